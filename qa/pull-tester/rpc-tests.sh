@@ -56,6 +56,8 @@ testScripts=(
   'zapwallettxes.py'
   'proxy_test.py'
   'merkle_blocks.py'
+  'txindex_compact.py'
+  'rpc_jsoncache.py'
   'fundrawtransaction.py'
   'signrawtransactions.py'
   'walletbackup.py'
@@ -64,8 +66,10 @@ testScripts=(
   'reindex.py'
   'decodescript.py'
   'disablewallet.py'
+  'multiwallet.py'
   'zcjoinsplit.py'
   'zcjoinsplitdoublespend.py'
+  'joinsplit_preverify.py'
   'zkey_import_export.py'
   'getblocktemplate.py'
   'bip65-cltv-p2p.py'
@@ -109,6 +113,7 @@ testScriptsExt=(
   'headers_09.py'
   'headers_10.py'
   'checkblockatheight.py'
+  'perf_scenarios.py'
 );
 
 if [ "x$ENABLE_ZMQ" = "x1" ]; then
@@ -23,7 +23,8 @@ class InvalidateTest(BitcoinTestFramework):
         self.is_network_split = False
         self.nodes.append(start_node(0, self.options.tmpdir, ["-debug"]))
         self.nodes.append(start_node(1, self.options.tmpdir, ["-debug"]))
-        self.nodes.append(start_node(2, self.options.tmpdir, ["-debug"]))
+        # Node 2 checks its block index and mempool by sampling, through the same reorgs
+        self.nodes.append(start_node(2, self.options.tmpdir, ["-debug", "-checkblockindexsample=10", "-checkmempoolsample=10"]))
 
     def run_test(self):
         print "Make sure we repopulate setBlockIndexCandidates after InvalidateBlock:"
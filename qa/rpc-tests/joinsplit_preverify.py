@@ -0,0 +1,186 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Zen Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the verification of the JoinSplit proofs of relayed transactions ahead
+# of cs_main: a transaction whose proof does not verify gets its peer banned,
+# is remembered as bad and not asked for again, a valid one is accepted.
+#
+
+from test_framework.mininode import CInv, CTxIn, CTxOut, NodeConn, NodeConnCB, \
+    NetworkThread, msg_inv, msg_ping, msg_pong, mininode_lock, deser_vector, hash256
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_true, initialize_chain_clean, \
+    start_nodes, connect_nodes_bi, sync_blocks, p2p_port, \
+    wait_and_assert_operationid_status
+
+from decimal import Decimal
+import cStringIO
+import time
+
+# The fields of a JSDescription ahead of its PHGR proof, and the proof itself
+JSDESCRIPTION_PROOF_OFFSET = 8 + 8 + 32 + 2 * 32 + 2 * 32 + 32 + 32 + 2 * 32
+PHGR_PROOF_SIZE = 7 * 33 + 65
+
+
+class msg_rawtx(object):
+    command = "tx"
+
+    def __init__(self, raw):
+        self.raw = raw
+
+    def serialize(self):
+        return self.raw
+
+    def __repr__(self):
+        return "msg_rawtx(%s)" % self.raw.encode('hex_codec')
+
+
+class TestNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+        self.ping_counter = 1
+        self.last_pong = msg_pong()
+        self.getdata_hashes = set()
+        self.closed = False
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def on_getdata(self, conn, message):
+        for inv in message.inv:
+            self.getdata_hashes.add(inv.hash)
+
+    def on_pong(self, conn, message):
+        self.last_pong = message
+
+    def on_close(self, conn):
+        self.closed = True
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+    def send_message(self, message):
+        self.connection.send_message(message)
+
+    def sync_with_ping(self, timeout=30):
+        self.connection.send_message(msg_ping(nonce=self.ping_counter))
+        received_pong = False
+        sleep_time = 0.05
+        while not received_pong and timeout > 0:
+            time.sleep(sleep_time)
+            timeout -= sleep_time
+            with mininode_lock:
+                if self.last_pong.nonce == self.ping_counter:
+                    received_pong = True
+        self.ping_counter += 1
+        return received_pong
+
+
+def proof_offset(raw):
+    """Offset of the proof of the first JoinSplit of a version 2 transaction"""
+    f = cStringIO.StringIO(raw)
+    f.read(4)
+    deser_vector(f, CTxIn)
+    deser_vector(f, CTxOut)
+    f.read(4)
+    assert_equal(ord(f.read(1)), 1)
+    return f.tell() + JSDESCRIPTION_PROOF_OFFSET
+
+
+def txid_of(raw):
+    return int(hash256(raw)[::-1].encode('hex_codec'), 16)
+
+
+class JoinSplitPreVerifyTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(2, self.options.tmpdir, [["-debug"]] * 2)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def connect_test_node(self):
+        test_node = TestNode()
+        conn = NodeConn('127.0.0.1', p2p_port(0), self.nodes[0], test_node)
+        test_node.add_connection(conn)
+        NetworkThread().start()
+        test_node.wait_for_verack()
+        return test_node
+
+    def shield_coinbase(self, zaddr):
+        result = self.nodes[1].z_shieldcoinbase("*", zaddr, Decimal('0.0001'), 1)
+        txid = wait_and_assert_operationid_status(self.nodes[1], result['opid'])
+        return self.nodes[1].getrawtransaction(txid).decode('hex_codec')
+
+    def run_test(self):
+        # PHGR proofs, below the height of the shielded fork on regtest
+        print "Mining blocks..."
+        self.nodes[1].generate(105)
+        sync_blocks(self.nodes)
+
+        # The transactions are made by node 1 and only reach node 0 from the test node
+        self.nodes[0].disconnectnode("127.0.0.1:" + str(p2p_port(1)))
+        for i in range(100):
+            if not self.nodes[0].getpeerinfo() and not self.nodes[1].getpeerinfo():
+                break
+            time.sleep(0.1)
+        assert_equal(self.nodes[0].getpeerinfo(), [])
+
+        zaddr = self.nodes[1].z_getnewaddress()
+        good = self.shield_coinbase(zaddr)
+        other = self.shield_coinbase(zaddr)
+
+        # A well formed proof, of another JoinSplit, does not verify
+        pos, other_pos = proof_offset(good), proof_offset(other)
+        bad = good[:pos] + other[other_pos:other_pos + PHGR_PROOF_SIZE] + good[pos + PHGR_PROOF_SIZE:]
+        assert_true(bad != good)
+        bad_txid = txid_of(bad)
+
+        print "Relaying a transaction whose proof does not verify..."
+        test_node = self.connect_test_node()
+        test_node.send_message(msg_rawtx(bad))
+        for i in range(100):
+            if self.nodes[0].listbanned():
+                break
+            time.sleep(0.1)
+        assert_equal(len(self.nodes[0].listbanned()), 1)
+        assert_equal(self.nodes[0].getrawmempool(), [])
+
+        print "Announcing it again..."
+        self.nodes[0].clearbanned()
+        test_node = self.connect_test_node()
+        good_txid = txid_of(good)
+        test_node.send_message(msg_inv([CInv(1, bad_txid), CInv(1, good_txid)]))
+        for i in range(100):
+            with mininode_lock:
+                if good_txid in test_node.getdata_hashes:
+                    break
+            time.sleep(0.1)
+        test_node.sync_with_ping()
+        with mininode_lock:
+            assert_true(good_txid in test_node.getdata_hashes, "the valid transaction was not asked for")
+            assert_true(bad_txid not in test_node.getdata_hashes, "the bad transaction was asked for again")
+
+        print "Relaying the valid transaction..."
+        test_node.send_message(msg_rawtx(good))
+        test_node.sync_with_ping()
+        assert_equal(self.nodes[0].getrawmempool(), ["%064x" % good_txid])
+        assert_equal(self.nodes[0].listbanned(), [])
+
+        print "Success"
+
+if __name__ == '__main__':
+    JoinSplitPreVerifyTest().main()
@@ -86,5 +86,15 @@ class MerkleBlockTest(BitcoinTestFramework):
         # ...or if we have a -txindex
         assert_equal(self.nodes[2].verifytxoutproof(self.nodes[3].gettxoutproof([txid_spent])), [txid_spent])
 
+        # Batches get a proof per block, in the order of their heights
+        txid3 = self.nodes[0].getblock(self.nodes[0].getbestblockhash(), True)["tx"][1]
+        proofs = self.nodes[3].gettxoutproofs([txid3, txid1, txid2])
+        assert_equal([proof["blockhash"] for proof in proofs], [blockhash, self.nodes[0].getbestblockhash()])
+        assert_equal(sorted(proofs[0]["txids"]), sorted(txlist))
+        assert_equal(proofs[1]["txids"], [txid3])
+        assert_equal(self.nodes[2].verifytxoutproofs([proof["proof"] for proof in proofs]), [txlist, [txid3]])
+        assert_equal(self.nodes[2].gettxoutproofs([txid1, txid2], blockhash)[0]["proof"], self.nodes[2].gettxoutproof([txid1, txid2], blockhash))
+        assert_raises(JSONRPCException, self.nodes[2].gettxoutproofs, [txid_spent])
+
 if __name__ == '__main__':
     MerkleBlockTest().main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Zen Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test several wallets loaded at once with -wallet, addressed through the
+# /wallet/<file> RPC endpoint.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import AuthServiceProxy, JSONRPCException
+from test_framework.util import assert_equal, initialize_chain_clean, start_nodes
+
+from decimal import Decimal
+
+
+class MultiWalletTest (BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(1, self.options.tmpdir, [['-wallet=w1', '-wallet=w2', '-wallet=w3']])
+        self.is_network_split = False
+
+    def wallet(self, name):
+        return AuthServiceProxy(self.nodes[0].url + "/wallet/" + name)
+
+    def run_test (self):
+        w1 = self.wallet("w1")
+        w2 = self.wallet("w2")
+        w3 = self.wallet("w3")
+
+        # The default endpoint is the first wallet
+        assert_equal(self.nodes[0].getnewaddress() in [a for a in w1.getaddressesbyaccount("")], True)
+
+        # Unknown wallets are refused
+        try:
+            self.wallet("wallet.dat").getbalance()
+            raise AssertionError("Unknown wallet accepted")
+        except JSONRPCException as e:
+            assert_equal(e.error['code'], -18)
+
+        # Each wallet has its own keys and coins
+        w1.generate(101)
+        assert_equal(w1.getbalance() > 0, True)
+        assert_equal(w2.getbalance(), 0)
+        assert_equal(w3.getbalance(), 0)
+
+        addr2 = w2.getnewaddress()
+        assert_equal(w1.validateaddress(addr2)['ismine'], False)
+        assert_equal(w2.validateaddress(addr2)['ismine'], True)
+
+        w1.sendtoaddress(addr2, Decimal('1.0'))
+        w1.generate(1)
+        assert_equal(w2.getbalance(), Decimal('1.0'))
+        assert_equal(w3.getbalance(), 0)
+
+        # Transactions signed through a wallet endpoint use that wallet's keys
+        addr3 = w3.getnewaddress()
+        w2.sendtoaddress(addr3, Decimal('0.5'))
+        w1.generate(1)
+        assert_equal(w3.getbalance(), Decimal('0.5'))
+
+if __name__ == '__main__':
+    MultiWalletTest ().main ()
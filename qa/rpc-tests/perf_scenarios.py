@@ -0,0 +1,325 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Zen Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Measure the throughput and latencies of a network of nodes, to compare
+# releases: block propagation, shielded transaction relay, a storm of forks,
+# reorgs of growing depth with the delay penalty, and RPC calls per second.
+# The results are printed and written as JSON to --results.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import AuthServiceProxy
+from test_framework.util import assert_equal, assert_true, initialize_chain_clean, \
+    start_nodes, connect_nodes, sync_blocks, sync_mempools, p2p_port, \
+    wait_and_assert_operationid_status
+
+from decimal import Decimal
+import json
+import os
+import random
+import threading
+import time
+
+# Mirrors PENALTY_THRESHOLD in src/zen/delay.h
+PENALTY_THRESHOLD = 5
+
+
+def stats(samples):
+    ordered = sorted(samples)
+    if not ordered:
+        return {"count": 0}
+    def percentile(p):
+        return ordered[min(len(ordered) - 1, int(p * len(ordered)))]
+    return {
+        "count": len(ordered),
+        "min": ordered[0],
+        "median": percentile(0.5),
+        "p90": percentile(0.9),
+        "p99": percentile(0.99),
+        "max": ordered[-1],
+        "mean": float(sum(ordered)) / len(ordered),
+    }
+
+
+def wait_until(predicate, timeout, poll=0.05):
+    """Seconds until predicate() holds, None if it did not within timeout"""
+    start = time.time()
+    while True:
+        if predicate():
+            return time.time() - start
+        if time.time() - start > timeout:
+            return None
+        time.sleep(poll)
+
+
+class PerfScenariosTest(BitcoinTestFramework):
+
+    def add_options(self, parser):
+        parser.add_option("--nodes", dest="num_nodes", type="int", default=6,
+                          help="Number of nodes, connected in a line (default: %default)")
+        parser.add_option("--results", dest="results", default=None,
+                          help="File the JSON results are written to (default: perf_results.json in the tmpdir)")
+        parser.add_option("--blocks", dest="blocks", type="int", default=20,
+                          help="Blocks mined to measure their propagation (default: %default)")
+        parser.add_option("--shieldedtxs", dest="shielded_txs", type="int", default=3,
+                          help="Shielded transactions created to measure their relay (default: %default)")
+        parser.add_option("--reorgdepths", dest="reorg_depths", default="1,3,6,10",
+                          help="Comma separated depths of the reorgs (default: %default)")
+        parser.add_option("--rpcseconds", dest="rpc_seconds", type="int", default=10,
+                          help="Seconds the RPC interface is loaded for (default: %default)")
+        parser.add_option("--rpcclients", dest="rpc_clients", type="int", default=8,
+                          help="Concurrent RPC clients (default: %default)")
+        parser.add_option("--timeout", dest="timeout", type="int", default=120,
+                          help="Seconds a scenario step may take before it is reported as not converged (default: %default)")
+
+    def setup_chain(self):
+        assert_true(self.options.num_nodes >= 4, "At least 4 nodes are needed")
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, self.options.num_nodes)
+
+    def setup_network(self, split=False):
+        self.num_nodes = self.options.num_nodes
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir,
+                                 [["-txindex", "-debug=forks"]] * self.num_nodes)
+        # A line, so that blocks and transactions cross every hop
+        self.edges = [(i, i + 1) for i in range(self.num_nodes - 1)]
+        for a, b in self.edges:
+            self.connect(a, b)
+        self.is_network_split = False
+        self.sync_all()
+
+    def connect(self, a, b):
+        connect_nodes(self.nodes[a], b)
+        connect_nodes(self.nodes[b], a)
+
+    def disconnect(self, a, b):
+        for x, y in [(a, b), (b, a)]:
+            try:
+                self.nodes[x].disconnectnode("127.0.0.1:" + str(p2p_port(y)))
+            except Exception:
+                pass # The other side already dropped the connection
+        for x in [a, b]:
+            assert_true(wait_until(lambda: self.peers_of(x).isdisjoint([a, b]), self.options.timeout) is not None,
+                        "nodes %d and %d did not disconnect" % (a, b))
+
+    def peers_of(self, i):
+        """The nodes i has an outbound connection to, found by their p2p ports"""
+        ports = dict((p2p_port(n), n) for n in range(self.num_nodes))
+        peers = set()
+        for peer in self.nodes[i].getpeerinfo():
+            port = int(peer["addr"].rsplit(":", 1)[1])
+            if port in ports:
+                peers.add(ports[port])
+        return peers
+
+    def tips(self, nodes=None):
+        return [self.nodes[i].getbestblockhash() for i in (nodes if nodes is not None else range(self.num_nodes))]
+
+    def wait_for_tip(self, tip, nodes=None, timeout=None):
+        return wait_until(lambda: all(t == tip for t in self.tips(nodes)),
+                          timeout if timeout is not None else self.options.timeout)
+
+    def block_propagation(self):
+        """Seconds from a block being mined on node 0 to it being the tip of every node"""
+        samples = []
+        for i in range(self.options.blocks):
+            tip = self.nodes[0].generate(1)[0]
+            elapsed = self.wait_for_tip(tip)
+            assert_true(elapsed is not None, "block %s did not propagate" % tip)
+            samples.append(elapsed)
+        return {"hops": self.num_nodes - 1, "seconds": stats(samples)}
+
+    def shielded_relay(self):
+        """Seconds to create shielded transactions on node 0, and to relay them to every mempool"""
+        zaddr = self.nodes[-1].z_getnewaddress()
+        create, relay, sizes = [], [], []
+        for i in range(self.options.shielded_txs):
+            start = time.time()
+            result = self.nodes[0].z_shieldcoinbase("*", zaddr, Decimal('0.0001'), 1)
+            txid = wait_and_assert_operationid_status(self.nodes[0], result['opid'])
+            created = time.time()
+            elapsed = wait_until(lambda: all(txid in n.getrawmempool() for n in self.nodes), self.options.timeout)
+            assert_true(elapsed is not None, "transaction %s was not relayed" % txid)
+            create.append(created - start)
+            relay.append(elapsed)
+            sizes.append(len(self.nodes[0].getrawtransaction(txid)) // 2)
+        self.nodes[0].generate(1)
+        self.sync_all()
+        total_relay = sum(relay)
+        return {
+            "create_seconds": stats(create),
+            "relay_seconds": stats(relay),
+            "tx_bytes": stats(sizes),
+            "relayed_per_second": len(relay) / total_relay if total_relay > 0 else None,
+        }
+
+    def fork_storm(self):
+        """
+        Every node mines its own fork in isolation, then they are all connected
+        at once. The forks stay within the penalty threshold of each other, the
+        last node's is the one longest.
+        """
+        for a, b in self.edges:
+            self.disconnect(a, b)
+        base_height = self.nodes[0].getblockcount()
+        lengths = [min(i, PENALTY_THRESHOLD - 1) + 1 for i in range(self.num_nodes - 1)] + [PENALTY_THRESHOLD + 1]
+        for i in range(self.num_nodes):
+            self.nodes[i].generate(lengths[i])
+        winner = self.nodes[-1].getbestblockhash()
+
+        start = time.time()
+        for a, b in self.edges:
+            self.connect(a, b)
+        elapsed = self.wait_for_tip(winner)
+        result = {
+            "forks": self.num_nodes,
+            "longest_fork": lengths[-1],
+            "converged": elapsed is not None,
+            "seconds": time.time() - start if elapsed is not None else None,
+            "chain_tips": [len(n.getchaintips()) for n in self.nodes],
+        }
+        assert_true(result["converged"], "the nodes did not settle on the longest fork")
+        assert_equal(self.nodes[0].getblockcount(), base_height + lengths[-1])
+        return result
+
+    def reorg_recovery(self, depth):
+        """
+        The two halves of the line mine depth and depth + 1 blocks apart, and
+        are joined. Past the penalty threshold the longer fork, which comes
+        late, is penalised and has to be mined on until it wins over.
+        """
+        half = self.num_nodes // 2
+        left, right = range(half), range(half, self.num_nodes)
+        self.disconnect(half - 1, half)
+        self.nodes[left[0]].generate(depth)
+        self.nodes[right[0]].generate(depth + 1)
+        sync_blocks([self.nodes[i] for i in left])
+        sync_blocks([self.nodes[i] for i in right])
+
+        start = time.time()
+        self.connect(half - 1, half)
+        extra_blocks = 0
+        max_extra_blocks = 3 * depth + PENALTY_THRESHOLD + 10
+        # Joined, the right half either wins right away or pays the penalty block by block
+        settle = min(self.options.timeout, 5)
+        while True:
+            tip = self.nodes[right[0]].getbestblockhash()
+            if self.wait_for_tip(tip, timeout=settle) is not None:
+                converged = True
+                break
+            if extra_blocks >= max_extra_blocks:
+                converged = False
+                break
+            self.nodes[right[0]].generate(1)
+            extra_blocks += 1
+        result = {
+            "depth": depth,
+            "converged": converged,
+            "extra_blocks": extra_blocks,
+            "penalised": extra_blocks > 0,
+            "seconds": time.time() - start,
+        }
+        assert_true(converged, "reorg of depth %d did not converge" % depth)
+        return result
+
+    def rpc_load(self):
+        """Calls per second and latencies of concurrent read-only RPC clients on node 0"""
+        node = self.nodes[0]
+        height = node.getblockcount()
+        hashes = [node.getblockhash(h) for h in range(max(1, height - 50), height + 1)]
+        txids = []
+        for blockhash in hashes:
+            txids += node.getblock(blockhash)["tx"]
+
+        calls = [
+            ("getblockcount", lambda proxy: proxy.getblockcount()),
+            ("getbestblockhash", lambda proxy: proxy.getbestblockhash()),
+            ("getblock", lambda proxy: proxy.getblock(random.choice(hashes))),
+            ("getrawtransaction", lambda proxy: proxy.getrawtransaction(random.choice(txids), 1)),
+        ]
+        latencies = dict((name, []) for name, _ in calls)
+        errors = [0]
+        lock = threading.Lock()
+        deadline = time.time() + self.options.rpc_seconds
+
+        def client():
+            proxy = AuthServiceProxy(node.url, timeout=60)
+            mine = dict((name, []) for name, _ in calls)
+            failed = 0
+            while time.time() < deadline:
+                name, call = random.choice(calls)
+                start = time.time()
+                try:
+                    call(proxy)
+                except Exception:
+                    failed += 1
+                    proxy = AuthServiceProxy(node.url, timeout=60)
+                    continue
+                mine[name].append(time.time() - start)
+            with lock:
+                for name in mine:
+                    latencies[name] += mine[name]
+                errors[0] += failed
+
+        start = time.time()
+        threads = [threading.Thread(target=client) for i in range(self.options.rpc_clients)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.time() - start
+
+        total = sum(len(l) for l in latencies.values())
+        assert_true(total > 0, "no RPC call completed")
+        return {
+            "clients": self.options.rpc_clients,
+            "seconds": elapsed,
+            "calls": total,
+            "errors": errors[0],
+            "calls_per_second": total / elapsed,
+            "latency_seconds": dict((name, stats(l)) for name, l in latencies.items()),
+        }
+
+    def run_test(self):
+        results = {
+            "subversion": self.nodes[0].getnetworkinfo()["subversion"],
+            "nodes": self.num_nodes,
+            "topology": "line",
+            "scenarios": {},
+        }
+        scenarios = results["scenarios"]
+
+        print "Mining blocks..."
+        # Coinbases for node 0 to shield, matured by the blocks of the others
+        self.nodes[0].generate(self.options.shielded_txs + 5)
+        self.sync_all()
+        self.nodes[1].generate(101)
+        self.sync_all()
+
+        print "Block propagation..."
+        scenarios["block_propagation"] = self.block_propagation()
+
+        print "Shielded transaction relay..."
+        scenarios["shielded_relay"] = self.shielded_relay()
+
+        print "Fork storm..."
+        scenarios["fork_storm"] = self.fork_storm()
+
+        print "Reorg recovery..."
+        scenarios["reorg_recovery"] = [self.reorg_recovery(int(d)) for d in self.options.reorg_depths.split(",")]
+        sync_mempools(self.nodes)
+
+        print "RPC load..."
+        scenarios["rpc_load"] = self.rpc_load()
+
+        results_file = self.options.results or os.path.join(self.options.tmpdir, "perf_results.json")
+        with open(results_file, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print json.dumps(results, indent=2, sort_keys=True)
+        print "Results written to " + results_file
+
+if __name__ == '__main__':
+    PerfScenariosTest().main()
@@ -291,6 +291,24 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(response_header_json_str)
         assert_equal(len(json_obj), 5) # now we should have 5 header objects
 
+        # block hashes and raw blocks by height
+        bb_height = self.nodes[0].getblock(bb_hash)['height']
+        json_string = http_get_call(url.hostname, url.port, '/rest/blockhashesbyheight/'+str(bb_height)+'/3'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj, [self.nodes[0].getblockhash(bb_height + i) for i in range(3)])
+
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(bb_height)+'/2'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        response_blocks_str = response.read()
+        first_block_str = http_get_call(url.hostname, url.port, '/rest/block/'+bb_hash+self.FORMAT_SEPARATOR+'bin')
+        second_block_str = http_get_call(url.hostname, url.port, '/rest/block/'+json_obj[1]+self.FORMAT_SEPARATOR+'bin')
+        assert_equal(response_blocks_str, first_block_str + second_block_str)
+
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(bb_height)+'/0'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(bb_height)+'/1'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+
         # do tx test
         tx_hash = block_json_obj['tx'][0]['txid'];
         json_string = http_get_call(url.hostname, url.port, '/rest/tx/'+tx_hash+self.FORMAT_SEPARATOR+"json")
@@ -0,0 +1,67 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Zen Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that the JSON cache of getblock and getrawtransaction follows the chain
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, initialize_chain_clean, \
+    start_nodes, connect_nodes_bi, sync_blocks
+
+
+class RPCJSONCacheTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir, [
+            ["-debug", "-txindex"],
+            ["-debug", "-txindex", "-rpcjsoncache=0"]])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def check_same(self, blockhash, txid):
+        for verbosity in [1, 2]:
+            assert_equal(self.nodes[0].getblock(blockhash, verbosity), self.nodes[1].getblock(blockhash, verbosity))
+        assert_equal(self.nodes[0].getrawtransaction(txid, 1), self.nodes[1].getrawtransaction(txid, 1))
+
+    def run_test(self):
+        print "Mining blocks..."
+        self.nodes[0].generate(101)
+        self.sync_all()
+        txid = self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 1)
+        self.sync_all()
+        blockhash = self.nodes[0].generate(1)[0]
+        self.sync_all()
+
+        # Rendered once, then served from the cache as the chain grows
+        self.check_same(blockhash, txid)
+        assert_equal(self.nodes[0].getblock(blockhash)["confirmations"], 1)
+        assert("nextblockhash" not in self.nodes[0].getblock(blockhash))
+        self.nodes[0].generate(1)
+        self.sync_all()
+        self.check_same(blockhash, txid)
+        assert_equal(self.nodes[0].getblock(blockhash)["confirmations"], 2)
+        assert_equal(self.nodes[0].getrawtransaction(txid, 1)["confirmations"], 2)
+        assert("nextblockhash" in self.nodes[0].getblock(blockhash))
+
+        # A block a reorg disconnects is not served from the cache
+        self.nodes[0].invalidateblock(blockhash)
+        self.nodes[1].invalidateblock(blockhash)
+        assert_equal(self.nodes[0].getblock(blockhash)["confirmations"], -1)
+        self.check_same(blockhash, txid)
+        self.nodes[0].generate(1)
+        sync_blocks(self.nodes)
+        self.check_same(self.nodes[0].getbestblockhash(), txid)
+        assert_equal(self.nodes[0].getrawtransaction(txid, 1)["blockhash"], self.nodes[0].getbestblockhash())
+
+        print "Success"
+
+if __name__ == '__main__':
+    RPCJSONCacheTest().main()
@@ -0,0 +1,73 @@
+#!/usr/bin/env python2
+# Copyright (c) 2018 The Zen Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test -compacttxindex lookups against the full -txindex, and getrawtransactions
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, initialize_chain_clean, \
+    start_nodes, connect_nodes_bi, sync_blocks
+
+
+class TxIndexCompactTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = start_nodes(2, self.options.tmpdir, [
+            ["-debug", "-txindex"],
+            ["-debug", "-txindex", "-compacttxindex"]])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        print "Mining blocks..."
+        self.nodes[0].generate(110)
+        self.sync_all()
+
+        txids = []
+        for i in range(10):
+            txids.append(self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 1))
+        self.sync_all()
+        self.nodes[0].generate(1)
+        self.sync_all()
+
+        # The coinbases of spent and unspent outputs alike, and the transactions just mined
+        txids += [self.nodes[0].getblock(self.nodes[0].getblockhash(h))["tx"][0] for h in range(1, 111, 7)]
+        for txid in txids:
+            assert_equal(self.nodes[1].getrawtransaction(txid), self.nodes[0].getrawtransaction(txid))
+
+        # In the order asked, with the mempool and unknown transactions
+        mempool_txid = self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 1)
+        self.sync_all()
+        unknown_txid = "00" * 32
+        query = list(reversed(txids)) + [mempool_txid, unknown_txid]
+        expected = [self.nodes[0].getrawtransaction(txid) for txid in query[:-1]] + [None]
+        assert_equal(self.nodes[0].getrawtransactions(query), expected)
+        assert_equal(self.nodes[1].getrawtransactions(query), expected)
+        verbose = self.nodes[1].getrawtransactions(query, 1)
+        assert_equal([entry["txid"] for entry in verbose[:-1]], query[:-1])
+        assert_equal(verbose[-1], None)
+
+        # After a reorg the entries of the disconnected block no longer match
+        # the block now at its height, the transactions are found again once mined
+        tip = self.nodes[1].getbestblockhash()
+        self.nodes[1].invalidateblock(tip)
+        self.nodes[1].generate(2)
+        self.nodes[0].generate(1)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[0].getbestblockhash(), self.nodes[1].getbestblockhash())
+        for txid in txids[:10] + [mempool_txid]:
+            assert_equal(self.nodes[1].getrawtransaction(txid), self.nodes[0].getrawtransaction(txid))
+        assert_equal(self.nodes[1].getrawtransactions(query), self.nodes[0].getrawtransactions(query))
+
+        print "Success"
+
+if __name__ == '__main__':
+    TxIndexCompactTest().main()
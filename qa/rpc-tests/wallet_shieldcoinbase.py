@@ -226,5 +226,18 @@ class WalletShieldCoinbaseTest (BitcoinTestFramework):
         self.nodes[1].generate(1)
         self.sync_all()
 
+        # Verify that the remaining utxos can be shielded in one call, over several transactions
+        result = self.nodes[0].z_shieldcoinbase(mytaddr, myzaddr, Decimal('0.0001'), 5, 0)
+        assert_equal(result["shieldingUTXOs"], Decimal('17'))
+        assert_equal(result["remainingUTXOs"], Decimal('0'))
+        assert_equal(len(result["opids"]), 4)
+        assert_equal(result["opid"], result["opids"][0])
+        for opid in result["opids"]:
+            self.wait_and_assert_operationid_status(0, opid)
+        sync_blocks(self.nodes[:2])
+        sync_mempools(self.nodes[:2])
+        self.nodes[1].generate(1)
+        self.sync_all()
+
 if __name__ == '__main__':
     WalletShieldCoinbaseTest().main()
@@ -0,0 +1,47 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "pubkey.h"
+#include "script/script.h"
+
+bool GetAddressIndexHash(const CTxDestination& dest, uint8_t& type, uint160& hash)
+{
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        type = ADDRESS_TYPE_PUBKEYHASH;
+        hash = *keyID;
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        type = ADDRESS_TYPE_SCRIPTHASH;
+        hash = *scriptID;
+        return true;
+    }
+    type = ADDRESS_TYPE_NONE;
+    return false;
+}
+
+bool GetAddressIndexHash(const CScript& scriptPubKey, uint8_t& type, uint160& hash)
+{
+    // Also matches the replay protected templates, which end in OP_CHECKBLOCKATHEIGHT
+    CTxDestination dest;
+    if (!ExtractDestination(scriptPubKey, dest)) {
+        type = ADDRESS_TYPE_NONE;
+        return false;
+    }
+    return GetAddressIndexHash(dest, type, hash);
+}
+
+CTxDestination GetAddressIndexDestination(uint8_t type, const uint160& hash)
+{
+    switch (type) {
+    case ADDRESS_TYPE_PUBKEYHASH:
+        return CKeyID(hash);
+    case ADDRESS_TYPE_SCRIPTHASH:
+        return CScriptID(hash);
+    default:
+        return CNoDestination();
+    }
+}
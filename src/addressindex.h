@@ -0,0 +1,167 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "script/standard.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <stdint.h>
+
+class CScript;
+
+/** Kinds of address the address and spent indexes know about */
+enum AddressIndexType
+{
+    ADDRESS_TYPE_NONE = 0,
+    ADDRESS_TYPE_PUBKEYHASH = 1,
+    ADDRESS_TYPE_SCRIPTHASH = 2,
+};
+
+/** Get the index type and hash of a destination; false if it has none */
+bool GetAddressIndexHash(const CTxDestination& dest, uint8_t& type, uint160& hash);
+/** Get the index type and hash of the address a scriptPubKey pays to; false if it pays to none */
+bool GetAddressIndexHash(const CScript& scriptPubKey, uint8_t& type, uint160& hash);
+/** Turn an index type and hash back into a destination */
+CTxDestination GetAddressIndexDestination(uint8_t type, const uint160& hash);
+
+/**
+ * Key of an address index entry: an output paid to an address, or an input
+ * spending one. The value is the amount, negative for spends.
+ *
+ * Heights and positions are stored big-endian so that the entries of an
+ * address are kept in chain order by the database.
+ */
+struct CAddressIndexKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+    int blockHeight;
+    //! Position of the transaction in its block
+    uint32_t txIndex;
+    uint256 txhash;
+    //! Output index, or input index for spends
+    uint32_t index;
+    bool spending;
+
+    CAddressIndexKey() : type(ADDRESS_TYPE_NONE), blockHeight(0), txIndex(0), index(0), spending(false) {}
+    CAddressIndexKey(uint8_t typeIn, const uint160& hashIn, int heightIn, uint32_t txIndexIn,
+                     const uint256& txhashIn, uint32_t indexIn, bool spendingIn) :
+        type(typeIn), hashBytes(hashIn), blockHeight(heightIn), txIndex(txIndexIn),
+        txhash(txhashIn), index(indexIn), spending(spendingIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 1 + 20 + 4 + 4 + 32 + 4 + 1;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txIndex);
+        txhash.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, index);
+        ser_writedata8(s, spending);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s, nType, nVersion);
+        blockHeight = ser_readdata32be(s);
+        txIndex = ser_readdata32be(s);
+        txhash.Unserialize(s, nType, nVersion);
+        index = ser_readdata32be(s);
+        spending = ser_readdata8(s) != 0;
+    }
+};
+
+/** Key of a spent index entry: the output that was spent */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    uint32_t outputIndex;
+
+    CSpentIndexKey() : outputIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, uint32_t outputIndexIn) : txid(txidIn), outputIndex(outputIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(outputIndex);
+    }
+};
+
+/** Where an output was spent, and what it held */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    uint32_t inputIndex;
+    //! Height of the block the spent output was created in
+    int blockHeight;
+    CAmount satoshis;
+    uint8_t addressType;
+    uint160 addressHash;
+
+    CSpentIndexValue() : inputIndex(0), blockHeight(0), satoshis(0), addressType(ADDRESS_TYPE_NONE) {}
+    CSpentIndexValue(const uint256& txidIn, uint32_t inputIndexIn, int heightIn, CAmount satoshisIn,
+                     uint8_t addressTypeIn, const uint160& addressHashIn) :
+        txid(txidIn), inputIndex(inputIndexIn), blockHeight(heightIn), satoshis(satoshisIn),
+        addressType(addressTypeIn), addressHash(addressHashIn) {}
+
+    //! A null value erases the entry of its key
+    bool IsNull() const { return txid.IsNull(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(inputIndex);
+        READWRITE(blockHeight);
+        READWRITE(satoshis);
+        READWRITE(addressType);
+        READWRITE(addressHash);
+    }
+};
+
+/** Key of a timestamp index entry, ordered by block time */
+struct CTimestampIndexKey
+{
+    uint32_t timestamp;
+    uint256 blockHash;
+
+    CTimestampIndexKey() : timestamp(0) {}
+    CTimestampIndexKey(uint32_t timestampIn, const uint256& blockHashIn) : timestamp(timestampIn), blockHash(blockHashIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 4 + 32;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ser_writedata32be(s, timestamp);
+        blockHash.Serialize(s, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        timestamp = ser_readdata32be(s);
+        blockHash.Unserialize(s, nType, nVersion);
+    }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
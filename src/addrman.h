@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ADDRMAN_H
 #define BITCOIN_ADDRMAN_H
 
+#include "flatmap.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -12,7 +13,6 @@
 #include "timedata.h"
 #include "util.h"
 
-#include <map>
 #include <set>
 #include <stdint.h>
 #include <vector>
@@ -166,6 +166,28 @@ public:
 //! the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+/** Hash of an nId: they are handed out one after the other, so they spread evenly as they are */
+class CAddrIdHasher
+{
+public:
+    size_t operator()(int nId) const { return nId; }
+};
+
+/** Salted hash of a network address, as peers choose the addresses they relay */
+class CNetAddrHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CNetAddrHasher();
+
+    size_t operator()(const CNetAddr& addr) const;
+};
+
+typedef flatmap<int, CAddrInfo, CAddrIdHasher> CAddrInfoMap;
+typedef flatmap<CNetAddr, int, CNetAddrHasher> CAddrIdMap;
+
 /** 
  * Stochastical (IP) address manager 
  */
@@ -178,11 +200,11 @@ private:
     //! last used nId
     int nIdCount;
 
-    //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    //! table with information about all nIds, stored inline (see flatmap.h)
+    CAddrInfoMap mapInfo;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    CAddrIdMap mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -292,9 +314,9 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        flatmap<int, int, CAddrIdHasher> mapUnkIds;
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        for (CAddrInfoMap::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
             mapUnkIds[(*it).first] = nIds;
             const CAddrInfo &info = (*it).second;
             if (info.nRefCount) {
@@ -304,7 +326,7 @@ public:
             }
         }
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        for (CAddrInfoMap::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
             const CAddrInfo &info = (*it).second;
             if (info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
@@ -418,9 +440,9 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
+        for (CAddrInfoMap::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
             if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
+                CAddrInfoMap::const_iterator itCopy = it++;
                 Delete(itCopy->first);
                 nLostUnk++;
             } else {
@@ -475,6 +497,14 @@ public:
         return vRandom.size();
     }
 
+    //! Memory used by the tables, including the buckets held in place.
+    size_t DynamicMemoryUsage() const
+    {
+        LOCK(cs);
+        return memusage::DynamicUsage(mapInfo) + memusage::DynamicUsage(mapAddr) + memusage::DynamicUsage(vRandom) +
+               sizeof(vvTried) + sizeof(vvNew);
+    }
+
     //! Consistency check
     void Check()
     {
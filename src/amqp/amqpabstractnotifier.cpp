@@ -10,12 +10,17 @@ AMQPAbstractNotifier::~AMQPAbstractNotifier()
 {
 }
 
-bool AMQPAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/)
+bool AMQPAbstractNotifier::NotifyBlock(const CNotification &/*block*/)
 {
     return true;
 }
 
-bool AMQPAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/)
+bool AMQPAbstractNotifier::NotifyTransaction(const CNotification &/*transaction*/)
+{
+    return true;
+}
+
+bool AMQPAbstractNotifier::NotifyMempool(const CNotification &/*event*/)
 {
     return true;
 }
@@ -7,7 +7,7 @@
 
 #include "amqpconfig.h"
 
-class CBlockIndex;
+struct CNotification;
 class AMQPAbstractNotifier;
 
 typedef AMQPAbstractNotifier* (*AMQPNotifierFactory)();
@@ -32,8 +32,9 @@ public:
     virtual bool Initialize() = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyBlock(const CNotification &block);
+    virtual bool NotifyTransaction(const CNotification &transaction);
+    virtual bool NotifyMempool(const CNotification &event);
 
 protected:
     std::string type;
@@ -5,23 +5,12 @@
 #include "amqpnotificationinterface.h"
 #include "amqppublishnotifier.h"
 
-#include "version.h"
-#include "main.h"
-#include "streams.h"
 #include "util.h"
 
 // AMQP 1.0 Support
 //
-// The boost::signals2 signals and slot system is thread safe, so CValidationInterface listeners
-// can be invoked from any thread.
-//
-// Currently signals are fired from main.cpp so the callbacks should be invoked on the same thread.
-// It should be safe to share objects responsible for sending, as they should not be run concurrently
-// across different threads.
-//
-// Developers should be mindful of where notifications are fired to avoid potential race conditions.
-// For example, different signals targeting the same address could be fired from different threads
-// in different parts of the system around the same time.
+// Notifications are published by the CNotificationDispatcher thread only, so the objects
+// responsible for sending can be shared between notifiers without running concurrently.
 //
 // Like the ZMQ notification interface, if a notifier fails to send a message, the notifier is shut down.
 //
@@ -49,6 +38,7 @@ AMQPNotificationInterface* AMQPNotificationInterface::CreateWithArguments(const
     factories["pubhashtx"] = AMQPAbstractNotifier::Create<AMQPPublishHashTransactionNotifier>;
     factories["pubrawblock"] = AMQPAbstractNotifier::Create<AMQPPublishRawBlockNotifier>;
     factories["pubrawtx"] = AMQPAbstractNotifier::Create<AMQPPublishRawTransactionNotifier>;
+    factories["pubmempoolsequence"] = AMQPAbstractNotifier::Create<AMQPPublishMempoolSequenceNotifier>;
 
     for (std::map<std::string, AMQPNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i) {
         std::map<std::string, std::string>::const_iterator j = args.find("-amqp" + i->first);
@@ -109,24 +99,53 @@ void AMQPNotificationInterface::Shutdown()
     }
 }
 
-void AMQPNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+bool AMQPNotificationInterface::WantsRawBlocks() const
 {
-    for (std::list<AMQPAbstractNotifier*>::iterator i = notifiers.begin(); i != notifiers.end(); ) {
-        AMQPAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex)) {
-            i++;
-        } else {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
+    for (std::list<AMQPAbstractNotifier*>::const_iterator i = notifiers.begin(); i != notifiers.end(); ++i) {
+        if ((*i)->GetType() == "pubrawblock")
+            return true;
+    }
+    return false;
+}
+
+bool AMQPNotificationInterface::WantsRawTransactions() const
+{
+    for (std::list<AMQPAbstractNotifier*>::const_iterator i = notifiers.begin(); i != notifiers.end(); ++i) {
+        if ((*i)->GetType() == "pubrawtx")
+            return true;
+    }
+    return false;
+}
+
+bool AMQPNotificationInterface::WantsMempoolEvents() const
+{
+    for (std::list<AMQPAbstractNotifier*>::const_iterator i = notifiers.begin(); i != notifiers.end(); ++i) {
+        if ((*i)->GetType() == "pubmempoolsequence")
+            return true;
+    }
+    return false;
+}
+
+static bool Notify(AMQPAbstractNotifier *notifier, const CNotification &notification)
+{
+    switch (notification.type) {
+    case NOTIFY_BLOCK:
+        return notifier->NotifyBlock(notification);
+    case NOTIFY_MEMPOOL:
+        return notifier->NotifyMempool(notification);
+    default:
+        return notifier->NotifyTransaction(notification);
     }
 }
 
-void AMQPNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+void AMQPNotificationInterface::Publish(const std::vector<CNotification> &vNotifications)
 {
     for (std::list<AMQPAbstractNotifier*>::iterator i = notifiers.begin(); i != notifiers.end(); ) {
         AMQPAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx)) {
+        bool fOk = true;
+        for (std::vector<CNotification>::const_iterator it = vNotifications.begin(); fOk && it != vNotifications.end(); ++it)
+            fOk = Notify(notifier, *it);
+        if (fOk) {
             i++;
         } else {
             notifier->Shutdown();
@@ -5,14 +5,13 @@
 #ifndef ZCASH_AMQP_AMQPNOTIFICATIONINTERFACE_H
 #define ZCASH_AMQP_AMQPNOTIFICATIONINTERFACE_H
 
-#include "validationinterface.h"
+#include "notificationdispatcher.h"
 #include <string>
 #include <map>
 
-class CBlockIndex;
 class AMQPAbstractNotifier;
 
-class AMQPNotificationInterface : public CValidationInterface
+class AMQPNotificationInterface : public CNotificationPublisher
 {
 public:
     virtual ~AMQPNotificationInterface();
@@ -23,9 +22,11 @@ protected:
     bool Initialize();
     void Shutdown();
 
-    // CValidationInterface
-    void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
-    void UpdatedBlockTip(const CBlockIndex *pindex);
+    // CNotificationPublisher
+    bool WantsRawBlocks() const;
+    bool WantsRawTransactions() const;
+    bool WantsMempoolEvents() const;
+    void Publish(const std::vector<CNotification> &vNotifications);
 
 private:
     AMQPNotificationInterface();
@@ -3,7 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amqppublishnotifier.h"
-#include "main.h"
+#include "notificationdispatcher.h"
 #include "util.h"
 
 #include "amqpsender.h"
@@ -17,6 +17,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_MEMPOOLSEQUENCE = "mempoolsequence";
 
 // Invoke this method from a new thread to run the proton container event loop.
 void AMQPAbstractPublishNotifier::SpawnProtonContainer()
@@ -128,50 +129,48 @@ bool AMQPAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
-bool AMQPPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool AMQPPublishHashBlockNotifier::NotifyBlock(const CNotification &block)
 {
-    uint256 hash = pindex->GetBlockHash();
-    LogPrint("amqp", "amqp: Publish hashblock %s\n", hash.GetHex());
+    LogPrint("amqp", "amqp: Publish hashblock %s\n", block.hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
+        data[31 - i] = block.hash.begin()[i];
     return SendMessage(MSG_HASHBLOCK, data, 32);
 }
 
-bool AMQPPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool AMQPPublishHashTransactionNotifier::NotifyTransaction(const CNotification &transaction)
 {
-    uint256 hash = transaction.GetHash();
-    LogPrint("amqp", "amqp: Publish hashtx %s\n", hash.GetHex());
+    LogPrint("amqp", "amqp: Publish hashtx %s\n", transaction.hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
+        data[31 - i] = transaction.hash.begin()[i];
     return SendMessage(MSG_HASHTX, data, 32);
 }
 
-bool AMQPPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool AMQPPublishRawBlockNotifier::NotifyBlock(const CNotification &block)
 {
-    LogPrint("amqp", "amqp: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
-
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex)) {
-            LogPrint("amqp", "amqp: Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+    LogPrint("amqp", "amqp: Publish rawblock %s\n", block.hash.GetHex());
+    if (!block.raw) {
+        LogPrint("amqp", "amqp: Block not available on disk\n");
+        return false;
     }
+    return SendMessage(MSG_RAWBLOCK, block.raw->data(), block.raw->size());
+}
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+bool AMQPPublishRawTransactionNotifier::NotifyTransaction(const CNotification &transaction)
+{
+    LogPrint("amqp", "amqp: Publish rawtx %s\n", transaction.hash.GetHex());
+    return SendMessage(MSG_RAWTX, transaction.raw->data(), transaction.raw->size());
 }
 
-bool AMQPPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool AMQPPublishMempoolSequenceNotifier::NotifyMempool(const CNotification &event)
 {
-    uint256 hash = transaction.GetHash();
-    LogPrint("amqp", "amqp: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    LogPrint("amqp", "amqp: Publish mempoolsequence %s %c %u\n", event.hash.GetHex(), event.chMempoolEvent, event.nMempoolSequence);
+    /* txid as in hashtx, the event label and a LE 8byte mempool sequence number */
+    unsigned char data[32 + 1 + sizeof(uint64_t)];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = event.hash.begin()[i];
+    data[32] = event.chMempoolEvent;
+    WriteLE64(&data[33], event.nMempoolSequence);
+    return SendMessage(MSG_MEMPOOLSEQUENCE, data, sizeof(data));
 }
@@ -12,8 +12,6 @@
 #include <memory>
 #include <thread>
 
-class CBlockIndex;
-
 class AMQPAbstractPublishNotifier : public AMQPAbstractNotifier
 {
 private:
@@ -32,25 +30,31 @@ public:
 class AMQPPublishHashBlockNotifier : public AMQPAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CNotification &block);
 };
 
 class AMQPPublishHashTransactionNotifier : public AMQPAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CNotification &transaction);
 };
 
 class AMQPPublishRawBlockNotifier : public AMQPAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CNotification &block);
 };
 
 class AMQPPublishRawTransactionNotifier : public AMQPAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CNotification &transaction);
+};
+
+class AMQPPublishMempoolSequenceNotifier : public AMQPAbstractPublishNotifier
+{
+public:
+    bool NotifyMempool(const CNotification &event);
 };
 
 #endif // ZCASH_AMQP_AMQPPUBLISHNOTIFIER_H
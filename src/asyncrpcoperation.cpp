@@ -24,10 +24,15 @@ std::map<OperationStatus, std::string> OperationStatusMap = {
     {OperationStatus::SUCCESS, "success"}
 };
 
+std::map<OperationPriority, std::string> OperationPriorityMap = {
+    {OperationPriority::NORMAL, "normal"},
+    {OperationPriority::LOW, "low"}
+};
+
 /**
  * Every operation instance should have a globally unique id
  */
-AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_() {
+AsyncRPCOperation::AsyncRPCOperation() : error_code_(0), error_message_(), priority_(OperationPriority::NORMAL) {
     // Set a unique reference for each operation
     boost::uuids::uuid uuid = uuidgen();
     id_ = "opid-" + boost::uuids::to_string(uuid);
@@ -39,7 +44,7 @@ AsyncRPCOperation::AsyncRPCOperation(const AsyncRPCOperation& o) :
         id_(o.id_), creation_time_(o.creation_time_), state_(o.state_.load()),
         start_time_(o.start_time_), end_time_(o.end_time_),
         error_code_(o.error_code_), error_message_(o.error_message_),
-        result_(o.result_)
+        result_(o.result_), priority_(o.priority_), joinsplit_secs_(o.joinsplit_secs_)
 {
 }
 
@@ -52,6 +57,8 @@ AsyncRPCOperation& AsyncRPCOperation::operator=( const AsyncRPCOperation& other
     this->error_code_ = other.error_code_;
     this->error_message_ = other.error_message_;
     this->result_ = other.result_;
+    this->priority_ = other.priority_;
+    this->joinsplit_secs_ = other.joinsplit_secs_;
     return *this;
 }
 
@@ -84,6 +91,15 @@ void AsyncRPCOperation::stop_execution_clock() {
     end_time_ = std::chrono::system_clock::now();
 }
 
+/**
+ * Record the time taken by a JoinSplit which was started at the given time
+ */
+void AsyncRPCOperation::add_joinsplit_time(std::chrono::time_point<std::chrono::system_clock> start) {
+    std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start;
+    std::lock_guard<std::mutex> guard(lock_);
+    joinsplit_secs_.push_back(elapsed_seconds.count());
+}
+
 /**
  * Implement this virtual method in any subclass.  This is just an example implementation.
  */
@@ -155,7 +171,22 @@ UniValue AsyncRPCOperation::getStatus() const {
     obj.pushKV("id", this->id_);
     obj.pushKV("status", OperationStatusMap[status]);
     obj.pushKV("creation_time", this->creation_time_);
-    // TODO: Issue #1354: There may be other useful metadata to return to the user.
+    obj.pushKV("priority", OperationPriorityMap[this->priority_]);
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (status == OperationStatus::EXECUTING) {
+            std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - start_time_;
+            obj.pushKV("elapsed_secs", elapsed_seconds.count());
+        }
+        if (!joinsplit_secs_.empty()) {
+            UniValue secs(UniValue::VARR);
+            for (double s : joinsplit_secs_) {
+                secs.push_back(s);
+            }
+            obj.pushKV("joinsplits_done", (uint64_t)joinsplit_secs_.size());
+            obj.pushKV("joinsplit_secs", secs);
+        }
+    }
     UniValue err = this->getError();
     if (!err.isNull()) {
         obj.pushKV("error", err.get_obj());
@@ -14,6 +14,7 @@
 #include <thread>
 #include <utility>
 #include <future>
+#include <vector>
 
 #include <univalue.h>
 
@@ -37,6 +38,14 @@ typedef enum class operationStateEnum {
     SUCCESS
 } OperationStatus;
 
+// The queue runs all waiting NORMAL operations before any LOW one, so that
+// bulk operations do not hold up interactive ones.
+typedef enum class operationPriorityEnum {
+    NORMAL = 0,
+    LOW,
+    NUM_PRIORITIES
+} OperationPriority;
+
 class AsyncRPCOperation {
 public:
     AsyncRPCOperation();
@@ -62,6 +71,10 @@ public:
         return creation_time_;
     }
 
+    OperationPriority getPriority() const {
+        return priority_;
+    }
+
     // Override this method to add data to the default status object.
     virtual UniValue getStatus() const;
 
@@ -115,10 +128,20 @@ protected:
     std::string error_message_;
     std::atomic<OperationStatus> state_;
     std::chrono::time_point<std::chrono::system_clock> start_time_, end_time_;  
+    OperationPriority priority_;
+    std::vector<double> joinsplit_secs_;    // time taken by each JoinSplit proof, in order
 
     void start_execution_clock();
     void stop_execution_clock();
 
+    // Subclasses set the priority in their constructor, before the operation is queued.
+    void set_priority(OperationPriority priority) {
+        this->priority_ = priority;
+    }
+
+    // Call this after each JoinSplit is proven, with the time it started, to report progress.
+    void add_joinsplit_time(std::chrono::time_point<std::chrono::system_clock> start);
+
     void set_state(OperationStatus state) {
         this->state_.store(state);
     }
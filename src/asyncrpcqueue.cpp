@@ -4,6 +4,8 @@
 
 #include "asyncrpcqueue.h"
 
+#include "threadpool.h"
+
 static std::atomic<size_t> workerCounter(0);
 
 /**
@@ -16,6 +18,8 @@ shared_ptr<AsyncRPCQueue> AsyncRPCQueue::sharedInstance() {
 }
 
 AsyncRPCQueue::AsyncRPCQueue() : closed_(false), finish_(false) {
+    running_.fill(0);
+    worker_limits_.fill(0);
 }
 
 AsyncRPCQueue::~AsyncRPCQueue() {
@@ -26,38 +30,50 @@ AsyncRPCQueue::~AsyncRPCQueue() {
  * A worker will execute this method on a new thread
  */
 void AsyncRPCQueue::run(size_t workerId) {
+    JoinThreadPool("rpc");
 
     while (true) {
         AsyncRPCOperationId key;
+        size_t priority = 0;
         std::shared_ptr<AsyncRPCOperation> operation;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
-                this->condition_.wait(guard);
-            }
+            bool fExit = false;
+            while (true) {
+                // Exit if the queue is closing.
+                if (isClosed()) {
+                    for (auto & q : operation_id_queues_) {
+                        while (!q.empty()) {
+                            q.pop();
+                        }
+                    }
+                    fExit = true;
+                    break;
+                }
 
-            // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
-                break;
-            }
+                // Get operation id, which may have to wait for a worker of its priority to finish
+                if (pop_next_operation_id(key, priority)) {
+                    break;
+                }
 
-            // Exit if the queue is closing.
-            if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
+                // Exit if the queue is empty and we are finishing up
+                if (isFinishing() && queued_operation_count() == 0) {
+                    fExit = true;
+                    break;
                 }
+
+                this->condition_.wait(guard);
+            }
+            if (fExit) {
                 break;
             }
 
-            // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
-
             // Search operation map
             AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
             if (iter != operation_map_.end()) {
                 operation = iter->second;
             }
+            running_[priority]++;
         }
 
         if (!operation) {
@@ -67,9 +83,47 @@ void AsyncRPCQueue::run(size_t workerId) {
         } else {
             operation->main();
         }
+
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            running_[priority]--;
+            // A worker may be waiting for this priority to be under its limit
+            this->condition_.notify_all();
+        }
     }
 }
 
+/**
+ * Pop the oldest operation id of the highest priority whose worker limit has
+ * not been reached. Caller must hold lock_.
+ */
+bool AsyncRPCQueue::pop_next_operation_id(AsyncRPCOperationId &key, size_t &priority) {
+    for (size_t p = 0; p < NUM_PRIORITIES; p++) {
+        if (operation_id_queues_[p].empty()) {
+            continue;
+        }
+        if (worker_limits_[p] > 0 && running_[p] >= worker_limits_[p]) {
+            continue;
+        }
+        key = operation_id_queues_[p].front();
+        operation_id_queues_[p].pop();
+        priority = p;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Return the number of queued operations of all priorities. Caller must hold lock_.
+ */
+size_t AsyncRPCQueue::queued_operation_count() const {
+    size_t count = 0;
+    for (const auto & q : operation_id_queues_) {
+        count += q.size();
+    }
+    return count;
+}
+
 
 /**
  * Add shared_ptr to operation.
@@ -91,7 +145,7 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
+    operation_id_queues_[(size_t)ptrOperation->getPriority()].push(id);
     this->condition_.notify_one();
 }
 
@@ -168,7 +222,25 @@ void AsyncRPCQueue::cancelAllOperations() {
  */
 size_t AsyncRPCQueue::getOperationCount() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return operation_id_queue_.size();
+    return queued_operation_count();
+}
+
+/**
+ * Limit how many operations of a priority can run at once, so that workers
+ * remain free for the other priorities. A limit of 0 means no limit.
+ */
+void AsyncRPCQueue::setWorkerLimit(OperationPriority priority, size_t limit) {
+    std::lock_guard<std::mutex> guard(lock_);
+    worker_limits_[(size_t)priority] = limit;
+    this->condition_.notify_all();
+}
+
+/**
+ * Return how many operations of a priority can run at once, 0 if there is no limit.
+ */
+size_t AsyncRPCQueue::getWorkerLimit(OperationPriority priority) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return worker_limits_[(size_t)priority];
 }
 
 /**
@@ -7,6 +7,7 @@
 
 #include "asyncrpcoperation.h"
 
+#include <array>
 #include <iostream>
 #include <string>
 #include <chrono>
@@ -49,11 +50,18 @@ public:
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
+    void setWorkerLimit(OperationPriority priority, size_t limit); // 0 means no limit
+    size_t getWorkerLimit(OperationPriority priority) const;
 
 private:
+    static const size_t NUM_PRIORITIES = (size_t)OperationPriority::NUM_PRIORITIES;
+
     // addWorker() will spawn a new thread on run())
     void run(size_t workerId);
     void wait_for_worker_threads();
+    // Pop the id of the next operation a worker may run, requires lock_
+    bool pop_next_operation_id(AsyncRPCOperationId &key, size_t &priority);
+    size_t queued_operation_count() const; // requires lock_
 
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
     mutable std::mutex lock_;
@@ -61,7 +69,10 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    // One queue per priority, and how many of its operations are running and may run at once
+    std::array<std::queue<AsyncRPCOperationId>, NUM_PRIORITIES> operation_id_queues_;
+    std::array<size_t, NUM_PRIORITIES> running_;
+    std::array<size_t, NUM_PRIORITIES> worker_limits_;
     std::vector<std::thread> workers_;
 };
 
@@ -5,12 +5,15 @@
 #include "base58.h"
 
 #include "hash.h"
+#include "sync.h"
 #include "uint256.h"
 
 #include "version.h"
 #include "streams.h"
 
 #include <assert.h>
+#include <list>
+#include <map>
 #include <stdint.h>
 #include <string.h>
 #include <vector>
@@ -21,6 +24,34 @@
 /** All alphanumeric characters except for "0", "I", "O", and "l" */
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
+//! Value of each base58 character, -1 for the others
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15,16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29,30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39,40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54,55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+/**
+ * The codecs below work on 32-bit limbs and five base58 digits at a time,
+ * 58^5 being the largest power of 58 that fits one limb, instead of on one
+ * byte and one digit: a twentieth of the multiplications of the schoolbook
+ * conversion, which is still quadratic but over far fewer, wider steps.
+ */
+static const uint32_t BASE58_POW5 = 58 * 58 * 58 * 58 * 58;
+
 bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
 {
     // Skip leading spaces.
@@ -32,38 +63,53 @@ bool DecodeBase58(const char* psz, std::vector<unsigned char>& vch)
         zeroes++;
         psz++;
     }
-    // Allocate enough space in big-endian base256 representation.
-    std::vector<unsigned char> b256(strlen(psz) * 733 / 1000 + 1); // log(58) / log(256), rounded up.
-    // Process the characters.
-    while (*psz && !isspace(*psz)) {
-        // Decode base58 character
-        const char* ch = strchr(pszBase58, *psz);
-        if (ch == NULL)
-            return false;
-        // Apply "b256 = b256 * 58 + ch".
-        int carry = ch - pszBase58;
-        for (std::vector<unsigned char>::reverse_iterator it = b256.rbegin(); it != b256.rend(); it++) {
-            carry += 58 * (*it);
-            *it = carry % 256;
-            carry /= 256;
+    // Allocate enough space in little-endian base 2^32 representation.
+    size_t nDigits = 0;
+    while (psz[nDigits] && !isspace(psz[nDigits]))
+        nDigits++;
+    std::vector<uint32_t> limbs((nDigits * 733 / 1000 + 1) / 4 + 1); // log(58) / log(256), rounded up.
+    size_t nUsed = 0;
+    // Process the characters, up to five at a time.
+    for (size_t i = 0; i < nDigits; ) {
+        uint64_t carry = 0;
+        uint64_t mul = 1;
+        for (int j = 0; j < 5 && i < nDigits; j++, i++) {
+            int8_t digit = mapBase58[(uint8_t)psz[i]];
+            if (digit < 0)
+                return false;
+            carry = carry * 58 + digit;
+            mul *= 58;
+        }
+        // Apply "limbs = limbs * mul + carry".
+        for (size_t k = 0; k < nUsed; k++) {
+            carry += mul * limbs[k];
+            limbs[k] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            assert(nUsed < limbs.size());
+            limbs[nUsed++] = (uint32_t)carry;
         }
-        assert(carry == 0);
-        psz++;
     }
+    psz += nDigits;
     // Skip trailing spaces.
     while (isspace(*psz))
         psz++;
     if (*psz != 0)
         return false;
-    // Skip leading zeroes in b256.
-    std::vector<unsigned char>::iterator it = b256.begin();
-    while (it != b256.end() && *it == 0)
-        it++;
-    // Copy result into output vector.
-    vch.reserve(zeroes + (b256.end() - it));
+    // Copy result into output vector, skipping the leading zeroes of the top limb.
     vch.assign(zeroes, 0x00);
-    while (it != b256.end())
-        vch.push_back(*(it++));
+    vch.reserve(zeroes + 4 * nUsed);
+    bool fLeading = true;
+    for (size_t k = nUsed; k-- > 0; ) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            unsigned char c = (limbs[k] >> shift) & 0xff;
+            if (fLeading && c == 0)
+                continue;
+            fLeading = false;
+            vch.push_back(c);
+        }
+    }
     return true;
 }
 
@@ -75,30 +121,40 @@ std::string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
         pbegin++;
         zeroes++;
     }
-    // Allocate enough space in big-endian base58 representation.
-    std::vector<unsigned char> b58((pend - pbegin) * 138 / 100 + 1); // log(256) / log(58), rounded up.
-    // Process the bytes.
-    while (pbegin != pend) {
-        int carry = *pbegin;
-        // Apply "b58 = b58 * 256 + ch".
-        for (std::vector<unsigned char>::reverse_iterator it = b58.rbegin(); it != b58.rend(); it++) {
-            carry += 256 * (*it);
-            *it = carry % 58;
-            carry /= 58;
+    // Load the bytes as big-endian base 2^32.
+    size_t nBytes = pend - pbegin;
+    std::vector<uint32_t> limbs((nBytes + 3) / 4);
+    for (size_t i = 0; i < nBytes; i++) {
+        size_t pos = nBytes - 1 - i;
+        limbs[limbs.size() - 1 - pos / 4] |= (uint32_t)pbegin[i] << (8 * (pos % 4));
+    }
+    // Divide by 58^5 until nothing is left, five digits per remainder, least significant first.
+    std::vector<unsigned char> b58;
+    b58.reserve(nBytes * 138 / 100 + 5); // log(256) / log(58), rounded up.
+    size_t nFirst = 0;
+    while (nFirst < limbs.size()) {
+        uint64_t rem = 0;
+        for (size_t k = nFirst; k < limbs.size(); k++) {
+            uint64_t cur = (rem << 32) | limbs[k];
+            limbs[k] = cur / BASE58_POW5;
+            rem = cur % BASE58_POW5;
+        }
+        while (nFirst < limbs.size() && limbs[nFirst] == 0)
+            nFirst++;
+        for (int j = 0; j < 5; j++) {
+            b58.push_back(rem % 58);
+            rem /= 58;
         }
-        assert(carry == 0);
-        pbegin++;
     }
     // Skip leading zeroes in base58 result.
-    std::vector<unsigned char>::iterator it = b58.begin();
-    while (it != b58.end() && *it == 0)
-        it++;
+    while (!b58.empty() && b58.back() == 0)
+        b58.pop_back();
     // Translate the result into a string.
     std::string str;
-    str.reserve(zeroes + (b58.end() - it));
+    str.reserve(zeroes + b58.size());
     str.assign(zeroes, '1');
-    while (it != b58.end())
-        str += pszBase58[*(it++)];
+    for (size_t i = b58.size(); i-- > 0; )
+        str += pszBase58[b58[i]];
     return str;
 }
 
@@ -191,6 +247,70 @@ std::string CBase58Data::ToString() const
     return EncodeBase58Check(vch);
 }
 
+namespace
+{
+//! Addresses kept by the encoding cache; a few MiB at the size of a payment address
+const size_t MAX_ENCODED_CACHE_SIZE = 20000;
+
+/**
+ * The most recently encoded addresses, keyed by their version and data, so
+ * that wallet and explorer RPCs listing the same few addresses over and over
+ * do not hash and base58 encode them every time.
+ */
+class CEncodedCache
+{
+private:
+    typedef std::vector<unsigned char> Key;
+    CCriticalSection cs;
+    std::list<Key> lru;
+    std::map<Key, std::pair<std::string, std::list<Key>::iterator> > mapEncoded;
+
+public:
+    bool Get(const Key& key, std::string& str)
+    {
+        LOCK(cs);
+        std::map<Key, std::pair<std::string, std::list<Key>::iterator> >::iterator it = mapEncoded.find(key);
+        if (it == mapEncoded.end())
+            return false;
+        lru.splice(lru.begin(), lru, it->second.second);
+        str = it->second.first;
+        return true;
+    }
+
+    void Put(const Key& key, const std::string& str)
+    {
+        LOCK(cs);
+        if (mapEncoded.count(key))
+            return;
+        lru.push_front(key);
+        mapEncoded.insert(std::make_pair(key, std::make_pair(str, lru.begin())));
+        if (mapEncoded.size() > MAX_ENCODED_CACHE_SIZE) {
+            mapEncoded.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+};
+
+CEncodedCache& GetEncodedCache()
+{
+    static CEncodedCache cache;
+    return cache;
+}
+
+} // anon namespace
+
+std::string CBase58Data::ToCachedString() const
+{
+    std::vector<unsigned char> key = vchVersion;
+    key.insert(key.end(), vchData.begin(), vchData.end());
+    std::string str;
+    if (GetEncodedCache().Get(key, str))
+        return str;
+    str = EncodeBase58Check(key);
+    GetEncodedCache().Put(key, str);
+    return str;
+}
+
 int CBase58Data::CompareTo(const CBase58Data& b58) const
 {
     if (vchVersion < b58.vchVersion)
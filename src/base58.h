@@ -82,6 +82,8 @@ protected:
     CBase58Data();
     void SetData(const std::vector<unsigned char> &vchVersionIn, const void* pdata, size_t nSize);
     void SetData(const std::vector<unsigned char> &vchVersionIn, const unsigned char *pbegin, const unsigned char *pend);
+    //! ToString through a cache of recently encoded data; only for public data such as addresses, never keys
+    std::string ToCachedString() const;
 
 public:
     bool SetString(const char* psz, unsigned int nVersionBytes);
@@ -116,6 +118,8 @@ public:
 
     CZCPaymentAddress(const std::string& strAddress) { SetString(strAddress.c_str(), 2); }
     CZCPaymentAddress(const libzcash::PaymentAddress& addr) { Set(addr); }
+
+    std::string ToString() const { return ToCachedString(); }
 };
 
 class CZCViewingKey : public CZCEncoding<libzcash::ViewingKey, CChainParams::ZCVIEWING_KEY, libzcash::SerializedViewingKeySize> {
@@ -161,6 +165,7 @@ public:
     CBitcoinAddress(const std::string& strAddress) { SetString(strAddress); }
     CBitcoinAddress(const char* pszAddress) { SetString(pszAddress); }
 
+    std::string ToString() const { return ToCachedString(); }
     CTxDestination Get() const;
     bool GetKeyID(CKeyID &keyID) const;
     bool IsScript() const;
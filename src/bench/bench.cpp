@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <regex>
+
+#include <stdio.h>
+
+/** Time stamp counter, or 0 where there is none to read */
+static inline uint64_t GetCycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return 0;
+#endif
+}
+
+static inline int64_t GetNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Value below which a fraction of the sorted samples lie */
+static double Percentile(const std::vector<double>& vSorted, double dFraction)
+{
+    if (vSorted.empty())
+        return 0;
+    size_t nIndex = std::min(vSorted.size() - 1, (size_t)(dFraction * vSorted.size()));
+    return vSorted[nIndex];
+}
+
+benchmark::State::State(double dMaxSecondsIn) :
+    dMaxSeconds(dMaxSecondsIn), nStartNanos(0), nBatchStartNanos(0), nBatchStartCycles(0),
+    nBatchSize(0), nBatchLeft(0), nIterations(0)
+{
+}
+
+bool benchmark::State::NextBatch()
+{
+    uint64_t nNowCycles = GetCycles();
+    int64_t nNow = GetNanos();
+
+    if (nBatchSize == 0) {
+        nStartNanos = nNow;
+        nBatchSize = 1;
+    } else {
+        nIterations += nBatchSize;
+        int64_t nElapsed = nNow - nBatchStartNanos;
+        if (nElapsed < MIN_BATCH_NANOS) {
+            // Too short to time precisely, and still warming up the caches
+            nBatchSize *= 2;
+        } else {
+            vNanos.push_back((double)nElapsed / nBatchSize);
+            vCycles.push_back((double)(nNowCycles - nBatchStartCycles) / nBatchSize);
+        }
+        if (nNow - nStartNanos >= dMaxSeconds * 1e9 && vNanos.size() >= MIN_SAMPLES)
+            return false;
+    }
+
+    nBatchLeft = nBatchSize - 1;
+    nBatchStartNanos = GetNanos();
+    nBatchStartCycles = GetCycles();
+    return true;
+}
+
+benchmark::BenchRunner::BenchmarkMap& benchmark::BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarksMap;
+    return benchmarksMap;
+}
+
+benchmark::BenchRunner::BenchRunner(const std::string& name, benchmark::BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+void benchmark::BenchRunner::RunAll(const std::string& strFilter, double dMaxSeconds)
+{
+    std::regex reFilter(strFilter);
+
+    // Fixed columns and name order, so that the output of two builds can be diffed
+    printf("# Benchmark, iterations, samples, min_ns, median_ns, p90_ns, p99_ns, max_ns, median_cycles\n");
+    for (const auto& item : benchmarks()) {
+        if (!std::regex_search(item.first, reFilter))
+            continue;
+
+        State state(dMaxSeconds);
+        item.second(state);
+
+        std::vector<double> vNanos = state.vNanos;
+        std::vector<double> vCycles = state.vCycles;
+        std::sort(vNanos.begin(), vNanos.end());
+        std::sort(vCycles.begin(), vCycles.end());
+        printf("%s, %lu, %u, %.1f, %.1f, %.1f, %.1f, %.1f, %.0f\n", item.first.c_str(),
+               (unsigned long)state.GetIterations(), (unsigned int)vNanos.size(),
+               vNanos.empty() ? 0 : vNanos.front(), Percentile(vNanos, 0.5), Percentile(vNanos, 0.9),
+               Percentile(vNanos, 0.99), vNanos.empty() ? 0 : vNanos.back(), Percentile(vCycles, 0.5));
+        fflush(stdout);
+    }
+}
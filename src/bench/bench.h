@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+/*
+ * Micro-benchmarks of the consensus hot paths, run by bench_zen without a
+ * node, wallet or datadir. The API follows a subset of Google Benchmark:
+ *
+ *   static void CodeToTime(benchmark::State& state)
+ *   {
+ *       ... setup, not timed ...
+ *       while (state.KeepRunning()) {
+ *           ... timed ...
+ *       }
+ *   }
+ *
+ *   BENCHMARK(CodeToTime);
+ *
+ * The iterations are timed in batches, grown until a batch lasts long enough
+ * to be measured precisely; each batch is one sample of the time and cycles
+ * per iteration, and the report gives their distribution.
+ */
+namespace benchmark {
+
+//! Shortest batch whose samples are kept; shorter ones only grow the batch size
+static const int64_t MIN_BATCH_NANOS = 1000000;
+//! Fewest samples taken, however long the benchmark runs
+static const size_t MIN_SAMPLES = 5;
+
+class State
+{
+private:
+    double dMaxSeconds;
+    int64_t nStartNanos;
+    int64_t nBatchStartNanos;
+    uint64_t nBatchStartCycles;
+    uint64_t nBatchSize;
+    uint64_t nBatchLeft;
+    uint64_t nIterations;
+
+    bool NextBatch();
+
+public:
+    //! Nanoseconds and cycles per iteration of each batch
+    std::vector<double> vNanos;
+    std::vector<double> vCycles;
+
+    explicit State(double dMaxSecondsIn);
+
+    //! Whether to run another iteration; the benchmark stops once it ran
+    //! for dMaxSeconds and took MIN_SAMPLES samples
+    bool KeepRunning()
+    {
+        if (nBatchLeft > 0) {
+            nBatchLeft--;
+            return true;
+        }
+        return NextBatch();
+    }
+
+    uint64_t GetIterations() const { return nIterations; }
+};
+
+typedef std::function<void(State&)> BenchFunction;
+
+class BenchRunner
+{
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func);
+
+    //! Run the benchmarks whose name matches strFilter, a regular expression,
+    //! for dMaxSeconds each, and print one CSV line per benchmark, in name order
+    static void RunAll(const std::string& strFilter, double dMaxSeconds);
+};
+
+}
+
+// BENCHMARK(foo) expands to: benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
@@ -0,0 +1,42 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "key.h"
+#include "pubkey.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* DEFAULT_BENCH_FILTER = ".*";
+static const char* DEFAULT_BENCH_TIME = "0.5";
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        printf("Usage: bench_zen [options]\n\n"
+               "Runs the micro-benchmarks and prints one CSV line per benchmark.\n\n"
+               "Options:\n"
+               "  -filter=<regex>   Only run the benchmarks whose name matches (default: %s)\n"
+               "  -time=<seconds>   Run each benchmark for at least this long (default: %s)\n",
+               DEFAULT_BENCH_FILTER, DEFAULT_BENCH_TIME);
+        return 0;
+    }
+
+    assert(init_and_check_sodium() != -1);
+    ECC_Start();
+    ECCVerifyHandle verifyHandle;
+    SelectParams(CBaseChainParams::MAIN);
+    fPrintToDebugLog = false;
+
+    benchmark::BenchRunner::RunAll(GetArg("-filter", DEFAULT_BENCH_FILTER), atof(GetArg("-time", DEFAULT_BENCH_TIME).c_str()));
+
+    ECC_Stop();
+    return 0;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "coins.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "script/standard.h"
+
+#include <assert.h>
+
+//! Transactions whose outputs the benchmark caches hold
+static const unsigned int CACHED_TXS = 100000;
+
+/** Fill a cache with CACHED_TXS transactions of two outputs each */
+static void FillCache(CCoinsViewCache& cache)
+{
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(), false);
+    for (unsigned int i = 0; i < CACHED_TXS; i++) {
+        CCoinsModifier coins = cache.ModifyCoins(ArithToUint256(arith_uint256(i)));
+        coins->vout.assign(2, CTxOut(1000, scriptPubKey));
+        coins->nHeight = 1;
+        coins->nVersion = 1;
+    }
+}
+
+static void CCoinsViewCache_AccessCoins(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    FillCache(cache);
+
+    unsigned int i = 0;
+    while (state.KeepRunning()) {
+        assert(cache.AccessCoins(ArithToUint256(arith_uint256(i))) != NULL);
+        i = (i + 7919) % CACHED_TXS;
+    }
+}
+
+static void CCoinsViewCache_HaveInputs(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    FillCache(cache);
+
+    CMutableTransaction mtx;
+    for (unsigned int i = 0; i < 100; i++)
+        mtx.vin.push_back(CTxIn(ArithToUint256(arith_uint256(i * 997 % CACHED_TXS)), i % 2));
+    mtx.vout.push_back(CTxOut(1000, CScript()));
+    CTransaction tx(mtx);
+
+    while (state.KeepRunning())
+        assert(cache.HaveInputs(tx));
+}
+
+static void CCoinsViewCache_SpendAndAdd(benchmark::State& state)
+{
+    // What connecting a transaction does to the cache: spend an output, add new ones
+    CCoinsView base;
+    CCoinsViewCache cache(&base);
+    FillCache(cache);
+
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(), false);
+    unsigned int i = 0;
+    while (state.KeepRunning()) {
+        uint256 txid = ArithToUint256(arith_uint256(i % CACHED_TXS));
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->Spend(0);
+        }
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->vout.assign(2, CTxOut(1000, scriptPubKey));
+        }
+        i++;
+    }
+}
+
+BENCHMARK(CCoinsViewCache_AccessCoins);
+BENCHMARK(CCoinsViewCache_HaveInputs);
+BENCHMARK(CCoinsViewCache_SpendAndAdd);
@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include "sodium.h"
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000 * 1000;
+
+static void SHA256(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(in.data(), in.size()).Finalize(hash);
+}
+
+static void SHA256_BlockHeader(benchmark::State& state)
+{
+    // Block ids and transaction ids are double SHA256 of small inputs
+    std::vector<uint8_t> in(80, 0);
+    uint256 hash;
+    while (state.KeepRunning()) {
+        hash = Hash(in.begin(), in.end());
+        in[0] = hash.begin()[0];
+    }
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    // A merkle tree level of 1024 pairs
+    std::vector<uint8_t> in(64 * 1024, 0);
+    std::vector<uint8_t> out(32 * 1024);
+    while (state.KeepRunning())
+        SHA256D64(out.data(), in.data(), 1024);
+}
+
+static void SHA256Compress64_1024(benchmark::State& state)
+{
+    // A note commitment tree level of 1024 pairs
+    std::vector<uint8_t> in(64 * 1024, 0);
+    std::vector<uint8_t> out(32 * 1024);
+    while (state.KeepRunning())
+        SHA256Compress64(out.data(), in.data(), 1024);
+}
+
+static void BLAKE2b(benchmark::State& state)
+{
+    uint8_t hash[crypto_generichash_blake2b_BYTES];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        crypto_generichash_blake2b(hash, sizeof(hash), in.data(), in.size(), NULL, 0);
+}
+
+static void BLAKE2b_Equihash(benchmark::State& state)
+{
+    // The personalized state Equihash hashes each index with
+    uint8_t personalization[crypto_generichash_blake2b_PERSONALBYTES] = {'Z', 'c', 'a', 's', 'h', 'P', 'o', 'W', 200, 0, 0, 0, 9, 0, 0, 0};
+    crypto_generichash_blake2b_state base_state;
+    crypto_generichash_blake2b_init_salt_personal(&base_state, NULL, 0, 50, NULL, personalization);
+    std::vector<uint8_t> header(140, 0);
+    crypto_generichash_blake2b_update(&base_state, header.data(), header.size());
+
+    uint8_t hash[50];
+    uint32_t index = 0;
+    while (state.KeepRunning()) {
+        crypto_generichash_blake2b_state s = base_state;
+        crypto_generichash_blake2b_update(&s, (const uint8_t*)&index, sizeof(index));
+        crypto_generichash_blake2b_final(&s, hash, sizeof(hash));
+        index++;
+    }
+}
+
+BENCHMARK(SHA256);
+BENCHMARK(SHA256_BlockHeader);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(SHA256Compress64_1024);
+BENCHMARK(BLAKE2b);
+BENCHMARK(BLAKE2b_Equihash);
@@ -0,0 +1,43 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "coins.h"
+#include "leveldbwrapper.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/standard.h"
+#include "util.h"
+
+#include <assert.h>
+
+#include <boost/filesystem.hpp>
+
+//! Entries per batch, about what flushing a block's worth of coins writes
+static const unsigned int BATCH_ENTRIES = 1000;
+
+static void LevelDB_WriteBatch(benchmark::State& state)
+{
+    boost::filesystem::path path = GetTempPath() / strprintf("bench_zen_leveldb_%lu", (unsigned long)GetRand(1000000000));
+    {
+        CLevelDBWrapper db(path, 8 << 20, false, true);
+        CCoins coins;
+        coins.vout.assign(2, CTxOut(1000, GetScriptForDestination(CKeyID(), false)));
+        coins.nHeight = 1;
+        coins.nVersion = 1;
+
+        uint64_t nKey = 0;
+        while (state.KeepRunning()) {
+            CLevelDBBatch batch;
+            for (unsigned int i = 0; i < BATCH_ENTRIES; i++)
+                batch.Write(std::make_pair('c', ArithToUint256(arith_uint256(nKey++))), coins);
+            assert(db.WriteBatch(batch));
+        }
+    }
+    boost::filesystem::remove_all(path);
+}
+
+BENCHMARK(LevelDB_WriteBatch);
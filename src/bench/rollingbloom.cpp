@@ -0,0 +1,30 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "bloom.h"
+#include "uint256.h"
+
+#include <string.h>
+
+static void RollingBloom(benchmark::State& state)
+{
+    // As sized for the inventory known to a peer
+    CRollingBloomFilter filter(5000, 0.000001);
+    uint256 hash;
+    uint32_t nEntry = 0;
+    while (state.KeepRunning()) {
+        memcpy(hash.begin(), &nEntry, sizeof(nEntry));
+        filter.insert(hash);
+        nEntry++;
+        // Mostly absent, as the hashes of announced inventory are
+        nEntry ^= 0x80000000;
+        memcpy(hash.begin(), &nEntry, sizeof(nEntry));
+        filter.contains(hash);
+        nEntry ^= 0x80000000;
+    }
+}
+
+BENCHMARK(RollingBloom);
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "primitives/block.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "version.h"
+
+#include <assert.h>
+
+/** A block of 1000 transactions of two inputs and two outputs */
+static CBlock MakeBlock()
+{
+    CBlock block;
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(), false);
+    CScript scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    for (unsigned int i = 0; i < 1000; i++) {
+        CMutableTransaction mtx;
+        for (unsigned int j = 0; j < 2; j++) {
+            mtx.vin.push_back(CTxIn(ArithToUint256(arith_uint256(2 * i + j + 1)), j, scriptSig));
+            mtx.vout.push_back(CTxOut(1000, scriptPubKey));
+        }
+        block.vtx.push_back(CTransaction(mtx));
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+static void CBlock_Serialize(benchmark::State& state)
+{
+    CBlock block = MakeBlock();
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream.reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    while (state.KeepRunning()) {
+        stream.clear();
+        stream << block;
+    }
+}
+
+static void CBlock_Deserialize(benchmark::State& state)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << MakeBlock();
+    while (state.KeepRunning()) {
+        CDataStream copy(stream);
+        CBlock block;
+        copy >> block;
+        assert(block.vtx.size() == 1000);
+    }
+}
+
+BENCHMARK(CBlock_Serialize);
+BENCHMARK(CBlock_Deserialize);
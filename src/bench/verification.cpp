@@ -0,0 +1,80 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "pow.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "zcash/Proof.hpp"
+
+#include <assert.h>
+
+static void EquihashVerify(benchmark::State& state)
+{
+    const CChainParams& params = Params(CBaseChainParams::MAIN);
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    while (state.KeepRunning())
+        assert(CheckEquihashSolution(&header, params));
+}
+
+/** A transaction spending nInputs distinct outputs to nOutputs P2PKH outputs */
+static CTransaction MakeTransparentTransaction(unsigned int nInputs, unsigned int nOutputs)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID(), false);
+
+    CMutableTransaction mtx;
+    for (unsigned int i = 0; i < nInputs; i++)
+        mtx.vin.push_back(CTxIn(ArithToUint256(arith_uint256(i + 1)), 0));
+    for (unsigned int i = 0; i < nOutputs; i++)
+        mtx.vout.push_back(CTxOut(1000, scriptPubKey));
+    return CTransaction(mtx);
+}
+
+static void CheckTransaction_100x100(benchmark::State& state)
+{
+    // The context-free checks; JoinSplit proofs need the proving parameters
+    // and are covered by the zcbenchmark RPC
+    CTransaction tx = MakeTransparentTransaction(100, 100);
+    auto verifier = libzcash::ProofVerifier::Disabled();
+    while (state.KeepRunning()) {
+        CValidationState validationState;
+        assert(CheckTransaction(tx, validationState, verifier));
+    }
+}
+
+static void VerifyScript_P2PKH(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID(), false);
+
+    CMutableTransaction mtx;
+    mtx.vin.push_back(CTxIn(ArithToUint256(arith_uint256(1)), 0));
+    mtx.vout.push_back(CTxOut(1000, scriptPubKey));
+    assert(SignSignature(keystore, scriptPubKey, mtx, 0, SIGHASH_ALL));
+    CTransaction tx(mtx);
+
+    while (state.KeepRunning()) {
+        ScriptError serror = SCRIPT_ERR_OK;
+        assert(VerifyScript(tx.vin[0].scriptSig, scriptPubKey, STANDARD_NONCONTEXTUAL_SCRIPT_VERIFY_FLAGS,
+                            TransactionSignatureChecker(&tx, 0, nullptr), &serror));
+    }
+}
+
+BENCHMARK(EquihashVerify);
+BENCHMARK(CheckTransaction_100x100);
+BENCHMARK(VerifyScript_P2PKH);
@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "uint256.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/NoteEncryption.hpp"
+
+#include <assert.h>
+
+//! Appends after which the tree is started afresh, well before it is full
+static const unsigned int MAX_TREE_APPENDS = 1 << 20;
+
+static void IncrementalMerkleTree_Append(benchmark::State& state)
+{
+    ZCIncrementalMerkleTree tree;
+    uint256 commitment = libzcash::random_uint256();
+    unsigned int nAppends = 0;
+    while (state.KeepRunning()) {
+        tree.append(commitment);
+        *commitment.begin() += 1;
+        if (++nAppends == MAX_TREE_APPENDS) {
+            tree = ZCIncrementalMerkleTree();
+            nAppends = 0;
+        }
+    }
+}
+
+static void NoteDecryption_Mine(benchmark::State& state)
+{
+    uint256 sk_enc = ZCNoteEncryption::generate_privkey(libzcash::random_uint252());
+    uint256 pk_enc = ZCNoteEncryption::generate_pubkey(sk_enc);
+    uint256 hSig = libzcash::random_uint256();
+
+    ZCNoteEncryption encryptor(hSig);
+    ZCNoteEncryption::Plaintext message;
+    message.fill(0x42);
+    ZCNoteEncryption::Ciphertext ciphertext = encryptor.encrypt(pk_enc, message);
+
+    ZCNoteDecryption decryptor(sk_enc);
+    while (state.KeepRunning())
+        assert(decryptor.decrypt(ciphertext, encryptor.get_epk(), hSig, 0) == message);
+}
+
+static void NoteDecryption_NotMine(benchmark::State& state)
+{
+    // What a wallet pays for each note of each transaction it scans, for each of its keys
+    uint256 pk_enc = ZCNoteEncryption::generate_pubkey(ZCNoteEncryption::generate_privkey(libzcash::random_uint252()));
+    uint256 hSig = libzcash::random_uint256();
+
+    ZCNoteEncryption encryptor(hSig);
+    ZCNoteEncryption::Plaintext message;
+    message.fill(0x42);
+    ZCNoteEncryption::Ciphertext ciphertext = encryptor.encrypt(pk_enc, message);
+
+    ZCNoteDecryption decryptor(ZCNoteEncryption::generate_privkey(libzcash::random_uint252()));
+    while (state.KeepRunning()) {
+        try {
+            decryptor.decrypt(ciphertext, encryptor.get_epk(), hSig, 0);
+            assert(false);
+        } catch (const libzcash::note_decryption_failed&) {
+        }
+    }
+}
+
+BENCHMARK(IncrementalMerkleTree_Append);
+BENCHMARK(NoteDecryption_Mine);
+BENCHMARK(NoteDecryption_NotMine);
@@ -10,9 +10,12 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <stdio.h>
 
+#include <iostream>
+
 #include <event2/buffer.h>
 #include <event2/keyvalq_struct.h>
 #include "support/events.h"
@@ -22,6 +25,9 @@
 using namespace std;
 
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT=900;
+//! Commands of -stdin-batch sent in one JSON-RPC batch request
+static const size_t STDIN_BATCH_COMMANDS = 100;
+static const int DEFAULT_PIPELINE = 1;
 
 std::string HelpMessageCli()
 {
@@ -39,6 +45,10 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcclienttimeout=<n>", strprintf(_("Timeout in seconds during HTTP requests, or 0 for no timeout. (default: %d)"), DEFAULT_HTTP_CLIENT_TIMEOUT));
+    strUsage += HelpMessageOpt("-stdin-batch", strprintf(_("Read commands from standard input, one per line as a command and its parameters "
+                                                           "separated by whitespace, or as a JSON array of strings, and send them in batches of %u "
+                                                           "over connections kept open; the results are written in the order of the commands"), STDIN_BATCH_COMMANDS));
+    strUsage += HelpMessageOpt("-pipeline=<n>", strprintf(_("With -stdin-batch, keep up to <n> batches in flight, each on a connection of its own (default: %d)"), DEFAULT_PIPELINE));
 
     return strUsage;
 }
@@ -68,13 +78,14 @@ static bool AppInitRPC(int argc, char* argv[])
     // Parameters
     //
     ParseParameters(argc, argv);
-    if (argc<2 || mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help") || mapArgs.count("-version")) {
+    if ((argc<2 && !mapArgs.count("-stdin-batch")) || mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help") || mapArgs.count("-version")) {
         std::string strUsage = _("Horizen RPC client version") + " " + FormatFullVersion() + "\n";
         if (!mapArgs.count("-version")) {
             strUsage += "\n" + _("Usage:") + "\n" +
                   "  zen-cli [options] <command> [params]  " + _("Send command to horizen") + "\n" +
                   "  zen-cli [options] help                " + _("List commands") + "\n" +
-                  "  zen-cli [options] help <command>      " + _("Get help for a command") + "\n";
+                  "  zen-cli [options] help <command>      " + _("Get help for a command") + "\n" +
+                  "  zen-cli [options] -stdin-batch        " + _("Send the commands read from standard input") + "\n";
 
             strUsage += "\n" + HelpMessageCli();
         } else {
@@ -173,6 +184,38 @@ static void http_error_cb(enum evhttp_request_error err, void *ctx)
 }
 #endif
 
+/** The Authorization header for the RPC credentials */
+static std::string GetAuthorization()
+{
+    std::string strRPCUserColonPass;
+    if (mapArgs["-rpcpassword"] == "") {
+        // Try fall back to cookie-based authentication if no password is provided
+        if (!GetAuthCookie(&strRPCUserColonPass)) {
+            throw runtime_error(strprintf(
+                _("Could not locate RPC credentials. No authentication cookie could be found,\n"
+                  "and no rpcpassword is set in the configuration file (%s)."),
+                    GetConfigFile().string().c_str()));
+
+        }
+    } else {
+        strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
+    }
+    return std::string("Basic ") + EncodeBase64(strRPCUserColonPass);
+}
+
+/** Throw for an HTTP response that carries no JSON-RPC reply */
+static void CheckHTTPReply(const HTTPReply& response)
+{
+    if (response.status == 0)
+        throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
+    else if (response.status == HTTP_UNAUTHORIZED)
+        throw runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
+    else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
+        throw runtime_error(strprintf("server returned HTTP error %d", response.status));
+    else if (response.body.empty())
+        throw runtime_error("no response from server");
+}
+
 UniValue CallRPC(const string& strMethod, const UniValue& params)
 {
     std::string host = GetArg("-rpcconnect", "127.0.0.1");
@@ -193,26 +236,11 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
     evhttp_request_set_error_cb(req.get(), http_error_cb);
 #endif
 
-    // Get credentials
-    std::string strRPCUserColonPass;
-    if (mapArgs["-rpcpassword"] == "") {
-        // Try fall back to cookie-based authentication if no password is provided
-        if (!GetAuthCookie(&strRPCUserColonPass)) {
-            throw runtime_error(strprintf(
-                _("Could not locate RPC credentials. No authentication cookie could be found,\n"
-                  "and no rpcpassword is set in the configuration file (%s)."),
-                    GetConfigFile().string().c_str()));
-
-        }
-    } else {
-        strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
-    }
-
     struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
     assert(output_headers);
     evhttp_add_header(output_headers, "Host", host.c_str());
     evhttp_add_header(output_headers, "Connection", "close");
-    evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
+    evhttp_add_header(output_headers, "Authorization", GetAuthorization().c_str());
 
     // Attach request data
     std::string strRequest = JSONRPCRequest(strMethod, params, 1);
@@ -228,14 +256,7 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
 
     event_base_dispatch(base.get());
 
-    if (response.status == 0)
-        throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
-    else if (response.status == HTTP_UNAUTHORIZED)
-        throw runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
-    else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
-        throw runtime_error(strprintf("server returned HTTP error %d", response.status));
-    else if (response.body.empty())
-        throw runtime_error("no response from server");
+    CheckHTTPReply(response);
 
     // Parse reply
     UniValue valReply(UniValue::VSTR);
@@ -248,6 +269,281 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
     return reply;
 }
 
+/** The text to print for a reply, and the exit code it gives, zero for a result */
+static int FormatReply(const UniValue& reply, string& strPrint)
+{
+    const UniValue& result = find_value(reply, "result");
+    const UniValue& error  = find_value(reply, "error");
+
+    if (!error.isNull()) {
+        // Error
+        int code = error["code"].get_int();
+        strPrint = "error: " + error.write();
+        if (error.isObject())
+        {
+            UniValue errCode = find_value(error, "code");
+            UniValue errMsg  = find_value(error, "message");
+            strPrint = errCode.isNull() ? "" : "error code: "+errCode.getValStr()+"\n";
+
+            if (errMsg.isStr())
+                strPrint += "error message:\n"+errMsg.get_str();
+        }
+        return abs(code);
+    }
+
+    // Result
+    if (result.isNull())
+        strPrint = "";
+    else if (result.isStr())
+        strPrint = result.get_str();
+    else
+        strPrint = result.write(2);
+    return 0;
+}
+
+/**
+ * The commands of -stdin-batch, sent as JSON-RPC batches over -pipeline
+ * connections that are kept open, each with one batch in flight. The
+ * replies are printed in the order of the commands, as soon as the batches
+ * before them are done.
+ */
+class CStdinBatch
+{
+private:
+    struct CConnection
+    {
+        CStdinBatch* batch;
+        raii_evhttp_connection evcon;
+        HTTPReply response;
+        //! The batch in flight on the connection
+        size_t nBatch;
+    };
+
+    /** A command read, with its reply once there is one */
+    struct CCommand
+    {
+        UniValue reply;
+        //! Why the command was not sent, or got no reply
+        std::string strError;
+    };
+
+    raii_event_base base;
+    std::string host;
+    std::string strAuthorization;
+    std::vector<std::unique_ptr<CConnection> > connections;
+    size_t nBatchesRead;
+    size_t nBatchesPrinted;
+    size_t nInFlight;
+    std::map<size_t, std::vector<CCommand> > mapBatches;
+    std::map<size_t, bool> mapDone;
+    bool fConnectionFailed;
+    std::string strFailure;
+    int nRet;
+
+    /** Split a line into the method and its parameters */
+    static std::vector<std::string> ParseLine(const std::string& line)
+    {
+        std::vector<std::string> args;
+        if (line[0] == '[') {
+            UniValue arr;
+            if (!arr.read(line) || !arr.isArray())
+                throw runtime_error("invalid JSON array of command and parameters");
+            for (size_t i = 0; i < arr.size(); i++) {
+                if (!arr[i].isStr())
+                    throw runtime_error("command and parameters must be strings");
+                args.push_back(arr[i].get_str());
+            }
+        } else {
+            boost::split(args, line, boost::is_any_of(" \t"), boost::token_compress_on);
+        }
+        if (args.empty())
+            throw runtime_error("too few parameters");
+        return args;
+    }
+
+    /** Read the next batch of commands, returning the request for those that could be sent */
+    std::string ReadBatch(std::vector<CCommand>& commands)
+    {
+        std::string strRequest;
+        std::string line;
+        while (commands.size() < STDIN_BATCH_COMMANDS && std::getline(std::cin, line)) {
+            boost::algorithm::trim(line);
+            if (line.empty())
+                continue;
+            CCommand command;
+            try {
+                std::vector<std::string> args = ParseLine(line);
+                std::vector<std::string> strParams(args.begin() + 1, args.end());
+                UniValue params = RPCConvertValues(args[0], strParams);
+                strRequest += (strRequest.empty() ? "[" : ",") + JSONRPCRequest(args[0], params, (int)commands.size());
+            } catch (const std::exception& e) {
+                command.strError = e.what();
+            }
+            commands.push_back(command);
+        }
+        if (!strRequest.empty())
+            strRequest += "]";
+        return strRequest;
+    }
+
+    void Print()
+    {
+        for (; mapDone.count(nBatchesPrinted); nBatchesPrinted++) {
+            for (const CCommand& command : mapBatches[nBatchesPrinted]) {
+                std::string strPrint;
+                int nCommandRet = EXIT_FAILURE;
+                if (!command.strError.empty())
+                    strPrint = "error: " + command.strError;
+                else
+                    nCommandRet = FormatReply(command.reply, strPrint);
+                if (nCommandRet != 0)
+                    fflush(stdout); // keep the errors in order with the results
+                if (strPrint != "")
+                    fprintf((nCommandRet == 0 ? stdout : stderr), "%s\n", strPrint.c_str());
+                if (nRet == 0)
+                    nRet = nCommandRet;
+            }
+            mapBatches.erase(nBatchesPrinted);
+            mapDone.erase(nBatchesPrinted);
+        }
+        fflush(stdout);
+    }
+
+    void Fail(const std::string& strError, bool fConnection)
+    {
+        if (strFailure.empty()) {
+            strFailure = strError;
+            fConnectionFailed = fConnection;
+        }
+        event_base_loopbreak(base.get());
+    }
+
+    /** Send the next batch on a connection, or leave it idle at the end of the input */
+    void SendNext(CConnection& conn)
+    {
+        while (true) {
+            std::vector<CCommand> commands;
+            std::string strRequest = ReadBatch(commands);
+            if (commands.empty())
+                break;
+            size_t nBatch = nBatchesRead++;
+            mapBatches[nBatch].swap(commands);
+            if (strRequest.empty()) {
+                // Nothing of it to send
+                mapDone[nBatch] = true;
+                Print();
+                continue;
+            }
+
+            conn.nBatch = nBatch;
+            conn.response = HTTPReply();
+            raii_evhttp_request req = obtain_evhttp_request(batch_request_done, (void*)&conn);
+            if (req == NULL)
+                return Fail("create http request failed", false);
+#if LIBEVENT_VERSION_NUMBER >= 0x02010300
+            evhttp_request_set_error_cb(req.get(), batch_error_cb);
+#endif
+            struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
+            assert(output_headers);
+            evhttp_add_header(output_headers, "Host", host.c_str());
+            evhttp_add_header(output_headers, "Authorization", strAuthorization.c_str());
+            struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
+            assert(output_buffer);
+            evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
+
+            int r = evhttp_make_request(conn.evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
+            req.release(); // ownership moved to evcon in above call
+            if (r != 0)
+                return Fail("send http request failed", true);
+            nInFlight++;
+            return;
+        }
+
+        // The connections kept open would keep the event loop running
+        if (nInFlight == 0)
+            event_base_loopexit(base.get(), NULL);
+    }
+
+    void Done(CConnection& conn)
+    {
+        nInFlight--;
+        try {
+            CheckHTTPReply(conn.response);
+            UniValue valReply;
+            if (!valReply.read(conn.response.body))
+                throw runtime_error("couldn't parse reply from server");
+            std::vector<CCommand>& commands = mapBatches[conn.nBatch];
+            if (valReply.isObject()) {
+                // An error for the batch as a whole
+                for (CCommand& command : commands)
+                    if (command.strError.empty())
+                        command.reply = valReply;
+            } else {
+                for (size_t i = 0; i < valReply.size(); i++) {
+                    const UniValue& id = find_value(valReply[i], "id");
+                    if (id.isNum() && id.get_int() >= 0 && (size_t)id.get_int() < commands.size())
+                        commands[id.get_int()].reply = valReply[i];
+                }
+            }
+            for (CCommand& command : commands)
+                if (command.strError.empty() && !command.reply.isObject())
+                    command.strError = "no reply from server";
+        } catch (const CConnectionFailed& e) {
+            return Fail(e.what(), true);
+        } catch (const std::exception& e) {
+            return Fail(e.what(), false);
+        }
+        mapDone[conn.nBatch] = true;
+        Print();
+        SendNext(conn);
+    }
+
+    static void batch_request_done(struct evhttp_request *req, void *ctx)
+    {
+        CConnection* conn = static_cast<CConnection*>(ctx);
+        http_request_done(req, &conn->response);
+        conn->batch->Done(*conn);
+    }
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010300
+    static void batch_error_cb(enum evhttp_request_error err, void *ctx)
+    {
+        static_cast<CConnection*>(ctx)->response.error = err;
+    }
+#endif
+
+public:
+    CStdinBatch() : nBatchesRead(0), nBatchesPrinted(0), nInFlight(0), fConnectionFailed(false), nRet(0) {}
+
+    int Run()
+    {
+        host = GetArg("-rpcconnect", "127.0.0.1");
+        int port = GetArg("-rpcport", BaseParams().RPCPort());
+        strAuthorization = GetAuthorization();
+        int nPipeline = std::max((int)GetArg("-pipeline", DEFAULT_PIPELINE), 1);
+
+        base = obtain_event_base();
+        for (int n = 0; n < nPipeline; n++) {
+            connections.emplace_back(new CConnection());
+            CConnection& conn = *connections.back();
+            conn.batch = this;
+            conn.evcon = obtain_evhttp_connection_base(base.get(), host, port);
+            evhttp_connection_set_timeout(conn.evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+        }
+        for (size_t n = 0; n < connections.size() && strFailure.empty(); n++)
+            SendNext(*connections[n]);
+
+        if (strFailure.empty() && nInFlight > 0)
+            event_base_dispatch(base.get());
+
+        if (fConnectionFailed)
+            throw CConnectionFailed(strFailure);
+        if (!strFailure.empty())
+            throw runtime_error(strFailure);
+        return nRet;
+    }
+};
+
 int CommandLineRPC(int argc, char *argv[])
 {
     string strPrint;
@@ -259,6 +555,9 @@ int CommandLineRPC(int argc, char *argv[])
             argv++;
         }
 
+        if (GetBoolArg("-stdin-batch", false))
+            return CStdinBatch().Run();
+
         // Method
         if (argc < 2)
             throw runtime_error("too few parameters");
@@ -275,34 +574,10 @@ int CommandLineRPC(int argc, char *argv[])
                 const UniValue reply = CallRPC(strMethod, params);
 
                 // Parse reply
-                const UniValue& result = find_value(reply, "result");
                 const UniValue& error  = find_value(reply, "error");
-
-                if (!error.isNull()) {
-                    // Error
-                    int code = error["code"].get_int();
-                    if (fWait && code == RPC_IN_WARMUP)
-                        throw CConnectionFailed("server in warmup");
-                    strPrint = "error: " + error.write();
-                    nRet = abs(code);
-                    if (error.isObject())
-                    {
-                        UniValue errCode = find_value(error, "code");
-                        UniValue errMsg  = find_value(error, "message");
-                        strPrint = errCode.isNull() ? "" : "error code: "+errCode.getValStr()+"\n";
-
-                        if (errMsg.isStr())
-                            strPrint += "error message:\n"+errMsg.get_str();
-                    }
-                } else {
-                    // Result
-                    if (result.isNull())
-                        strPrint = "";
-                    else if (result.isStr())
-                        strPrint = result.get_str();
-                    else
-                        strPrint = result.write(2);
-                }
+                if (fWait && !error.isNull() && error["code"].get_int() == RPC_IN_WARMUP)
+                    throw CConnectionFailed("server in warmup");
+                nRet = FormatReply(reply, strPrint);
                 // Connection succeeded, no need to retry.
                 break;
             }
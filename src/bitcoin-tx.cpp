@@ -17,13 +17,22 @@
 #include "utilstrencodings.h"
 
 #include <stdio.h>
+#include <iostream>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
+#include <boost/thread/mutex.hpp>
 
 using namespace std;
 
+//! The fewest transactions of a batch worth processing on a thread of their own
+static const size_t MIN_BATCH_TXS_PER_THREAD = 4;
+//! Lines of standard input read in batch mode before their results are written
+static const size_t BATCH_LINES = 1024;
+
 static bool fCreateBlank;
+static bool fBatch;
 static map<string,UniValue> registers;
 
 static bool AppInitRawTx(int argc, char* argv[])
@@ -40,6 +49,7 @@ static bool AppInitRawTx(int argc, char* argv[])
     }
 
     fCreateBlank = GetBoolArg("-create", false);
+    fBatch = GetBoolArg("-batch", false);
 
     if (argc<2 || mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help"))
     {
@@ -48,12 +58,17 @@ static bool AppInitRawTx(int argc, char* argv[])
             _("Usage:") + "\n" +
               "  zen-tx [options] <hex-tx> [commands]  " + _("Update hex-encoded zencash transaction") + "\n" +
               "  zen-tx [options] -create [commands]   " + _("Create hex-encoded zencash transaction") + "\n" +
+              "  zen-tx [options] -batch [commands]    " + _("Update or create each transaction read from standard input") + "\n" +
               "\n";
 
         fprintf(stdout, "%s", strUsage.c_str());
 
         strUsage = HelpMessageGroup(_("Options:"));
         strUsage += HelpMessageOpt("-?", _("This help message"));
+        strUsage += HelpMessageOpt("-batch", _("Read transactions from standard input, one JSON object per line: "
+            "{\"tx\":\"hex\",\"commands\":[\"COMMAND=VALUE\",...]}, where tx is left out to create one. "
+            "Each result is written on a line of its own, as an error if it failed. "
+            "Register commands are only given on the command line, once for all the transactions."));
         strUsage += HelpMessageOpt("-create", _("Create new, empty TX."));
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
@@ -87,6 +102,15 @@ static bool AppInitRawTx(int argc, char* argv[])
     return true;
 }
 
+/** The keys and previous outputs in the privatekeys and prevtxs registers, parsed once for all transactions signed */
+struct CSignInputs
+{
+    CBasicKeyStore keystore;
+    map<COutPoint, CScript> mapPrevOuts;
+};
+static boost::scoped_ptr<CSignInputs> signInputs;
+static boost::mutex cs_signInputs;
+
 static void RegisterSetJson(const string& key, const string& rawJson)
 {
     UniValue val;
@@ -96,6 +120,7 @@ static void RegisterSetJson(const string& key, const string& rawJson)
     }
 
     registers[key] = val;
+    signInputs.reset();
 }
 
 static void RegisterSet(const string& strInput)
@@ -323,28 +348,18 @@ vector<unsigned char> ParseHexUO(map<string,UniValue>& o, string strKey)
     return ParseHexUV(o[strKey], strKey);
 }
 
-static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
+static const CSignInputs& GetSignInputs()
 {
-    int nHashType = SIGHASH_ALL;
-
-    if (flagStr.size() > 0)
-        if (!findSighashFlags(nHashType, flagStr))
-            throw runtime_error("unknown sighash flag/sign option");
+    boost::unique_lock<boost::mutex> lock(cs_signInputs);
+    if (signInputs)
+        return *signInputs;
 
-    vector<CTransaction> txVariants;
-    txVariants.push_back(tx);
-
-    // mergedTx will end up with all the signatures; it
-    // starts as a clone of the raw tx:
-    CMutableTransaction mergedTx(txVariants[0]);
-    bool fComplete = true;
-    CCoinsView viewDummy;
-    CCoinsViewCache view(&viewDummy);
+    boost::scoped_ptr<CSignInputs> inputs(new CSignInputs());
 
     if (!registers.count("privatekeys"))
         throw runtime_error("privatekeys register variable must be set.");
     bool fGivenKeys = false;
-    CBasicKeyStore tempKeystore;
+    CBasicKeyStore& tempKeystore = inputs->keystore;
     UniValue keysObj = registers["privatekeys"];
     fGivenKeys = true;
 
@@ -384,17 +399,13 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                pair<map<COutPoint, CScript>::iterator, bool> ret = inputs->mapPrevOuts.insert(make_pair(COutPoint(txid, nOut), scriptPubKey));
+                if (!ret.second && ret.first->second != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + coins->vout[nOut].scriptPubKey.ToString() + "\nvs:\n"+
+                    err = err + ret.first->second.ToString() + "\nvs:\n"+
                         scriptPubKey.ToString();
                     throw runtime_error(err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0; // we don't know the actual output value
             }
 
             // if redeemScript given and private keys given,
@@ -409,30 +420,49 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
         }
     }
 
-    const CKeyStore& keystore = tempKeystore;
+    signInputs.swap(inputs);
+    return *signInputs;
+}
+
+static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
+{
+    int nHashType = SIGHASH_ALL;
+
+    if (flagStr.size() > 0)
+        if (!findSighashFlags(nHashType, flagStr))
+            throw runtime_error("unknown sighash flag/sign option");
+
+    const CSignInputs& inputs = GetSignInputs();
+    const CKeyStore& keystore = inputs.keystore;
+
+    // The signature hash of an input blanks the scripts of all others, so
+    // every input is signed against the transaction as it was given, which
+    // also holds the signatures to merge in
+    const CTransaction txVariant(tx);
+    const PrecomputedTransactionData txdata(txVariant);
+    bool fComplete = true;
 
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
     // Sign what we can:
-    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (!coins || !coins->IsAvailable(txin.prevout.n)) {
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        CTxIn& txin = tx.vin[i];
+        map<COutPoint, CScript>::const_iterator it = inputs.mapPrevOuts.find(txin.prevout);
+        if (it == inputs.mapPrevOuts.end()) {
             fComplete = false;
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
+        const CScript& prevPubKey = it->second;
 
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+        if (!fHashSingle || (i < tx.vout.size()))
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txVariant, i, nHashType, &txdata), prevPubKey, txin.scriptSig);
 
         // ... and merge in other signatures:
-        BOOST_FOREACH(const CTransaction& txv, txVariants) {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
-        }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_NONCONTEXTUAL_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&mergedTx, i)))
+        const TransactionSignatureChecker checker(&txVariant, i, nullptr, &txdata);
+        txin.scriptSig = CombineSignatures(prevPubKey, checker, txin.scriptSig, txVariant.vin[i].scriptSig);
+        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_NONCONTEXTUAL_SCRIPT_VERIFY_FLAGS, checker))
             fComplete = false;
     }
 
@@ -440,8 +470,6 @@ static void MutateTxSign(CMutableTransaction& tx, const string& flagStr)
         // do nothing... for now
         // perhaps store this for later optional JSON output
     }
-
-    tx = mergedTx;
 }
 
 class Secp256k1Init
@@ -457,11 +485,11 @@ public:
     }
 };
 
+static boost::scoped_ptr<Secp256k1Init> ecc;
+
 static void MutateTx(CMutableTransaction& tx, const string& command,
                      const string& commandVal)
 {
-    boost::scoped_ptr<Secp256k1Init> ecc;
-
     if (command == "nversion")
         MutateTxVersion(tx, commandVal);
     else if (command == "locktime")
@@ -547,6 +575,120 @@ static string readStdin()
     return ret;
 }
 
+static void ParseCommand(const string& arg, string& key, string& value)
+{
+    size_t eqpos = arg.find('=');
+    if (eqpos == string::npos)
+        key = arg;
+    else {
+        key = arg.substr(0, eqpos);
+        value = arg.substr(eqpos + 1);
+    }
+}
+
+/** Apply the commands of one line of a batch to its transaction, returning the result line */
+static string BatchTx(const string& strLine)
+{
+    try {
+        UniValue spec;
+        if (!spec.read(strLine) || !spec.isObject())
+            throw runtime_error("invalid transaction line");
+
+        CTransaction txDecodeTmp;
+        const UniValue& hexTx = find_value(spec, "tx");
+        if (!hexTx.isNull() && (!hexTx.isStr() || !DecodeHexTx(txDecodeTmp, hexTx.get_str())))
+            throw runtime_error("invalid transaction encoding");
+        CMutableTransaction tx(txDecodeTmp);
+
+        const UniValue& commands = find_value(spec, "commands");
+        if (!commands.isNull() && !commands.isArray())
+            throw runtime_error("commands must be an array");
+        for (size_t i = 0; i < commands.size(); i++) {
+            if (!commands[i].isStr())
+                throw runtime_error("command not a string");
+            string key, value;
+            ParseCommand(commands[i].get_str(), key, value);
+            // The registers are shared by all the transactions of the batch
+            if (key == "load" || key == "set")
+                throw runtime_error("register commands are only allowed on the command line");
+
+            MutateTx(tx, key, value);
+        }
+
+        if (GetBoolArg("-json", false)) {
+            UniValue entry(UniValue::VOBJ);
+            TxToUniv(tx, uint256(), entry);
+            return entry.write();
+        } else if (GetBoolArg("-txid", false))
+            return tx.GetHash().GetHex();
+        return EncodeHexTx(tx);
+    }
+    catch (const std::exception& e) {
+        return string("error: ") + e.what();
+    }
+}
+
+/**
+ * Process the transactions read from standard input, one per line, after the
+ * register commands given on the command line. The keys and previous outputs
+ * of the registers are parsed once for all of them, and runs of lines are
+ * processed on threads of their own; the results are written in the order
+ * of the lines, as each chunk of them is done.
+ */
+static int CommandLineBatchTx(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        string key, value;
+        ParseCommand(argv[i], key, value);
+        if (key == "load")
+            RegisterLoad(value);
+        else if (key == "set")
+            RegisterSet(value);
+        else
+            throw runtime_error("only register commands are allowed on the command line with -batch");
+    }
+
+    // Started once, rather than by the first transaction signed
+    ecc.reset(new Secp256k1Init());
+
+    int nRet = 0;
+    vector<string> vLines;
+    vLines.reserve(BATCH_LINES);
+    while (!cin.eof()) {
+        vLines.clear();
+        string line;
+        while (vLines.size() < BATCH_LINES && getline(cin, line)) {
+            boost::algorithm::trim_right(line);
+            if (!line.empty())
+                vLines.push_back(line);
+        }
+        if (cin.bad())
+            throw runtime_error("error reading stdin");
+
+        vector<string> vResults(vLines.size());
+        size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vLines.size() / MIN_BATCH_TXS_PER_THREAD);
+        nThreads = std::max(nThreads, (size_t)1);
+        auto worker = [&](size_t nThread) {
+            for (size_t i = vLines.size() * nThread / nThreads; i < vLines.size() * (nThread + 1) / nThreads; i++)
+                vResults[i] = BatchTx(vLines[i]);
+        };
+        vector<std::thread> threads;
+        for (size_t n = 1; n < nThreads; n++)
+            threads.emplace_back(worker, n);
+        worker(0);
+        for (std::thread& t : threads)
+            t.join();
+
+        for (const string& result : vResults) {
+            if (boost::algorithm::starts_with(result, "error: "))
+                nRet = EXIT_FAILURE;
+            fprintf(stdout, "%s\n", result.c_str());
+        }
+        fflush(stdout);
+    }
+    return nRet;
+}
+
 static int CommandLineRawTx(int argc, char* argv[])
 {
     string strPrint;
@@ -559,6 +701,9 @@ static int CommandLineRawTx(int argc, char* argv[])
             argv++;
         }
 
+        if (fBatch)
+            return CommandLineBatchTx(argc, argv);
+
         CTransaction txDecodeTmp;
         int startArg;
 
@@ -582,15 +727,8 @@ static int CommandLineRawTx(int argc, char* argv[])
         CMutableTransaction tx(txDecodeTmp);
 
         for (int i = startArg; i < argc; i++) {
-            string arg = argv[i];
             string key, value;
-            size_t eqpos = arg.find('=');
-            if (eqpos == string::npos)
-                key = arg;
-            else {
-                key = arg.substr(0, eqpos);
-                value = arg.substr(eqpos + 1);
-            }
+            ParseCommand(argv[i], key, value);
 
             MutateTx(tx, key, value);
         }
@@ -641,5 +779,9 @@ int main(int argc, char* argv[])
     } catch (...) {
         PrintExceptionContinue(NULL, "CommandLineRawTx()");
     }
+
+    // Free the keys while the pool of locked memory holding them is still there
+    signInputs.reset();
+    ecc.reset();
     return ret;
 }
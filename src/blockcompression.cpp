@@ -0,0 +1,117 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "blockcompression.h"
+
+#include "consensus/consensus.h"
+#include "crypto/common.h"
+
+#include <string.h>
+
+#if ENABLE_ZLIB
+#include <zlib.h>
+
+/**
+ * Preset dictionary of the compressed records. zlib takes the most common
+ * strings to be at its end: replay protected and plain P2PKH and P2SH output
+ * scripts, signature and key pushes of their inputs, sequences, versions and
+ * zero amounts. Records store its checksum, so it must never change; another
+ * dictionary needs another record flag.
+ */
+static const unsigned char BLOCK_DICTIONARY[] = {
+    // Coinbase and JoinSplit transactions
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0xff, 0xff, 0xfd, 0xff, 0xff, 0xff, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+    // P2SH outputs, plain then replay protected
+    0x17, 0xa9, 0x14, 0x87, 0x3d, 0xa9, 0x14, 0x87, 0x20,
+    // Input signatures and keys
+    0x48, 0x30, 0x45, 0x02, 0x21, 0x00, 0x02, 0x20, 0x01, 0x21, 0x03,
+    0x6a, 0x47, 0x30, 0x44, 0x02, 0x20, 0x02, 0x20, 0x01, 0x21, 0x02,
+    0xff, 0xff, 0xff, 0xff, 0x6b, 0x48, 0x30, 0x45, 0x02, 0x21, 0x00,
+    // P2PKH outputs, plain then replay protected
+    0x00, 0x00, 0x00, 0x00, 0x19, 0x76, 0xa9, 0x14, 0x88, 0xac,
+    0x00, 0x00, 0x00, 0x00, 0x3f, 0x76, 0xa9, 0x14, 0x88, 0xac, 0x20, 0x03, 0xb4,
+    0xff, 0xff, 0xff, 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x76, 0xa9, 0x14,
+    0x88, 0xac, 0x20, 0x03, 0xb4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x76, 0xa9, 0x14,
+};
+#endif
+
+bool CanCompressBlocks()
+{
+#if ENABLE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool CompressBlockData(const char* pch, size_t nSize, std::vector<char>& vData)
+{
+#if ENABLE_ZLIB
+    if (nSize > MAX_BLOCK_SIZE)
+        return false;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit(&zs, BLOCK_COMPRESSION_LEVEL) != Z_OK)
+        return false;
+    bool fOk = deflateSetDictionary(&zs, BLOCK_DICTIONARY, sizeof(BLOCK_DICTIONARY)) == Z_OK;
+    if (fOk) {
+        vData.resize(4 + deflateBound(&zs, nSize));
+        WriteLE32((unsigned char*)vData.data(), nSize);
+        zs.next_in = (Bytef*)pch;
+        zs.avail_in = nSize;
+        zs.next_out = (Bytef*)vData.data() + 4;
+        zs.avail_out = vData.size() - 4;
+        // deflateBound leaves room for the whole stream in one call
+        fOk = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+    }
+    size_t nData = 4 + zs.total_out;
+    deflateEnd(&zs);
+
+    if (!fOk || nData >= nSize)
+        return false;
+    vData.resize(nData);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool DecompressBlockData(const char* pch, size_t nSize, std::vector<char>& vBlock)
+{
+#if ENABLE_ZLIB
+    if (nSize < 4)
+        return false;
+    unsigned int nBlockSize = ReadLE32((const unsigned char*)pch);
+    if (nBlockSize > MAX_BLOCK_SIZE)
+        return false;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK)
+        return false;
+    vBlock.resize(nBlockSize);
+    zs.next_in = (Bytef*)pch + 4;
+    zs.avail_in = nSize - 4;
+    zs.next_out = (Bytef*)vBlock.data();
+    zs.avail_out = nBlockSize;
+    int ret = inflate(&zs, Z_FINISH);
+    if (ret == Z_NEED_DICT) {
+        // Fails if the record was compressed with another dictionary
+        if (inflateSetDictionary(&zs, BLOCK_DICTIONARY, sizeof(BLOCK_DICTIONARY)) == Z_OK)
+            ret = inflate(&zs, Z_FINISH);
+    }
+    bool fOk = ret == Z_STREAM_END && zs.avail_out == 0 && zs.avail_in == 0;
+    inflateEnd(&zs);
+    return fOk;
+#else
+    return false;
+#endif
+}
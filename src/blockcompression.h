@@ -0,0 +1,37 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCOMPRESSION_H
+#define BITCOIN_BLOCKCOMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Set in the size field of a block file record header when the record holds
+ * a compressed block; the rest of the field is the size of the compressed
+ * data. Uncompressed blocks are far below this size, so both kinds of records
+ * can share a block file.
+ */
+static const unsigned int BLOCK_RECORD_COMPRESSED = 0x80000000;
+
+//! zlib level of -compressblocks, blocks are compressed under cs_main
+static const int BLOCK_COMPRESSION_LEVEL = 1;
+
+/** Whether this build can compress block files, it needs zlib */
+bool CanCompressBlocks();
+
+/**
+ * Compress a serialized block into the data of a compressed record: the
+ * uncompressed size, then a zlib stream primed with a fixed dictionary of the
+ * bytes common to Zen transactions so that each block can be decompressed on
+ * its own. Returns false if zlib is missing or nothing would be saved.
+ */
+bool CompressBlockData(const char* pch, size_t nSize, std::vector<char>& vData);
+
+/** Decompress the data of a compressed record, returns false if it is corrupt */
+bool DecompressBlockData(const char* pch, size_t nSize, std::vector<char>& vBlock);
+
+#endif // BITCOIN_BLOCKCOMPRESSION_H
@@ -0,0 +1,152 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilewriter.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <boost/thread.hpp>
+
+bool CBlockFileWriter::WriteRecord(const CRecord& record)
+{
+    FILE* file = (record.type == BLOCK_FILE) ? OpenBlockFile(record.pos) : OpenUndoFile(record.pos);
+    if (!file)
+        return error("%s: cannot open the file of %s", __func__, record.pos.ToString());
+#ifdef WIN32
+    bool fOk = fwrite(record.data->data(), 1, record.data->size(), file) == record.data->size();
+#else
+    // The record goes to the file in as few writes as it can, bypassing the stdio buffer
+    bool fOk = true;
+    const char* pch = record.data->data();
+    size_t nLeft = record.data->size();
+    off_t nOffset = record.pos.nPos;
+    while (nLeft > 0) {
+        ssize_t nWritten = pwrite(fileno(file), pch, nLeft, nOffset);
+        if (nWritten < 0) {
+            if (errno == EINTR)
+                continue;
+            fOk = false;
+            break;
+        }
+        pch += nWritten;
+        nLeft -= nWritten;
+        nOffset += nWritten;
+    }
+#endif
+    if (fclose(file) != 0)
+        fOk = false;
+    if (!fOk)
+        return error("%s: write failed at %s", __func__, record.pos.ToString());
+    return true;
+}
+
+void CBlockFileWriter::PopWritten(bool fOk)
+{
+    const CRecord& record = queue.front();
+    if (fOk)
+        setDirtyFiles.insert(std::make_pair((int)record.type, record.pos.nFile));
+    else
+        fFailed = true;
+    nQueuedBytes -= record.data->size();
+    mapPending.erase(GetKey(record.type, record.pos));
+    queue.pop_front();
+    condWritten.notify_all();
+}
+
+bool CBlockFileWriter::Write(FileType type, const CDiskBlockPos& pos, CPublicSerializeData& data)
+{
+    CRecord record;
+    record.type = type;
+    record.pos = pos;
+    CPublicSerializeData* pdata = new CPublicSerializeData();
+    pdata->swap(data);
+    record.data.reset(pdata);
+
+    // Waiting for room in the queue must not throw out of validation
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (fFailed)
+        return false;
+
+    if (!fThreadRunning && queue.empty()) {
+        bool fOk = WriteRecord(record);
+        if (fOk)
+            setDirtyFiles.insert(std::make_pair((int)type, pos.nFile));
+        else
+            fFailed = true;
+        return fOk;
+    }
+
+    while (fThreadRunning && nQueuedBytes > MAX_BLOCK_FILE_WRITE_QUEUE)
+        condWritten.wait(lock);
+    queue.push_back(record);
+    mapPending[GetKey(type, pos)] = record.data;
+    nQueuedBytes += record.data->size();
+    condQueued.notify_one();
+    return true;
+}
+
+boost::shared_ptr<const CPublicSerializeData> CBlockFileWriter::FindPending(FileType type, const CDiskBlockPos& pos)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    std::map<RecordKey, boost::shared_ptr<const CPublicSerializeData> >::const_iterator it = mapPending.find(GetKey(type, pos));
+    if (it == mapPending.end())
+        return boost::shared_ptr<const CPublicSerializeData>();
+    return it->second;
+}
+
+bool CBlockFileWriter::Sync()
+{
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (!queue.empty()) {
+        if (fThreadRunning) {
+            condWritten.wait(lock);
+            continue;
+        }
+        // The thread is gone, on shutdown: write what it left here
+        PopWritten(WriteRecord(queue.front()));
+    }
+
+    for (const std::pair<int, int>& file : setDirtyFiles) {
+        CDiskBlockPos pos(file.second, 0);
+        FILE* fileout = (file.first == BLOCK_FILE) ? OpenBlockFile(pos) : OpenUndoFile(pos);
+        if (fileout) {
+            FileCommit(fileout);
+            fclose(fileout);
+        }
+    }
+    setDirtyFiles.clear();
+    return !fFailed;
+}
+
+void CBlockFileWriter::Thread()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    fThreadRunning = true;
+    try {
+        while (true) {
+            while (queue.empty())
+                condQueued.wait(lock);
+            // The record stays queued, and readable, until it is written
+            CRecord record = queue.front();
+            lock.unlock();
+            bool fOk = WriteRecord(record);
+            lock.lock();
+            PopWritten(fOk);
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Only waiting for records is interrupted, the lock is held again
+        fThreadRunning = false;
+        condWritten.notify_all();
+        throw;
+    }
+}
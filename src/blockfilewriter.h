@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEWRITER_H
+#define BITCOIN_BLOCKFILEWRITER_H
+
+#include "chain.h"
+#include "streams.h"
+
+#include <deque>
+#include <map>
+#include <set>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+//! Bytes of records queued for writing past which validation waits for the writer
+static const size_t MAX_BLOCK_FILE_WRITE_QUEUE = 64 << 20;
+
+/**
+ * Writes the records of the block and undo files on a thread of its own, so
+ * that validation does not wait for the disk while it holds cs_main.
+ *
+ * A record is queued, index header included, at the position FindBlockPos or
+ * FindUndoPos gave it, and is read back from the queue until it is written.
+ * Sync waits until everything queued is written, then commits the files
+ * written to since the last Sync in one go: the block index may only refer
+ * to records once they are synced. While the thread is not running, records
+ * are written right away by whoever queues them.
+ */
+class CBlockFileWriter
+{
+public:
+    enum FileType {
+        BLOCK_FILE,
+        UNDO_FILE,
+    };
+
+    CBlockFileWriter() : nQueuedBytes(0), fThreadRunning(false), fFailed(false) {}
+
+    /** Queue the record starting at pos, taking data. Returns false if a write has failed. */
+    bool Write(FileType type, const CDiskBlockPos& pos, CPublicSerializeData& data);
+
+    /** The record starting at pos that is not written yet, NULL if there is none */
+    boost::shared_ptr<const CPublicSerializeData> FindPending(FileType type, const CDiskBlockPos& pos);
+
+    /** Write everything queued and commit the files written to. Returns false if a write has failed. */
+    bool Sync();
+
+    /** Write the records queued as they come, until interrupted */
+    void Thread();
+
+private:
+    struct CRecord {
+        FileType type;
+        CDiskBlockPos pos;
+        boost::shared_ptr<const CPublicSerializeData> data;
+    };
+    typedef std::pair<int, std::pair<int, unsigned int> > RecordKey;
+
+    boost::mutex cs;
+    boost::condition_variable condQueued;
+    boost::condition_variable condWritten;
+    //! Records to write in order, the front one is being written by the thread
+    std::deque<CRecord> queue;
+    std::map<RecordKey, boost::shared_ptr<const CPublicSerializeData> > mapPending;
+    size_t nQueuedBytes;
+    //! Files written to since the last Sync, by type and number
+    std::set<std::pair<int, int> > setDirtyFiles;
+    bool fThreadRunning;
+    bool fFailed;
+
+    static RecordKey GetKey(FileType type, const CDiskBlockPos& pos)
+    {
+        return std::make_pair((int)type, std::make_pair(pos.nFile, pos.nPos));
+    }
+
+    static bool WriteRecord(const CRecord& record);
+    /** Remove the front record of the queue once written, cs must be held */
+    void PopWritten(bool fOk);
+};
+
+#endif // BITCOIN_BLOCKFILEWRITER_H
@@ -0,0 +1,240 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+#include <ios>
+#include <limits>
+
+namespace {
+
+/** Writes bits most significant first, as BIP 158 does. */
+class BitWriter
+{
+private:
+    std::vector<unsigned char>& out;
+    unsigned char buffer;
+    int nBits;
+
+public:
+    BitWriter(std::vector<unsigned char>& outIn) : out(outIn), buffer(0), nBits(0) {}
+
+    void Write(uint64_t data, int bits)
+    {
+        while (bits > 0) {
+            int n = std::min(8 - nBits, bits);
+            buffer |= ((data >> (bits - n)) & ((1 << n) - 1)) << (8 - nBits - n);
+            nBits += n;
+            bits -= n;
+            if (nBits == 8)
+                Flush();
+        }
+    }
+
+    void Flush()
+    {
+        if (nBits == 0)
+            return;
+        out.push_back(buffer);
+        buffer = 0;
+        nBits = 0;
+    }
+};
+
+class BitReader
+{
+private:
+    const std::vector<unsigned char>& in;
+    size_t nPos;
+    int nBits;
+
+public:
+    BitReader(const std::vector<unsigned char>& inIn, size_t nPosIn) : in(inIn), nPos(nPosIn), nBits(0) {}
+
+    uint64_t Read(int bits)
+    {
+        uint64_t data = 0;
+        while (bits > 0) {
+            if (nPos >= in.size())
+                throw std::ios_base::failure("GCS filter is truncated");
+            int n = std::min(8 - nBits, bits);
+            data = (data << n) | ((in[nPos] >> (8 - nBits - n)) & ((1 << n) - 1));
+            nBits += n;
+            bits -= n;
+            if (nBits == 8) {
+                nPos++;
+                nBits = 0;
+            }
+        }
+        return data;
+    }
+};
+
+void GolombRiceEncode(BitWriter& writer, uint64_t x)
+{
+    for (uint64_t q = x >> GCSFilter::P; q > 0; q--)
+        writer.Write(1, 1);
+    writer.Write(0, 1);
+    writer.Write(x, GCSFilter::P);
+}
+
+uint64_t GolombRiceDecode(BitReader& reader)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    return (q << GCSFilter::P) + reader.Read(GCSFilter::P);
+}
+
+/** Compute (x * n) >> 64, mapping a uniform 64-bit hash into [0, n). */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (static_cast<unsigned __int128>(x) * static_cast<unsigned __int128>(n)) >> 64;
+#else
+    uint64_t a = x >> 32, b = x & 0xffffffff;
+    uint64_t c = n >> 32, d = n & 0xffffffff;
+    uint64_t ad = a * d, bc = b * c, bd = b * d;
+    uint64_t mid = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff);
+    return a * c + (ad >> 32) + (bc >> 32) + (mid >> 32);
+#endif
+}
+
+}
+
+GCSFilter::GCSFilter() : k0(0), k1(0), nElements(0), nRange(0), encoded(1, 0)
+{
+}
+
+GCSFilter::GCSFilter(const uint256& hashBlock, const ElementSet& elements) :
+    k0(ReadLE64(hashBlock.begin())), k1(ReadLE64(hashBlock.begin() + 8)),
+    nElements(elements.size()), nRange((uint64_t)elements.size() * M)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, nElements);
+    encoded.assign(ss.begin(), ss.end());
+
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const Element& element : elements)
+        vHashes.push_back(HashToRange(element));
+    std::sort(vHashes.begin(), vHashes.end());
+
+    BitWriter writer(encoded);
+    uint64_t nLast = 0;
+    for (uint64_t hash : vHashes) {
+        GolombRiceEncode(writer, hash - nLast);
+        nLast = hash;
+    }
+    writer.Flush();
+}
+
+GCSFilter::GCSFilter(const uint256& hashBlock, const std::vector<unsigned char>& encodedIn) :
+    k0(ReadLE64(hashBlock.begin())), k1(ReadLE64(hashBlock.begin() + 8)), encoded(encodedIn)
+{
+    CDataStream ss(encoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t n = ReadCompactSize(ss);
+    if (n > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("GCS filter has too many elements");
+    nElements = n;
+    nRange = (uint64_t)nElements * M;
+
+    // Check that all the elements decode
+    BitReader reader(encoded, encoded.size() - ss.size());
+    for (uint32_t i = 0; i < nElements; i++)
+        GolombRiceDecode(reader);
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(k0, k1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(hash, nRange);
+}
+
+bool GCSFilter::MatchSorted(const std::vector<uint64_t>& vQuery) const
+{
+    CDataStream ss(encoded, SER_NETWORK, PROTOCOL_VERSION);
+    ReadCompactSize(ss);
+    BitReader reader(encoded, encoded.size() - ss.size());
+
+    uint64_t nValue = 0;
+    std::vector<uint64_t>::const_iterator it = vQuery.begin();
+    for (uint32_t i = 0; i < nElements && it != vQuery.end(); i++) {
+        nValue += GolombRiceDecode(reader);
+        while (it != vQuery.end() && *it < nValue)
+            ++it;
+        if (it != vQuery.end() && *it == nValue)
+            return true;
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    if (nElements == 0)
+        return false;
+    return MatchSorted(std::vector<uint64_t>(1, HashToRange(element)));
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    if (nElements == 0 || elements.empty())
+        return false;
+    std::vector<uint64_t> vQuery;
+    vQuery.reserve(elements.size());
+    for (const Element& element : elements)
+        vQuery.push_back(HashToRange(element));
+    std::sort(vQuery.begin(), vQuery.end());
+    return MatchSorted(vQuery);
+}
+
+CBlockFilter::CBlockFilter(const CBlock& block, const CBlockUndo& blockundo) :
+    hashBlock(block.GetHash()), fHasJoinSplits(false)
+{
+    GCSFilter::ElementSet elements;
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.vjoinsplit.empty())
+            fHasJoinSplits = true;
+        for (const CTxOut& txout : tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(GetFilterElement(script));
+        }
+    }
+    for (const CTxUndo& txundo : blockundo.vtxundo) {
+        for (const CTxInUndo& prevout : txundo.vprevout) {
+            const CScript& script = prevout.txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(GetFilterElement(script));
+        }
+    }
+    filter = GCSFilter(hashBlock, elements);
+}
+
+GCSFilter::Element GetFilterElement(const CScript& scriptPubKey)
+{
+    // Find where the last three operations, <hash> <height> OP_CHECKBLOCKATHEIGHT, start
+    std::vector<CScript::const_iterator> vOpStarts;
+    CScript::const_iterator pc = scriptPubKey.begin();
+    opcodetype opcode = OP_INVALIDOPCODE;
+    while (pc < scriptPubKey.end()) {
+        vOpStarts.push_back(pc);
+        if (!scriptPubKey.GetOp(pc, opcode))
+            return GCSFilter::Element(scriptPubKey.begin(), scriptPubKey.end());
+    }
+    if (vOpStarts.size() > 3 && opcode == OP_CHECKBLOCKATHEIGHT)
+        return GCSFilter::Element(scriptPubKey.begin(), vOpStarts[vOpStarts.size() - 3]);
+    return GCSFilter::Element(scriptPubKey.begin(), scriptPubKey.end());
+}
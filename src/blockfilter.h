@@ -0,0 +1,99 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+class CScript;
+
+/**
+ * A Golomb-coded set (BIP 158): a compact, probabilistic set of byte strings
+ * which has no false negatives and a false positive rate of 1/M per query.
+ * The elements are hashed with SipHash keyed by a block hash, mapped into
+ * [0, N * M), sorted and the differences stored Golomb-Rice coded with
+ * parameter P.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    static const int P = 19;
+    static const uint32_t M = 784931;
+
+private:
+    uint64_t k0, k1;
+    uint32_t nElements;
+    uint64_t nRange;
+    std::vector<unsigned char> encoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    bool MatchSorted(const std::vector<uint64_t>& vQuery) const;
+
+public:
+    GCSFilter();
+    /** Build the filter of a set of elements, keyed by the given block hash. */
+    GCSFilter(const uint256& hashBlock, const ElementSet& elements);
+    /** Reconstruct a filter from its encoding, throwing std::ios_base::failure if it is malformed. */
+    GCSFilter(const uint256& hashBlock, const std::vector<unsigned char>& encodedIn);
+
+    uint32_t GetN() const { return nElements; }
+    const std::vector<unsigned char>& GetEncoded() const { return encoded; }
+
+    bool Match(const Element& element) const;
+    /** Whether any of the elements matches, in a single pass over the filter. */
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+/**
+ * The filter index entry of a block: a GCSFilter of the scriptPubKeys that
+ * the block creates and spends. Shielded outputs cannot be filtered, so
+ * whether the block has any JoinSplit is recorded alongside.
+ */
+class CBlockFilter
+{
+private:
+    uint256 hashBlock;
+    bool fHasJoinSplits;
+    GCSFilter filter;
+
+public:
+    CBlockFilter() : fHasJoinSplits(false) {}
+    CBlockFilter(const CBlock& block, const CBlockUndo& blockundo);
+
+    const uint256& GetBlockHash() const { return hashBlock; }
+    bool HasJoinSplits() const { return fHasJoinSplits; }
+    const GCSFilter& GetFilter() const { return filter; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(fHasJoinSplits);
+        std::vector<unsigned char> encoded = filter.GetEncoded();
+        READWRITE(encoded);
+        if (ser_action.ForRead())
+            filter = GCSFilter(hashBlock, encoded);
+    }
+};
+
+/**
+ * The form of a scriptPubKey that goes into block filters: the script
+ * without its OP_CHECKBLOCKATHEIGHT replay protection suffix, which differs
+ * between outputs to the same address.
+ */
+GCSFilter::Element GetFilterElement(const CScript& scriptPubKey);
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,197 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockreplay.h"
+
+#include "chain.h"
+#include "init.h"
+#include "main.h"
+#include "metrics.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validationinterface.h"
+
+#include <univalue.h>
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread.hpp>
+
+/** Progress of the replay at some point */
+struct CReplaySnapshot
+{
+    int64_t nTimeMicros;
+    int nHeight;
+    uint64_t nChainTx;
+    uint64_t nFullFlushes;
+    uint64_t nWriteFlushes;
+    CBlockConnectTotals totals;
+
+    CReplaySnapshot() : nTimeMicros(0), nHeight(-1), nChainTx(0), nFullFlushes(0), nWriteFlushes(0) {}
+};
+
+/** FlushStateToDisk runs of a kind, from the histogram timing them */
+static uint64_t CountFlushes(const std::string& kind)
+{
+    std::vector<uint64_t> counts;
+    uint64_t sum;
+    flushStateTimes.get(kind).snapshot(counts, sum);
+    uint64_t nCount = 0;
+    for (uint64_t count : counts)
+        nCount += count;
+    return nCount;
+}
+
+/** Peak resident set size of the process, in bytes */
+static uint64_t GetPeakRSS()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef MAC_OSX
+    return usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+static CReplaySnapshot TakeReplaySnapshot(const CBlockIndex* pindex)
+{
+    CReplaySnapshot snapshot;
+    snapshot.nTimeMicros = GetTimeMicros();
+    if (pindex) {
+        snapshot.nHeight = pindex->nHeight;
+        snapshot.nChainTx = pindex->nChainTx;
+    }
+    snapshot.nFullFlushes = CountFlushes("full");
+    snapshot.nWriteFlushes = CountFlushes("write");
+    std::vector<CBlockConnectStats> vRecent;
+    GetBlockConnectStats(0, vRecent, snapshot.totals);
+    return snapshot;
+}
+
+/**
+ * Takes the snapshots of the measured range as the tip moves: ChainTip is
+ * signalled from ConnectTip for every block, even during initial block
+ * download, under cs_main.
+ */
+class CBlockReplayMonitor : public CValidationInterface
+{
+public:
+    int nStartHeight;
+    int nStopHeight;
+    CReplaySnapshot start;
+    CReplaySnapshot end;
+    bool fStarted;
+    bool fEnded;
+
+    CBlockReplayMonitor(int nStartHeightIn, int nStopHeightIn) :
+        nStartHeight(nStartHeightIn), nStopHeight(nStopHeightIn), fStarted(false), fEnded(false) {}
+
+protected:
+    void ChainTip(const CBlockIndex* pindex, const CBlock* pblock, ZCIncrementalMerkleTree tree, bool added)
+    {
+        if (!added || fEnded)
+            return;
+        if (!fStarted && pindex->nHeight + 1 >= nStartHeight) {
+            start = TakeReplaySnapshot(pindex);
+            fStarted = true;
+        }
+        if (fStarted && nStopHeight > 0 && pindex->nHeight >= nStopHeight) {
+            end = TakeReplaySnapshot(pindex);
+            fEnded = true;
+        }
+    }
+};
+
+static void WriteReplayReport(const boost::filesystem::path& dir, const CBlockReplayMonitor& monitor)
+{
+    const CReplaySnapshot& start = monitor.start;
+    const CReplaySnapshot& end = monitor.end;
+    double dSeconds = std::max(end.nTimeMicros - start.nTimeMicros, (int64_t)1) * 0.000001;
+    int nBlocks = end.nHeight - start.nHeight;
+    uint64_t nTx = end.nChainTx - start.nChainTx;
+
+    UniValue report(UniValue::VOBJ);
+    report.pushKV("dir", dir.string());
+    report.pushKV("startheight", start.nHeight + 1);
+    report.pushKV("endheight", end.nHeight);
+    report.pushKV("blocks", nBlocks);
+    report.pushKV("tx", nTx);
+    report.pushKV("seconds", dSeconds);
+    report.pushKV("blockspersecond", nBlocks / dSeconds);
+    report.pushKV("txpersecond", nTx / dSeconds);
+    report.pushKV("peakrss", GetPeakRSS());
+    report.pushKV("fullflushes", end.nFullFlushes - start.nFullFlushes);
+    report.pushKV("writeflushes", end.nWriteFlushes - start.nWriteFlushes);
+
+    // The options worth comparing runs by
+    UniValue settings(UniValue::VOBJ);
+    settings.pushKV("dbcache", GetArg("-dbcache", nDefaultDbCache));
+    settings.pushKV("par", GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS));
+    settings.pushKV("datadir", GetDataDir().string());
+    report.pushKV("settings", settings);
+
+    UniValue phases(UniValue::VOBJ);
+    for (int phase = 0; phase < CONNECT_PHASE_COUNT; phase++)
+        phases.pushKV(GetBlockConnectPhaseName(phase), (end.totals.vTotalMicros[phase] - start.totals.vTotalMicros[phase]) * 0.000001);
+    report.pushKV("phaseseconds", phases);
+
+    LogPrintf("Block replay: %d blocks (%d to %d) and %u transactions in %.1fs, %.1f blocks/s, %.1f tx/s, peak RSS %uMiB, %u full and %u write flushes\n",
+              nBlocks, start.nHeight + 1, end.nHeight, nTx, dSeconds, nBlocks / dSeconds, nTx / dSeconds,
+              GetPeakRSS() >> 20, end.nFullFlushes - start.nFullFlushes, end.nWriteFlushes - start.nWriteFlushes);
+    for (int phase = 0; phase < CONNECT_PHASE_COUNT; phase++)
+        LogPrintf("Block replay:   %-10s %.3fs\n", GetBlockConnectPhaseName(phase), (end.totals.vTotalMicros[phase] - start.totals.vTotalMicros[phase]) * 0.000001);
+
+    boost::filesystem::path pathReport = GetDataDir() / BLOCK_REPLAY_REPORT_FILE;
+    boost::filesystem::ofstream file(pathReport);
+    file << report.write(4) << std::endl;
+    if (!file.good())
+        LogPrintf("Block replay: could not write %s\n", pathReport.string());
+}
+
+void ReplayBlockFiles(const boost::filesystem::path& dir, int nStartHeight)
+{
+    CBlockReplayMonitor monitor(nStartHeight, GetArg("-stopatheight", DEFAULT_STOPATHEIGHT));
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() + 1 >= nStartHeight) {
+            if (chainActive.Height() >= nStartHeight)
+                LogPrintf("Block replay: the chain is already at height %d, the blocks below are not replayed; use an empty datadir\n", chainActive.Height());
+            monitor.start = TakeReplaySnapshot(chainActive.Tip());
+            monitor.fStarted = true;
+        }
+    }
+    RegisterValidationInterface(&monitor);
+
+    try {
+        LogPrintf("Block replay: replaying the block files of %s\n", dir.string());
+        for (int nFile = 0; !ShutdownRequested(); nFile++) {
+            boost::filesystem::path path = dir / strprintf("blk%05u.dat", nFile);
+            FILE* file = fopen(path.string().c_str(), "rb");
+            if (!file)
+                break;
+            LogPrintf("Block replay: importing %s\n", path.string());
+            LoadBlocksFromExternalFile(file, NULL, /*loadHeadersOnly*/false);
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Shutting down, still report what was replayed
+    }
+
+    UnregisterValidationInterface(&monitor);
+    {
+        LOCK(cs_main);
+        if (!monitor.fEnded)
+            monitor.end = TakeReplaySnapshot(chainActive.Tip());
+    }
+    if (monitor.fStarted)
+        WriteReplayReport(dir, monitor);
+    else
+        LogPrintf("Block replay: the block files end before height %d\n", nStartHeight);
+    StartShutdown();
+}
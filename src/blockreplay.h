@@ -0,0 +1,26 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKREPLAY_H
+#define BITCOIN_BLOCKREPLAY_H
+
+#include <boost/filesystem/path.hpp>
+
+//! Name of the -replayblocks report, in the datadir
+static const char* const BLOCK_REPLAY_REPORT_FILE = "replay.json";
+
+/**
+ * Replay the blk?????.dat files of a directory, in order and until one is
+ * missing, through the same path as -loadblock, as a benchmark of initial
+ * block download on real blocks.
+ *
+ * The blocks below nStartHeight are connected but not measured; the replay
+ * ends with the files or once the tip reaches -stopatheight. The blocks and
+ * transactions per second, peak RSS, chainstate flushes and the totals of
+ * each ConnectBlock phase over the measured blocks are logged and written
+ * to BLOCK_REPLAY_REPORT_FILE, then the node shuts down.
+ */
+void ReplayBlockFiles(const boost::filesystem::path& dir, int nStartHeight);
+
+#endif // BITCOIN_BLOCKREPLAY_H
@@ -0,0 +1,180 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockview.h"
+
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "streams.h"
+#include "version.h"
+
+#include "crypto/common.h"
+
+//! nVersion, hashPrevBlock, hashMerkleRoot, hashReserved, nTime, nBits and nNonce
+static const size_t BLOCK_HEADER_FIXED_SIZE = 4 + 32 + 32 + 32 + 4 + 4 + 32;
+
+/** Where the reader is, in the bytes ending at pend */
+static const char* GetReadPos(const CMemoryReader& s, const char* pend)
+{
+    return pend - s.size();
+}
+
+/** Skip a script or other byte vector, its size first */
+static void SkipBytes(CMemoryReader& s)
+{
+    s.ignore(ReadCompactSize(s));
+}
+
+static size_t ComputeJoinSplitSize(int32_t nTxVersion)
+{
+    JSDescription jsdesc;
+    if (nTxVersion == GROTH_TX_VERSION)
+        jsdesc.proof = libzcash::GrothProof();
+    return jsdesc.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION, nTxVersion);
+}
+
+/** JoinSplit descriptions are all of the same size for a transaction version, only their proofs differ */
+static size_t GetJoinSplitSize(int32_t nTxVersion)
+{
+    static const size_t nPHGRSize = ComputeJoinSplitSize(PHGR_TX_VERSION);
+    static const size_t nGrothSize = ComputeJoinSplitSize(GROTH_TX_VERSION);
+    return nTxVersion == GROTH_TX_VERSION ? nGrothSize : nPHGRSize;
+}
+
+/** Skip the inputs or outputs of a transaction, noting where each starts and where the last ends if vOffsets is given */
+static void SkipTxIns(CMemoryReader& s, const char* pbegin, const char* pend, std::vector<uint32_t>* vOffsets)
+{
+    uint64_t nCount = ReadCompactSize(s);
+    for (uint64_t i = 0; i < nCount; i++) {
+        if (vOffsets)
+            vOffsets->push_back(GetReadPos(s, pend) - pbegin);
+        s.ignore(32 + 4);
+        SkipBytes(s);
+        s.ignore(4);
+    }
+    if (vOffsets)
+        vOffsets->push_back(GetReadPos(s, pend) - pbegin);
+}
+
+static void SkipTxOuts(CMemoryReader& s, const char* pbegin, const char* pend, std::vector<uint32_t>* vOffsets)
+{
+    uint64_t nCount = ReadCompactSize(s);
+    for (uint64_t i = 0; i < nCount; i++) {
+        if (vOffsets)
+            vOffsets->push_back(GetReadPos(s, pend) - pbegin);
+        s.ignore(8);
+        SkipBytes(s);
+    }
+    if (vOffsets)
+        vOffsets->push_back(GetReadPos(s, pend) - pbegin);
+}
+
+/** Skip a transaction, as CTransaction::SerializationOp lays it out */
+static void SkipTransaction(CMemoryReader& s, const char* pend)
+{
+    int32_t nVersion;
+    s >> nVersion;
+    SkipTxIns(s, NULL, pend, NULL);
+    SkipTxOuts(s, NULL, pend, NULL);
+    s.ignore(4);
+    if (nVersion >= PHGR_TX_VERSION || nVersion == GROTH_TX_VERSION) {
+        uint64_t nJoinSplits = ReadCompactSize(s);
+        size_t nJoinSplitSize = GetJoinSplitSize(nVersion);
+        for (uint64_t i = 0; i < nJoinSplits; i++)
+            s.ignore(nJoinSplitSize);
+        if (nJoinSplits > 0)
+            s.ignore(sizeof(uint256) + sizeof(CTransaction::joinsplit_sig_t));
+    }
+}
+
+CTransactionView::CTransactionView(const char* pbeginIn, const char* pendIn) : pbegin(pbeginIn), pend(pendIn), fParsed(false)
+{
+    CMemoryReader s(pbeginIn, pendIn, SER_NETWORK, PROTOCOL_VERSION);
+    SkipTransaction(s, pendIn);
+    pend = GetReadPos(s, pendIn);
+}
+
+int32_t CTransactionView::GetVersion() const
+{
+    return ReadLE32((const unsigned char*)pbegin);
+}
+
+uint256 CTransactionView::GetHash() const
+{
+    return Hash(pbegin, pend);
+}
+
+void CTransactionView::Parse()
+{
+    if (fParsed)
+        return;
+    CMemoryReader s(pbegin, pend, SER_NETWORK, PROTOCOL_VERSION);
+    s.ignore(4);
+    SkipTxIns(s, pbegin, pend, &vInputOffsets);
+    SkipTxOuts(s, pbegin, pend, &vOutputOffsets);
+    fParsed = true;
+}
+
+size_t CTransactionView::GetInputCount()
+{
+    Parse();
+    return vInputOffsets.size() - 1;
+}
+
+size_t CTransactionView::GetOutputCount()
+{
+    Parse();
+    return vOutputOffsets.size() - 1;
+}
+
+CSerializedSpan CTransactionView::GetInput(size_t n)
+{
+    if (n >= GetInputCount())
+        throw std::ios_base::failure("CTransactionView::GetInput(): no such input");
+    return CSerializedSpan(pbegin + vInputOffsets[n], pbegin + vInputOffsets[n + 1]);
+}
+
+CSerializedSpan CTransactionView::GetOutput(size_t n)
+{
+    if (n >= GetOutputCount())
+        throw std::ios_base::failure("CTransactionView::GetOutput(): no such output");
+    return CSerializedSpan(pbegin + vOutputOffsets[n], pbegin + vOutputOffsets[n + 1]);
+}
+
+size_t GetSerializedBlockHeaderSize(const char* pbegin, const char* pend)
+{
+    CMemoryReader s(pbegin, pend, SER_NETWORK, PROTOCOL_VERSION);
+    s.ignore(BLOCK_HEADER_FIXED_SIZE);
+    SkipBytes(s);
+    return GetReadPos(s, pend) - pbegin;
+}
+
+CBlockView::CBlockView(const char* pbeginIn, const char* pendIn) : pbegin(pbeginIn), pend(pendIn)
+{
+    pheaderEnd = pbegin + GetSerializedBlockHeaderSize(pbegin, pend);
+    CMemoryReader s(pheaderEnd, pend, SER_NETWORK, PROTOCOL_VERSION);
+    nTxCount = ReadCompactSize(s);
+    ptxBegin = GetReadPos(s, pend);
+}
+
+uint256 CBlockView::GetHash() const
+{
+    return Hash(pbegin, pheaderEnd);
+}
+
+CTransactionView CBlockView::GetTx(size_t n)
+{
+    if (n >= nTxCount)
+        throw std::ios_base::failure("CBlockView::GetTx(): no such transaction");
+    while (vtx.size() <= n)
+        vtx.push_back(CTransactionView(vtx.empty() ? ptxBegin : vtx.back().end(), pend));
+    return vtx[n];
+}
+
+CTransactionView CBlockView::GetTxAtOffset(unsigned int nTxOffset) const
+{
+    if (nTxOffset > (size_t)(pend - pheaderEnd))
+        throw std::ios_base::failure("CBlockView::GetTxAtOffset(): offset past the block");
+    return CTransactionView(pheaderEnd + nTxOffset, pend);
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKVIEW_H
+#define BITCOIN_BLOCKVIEW_H
+
+#include "uint256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** Bytes of a serialized object, in a buffer owned by someone else */
+typedef std::pair<const char*, const char*> CSerializedSpan;
+
+/**
+ * A serialized transaction, read where it lies: in a block file mapping, a
+ * queued record or a buffer that outlives the view. Only its extent is found
+ * when the view is made, by skipping over its fields; the offsets of its
+ * inputs and outputs are found when first asked for. Serving a transaction
+ * as stored then needs no CTransaction, nor serializing one again.
+ *
+ * Bytes that are not a transaction throw std::ios_base::failure, as
+ * deserializing them would.
+ */
+class CTransactionView
+{
+public:
+    CTransactionView() : pbegin(NULL), pend(NULL), fParsed(false) {}
+    /** The transaction at pbeginIn, its bytes may be followed by others up to pendIn */
+    CTransactionView(const char* pbeginIn, const char* pendIn);
+
+    const char* begin() const { return pbegin; }
+    const char* end() const { return pend; }
+    size_t size() const { return pend - pbegin; }
+
+    int32_t GetVersion() const;
+    /** The txid, the hash of the bytes as CTransaction::GetHash computes it */
+    uint256 GetHash() const;
+
+    size_t GetInputCount();
+    size_t GetOutputCount();
+    /** Input n as serialized: prevout, scriptSig and nSequence */
+    CSerializedSpan GetInput(size_t n);
+    /** Output n as serialized: nValue and scriptPubKey */
+    CSerializedSpan GetOutput(size_t n);
+
+private:
+    const char* pbegin;
+    const char* pend;
+    bool fParsed;
+    //! Offsets from pbegin where each input and output starts, then where the last one ends
+    std::vector<uint32_t> vInputOffsets;
+    std::vector<uint32_t> vOutputOffsets;
+
+    void Parse();
+};
+
+/**
+ * A serialized block, read where it lies. The header is measured when the
+ * view is made; the offsets of the transactions are found as far as they
+ * are asked for, so that the last of them is walked over only if needed.
+ */
+class CBlockView
+{
+public:
+    CBlockView(const char* pbeginIn, const char* pendIn);
+
+    const char* begin() const { return pbegin; }
+    const char* end() const { return pend; }
+    size_t size() const { return pend - pbegin; }
+
+    CSerializedSpan GetHeader() const { return CSerializedSpan(pbegin, pheaderEnd); }
+    /** The block hash, the hash of the header bytes */
+    uint256 GetHash() const;
+
+    size_t GetTxCount() const { return nTxCount; }
+    /** Transaction n, throws std::ios_base::failure if there is none */
+    CTransactionView GetTx(size_t n);
+    /**
+     * The transaction nTxOffset bytes past the header, the offset CDiskTxPos
+     * keeps in the transaction index; the count of transactions comes first.
+     */
+    CTransactionView GetTxAtOffset(unsigned int nTxOffset) const;
+
+private:
+    const char* pbegin;
+    const char* pend;
+    const char* pheaderEnd;
+    const char* ptxBegin;
+    size_t nTxCount;
+    //! The transactions found so far, the next one starts where the last ends
+    std::vector<CTransactionView> vtx;
+};
+
+/** Size of the serialized block header at pbegin, throws if it runs past pend */
+size_t GetSerializedBlockHeaderSize(const char* pbegin, const char* pend);
+
+#endif // BITCOIN_BLOCKVIEW_H
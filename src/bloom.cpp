@@ -4,8 +4,10 @@
 
 #include "bloom.h"
 
+#include "crypto/common.h"
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -13,6 +15,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 
@@ -21,6 +24,9 @@
 
 using namespace std;
 
+//! Size of a serialized COutPoint: the txid and the output index
+static const size_t OUTPOINT_KEY_SIZE = 36;
+
 CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn, unsigned char nFlagsIn) :
     /**
      * The ideal size for a bloom filter with a given number of elements and false positive rate is:
@@ -41,78 +47,92 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-// Private constructor used by CRollingBloomFilter
-CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweakIn) :
-    vData((unsigned int)(-1  / LN2SQUARED * nElements * log(nFPRate)) / 8),
-    isFull(false),
-    isEmpty(true),
-    nHashFuncs((unsigned int)(vData.size() * 8 / nElements * LN2)),
-    nTweak(nTweakIn),
-    nFlags(BLOOM_UPDATE_NONE)
+inline void CBloomFilter::Hash(unsigned int nHashNum, const unsigned char* pKey, size_t nKeySize, unsigned int* pIndexes) const
 {
+    uint32_t seeds[MURMURHASH3_LANES];
+    uint32_t hashes[MURMURHASH3_LANES];
+    for (int l = 0; l < MURMURHASH3_LANES; l++)
+        // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
+        seeds[l] = (nHashNum + l) * 0xFBA4C795 + nTweak;
+    MurmurHash3(seeds, hashes, pKey, nKeySize);
+    for (int l = 0; l < MURMURHASH3_LANES; l++)
+        pIndexes[l] = hashes[l] % (vData.size() * 8);
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
+void CBloomFilter::insert(const unsigned char* pKey, size_t nKeySize)
 {
-    // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
+    if (isFull)
+        return;
+    unsigned int vIndex[MURMURHASH3_LANES];
+    for (unsigned int i = 0; i < nHashFuncs; i += MURMURHASH3_LANES)
+    {
+        Hash(i, pKey, nKeySize, vIndex);
+        for (unsigned int l = 0; l < MURMURHASH3_LANES && i + l < nHashFuncs; l++)
+            // Sets bit nIndex of vData
+            vData[vIndex[l] >> 3] |= (1 << (7 & vIndex[l]));
+    }
+    isEmpty = false;
 }
 
-void CBloomFilter::insert(const vector<unsigned char>& vKey)
+bool CBloomFilter::contains(const unsigned char* pKey, size_t nKeySize) const
 {
     if (isFull)
-        return;
-    for (unsigned int i = 0; i < nHashFuncs; i++)
+        return true;
+    if (isEmpty)
+        return false;
+    // The hash functions are computed a batch at a time, most keys are
+    // rejected by the first few
+    unsigned int vIndex[MURMURHASH3_LANES];
+    for (unsigned int i = 0; i < nHashFuncs; i += MURMURHASH3_LANES)
     {
-        unsigned int nIndex = Hash(i, vKey);
-        // Sets bit nIndex of vData
-        vData[nIndex >> 3] |= (1 << (7 & nIndex));
+        Hash(i, pKey, nKeySize, vIndex);
+        for (unsigned int l = 0; l < MURMURHASH3_LANES && i + l < nHashFuncs; l++)
+            // Checks bit nIndex of vData
+            if (!(vData[vIndex[l] >> 3] & (1 << (7 & vIndex[l]))))
+                return false;
     }
-    isEmpty = false;
+    return true;
+}
+
+/** An outpoint as serialized, the key it has in a bloom filter */
+static void SerializeOutPoint(const COutPoint& outpoint, unsigned char* pKey)
+{
+    memcpy(pKey, outpoint.hash.begin(), 32);
+    WriteLE32(pKey + 32, outpoint.n);
+}
+
+void CBloomFilter::insert(const vector<unsigned char>& vKey)
+{
+    insert(vKey.empty() ? NULL : &vKey[0], vKey.size());
 }
 
 void CBloomFilter::insert(const COutPoint& outpoint)
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    insert(data);
+    unsigned char vKey[OUTPOINT_KEY_SIZE];
+    SerializeOutPoint(outpoint, vKey);
+    insert(vKey, sizeof(vKey));
 }
 
 void CBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(hash.begin(), hash.size());
 }
 
 bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
 {
-    if (isFull)
-        return true;
-    if (isEmpty)
-        return false;
-    for (unsigned int i = 0; i < nHashFuncs; i++)
-    {
-        unsigned int nIndex = Hash(i, vKey);
-        // Checks bit nIndex of vData
-        if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
-            return false;
-    }
-    return true;
+    return contains(vKey.empty() ? NULL : &vKey[0], vKey.size());
 }
 
 bool CBloomFilter::contains(const COutPoint& outpoint) const
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    return contains(data);
+    unsigned char vKey[OUTPOINT_KEY_SIZE];
+    SerializeOutPoint(outpoint, vKey);
+    return contains(vKey, sizeof(vKey));
 }
 
 bool CBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(hash.begin(), hash.size());
 }
 
 void CBloomFilter::clear()
@@ -216,57 +236,160 @@ void CBloomFilter::UpdateEmptyFull()
     isEmpty = empty;
 }
 
-CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate) :
-    b1(nElements * 2, fpRate, 0), b2(nElements * 2, fpRate, 0)
+size_t CBloomFilter::DynamicMemoryUsage() const
 {
-    // Implemented using two bloom filters of 2 * nElements each.
-    // We fill them up, and clear them, staggered, every nElements
-    // inserted, so at least one always contains the last nElements
-    // inserted.
-    nInsertions = 0;
-    nBloomSize = nElements * 2;
+    return memusage::DynamicUsage(vData);
+}
 
+CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
+{
+    double logFpRate = log(fpRate);
+    /* The optimal number of hash functions is log(fpRate) / log(0.5), but
+     * restrict it to the range 1-50. */
+    nHashFuncs = std::max(1, std::min((int)round(logFpRate / log(0.5)), 50));
+    /* In this rolling bloom filter, we'll store between 2 and 3 generations of nElements / 2 entries. */
+    nEntriesPerGeneration = (nElements + 1) / 2;
+    uint32_t nMaxElements = nEntriesPerGeneration * 3;
+    /* The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits), nHashFuncs)
+     * =>          pow(fpRate, 1.0 / nHashFuncs) = 1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits)
+     * =>          1.0 - pow(fpRate, 1.0 / nHashFuncs) = exp(-nHashFuncs * nMaxElements / nFilterBits)
+     * =>          log(1.0 - pow(fpRate, 1.0 / nHashFuncs)) = -nHashFuncs * nMaxElements / nFilterBits
+     * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - pow(fpRate, 1.0 / nHashFuncs))
+     * =>          nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs))
+     */
+    uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
+    data.clear();
+    /* For each data element we need to store 2 bits. If both bits are 0, the
+     * bit is treated as unset. If the bits are (01), (10), or (11), the bit is
+     * treated as set in generation 1, 2, or 3 respectively. */
+    data.resize(((nFilterBits + 63) / 64) << 1);
     reset();
 }
 
-void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+/* Similar to CBloomFilter::Hash */
+static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const unsigned char* pKey, size_t nKeySize)
+{
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pKey, nKeySize);
+}
+
+void CRollingBloomFilter::insert(const unsigned char* pKey, size_t nKeySize)
 {
-    if (nInsertions == 0) {
-        b1.clear();
-    } else if (nInsertions == nBloomSize / 2) {
-        b2.clear();
+    if (nEntriesThisGeneration == nEntriesPerGeneration) {
+        nEntriesThisGeneration = 0;
+        nGeneration++;
+        if (nGeneration == 4) {
+            nGeneration = 1;
+        }
+        uint64_t nGenerationMask1 = 0 - (uint64_t)(nGeneration & 1);
+        uint64_t nGenerationMask2 = 0 - (uint64_t)(nGeneration >> 1);
+        /* Wipe old entries that used this generation number. */
+        for (uint32_t p = 0; p < data.size(); p += 2) {
+            uint64_t p1 = data[p], p2 = data[p + 1];
+            uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+            data[p] = p1 & mask;
+            data[p + 1] = p2 & mask;
+        }
+    }
+    nEntriesThisGeneration++;
+
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint32_t h = RollingBloomHash(n, nTweak, pKey, nKeySize);
+        int bit = h & 0x3F;
+        uint32_t pos = (h >> 6) % data.size();
+        /* The lowest bit of pos is ignored, and set to zero for the first bit, and to one for the second. */
+        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
+        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
     }
-    b1.insert(vKey);
-    b2.insert(vKey);
-    if (++nInsertions == nBloomSize) {
-        nInsertions = 0;
+}
+
+bool CRollingBloomFilter::contains(const unsigned char* pKey, size_t nKeySize) const
+{
+    for (int n = 0; n < nHashFuncs; n++) {
+        uint32_t h = RollingBloomHash(n, nTweak, pKey, nKeySize);
+        int bit = h & 0x3F;
+        uint32_t pos = (h >> 6) % data.size();
+        /* If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain the key */
+        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1)) {
+            return false;
+        }
     }
+    return true;
+}
+
+void CRollingBloomFilter::insert(const std::vector<unsigned char>& vKey)
+{
+    insert(vKey.empty() ? NULL : &vKey[0], vKey.size());
 }
 
 void CRollingBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(hash.begin(), hash.size());
 }
 
 bool CRollingBloomFilter::contains(const std::vector<unsigned char>& vKey) const
 {
-    if (nInsertions < nBloomSize / 2) {
-        return b2.contains(vKey);
-    }
-    return b1.contains(vKey);
+    return contains(vKey.empty() ? NULL : &vKey[0], vKey.size());
 }
 
 bool CRollingBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(hash.begin(), hash.size());
 }
 
 void CRollingBloomFilter::reset()
 {
-    unsigned int nNewTweak = GetRand(std::numeric_limits<unsigned int>::max());
-    b1.reset(nNewTweak);
-    b2.reset(nNewTweak);
-    nInsertions = 0;
+    nTweak = GetRand(std::numeric_limits<unsigned int>::max());
+    nEntriesThisGeneration = 0;
+    nGeneration = 1;
+    std::fill(data.begin(), data.end(), 0);
+}
+
+size_t CRollingBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(data);
+}
+
+//! Bits per element a CBlockedBloomFilter is sized for, and words per block
+static const size_t BLOCKED_BLOOM_BITS_PER_ELEMENT = 16;
+static const size_t BLOCKED_BLOOM_BLOCK_WORDS = 8;
+
+CBlockedBloomFilter::CBlockedBloomFilter(size_t nElements) :
+    salt1(GetRandHash()), salt2(GetRandHash()), nCapacity(nElements), nInsertions(0)
+{
+    nBlocks = nElements * BLOCKED_BLOOM_BITS_PER_ELEMENT / (64 * BLOCKED_BLOOM_BLOCK_WORDS) + 1;
+    vData.assign((size_t)nBlocks * BLOCKED_BLOOM_BLOCK_WORDS, 0);
+}
+
+size_t CBlockedBloomFilter::GetBlock(const uint256& hash, uint64_t masks[8]) const
+{
+    // One hash picks the block, the other one bit of each of its words
+    uint64_t h1 = hash.GetHash(salt1);
+    uint64_t h2 = hash.GetHash(salt2);
+    for (size_t i = 0; i < BLOCKED_BLOOM_BLOCK_WORDS; i++)
+        masks[i] = (uint64_t)1 << ((h2 >> (6 * i)) & 63);
+    return (size_t)(((h1 & 0xffffffff) * nBlocks) >> 32) * BLOCKED_BLOOM_BLOCK_WORDS;
+}
+
+void CBlockedBloomFilter::insert(const uint256& hash)
+{
+    uint64_t masks[BLOCKED_BLOOM_BLOCK_WORDS];
+    uint64_t* block = &vData[GetBlock(hash, masks)];
+    for (size_t i = 0; i < BLOCKED_BLOOM_BLOCK_WORDS; i++)
+        block[i] |= masks[i];
+    nInsertions++;
+}
+
+bool CBlockedBloomFilter::contains(const uint256& hash) const
+{
+    uint64_t masks[BLOCKED_BLOOM_BLOCK_WORDS];
+    const uint64_t* block = &vData[GetBlock(hash, masks)];
+    uint64_t missing = 0;
+    for (size_t i = 0; i < BLOCKED_BLOOM_BLOCK_WORDS; i++)
+        missing |= masks[i] & ~block[i];
+    return missing == 0;
+}
+
+size_t CBlockedBloomFilter::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vData);
 }
@@ -6,12 +6,12 @@
 #define BITCOIN_BLOOM_H
 
 #include "serialize.h"
+#include "uint256.h"
 
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -51,11 +51,11 @@ private:
     unsigned int nTweak;
     unsigned char nFlags;
 
-    unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
+    /** The bits of the hash functions nHashNum to nHashNum + MURMURHASH3_LANES - 1 for a key */
+    void Hash(unsigned int nHashNum, const unsigned char* pKey, size_t nKeySize, unsigned int* pIndexes) const;
 
-    // Private constructor for CRollingBloomFilter, no restrictions on size
-    CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
-    friend class CRollingBloomFilter;
+    void insert(const unsigned char* pKey, size_t nKeySize);
+    bool contains(const unsigned char* pKey, size_t nKeySize) const;
 
 public:
     /**
@@ -100,6 +100,8 @@ public:
 
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
+
+    size_t DynamicMemoryUsage() const;
 };
 
 /**
@@ -112,6 +114,11 @@ public:
  *
  * contains(item) will always return true if item was one of the last N things
  * insert()'ed ... but may also return true for items that were not inserted.
+ *
+ * The memory is allocated once, at construction. Each bit of the filter is
+ * stored as 2 bits, the generation (1 to 3) of the last element that set it,
+ * each generation holding N/2 elements: starting a generation wipes the bits
+ * of the one 3 generations back, in a single pass over the filter.
  */
 class CRollingBloomFilter
 {
@@ -128,11 +135,53 @@ public:
 
     void reset();
 
+    size_t DynamicMemoryUsage() const;
+
 private:
-    unsigned int nBloomSize;
-    unsigned int nInsertions;
-    CBloomFilter b1, b2;
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    //! The two bits of position P are bit (P & 63) of words (P >> 6) * 2 and (P >> 6) * 2 + 1
+    std::vector<uint64_t> data;
+    unsigned int nTweak;
+    int nHashFuncs;
+
+    void insert(const unsigned char* pKey, size_t nKeySize);
+    bool contains(const unsigned char* pKey, size_t nKeySize) const;
 };
 
 
+/**
+ * Bloom filter over uniformly distributed 256-bit hashes, such as nullifiers,
+ * whose bits for an element all fall in one 64-byte block so that a lookup
+ * touches a single cache line. Sized for a number of elements at
+ * construction, for about 0.1% false positives with 16 bits per element;
+ * elements cannot be removed, the owner rebuilds a filter that has taken more
+ * than its capacity or holds too many stale elements.
+ */
+class CBlockedBloomFilter
+{
+public:
+    explicit CBlockedBloomFilter(size_t nElements = 0);
+
+    void insert(const uint256& hash);
+    bool contains(const uint256& hash) const;
+
+    //! Elements inserted so far, and how many the filter was sized for
+    size_t size() const { return nInsertions; }
+    size_t capacity() const { return nCapacity; }
+    size_t DynamicMemoryUsage() const;
+
+private:
+    //! Blocks of 8 words, keyed with random salts so that false positives are not predictable
+    std::vector<uint64_t> vData;
+    uint256 salt1, salt2;
+    uint32_t nBlocks;
+    size_t nCapacity;
+    size_t nInsertions;
+
+    //! The index of the first word of the block of an element, and the bit it sets in each word
+    size_t GetBlock(const uint256& hash, uint64_t masks[8]) const;
+};
+
 #endif // BITCOIN_BLOOM_H
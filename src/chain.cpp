@@ -110,6 +110,17 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CBlockIndex::BuildDifficultyCache()
+{
+    if (pprev && !pprev->fDifficultyCache)
+        return;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits);
+    nChainTargetSum = (pprev ? pprev->nChainTargetSum : arith_uint256()) + bnTarget;
+    nMedianTimePastCache = ComputeMedianTimePast();
+    fDifficultyCache = true;
+}
+
 void CHistoricalChain::SetHeight(const int nHeight)
 {
     if (nHeight > chain.Height()) {
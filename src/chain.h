@@ -7,6 +7,7 @@
 #define BITCOIN_CHAIN_H
 
 #include "arith_uint256.h"
+#include "memusage.h"
 #include "primitives/block.h"
 #include "tinyformat.h"
 #include "uint256.h"
@@ -116,6 +117,11 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_VALID       =   32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, //! descends from failed block
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    //! At or below the block of a loaded UTXO snapshot: TRANSACTIONS valid only
+    //! so that the chain links, none of its blocks were checked. Stands in for
+    //! CHAIN and SCRIPTS validity as the parent of the blocks connected on top.
+    BLOCK_ASSUMED_VALID      =  128,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -186,11 +192,23 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+protected:
+    //! Equihash solution, left on disk only once the entry is written to the
+    //! block tree database, see TrimSolution and GetSolution
     std::vector<unsigned char> nSolution;
 
+public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Sum of the targets of the blocks up to and including this
+    //! one, modulo 2^256, so that the sum over a window is a difference of two
+    //! entries; valid with fDifficultyCache, see BuildDifficultyCache
+    arith_uint256 nChainTargetSum;
+    //! (memory only) GetMedianTimePast, valid with fDifficultyCache
+    int64_t nMedianTimePastCache;
+    bool fDifficultyCache;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -208,6 +226,9 @@ public:
         hashAnchor = uint256();
         hashAnchorEnd = uint256();
         nSequenceId = 0;
+        nChainTargetSum = arith_uint256();
+        nMedianTimePastCache = 0;
+        fDifficultyCache = false;
         nSproutValue = boost::none;
         nChainSproutValue = boost::none;
 
@@ -267,10 +288,30 @@ public:
         block.nTime          = nTime;
         block.nBits          = nBits;
         block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
+        block.nSolution      = GetSolution();
         return block;
     }
 
+    //! The Equihash solution, read back from the block tree database if
+    //! trimmed; safe without cs_main, against a concurrent TrimSolution
+    std::vector<unsigned char> GetSolution() const;
+
+    //! Whether the solution is still in memory, under cs_main
+    bool HasSolution() const
+    {
+        return !nSolution.empty();
+    }
+
+    //! Memory held by the solution until it is trimmed, under cs_main
+    size_t SolutionMemoryUsage() const
+    {
+        return memusage::DynamicUsage(nSolution);
+    }
+
+    //! Free the solution, which must be in the block tree database already,
+    //! under cs_main
+    void TrimSolution();
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -284,6 +325,13 @@ public:
     enum { nMedianTimeSpan=11 };
 
     int64_t GetMedianTimePast() const
+    {
+        if (fDifficultyCache)
+            return nMedianTimePastCache;
+        return ComputeMedianTimePast();
+    }
+
+    int64_t ComputeMedianTimePast() const
     {
         int64_t pmedian[nMedianTimeSpan];
         int64_t* pbegin = &pmedian[nMedianTimeSpan];
@@ -331,6 +379,10 @@ public:
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
 
+    //! Cache the target sum and median time past of this entry, once its
+    //! header and pprev are final and the entry of pprev is cached
+    void BuildDifficultyCache();
+
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
@@ -348,6 +400,15 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        // Entries written before are written again with the solution they have on disk
+        if (!HasSolution())
+            nSolution = pindex->GetSolution();
+    }
+
+    //! The solution of the record itself, never read back from the database
+    const std::vector<unsigned char>& GetDiskSolution() const
+    {
+        return nSolution;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -80,4 +80,36 @@ namespace Checkpoints {
         return NULL;
     }
 
+    bool IsOnCheckpointedChain(const CCheckpointData& data, const CBlockIndex* pindex)
+    {
+        const MapCheckpoints& checkpoints = data.mapCheckpoints;
+
+        MapCheckpoints::const_iterator it = checkpoints.upper_bound(pindex->nHeight);
+        if (it == checkpoints.begin())
+            return true;
+        --it;
+        return pindex->GetAncestor(it->first)->GetBlockHash() == it->second;
+    }
+
+    size_t CountLinkedToCheckpoint(const CCheckpointData& data, int nHeightPrev, const uint256& hashPrev,
+                                   const std::vector<CBlockHeader>& headers)
+    {
+        const MapCheckpoints& checkpoints = data.mapCheckpoints;
+
+        size_t nLinked = 0;
+        uint256 hash = hashPrev;
+        for (size_t n = 0; n < headers.size(); n++) {
+            if (headers[n].hashPrevBlock != hash)
+                break;
+            hash = headers[n].GetHash();
+            MapCheckpoints::const_iterator it = checkpoints.find(nHeightPrev + 1 + (int)n);
+            if (it != checkpoints.end()) {
+                if (it->second != hash)
+                    break;
+                nLinked = n + 1;
+            }
+        }
+        return nLinked;
+    }
+
 } // namespace Checkpoints
@@ -8,7 +8,9 @@
 #include "uint256.h"
 
 #include <map>
+#include <vector>
 
+class CBlockHeader;
 class CBlockIndex;
 
 /**
@@ -31,6 +33,14 @@ int GetTotalBlocksEstimate(const CCheckpointData& data);
 //! Returns last CBlockIndex* in mapBlockIndex that is a checkpoint
 CBlockIndex* GetLastCheckpoint(const CCheckpointData& data);
 
+//! Whether pindex descends from the checkpoint at or below its height, true if there is none
+bool IsOnCheckpointedChain(const CCheckpointData& data, const CBlockIndex* pindex);
+
+//! The number of leading headers, following the block hashPrev at nHeightPrev, that
+//! are committed to by a checkpoint hash among them: each links to the next up to it
+size_t CountLinkedToCheckpoint(const CCheckpointData& data, int nHeightPrev, const uint256& hashPrev,
+                               const std::vector<CBlockHeader>& headers);
+
 double GuessVerificationProgress(const CCheckpointData& data, CBlockIndex* pindex, bool fSigchecks = true);
 
 
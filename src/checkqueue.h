@@ -6,6 +6,9 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <stdint.h>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -25,110 +28,159 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * The checks are taken without a lock. They are stored in block order;
+  * each worker reserves a run of them not taken yet into a deque of its own
+  * and works through it from the front. A worker out of work steals half of
+  * what is left of another's deque, from its far end. The mutex is only
+  * taken by workers going to sleep, and by the master to wake them.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
+    //! Checks are stored in chunks that never move, so that workers can read them while more are added
+    static const unsigned int CHUNK_BITS = 10;
+    static const unsigned int CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const unsigned int MAX_CHUNKS = 4096;
+    //! Deques of the workers, the master's is the first
+    static const unsigned int MAX_WORKERS = 64;
+
     //! Mutex to protect the inner state
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
 
-    //! Master thread blocks on this when out of work
+    //! Master thread blocks on this when the workers are not all out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The checks pushed so far, and the next one not reserved by a worker yet
+    T* chunks[MAX_CHUNKS];
+    std::atomic<uint32_t> nPushed;
+    std::atomic<uint32_t> nNextReserve;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    /**
+     * The checks each worker has reserved and not taken yet, [begin, end) in
+     * one word so that the owner taking from the front and thieves taking
+     * from the back agree: the high half is begin, the low half end.
+     */
+    std::atomic<uint64_t> deques[MAX_WORKERS];
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers (excluding the master) that are idle, and in total.
+    std::atomic<int> nIdle;
+    std::atomic<int> nTotal;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
-    /**
-     * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
-     */
-    unsigned int nTodo;
+    //! The maximum number of elements to be reserved in one go
+    unsigned int nBatchSize;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    static uint64_t MakeRange(uint32_t nBegin, uint32_t nEnd) { return ((uint64_t)nBegin << 32) | nEnd; }
+    static uint32_t RangeBegin(uint64_t range) { return range >> 32; }
+    static uint32_t RangeEnd(uint64_t range) { return (uint32_t)range; }
 
-    //! The maximum number of elements to be processed in one batch
-    unsigned int nBatchSize;
+    T& Get(uint32_t nPos) { return chunks[nPos >> CHUNK_BITS][nPos & (CHUNK_SIZE - 1)]; }
+
+    /** Take the next check of the deque of worker nSlot, the owner's end */
+    bool PopFront(unsigned int nSlot, uint32_t& nPos)
+    {
+        uint64_t range = deques[nSlot].load();
+        while (RangeBegin(range) < RangeEnd(range)) {
+            if (deques[nSlot].compare_exchange_weak(range, MakeRange(RangeBegin(range) + 1, RangeEnd(range)))) {
+                nPos = RangeBegin(range);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Fill the empty deque of worker nSlot with checks not reserved yet, or stolen from the far end of another's */
+    bool Refill(unsigned int nSlot)
+    {
+        uint32_t nReserve = nNextReserve.load();
+        uint32_t nAvailable = nPushed.load();
+        while (nReserve < nAvailable) {
+            // Aim for smaller reservations as the queue empties, stealing evens out the rest
+            uint32_t nNow = std::max(1U, std::min(nBatchSize, (nAvailable - nReserve) / (nTotal + 1)));
+            if (nNextReserve.compare_exchange_weak(nReserve, nReserve + nNow)) {
+                deques[nSlot].store(MakeRange(nReserve, nReserve + nNow));
+                return true;
+            }
+            nAvailable = nPushed.load();
+        }
+        for (unsigned int n = 1; n <= (unsigned int)nTotal; n++) {
+            const unsigned int nVictim = (nSlot + n) % (nTotal + 1);
+            uint64_t range = deques[nVictim].load();
+            while (RangeBegin(range) < RangeEnd(range)) {
+                const uint32_t nSteal = std::max(1U, (RangeEnd(range) - RangeBegin(range)) / 2);
+                if (deques[nVictim].compare_exchange_weak(range, MakeRange(RangeBegin(range), RangeEnd(range) - nSteal))) {
+                    deques[nSlot].store(MakeRange(RangeEnd(range) - nSteal, RangeEnd(range)));
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
 
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        unsigned int nSlot = 0;
+        if (!fMaster) {
+            // Join idle, so that the queue never looks busy before there is work
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nSlot = ++nTotal;
+            assert(nSlot < MAX_WORKERS);
+            nIdle++;
+            while (nNextReserve.load() >= nPushed.load())
+                condWorker.wait(lock);
+            nIdle--;
+        }
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
+            uint32_t nPos;
+            if (PopFront(nSlot, nPos) || (Refill(nSlot) && PopFront(nSlot, nPos))) {
+                // Move the check out, so that what it holds is released once it has run
+                T check;
+                check.swap(Get(nPos));
                 // Check whether we need to do work at all
-                fOk = fAllOk;
+                if (fAllOk.load(std::memory_order_relaxed) && !check())
+                    fAllOk = false;
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                // Everything is taken, wait until the workers have done what they took
+                while (nIdle < nTotal)
+                    condMaster.wait(lock);
+                bool fRet = fAllOk;
+                // reset the status for new work later
+                nPushed = 0;
+                nNextReserve = 0;
+                for (std::atomic<uint64_t>& range : deques)
+                    range = 0;
+                fAllOk = true;
+                return fRet;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
+            // Going idle before looking for work again, so that Add either sees it or adds work seen here
+            if (++nIdle == nTotal)
+                condMaster.notify_one();
+            while (nNextReserve.load() >= nPushed.load())
+                condWorker.wait(lock); // wait
+            nIdle--;
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nPushed(0), nNextReserve(0), nIdle(0), nTotal(0), fAllOk(true), nBatchSize(nBatchSizeIn)
+    {
+        std::fill(chunks, chunks + MAX_CHUNKS, (T*)NULL);
+        for (std::atomic<uint64_t>& range : deques)
+            range = 0;
+    }
 
     //! Worker thread
     void Thread()
@@ -145,26 +197,38 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
+        uint32_t nPos = nPushed.load(std::memory_order_relaxed);
         BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+            if (nPos == MAX_CHUNKS * CHUNK_SIZE) {
+                // Out of room, which a block never gets near: run it right here
+                if (fAllOk.load(std::memory_order_relaxed) && !check())
+                    fAllOk = false;
+                continue;
+            }
+            if (!chunks[nPos >> CHUNK_BITS])
+                chunks[nPos >> CHUNK_BITS] = new T[CHUNK_SIZE];
+            check.swap(Get(nPos++));
+        }
+        nPushed.store(nPos);
+        if (nIdle.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else if (vChecks.size() > 1)
+                condWorker.notify_all();
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
+        for (T* chunk : chunks)
+            delete[] chunk;
     }
 
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTotal == nIdle && nNextReserve.load() >= nPushed.load() && fAllOk == true);
     }
 
 };
@@ -9,7 +9,9 @@
 #include "version.h"
 #include "policy/fees.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <thread>
 
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
@@ -54,6 +56,7 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             CAnchorsMap &mapAnchors,
                             CNullifiersMap &mapNullifiers) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
+size_t CCoinsView::BackendMemoryUsage() const { return 0; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -71,10 +74,9 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   CAnchorsMap &mapAnchors,
                                   CNullifiersMap &mapNullifiers) { return base->BatchWrite(mapCoins, hashBlock, hashAnchor, mapAnchors, mapNullifiers); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
+size_t CCoinsViewBacked::BackendMemoryUsage() const { return base->BackendMemoryUsage(); }
 
-CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
-
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0), nUseClock(0), nCacheHits(0), nCacheMisses(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -88,15 +90,33 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
            cachedCoinsUsage;
 }
 
+size_t CCoinsViewCache::ShieldedMemoryUsage() const {
+    size_t nUsage = memusage::DynamicUsage(cacheAnchors) + memusage::DynamicUsage(cacheNullifiers);
+    for (CAnchorsMap::const_iterator it = cacheAnchors.begin(); it != cacheAnchors.end(); it++)
+        nUsage += it->second.tree.DynamicMemoryUsage();
+    return nUsage;
+}
+
+// A cache is only used by one thread at a time, so the counters do not need
+// an atomic increment, which would cost a locked instruction per lookup
+static inline void CountLookup(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        CountLookup(nCacheHits);
+        Touch(it->second);
         return it;
+    }
+    CountLookup(nCacheMisses);
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
     tmp.swap(ret->second.coins);
+    Touch(ret->second);
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
@@ -107,6 +127,79 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
 }
 
 
+void CCoinsViewCache::Prefetch(const std::vector<uint256> &vTxids, const std::vector<uint256> &vNullifiers,
+                               const std::vector<uint256> &vAnchors, unsigned int nThreads) {
+    std::vector<uint256> vMissingTxids, vMissingNullifiers, vMissingAnchors;
+    for (const uint256 &txid : vTxids)
+        if (!cacheCoins.count(txid))
+            vMissingTxids.push_back(txid);
+    for (const uint256 &nullifier : vNullifiers)
+        if (!cacheNullifiers.count(nullifier))
+            vMissingNullifiers.push_back(nullifier);
+    for (const uint256 &rt : vAnchors)
+        if (!cacheAnchors.count(rt))
+            vMissingAnchors.push_back(rt);
+
+    // Read them from the base into slots of their own, each thread taking the
+    // next lookup not taken yet, the cache itself is only filled afterwards
+    std::vector<CCoins> vCoins(vMissingTxids.size());
+    std::vector<char> vHaveCoins(vMissingTxids.size());
+    std::vector<char> vSpent(vMissingNullifiers.size());
+    std::vector<ZCIncrementalMerkleTree> vTrees(vMissingAnchors.size());
+    std::vector<char> vHaveTree(vMissingAnchors.size());
+    const size_t nLookups = vMissingTxids.size() + vMissingNullifiers.size() + vMissingAnchors.size();
+    std::atomic<size_t> nNext(0);
+    auto worker = [&]() {
+        for (size_t n = nNext++; n < nLookups; n = nNext++) {
+            size_t i = n;
+            if (i < vMissingTxids.size()) {
+                vHaveCoins[i] = base->GetCoins(vMissingTxids[i], vCoins[i]);
+                continue;
+            }
+            i -= vMissingTxids.size();
+            if (i < vMissingNullifiers.size()) {
+                vSpent[i] = base->GetNullifier(vMissingNullifiers[i]);
+                continue;
+            }
+            i -= vMissingNullifiers.size();
+            vHaveTree[i] = base->GetAnchorAt(vMissingAnchors[i], vTrees[i]);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t n = 1; n < std::min((size_t)nThreads, nLookups); n++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread &t : threads)
+        t.join();
+
+    for (size_t i = 0; i < vMissingTxids.size(); i++) {
+        CountLookup(nCacheMisses);
+        if (!vHaveCoins[i])
+            continue;
+        CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(vMissingTxids[i], CCoinsCacheEntry())).first;
+        vCoins[i].swap(ret->second.coins);
+        Touch(ret->second);
+        if (ret->second.coins.IsPruned())
+            ret->second.flags = CCoinsCacheEntry::FRESH;
+        cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    }
+    for (size_t i = 0; i < vMissingNullifiers.size(); i++) {
+        if (!vSpent[i])
+            continue;
+        CNullifiersCacheEntry entry;
+        entry.entered = true;
+        cacheNullifiers.insert(std::make_pair(vMissingNullifiers[i], entry));
+    }
+    for (size_t i = 0; i < vMissingAnchors.size(); i++) {
+        if (!vHaveTree[i])
+            continue;
+        CAnchorsMap::iterator ret = cacheAnchors.insert(std::make_pair(vMissingAnchors[i], CAnchorsCacheEntry())).first;
+        ret->second.entered = true;
+        ret->second.tree = vTrees[i];
+        cachedCoinsUsage += ret->second.tree.DynamicMemoryUsage();
+    }
+}
+
 bool CCoinsViewCache::GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const {
     CAnchorsMap::const_iterator it = cacheAnchors.find(rt);
     if (it != cacheAnchors.end()) {
@@ -135,13 +228,17 @@ bool CCoinsViewCache::GetNullifier(const uint256 &nullifier) const {
     if (it != cacheNullifiers.end())
         return it->second.entered;
 
-    CNullifiersCacheEntry entry;
-    bool tmp = base->GetNullifier(nullifier);
-    entry.entered = tmp;
+    // Only spent nullifiers are cached: the base answers for the others from
+    // the nullifier filter of the coin database without reading it, and
+    // caching them would fill the cache with an entry per lookup
+    if (!base->GetNullifier(nullifier))
+        return false;
 
+    CNullifiersCacheEntry entry;
+    entry.entered = true;
     cacheNullifiers.insert(std::make_pair(nullifier, entry));
 
-    return tmp;
+    return true;
 }
 
 void CCoinsViewCache::PushAnchor(const ZCIncrementalMerkleTree &tree) {
@@ -160,6 +257,7 @@ void CCoinsViewCache::PushAnchor(const ZCIncrementalMerkleTree &tree) {
 
         ret->second.entered = true;
         ret->second.tree = tree;
+        ret->second.parent = currentRoot;
         ret->second.flags = CAnchorsCacheEntry::DIRTY;
 
         if (insertRet.second) {
@@ -216,6 +314,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
     size_t cachedCoinUsage = 0;
     if (ret.second) {
+        CountLookup(nCacheMisses);
         if (!base->GetCoins(txid, ret.first->second.coins)) {
             // The parent view does not have this entry; mark it as fresh.
             ret.first->second.coins.Clear();
@@ -225,10 +324,12 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
     } else {
+        CountLookup(nCacheHits);
         cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    Touch(ret.first->second);
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
@@ -287,6 +388,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     entry.coins.swap(it->second.coins);
                     cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    Touch(entry);
                 }
             } else {
                 if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
@@ -301,6 +403,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    Touch(itUs->second);
                 }
             }
         }
@@ -317,6 +420,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                 CAnchorsCacheEntry& entry = cacheAnchors[child_it->first];
                 entry.entered = child_it->second.entered;
                 entry.tree = child_it->second.tree;
+                entry.parent = child_it->second.parent;
                 entry.flags = CAnchorsCacheEntry::DIRTY;
 
                 cachedCoinsUsage += entry.tree.DynamicMemoryUsage();
@@ -326,6 +430,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     parent_it->second.entered = child_it->second.entered;
                     parent_it->second.flags |= CAnchorsCacheEntry::DIRTY;
                 }
+                if (!child_it->second.parent.IsNull())
+                    parent_it->second.parent = child_it->second.parent;
             }
         }
 
@@ -367,6 +473,86 @@ bool CCoinsViewCache::Flush() {
     return fOk;
 }
 
+bool CCoinsViewCache::WriteBack(size_t nTargetUsage) {
+    assert(!hasModifier);
+    // The base takes what it is given, so it gets copies of the modified coins
+    CCoinsMap mapDirty;
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            mapDirty.insert(*it);
+    }
+    bool fOk = base->BatchWrite(mapDirty, hashBlock, hashAnchor, cacheAnchors, cacheNullifiers);
+    cacheAnchors.clear();
+    cacheNullifiers.clear();
+
+    // Rank the coins by the lookups since they were last used (modulo 2^32,
+    // so an entry unused for that long may pass for recent), spent ones are
+    // not worth keeping
+    std::vector<std::pair<uint32_t, CCoinsMap::iterator> > vEntries;
+    vEntries.reserve(cacheCoins.size());
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (!it->second.coins.IsPruned())
+            vEntries.push_back(std::make_pair(nUseClock - it->second.nLastUsed, it));
+    }
+    std::sort(vEntries.begin(), vEntries.end(),
+              [](const std::pair<uint32_t, CCoinsMap::iterator> &a, const std::pair<uint32_t, CCoinsMap::iterator> &b) {
+                  return a.first < b.first;
+              });
+
+    // Keep as many as fit, in a new map as a map never releases the memory of erased entries
+    const size_t nOtherUsage = memusage::DynamicUsage(cacheAnchors) + memusage::DynamicUsage(cacheNullifiers);
+    size_t nKept = 0;
+    size_t nKeptUsage = 0;
+    for (; nKept < vEntries.size(); nKept++) {
+        size_t nUsage = vEntries[nKept].second->second.coins.DynamicMemoryUsage();
+        if (nOtherUsage + CCoinsMap::DynamicMemoryUsageFor(nKept + 1) + nKeptUsage + nUsage > nTargetUsage)
+            break;
+        nKeptUsage += nUsage;
+    }
+    CCoinsMap mapKept;
+    mapKept.reserve(nKept);
+    for (size_t i = 0; i < nKept; i++) {
+        CCoinsCacheEntry &kept = mapKept[vEntries[i].second->first];
+        kept.coins.swap(vEntries[i].second->second.coins);
+        kept.nLastUsed = vEntries[i].second->second.nLastUsed;
+    }
+    cacheCoins.swap(mapKept);
+    cachedCoinsUsage = nKeptUsage;
+    return fOk;
+}
+
+bool CCoinsViewCache::WriteDirty() {
+    assert(!hasModifier);
+    // The base takes what it is given, so it gets copies of the modified coins
+    CCoinsMap mapDirty;
+    for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            mapDirty.insert(*it);
+    }
+    bool fOk = base->BatchWrite(mapDirty, hashBlock, hashAnchor, cacheAnchors, cacheNullifiers);
+    cacheAnchors.clear();
+    cacheNullifiers.clear();
+
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            it++;
+        } else if (it->second.coins.IsPruned()) {
+            cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            it++;
+        }
+    }
+    return fOk;
+}
+
+void CCoinsViewCache::ResetBestBlock() {
+    assert(cacheCoins.empty() && cacheAnchors.empty() && cacheNullifiers.empty());
+    hashBlock.SetNull();
+    hashAnchor.SetNull();
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -394,7 +580,7 @@ CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
 
 bool CCoinsViewCache::HaveJoinSplitRequirements(const CTransaction& tx) const
 {
-    boost::unordered_map<uint256, ZCIncrementalMerkleTree, CCoinsKeyHasher> intermediates;
+    boost::unordered_map<uint256, ZCIncrementalMerkleTree, SaltedUint256Hasher> intermediates;
 
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit)
     {
@@ -415,10 +601,7 @@ bool CCoinsViewCache::HaveJoinSplitRequirements(const CTransaction& tx) const
             return false;
         }
 
-        BOOST_FOREACH(const uint256& commitment, joinsplit.commitments)
-        {
-            tree.append(commitment);
-        }
+        tree.append_range(joinsplit.commitments.begin(), joinsplit.commitments.end());
 
         intermediates.insert(std::make_pair(tree.root(), tree));
     }
@@ -8,11 +8,14 @@
 
 #include "compressor.h"
 #include "core_memusage.h"
+#include "flatmap.h"
+#include "hasher.h"
 #include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
 
 #include <assert.h>
+#include <atomic>
 #include <stdint.h>
 
 #include <boost/foreach.hpp>
@@ -265,41 +268,25 @@ public:
     }
 };
 
-class CCoinsKeyHasher
-{
-private:
-    uint256 salt;
-
-public:
-    CCoinsKeyHasher();
-
-    /**
-     * This *must* return size_t. With Boost 1.46 on 32-bit systems the
-     * unordered_map will behave unpredictably if the custom hasher returns a
-     * uint64_t, resulting in failures when syncing the chain (#4634).
-     */
-    size_t operator()(const uint256& key) const {
-        return key.GetHash(salt);
-    }
-};
-
 struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    uint32_t nLastUsed; // The use clock of the cache when the entry was last looked up, see CCoinsViewCache::WriteBack.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coins(), flags(0), nLastUsed(0) {}
 };
 
 struct CAnchorsCacheEntry
 {
     bool entered; // This will be false if the anchor is removed from the cache
     ZCIncrementalMerkleTree tree; // The tree itself
+    uint256 parent; // The anchor the tree was appended to, null if unknown
     unsigned char flags;
 
     enum Flags {
@@ -321,9 +308,13 @@ struct CNullifiersCacheEntry
     CNullifiersCacheEntry() : entered(false), flags(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
-typedef boost::unordered_map<uint256, CAnchorsCacheEntry, CCoinsKeyHasher> CAnchorsMap;
-typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher> CNullifiersMap;
+/**
+ * The coins cache is by far the largest map of the node, so it uses an open
+ * addressing map with the entries stored inline (see flatmap.h).
+ */
+typedef flatmap<uint256, CCoinsCacheEntry, SaltedUint256Hasher> CCoinsMap;
+typedef boost::unordered_map<uint256, CAnchorsCacheEntry, SaltedUint256Hasher> CAnchorsMap;
+typedef boost::unordered_map<uint256, CNullifiersCacheEntry, SaltedUint256Hasher> CNullifiersMap;
 
 struct CCoinsStats
 {
@@ -333,6 +324,8 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
     uint256 hashSerialized;
+    //! MuHash of the unspent outputs, which does not depend on their order
+    uint256 hashMuHash;
     CAmount nTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
@@ -373,6 +366,9 @@ public:
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Memory held below the caches, such as flushes in progress and filters of the database
+    virtual size_t BackendMemoryUsage() const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -399,6 +395,7 @@ public:
                     CAnchorsMap &mapAnchors,
                     CNullifiersMap &mapNullifiers);
     bool GetStats(CCoinsStats &stats) const;
+    size_t BackendMemoryUsage() const;
 };
 
 
@@ -445,6 +442,16 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Counts coins lookups, stamped on the entries looked up to evict the least recently used. */
+    mutable uint32_t nUseClock;
+
+    /**
+     * Coins lookups answered by the cache, and those passed to the base.
+     * Atomic so that they can be read without the lock of the cache's user.
+     */
+    mutable std::atomic<uint64_t> nCacheHits;
+    mutable std::atomic<uint64_t> nCacheMisses;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -496,11 +503,41 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush,
+     * but keep the coins cached, now unmodified, the most recently used first
+     * for as long as the cache stays within nTargetUsage bytes; only the least
+     * recently used are evicted. Anchors and nullifiers are all flushed.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool WriteBack(size_t nTargetUsage);
+
+    /**
+     * Push the modifications applied to this cache to its base like Flush,
+     * but keep every coin cached, now unmodified, so that a later Flush only
+     * has what changed since to write. Spent coins are dropped, anchors and
+     * nullifiers are all flushed.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool WriteDirty();
+
+    /**
+     * Forget the best block and anchor so they are read from the base again,
+     * after the base was changed underneath this cache. The cache must be empty.
+     */
+    void ResetBestBlock();
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
+    //! The part of DynamicMemoryUsage() taken by the cached anchors and nullifiers
+    size_t ShieldedMemoryUsage() const;
+
+    //! Coins lookups answered by the cache, and those read from the base
+    uint64_t GetCacheHits() const { return nCacheHits.load(std::memory_order_relaxed); }
+    uint64_t GetCacheMisses() const { return nCacheMisses.load(std::memory_order_relaxed); }
 
     /** 
      * Amount of bitcoins coming in to a transaction
@@ -523,12 +560,23 @@ public:
 
     const CTxOut &GetOutputFor(const CTxIn& input) const;
 
+    /**
+     * Read the coins, spent nullifiers and anchors of the given hashes that
+     * this cache misses from its base, on up to nThreads threads at once, and
+     * add them to the cache. Lookups not found are not cached, as with the
+     * Get methods. The base must allow concurrent reads.
+     */
+    void Prefetch(const std::vector<uint256> &vTxids, const std::vector<uint256> &vNullifiers,
+                  const std::vector<uint256> &vAnchors, unsigned int nThreads);
+
     friend class CCoinsModifier;
 
 private:
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
 
+    void Touch(CCoinsCacheEntry &entry) const { entry.nLastUsed = ++nUseClock; }
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -22,30 +22,33 @@
 
 using namespace std;
 
+static map<string, opcodetype> CreateOpNames()
+{
+    map<string, opcodetype> mapOpNames;
+    for (int op = 0; op <= OP_NOP10; op++)
+    {
+        // Allow OP_RESERVED to get into mapOpNames
+        if (op < OP_NOP && op != OP_RESERVED)
+            continue;
+
+        const char* name = GetOpName((opcodetype)op);
+        if (strcmp(name, "OP_UNKNOWN") == 0)
+            continue;
+        string strName(name);
+        mapOpNames[strName] = (opcodetype)op;
+        // Convenience: OP_ADD and just ADD are both recognized:
+        boost::algorithm::replace_first(strName, "OP_", "");
+        mapOpNames[strName] = (opcodetype)op;
+    }
+    return mapOpNames;
+}
+
 CScript ParseScript(const std::string& s)
 {
     CScript result;
 
-    static map<string, opcodetype> mapOpNames;
-
-    if (mapOpNames.empty())
-    {
-        for (int op = 0; op <= OP_NOP10; op++)
-        {
-            // Allow OP_RESERVED to get into mapOpNames
-            if (op < OP_NOP && op != OP_RESERVED)
-                continue;
-
-            const char* name = GetOpName((opcodetype)op);
-            if (strcmp(name, "OP_UNKNOWN") == 0)
-                continue;
-            string strName(name);
-            mapOpNames[strName] = (opcodetype)op;
-            // Convenience: OP_ADD and just ADD are both recognized:
-            boost::algorithm::replace_first(strName, "OP_", "");
-            mapOpNames[strName] = (opcodetype)op;
-        }
-    }
+    // Built once, even by threads parsing scripts at the same time
+    static const map<string, opcodetype> mapOpNames = CreateOpNames();
 
     vector<string> words;
     boost::algorithm::split(words, s, boost::algorithm::is_any_of(" \t\n"), boost::algorithm::token_compress_on);
@@ -79,7 +82,7 @@ CScript ParseScript(const std::string& s)
         else if (mapOpNames.count(*w))
         {
             // opcode, e.g. OP_ADD or ADD:
-            result << mapOpNames[*w];
+            result << mapOpNames.at(*w);
         }
         else
         {
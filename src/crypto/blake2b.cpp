@@ -0,0 +1,255 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/blake2b.h"
+
+#include "crypto/common.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ENABLE_BLAKE2B_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Internal implementation code.
+namespace
+{
+/// Internal BLAKE2b implementation.
+namespace blake2b
+{
+const uint64_t IV[8] = {
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+    0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull};
+
+const unsigned char SIGMA[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+uint64_t inline Rotr(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+void inline G(uint64_t& a, uint64_t& b, uint64_t& c, uint64_t& d, uint64_t x, uint64_t y)
+{
+    a = a + b + x;
+    d = Rotr(d ^ a, 32);
+    c = c + d;
+    b = Rotr(b ^ c, 24);
+    a = a + b + y;
+    d = Rotr(d ^ a, 16);
+    c = c + d;
+    b = Rotr(b ^ c, 63);
+}
+
+/** Compress one 128-byte block; counter is the number of bytes hashed including this block. */
+void Compress(uint64_t* h, const unsigned char* block, uint64_t counter, bool fLast)
+{
+    uint64_t m[16];
+    uint64_t v[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = ReadLE64(block + 8 * i);
+    for (int i = 0; i < 8; i++) {
+        v[i] = h[i];
+        v[i + 8] = IV[i];
+    }
+    v[12] ^= counter;
+    if (fLast)
+        v[14] = ~v[14];
+
+    for (int r = 0; r < 12; r++) {
+        const unsigned char* s = SIGMA[r];
+        G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++)
+        h[i] ^= v[i] ^ v[i + 8];
+}
+
+#ifdef ENABLE_BLAKE2B_AVX2
+/**
+ * Compress four final blocks that share the chaining value h and the
+ * counter, one per 64-bit lane, and write the four digests.
+ */
+__attribute__((target("avx2")))
+void CompressLast4Way(const uint64_t* h, const unsigned char* blocks, uint64_t counter, size_t outlen, unsigned char* out)
+{
+    const __m256i r16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                         2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+    const __m256i r24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                         3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+
+    __m256i m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = _mm256_set_epi64x(ReadLE64(blocks + 3 * 128 + 8 * i), ReadLE64(blocks + 2 * 128 + 8 * i),
+                                 ReadLE64(blocks + 128 + 8 * i), ReadLE64(blocks + 8 * i));
+    }
+
+    __m256i v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = _mm256_set1_epi64x(h[i]);
+        v[i + 8] = _mm256_set1_epi64x(IV[i]);
+    }
+    v[12] = _mm256_xor_si256(v[12], _mm256_set1_epi64x(counter));
+    v[14] = _mm256_xor_si256(v[14], _mm256_set1_epi64x(-1));
+
+#define G4(a, b, c, d, x, y)                                                              \
+    do {                                                                                  \
+        a = _mm256_add_epi64(_mm256_add_epi64(a, b), x);                                  \
+        d = _mm256_shuffle_epi32(_mm256_xor_si256(d, a), _MM_SHUFFLE(2, 3, 0, 1));       \
+        c = _mm256_add_epi64(c, d);                                                       \
+        b = _mm256_shuffle_epi8(_mm256_xor_si256(b, c), r24);                             \
+        a = _mm256_add_epi64(_mm256_add_epi64(a, b), y);                                  \
+        d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), r16);                             \
+        c = _mm256_add_epi64(c, d);                                                       \
+        b = _mm256_xor_si256(b, c);                                                       \
+        b = _mm256_or_si256(_mm256_srli_epi64(b, 63), _mm256_add_epi64(b, b));           \
+    } while (0)
+
+    for (int r = 0; r < 12; r++) {
+        const unsigned char* s = SIGMA[r];
+        G4(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        G4(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        G4(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        G4(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        G4(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        G4(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G4(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        G4(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+#undef G4
+
+    uint64_t lanes[8][4];
+    for (int i = 0; i < 8; i++) {
+        __m256i hi = _mm256_xor_si256(_mm256_set1_epi64x(h[i]), _mm256_xor_si256(v[i], v[i + 8]));
+        _mm256_storeu_si256((__m256i*)lanes[i], hi);
+    }
+    for (int lane = 0; lane < 4; lane++) {
+        unsigned char digest[64];
+        for (int i = 0; i < 8; i++)
+            WriteLE64(digest + 8 * i, lanes[i][lane]);
+        memcpy(out + lane * outlen, digest, outlen);
+    }
+}
+
+bool HaveAVX2()
+{
+    static const bool fHaveAVX2 = __builtin_cpu_supports("avx2");
+    return fHaveAVX2;
+}
+#endif
+
+} // namespace blake2b
+} // namespace
+
+CBLAKE2b::CBLAKE2b() : bufsize(0), counter(0), outlen(0)
+{
+    memset(h, 0, sizeof(h));
+    memset(buf, 0, sizeof(buf));
+}
+
+CBLAKE2b::CBLAKE2b(size_t outlenIn, const unsigned char personal[PERSONAL_SIZE])
+{
+    Init(outlenIn, personal);
+}
+
+CBLAKE2b& CBLAKE2b::Init(size_t outlenIn, const unsigned char personal[PERSONAL_SIZE])
+{
+    assert(outlenIn > 0 && outlenIn <= MAX_OUTPUT_SIZE);
+    outlen = outlenIn;
+    bufsize = 0;
+    counter = 0;
+    memset(buf, 0, sizeof(buf));
+    for (int i = 0; i < 8; i++)
+        h[i] = blake2b::IV[i];
+    // Parameter block: digest length, no key, fanout and depth 1, no salt
+    h[0] ^= 0x01010000ull ^ outlen;
+    h[6] ^= ReadLE64(personal);
+    h[7] ^= ReadLE64(personal + 8);
+    return *this;
+}
+
+CBLAKE2b& CBLAKE2b::Write(const unsigned char* data, size_t len)
+{
+    while (len > 0) {
+        // The last block is only compressed on finalization
+        if (bufsize == sizeof(buf)) {
+            counter += sizeof(buf);
+            blake2b::Compress(h, buf, counter, false);
+            bufsize = 0;
+        }
+        size_t n = std::min(sizeof(buf) - bufsize, len);
+        memcpy(buf + bufsize, data, n);
+        bufsize += n;
+        data += n;
+        len -= n;
+    }
+    return *this;
+}
+
+void CBLAKE2b::Finalize(unsigned char* hash) const
+{
+    uint64_t hFinal[8];
+    memcpy(hFinal, h, sizeof(h));
+    unsigned char block[128] = {};
+    memcpy(block, buf, bufsize);
+    blake2b::Compress(hFinal, block, counter + bufsize, true);
+
+    unsigned char digest[64];
+    for (int i = 0; i < 8; i++)
+        WriteLE64(digest + 8 * i, hFinal[i]);
+    memcpy(hash, digest, outlen);
+}
+
+void CBLAKE2b::FinalizeWithIndices(const uint32_t* indices, size_t count, unsigned char* hashes) const
+{
+    size_t i = 0;
+#ifdef ENABLE_BLAKE2B_AVX2
+    // All four hashes end with one block holding the buffered bytes and the index
+    if (blake2b::HaveAVX2() && bufsize + 4 <= sizeof(buf)) {
+        unsigned char blocks[4 * 128];
+        memset(blocks, 0, sizeof(blocks));
+        for (int lane = 0; lane < 4; lane++)
+            memcpy(blocks + lane * 128, buf, bufsize);
+        for (; i + 4 <= count; i += 4) {
+            for (int lane = 0; lane < 4; lane++)
+                WriteLE32(blocks + lane * 128 + bufsize, indices[i + lane]);
+            blake2b::CompressLast4Way(h, blocks, counter + bufsize + 4, outlen, hashes + i * outlen);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        CBLAKE2b state(*this);
+        unsigned char index[4];
+        WriteLE32(index, indices[i]);
+        state.Write(index, sizeof(index));
+        state.Finalize(hashes + i * outlen);
+    }
+}
+
+std::string BLAKE2bImplementation()
+{
+#ifdef ENABLE_BLAKE2B_AVX2
+    if (blake2b::HaveAVX2())
+        return "avx2";
+#endif
+    return "standard";
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_BLAKE2B_H
+#define BITCOIN_CRYPTO_BLAKE2B_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/**
+ * A hasher class for unkeyed BLAKE2b with a personalization string.
+ *
+ * Besides the usual incremental interface it can finalize the hash of the
+ * data written so far followed by a 32-bit little endian index for many
+ * indices at once, which is what Equihash spends its time on. When the CPU
+ * supports AVX2 four of those hashes are computed in parallel.
+ */
+class CBLAKE2b
+{
+public:
+    static const size_t MAX_OUTPUT_SIZE = 64;
+    static const size_t PERSONAL_SIZE = 16;
+
+    CBLAKE2b();
+    CBLAKE2b(size_t outlen, const unsigned char personal[PERSONAL_SIZE]);
+    CBLAKE2b& Init(size_t outlen, const unsigned char personal[PERSONAL_SIZE]);
+    CBLAKE2b& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char* hash) const;
+
+    /**
+     * For each i < count write the hash of (data written so far || LE32(indices[i]))
+     * to hashes + i * OutputSize(). The state itself is not modified.
+     */
+    void FinalizeWithIndices(const uint32_t* indices, size_t count, unsigned char* hashes) const;
+
+    size_t OutputSize() const { return outlen; }
+
+private:
+    uint64_t h[8];
+    unsigned char buf[128];
+    size_t bufsize;
+    uint64_t counter;
+    size_t outlen;
+};
+
+/** Name of the BLAKE2b implementation used by CBLAKE2b::FinalizeWithIndices ("avx2" or "standard"). */
+std::string BLAKE2bImplementation();
+
+#endif // BITCOIN_CRYPTO_BLAKE2B_H
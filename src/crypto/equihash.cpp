@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <new>
 #include <stdexcept>
 
 #include <boost/optional.hpp>
@@ -44,6 +45,19 @@ int Equihash<N,K>::InitialiseState(eh_HashState& base_state)
                                                          personalization);
 }
 
+template<unsigned int N, unsigned int K>
+int Equihash<N,K>::InitialiseState(CBLAKE2b& base_state)
+{
+    uint32_t le_N = htole32(N);
+    uint32_t le_K = htole32(K);
+    unsigned char personalization[CBLAKE2b::PERSONAL_SIZE] = {};
+    memcpy(personalization, "ZcashPoW", 8);
+    memcpy(personalization+8,  &le_N, 4);
+    memcpy(personalization+12, &le_K, 4);
+    base_state.Init(HashOutput, personalization);
+    return 0;
+}
+
 void GenerateHash(const eh_HashState& base_state, eh_index g,
                   unsigned char* hash, size_t hLen)
 {
@@ -720,7 +734,18 @@ invalidsolution:
 #endif // ENABLE_MINING
 
 template<unsigned int N, unsigned int K>
-bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln)
+void Equihash<N,K>::GetSolutionIndices(const std::vector<unsigned char>& soln, eh_index indices[1 << K])
+{
+    // As GetIndicesFromMinimal, for a solution of SolutionWidth
+    unsigned char array[(1 << K) * sizeof(eh_index)];
+    ExpandArray(soln.data(), soln.size(), array, sizeof(array),
+                CollisionBitLength+1, sizeof(eh_index) - ((CollisionBitLength+1)+7)/8);
+    for (size_t n = 0; n < ((size_t)1 << K); n++)
+        indices[n] = ArrayToEhIndex(array + n * sizeof(eh_index));
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln)
 {
     if (soln.size() != SolutionWidth) {
         LogPrint("pow", "Invalid solution length: %d (expected %d)\n",
@@ -728,47 +753,90 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
+    eh_index indices[1 << K];
+    GetSolutionIndices(soln, indices);
     unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
+    return IsValidSolutionTree(indices, [&](size_t n) {
+        GenerateHash(base_state, indices[n]/IndicesPerHashOutput, tmpHash, HashOutput);
+        return tmpHash + (indices[n] % IndicesPerHashOutput) * N/8;
+    });
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::IsValidSolution(const CBLAKE2b& base_state, const std::vector<unsigned char>& soln)
+{
+    if (soln.size() != SolutionWidth) {
+        LogPrint("pow", "Invalid solution length: %d (expected %d)\n",
+                 soln.size(), SolutionWidth);
+        return false;
     }
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
+    eh_index indices[1 << K];
+    GetSolutionIndices(soln, indices);
+    eh_index hashIndices[1 << K];
+    for (size_t n = 0; n < ((size_t)1 << K); n++)
+        hashIndices[n] = indices[n]/IndicesPerHashOutput;
+
+    unsigned char hashes[(1 << K) * HashOutput];
+    base_state.FinalizeWithIndices(hashIndices, 1 << K, hashes);
+
+    return IsValidSolutionTree(indices, [&](size_t n) {
+        return hashes + n * HashOutput + (indices[n] % IndicesPerHashOutput) * N/8;
+    });
+}
+
+template<unsigned int N, unsigned int K> template<typename LeafHash>
+bool Equihash<N,K>::IsValidSolutionTree(const eh_index indices[1 << K], const LeafHash& leafHash)
+{
+    // The tree is merged depth first, left to right: subtree[l] holds the
+    // pending left subtree of 2^l leaves while bit l of the number of leaves
+    // seen is set. Only K+3 rows are kept, each built in place, and the
+    // first bad pair ends the check before the remaining leaves are hashed.
+    FullStepRow<FinalFullWidth> subtree[K + 1];
+    FullStepRow<FinalFullWidth> tmp[2];
+    for (size_t n = 0; n < ((size_t)1 << K); n++) {
+        unsigned int nMerges = 0;
+        while ((n >> nMerges) & 1)
+            nMerges++;
+
+        // The leaf and the merges go to the spare rows, the last one to its subtree
+        FullStepRow<FinalFullWidth>* row = nMerges ? &tmp[0] : &subtree[0];
+        new (row) FullStepRow<FinalFullWidth>(leafHash(n), N/8, HashLength, CollisionBitLength, indices[n]);
+        size_t hashLen = HashLength;
+        size_t lenIndices = sizeof(eh_index);
+        for (unsigned int l = 0; l < nMerges; l++) {
+            FullStepRow<FinalFullWidth>& left = subtree[l];
+            if (!HasCollision(left, *row, CollisionByteLength)) {
                 LogPrint("pow", "Invalid solution: invalid collision length between StepRows\n");
-                LogPrint("pow", "X[i]   = %s\n", X[i].GetHex(hashLen));
-                LogPrint("pow", "X[i+1] = %s\n", X[i+1].GetHex(hashLen));
+                LogPrint("pow", "X[i]   = %s\n", left.GetHex(hashLen));
+                LogPrint("pow", "X[i+1] = %s\n", row->GetHex(hashLen));
                 return false;
             }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
+            if (row->IndicesBefore(left, hashLen, lenIndices)) {
                 LogPrint("pow", "Invalid solution: Index tree incorrectly ordered\n");
                 return false;
             }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
+            if (!DistinctIndices(left, *row, hashLen, lenIndices)) {
                 LogPrint("pow", "Invalid solution: duplicate indices\n");
                 return false;
             }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
+            FullStepRow<FinalFullWidth>* merged = (l + 1 < nMerges) ? &tmp[(l + 1) & 1] : &subtree[nMerges];
+            new (merged) FullStepRow<FinalFullWidth>(left, *row, hashLen, lenIndices, CollisionByteLength);
+            row = merged;
+            hashLen -= CollisionByteLength;
+            lenIndices *= 2;
         }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
-    }
 
-    assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+        if (nMerges == K)
+            return row->IsZero(hashLen);
+    }
+    assert(false); // The last leaf completes the tree
+    return false;
 }
 
 // Explicit instantiations for Equihash<96,3>
 template int Equihash<96,3>::InitialiseState(eh_HashState& base_state);
+template int Equihash<96,3>::InitialiseState(CBLAKE2b& base_state);
 #ifdef ENABLE_MINING
 template bool Equihash<96,3>::BasicSolve(const eh_HashState& base_state,
                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
@@ -777,10 +845,12 @@ template bool Equihash<96,3>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<96,3>::IsValidSolution(const CBLAKE2b& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<200,9>
 template int Equihash<200,9>::InitialiseState(eh_HashState& base_state);
+template int Equihash<200,9>::InitialiseState(CBLAKE2b& base_state);
 #ifdef ENABLE_MINING
 template bool Equihash<200,9>::BasicSolve(const eh_HashState& base_state,
                                           const std::function<bool(std::vector<unsigned char>)> validBlock,
@@ -789,10 +859,12 @@ template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<200,9>::IsValidSolution(const CBLAKE2b& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<96,5>
 template int Equihash<96,5>::InitialiseState(eh_HashState& base_state);
+template int Equihash<96,5>::InitialiseState(CBLAKE2b& base_state);
 #ifdef ENABLE_MINING
 template bool Equihash<96,5>::BasicSolve(const eh_HashState& base_state,
                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
@@ -801,10 +873,12 @@ template bool Equihash<96,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<96,5>::IsValidSolution(const CBLAKE2b& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<48,5>
 template int Equihash<48,5>::InitialiseState(eh_HashState& base_state);
+template int Equihash<48,5>::InitialiseState(CBLAKE2b& base_state);
 #ifdef ENABLE_MINING
 template bool Equihash<48,5>::BasicSolve(const eh_HashState& base_state,
                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
@@ -813,4 +887,5 @@ template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+template bool Equihash<48,5>::IsValidSolution(const CBLAKE2b& base_state, const std::vector<unsigned char>& soln);
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_EQUIHASH_H
 #define BITCOIN_EQUIHASH_H
 
+#include "crypto/blake2b.h"
 #include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
@@ -52,6 +53,8 @@ protected:
 public:
     StepRow(const unsigned char* hashIn, size_t hInLen,
             size_t hLen, size_t cBitLen);
+    //! Uninitialized, for rows to be built in place
+    StepRow() { }
     ~StepRow() { }
 
     template<size_t W>
@@ -90,6 +93,7 @@ class FullStepRow : public StepRow<WIDTH>
 public:
     FullStepRow(const unsigned char* hashIn, size_t hInLen,
                 size_t hLen, size_t cBitLen, eh_index i);
+    FullStepRow() { }
     ~FullStepRow() { }
 
     FullStepRow(const FullStepRow<WIDTH>& a) : StepRow<WIDTH> {a} { }
@@ -182,6 +186,7 @@ public:
     Equihash() { }
 
     int InitialiseState(eh_HashState& base_state);
+    int InitialiseState(CBLAKE2b& base_state);
 #ifdef ENABLE_MINING
     bool BasicSolve(const eh_HashState& base_state,
                     const std::function<bool(std::vector<unsigned char>)> validBlock,
@@ -190,7 +195,17 @@ public:
                         const std::function<bool(std::vector<unsigned char>)> validBlock,
                         const std::function<bool(EhSolverCancelCheck)> cancelled);
 #endif
-    bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+    // Solutions are checked without heap allocations, with the rows of
+    // the index tree on the stack
+    bool IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
+    // Same as above, but all the hashes of the solution are generated in one
+    // batch, which uses the SIMD BLAKE2b implementation if available.
+    bool IsValidSolution(const CBLAKE2b& base_state, const std::vector<unsigned char>& soln);
+
+private:
+    void GetSolutionIndices(const std::vector<unsigned char>& soln, eh_index indices[1 << K]);
+    template<typename LeafHash>
+    bool IsValidSolutionTree(const eh_index indices[1 << K], const LeafHash& leafHash);
 };
 
 #include "equihash.tcc"
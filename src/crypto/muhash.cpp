@@ -0,0 +1,167 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <string.h>
+
+namespace {
+
+typedef unsigned __int128 uint128_t;
+
+//! The prime is 2^3072 - MAX_PRIME_DIFF, so 2^3072 is MAX_PRIME_DIFF modulo it
+const uint64_t MAX_PRIME_DIFF = 1103717;
+
+/** r += top * 2^3072, that is top * MAX_PRIME_DIFF, until nothing is left above 2^3072 */
+void FoldTop(uint64_t* r, uint64_t top)
+{
+    while (top != 0) {
+        uint128_t acc = (uint128_t)top * MAX_PRIME_DIFF;
+        int i = 0;
+        for (; i < Num3072::LIMBS && acc != 0; i++) {
+            acc += r[i];
+            r[i] = (uint64_t)acc;
+            acc >>= 64;
+        }
+        top = (uint64_t)acc;
+    }
+}
+
+} // anon namespace
+
+Num3072::Num3072()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+Num3072::Num3072(const unsigned char* data)
+{
+    for (int i = 0; i < LIMBS; i++)
+        limbs[i] = ReadLE64(data + 8 * i);
+    if (IsOverflow())
+        FullReduce();
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= ~(uint64_t)0 - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; i++)
+        if (limbs[i] != ~(uint64_t)0)
+            return false;
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtract the prime: add MAX_PRIME_DIFF and drop the 2^3072 carried out
+    uint128_t acc = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; i++) {
+        acc += limbs[i];
+        limbs[i] = (uint64_t)acc;
+        acc >>= 64;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint64_t t[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            uint128_t v = (uint128_t)limbs[i] * a.limbs[j] + t[i + j] + carry;
+            t[i + j] = (uint64_t)v;
+            carry = (uint64_t)(v >> 64);
+        }
+        t[i + LIMBS] = carry;
+    }
+
+    // The high half counts MAX_PRIME_DIFF times
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        uint128_t v = (uint128_t)t[LIMBS + i] * MAX_PRIME_DIFF + t[i] + carry;
+        limbs[i] = (uint64_t)v;
+        carry = (uint64_t)(v >> 64);
+    }
+    FoldTop(limbs, carry);
+    if (IsOverflow())
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // a^(p-2), the bits of p-2 = 2^3072 - MAX_PRIME_DIFF - 2 from the top
+    uint64_t exponent[LIMBS];
+    exponent[0] = ~(uint64_t)0 - MAX_PRIME_DIFF - 1;
+    for (int i = 1; i < LIMBS; i++)
+        exponent[i] = ~(uint64_t)0;
+
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; i--) {
+        for (int bit = 63; bit >= 0; bit--) {
+            result.Multiply(result);
+            if ((exponent[i] >> bit) & 1)
+                result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::ToBytes(unsigned char* out) const
+{
+    for (int i = 0; i < LIMBS; i++)
+        WriteLE64(out + 8 * i, limbs[i]);
+}
+
+/** The number a string is mapped to: SHA-512 in counter mode, keyed by SHA-256 of the string */
+static Num3072 ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; i++)
+        CSHA512().Write(key, sizeof(key)).Write(&i, 1).Finalize(bytes + i * CSHA512::OUTPUT_SIZE);
+    return Num3072(bytes);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE]) const
+{
+    Num3072 result = denominator.GetInverse();
+    result.Multiply(numerator);
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    result.ToBytes(bytes);
+    CSHA256().Write(bytes, sizeof(bytes)).Finalize(hash);
+}
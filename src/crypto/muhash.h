@@ -0,0 +1,90 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, as 48 little endian limbs */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+    static const int LIMBS = 48;
+
+    uint64_t limbs[LIMBS];
+
+    //! The number one
+    Num3072();
+    //! The number of BYTE_SIZE little endian bytes, reduced
+    explicit Num3072(const unsigned char* data);
+
+    void Multiply(const Num3072& a);
+    //! The inverse, by exponentiation to the prime minus two; much slower than Multiply
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char* out) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A hash of a set of byte strings that does not depend on the order they are
+ * added in, and that strings can be added to and removed from one at a time
+ * (MuHash, from "A New Paradigm for Collision-free Hashing: Incrementality at
+ * Reduced Cost"). Each string is mapped to a number modulo a 3072-bit prime,
+ * from SHA-512 of its SHA-256, and the hash is that of the product of the
+ * numbers of the strings added, divided by those of the strings removed.
+ *
+ * The products of the numbers added and removed are kept apart, so that
+ * adding or removing a string takes one multiplication; the division is
+ * done once, by Finalize.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t SERIALIZED_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Add, respectively remove, the strings of another hash
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    void Finalize(unsigned char hash[OUTPUT_SIZE]) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        unsigned char data[SERIALIZED_SIZE];
+        numerator.ToBytes(data);
+        denominator.ToBytes(data + Num3072::BYTE_SIZE);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        unsigned char data[SERIALIZED_SIZE];
+        s.read((char*)data, sizeof(data));
+        numerator = Num3072(data);
+        denominator = Num3072(data + Num3072::BYTE_SIZE);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return SERIALIZED_SIZE; }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -29,4 +30,24 @@ private:
     void FinalizeNoPadding(unsigned char hash[OUTPUT_SIZE], bool enforce_compression);
 };
 
+/**
+ * Name of the SHA-256 transforms picked for this CPU: SHA-NI or the ARMv8
+ * crypto extensions for single blocks, AVX2 for eight 64-byte messages at a
+ * time, "standard" otherwise.
+ */
+std::string SHA256Implementation();
+
+/**
+ * Compute the double SHA-256 of each of blocks 64-byte inputs, as the levels
+ * of a merkle tree need: in holds blocks * 64 bytes, out receives blocks * 32.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+
+/**
+ * Apply the SHA-256 compression function, from the initial state and without
+ * padding, to each of blocks 64-byte inputs, as the levels of a note
+ * commitment tree need: in holds blocks * 64 bytes, out receives blocks * 32.
+ */
+void SHA256Compress64(unsigned char* out, const unsigned char* in, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
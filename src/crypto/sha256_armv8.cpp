@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 transform with the ARMv8 crypto extensions, picked at runtime by
+// crypto/sha256.cpp when the CPU supports them.
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <arm_neon.h>
+
+namespace sha256_armv8
+{
+namespace
+{
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+} // namespace
+
+__attribute__((target("arch=armv8-a+crypto")))
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    uint32x4_t state0 = vld1q_u32(s);
+    uint32x4_t state1 = vld1q_u32(s + 4);
+
+    while (blocks--) {
+        uint32x4_t abcd = state0, efgh = state1;
+        uint32x4_t m[4];
+        for (int i = 0; i < 4; i++)
+            m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(chunk + 16 * i)));
+
+        for (int i = 0; i < 16; i++) {
+            uint32x4_t msg = vaddq_u32(m[i & 3], vld1q_u32(K + 4 * i));
+            uint32x4_t prev = state0;
+            state0 = vsha256hq_u32(state0, state1, msg);
+            state1 = vsha256h2q_u32(state1, prev, msg);
+            // The words of four rounds later replace the ones just used
+            if (i < 12)
+                m[i & 3] = vsha256su1q_u32(vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]), m[(i + 2) & 3], m[(i + 3) & 3]);
+        }
+
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+        chunk += 64;
+    }
+
+    vst1q_u32(s, state0);
+    vst1q_u32(s + 4, state1);
+}
+} // namespace sha256_armv8
+
+#endif
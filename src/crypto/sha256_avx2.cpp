@@ -0,0 +1,139 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Eight double SHA-256, or eight single compressions, of 64-byte inputs at once
+// with AVX2, one per 32-bit lane, picked at runtime by crypto/sha256.cpp when
+// the CPU supports it.
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#define SHA256_AVX2 __attribute__((target("avx2"), always_inline)) inline
+
+namespace sha256_avx2
+{
+namespace
+{
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+const uint32_t INIT[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+SHA256_AVX2 __m256i Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+SHA256_AVX2 __m256i Rotr(__m256i x, int n) { return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n)); }
+SHA256_AVX2 __m256i Ch(__m256i x, __m256i y, __m256i z) { return _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z))); }
+SHA256_AVX2 __m256i Maj(__m256i x, __m256i y, __m256i z) { return _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y))); }
+SHA256_AVX2 __m256i Sigma0(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(Rotr(x, 2), Rotr(x, 13)), Rotr(x, 22)); }
+SHA256_AVX2 __m256i Sigma1(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(Rotr(x, 6), Rotr(x, 11)), Rotr(x, 25)); }
+SHA256_AVX2 __m256i sigma0(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(Rotr(x, 7), Rotr(x, 18)), _mm256_srli_epi32(x, 3)); }
+SHA256_AVX2 __m256i sigma1(__m256i x) { return _mm256_xor_si256(_mm256_xor_si256(Rotr(x, 17), Rotr(x, 19)), _mm256_srli_epi32(x, 10)); }
+
+/** 64 rounds on eight states at once, adding the result to s. */
+__attribute__((target("avx2")))
+void Transform8(__m256i* s, __m256i* w)
+{
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++) {
+        if (i >= 16)
+            w[i & 15] = Add(Add(w[i & 15], sigma1(w[(i - 2) & 15])), Add(w[(i - 7) & 15], sigma0(w[(i - 15) & 15])));
+        __m256i t1 = Add(Add(Add(h, Sigma1(e)), Add(Ch(e, f, g), _mm256_set1_epi32(K[i]))), w[i & 15]);
+        __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = Add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Add(t1, t2);
+    }
+    s[0] = Add(s[0], a);
+    s[1] = Add(s[1], b);
+    s[2] = Add(s[2], c);
+    s[3] = Add(s[3], d);
+    s[4] = Add(s[4], e);
+    s[5] = Add(s[5], f);
+    s[6] = Add(s[6], g);
+    s[7] = Add(s[7], h);
+}
+
+/** Big endian word at offset of each of eight inputs stride bytes apart. */
+SHA256_AVX2 __m256i Read8(const unsigned char* in, int stride, int offset)
+{
+    return _mm256_set_epi32(ReadBE32(in + 7 * stride + offset), ReadBE32(in + 6 * stride + offset),
+                            ReadBE32(in + 5 * stride + offset), ReadBE32(in + 4 * stride + offset),
+                            ReadBE32(in + 3 * stride + offset), ReadBE32(in + 2 * stride + offset),
+                            ReadBE32(in + stride + offset), ReadBE32(in + offset));
+}
+
+SHA256_AVX2 void Write8(unsigned char* out, int stride, int offset, __m256i v)
+{
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, v);
+    for (int lane = 0; lane < 8; lane++)
+        WriteBE32(out + lane * stride + offset, lanes[lane]);
+}
+} // namespace
+
+__attribute__((target("avx2")))
+void TransformD64_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], w[16];
+
+    // First hash: the 64-byte input, then its padding block
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm256_set1_epi32(INIT[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = Read8(in, 64, 4 * i);
+    Transform8(s, w);
+    w[0] = _mm256_set1_epi32(0x80000000);
+    for (int i = 1; i < 15; i++)
+        w[i] = _mm256_setzero_si256();
+    w[15] = _mm256_set1_epi32(512);
+    Transform8(s, w);
+
+    // Second hash: the 32-byte digest and its padding in a single block
+    for (int i = 0; i < 8; i++) {
+        w[i] = s[i];
+        s[i] = _mm256_set1_epi32(INIT[i]);
+    }
+    w[8] = _mm256_set1_epi32(0x80000000);
+    for (int i = 9; i < 15; i++)
+        w[i] = _mm256_setzero_si256();
+    w[15] = _mm256_set1_epi32(256);
+    Transform8(s, w);
+
+    for (int i = 0; i < 8; i++)
+        Write8(out, 32, 4 * i, s[i]);
+}
+__attribute__((target("avx2")))
+void TransformC64_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], w[16];
+
+    // A single compression of each input, without padding
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm256_set1_epi32(INIT[i]);
+    for (int i = 0; i < 16; i++)
+        w[i] = Read8(in, 64, 4 * i);
+    Transform8(s, w);
+
+    for (int i = 0; i < 8; i++)
+        Write8(out, 32, 4 * i, s[i]);
+}
+} // namespace sha256_avx2
+
+#endif
@@ -0,0 +1,384 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include "memusage.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * A hash map using open addressing, meant for maps holding many small
+ * entries such as the coins cache.
+ *
+ * Entries are stored inline in fixed-size chunks that are carved out one after
+ * the other; erased entries are recycled, and the chunks are only released
+ * (all at once) by clear(). The table itself is an array of (entry index,
+ * hash) pairs searched with linear probing, so growing the table never moves
+ * an entry and never recomputes a hash.
+ *
+ * Iterators and references to an entry stay valid until that entry is erased
+ * or the map is cleared. Inserting invalidates end() only.
+ */
+template<typename K, typename V, typename Hash>
+class flatmap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+    typedef size_t size_type;
+
+private:
+    static const uint32_t CHUNK_BITS = 6;
+    static const uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const uint32_t SLOT_EMPTY = 0xffffffff;
+    static const uint32_t SLOT_DELETED = 0xfffffffe;
+
+    struct node {
+        typename std::aligned_storage<sizeof(value_type), std::alignment_of<value_type>::value>::type data;
+        //! The table slot pointing to this node if used, the next free node otherwise
+        uint32_t link;
+        bool used;
+
+        value_type* value() { return reinterpret_cast<value_type*>(&data); }
+        const value_type* value() const { return reinterpret_cast<const value_type*>(&data); }
+    };
+
+    struct slot {
+        uint32_t index;
+        uint32_t hash;
+    };
+
+    std::vector<node*> chunks;
+    std::vector<slot> table;
+    uint32_t nNodes;    //!< Number of nodes handed out so far, used or free
+    uint32_t freeList;  //!< First free node or SLOT_EMPTY
+    size_t nSize;
+    size_t nDeleted;    //!< Number of SLOT_DELETED entries in the table
+    Hash hasher;
+
+    node& get(uint32_t index) { return chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)]; }
+    const node& get(uint32_t index) const { return chunks[index >> CHUNK_BITS][index & (CHUNK_SIZE - 1)]; }
+
+    uint32_t next_used(uint32_t index) const
+    {
+        while (index < nNodes && !get(index).used)
+            index++;
+        return index;
+    }
+
+    uint32_t hash(const K& key) const { return (uint32_t)hasher(key); }
+
+    uint32_t find_index(const K& key) const
+    {
+        if (table.empty())
+            return nNodes;
+        const uint32_t h = hash(key);
+        const size_t mask = table.size() - 1;
+        for (size_t i = h & mask; ; i = (i + 1) & mask) {
+            const slot& s = table[i];
+            if (s.index == SLOT_EMPTY)
+                return nNodes;
+            if (s.index != SLOT_DELETED && s.hash == h && get(s.index).value()->first == key)
+                return s.index;
+        }
+    }
+
+    uint32_t alloc_node()
+    {
+        uint32_t index;
+        if (freeList != SLOT_EMPTY) {
+            index = freeList;
+            freeList = get(index).link;
+        } else {
+            assert(nNodes < SLOT_DELETED);
+            if (nNodes == chunks.size() * CHUNK_SIZE)
+                chunks.push_back(new node[CHUNK_SIZE]);
+            index = nNodes++;
+        }
+        get(index).used = false;
+        return index;
+    }
+
+    void free_node(uint32_t index)
+    {
+        node& n = get(index);
+        n.used = false;
+        n.link = freeList;
+        freeList = index;
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<slot> old(capacity, slot{SLOT_EMPTY, 0});
+        old.swap(table);
+        const size_t mask = table.size() - 1;
+        for (const slot& s : old) {
+            if (s.index == SLOT_EMPTY || s.index == SLOT_DELETED)
+                continue;
+            size_t i = s.hash & mask;
+            while (table[i].index != SLOT_EMPTY)
+                i = (i + 1) & mask;
+            table[i] = s;
+            get(s.index).link = i;
+        }
+        nDeleted = 0;
+    }
+
+    /** The smallest table holding n entries at most 3/4 full, as reserve_one grows it to. */
+    static size_t table_capacity(size_t n)
+    {
+        if (n == 0)
+            return 0;
+        size_t capacity = 16;
+        while (capacity * 3 < n * 4)
+            capacity *= 2;
+        return capacity;
+    }
+
+    /** Make sure one more entry can be added with the table at most 3/4 full. */
+    void reserve_one()
+    {
+        if ((nSize + nDeleted + 1) * 4 <= table.size() * 3)
+            return;
+        size_t capacity = 16;
+        while (capacity < (nSize + 1) * 2)
+            capacity *= 2;
+        rehash(capacity);
+    }
+
+public:
+    class const_iterator;
+
+    class iterator
+    {
+        friend class flatmap;
+        friend class const_iterator;
+
+        flatmap* map;
+        uint32_t pos;
+
+        iterator(flatmap* mapIn, uint32_t posIn) : map(mapIn), pos(posIn) {}
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename flatmap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator() : map(NULL), pos(0) {}
+        value_type& operator*() const { return *map->get(pos).value(); }
+        value_type* operator->() const { return map->get(pos).value(); }
+        iterator& operator++() { pos = map->next_used(pos + 1); return *this; }
+        iterator operator++(int) { iterator copy(*this); ++(*this); return copy; }
+        bool operator==(const iterator& x) const { return pos == x.pos; }
+        bool operator!=(const iterator& x) const { return pos != x.pos; }
+    };
+
+    class const_iterator
+    {
+        friend class flatmap;
+
+        const flatmap* map;
+        uint32_t pos;
+
+        const_iterator(const flatmap* mapIn, uint32_t posIn) : map(mapIn), pos(posIn) {}
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef const typename flatmap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        const_iterator() : map(NULL), pos(0) {}
+        const_iterator(const iterator& x) : map(x.map), pos(x.pos) {}
+        value_type& operator*() const { return *map->get(pos).value(); }
+        value_type* operator->() const { return map->get(pos).value(); }
+        const_iterator& operator++() { pos = map->next_used(pos + 1); return *this; }
+        const_iterator operator++(int) { const_iterator copy(*this); ++(*this); return copy; }
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.pos == b.pos; }
+        friend bool operator!=(const const_iterator& a, const const_iterator& b) { return a.pos != b.pos; }
+    };
+
+    flatmap() : nNodes(0), freeList(SLOT_EMPTY), nSize(0), nDeleted(0) {}
+
+    flatmap(const flatmap& other) : nNodes(0), freeList(SLOT_EMPTY), nSize(0), nDeleted(0), hasher(other.hasher)
+    {
+        for (const_iterator it = other.begin(); it != other.end(); ++it)
+            emplace(*it);
+    }
+
+    flatmap& operator=(const flatmap& other)
+    {
+        if (this != &other) {
+            clear();
+            hasher = other.hasher;
+            for (const_iterator it = other.begin(); it != other.end(); ++it)
+                emplace(*it);
+        }
+        return *this;
+    }
+
+    ~flatmap() { clear(); }
+
+    iterator begin() { return iterator(this, next_used(0)); }
+    const_iterator begin() const { return const_iterator(this, next_used(0)); }
+    iterator end() { return iterator(this, nNodes); }
+    const_iterator end() const { return const_iterator(this, nNodes); }
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const K& key) { return iterator(this, find_index(key)); }
+    const_iterator find(const K& key) const { return const_iterator(this, find_index(key)); }
+    size_t count(const K& key) const { return find_index(key) != nNodes; }
+
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        // Build the entry in a fresh node first, as the key is only known then
+        const uint32_t index = alloc_node();
+        node& n = get(index);
+        new (n.value()) value_type(std::forward<Args>(args)...);
+
+        reserve_one();
+        const uint32_t h = hash(n.value()->first);
+        const size_t mask = table.size() - 1;
+        size_t target = table.size();
+        for (size_t i = h & mask; ; i = (i + 1) & mask) {
+            const slot& s = table[i];
+            if (s.index == SLOT_EMPTY) {
+                if (target == table.size())
+                    target = i;
+                break;
+            }
+            if (s.index == SLOT_DELETED) {
+                if (target == table.size())
+                    target = i;
+            } else if (s.hash == h && get(s.index).value()->first == n.value()->first) {
+                n.value()->~value_type();
+                free_node(index);
+                return std::make_pair(iterator(this, s.index), false);
+            }
+        }
+
+        if (table[target].index == SLOT_DELETED)
+            nDeleted--;
+        table[target].index = index;
+        table[target].hash = h;
+        n.link = target;
+        n.used = true;
+        nSize++;
+        return std::make_pair(iterator(this, index), true);
+    }
+
+    template<typename P>
+    std::pair<iterator, bool> insert(P&& value) { return emplace(std::forward<P>(value)); }
+
+    V& operator[](const K& key)
+    {
+        uint32_t index = find_index(key);
+        if (index == nNodes)
+            index = emplace(key, V()).first.pos;
+        return get(index).value()->second;
+    }
+
+    iterator erase(iterator it)
+    {
+        node& n = get(it.pos);
+        assert(n.used);
+        table[n.link].index = SLOT_DELETED;
+        nDeleted++;
+        n.value()->~value_type();
+        free_node(it.pos);
+        nSize--;
+        return iterator(this, next_used(it.pos + 1));
+    }
+
+    size_t erase(const K& key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    /**
+     * Size the map for n entries, so that a map empty until now takes no
+     * more than DynamicMemoryUsageFor(n) for up to n entries.
+     */
+    void reserve(size_t n)
+    {
+        chunks.reserve((n + CHUNK_SIZE - 1) >> CHUNK_BITS);
+        if (table_capacity(n) > table.size())
+            rehash(table_capacity(n));
+    }
+
+    void swap(flatmap& other)
+    {
+        chunks.swap(other.chunks);
+        table.swap(other.table);
+        std::swap(nNodes, other.nNodes);
+        std::swap(freeList, other.freeList);
+        std::swap(nSize, other.nSize);
+        std::swap(nDeleted, other.nDeleted);
+        std::swap(hasher, other.hasher);
+    }
+
+    /** Remove all entries and release all memory. */
+    void clear()
+    {
+        for (uint32_t i = 0; i < nNodes; i++) {
+            if (get(i).used)
+                get(i).value()->~value_type();
+        }
+        for (node* chunk : chunks)
+            delete[] chunk;
+        std::vector<node*>().swap(chunks);
+        std::vector<slot>().swap(table);
+        nNodes = 0;
+        freeList = SLOT_EMPTY;
+        nSize = 0;
+        nDeleted = 0;
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return memusage::MallocUsage(sizeof(node) * CHUNK_SIZE) * chunks.size() +
+               memusage::DynamicUsage(chunks) + memusage::DynamicUsage(table);
+    }
+
+    /** DynamicMemoryUsage of a map reserved for, and holding, n entries */
+    static size_t DynamicMemoryUsageFor(size_t n)
+    {
+        const size_t nChunks = (n + CHUNK_SIZE - 1) >> CHUNK_BITS;
+        return memusage::MallocUsage(sizeof(node) * CHUNK_SIZE) * nChunks +
+               memusage::MallocUsage(sizeof(node*) * nChunks) + memusage::MallocUsage(sizeof(slot) * table_capacity(n));
+    }
+};
+
+namespace memusage
+{
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z>& m)
+{
+    return m.DynamicMemoryUsage();
+}
+
+}
+
+#endif // BITCOIN_FLATMAP_H
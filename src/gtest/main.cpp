@@ -1,7 +1,9 @@
 #include "gmock/gmock.h"
 #include "crypto/common.h"
 #include "key.h"
+#include "proofcache.h"
 #include "pubkey.h"
+#include "script/sigcache.h"
 #include "zcash/JoinSplit.hpp"
 #include "util.h"
 
@@ -22,6 +24,8 @@ ZCJoinSplit* params;
 int main(int argc, char **argv) {
   assert(init_and_check_sodium() != -1);
   ECC_Start();
+  InitSignatureCache();
+  InitProofCache();
 
   libsnark::default_r1cs_ppzksnark_pp::init_public_params();
   libsnark::inhibit_profiling_info = true;
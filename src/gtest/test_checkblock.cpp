@@ -70,6 +70,88 @@ TEST(CheckBlock, BlockRejectsBadVersion) {
     EXPECT_FALSE(CheckBlock(block, state, verifier, false, false));
 }
 
+// Test that with the transactions checked on the queue, the first
+// failing one is still the one reported.
+TEST(CheckBlock, ParallelTxChecksReportFirstFailure) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CMutableTransaction mtxCoinbase;
+    mtxCoinbase.vin.resize(1);
+    mtxCoinbase.vin[0].prevout.SetNull();
+    mtxCoinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    mtxCoinbase.vout.resize(1);
+    mtxCoinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    mtxCoinbase.vout[0].nValue = 0;
+
+    CBlock block;
+    block.nVersion = MIN_BLOCK_VERSION;
+    block.vtx.push_back(CTransaction(mtxCoinbase));
+    for (int i = 1; i < 32; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.resize(1);
+        mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        mtx.vout[0].nValue = 0;
+        if (i == 1)
+            mtx.nVersion = -1;
+        if (i == 20)
+            mtx.vout[0].nValue = -1;
+        block.vtx.push_back(CTransaction(mtx));
+    }
+
+    // No worker threads run here, the queue is worked through by CheckBlock itself
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = 2;
+
+    MockCValidationState state;
+    auto verifier = libzcash::ProofVerifier::Strict();
+
+    EXPECT_CALL(state, DoS(100, false, REJECT_INVALID, "bad-txns-version-too-low", false)).Times(1);
+    EXPECT_FALSE(CheckBlock(block, state, verifier, false, false));
+
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+}
+
+// Test that a block which passed the context-free checks, e.g. on a
+// pre-validation thread, is not checked again unless proofs are asked for.
+TEST(CheckBlock, CheckedBlockIsNotCheckedAgain) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    CBlock block = Params().GenesisBlock();
+    block.fChecked = false;
+    block.fProofsChecked = false;
+
+    auto disabled = libzcash::ProofVerifier::Disabled();
+    auto strict = libzcash::ProofVerifier::Strict();
+    CValidationState state;
+
+    // Only the full checks are remembered
+    EXPECT_TRUE(CheckBlock(block, state, disabled, false, false));
+    EXPECT_FALSE(block.fChecked);
+    EXPECT_TRUE(CheckBlock(block, state, disabled));
+    EXPECT_TRUE(block.fChecked);
+    EXPECT_FALSE(block.fProofsChecked);
+
+    // A block that fails is not
+    CBlock blockBad;
+    blockBad.nVersion = 1;
+    EXPECT_FALSE(CheckBlock(blockBad, state, disabled));
+    EXPECT_FALSE(blockBad.fChecked);
+
+    // Made invalid behind its back, the checked block still passes...
+    block.nVersion = 1;
+    EXPECT_TRUE(CheckBlock(block, state, disabled));
+
+    // ... unless its proofs are to be verified and have not been yet
+    MockCValidationState mockState;
+    EXPECT_CALL(mockState, DoS(100, false, REJECT_INVALID, "version-too-low", false)).Times(1);
+    EXPECT_FALSE(CheckBlock(block, mockState, strict));
+
+    block.fProofsChecked = true;
+    EXPECT_TRUE(CheckBlock(block, state, strict));
+}
+
 
 extern CBlockIndex* AddToBlockIndex(const CBlockHeader& block);
 extern void CleanUpAll();
@@ -5,9 +5,12 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include "crypto/blake2b.h"
 #include "crypto/equihash.h"
 #include "uint256.h"
 
+#include "sodium.h"
+
 void TestExpandAndCompress(const std::string &scope, size_t bit_len, size_t byte_pad,
                            std::vector<unsigned char> compact,
                            std::vector<unsigned char> expanded)
@@ -70,6 +73,52 @@ TEST(equihash_tests, minimal_solution_representation) {
                         ParseHex("000220000a7ffffe004d10014c800ffc00002fffff"));
 }
 
+TEST(equihash_tests, blake2b_matches_libsodium) {
+    unsigned char personal[CBLAKE2b::PERSONAL_SIZE] = {};
+    memcpy(personal, "ZcashPoW", 8);
+    personal[8] = 200;
+    personal[12] = 9;
+
+    std::vector<unsigned char> data(300);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = i * 7 + 3;
+    }
+    std::vector<uint32_t> indices;
+    for (uint32_t i = 0; i < 13; i++) {
+        indices.push_back(i * 0x01010101);
+    }
+
+    // Cover an empty, a partial, a full and a multi-block buffer
+    for (size_t len : {0, 1, 108, 124, 125, 128, 140, 300}) {
+        SCOPED_TRACE(len);
+        for (size_t outlen : {32, 50, 64}) {
+            crypto_generichash_blake2b_state sodiumState;
+            crypto_generichash_blake2b_init_salt_personal(&sodiumState, NULL, 0, outlen, NULL, personal);
+            crypto_generichash_blake2b_update(&sodiumState, data.data(), len);
+
+            CBLAKE2b state(outlen, personal);
+            state.Write(data.data(), len);
+
+            unsigned char expected[CBLAKE2b::MAX_OUTPUT_SIZE];
+            unsigned char hash[CBLAKE2b::MAX_OUTPUT_SIZE];
+            crypto_generichash_blake2b_state tmp = sodiumState;
+            crypto_generichash_blake2b_final(&tmp, expected, outlen);
+            state.Finalize(hash);
+            EXPECT_EQ(0, memcmp(expected, hash, outlen));
+
+            std::vector<unsigned char> hashes(indices.size() * outlen);
+            state.FinalizeWithIndices(indices.data(), indices.size(), hashes.data());
+            for (size_t i = 0; i < indices.size(); i++) {
+                uint32_t le_i = htole32(indices[i]);
+                tmp = sodiumState;
+                crypto_generichash_blake2b_update(&tmp, (unsigned char*)&le_i, sizeof(le_i));
+                crypto_generichash_blake2b_final(&tmp, expected, outlen);
+                EXPECT_EQ(0, memcmp(expected, hashes.data() + i * outlen, outlen));
+            }
+        }
+    }
+}
+
 TEST(equihash_tests, is_probably_duplicate) {
     std::shared_ptr<eh_trunc> p1 (new eh_trunc[4] {0, 1, 2, 3}, std::default_delete<eh_trunc[]>());
     std::shared_ptr<eh_trunc> p2 (new eh_trunc[4] {0, 1, 1, 3}, std::default_delete<eh_trunc[]>());
@@ -103,6 +103,38 @@ TEST(keystore_tests, StoreAndRetrieveViewingKey) {
     EXPECT_EQ(ZCNoteDecryption(sk.receiving_key()), decOut);
 }
 
+TEST(keystore_tests, WatchOnlyMatchesScriptsStartingWithIt) {
+    CBasicKeyStore keyStore;
+    CScript p2pkh = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 1))), false);
+    CScript p2sh = GetScriptForDestination(CScriptID(uint160(std::vector<unsigned char>(20, 2))), false);
+    CScript other = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 3))), false);
+    CScript p2pkhReplay = CScript(p2pkh) << std::vector<unsigned char>(32, 4) << 100 << OP_CHECKBLOCKATHEIGHT;
+
+    EXPECT_FALSE(keyStore.HaveWatchOnly());
+    EXPECT_FALSE(keyStore.HaveWatchOnly(p2pkh));
+
+    keyStore.AddWatchOnly(p2pkh);
+    keyStore.AddWatchOnly(p2pkh);
+    keyStore.AddWatchOnly(p2sh);
+    EXPECT_TRUE(keyStore.HaveWatchOnly());
+    EXPECT_TRUE(keyStore.HaveWatchOnly(p2pkh));
+    EXPECT_TRUE(keyStore.HaveWatchOnly(p2sh));
+    EXPECT_TRUE(keyStore.HaveWatchOnly(p2pkhReplay));
+    EXPECT_FALSE(keyStore.HaveWatchOnly(other));
+    EXPECT_FALSE(keyStore.HaveWatchOnly(CScript(p2pkh.begin(), p2pkh.end() - 1)));
+
+    // Added twice, but removed once
+    keyStore.RemoveWatchOnly(p2pkh);
+    EXPECT_FALSE(keyStore.HaveWatchOnly(p2pkh));
+    EXPECT_FALSE(keyStore.HaveWatchOnly(p2pkhReplay));
+    EXPECT_TRUE(keyStore.HaveWatchOnly(p2sh));
+
+    keyStore.RemoveWatchOnly(other);
+    keyStore.RemoveWatchOnly(p2sh);
+    EXPECT_FALSE(keyStore.HaveWatchOnly());
+    EXPECT_FALSE(keyStore.HaveWatchOnly(p2sh));
+}
+
 #ifdef ENABLE_WALLET
 class TestCCryptoKeyStore : public CCryptoKeyStore
 {
@@ -185,4 +217,46 @@ TEST(keystore_tests, store_and_retrieve_spending_key_in_encrypted_store) {
     ASSERT_EQ(1, addrs.count(addr));
     ASSERT_EQ(1, addrs.count(addr2));
 }
+
+TEST(keystore_tests, unlock_checks_many_keys_in_parallel) {
+    TestCCryptoKeyStore keyStore;
+    uint256 r {GetRandHash()};
+    CKeyingMaterial vMasterKey (r.begin(), r.end());
+
+    // Enough keys of both kinds for the first unlock to use several threads
+    std::vector<CKey> keys;
+    for (int i = 0; i < 600; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        ASSERT_TRUE(keyStore.AddKeyPubKey(key, key.GetPubKey()));
+        keys.push_back(key);
+    }
+    std::vector<libzcash::SpendingKey> sks;
+    for (int i = 0; i < 300; i++) {
+        sks.push_back(libzcash::SpendingKey::random());
+        ASSERT_TRUE(keyStore.AddSpendingKey(sks.back()));
+    }
+    ASSERT_TRUE(keyStore.EncryptKeys(vMasterKey));
+
+    uint256 r2 {GetRandHash()};
+    CKeyingMaterial vRandomKey (r2.begin(), r2.end());
+    EXPECT_FALSE(keyStore.Unlock(vRandomKey));
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+
+    for (const CKey& key : keys) {
+        CKey keyOut;
+        ASSERT_TRUE(keyStore.GetKey(key.GetPubKey().GetID(), keyOut));
+        ASSERT_TRUE(key == keyOut);
+    }
+    for (const libzcash::SpendingKey& sk : sks) {
+        libzcash::SpendingKey skOut;
+        ASSERT_TRUE(keyStore.GetSpendingKey(sk.address(), skOut));
+        ASSERT_EQ(sk, skOut);
+    }
+
+    // Later unlocks check one key of each kind
+    ASSERT_TRUE(keyStore.Lock());
+    EXPECT_FALSE(keyStore.Unlock(vRandomKey));
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+}
 #endif
@@ -11,6 +11,7 @@
 
 #include <stdexcept>
 
+#include "arith_uint256.h"
 #include "utilstrencodings.h"
 #include "version.h"
 #include "serialize.h"
@@ -299,3 +300,52 @@ TEST(merkletree, testZeroElements) {
         ASSERT_TRUE(newTree.root() == oldroot);
     }
 }
+
+TEST(merkletree, appendRange) {
+    // Every split of the testing tree's capacity between single appends and
+    // a range, against appending one at a time
+    size_t capacity = 1 << INCREMENTAL_MERKLE_TREE_DEPTH_TESTING;
+    std::vector<uint256> commitments;
+    for (size_t i = 0; i < capacity; i++) {
+        commitments.push_back(ArithToUint256(arith_uint256(i + 1)));
+    }
+
+    for (size_t before = 0; before <= capacity; before++) {
+        for (size_t count = 0; before + count <= capacity; count++) {
+            ZCTestingIncrementalMerkleTree tree, rangeTree;
+            for (size_t i = 0; i < before; i++) {
+                tree.append(commitments[i]);
+                rangeTree.append(commitments[i]);
+            }
+            boost::optional<ZCTestingIncrementalWitness> witness, rangeWitness;
+            if (before > 0) {
+                witness = tree.witness();
+                rangeWitness = rangeTree.witness();
+            }
+
+            for (size_t i = before; i < before + count; i++) {
+                tree.append(commitments[i]);
+                if (witness) {
+                    witness->append(commitments[i]);
+                }
+            }
+            rangeTree.append_range(commitments.begin() + before, commitments.begin() + before + count);
+            if (rangeWitness) {
+                rangeWitness->append_range(commitments.begin() + before, commitments.begin() + before + count);
+            }
+
+            ASSERT_TRUE(rangeTree == tree);
+            ASSERT_TRUE(rangeTree.root() == tree.root());
+            if (witness) {
+                ASSERT_TRUE(*rangeWitness == *witness);
+                ASSERT_TRUE(rangeWitness->root() == witness->root());
+            }
+        }
+    }
+
+    // A range that does not fit is rejected before anything is appended
+    ZCTestingIncrementalMerkleTree tree;
+    tree.append(commitments[0]);
+    ASSERT_THROW(tree.append_range(commitments.begin(), commitments.end()), std::runtime_error);
+    ASSERT_EQ(tree.size(), 1u);
+}
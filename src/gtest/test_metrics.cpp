@@ -1,8 +1,11 @@
 #include <gtest/gtest.h>
 
 #include "metrics.h"
+#include "tinyformat.h"
 #include "utiltime.h"
 
+#include <thread>
+
 
 TEST(Metrics, AtomicTimer) {
     AtomicTimer t;
@@ -95,6 +98,39 @@ TEST(Metrics, GetLocalSolPS) {
     SetMockTime(0);
 }
 
+TEST(Metrics, MinerThreadMetrics) {
+    EXPECT_TRUE(GetMinerThreadMetrics().empty());
+
+    auto m1 = RegisterMinerThread("default");
+    auto m2 = RegisterMinerThread("tromp");
+    auto threads = GetMinerThreadMetrics();
+    ASSERT_EQ(2, threads.size());
+    EXPECT_EQ(0, threads[0]->id);
+    EXPECT_EQ("default", threads[0]->solver);
+    EXPECT_EQ(1, threads[1]->id);
+    EXPECT_EQ("tromp", threads[1]->solver);
+
+    // Each thread has its own rate
+    SetMockTime(100);
+    m1->timer.start();
+    m2->timer.start();
+    SetMockTime(102);
+    m1->solutionTargetChecks.increment();
+    m2->solutionTargetChecks.increment();
+    m2->solutionTargetChecks.increment();
+    EXPECT_EQ(0.5, m1->timer.rate(m1->solutionTargetChecks));
+    EXPECT_EQ(1, m2->timer.rate(m2->solutionTargetChecks));
+
+    UnregisterMinerThread(m1);
+    threads = GetMinerThreadMetrics();
+    ASSERT_EQ(1, threads.size());
+    EXPECT_EQ(m2, threads[0]);
+
+    UnregisterMinerThread(m2);
+    EXPECT_TRUE(GetMinerThreadMetrics().empty());
+    SetMockTime(0);
+}
+
 TEST(Metrics, EstimateNetHeightInner) {
     // Ensure that the (rounded) current height is returned if the tip is current
     SetMockTime(15000);
@@ -136,3 +172,53 @@ TEST(Metrics, EstimateNetHeightInner) {
     EXPECT_EQ(150, EstimateNetHeightInner(100, 14100, 50, 12000, 0, 150));
     SetMockTime(0);
 }
+
+TEST(Metrics, Histogram) {
+    MetricsHistogram h;
+    std::vector<uint64_t> counts;
+    uint64_t sum;
+
+    h.snapshot(counts, sum);
+    ASSERT_EQ(METRICS_HISTOGRAM_BUCKETS, counts.size());
+    EXPECT_EQ(0, sum);
+
+    // Bounds are inclusive, negative durations count as zero
+    h.observe(-5);
+    h.observe(50);
+    h.observe(51);
+    h.observe(10000000);
+    h.observe(10000001);
+    h.snapshot(counts, sum);
+    EXPECT_EQ(2, counts[0]);
+    EXPECT_EQ(1, counts[1]);
+    EXPECT_EQ(1, counts[METRICS_HISTOGRAM_BUCKETS - 2]);
+    EXPECT_EQ(1, counts[METRICS_HISTOGRAM_BUCKETS - 1]);
+    EXPECT_EQ(50 + 51 + 10000000 + 10000001, sum);
+
+    // Observations from other threads land in other shards but are all counted
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+        threads.emplace_back([&h]() { for (int j = 0; j < 1000; j++) h.observe(100); });
+    for (std::thread& t : threads)
+        t.join();
+    h.snapshot(counts, sum);
+    EXPECT_EQ(1 + 4000, counts[1]);
+}
+
+TEST(Metrics, HistogramFamily) {
+    MetricsHistogramFamily f;
+    EXPECT_TRUE(f.list().empty());
+
+    MetricsHistogram& h = f.get("tx");
+    EXPECT_EQ(&h, &f.get("tx"));
+
+    for (size_t i = 1; i < METRICS_MAX_LABELS; i++)
+        f.get(strprintf("label%d", i));
+    EXPECT_EQ(METRICS_MAX_LABELS, f.list().size());
+
+    // Further labels share one histogram
+    EXPECT_EQ(&f.get("new1"), &f.get("new2"));
+    EXPECT_EQ(&f.get("new1"), &f.get("other"));
+    EXPECT_EQ(&h, &f.get("tx"));
+    EXPECT_EQ(METRICS_MAX_LABELS + 1, f.list().size());
+}
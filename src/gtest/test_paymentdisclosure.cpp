@@ -209,3 +209,62 @@ TEST(paymentdisclosure, mainnet) {
     mydb.DebugDumpAllStdout();
 #endif
 }
+
+// Entries written in a batch or queued for the writer thread can be read back
+// at once, and are all in the database once flushed.
+TEST(paymentdisclosure, batched_and_async_writes) {
+    SelectParams(CBaseChainParams::MAIN);
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+
+    uint256 txid = random_uint256();
+    std::vector<PaymentDisclosureKeyInfo> vBatch, vAsync;
+    for (uint64_t js = 0; js < 4; js++) {
+        for (uint8_t n = 0; n < 2; n++) {
+            PaymentDisclosureInfo info;
+            info.esk = random_uint256();
+            info.joinSplitPrivKey = random_uint256();
+            info.zaddr = libzcash::SpendingKey::random().address();
+            (js < 2 ? vBatch : vAsync).push_back(std::make_pair(PaymentDisclosureKey{txid, js, n}, info));
+        }
+    }
+    // An entry of another transaction
+    PaymentDisclosureKeyInfo other(PaymentDisclosureKey{random_uint256(), 0, 0}, vAsync[0].second);
+    vAsync.push_back(other);
+
+    {
+        PaymentDisclosureDB db(pathTemp);
+        ASSERT_TRUE(db.PutBatch(vBatch));
+        ASSERT_TRUE(db.PutAsync(vAsync));
+        for (const PaymentDisclosureKeyInfo& entry : vAsync) {
+            PaymentDisclosureInfo info;
+            ASSERT_TRUE(db.Get(entry.first, info));
+            ASSERT_EQ(entry.second, info);
+        }
+        ASSERT_TRUE(db.Flush());
+
+        std::vector<PaymentDisclosureInfo> vInfos;
+        ASSERT_TRUE(db.ForEach(PaymentDisclosureDB::KeyPrefix(txid),
+                               [&vInfos](const std::string&, const PaymentDisclosureInfo& info) {
+                                   vInfos.push_back(info);
+                                   return true;
+                               }));
+        ASSERT_EQ(8, vInfos.size());
+        // In key order, which is that of the joinsplits and outputs
+        for (size_t i = 0; i < vInfos.size(); i++)
+            EXPECT_EQ(i < 4 ? vBatch[i].second : vAsync[i - 4].second, vInfos[i]);
+
+        size_t nEntries = 0;
+        ASSERT_TRUE(db.ForEach("", [&nEntries](const std::string&, const PaymentDisclosureInfo&) {
+            return ++nEntries < 5;
+        }));
+        EXPECT_EQ(5, nEntries);
+    }
+
+    // Queued entries are written before the database is closed
+    PaymentDisclosureDB db(pathTemp);
+    PaymentDisclosureInfo info;
+    ASSERT_TRUE(db.Get(other.first, info));
+    EXPECT_EQ(other.second, info);
+}
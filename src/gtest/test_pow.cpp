@@ -68,3 +68,30 @@ TEST(PoW, DifficultyAveraging) {
                                         params),
               GetNextWorkRequired(&blocks[lastBlk], nullptr, params));
 }
+
+TEST(PoW, DifficultyCache) {
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    const int nBlocks = 4 * params.nPowAveragingWindow;
+
+    // The same chain twice, with and without the cached window state
+    std::vector<CBlockIndex> blocks(nBlocks);
+    std::vector<CBlockIndex> cached(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        for (std::vector<CBlockIndex>* chain : {&blocks, &cached}) {
+            CBlockIndex& block = (*chain)[i];
+            block.pprev = i ? &(*chain)[i - 1] : nullptr;
+            block.nHeight = i;
+            block.nTime = 1269211443 + i * params.nPowTargetSpacing + (i % 7) * 41 - (i % 3) * 97;
+            block.nBits = 0x1e7fffff - (i % 5) * 0x10000;
+        }
+        cached[i].BuildSkip();
+        cached[i].BuildDifficultyCache();
+    }
+
+    for (int i = 0; i < nBlocks; i++) {
+        EXPECT_TRUE(cached[i].fDifficultyCache);
+        EXPECT_EQ(blocks[i].GetMedianTimePast(), cached[i].GetMedianTimePast());
+        EXPECT_EQ(GetNextWorkRequired(&blocks[i], nullptr, params), GetNextWorkRequired(&cached[i], nullptr, params));
+    }
+}
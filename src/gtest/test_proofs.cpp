@@ -517,6 +517,62 @@ TEST(proofs, zksnark_serializes_properly)
     }
 }
 
+TEST(proofs, batch_verifier)
+{
+    auto example = libsnark::generate_r1cs_example_with_field_input<curve_Fr>(250, 4);
+    example.constraint_system.swap_AB_if_beneficial();
+    auto kp = libsnark::r1cs_ppzksnark_generator<curve_pp>(example.constraint_system);
+    auto vkprecomp = libsnark::r1cs_ppzksnark_verifier_process_vk(kp.vk);
+
+    std::vector<libsnark::r1cs_ppzksnark_proof<curve_pp>> proofs;
+    for (size_t i = 0; i < 5; i++) {
+        proofs.push_back(libsnark::r1cs_ppzksnark_prover<curve_pp>(
+            kp.pk,
+            example.primary_input,
+            example.auxiliary_input,
+            example.constraint_system
+        ));
+    }
+
+    auto verifier = ProofVerifier::Batch();
+    // An empty batch is trivially valid
+    ASSERT_TRUE(verifier.verifyBatch());
+
+    for (const auto& proof : proofs) {
+        ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proof));
+    }
+    ASSERT_EQ(verifier.batchSize(), proofs.size());
+    ASSERT_TRUE(verifier.verifyBatch());
+    ASSERT_EQ(verifier.batchSize(), 0);
+
+    // A single bad proof anywhere in the batch must be caught
+    for (size_t bad = 0; bad < proofs.size(); bad++) {
+        for (size_t i = 0; i < proofs.size(); i++) {
+            if (i == bad) {
+                auto badproof = PHGRProof::random_invalid().to_libsnark_proof<libsnark::r1cs_ppzksnark_proof<curve_pp>>();
+                ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, badproof));
+            } else {
+                ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proofs[i]));
+            }
+        }
+        ASSERT_FALSE(verifier.verifyBatch());
+        ASSERT_EQ(verifier.batchSize(), 0);
+    }
+
+    // A valid proof for a different primary input must fail as well
+    auto wrong_input = example.primary_input;
+    wrong_input[0] = wrong_input[0] + curve_Fr::one();
+    ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, example.primary_input, proofs[0]));
+    ASSERT_TRUE(verifier.check(kp.vk, vkprecomp, wrong_input, proofs[1]));
+    ASSERT_FALSE(verifier.verifyBatch());
+
+    // Non-batching verifiers have nothing to do
+    auto strict = ProofVerifier::Strict();
+    ASSERT_TRUE(strict.check(kp.vk, vkprecomp, example.primary_input, proofs[0]));
+    ASSERT_EQ(strict.batchSize(), 0);
+    ASSERT_TRUE(strict.verifyBatch());
+}
+
 TEST(proofs, g1_deserialization)
 {
     CompressedG1 g;
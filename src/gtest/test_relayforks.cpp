@@ -206,9 +206,9 @@ TEST(relayforks_test, relayforks) {
     ASSERT_EQ ( highest->GetBlockHash(), f1->GetBlockHash() );
 
     // 2. check that the latest arrived tips are in the correct order
-    std::cout << "f4: " << std::to_string((int)mGlobalForkTips[f4]) << std::endl;
-    std::cout << "f3: " << std::to_string((int)mGlobalForkTips[f3]) << std::endl;
-    std::cout << "f2: " << std::to_string((int)mGlobalForkTips[f2]) << std::endl;
+    std::cout << "f4: " << std::to_string(mGlobalForkTips.GetAccessTime(f4)) << std::endl;
+    std::cout << "f3: " << std::to_string(mGlobalForkTips.GetAccessTime(f3)) << std::endl;
+    std::cout << "f2: " << std::to_string(mGlobalForkTips.GetAccessTime(f2)) << std::endl;
 
     vOutput.clear();
     ASSERT_EQ ( getMostRecentGlobalForkTips(vOutput), 3);
@@ -403,5 +403,26 @@ TEST(relayforks_test, getfinality) {
 
     ASSERT_EQ( (ret.get_int64() > 0) , true);
 
+    // the batch form must match the minimum gap over all the tips for every recent enough block
+    const int nStart = std::max(1, chainActive.Height() - MAX_BLOCK_AGE_FOR_FINALITY + 2);
+    UniValue hashes(UniValue::VARR);
+    for (int h = nStart; h <= chainActive.Height(); h++)
+        hashes.push_back(chainActive[h]->GetBlockHash().ToString());
+    UniValue batchInput(UniValue::VARR);
+    batchInput.push_back(hashes);
+    UniValue batch = getblockfinalityindex(batchInput, false);
+    ASSERT_EQ(batch.size(), hashes.size());
+
+    for (int h = nStart; h <= chainActive.Height(); h++)
+    {
+        int64_t minGap = blocksToOvertakeTarget(chainActive.Tip(), chainActive[h]);
+        for (auto mapPair: mGlobalForkTips)
+            minGap = std::min(minGap, blocksToOvertakeTarget(mapPair.first, chainActive[h]));
+
+        const UniValue& entry = batch[h - nStart];
+        ASSERT_EQ(find_value(entry, "hash").get_str(), chainActive[h]->GetBlockHash().ToString());
+        ASSERT_EQ(find_value(entry, "finalityindex").get_int64(), minGap);
+    }
+
     CleanUpAll();
 }
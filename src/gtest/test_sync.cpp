@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include "sync.h"
+
+TEST(LockProfile, LockTimes) {
+    CLockTimes times;
+    times.Add(-3);
+    times.Add(0);
+    times.Add(1);
+    times.Add(3);
+    times.Add(4);
+    times.Add(int64_t(1) << 40);
+    EXPECT_EQ(6, times.nCount);
+    EXPECT_EQ(1 + 3 + 4 + (uint64_t(1) << 40), times.nTotalMicros);
+    EXPECT_EQ(uint64_t(1) << 40, times.nMaxMicros);
+    // Bucket i counts the times under 2^i not counted before
+    EXPECT_EQ(2, times.vBuckets[0]);
+    EXPECT_EQ(1, times.vBuckets[1]);
+    EXPECT_EQ(1, times.vBuckets[2]);
+    EXPECT_EQ(1, times.vBuckets[3]);
+    EXPECT_EQ(1, times.vBuckets[LOCK_PROFILE_BUCKETS - 1]);
+
+    CLockTimes sum;
+    sum.Add(times);
+    sum.Add(times);
+    EXPECT_EQ(12, sum.nCount);
+    EXPECT_EQ(4, sum.vBuckets[0]);
+    EXPECT_EQ(times.nMaxMicros, sum.nMaxMicros);
+}
+
+static const CLockSiteStats* FindSite(const std::vector<CLockSiteStats>& vStats, const std::string& strName)
+{
+    for (const CLockSiteStats& stats : vStats) {
+        if (stats.strName == strName)
+            return &stats;
+    }
+    return NULL;
+}
+
+TEST(LockProfile, Sampling) {
+    unsigned int nInterval = nLockProfileInterval;
+    GetLockProfile(true);
+
+    CCriticalSection csProfiled;
+    nLockProfileInterval = 1;
+    for (int i = 0; i < 10; i++) {
+        LOCK(csProfiled);
+    }
+    {
+        // Only blocking acquisitions are sampled
+        TRY_LOCK(csProfiled, lockProfiled);
+        bool fLocked = lockProfiled;
+        EXPECT_TRUE(fLocked);
+    }
+    std::vector<CLockSiteStats> vStats = GetLockProfile(true);
+    const CLockSiteStats* site = FindSite(vStats, "csProfiled");
+    ASSERT_TRUE(site != NULL);
+    EXPECT_EQ(__FILE__, site->strFile);
+    EXPECT_EQ(10, site->wait.nCount);
+    EXPECT_EQ(10, site->hold.nCount);
+
+    // Reset, and not sampled while disabled
+    nLockProfileInterval = 0;
+    {
+        LOCK(csProfiled);
+    }
+    site = FindSite(GetLockProfile(false), "csProfiled");
+    ASSERT_TRUE(site != NULL);
+    EXPECT_EQ(0, site->wait.nCount);
+
+    nLockProfileInterval = nInterval;
+}
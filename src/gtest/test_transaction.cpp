@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "primitives/transaction.h"
+#include "version.h"
 #include "zcash/Note.hpp"
 #include "zcash/Address.hpp"
 
@@ -118,3 +119,18 @@ TEST(Transaction, JSDescriptionRandomizedGroth) {
     do_test(true);
 }
 
+
+TEST(Transaction, JSDescriptionSerializeSize) {
+    for (bool isGroth : {false, true}) {
+        int nTxVersion = isGroth ? GROTH_TX_VERSION : PHGR_TX_VERSION;
+        JSDescription jsdesc = JSDescription::getNewInstance(isGroth);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        auto os = WithTxVersion(&ss, nTxVersion);
+        jsdesc.Serialize(os, SER_NETWORK, PROTOCOL_VERSION);
+        EXPECT_EQ(ss.size(), jsdesc.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION, nTxVersion));
+
+        // A proof of the other kind is not sized, the walk throws as serializing does
+        int nOtherTxVersion = isGroth ? PHGR_TX_VERSION : GROTH_TX_VERSION;
+        EXPECT_THROW(jsdesc.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION, nOtherTxVersion), std::ios_base::failure);
+    }
+}
@@ -162,8 +162,46 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
     return ss.GetHash();
 }
 
+unsigned int MurmurHash3(unsigned int nHashSeed, const unsigned char* pDataToHash, size_t nDataSize);
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+//! Number of seeds hashed together by the batched MurmurHash3
+static const int MURMURHASH3_LANES = 4;
+/** MurmurHash3 of one piece of data for MURMURHASH3_LANES seeds, reading and mixing the data once */
+void MurmurHash3(const uint32_t* pHashSeeds, uint32_t* pHashes, const unsigned char* pDataToHash, size_t nDataSize);
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
+/** SipHash-2-4, can be used incrementally. */
+class CSipHasher
+{
+private:
+    uint64_t v[4];
+    uint64_t tmp;
+    int count;
+
+public:
+    /** Construct a SipHash calculator initialized with 128-bit key (k0, k1) */
+    CSipHasher(uint64_t k0, uint64_t k1);
+    /** Hash a 64-bit integer worth of data
+     *  It is treated as if this was the little-endian interpretation of 8 bytes.
+     *  This function can only be used when a multiple of 8 bytes have been written so far.
+     */
+    CSipHasher& Write(uint64_t data);
+    /** Hash arbitrary bytes. */
+    CSipHasher& Write(const unsigned char* data, size_t size);
+    /** Compute the 64-bit SipHash-2-4 of the data written so far. The object remains untouched. */
+    uint64_t Finalize() const;
+};
+
+/** Optimized SipHash-2-4 implementation for uint256, equal to CSipHasher(k0, k1).Write(val.begin(), 32).Finalize(). */
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+
+/**
+ * SipHash-1-3 of a uint256: one round per word and three to finalize instead
+ * of two and four. For hash tables, where the key is secret and the output
+ * never leaves the process, it resists crafted collisions for half the work.
+ */
+uint64_t SipHash13Uint256(uint64_t k0, uint64_t k1, const uint256& val);
+
 #endif // BITCOIN_HASH_H
@@ -0,0 +1,38 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_HASHER_H
+#define BITCOIN_HASHER_H
+
+#include "hash.h"
+#include "uint256.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Hasher for hash tables keyed by txids, block hashes, nullifiers, anchors
+ * and other uint256 values that peers get to choose. A per-process random
+ * SipHash key keeps them from grinding keys that all land in one bucket.
+ */
+class SaltedUint256Hasher
+{
+private:
+    /** Salt */
+    uint64_t k0, k1;
+
+public:
+    SaltedUint256Hasher();
+
+    /**
+     * This *must* return size_t. With Boost 1.46 on 32-bit systems the
+     * unordered_map will behave unpredictably if the custom hasher returns a
+     * uint64_t, resulting in failures when syncing the chain (#4634).
+     */
+    size_t operator()(const uint256& key) const {
+        return SipHash13Uint256(k0, k1, key);
+    }
+};
+
+#endif // BITCOIN_HASHER_H
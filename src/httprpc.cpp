@@ -12,6 +12,7 @@
 #include "ui_interface.h"
 
 #include <boost/algorithm/string.hpp> // boost::trim
+#include <boost/bind.hpp>
 
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
@@ -57,6 +58,8 @@ private:
 static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
+/* Other HTTP workers a batch request may hand its calls to */
+static unsigned int nBatchHelpers = 0;
 
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
@@ -69,6 +72,9 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     else if (code == RPC_METHOD_NOT_FOUND)
         nStatus = HTTP_NOT_FOUND;
 
+    // Drop any part of a streamed result that was written before the error
+    req->DiscardReplyData();
+
     std::string strReply = JSONRPCReply(NullUniValue, objError, id);
 
     req->WriteHeader("Content-Type", "application/json");
@@ -116,6 +122,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     }
 
     JSONRequest jreq;
+    SetRPCRequestURI(req->GetURI());
     try {
         // Parse request
         UniValue valRequest;
@@ -127,6 +134,26 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            if (tableRPC.canStream(jreq.strMethod)) {
+                // Write the reply straight into the HTTP reply buffer, rather
+                // than building it as a whole first
+                JSONStreamWriter out(boost::bind(&HTTPRequest::WriteReplyData, req, _1));
+                out.BeginObject();
+                out.Key("result");
+                tableRPC.executeStream(jreq.strMethod, jreq.params, out);
+                out.Key("error");
+                out.Value(NullUniValue);
+                out.Key("id");
+                out.Value(jreq.id);
+                out.EndObject();
+                out.Flush();
+                req->WriteReplyData("\n");
+
+                req->WriteHeader("Content-Type", "application/json");
+                req->WriteReply(HTTP_OK);
+                return true;
+            }
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -134,7 +161,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
         // array of requests
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(valRequest.get_array(), &HTTPEnqueueWork, nBatchHelpers);
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -175,6 +202,9 @@ bool StartHTTPRPC()
 
     RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
 
+    if (GetBoolArg("-rpcparallelbatch", DEFAULT_HTTP_PARALLEL_BATCH))
+        nBatchHelpers = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L) - 1;
+
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
     RPCRegisterTimerInterface(httpRPCTimerInterface);
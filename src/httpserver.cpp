@@ -2,6 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "httpserver.h"
 
 #include "chainparamsbase.h"
@@ -10,6 +14,7 @@
 #include "netbase.h"
 #include "rpc/protocol.h" // For HTTP status codes
 #include "sync.h"
+#include "threadpool.h"
 #include "ui_interface.h"
 
 #include <stdio.h>
@@ -19,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <map>
 
 #include <event2/event.h>
 #include <event2/http.h>
@@ -34,7 +40,11 @@
 #endif
 #endif
 
-#include <boost/algorithm/string/case_conv.hpp> // for to_lower()
+#if ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <boost/algorithm/string.hpp> // for to_lower(), split(), trim()
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
 
@@ -58,6 +68,22 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item running a plain function, queued by HTTPEnqueueWork */
+class HTTPWorkFunction : public HTTPClosure
+{
+public:
+    HTTPWorkFunction(const boost::function<void(void)>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -164,13 +190,29 @@ public:
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPWorkQueueId queue):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), queue(queue)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPWorkQueueId queue;
+};
+
+/** Options and thread name of each work queue, indexed by HTTPWorkQueueId */
+struct HTTPWorkQueueParams
+{
+    const char* threadName;
+    const char* threadsArg;
+    int nDefaultThreads;
+    const char* depthArg;
+    int nDefaultDepth;
+};
+
+static const HTTPWorkQueueParams workQueueParams[HTTP_QUEUE_COUNT] = {
+    {"horizen-httpworker", "-rpcthreads", DEFAULT_HTTP_THREADS, "-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE},
+    {"horizen-httprest", "-restthreads", DEFAULT_HTTP_REST_THREADS, "-restworkqueue", DEFAULT_HTTP_REST_WORKQUEUE},
 };
 
 /** HTTP module state */
@@ -181,12 +223,18 @@ static struct event_base* eventBase = 0;
 struct evhttp* eventHTTP = 0;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
-//! Handlers for (sub)paths
+//! Work queues for handling longer requests off the event loop thread
+static WorkQueue<HTTPClosure>* workQueues[HTTP_QUEUE_COUNT] = {};
+//! Handlers for (sub)paths, in registration order
 std::vector<HTTPPathHandler> pathHandlers;
+//! Index into pathHandlers of the first exact-match handler for each path
+static std::map<std::string, size_t> mapExactHandlers;
 //! Bound listening sockets
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Keep connections open between requests (-rpckeepalive)
+static bool fHTTPKeepAlive = DEFAULT_HTTP_KEEPALIVE;
+//! Compress large replies for clients that accept it (-rpccompression)
+static bool fHTTPCompression = false;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -246,6 +294,34 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
+/** Find the handler for a request URI.
+ * Exact matches are looked up directly; only prefix handlers registered
+ * before that match need to be compared, which keeps the common JSON-RPC
+ * path free of any scan.
+ */
+static const HTTPPathHandler* FindHTTPHandler(const std::string& strURI)
+{
+    size_t nFound = pathHandlers.size();
+    std::map<std::string, size_t>::const_iterator it = mapExactHandlers.find(strURI);
+    if (it != mapExactHandlers.end())
+        nFound = it->second;
+    for (size_t i = 0; i < nFound; i++) {
+        const HTTPPathHandler& h = pathHandlers[i];
+        if (!h.exactMatch && strURI.compare(0, h.prefix.size(), h.prefix) == 0)
+            return &h;
+    }
+    return nFound < pathHandlers.size() ? &pathHandlers[nFound] : NULL;
+}
+
+/** Rebuild mapExactHandlers after pathHandlers changed */
+static void IndexHTTPHandlers()
+{
+    mapExactHandlers.clear();
+    for (size_t i = 0; i < pathHandlers.size(); i++)
+        if (pathHandlers[i].exactMatch)
+            mapExactHandlers.insert(std::make_pair(pathHandlers[i].prefix, i));
+}
+
 /** HTTP request callback */
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
@@ -268,24 +344,13 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Find registered handler for prefix
     std::string strURI = hreq->GetURI();
-    std::string path;
-    std::vector<HTTPPathHandler>::const_iterator i = pathHandlers.begin();
-    std::vector<HTTPPathHandler>::const_iterator iend = pathHandlers.end();
-    for (; i != iend; ++i) {
-        bool match = false;
-        if (i->exactMatch)
-            match = (strURI == i->prefix);
-        else
-            match = (strURI.substr(0, i->prefix.size()) == i->prefix);
-        if (match) {
-            path = strURI.substr(i->prefix.size());
-            break;
-        }
-    }
+    const HTTPPathHandler* handler = FindHTTPHandler(strURI);
 
     // Dispatch to worker thread
-    if (i != iend) {
-        std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
+    if (handler) {
+        std::string path = strURI.substr(handler->prefix.size());
+        std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, handler->handler));
+        WorkQueue<HTTPClosure>* workQueue = workQueues[handler->queue];
         assert(workQueue);
         if (workQueue->Enqueue(item.get()))
             item.release(); /* if true, queue took ownership */
@@ -354,9 +419,10 @@ static bool HTTPBindAddresses(struct evhttp* http)
 }
 
 /** Simple wrapper to set thread name and run work queue */
-static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
+static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue, const char* threadName)
 {
-    RenameThread("horizen-httpworker");
+    RenameThread(threadName);
+    JoinThreadPool("http");
     queue->Run();
 }
 
@@ -393,7 +459,7 @@ bool InitHTTPServer()
 #if LIBEVENT_VERSION_NUMBER >= 0x02010100
     // If -debug=libevent, set full libevent debugging.
     // Otherwise, disable all libevent debugging.
-    if (LogAcceptCategory("libevent"))
+    if (LogAcceptCategory(LOG_CATEGORY("libevent")))
         event_enable_debug_logging(EVENT_DBG_ALL);
     else
         event_enable_debug_logging(EVENT_DBG_NONE);
@@ -418,6 +484,7 @@ bool InitHTTPServer()
         return false;
     }
 
+    // Also bounds how long an idle keep-alive connection is held open
     evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
     evhttp_set_max_body_size(http, MAX_SIZE);
     evhttp_set_gencb(http, http_request_cb, NULL);
@@ -429,11 +496,18 @@ bool InitHTTPServer()
         return false;
     }
 
-    LogPrint("http", "Initialized HTTP server\n");
-    int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    fHTTPKeepAlive = GetBoolArg("-rpckeepalive", DEFAULT_HTTP_KEEPALIVE);
+#if ENABLE_ZLIB
+    fHTTPCompression = GetBoolArg("-rpccompression", DEFAULT_HTTP_COMPRESSION);
+#endif
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    LogPrint("http", "Initialized HTTP server\n");
+    for (int q = 0; q < HTTP_QUEUE_COUNT; q++) {
+        const HTTPWorkQueueParams& params = workQueueParams[q];
+        int workQueueDepth = std::max((long)GetArg(params.depthArg, params.nDefaultDepth), 1L);
+        LogPrintf("HTTP: creating work queue of depth %d (%s)\n", workQueueDepth, params.depthArg);
+        workQueues[q] = new WorkQueue<HTTPClosure>(workQueueDepth);
+    }
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -444,13 +518,22 @@ boost::thread threadHTTP;
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
     threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
 
-    for (int i = 0; i < rpcThreads; i++) {
-        boost::thread rpc_worker(HTTPWorkQueueRun, workQueue);
-        rpc_worker.detach();
+    for (int q = 0; q < HTTP_QUEUE_COUNT; q++) {
+        // Queues without handlers (e.g. REST when -rest is off) get no threads
+        bool fUsed = (q == HTTP_QUEUE_RPC);
+        BOOST_FOREACH(const HTTPPathHandler& handler, pathHandlers)
+            fUsed |= (handler.queue == q);
+        if (!fUsed)
+            continue;
+        const HTTPWorkQueueParams& params = workQueueParams[q];
+        int nThreads = std::max((long)GetArg(params.threadsArg, params.nDefaultThreads), 1L);
+        LogPrintf("HTTP: starting %d worker threads (%s)\n", nThreads, params.threadsArg);
+        for (int i = 0; i < nThreads; i++) {
+            boost::thread worker(HTTPWorkQueueRun, workQueues[q], params.threadName);
+            worker.detach();
+        }
     }
     return true;
 }
@@ -466,17 +549,21 @@ void InterruptHTTPServer()
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
-    if (workQueue)
-        workQueue->Interrupt();
+    for (int q = 0; q < HTTP_QUEUE_COUNT; q++)
+        if (workQueues[q])
+            workQueues[q]->Interrupt();
 }
 
 void StopHTTPServer()
 {
     LogPrint("http", "Stopping HTTP server\n");
-    if (workQueue) {
-        LogPrint("http", "Waiting for HTTP worker threads to exit\n");
-        workQueue->WaitExit();
-        delete workQueue;
+    LogPrint("http", "Waiting for HTTP worker threads to exit\n");
+    for (int q = 0; q < HTTP_QUEUE_COUNT; q++) {
+        if (workQueues[q]) {
+            workQueues[q]->WaitExit();
+            delete workQueues[q];
+            workQueues[q] = 0;
+        }
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -510,6 +597,18 @@ struct event_base* EventBase()
     return eventBase;
 }
 
+bool HTTPEnqueueWork(const boost::function<void(void)>& func)
+{
+    WorkQueue<HTTPClosure>* workQueue = workQueues[HTTP_QUEUE_RPC];
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPWorkFunction> item(new HTTPWorkFunction(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* if true, queue took ownership */
+    return true;
+}
+
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
 {
     // Static handler: simply call inner handler
@@ -593,6 +692,95 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  * Replies must be sent in the main loop in the main http thread,
  * this cannot be done from worker threads.
  */
+#if ENABLE_ZLIB
+enum HTTPContentEncoding
+{
+    HTTP_ENCODING_IDENTITY,
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_DEFLATE
+};
+
+/** Pick the reply encoding from an Accept-Encoding header, preferring gzip */
+static HTTPContentEncoding ParseAcceptEncoding(const std::string& strHeader)
+{
+    bool fGzip = false, fDeflate = false;
+    std::vector<std::string> vCodings;
+    boost::split(vCodings, strHeader, boost::is_any_of(","));
+    BOOST_FOREACH(std::string& strCoding, vCodings) {
+        std::vector<std::string> vParams;
+        boost::split(vParams, strCoding, boost::is_any_of(";"));
+        std::string strName = boost::to_lower_copy(boost::trim_copy(vParams[0]));
+        bool fAccepted = true;
+        for (size_t i = 1; i < vParams.size(); i++) {
+            std::string strParam = boost::trim_copy(vParams[i]);
+            if (strParam.size() > 2 && (strParam[0] == 'q' || strParam[0] == 'Q') && strParam[1] == '=')
+                fAccepted = atof(strParam.c_str() + 2) > 0;
+        }
+        if (strName == "gzip" || strName == "x-gzip")
+            fGzip = fAccepted;
+        else if (strName == "deflate")
+            fDeflate = fAccepted;
+    }
+    if (fGzip)
+        return HTTP_ENCODING_GZIP;
+    if (fDeflate)
+        return HTTP_ENCODING_DEFLATE;
+    return HTTP_ENCODING_IDENTITY;
+}
+
+/** Compress the contents of evb in place, segment by segment.
+ * Returns false, leaving evb untouched, on failure or if nothing was saved.
+ */
+static bool CompressEvBuffer(struct evbuffer* evb, HTTPContentEncoding encoding)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // windowBits 15 produces a zlib stream ("deflate"), adding 16 a gzip one
+    int windowBits = (encoding == HTTP_ENCODING_GZIP) ? 15 + 16 : 15;
+    if (deflateInit2(&zs, HTTP_COMPRESSION_LEVEL, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    int nSegments = evbuffer_peek(evb, -1, NULL, NULL, 0);
+    std::vector<struct evbuffer_iovec> vSegments(nSegments);
+    evbuffer_peek(evb, -1, NULL, vSegments.data(), nSegments);
+
+    struct evbuffer* out = evbuffer_new();
+    bool fOk = (out != NULL);
+    for (int i = 0; fOk && i < nSegments; i++) {
+        zs.next_in = (Bytef*)vSegments[i].iov_base;
+        zs.avail_in = vSegments[i].iov_len;
+        int flush = (i + 1 == nSegments) ? Z_FINISH : Z_NO_FLUSH;
+        int ret;
+        do {
+            struct evbuffer_iovec iov;
+            if (evbuffer_reserve_space(out, HTTP_COMPRESS_CHUNK_SIZE, &iov, 1) < 1) {
+                fOk = false;
+                break;
+            }
+            zs.next_out = (Bytef*)iov.iov_base;
+            zs.avail_out = iov.iov_len;
+            ret = deflate(&zs, flush);
+            iov.iov_len -= zs.avail_out;
+            evbuffer_commit_space(out, &iov, 1);
+            if (ret == Z_STREAM_ERROR) {
+                fOk = false;
+                break;
+            }
+        } while (zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    }
+    deflateEnd(&zs);
+
+    fOk = fOk && nSegments > 0 && evbuffer_get_length(out) < evbuffer_get_length(evb);
+    if (fOk) {
+        evbuffer_drain(evb, evbuffer_get_length(evb));
+        evbuffer_add_buffer(evb, out);
+    }
+    if (out)
+        evbuffer_free(out);
+    return fOk;
+}
+#endif
+
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
@@ -600,6 +788,20 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
+#if ENABLE_ZLIB
+    // Compress here, on the worker thread, rather than on the event loop
+    if (fHTTPCompression && evbuffer_get_length(evb) >= HTTP_COMPRESS_MIN_SIZE) {
+        std::pair<bool, std::string> accept = GetHeader("Accept-Encoding");
+        HTTPContentEncoding encoding = accept.first ? ParseAcceptEncoding(accept.second) : HTTP_ENCODING_IDENTITY;
+        if (encoding != HTTP_ENCODING_IDENTITY) {
+            WriteHeader("Vary", "Accept-Encoding");
+            if (CompressEvBuffer(evb, encoding))
+                WriteHeader("Content-Encoding", encoding == HTTP_ENCODING_GZIP ? "gzip" : "deflate");
+        }
+    }
+#endif
+    if (!fHTTPKeepAlive)
+        WriteHeader("Connection", "close");
     HTTPEvent* ev = new HTTPEvent(eventBase, true,
         boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
@@ -607,6 +809,22 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+void HTTPRequest::WriteReplyData(const std::string& strData)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add(evb, strData.data(), strData.size());
+}
+
+void HTTPRequest::DiscardReplyData()
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_drain(evb, evbuffer_get_length(evb));
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -647,10 +865,12 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         HTTPWorkQueueId queue)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, queue));
+    IndexHTTPHandlers();
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
@@ -664,6 +884,7 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
     {
         LogPrint("http", "Unregistering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
         pathHandlers.erase(i);
+        IndexHTTPHandlers();
     }
 }
 
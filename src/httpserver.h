@@ -14,6 +14,16 @@
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+static const bool DEFAULT_HTTP_PARALLEL_BATCH=false;
+static const int DEFAULT_HTTP_REST_THREADS=2;
+static const int DEFAULT_HTTP_REST_WORKQUEUE=16;
+static const bool DEFAULT_HTTP_KEEPALIVE=true;
+static const bool DEFAULT_HTTP_COMPRESSION=true;
+//! Replies shorter than this are sent uncompressed
+static const size_t HTTP_COMPRESS_MIN_SIZE=1024;
+//! zlib level used for replies; favours speed, JSON and hex compress well anyway
+static const int HTTP_COMPRESSION_LEVEL=3;
+static const size_t HTTP_COMPRESS_CHUNK_SIZE=1<<16;
 
 struct evhttp_request;
 struct event_base;
@@ -34,13 +44,25 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Work queues requests can be dispatched to. Each queue has its own depth
+ * and worker threads, so a backlog of slow requests on one of them does not
+ * make the others reject requests.
+ */
+enum HTTPWorkQueueId
+{
+    HTTP_QUEUE_RPC,
+    HTTP_QUEUE_REST,
+    HTTP_QUEUE_COUNT
+};
+
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
-/** Register handler for prefix.
+/** Register handler for prefix, to be run on the given work queue.
  * If multiple handlers match a prefix, the first-registered one will
  * be invoked.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         HTTPWorkQueueId queue = HTTP_QUEUE_RPC);
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
@@ -49,6 +71,11 @@ void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
  */
 struct event_base* EventBase();
 
+/** Queue func on the RPC work queue, to run on one of the worker threads.
+ * Returns false if the queue is full or not running.
+ */
+bool HTTPEnqueueWork(const boost::function<void(void)>& func);
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -115,6 +142,17 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     virtual void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Append to the body of the reply, ahead of a WriteReply call.
+     * This lets a large reply be written in pieces, without building it in a string first.
+     */
+    virtual void WriteReplyData(const std::string& strData);
+
+    /**
+     * Drop whatever WriteReplyData appended so far.
+     */
+    virtual void DiscardReplyData();
 };
 
 /** Event handler closure.
@@ -9,11 +9,14 @@
 
 #include "init.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "addrman.h"
 #include "amount.h"
 #ifdef ENABLE_MINING
 #include "base58.h"
 #endif
+#include "blockcompression.h"
+#include "blockreplay.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
@@ -24,9 +27,17 @@
 #include "metrics.h"
 #include "miner.h"
 #include "net.h"
+#include "notificationdispatcher.h"
+#include "paymentdisclosuredb.h"
+#include "rpc/jsoncache.h"
 #include "rpc/server.h"
+#include "proofcache.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "scheduler.h"
+#include "threadpool.h"
+#include "socketevents.h"
+#include "stratum.h"
 #include "txdb.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
@@ -73,11 +84,15 @@ using namespace std;
 extern void ThreadSendAlert();
 
 ZCJoinSplit* pzcashParams = NULL;
+CScheduler* pschedulerMain = NULL;
 
 #ifdef ENABLE_WALLET
 CWallet* pwalletMain = NULL;
+std::vector<CWallet*> vpwallets;
 #endif
 bool fFeeEstimatesInitialized = false;
+//! Only dump the mempool at shutdown once it was loaded, or the dump would be lost
+static bool fDumpMempoolLater = false;
 
 #if ENABLE_ZMQ
 static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
@@ -164,7 +179,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -175,6 +189,7 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptStratumServer();
     threadGroup.interrupt_all();
 }
 
@@ -195,11 +210,16 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopHTTPMetrics();
     StopRPC();
     StopHTTPServer();
+    StopStratumServer();
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
-        pwalletMain->Flush(false);
+    for (CWallet* pwallet : vpwallets)
+        pwallet->Flush(false);
+    // The asynchronous operations are done, what they queued for the payment disclosure database goes to disk
+    if (fExperimentalMode && GetBoolArg("-paymentdisclosure", false))
+        PaymentDisclosureDB::sharedInstance()->Flush();
 #endif
 #ifdef ENABLE_MINING
  #ifdef ENABLE_WALLET
@@ -212,6 +232,9 @@ void Shutdown()
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
 
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        DumpMempool();
+
     if (fFeeEstimatesInitialized)
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -232,19 +255,28 @@ void Shutdown()
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        // Writes a pending background flush before closing the database
+        delete pcoinsflush;
+        pcoinsflush = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
     }
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
-        pwalletMain->Flush(true);
+    for (CWallet* pwallet : vpwallets)
+        pwallet->Flush(true);
 #endif
 
+    // Stop publishing before the publishers go away
+    if (pNotificationDispatcher) {
+        UnregisterValidationInterface(pNotificationDispatcher);
+        delete pNotificationDispatcher;
+        pNotificationDispatcher = NULL;
+    }
+
 #if ENABLE_ZMQ
     if (pzmqNotificationInterface) {
-        UnregisterValidationInterface(pzmqNotificationInterface);
         delete pzmqNotificationInterface;
         pzmqNotificationInterface = NULL;
     }
@@ -252,7 +284,6 @@ void Shutdown()
 
 #if ENABLE_PROTON
     if (pAMQPNotificationInterface) {
-        UnregisterValidationInterface(pAMQPNotificationInterface);
         delete pAMQPNotificationInterface;
         pAMQPNotificationInterface = NULL;
     }
@@ -267,15 +298,19 @@ void Shutdown()
 #endif
     UnregisterAllValidationInterfaces();
 #ifdef ENABLE_WALLET
-    delete pwalletMain;
+    for (CWallet* pwallet : vpwallets)
+        delete pwallet;
+    vpwallets.clear();
     pwalletMain = NULL;
 #endif
     delete pzcashParams;
     pzcashParams = NULL;
+    pschedulerMain = NULL;
     globalVerifyHandle.reset();
     ECC_Stop();
     CNode::NetCleanup();
     LogPrintf("%s: done\n", __func__);
+    StopDebugLogWriter();
 }
 
 /**
@@ -341,9 +376,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", _("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script and JoinSplit proof verification (0 to verify all, default: 0)"));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
+    strUsage += HelpMessageOpt("-checkblocksbackground", strprintf(_("Do levels 0 to 2 of the -checkblocks verification (reading the blocks, checking them and their undo data) in the background once the node is started, unless pruning (default: %u)"), DEFAULT_CHECKBLOCKS_BACKGROUND));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
+    strUsage += HelpMessageOpt("-compressblocks", strprintf(_("Store new blocks compressed in the block files, which older versions cannot read (default: %u)"), DEFAULT_COMPRESS_BLOCKS));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "zen.conf"));
     if (mode == HMM_BITCOIND)
     {
@@ -355,24 +393,59 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-disabledeprecation=<version>", strprintf(_("Disable block-height node deprecation and automatic shutdown (example: -disabledeprecation=%s)"),
         FormatVersion(CLIENT_VERSION)));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
+    strUsage += HelpMessageOpt("-coinswriteinterval=<n>", strprintf(_("Once synced, write the modified coins to disk every <n> seconds and keep them cached, so that a shutdown has little left to write (0 to disable, default: %u)"), DEFAULT_COINS_WRITE_INTERVAL));
+    strUsage += HelpMessageOpt("-asyncflush", strprintf(_("Write the coin database cache to disk in the background instead of blocking block processing (default: %u)"), DEFAULT_ASYNC_FLUSH));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbcacheibd=<n>", strprintf(_("Database cache size in megabytes during initial block download, if -dynamicdbcache (default: 4 times -dbcache, up to %d)"), nMaxDbCache));
+    strUsage += HelpMessageOpt("-dbcompression", strprintf(_("Compress the block index database with Snappy, if built with it; the database is then unreadable by builds without Snappy (default: %u)"), DEFAULT_DB_COMPRESSION));
+    strUsage += HelpMessageOpt("-dbmaxopenfiles=<n>", strprintf(_("Number of files each database keeps open (minimum %d, default: %d)"), MIN_LEVELDB_MAX_OPEN_FILES, DEFAULT_LEVELDB_MAX_OPEN_FILES));
+    strUsage += HelpMessageOpt("-dynamicdbcache", strprintf(_("Resize the in-memory UTXO set cache to the memory the system or container has left and shrink it under memory pressure (default: %u)"), DEFAULT_DYNAMIC_DB_CACHE));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-replayblocks=<dir>", strprintf(_("Benchmark: import the blk?????.dat files of <dir> on startup without connecting to peers, write a report to %s in the datadir and shut down. "
+                                                                  "Meant for an empty datadir; end it early with -stopatheight"), BLOCK_REPLAY_REPORT_FILE));
+    strUsage += HelpMessageOpt("-replaystartheight=<n>", _("Only measure the blocks replayed by -replayblocks from height <n> (default: 0)"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphantxsize=<n>", strprintf(_("Keep at most <n> kilobytes of unconnectable transactions in memory, a peer at most a %uth of them and of -maxorphantx (default: %u)"),
+        ORPHAN_TX_PEER_SHARE, DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
+    strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
+#ifndef WIN32
+    strUsage += HelpMessageOpt("-mmapblockfiles", strprintf(_("Read blocks and undo data of the block files no longer written to through memory mappings (default: %u)"), DEFAULT_MMAP_BLOCK_FILES));
+#endif
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads reading the inputs of a block from the coin database before it is connected (0 to %d, 0 = none, default: %d)"),
+        MAX_SCRIPTCHECK_THREADS, DEFAULT_PREFETCH_THREADS));
+    strUsage += HelpMessageOpt("-prevalidationthreads=<n>", strprintf(_("Set the number of threads doing the context-free checks (merkle root, Equihash solution, JoinSplit proofs) of blocks received from peers outside of the main lock (0 to %d, default: %d)"),
+        MAX_SCRIPTCHECK_THREADS, DEFAULT_PREVALIDATION_THREADS));
+    strUsage += HelpMessageOpt("-proverthreads=<n>", strprintf(_("Set the number of threads computing each PHGR13 JoinSplit proof (%d to %d, 0 = auto, <0 = leave that many cores free, default: 0)"),
+        -GetNumCores(), GetNumCores()));
+    strUsage += HelpMessageOpt("-parproofs", strprintf(_("Verify JoinSplit proofs of connected blocks in parallel on the -par threads (default: %u)"), DEFAULT_PARALLEL_PROOF_CHECK));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "zend.pid"));
 #endif
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
+    strUsage += HelpMessageOpt("-prunekeepblocks=<n>", strprintf(_("With -prune, keep the block files of the last <n> blocks, %u for getfinality to answer for all the blocks it applies to (minimum and default: %u)"),
+        MAX_BLOCK_AGE_FOR_FINALITY, MIN_BLOCKS_TO_KEEP));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
     strUsage += HelpMessageOpt("-reindexfast", _("Rebuild block chain index from current blk000??.dat files on startup, skipping expensive checks for blocks below checkpoints. It is incompatible with reindex"));
+    strUsage += HelpMessageOpt("-reindexthreads=<n>", strprintf(_("Set the number of threads reading and checking block files ahead of -reindex or -reindexfast (0 to %d, 0 = read them in turn, default: %d)"),
+        MAX_SCRIPTCHECK_THREADS, DEFAULT_REINDEX_THREADS));
     #if !defined(WIN32)
+    strUsage += HelpMessageOpt("-threadaffinity=<pool>:<cpus>", _("Run the threads of a pool (validation, http, rpc, scheduler or miner) only on the given CPUs, a list such as 0-7,16 or node<n> for those of NUMA node n. "
+        "With validation pinned, -par counts the CPUs of the pool instead of all cores (can be specified multiple times)"));
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-compacttxindex", strprintf(_("Keep the -txindex by truncated txid, block height and offset, several times smaller than the full positions; lookups read the transactions to tell apart txids that start alike (default: %u)"), DEFAULT_COMPACT_TXINDEX));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the outputs paid to and spent from each address, used by the getaddress* rpc calls (default: %u)"), DEFAULT_ADDRESSINDEX));
+    strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain an index of where each output was spent, used by the getspentinfo rpc call (default: %u)"), DEFAULT_SPENTINDEX));
+    strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain an index of blocks by timestamp, used by the getblockhashes rpc call (default: %u)"), DEFAULT_TIMESTAMPINDEX));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain a filter of the scriptPubKeys of each connected block, which lets wallet rescans skip the blocks that cannot concern them (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -380,8 +453,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 86400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s)"));
+    strUsage += HelpMessageOpt("-connectthreads=<n>", strprintf(_("Number of outbound connections, with their proxy and TLS handshakes, attempted at once (1 to %d, default: %d)"), MAX_CONNECT_THREADS, DEFAULT_CONNECT_THREADS));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
+    strUsage += HelpMessageOpt("-dnscachettl=<n>", strprintf(_("Seconds to reuse the addresses a name resolved to, 0 to not cache them (default: %u)"), DEFAULT_DNS_CACHE_TTL));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect)"));
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), 0));
@@ -389,7 +464,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
+    strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET) +
+        " " + _("Once it is nearly reached, historical blocks are no longer served to non-whitelisted peers, while new and fork tip blocks still are"));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads processing peer messages, each peer being served by one of them (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
@@ -397,11 +475,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), 1));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents", strprintf(_("Watch peer sockets with epoll or kqueue instead of select() where available, which also lifts the FD_SETSIZE limit on connections (default: %u)"), DEFAULT_SOCKET_EVENTS));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
     strUsage += HelpMessageOpt("-tlsfallbacknontls=<0 or 1>", _("If a TLS connection fails, the next connection attempt of the same peer (based on IP address) takes place without TLS (default: 1)"));
     strUsage += HelpMessageOpt("-tlsvalidate=<0 or 1>", _("Connect to peers only with valid certificates (default: 0)"));
+    strUsage += HelpMessageOpt("-tlsktls=<0 or 1>", _("Let the kernel encrypt and decrypt the TLS records of peer connections (kTLS), where OpenSSL and the kernel support it (default: 0)"));
     strUsage += HelpMessageOpt("-tlskeypath=<path>", _("Full path to a private key"));
     strUsage += HelpMessageOpt("-tlskeypwd=<password>", _("Password for a private key encryption (default: not set, i.e. private key will be stored unencrypted)"));
     strUsage += HelpMessageOpt("-tlscertpath=<path>", _("Full path to a certificate"));
@@ -420,7 +500,9 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifdef ENABLE_WALLET
     strUsage += HelpMessageGroup(_("Wallet options:"));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
-    strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), 100));
+    strUsage += HelpMessageOpt("-joinsplitproverthreads=<n>", strprintf(_("Set the number of JoinSplit proofs of a z_sendmany operation to generate in parallel, where they do not depend on each other (default: %d)"), DEFAULT_JOINSPLIT_PROVER_THREADS));
+    strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), DEFAULT_KEYPOOL_SIZE));
+    strUsage += HelpMessageOpt("-keypoolmin=<n>", strprintf(_("Refill the key pool in the background once it holds fewer than <n> keys, 0 to refill on demand (default: %u)"), DEFAULT_KEYPOOL_MIN));
     if (showDebug)
         strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)",
             CURRENCY_UNIT, FormatMoney(CWallet::minTxFee.GetFeePerK())));
@@ -434,7 +516,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxtxfee=<amt>", strprintf(_("Maximum total fees (in %s) to use in a single wallet transaction; setting this too low may abort large transactions (default: %s)"),
         CURRENCY_UNIT, FormatMoney(maxTxFee)));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format") + " " + _("on startup"));
-    strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat"));
+    strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat") + " " +
+        _("Can be specified multiple times to load several wallets, each with its own lock and database; RPC calls address one with the /wallet/<file> endpoint, and / is the first one"));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), true));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
@@ -447,6 +530,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubmempoolsequence=<address>", _("Enable publish mempool additions and removals with their sequence number in <address>"));
 #endif
 
 #if ENABLE_PROTON
@@ -455,12 +539,24 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-amqppubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-amqppubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-amqppubmempoolsequence=<address>", _("Enable publish mempool additions and removals with their sequence number in <address>"));
+#endif
+
+#if ENABLE_ZMQ || ENABLE_PROTON
+    strUsage += HelpMessageGroup(_("Notification options:"));
+    strUsage += HelpMessageOpt("-notificationqueue=<n>", strprintf(_("Queue at most <n> ZeroMQ and AMQP notifications for publishing; further ones are dropped while the publishers are behind (default: %u)"), DEFAULT_NOTIFICATION_QUEUE_SIZE));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", 1));
+        strUsage += HelpMessageOpt("-checkpointheaders", strprintf("Check the Equihash solution of only 1 in %u headers a checkpoint in the same headers message commits to during header sync, "
+            "the blocks are still checked in full (default: %u)", CHECKPOINT_HEADERS_SAMPLE, DEFAULT_CHECKPOINT_HEADERS));
+        strUsage += HelpMessageOpt("-checkblockindexsample=<n>", strprintf("With -checkblockindex, check the block index entries that changed and <n> percent of the others "
+            "instead of walking the whole block tree (0-100, default: %u)", DEFAULT_CHECK_BLOCK_INDEX_SAMPLE));
+        strUsage += HelpMessageOpt("-checkmempoolsample=<n>", strprintf("With -checkmempool, check the inputs of the mempool entries that changed and <n> percent of the others "
+            "instead of replaying the whole mempool (0-100, default: %u)", DEFAULT_CHECK_MEMPOOL_SAMPLE));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)", 100));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", 0));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", 0));
@@ -468,13 +564,19 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", 1));
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", 0));
+        strUsage += HelpMessageOpt("-stopatheight", strprintf("Stop running after reaching the given height in the main chain (default: %u)", DEFAULT_STOPATHEIGHT));
+    }
+    string debugCategories; // Don't translate these
+    for (const char* pszCategory : LOG_CATEGORIES) {
+        debugCategories += (debugCategories.empty() ? "" : ", ") + string(pszCategory);
+        if (string(pszCategory) == "zrpcunsafe")
+            debugCategories += " (implies zrpc)";
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, estimatefee, http, libevent, lock, mempool, net, partitioncheck, pow, proxy, prune, "
-                             "rand, reindex, rpc, selectcoins, tor, zmq, zrpc, zrpcunsafe (implies zrpc)"; // Don't translate these
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + debugCategories + ".");
     strUsage += HelpMessageOpt("-experimentalfeatures", _("Enable use of experimental features"));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
+    strUsage += HelpMessageOpt("-lockprofile=<n>", strprintf(_("Time one in <n> lock acquisitions of each thread for getlockstats, 0 to disable (default: %u)"), DEFAULT_LOCK_PROFILE_INTERVAL));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
     strUsage += HelpMessageOpt("-logtimemicros", strprintf(_("Meaningful if -logtimestamps=1. In debug output timestamp reports microseconds (default: %u)"), 0));
@@ -482,7 +584,8 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxproofcachesize=<n>", strprintf("Limit size of JoinSplit proof cache to <n> MiB (default: %u)", DEFAULT_MAX_PROOF_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
         CURRENCY_UNIT, FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -491,11 +594,13 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-printpriority", strprintf("Log transaction priority and fee per kB when mining blocks (default: %u)", 0));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", 1));
+        strUsage += HelpMessageOpt("-provermultiexp=<method>", "Multi-exponentiation algorithm of the PHGR13 JoinSplit prover, bdlo12 or boscoster (default: bdlo12)");
         strUsage += HelpMessageOpt("-regtest", "Enter regression test mode, which uses a special chain in which blocks can be solved instantly. "
             "This is intended for regression testing tools and app development.");
     }
     strUsage += HelpMessageOpt("-shrinkdebugfile", _("Shrink debug.log file on client startup (default: 1 when no -debug)"));
-    strUsage += HelpMessageOpt("-limitdebuglogsize", _("Limit the debug.log file size to 10Mb (default: 1 when no -debug)"));
+    strUsage += HelpMessageOpt("-limitdebuglogsize", _("Limit the debug.log file size to 10Mb, moving a full file to debug.log.1 (default: 1 when no -debug)"));
+    strUsage += HelpMessageOpt("-lograte=<n>", strprintf(_("Log at most <n> lines a second of each debug category, 0 for no limit (default: %u)"), DEFAULT_LOG_RATE_LIMIT));
     strUsage += HelpMessageOpt("-testnet", _("Use the test network"));
 
     strUsage += HelpMessageGroup(_("Node relay options:"));
@@ -533,7 +638,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("Mining options:"));
     strUsage += HelpMessageOpt("-gen", strprintf(_("Generate coins (default: %u)"), 0));
     strUsage += HelpMessageOpt("-genproclimit=<n>", strprintf(_("Set the number of threads for coin generation if enabled (-1 = all cores, default: %d)"), 1));
-    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used if enabled (default: \"default\")"));
+    strUsage += HelpMessageOpt("-equihashsolver=<name>", _("Specify the Equihash solver to be used by each mining thread, \"default\" or \"tromp\" (default: \"default\")"));
     strUsage += HelpMessageOpt("-mineraddress=<addr>", _("Send mined coins to a specific single address"));
     strUsage += HelpMessageOpt("-minetolocalwallet", strprintf(
             _("Require that mined blocks use a coinbase address in the local wallet (default: %u)"),
@@ -543,24 +648,38 @@ std::string HelpMessage(HelpMessageMode mode)
             0
  #endif
             ));
+    strUsage += HelpMessageOpt("-stratum", strprintf(_("Serve Equihash Stratum work paying to -mineraddress (default: %u)"), DEFAULT_STRATUM_ENABLE));
+    strUsage += HelpMessageOpt("-stratumallowip=<ip>", _("Allow Stratum connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>", _("Bind the Stratum server to given address. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces if -stratumallowip is set, localhost otherwise)"));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Share difficulty, as a divisor of the proof of work limit; shares are never harder than blocks (default: %d)"), DEFAULT_STRATUM_DIFFICULTY));
+    strUsage += HelpMessageOpt("-stratumport=<port>", strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT));
 #endif
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-metricsendpoint", strprintf(_("Serve node performance metrics for Prometheus at /metrics, without authentication (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-restthreads=<n>", strprintf(_("Set the number of threads to service REST requests (default: %d)"), DEFAULT_HTTP_REST_THREADS));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8232, 18232));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpckeepalive", strprintf(_("Keep RPC and REST connections open between requests (default: %u)"), DEFAULT_HTTP_KEEPALIVE));
+#if ENABLE_ZLIB
+    strUsage += HelpMessageOpt("-rpccompression", strprintf(_("Compress large RPC and REST replies for clients that accept gzip or deflate (default: %u)"), DEFAULT_HTTP_COMPRESSION));
+#endif
+    strUsage += HelpMessageOpt("-rpcparallelbatch", strprintf(_("Spread the read-only calls of a JSON-RPC batch over the RPC threads (default: %u)"), DEFAULT_HTTP_PARALLEL_BATCH));
+    strUsage += HelpMessageOpt("-rpcjsoncache=<n>", strprintf(_("Keep up to <n> megabytes of the JSON of blocks and transactions that RPC and REST rendered, 0 to disable (default: %u)"), DEFAULT_RPC_JSON_CACHE_SIZE));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
-        strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
+        strUsage += HelpMessageOpt("-restworkqueue=<n>", strprintf("Set the depth of the work queue to service REST requests (default: %d)", DEFAULT_HTTP_REST_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests and for idle keep-alive connections (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
-    // Disabled until we can lock notes and also tune performance of libsnark which by default uses multiple threads
-    //strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to service Async RPC calls (default: %d)"), 1));
+    strUsage += HelpMessageOpt("-rpcasyncthreads=<n>", strprintf(_("Set the number of threads to service Async RPC calls (default: %d)"), DEFAULT_RPC_ASYNC_THREADS));
+    strUsage += HelpMessageOpt("-rpcasynclowprioritythreads=<n>", strprintf(_("Set the maximum number of Async RPC threads running low priority operations such as z_shieldcoinbase, 0 for no limit (default: %d)"), DEFAULT_RPC_ASYNC_LOW_PRIORITY_THREADS));
 
     if (mode == HMM_BITCOIND) {
         strUsage += HelpMessageGroup(_("Metrics Options (only if -daemon and -printtoconsole are not set):"));
@@ -644,35 +763,15 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     if (fReindex || fReindexFast)
     {
         CImportingNow imp;
-        int nFile = 0;
-        if (fReindexFast) uiInterface.InitMessage(_("Reindexing block headers from files..."));
-        while (fReindexFast)
-        {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file) break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat, headers-only...\n", (unsigned int)nFile);
-            LoadBlocksFromExternalFile(file, &pos, /*loadHeadersOnly*/true);
-            nFile++;
-        }
-        if (fReindexFast)
+        int nThreads = std::max(0, std::min((int)GetArg("-reindexthreads", DEFAULT_REINDEX_THREADS), MAX_SCRIPTCHECK_THREADS));
+        if (fReindexFast) {
+            uiInterface.InitMessage(_("Reindexing block headers from files..."));
+            ReindexBlockFiles(/*loadHeadersOnly*/true, nThreads);
             LogPrintf("Headers-only reindexing finished. Going on with blocks\n");
+        }
 
-        nFile = 0;
         uiInterface.InitMessage(_("Reindexing block from files..."));
-        while (true)
-        {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file) break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadBlocksFromExternalFile(file, &pos, /*loadHeadersOnly*/false);
-            nFile++;
-        }
+        ReindexBlockFiles(/*loadHeadersOnly*/false, nThreads);
 
         pblocktree->WriteReindexing(false);
         fReindex = false;
@@ -685,6 +784,13 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         InitBlockIndex();
     }
 
+    // -replayblocks=
+    if (mapArgs.count("-replayblocks")) {
+        CImportingNow imp;
+        ReplayBlockFiles(GetArg("-replayblocks", ""), GetArg("-replaystartheight", 0));
+        return;
+    }
+
     // hardcoded $DATADIR/bootstrap.dat
     boost::filesystem::path pathBootstrap = GetDataDir() / "bootstrap.dat";
     if (boost::filesystem::exists(pathBootstrap)) {
@@ -715,7 +821,12 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     if (GetBoolArg("-stopafterblockimport", false)) {
         LogPrintf("Stopping after block import\n");
         StartShutdown();
+        return;
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL))
+        LoadMempool();
+    fDumpMempoolLater = !ShutdownRequested();
 }
 
 void ThreadNotifyRecentlyAdded()
@@ -734,6 +845,15 @@ void ThreadNotifyRecentlyAdded()
     }
 }
 
+static void ThreadScheduler(CScheduler* scheduler, bool fLongRunning)
+{
+    JoinThreadPool("scheduler");
+    if (fLongRunning)
+        scheduler->serviceLongRunning();
+    else
+        scheduler->serviceQueue();
+}
+
 /** Sanity checks
  *  Ensure that Bitcoin is running in a usable environment with all
  *  necessary library support.
@@ -811,6 +931,88 @@ static void ZC_LoadParams()
     LogPrintf("Loaded Sapling parameters in %fs seconds.\n", elapsed);
 }
 
+static boost::mutex csStartupStatus;
+//! The last InitMessage, and the startup tasks still running or not joined yet, by whether they are done
+static std::string strStartupMessage;
+static std::vector<std::pair<std::string, bool> > vStartupTasks;
+
+static void UpdateStartupStatus()
+{
+    std::string strTasks;
+    for (const std::pair<std::string, bool>& task : vStartupTasks)
+        strTasks += (strTasks.empty() ? "" : ", ") + task.first + (task.second ? _(": ready") : _(": loading"));
+    SetRPCWarmupStatus(strTasks.empty() ? strStartupMessage : strStartupMessage + " (" + strTasks + ")");
+}
+
+static void SetStartupMessage(const std::string& strMessage)
+{
+    boost::lock_guard<boost::mutex> lock(csStartupStatus);
+    strStartupMessage = strMessage;
+    UpdateStartupStatus();
+}
+
+/**
+ * A step of AppInit2 run on its own thread, next to the steps that do not
+ * depend on it, and joined where its result is first needed. Its state is
+ * shown in the RPC warmup status until then.
+ */
+class CStartupTask
+{
+public:
+    CStartupTask(const std::string& strNameIn, boost::function<void()> func) : strName(strNameIn)
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(csStartupStatus);
+            vStartupTasks.push_back(std::make_pair(strName, false));
+            UpdateStartupStatus();
+        }
+        thread = boost::thread(boost::bind(&CStartupTask::Run, this, func));
+    }
+
+    //! AppInit2 may bail out before joining
+    ~CStartupTask() { Join(); }
+
+    //! Wait for the step, false with the reason in strError if it threw
+    bool Join()
+    {
+        if (thread.joinable()) {
+            thread.join();
+            boost::lock_guard<boost::mutex> lock(csStartupStatus);
+            for (std::vector<std::pair<std::string, bool> >::iterator it = vStartupTasks.begin(); it != vStartupTasks.end(); ++it) {
+                if (it->first == strName) {
+                    vStartupTasks.erase(it);
+                    break;
+                }
+            }
+            UpdateStartupStatus();
+        }
+        return strError.empty();
+    }
+
+    std::string strError;
+
+private:
+    const std::string strName;
+    boost::thread thread;
+
+    void Run(boost::function<void()> func)
+    {
+        RenameThread("horizen-startup");
+        int64_t nStart = GetTimeMillis();
+        try {
+            func();
+        } catch (const std::exception& e) {
+            strError = strprintf(_("Error loading %s: %s"), strName, e.what());
+        }
+        LogPrintf(" %-11s %15dms (in parallel)\n", strName, GetTimeMillis() - nStart);
+        boost::lock_guard<boost::mutex> lock(csStartupStatus);
+        for (std::pair<std::string, bool>& task : vStartupTasks)
+            if (task.first == strName)
+                task.second = true;
+        UpdateStartupStatus();
+    }
+};
+
 bool AppInitServers(boost::thread_group& threadGroup)
 {
     RPCServer::OnStopped(&OnRPCStopped);
@@ -823,11 +1025,155 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", false) && !StartREST())
         return false;
+    if (GetBoolArg("-metricsendpoint", false) && !StartHTTPMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
 }
 
+#ifdef ENABLE_WALLET
+/**
+ * Load a wallet file verified in step 5, zap and rescan it as asked, and
+ * register it for the validation notifications. Problems that must stop the
+ * node are added to strErrors; returns NULL if it can't even go on loading.
+ */
+static CWallet* LoadWalletFile(const std::string& strWalletFile, std::ostringstream& strErrors)
+{
+    // needed to restore wallet transaction meta data after -zapwallettxes
+    std::vector<CWalletTx> vWtx;
+
+    if (GetBoolArg("-zapwallettxes", false)) {
+        uiInterface.InitMessage(_("Zapping all transactions from wallet..."));
+
+        CWallet* pwalletZap = new CWallet(strWalletFile);
+        DBErrors nZapWalletRet = pwalletZap->ZapWalletTx(vWtx);
+        delete pwalletZap;
+        if (nZapWalletRet != DB_LOAD_OK) {
+            uiInterface.InitMessage(strprintf(_("Error loading %s: Wallet corrupted"), strWalletFile));
+            return NULL;
+        }
+    }
+
+    uiInterface.InitMessage(_("Loading wallet..."));
+
+    int64_t nStart = GetTimeMillis();
+    bool fFirstRun = true;
+    CWallet* pwallet = new CWallet(strWalletFile);
+    DBErrors nLoadWalletRet = pwallet->LoadWallet(fFirstRun);
+    if (nLoadWalletRet != DB_LOAD_OK)
+    {
+        if (nLoadWalletRet == DB_CORRUPT)
+            strErrors << strprintf(_("Error loading %s: Wallet corrupted"), strWalletFile) << "\n";
+        else if (nLoadWalletRet == DB_NONCRITICAL_ERROR)
+        {
+            string msg(strprintf(_("Warning: error reading %s! All keys read correctly, but transaction data"
+                                   " or address book entries might be missing or incorrect."), strWalletFile));
+            InitWarning(msg);
+        }
+        else if (nLoadWalletRet == DB_TOO_NEW)
+            strErrors << strprintf(_("Error loading %s: Wallet requires newer version of Horizen"), strWalletFile) << "\n";
+        else if (nLoadWalletRet == DB_NEED_REWRITE)
+        {
+            strErrors << _("Wallet needed to be rewritten: restart Horizen to complete") << "\n";
+            LogPrintf("%s", strErrors.str());
+            InitError(strErrors.str());
+            delete pwallet;
+            return NULL;
+        }
+        else
+            strErrors << strprintf(_("Error loading %s"), strWalletFile) << "\n";
+    }
+
+    if (GetBoolArg("-upgradewallet", fFirstRun))
+    {
+        int nMaxVersion = GetArg("-upgradewallet", 0);
+        if (nMaxVersion == 0) // the -upgradewallet without argument case
+        {
+            LogPrintf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
+            nMaxVersion = CLIENT_VERSION;
+            pwallet->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
+        }
+        else
+            LogPrintf("Allowing wallet upgrade up to %i\n", nMaxVersion);
+        if (nMaxVersion < pwallet->GetVersion())
+            strErrors << _("Cannot downgrade wallet") << "\n";
+        pwallet->SetMaxVersion(nMaxVersion);
+    }
+
+    if (fFirstRun)
+    {
+        // Create new keyUser and set as default key
+        CPubKey newDefaultKey;
+        if (pwallet->GetKeyFromPool(newDefaultKey)) {
+            pwallet->SetDefaultKey(newDefaultKey);
+            if (!pwallet->SetAddressBook(pwallet->vchDefaultKey.GetID(), "", "receive"))
+                strErrors << _("Cannot write default address") << "\n";
+        }
+
+        pwallet->SetBestChain(chainActive.GetLocator());
+    }
+
+    LogPrintf("%s", strErrors.str());
+    LogPrintf(" wallet %s %15dms\n", strWalletFile, GetTimeMillis() - nStart);
+
+    RegisterValidationInterface(pwallet);
+
+    CBlockIndex *pindexRescan = chainActive.Tip();
+    if (GetBoolArg("-rescan", false))
+    {
+        pwallet->ClearNoteWitnessCache();
+        pindexRescan = chainActive.Genesis();
+    }
+    else
+    {
+        CWalletDB walletdb(strWalletFile);
+        CBlockLocator locator;
+        if (walletdb.ReadBestBlock(locator))
+            pindexRescan = FindForkInGlobalIndex(chainActive, locator);
+        else
+            pindexRescan = chainActive.Genesis();
+    }
+    if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
+    {
+        uiInterface.InitMessage(_("Rescanning..."));
+        LogPrintf("Rescanning %s, last %i blocks (from block %i)...\n", strWalletFile, chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
+        nStart = GetTimeMillis();
+        pwallet->ScanForWalletTransactions(pindexRescan, true);
+        LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
+        pwallet->SetBestChain(chainActive.GetLocator());
+        nWalletDBUpdated++;
+
+        // Restore wallet transaction metadata after -zapwallettxes=1
+        if (GetBoolArg("-zapwallettxes", false) && GetArg("-zapwallettxes", "1") != "2")
+        {
+            CWalletDB walletdb(strWalletFile);
+
+            BOOST_FOREACH(const CWalletTx& wtxOld, vWtx)
+            {
+                uint256 hash = wtxOld.GetHash();
+                std::map<uint256, CWalletTx>::iterator mi = pwallet->mapWallet.find(hash);
+                if (mi != pwallet->mapWallet.end())
+                {
+                    const CWalletTx* copyFrom = &wtxOld;
+                    CWalletTx* copyTo = &mi->second;
+                    copyTo->mapValue = copyFrom->mapValue;
+                    copyTo->vOrderForm = copyFrom->vOrderForm;
+                    copyTo->nTimeReceived = copyFrom->nTimeReceived;
+                    copyTo->nTimeSmart = copyFrom->nTimeSmart;
+                    copyTo->fFromMe = copyFrom->fFromMe;
+                    copyTo->strFromAccount = copyFrom->strFromAccount;
+                    copyTo->nOrderPos = copyFrom->nOrderPos;
+                    copyTo->WriteToDisk(&walletdb);
+                }
+            }
+        }
+    }
+    pwallet->SetBroadcastTransactions(GetBoolArg("-walletbroadcast", true));
+    return pwallet;
+}
+#endif // ENABLE_WALLET
+
 /** Initialize bitcoin.
  *  @pre Parameters should be parsed and config file should be read.
  */
@@ -910,6 +1256,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fLogTimestamps = GetBoolArg("-logtimestamps", true);
     fLogTimeMicros = GetBoolArg("-logtimemicros", false);
     fLogIPs = GetBoolArg("-logips", false);
+    nLogRateLimit = GetArg("-lograte", DEFAULT_LOG_RATE_LIMIT);
+    nLockProfileInterval = std::max(GetArg("-lockprofile", DEFAULT_LOCK_PROFILE_INTERVAL), (int64_t)0);
 
     LogPrintf("Horizen version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
 
@@ -932,6 +1280,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             LogPrintf("%s: parameter interaction: -connect set -> setting -listen=0\n", __func__);
     }
 
+    if (mapArgs.count("-replayblocks")) {
+        // a replay only measures the blocks of the files, no peer may bring others
+        if (SoftSetBoolArg("-listen", false))
+            LogPrintf("%s: parameter interaction: -replayblocks set -> setting -listen=0\n", __func__);
+        if (SoftSetBoolArg("-dnsseed", false))
+            LogPrintf("%s: parameter interaction: -replayblocks set -> setting -dnsseed=0\n", __func__);
+        if (SoftSetArg("-maxconnections", "0"))
+            LogPrintf("%s: parameter interaction: -replayblocks set -> setting -maxconnections=0\n", __func__);
+    }
+
     if (mapArgs.count("-proxy")) {
         // to protect privacy, do not listen by default if a default proxy server is specified
         if (SoftSetBoolArg("-listen", false))
@@ -970,18 +1328,27 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    // MIN_CORE_FILEDESCRIPTORS covers the default -dbmaxopenfiles of both databases
+    int nCoreFD = MIN_CORE_FILEDESCRIPTORS;
+    if (MIN_CORE_FILEDESCRIPTORS > 0)
+        nCoreFD += 2 * std::max(0, (int)GetArg("-dbmaxopenfiles", DEFAULT_LEVELDB_MAX_OPEN_FILES) - DEFAULT_LEVELDB_MAX_OPEN_FILES);
+    // select() cannot watch descriptors at or above FD_SETSIZE
+    if (!GetBoolArg("-socketevents", DEFAULT_SOCKET_EVENTS) || !CSocketEvents::IsSupported())
+        nMaxConnections = std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nCoreFD));
+    nMaxConnections = std::max(nMaxConnections, 0);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFD);
+    if (nFD < nCoreFD)
         return InitError(_("Not enough file descriptors available."));
-    if (nFD - MIN_CORE_FILEDESCRIPTORS < nMaxConnections)
-        nMaxConnections = nFD - MIN_CORE_FILEDESCRIPTORS;
+    if (nFD - nCoreFD < nMaxConnections)
+        nMaxConnections = nFD - nCoreFD;
 
     // if using block pruning, then disable txindex
     // also disable the wallet (for now, until SPV support is implemented in wallet)
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", false))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) || GetBoolArg("-spentindex", DEFAULT_SPENTINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex and -spentindex."));
 #ifdef ENABLE_WALLET
         if (!GetBoolArg("-disablewallet", false)) {
             if (SoftSetBoolArg("-disablewallet", true))
@@ -1034,6 +1401,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    for (const std::string& strCategory : categories)
+        if (strCategory != "" && strCategory != "0" && strCategory != "1" && GetLogCategory(strCategory) == 0)
+            InitWarning(strprintf(_("Unsupported logging category %s=%s."), "-debug", strCategory));
+
     // Check for -debugnet
     if (GetBoolArg("-debugnet", false))
         InitWarning(_("Warning: Unsupported argument -debugnet ignored, use -debug=net."));
@@ -1048,18 +1419,53 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         InitWarning(_("Warning: Unsupported argument -benchmark ignored, use -debug=bench."));
 
     // Checkmempool and checkblockindex default to true in regtest mode
-    mempool.setSanityCheck(GetBoolArg("-checkmempool", chainparams.DefaultConsistencyChecks()));
+    mempool.setSanityCheck(GetBoolArg("-checkmempool", chainparams.DefaultConsistencyChecks()),
+                           std::max(0, std::min(100, (int)GetArg("-checkmempoolsample", DEFAULT_CHECK_MEMPOOL_SAMPLE))));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    nCheckBlockIndexSample = std::max(0, std::min(100, (int)GetArg("-checkblockindexsample", DEFAULT_CHECK_BLOCK_INDEX_SAMPLE)));
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
+    fCheckpointHeaders = GetBoolArg("-checkpointheaders", DEFAULT_CHECKPOINT_HEADERS);
+    fMmapBlockFiles = GetBoolArg("-mmapblockfiles", DEFAULT_MMAP_BLOCK_FILES);
+    fCompressBlocks = GetBoolArg("-compressblocks", DEFAULT_COMPRESS_BLOCKS);
+    if (fCompressBlocks && !CanCompressBlocks()) {
+        InitWarning(_("Warning: -compressblocks ignored, this build has no zlib support."));
+        fCompressBlocks = false;
+    }
+
+    hashAssumeValid = uint256S(GetArg("-assumevalid", "0"));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid scripts and proofs.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating scripts and proofs of all blocks.\n");
+
+    BOOST_FOREACH(const std::string& strSpec, mapMultiArgs["-threadaffinity"]) {
+        std::string strError;
+        if (!SetThreadPoolAffinity(strSpec, strError))
+            return InitError(strError);
+    }
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
-    if (nScriptCheckThreads <= 0)
-        nScriptCheckThreads += GetNumCores();
+    if (nScriptCheckThreads <= 0) {
+        // Validation threads pinned to some CPUs would only contend with each other beyond them
+        int nValidationCPUs = GetThreadPoolCPUCount("validation");
+        nScriptCheckThreads += nValidationCPUs ? nValidationCPUs : GetNumCores();
+    }
     if (nScriptCheckThreads <= 1)
         nScriptCheckThreads = 0;
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    fParallelProofCheck = GetBoolArg("-parproofs", DEFAULT_PARALLEL_PROOF_CHECK);
+    nPrevalidationThreads = std::max(0, std::min((int)GetArg("-prevalidationthreads", DEFAULT_PREVALIDATION_THREADS), MAX_SCRIPTCHECK_THREADS));
+    nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_SCRIPTCHECK_THREADS));
+
+    // -proverthreads=0 leaves the count to OpenMP, one thread per core
+    int nProverThreads = GetArg("-proverthreads", 0);
+    if (nProverThreads < 0)
+        nProverThreads = std::max(nProverThreads + GetNumCores(), 1);
+    libzcash::SetProverThreads(nProverThreads);
+    if (!libzcash::SetProverMultiExp(GetArg("-provermultiexp", "bdlo12")))
+        return InitError(strprintf(_("Unknown -provermultiexp method: '%s'"), GetArg("-provermultiexp", "")));
 
     fServer = GetBoolArg("-server", false);
 
@@ -1073,7 +1479,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         if (nPruneTarget < MIN_DISK_SPACE_FOR_BLOCK_FILES) {
             return InitError(strprintf(_("Prune configured below the minimum of %d MB.  Please use a higher number."), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
         }
-        LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
+        int64_t nKeepBlocks = GetArg("-prunekeepblocks", MIN_BLOCKS_TO_KEEP);
+        if (nKeepBlocks < MIN_BLOCKS_TO_KEEP) {
+            return InitError(strprintf(_("-prunekeepblocks must be at least %u."), MIN_BLOCKS_TO_KEEP));
+        }
+        nPruneKeepBlocks = nKeepBlocks;
+        LogPrintf("Prune configured to target %uMiB on disk for block and undo files, keeping the last %u blocks.\n", nPruneTarget / 1024 / 1024, nPruneKeepBlocks);
         fPruneMode = true;
     }
 
@@ -1142,10 +1553,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", true);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", false);
 
-    std::string strWalletFile = GetArg("-wallet", "wallet.dat");
+    std::vector<std::string> vWalletFiles;
+    if (mapMultiArgs.count("-wallet"))
+        vWalletFiles = mapMultiArgs["-wallet"];
+    else
+        vWalletFiles.push_back("wallet.dat");
 #endif // ENABLE_WALLET
 
     fIsBareMultisigStd = GetBoolArg("-permitbaremultisig", true);
+    fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
     nMaxDatacarrierBytes = GetArg("-datacarriersize", nMaxDatacarrierBytes);
 
     fAlerts = GetBoolArg("-alerts", DEFAULT_ALERTS);
@@ -1192,9 +1608,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     std::string strDataDir = GetDataDir().string();
 #ifdef ENABLE_WALLET
-    // Wallet file must be a plain filename without a directory
-    if (strWalletFile != boost::filesystem::basename(strWalletFile) + boost::filesystem::extension(strWalletFile))
-        return InitError(strprintf(_("Wallet %s resides outside data directory %s"), strWalletFile, strDataDir));
+    // Wallet files must be plain filenames without a directory
+    std::set<std::string> setWalletFiles;
+    for (const std::string& strWalletFile : vWalletFiles) {
+        if (strWalletFile != boost::filesystem::basename(strWalletFile) + boost::filesystem::extension(strWalletFile))
+            return InitError(strprintf(_("Wallet %s resides outside data directory %s"), strWalletFile, strDataDir));
+        if (!setWalletFiles.insert(strWalletFile).second)
+            return InitError(strprintf(_("Wallet %s is specified more than once"), strWalletFile));
+    }
 #endif
     // Make sure only a single Bitcoin process is using the data directory.
     boost::filesystem::path pathLockFile = GetDataDir() / ".lock";
@@ -1223,6 +1644,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (fPrintToDebugLog)
         OpenDebugLog();
 
+    LogPrintf("Using SHA256 implementation %s\n", SHA256Implementation());
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
@@ -1235,15 +1657,41 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
+    jsonCache.SetMaxUsage(std::max((int64_t)0, GetArg("-rpcjsoncache", DEFAULT_RPC_JSON_CACHE_SIZE)) * 1000000);
+    InitProofCache();
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadEquihashCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTxCheck);
+        if (fParallelProofCheck) {
+            LogPrintf("Using %u threads for JoinSplit proof verification\n", nScriptCheckThreads);
+            for (int i=0; i<nScriptCheckThreads-1; i++)
+                threadGroup.create_thread(&ThreadProofCheck);
+        }
+    }
+
+    // Block and undo records are written off the validation path from here on
+    threadGroup.create_thread(&ThreadBlockFileWriter);
+
+    if (nPrevalidationThreads) {
+        LogPrintf("Using %u threads for block pre-validation\n", nPrevalidationThreads);
+        for (int i=0; i<nPrevalidationThreads; i++)
+            threadGroup.create_thread(&ThreadBlockPrevalidation);
     }
 
     // Start the lightweight task scheduler thread
-    CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
+    CScheduler::Function serviceLoop = boost::bind(&ThreadScheduler, &scheduler, false);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    // Tasks that write files and the like run apart, so that the timers are kept
+    CScheduler::Function longRunningLoop = boost::bind(&ThreadScheduler, &scheduler, true);
+    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "schedlong", longRunningLoop));
+    pschedulerMain = &scheduler;
 
     // Count uptime
     MarkStartTime();
@@ -1261,8 +1709,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     libsnark::inhibit_profiling_info = true;
     libsnark::inhibit_profiling_counters = true;
 
-    // Initialize Zcash circuit parameters
-    ZC_LoadParams();
+    // Initialize Zcash circuit parameters. Nothing needs them before the
+    // blocks are verified in step 7, so they load next to steps 5 to 7.
+    CStartupTask paramsTask(_("zk-SNARK parameters"), &ZC_LoadParams);
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1271,7 +1720,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
      */
     if (fServer)
     {
-        uiInterface.InitMessage.connect(SetRPCWarmupStatus);
+        uiInterface.InitMessage.connect(SetStartupMessage);
         if (!AppInitServers(threadGroup))
             return InitError(_("Unable to start HTTP server. See debug log for details."));
     }
@@ -1280,21 +1729,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
+    // Opening and verifying the wallet database is independent of the block
+    // database, the wallet is only loaded from it in step 8.
+    std::string strWalletWarning;
+    std::string strWalletError;
+    bool fWalletVerified = true;
+    boost::scoped_ptr<CStartupTask> walletTask;
     if (!fDisableWallet) {
-        LogPrintf("Using wallet %s\n", strWalletFile);
-        uiInterface.InitMessage(_("Verifying wallet..."));
-
-        std::string warningString;
-        std::string errorString;
-
-        if (!CWallet::Verify(strWalletFile, warningString, errorString))
-            return false;
-
-        if (!warningString.empty())
-            InitWarning(warningString);
-        if (!errorString.empty())
-            return InitError(warningString);
-
+        for (const std::string& strWalletFile : vWalletFiles)
+            LogPrintf("Using wallet %s\n", strWalletFile);
+        walletTask.reset(new CStartupTask(_("wallet database"), [&]() {
+            for (const std::string& strWalletFile : vWalletFiles) {
+                fWalletVerified = CWallet::Verify(strWalletFile, strWalletWarning, strWalletError);
+                if (!fWalletVerified || !strWalletError.empty())
+                    break;
+            }
+        }));
     } // (!fDisableWallet)
 #endif // ENABLE_WALLET
     // ********************************************************* Step 6: network initialization
@@ -1325,6 +1775,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    if (mapArgs.count("-maxuploadtarget"))
+        CNode::SetMaxOutboundTarget(GetArg("-maxuploadtarget", DEFAULT_MAX_UPLOAD_TARGET) * 1024 * 1024);
+
     bool proxyRandomize = GetBoolArg("-proxyrandomize", true);
     // -proxy sets a proxy for all outgoing network traffic
     // -noproxy (or -proxy=0) as well as the empty string can be used to not set a proxy, this is the default
@@ -1362,6 +1815,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fListen = GetBoolArg("-listen", DEFAULT_LISTEN);
     fDiscover = GetBoolArg("-discover", true);
     fNameLookup = GetBoolArg("-dns", true);
+    nDNSCacheTTL = std::max(GetArg("-dnscachettl", DEFAULT_DNS_CACHE_TTL), (int64_t)0);
 
     bool fBound = false;
     if (fListen) {
@@ -1421,11 +1875,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(strprintf(_("Cannot find trusted certificates directory: '%s'"), pathTLSTrustredDir.string()));
     }
 
+    // The notification interfaces publish from the thread of the notification dispatcher
+    std::vector<CNotificationPublisher*> vPublishers;
+
 #if ENABLE_ZMQ
     pzmqNotificationInterface = CZMQNotificationInterface::CreateWithArguments(mapArgs);
 
     if (pzmqNotificationInterface) {
-        RegisterValidationInterface(pzmqNotificationInterface);
+        vPublishers.push_back(pzmqNotificationInterface);
     }
 #endif
 
@@ -1440,10 +1897,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("AMQP support requires -experimentalfeatures."));
         }
 
-        RegisterValidationInterface(pAMQPNotificationInterface);
+        vPublishers.push_back(pAMQPNotificationInterface);
     }
 #endif
 
+    if (!vPublishers.empty()) {
+        pNotificationDispatcher = new CNotificationDispatcher(vPublishers, GetArg("-notificationqueue", DEFAULT_NOTIFICATION_QUEUE_SIZE));
+        RegisterValidationInterface(pNotificationDispatcher);
+    }
+
     // ********************************************************* Step 7: load block chain
 
     fReindex = GetBoolArg("-reindex", false);
@@ -1476,21 +1938,35 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    // Blocks can only be read in the background as long as none are pruned
+    const bool fCheckBlocksBackground = GetBoolArg("-checkblocksbackground", DEFAULT_CHECKBLOCKS_BACKGROUND) && !fPruneMode;
+
     // cache size calculations
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
+    bool fLargeBlockTree = GetBoolArg("-txindex", false) || GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ||
+                           GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    if (nBlockTreeDBCache > (1 << 21) && !fLargeBlockTree)
         nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
     nTotalCache -= nBlockTreeDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    nCoinCacheUsageSynced = nCoinCacheUsage;
+    // During initial block download only the in-memory cache grows, the database caches are set when they are opened
+    fDynamicCoinCache = GetBoolArg("-dynamicdbcache", DEFAULT_DYNAMIC_DB_CACHE);
+    nCoinsWriteInterval = std::max(GetArg("-coinswriteinterval", DEFAULT_COINS_WRITE_INTERVAL), (int64_t)0);
+    int64_t nIBDCache = GetArg("-dbcacheibd", std::min(4 * GetArg("-dbcache", nDefaultDbCache), nMaxDbCache)) << 20;
+    nIBDCache = std::min(nIBDCache, nMaxDbCache << 20);
+    nCoinCacheUsageIBD = fDynamicCoinCache ? nCoinCacheUsage + std::max(nIBDCache - (nTotalCache + nCoinDBCache + nBlockTreeDBCache), (int64_t)0) : nCoinCacheUsage;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    if (fDynamicCoinCache)
+        LogPrintf("* Using up to %.1fMiB for in-memory UTXO set during initial block download, as memory allows\n", nCoinCacheUsageIBD * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1504,13 +1980,28 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsflush;
+                pcoinsflush = NULL;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex || fReindexFast);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexFast);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+                if (!pcoinsdbview->InitTxOutSetStats()) {
+                    strLoadError = _("Error computing the UTXO set statistics");
+                    break;
+                }
+                if (GetBoolArg("-asyncflush", DEFAULT_ASYNC_FLUSH)) {
+                    pcoinsflush = new CCoinsViewBackgroundFlush(pcoinsdbview);
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsflush);
+                } else {
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                }
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
                 if (fReindex || fReindexFast) {
@@ -1542,6 +2033,24 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
                     break;
                 }
+                if (fTxIndex && fCompactTxIndex != GetBoolArg("-compacttxindex", DEFAULT_COMPACT_TXINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -compacttxindex");
+                    break;
+                }
+
+                // Same for the explorer indexes
+                if (fAddressIndex != GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -addressindex");
+                    break;
+                }
+                if (fSpentIndex != GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -spentindex");
+                    break;
+                }
+                if (fTimestampIndex != GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex to change -timestampindex");
+                    break;
+                }
 
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
@@ -1550,13 +2059,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Verifying the blocks checks their JoinSplit proofs
+                if (!paramsTask.Join())
+                    return InitError(paramsTask.strError);
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
-                if (fHavePruned && GetArg("-checkblocks", 288) > MIN_BLOCKS_TO_KEEP) {
+                if (fHavePruned && GetArg("-checkblocks", 288) > nPruneKeepBlocks) {
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; -checkblocks=%d may fail\n",
-                        MIN_BLOCKS_TO_KEEP, GetArg("-checkblocks", 288));
+                        nPruneKeepBlocks, GetArg("-checkblocks", 288));
                 }
                 if (!CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", 3),
-                              GetArg("-checkblocks", 288))) {
+                              GetArg("-checkblocks", 288), !fCheckBlocksBackground)) {
                     strLoadError = _("Corrupted block database detected");
                     break;
                 }
@@ -1609,141 +2122,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
+    if (walletTask) {
+        uiInterface.InitMessage(_("Verifying wallet..."));
+        if (!walletTask->Join())
+            return InitError(walletTask->strError);
+        if (!fWalletVerified)
+            return false;
+        if (!strWalletWarning.empty())
+            InitWarning(strWalletWarning);
+        if (!strWalletError.empty())
+            return InitError(strWalletError);
+    }
+
     if (fDisableWallet) {
         pwalletMain = NULL;
         LogPrintf("Wallet disabled!\n");
     } else {
 
-        // needed to restore wallet transaction meta data after -zapwallettxes
-        std::vector<CWalletTx> vWtx;
-
-        if (GetBoolArg("-zapwallettxes", false)) {
-            uiInterface.InitMessage(_("Zapping all transactions from wallet..."));
-
-            pwalletMain = new CWallet(strWalletFile);
-            DBErrors nZapWalletRet = pwalletMain->ZapWalletTx(vWtx);
-            if (nZapWalletRet != DB_LOAD_OK) {
-                uiInterface.InitMessage(_("Error loading wallet.dat: Wallet corrupted"));
+        for (const std::string& strWalletFile : vWalletFiles) {
+            CWallet* pwallet = LoadWalletFile(strWalletFile, strErrors);
+            if (!pwallet)
                 return false;
-            }
-
-            delete pwalletMain;
-            pwalletMain = NULL;
-        }
-
-        uiInterface.InitMessage(_("Loading wallet..."));
-
-        nStart = GetTimeMillis();
-        bool fFirstRun = true;
-        pwalletMain = new CWallet(strWalletFile);
-        DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRun);
-        if (nLoadWalletRet != DB_LOAD_OK)
-        {
-            if (nLoadWalletRet == DB_CORRUPT)
-                strErrors << _("Error loading wallet.dat: Wallet corrupted") << "\n";
-            else if (nLoadWalletRet == DB_NONCRITICAL_ERROR)
-            {
-                string msg(_("Warning: error reading wallet.dat! All keys read correctly, but transaction data"
-                             " or address book entries might be missing or incorrect."));
-                InitWarning(msg);
-            }
-            else if (nLoadWalletRet == DB_TOO_NEW)
-                strErrors << _("Error loading wallet.dat: Wallet requires newer version of Horizen") << "\n";
-            else if (nLoadWalletRet == DB_NEED_REWRITE)
-            {
-                strErrors << _("Wallet needed to be rewritten: restart Horizen to complete") << "\n";
-                LogPrintf("%s", strErrors.str());
-                return InitError(strErrors.str());
-            }
-            else
-                strErrors << _("Error loading wallet.dat") << "\n";
-        }
-
-        if (GetBoolArg("-upgradewallet", fFirstRun))
-        {
-            int nMaxVersion = GetArg("-upgradewallet", 0);
-            if (nMaxVersion == 0) // the -upgradewallet without argument case
-            {
-                LogPrintf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
-                nMaxVersion = CLIENT_VERSION;
-                pwalletMain->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
-            }
-            else
-                LogPrintf("Allowing wallet upgrade up to %i\n", nMaxVersion);
-            if (nMaxVersion < pwalletMain->GetVersion())
-                strErrors << _("Cannot downgrade wallet") << "\n";
-            pwalletMain->SetMaxVersion(nMaxVersion);
+            vpwallets.push_back(pwallet);
         }
-
-        if (fFirstRun)
-        {
-            // Create new keyUser and set as default key
-            CPubKey newDefaultKey;
-            if (pwalletMain->GetKeyFromPool(newDefaultKey)) {
-                pwalletMain->SetDefaultKey(newDefaultKey);
-                if (!pwalletMain->SetAddressBook(pwalletMain->vchDefaultKey.GetID(), "", "receive"))
-                    strErrors << _("Cannot write default address") << "\n";
-            }
-
-            pwalletMain->SetBestChain(chainActive.GetLocator());
-        }
-
-        LogPrintf("%s", strErrors.str());
-        LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
-
-        RegisterValidationInterface(pwalletMain);
-
-        CBlockIndex *pindexRescan = chainActive.Tip();
-        if (GetBoolArg("-rescan", false))
-        {
-            pwalletMain->ClearNoteWitnessCache();
-            pindexRescan = chainActive.Genesis();
-        }
-        else
-        {
-            CWalletDB walletdb(strWalletFile);
-            CBlockLocator locator;
-            if (walletdb.ReadBestBlock(locator))
-                pindexRescan = FindForkInGlobalIndex(chainActive, locator);
-            else
-                pindexRescan = chainActive.Genesis();
-        }
-        if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
-        {
-            uiInterface.InitMessage(_("Rescanning..."));
-            LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
-            nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true);
-            LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
-            pwalletMain->SetBestChain(chainActive.GetLocator());
-            nWalletDBUpdated++;
-
-            // Restore wallet transaction metadata after -zapwallettxes=1
-            if (GetBoolArg("-zapwallettxes", false) && GetArg("-zapwallettxes", "1") != "2")
-            {
-                CWalletDB walletdb(strWalletFile);
-
-                BOOST_FOREACH(const CWalletTx& wtxOld, vWtx)
-                {
-                    uint256 hash = wtxOld.GetHash();
-                    std::map<uint256, CWalletTx>::iterator mi = pwalletMain->mapWallet.find(hash);
-                    if (mi != pwalletMain->mapWallet.end())
-                    {
-                        const CWalletTx* copyFrom = &wtxOld;
-                        CWalletTx* copyTo = &mi->second;
-                        copyTo->mapValue = copyFrom->mapValue;
-                        copyTo->vOrderForm = copyFrom->vOrderForm;
-                        copyTo->nTimeReceived = copyFrom->nTimeReceived;
-                        copyTo->nTimeSmart = copyFrom->nTimeSmart;
-                        copyTo->fFromMe = copyFrom->fFromMe;
-                        copyTo->strFromAccount = copyFrom->strFromAccount;
-                        copyTo->nOrderPos = copyFrom->nOrderPos;
-                        copyTo->WriteToDisk(&walletdb);
-                    }
-                }
-            }
-        }
-        pwalletMain->SetBroadcastTransactions(GetBoolArg("-walletbroadcast", true));
+        pwalletMain = vpwallets[0];
     } // (!fDisableWallet)
 #else // ENABLE_WALLET
     LogPrintf("No wallet support compiled in!\n");
@@ -1807,6 +2209,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (fCheckBlocksBackground)
+        threadGroup.create_thread(boost::bind(&ThreadVerifyBlocks, GetArg("-checklevel", 3), GetArg("-checkblocks", 288)));
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
         while (!fRequestShutdown && chainActive.Tip() == NULL)
@@ -1843,7 +2247,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nPowTargetSpacing = Params().GetConsensus().nPowTargetSpacing;
     CScheduler::Function f = boost::bind(&PartitionCheck, &IsInitialBlockDownload,
                                          boost::ref(cs_main), boost::cref(pindexBestHeader), nPowTargetSpacing);
-    scheduler.scheduleEvery(f, nPowTargetSpacing);
+    scheduler.scheduleEvery(f, nPowTargetSpacing, "partitioncheck");
 
 #ifdef ENABLE_MINING
     // Generate coins in the background
@@ -1853,6 +2257,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
  #else
     GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1));
  #endif
+
+    // Serve work to external miners, with a new job at every new tip
+    if (!StartStratumServer())
+        return InitError(_("Unable to start Stratum server. See debug log for details."));
 #endif
 
     // ********************************************************* Step 11: finished
@@ -1861,12 +2269,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     uiInterface.InitMessage(_("Done loading"));
 
 #ifdef ENABLE_WALLET
-    if (pwalletMain) {
-        // Add wallet transactions that aren't already in a block to mapTransactions
-        pwalletMain->ReacceptWalletTransactions();
+    if (!vpwallets.empty()) {
+        std::vector<std::string> vWalletFilesLoaded;
+        for (CWallet* pwallet : vpwallets) {
+            // Add wallet transactions that aren't already in a block to mapTransactions
+            pwallet->ReacceptWalletTransactions();
+
+            // Run a thread to keep the key pool topped up
+            threadGroup.create_thread(boost::bind(&ThreadRefillKeyPool, pwallet));
+            vWalletFilesLoaded.push_back(pwallet->strWalletFile);
+        }
 
-        // Run a thread to flush wallet periodically
-        threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+        // Run a thread to flush the wallets periodically
+        threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, vWalletFilesLoaded));
     }
 #endif
 
@@ -7,6 +7,7 @@
 #define BITCOIN_INIT_H
 
 #include <string>
+#include <vector>
 
 #include "zcash/JoinSplit.hpp"
 
@@ -19,7 +20,11 @@ class thread_group;
 } // namespace boost
 
 extern CWallet* pwalletMain;
+//! All the loaded wallets, one per -wallet file; pwalletMain is the first
+extern std::vector<CWallet*> vpwallets;
 extern ZCJoinSplit* pzcashParams;
+//! The scheduler of the node once started, for getschedulerinfo
+extern CScheduler* pschedulerMain;
 
 void StartShutdown();
 bool ShutdownRequested();
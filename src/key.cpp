@@ -10,6 +10,7 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 #include "random.h"
+#include "support/pagelocker.h"
 
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
@@ -161,8 +162,8 @@ bool CKey::Check(const unsigned char *vch) {
 
 void CKey::MakeNewKey(bool fCompressedIn) {
     do {
-        GetRandBytes(vch, sizeof(vch));
-    } while (!Check(vch));
+        GetRandBytes(keydata.data(), keydata.size());
+    } while (!Check(keydata.data()));
     fValid = true;
     fCompressed = fCompressedIn;
 }
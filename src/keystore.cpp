@@ -6,6 +6,7 @@
 #include "keystore.h"
 
 #include "key.h"
+#include "memusage.h"
 #include "util.h"
 
 #include <boost/foreach.hpp>
@@ -61,14 +62,16 @@ bool CBasicKeyStore::GetCScript(const CScriptID &hash, CScript& redeemScriptOut)
 bool CBasicKeyStore::AddWatchOnly(const CScript &dest)
 {
     LOCK(cs_KeyStore);
-    setWatchOnly.insert(dest);
+    if (setWatchOnly.insert(dest).second)
+        mapWatchOnlySizes[dest.size()]++;
     return true;
 }
 
 bool CBasicKeyStore::RemoveWatchOnly(const CScript &dest)
 {
     LOCK(cs_KeyStore);
-    setWatchOnly.erase(dest);
+    if (setWatchOnly.erase(dest) && --mapWatchOnlySizes[dest.size()] == 0)
+        mapWatchOnlySizes.erase(dest.size());
     return true;
 }
 
@@ -78,13 +81,16 @@ bool CBasicKeyStore::HaveWatchOnly(const CScript &dest) const
 
     /* We assume that dest could be a script with OP_CHECKBLOCKATHEIGHT. In this case we cant search
      * for full match with watchonly scripts, cause OP_CHECKBLOCKATHEIGHT arguments are different all the time.
-     * So, instead, check that dest starts with some of the scripts from setWatchOnly */
-    auto predicate = [&dest](const CScript& script) {
-        auto res = search(begin(dest), end(dest), begin(script), end(script));
-        return res == begin(dest);
-    };
-
-    return std::find_if(setWatchOnly.begin(), setWatchOnly.end(), predicate) != setWatchOnly.end();
+     * So, instead, check that dest starts with some of the scripts from setWatchOnly: its prefix of the
+     * size of each of them is looked up, rather than every script compared with it */
+    for (const std::pair<const unsigned int, unsigned int>& size : mapWatchOnlySizes)
+    {
+        if (size.first > dest.size())
+            break;
+        if (setWatchOnly.count(CScript(dest.begin(), dest.begin() + size.first)))
+            return true;
+    }
+    return false;
 }
 
 bool CBasicKeyStore::HaveWatchOnly() const
@@ -135,3 +141,16 @@ bool CBasicKeyStore::GetViewingKey(const libzcash::PaymentAddress &address,
     }
     return false;
 }
+
+size_t CBasicKeyStore::DynamicMemoryUsage() const
+{
+    size_t nUsage = 0;
+    {
+        LOCK(cs_KeyStore);
+        nUsage += memusage::DynamicUsage(mapKeys) + memusage::DynamicUsage(mapScripts) +
+                  memusage::DynamicUsage(setWatchOnly) + memusage::DynamicUsage(mapWatchOnlySizes);
+    }
+    LOCK(cs_SpendingKeyStore);
+    return nUsage + memusage::DynamicUsage(mapSpendingKeys) + memusage::DynamicUsage(mapViewingKeys) +
+           memusage::DynamicUsage(mapNoteDecryptors);
+}
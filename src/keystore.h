@@ -77,6 +77,8 @@ protected:
     KeyMap mapKeys;
     ScriptMap mapScripts;
     WatchOnlySet setWatchOnly;
+    //! Number of watch-only scripts of each size, for HaveWatchOnly to look up prefixes of those sizes only
+    std::map<unsigned int, unsigned int> mapWatchOnlySizes;
     SpendingKeyMap mapSpendingKeys;
     ViewingKeyMap mapViewingKeys;
     NoteDecryptorMap mapNoteDecryptors;
@@ -187,6 +189,9 @@ public:
     virtual bool RemoveViewingKey(const libzcash::ViewingKey &vk);
     virtual bool HaveViewingKey(const libzcash::PaymentAddress &address) const;
     virtual bool GetViewingKey(const libzcash::PaymentAddress &address, libzcash::ViewingKey& vkOut) const;
+
+    //! Memory used by the maps of keys and scripts
+    size_t DynamicMemoryUsage() const;
 };
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > CKeyingMaterial;
@@ -6,6 +6,8 @@
 
 #include "util.h"
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -27,14 +29,20 @@ void HandleError(const leveldb::Status& status)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const CLevelDBTuning& tuning)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    // up to two write buffers may be held in memory simultaneously
+    if (tuning.fWriteHeavy) {
+        options.block_cache = leveldb::NewLRUCache(nCacheSize / 4);
+        options.write_buffer_size = nCacheSize * 3 / 8;
+    } else {
+        options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+        options.write_buffer_size = nCacheSize / 4;
+    }
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.compression = tuning.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = std::max(tuning.nMaxOpenFiles, MIN_LEVELDB_MAX_OPEN_FILES);
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +51,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe,
+                                 const CLevelDBTuning& tuning)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, tuning);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -66,7 +75,8 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    LogPrintf("Opened LevelDB successfully (max open files %d, compression %s)\n",
+              options.max_open_files, tuning.fCompression ? "snappy" : "none");
 }
 
 CLevelDBWrapper::~CLevelDBWrapper()
@@ -81,9 +91,38 @@ CLevelDBWrapper::~CLevelDBWrapper()
     options.env = NULL;
 }
 
+void CLevelDBWrapper::CompactFull()
+{
+    pdb->CompactRange(NULL, NULL);
+}
+
+uint64_t CLevelDBWrapper::EstimateSize() const
+{
+    // All keys start with a one byte prefix below 0xff
+    std::string strBegin, strEnd(1, '\xff');
+    leveldb::Range range(strBegin, strEnd);
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
+}
+
 bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync)
 {
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
     HandleError(status);
     return true;
 }
+
+CLevelDBSnapshot::CLevelDBSnapshot(const CLevelDBWrapper& parentIn) : parent(parentIn)
+{
+    psnapshot = parent.pdb->GetSnapshot();
+    readoptions = parent.readoptions;
+    readoptions.snapshot = psnapshot;
+    iteroptions = parent.iteroptions;
+    iteroptions.snapshot = psnapshot;
+}
+
+CLevelDBSnapshot::~CLevelDBSnapshot()
+{
+    parent.pdb->ReleaseSnapshot(psnapshot);
+}
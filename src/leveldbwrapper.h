@@ -16,6 +16,25 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+//! -dbmaxopenfiles default, per database
+static const int DEFAULT_LEVELDB_MAX_OPEN_FILES = 64;
+//! -dbmaxopenfiles minimum
+static const int MIN_LEVELDB_MAX_OPEN_FILES = 16;
+
+/** Per-database tuning of the LevelDB options, see GetOptions */
+struct CLevelDBTuning
+{
+    //! Compress table blocks with Snappy; a no-op if LevelDB was built without it
+    bool fCompression;
+    //! Give the write buffer a larger share of the cache than the block cache,
+    //! for databases that are written in large batches and read through a cache of their own
+    bool fWriteHeavy;
+    //! Number of table files LevelDB keeps open
+    int nMaxOpenFiles;
+
+    CLevelDBTuning() : fCompression(false), fWriteHeavy(false), nMaxOpenFiles(DEFAULT_LEVELDB_MAX_OPEN_FILES) {}
+};
+
 class leveldb_error : public std::runtime_error
 {
 public:
@@ -63,6 +82,8 @@ public:
 
 class CLevelDBWrapper
 {
+    friend class CLevelDBSnapshot;
+
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
@@ -85,12 +106,8 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
-public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
-    ~CLevelDBWrapper();
-
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool ReadWithOptions(const leveldb::ReadOptions& opts, const K& key, V& value) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(ssKey.GetSerializeSize(key));
@@ -98,7 +115,7 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(opts, slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -114,6 +131,17 @@ public:
         return true;
     }
 
+public:
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false,
+                    const CLevelDBTuning& tuning = CLevelDBTuning());
+    ~CLevelDBWrapper();
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        return ReadWithOptions(readoptions, key, value);
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -163,11 +191,56 @@ public:
         return WriteBatch(batch, true);
     }
 
+    //! Compact the whole database. Slow; can run alongside reads and writes.
+    void CompactFull();
+
+    //! Approximate size on disk of the whole database, in bytes
+    uint64_t EstimateSize() const;
+
     // not exactly clean encapsulation, but it's easiest for now
     leveldb::Iterator* NewIterator()
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterator for a short run of lookups, which unlike a scan fill the block cache
+    leveldb::Iterator* NewLookupIterator() const
+    {
+        return pdb->NewIterator(readoptions);
+    }
+};
+
+/**
+ * Consistent read-only view of a CLevelDBWrapper as of the creation of the
+ * snapshot. Writes made afterwards are not seen, so a long iteration over it
+ * needs no lock against the writers of the database. The database must
+ * outlive the snapshot.
+ */
+class CLevelDBSnapshot
+{
+private:
+    const CLevelDBWrapper& parent;
+    const leveldb::Snapshot* psnapshot;
+    leveldb::ReadOptions readoptions;
+    leveldb::ReadOptions iteroptions;
+
+    CLevelDBSnapshot(const CLevelDBSnapshot&);
+    void operator=(const CLevelDBSnapshot&);
+
+public:
+    explicit CLevelDBSnapshot(const CLevelDBWrapper& parentIn);
+    ~CLevelDBSnapshot();
+
+    template <typename K, typename V>
+    bool Read(const K& key, V& value) const
+    {
+        return parent.ReadWithOptions(readoptions, key, value);
+    }
+
+    leveldb::Iterator* NewIterator() const
+    {
+        return parent.pdb->NewIterator(iteroptions);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
@@ -10,14 +10,20 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcompression.h"
+#include "blockencodings.h"
+#include "blockfilewriter.h"
+#include "blockview.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/validation.h"
 #include "deprecation.h"
 #include "init.h"
+#include "mappedfile.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "pow.h"
+#include "threadpool.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "undo.h"
@@ -27,18 +33,24 @@
 #include "wallet/asyncrpcoperation_sendmany.h"
 #include "wallet/asyncrpcoperation_shieldcoinbase.h"
 
+#include <atomic>
+#include <deque>
 #include <sstream>
+#include <thread>
+#include <tuple>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/static_assert.hpp>
 
 #include "zen/forkmanager.h"
 #include "zen/delay.h"
 
+#include "proofcache.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
 
@@ -56,31 +68,52 @@ using namespace std;
 
 CCriticalSection cs_main;
 
-BlockSet sGlobalForkTips;
-BlockTimeMap mGlobalForkTips;
+CGlobalForkTips mGlobalForkTips;
 
 BlockMap mapBlockIndex;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 int64_t nTimeBestReceived = 0;
+//! Swapped as a whole by SetActiveTip whenever chainActive changes, through the atomic shared_ptr functions
+static std::shared_ptr<const CChainTipSnapshot> pchainTipSnapshot = std::make_shared<const CChainTipSnapshot>();
+std::atomic<int> nBestHeaderHeight(-1);
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+bool fParallelProofCheck = DEFAULT_PARALLEL_PROOF_CHECK;
+int nPrefetchThreads = DEFAULT_PREFETCH_THREADS;
 bool fExperimentalMode = false;
 bool fImporting = false;
 bool fReindex = false;
 bool fReindexFast = false;
 bool fTxIndex = false;
+bool fCompactTxIndex = DEFAULT_COMPACT_TXINDEX;
+bool fBlockFilterIndex = DEFAULT_BLOCKFILTERINDEX;
+bool fAddressIndex = DEFAULT_ADDRESSINDEX;
+bool fSpentIndex = DEFAULT_SPENTINDEX;
+bool fTimestampIndex = DEFAULT_TIMESTAMPINDEX;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
+unsigned int nCheckBlockIndexSample = DEFAULT_CHECK_BLOCK_INDEX_SAMPLE;
 bool fCheckpointsEnabled = true;
+bool fCheckpointHeaders = DEFAULT_CHECKPOINT_HEADERS;
+bool fMmapBlockFiles = DEFAULT_MMAP_BLOCK_FILES;
+bool fCompressBlocks = DEFAULT_COMPRESS_BLOCKS;
+/** Writes the block and undo records, off the validation path once its thread runs */
+static CBlockFileWriter blockFileWriter;
+uint256 hashAssumeValid;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 //true in case we still have not reached the highest known block from server startup
 bool fIsStartupSyncing = true;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nCoinCacheUsageSynced = 5000 * 300;
+size_t nCoinCacheUsageIBD = 5000 * 300;
+bool fDynamicCoinCache = false;
+int64_t nCoinsWriteInterval = DEFAULT_COINS_WRITE_INTERVAL;
 uint64_t nPruneTarget = 0;
+unsigned int nPruneKeepBlocks = MIN_BLOCKS_TO_KEEP;
 bool fAlerts = DEFAULT_ALERTS;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
@@ -91,10 +124,21 @@ CTxMemPool mempool(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nSize;
 };
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);;
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/**
+ * The orphan pool has a lock of its own, taken after cs_main when both are
+ * held and never across a call that takes cs_main.
+ */
+CCriticalSection cs_orphans;
+map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_orphans);
+boost::unordered_map<uint256, set<uint256>, SaltedUint256Hasher> mapOrphanTransactionsByPrev GUARDED_BY(cs_orphans);
+//! The orphans of each peer, and the total size of those of each peer and of all
+map<NodeId, set<uint256> > mapOrphanTransactionsByPeer GUARDED_BY(cs_orphans);
+map<NodeId, size_t> mapOrphanBytesByPeer GUARDED_BY(cs_orphans);
+size_t nOrphanTransactionsBytes GUARDED_BY(cs_orphans) = 0;
+void EraseOrphansFor(NodeId peer);
 
 /**
  * Returns true if there are nRequired or more blocks of minVersion or above
@@ -113,7 +157,7 @@ namespace {
 
     struct CBlockIndexWorkComparator
     {
-        bool operator()(CBlockIndex *pa, CBlockIndex *pb) const {
+        bool operator()(const CBlockIndex *pa, const CBlockIndex *pb) const {
             // First sort by total delay in chain.
             if (pa->nChainDelay < pb->nChainDelay) return false;
             if (pa->nChainDelay > pb->nChainDelay) return true;
@@ -177,6 +221,11 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+
+    /** Read-only mappings of the block and undo files before nLastBlockFile, most recently used first (-mmapblockfiles). */
+    CCriticalSection cs_MappedBlockFiles;
+    typedef std::pair<CDiskBlockPos, std::string> MappedBlockFileKey; // file number (nPos 0) and prefix
+    list<std::pair<MappedBlockFileKey, boost::shared_ptr<const CMappedFile> > > listMappedBlockFiles;
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -221,6 +270,15 @@ namespace {
     boost::scoped_ptr<CRollingBloomFilter> recentRejects;
     uint256 hashRecentRejectsChainTip;
 
+    /**
+     * Filter for transactions whose JoinSplit proofs failed to verify. Unlike
+     * recentRejects it is not reset on tip changes: the txid commits to the
+     * proofs, so these transactions can never become valid, and each peer
+     * announcing one again would otherwise cost a full proof verification.
+     * Protected by cs_main.
+     */
+    boost::scoped_ptr<CRollingBloomFilter> recentBadProofs;
+
     /** Blocks that are in flight, and that are in the queue to be downloaded. Protected by cs_main. */
     struct QueuedBlock {
         uint256 hash;
@@ -228,9 +286,13 @@ namespace {
         int64_t nTime;  //! Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //! The timeout for this block request (for disconnecting a slow peer)
+        boost::shared_ptr<PartiallyDownloadedBlock> partialBlock;  //! Set while waiting for the missing transactions of a compact block.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+    /** Blocks in flight that were requested from a second peer as well, and the peer. Protected by cs_main. */
+    map<uint256, NodeId> mapBlocksRerequested;
+
     /** Number of blocks in flight with validated headers. */
     int nQueuedValidatedHeaders = 0;
 
@@ -240,10 +302,108 @@ namespace {
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
+    /** Dirty block index entries flushed since the last sampled CheckBlockIndex. */
+    set<CBlockIndex*> setBlockIndexUnchecked;
+
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** The "block" and "cmpctblock" messages of a block, each built when first needed. */
+    struct CBlockMessages {
+        uint256 hash;
+        CSerializedNetMsg msgBlock;
+        CSerializedNetMsg msgCmpctBlock;
+        //! The block with its merkle tree built, once a peer asked for it filtered
+        std::shared_ptr<const CBlock> pblockFiltered;
+    };
+
+    /** Recent blocks in wire format, most recently used first. */
+    list<CBlockMessages> listRecentBlockMessages;
+
+    /** The cached messages of a block, made the most recently used, or NULL. */
+    CBlockMessages* FindRecentBlockMessages(const uint256& hash)
+    {
+        for (list<CBlockMessages>::iterator it = listRecentBlockMessages.begin(); it != listRecentBlockMessages.end(); ++it) {
+            if (it->hash == hash) {
+                listRecentBlockMessages.splice(listRecentBlockMessages.begin(), listRecentBlockMessages, it);
+                return &listRecentBlockMessages.front();
+            }
+        }
+        return NULL;
+    }
+
+    /** Find the cached messages of a block, or add an empty entry for it, evicting the least recently used one. */
+    CBlockMessages& AddRecentBlockMessages(const uint256& hash)
+    {
+        CBlockMessages* pentry = FindRecentBlockMessages(hash);
+        if (pentry)
+            return *pentry;
+        listRecentBlockMessages.push_front(CBlockMessages());
+        listRecentBlockMessages.front().hash = hash;
+        if (listRecentBlockMessages.size() > MAX_RECENT_BLOCK_MESSAGES)
+            listRecentBlockMessages.pop_back();
+        return listRecentBlockMessages.front();
+    }
+
+    /** A "headers" reply of MAX_HEADERS_RESULTS main chain headers, valid while pindexLast is on the main chain. */
+    struct CHeadersMessage {
+        const CBlockIndex* pindexFirst;
+        const CBlockIndex* pindexLast;
+        CSerializedNetMsg msg;
+    };
+
+    /** Recent full "headers" replies, most recently used first. */
+    CCriticalSection cs_RecentHeadersMessages;
+    list<CHeadersMessage> listRecentHeadersMessages;
 } // anon namespace
 
+/**
+ * The cached "headers" reply starting at pindexFirst and its last block, if its
+ * headers are still the main chain, or an empty message. Requires cs_main.
+ */
+static CSerializedNetMsg FindHeadersMessage(const CBlockIndex* pindexFirst, const CBlockIndex*& pindexLast)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_RecentHeadersMessages);
+    for (list<CHeadersMessage>::iterator it = listRecentHeadersMessages.begin(); it != listRecentHeadersMessages.end(); ++it) {
+        if (it->pindexFirst != pindexFirst)
+            continue;
+        // The headers are consecutive, they are all on the main chain if the last one is
+        if (!chainActive.Contains(it->pindexLast)) {
+            listRecentHeadersMessages.erase(it);
+            return CSerializedNetMsg();
+        }
+        listRecentHeadersMessages.splice(listRecentHeadersMessages.begin(), listRecentHeadersMessages, it);
+        pindexLast = it->pindexLast;
+        return it->msg;
+    }
+    return CSerializedNetMsg();
+}
+
+/** Keep a full "headers" reply, for the other peers syncing through the same range. */
+static void CacheHeadersMessage(const CBlockIndex* pindexFirst, const CBlockIndex* pindexLast, const CSerializedNetMsg& msg)
+{
+    LOCK(cs_RecentHeadersMessages);
+    CHeadersMessage entry;
+    entry.pindexFirst = pindexFirst;
+    entry.pindexLast = pindexLast;
+    entry.msg = msg;
+    listRecentHeadersMessages.push_front(entry);
+    if (listRecentHeadersMessages.size() > MAX_RECENT_HEADERS_MESSAGES)
+        listRecentHeadersMessages.pop_back();
+}
+
+/** Keep a block that was just accepted or connected in wire format, as peers are about to fetch it. */
+static void CacheBlockMessage(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (IsInitialBlockDownload())
+        return;
+    CBlockMessages& entry = AddRecentBlockMessages(block.GetHash());
+    if (!entry.msgBlock)
+        entry.msgBlock = SerializeNetMessage("block", block);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Registration of network node signals.
@@ -288,9 +448,25 @@ struct CNodeState {
     int64_t nStallingSince;
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
+    //! Moving average of the time this peer takes per block we request (in microseconds), or 0 until measured.
+    int64_t nAvgBlockTime;
+    //! When this peer last delivered a block we requested from it (in microseconds), or 0.
+    int64_t nLastBlockTime;
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer can send us compact blocks ("sendcmpct").
+    bool fProvidesHeaderAndIDs;
+    //! Whether this peer wants new blocks announced with their headers ("sendheaders").
+    bool fPreferHeaders;
+    //! The main chain block with the most work we sent this peer the header of.
+    const CBlockIndex *pindexBestHeaderSent;
+    //! Fork tips to announce to this peer, the least delayed with the most work last.
+    std::set<const CBlockIndex*, CBlockIndexWorkComparator> setForkTipsToAnnounce;
+    //! How many fork tips can be announced right now, refilled at MAX_FORK_RELAY_INV_PER_SECOND.
+    double dForkRelayAllowance;
+    //! When dForkRelayAllowance was last refilled (in microseconds).
+    int64_t nForkRelayRefillTime;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -302,8 +478,15 @@ struct CNodeState {
         fSyncStarted = false;
         nStallingSince = 0;
         nBlocksInFlight = 0;
+        nAvgBlockTime = 0;
+        nLastBlockTime = 0;
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
+        fProvidesHeaderAndIDs = false;
+        fPreferHeaders = false;
+        pindexBestHeaderSent = NULL;
+        dForkRelayAllowance = MAX_FORK_RELAY_INV_PER_SECOND;
+        nForkRelayRefillTime = 0;
     }
 };
 
@@ -364,8 +547,16 @@ void FinalizeNode(NodeId nodeid) {
         AddressCurrentlyConnected(state->address);
     }
 
-    BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight)
+    BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight) {
         mapBlocksInFlight.erase(entry.hash);
+        mapBlocksRerequested.erase(entry.hash);
+    }
+    for (map<uint256, NodeId>::iterator it = mapBlocksRerequested.begin(); it != mapBlocksRerequested.end(); ) {
+        if (it->second == nodeid)
+            mapBlocksRerequested.erase(it++);
+        else
+            ++it;
+    }
     EraseOrphansFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
 
@@ -374,10 +565,22 @@ void FinalizeNode(NodeId nodeid) {
 
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
-bool MarkBlockAsReceived(const uint256& hash) {
+// nodeFrom is the peer the block came from, if known, to time the peers delivering the blocks requested from them.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1) {
+    mapBlocksRerequested.erase(hash);
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (nodeFrom == itInFlight->second.first) {
+            // The requests queue up at the peer, so time each block from when the peer was done with the previous one
+            int64_t nNow = GetTimeMicros();
+            int64_t nBlockTime = std::max<int64_t>(nNow - std::max(itInFlight->second.second->nTime, state->nLastBlockTime), 1);
+            if (state->nAvgBlockTime == 0)
+                state->nAvgBlockTime = nBlockTime;
+            else
+                state->nAvgBlockTime = (nBlockTime * BLOCK_DOWNLOAD_TIME_WEIGHT + state->nAvgBlockTime * (8 - BLOCK_DOWNLOAD_TIME_WEIGHT)) / 8;
+            state->nLastBlockTime = nNow;
+        }
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
@@ -439,6 +642,32 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     }
 }
 
+/** Whether the peer is known to have the header of pindex. Requires cs_main. */
+bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
+{
+    if (state->pindexBestKnownBlock && pindex == state->pindexBestKnownBlock->GetAncestor(pindex->nHeight))
+        return true;
+    if (state->pindexBestHeaderSent && pindex == state->pindexBestHeaderSent->GetAncestor(pindex->nHeight))
+        return true;
+    return false;
+}
+
+/** Blocks per second all the peers we are downloading from deliver together, recomputed once a second. */
+double GetBlocksPerSecond() {
+    static double dBlocksPerSecond = 0;
+    static int64_t nLastUpdate = 0;
+    int64_t nNow = GetTimeMicros();
+    if (nNow - nLastUpdate >= 1000000) {
+        dBlocksPerSecond = 0;
+        BOOST_FOREACH(const PAIRTYPE(NodeId, CNodeState)& item, mapNodeState) {
+            if (item.second.nBlocksInFlight > 0 && item.second.nAvgBlockTime > 0)
+                dBlocksPerSecond += 1000000.0 / item.second.nAvgBlockTime;
+        }
+        nLastUpdate = nNow;
+    }
+    return dBlocksPerSecond;
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
@@ -459,8 +688,8 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. pindexWaitingFor is set to the first of them already in flight, if any. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex*& pindexWaitingFor) {
     if (count == 0)
     {
         LogPrint("forks", "%s():%d - peer has too many blocks in fligth\n", __func__, __LINE__);
@@ -493,10 +722,10 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
     std::vector<CBlockIndex*> vToFetch;
     CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than the download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow(GetBlocksPerSecond());
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
@@ -541,6 +770,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -560,9 +790,27 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInTransitLimit = GetBlocksInTransitLimit(state->nAvgBlockTime);
+    stats.nAvgBlockTime = state->nAvgBlockTime;
     return true;
 }
 
+int GetBlocksInTransitLimit(int64_t nAvgBlockTime) {
+    if (nAvgBlockTime <= 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nLimit = 1000000LL * BLOCK_DOWNLOAD_QUEUE_TIME / nAvgBlockTime;
+    return std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nLimit, MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER));
+}
+
+int GetBlockDownloadWindow(double dBlocksPerSecond) {
+    double dWindow = dBlocksPerSecond * BLOCK_DOWNLOAD_WINDOW_TIME;
+    if (dWindow <= BLOCK_DOWNLOAD_WINDOW)
+        return BLOCK_DOWNLOAD_WINDOW;
+    if (dWindow >= MAX_BLOCK_DOWNLOAD_WINDOW)
+        return MAX_BLOCK_DOWNLOAD_WINDOW;
+    return (int)dWindow;
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.connect(&GetHeight);
@@ -597,6 +845,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewBackgroundFlush *pcoinsflush = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -604,8 +854,20 @@ CBlockTreeDB *pblocktree = NULL;
 // mapOrphanTransactions
 //
 
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+//! The -maxorphantx and -maxorphantxsize limits of the whole orphan pool
+static unsigned int GetMaxOrphanTx()
+{
+    return (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+}
+
+static size_t GetMaxOrphanTxBytes()
 {
+    return (size_t)std::max((int64_t)0, GetArg("-maxorphantxsize", DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE)) * 1000;
+}
+
+bool AddOrphanTx(const CTransaction& tx, NodeId peer)
+{
+    LOCK(cs_orphans);
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
         return false;
@@ -615,63 +877,136 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
-    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, tx.nVersion);
-    if (sz > 5000)
+    unsigned int sz = tx.GetTotalSize();
+    if (sz > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    // A peer only gets its share of the pool, so that a few of them cannot
+    // push out the orphans of all the others
+    map<NodeId, set<uint256> >::const_iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    size_t nPeerOrphans = itPeer == mapOrphanTransactionsByPeer.end() ? 0 : itPeer->second.size();
+    size_t nPeerBytes = nPeerOrphans ? mapOrphanBytesByPeer[peer] : 0;
+    if (nPeerOrphans + 1 > std::max(GetMaxOrphanTx() / ORPHAN_TX_PEER_SHARE, 1u) ||
+        nPeerBytes + sz > std::max(GetMaxOrphanTxBytes() / ORPHAN_TX_PEER_SHARE, (size_t)MAX_ORPHAN_TX_SIZE))
+    {
+        LogPrint("mempool", "ignoring orphan tx %s, peer=%d has %u orphans of %u bytes\n", hash.ToString(), peer,
+                 nPeerOrphans, nPeerBytes);
+        return false;
+    }
+
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nSize = sz;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
         mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
+    mapOrphanTransactionsByPeer[peer].insert(hash);
+    mapOrphanBytesByPeer[peer] += sz;
+    nOrphanTransactionsBytes += sz;
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u bytes %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTransactionsBytes);
     return true;
 }
 
-void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_orphans)
 {
     map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
     BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        boost::unordered_map<uint256, set<uint256>, SaltedUint256Hasher>::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
         itPrev->second.erase(hash);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    NodeId peer = it->second.fromPeer;
+    map<NodeId, set<uint256> >::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer != mapOrphanTransactionsByPeer.end()) {
+        itPeer->second.erase(hash);
+        if (itPeer->second.empty()) {
+            mapOrphanTransactionsByPeer.erase(itPeer);
+            mapOrphanBytesByPeer.erase(peer);
+        } else {
+            mapOrphanBytesByPeer[peer] -= it->second.nSize;
+        }
+    }
+    nOrphanTransactionsBytes -= it->second.nSize;
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    LOCK(cs_orphans);
+    map<NodeId, set<uint256> >::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer == mapOrphanTransactionsByPeer.end())
+        return;
+    // Copied, erasing the last one erases the set
+    set<uint256> setErase = itPeer->second;
+    BOOST_FOREACH(const uint256& hash, setErase)
+        EraseOrphanTx(hash);
+    LogPrint("mempool", "Erased %d orphan tx from peer %d\n", setErase.size(), peer);
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void RelayMempoolTransaction(const CTransaction& tx)
+{
+    std::shared_ptr<const CTransaction> ptx = mempool.get(tx.GetHash());
+    if (ptx)
+        RelayTransaction(ptx);
+    else
+        RelayTransaction(tx);
+}
+
+size_t GetOrphanPoolMemoryUsage(size_t& nOrphans)
+{
+    LOCK(cs_orphans);
+    nOrphans = mapOrphanTransactions.size();
+    size_t nUsage = memusage::DynamicUsage(mapOrphanTransactions) + memusage::DynamicUsage(mapOrphanTransactionsByPrev) +
+                    memusage::DynamicUsage(mapOrphanTransactionsByPeer) + memusage::DynamicUsage(mapOrphanBytesByPeer);
+    for (map<uint256, COrphanTx>::const_iterator it = mapOrphanTransactions.begin(); it != mapOrphanTransactions.end(); it++)
+        nUsage += RecursiveDynamicUsage(it->second.tx);
+    for (boost::unordered_map<uint256, set<uint256>, SaltedUint256Hasher>::const_iterator it = mapOrphanTransactionsByPrev.begin(); it != mapOrphanTransactionsByPrev.end(); it++)
+        nUsage += memusage::DynamicUsage(it->second);
+    for (map<NodeId, set<uint256> >::const_iterator it = mapOrphanTransactionsByPeer.begin(); it != mapOrphanTransactionsByPeer.end(); it++)
+        nUsage += memusage::DynamicUsage(it->second);
+    return nUsage;
+}
+
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanBytes)
 {
+    LOCK(cs_orphans);
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+
+    // Drop the orphans whose parents did not show up in time, scanning for
+    // them now and then rather than at every call
+    static int64_t nNextSweep = 0;
+    int64_t nNow = GetTime();
+    if (nNextSweep <= nNow) {
+        int nExpired = 0;
+        map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
+        while (iter != mapOrphanTransactions.end())
+        {
+            map<uint256, COrphanTx>::iterator maybeErase = iter++;
+            if (maybeErase->second.nTimeExpire <= nNow) {
+                EraseOrphanTx(maybeErase->first);
+                ++nExpired;
+            }
+        }
+        nNextSweep = nNow + ORPHAN_TX_EXPIRE_INTERVAL;
+        if (nExpired > 0)
+            LogPrint("mempool", "Erased %d expired orphan tx\n", nExpired);
+        nEvicted += nExpired;
+    }
+
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTransactionsBytes > nMaxOrphanBytes)
     {
         // Evict a random orphan:
         uint256 randomhash = GetRandHash();
@@ -985,24 +1320,36 @@ bool ContextualCheckTransaction(
 }
 
 
-bool CheckTransaction(const CTransaction& tx, CValidationState &state,
-                      libzcash::ProofVerifier& verifier)
+/**
+ * Ensure that the zk-SNARKs of tx verify, unless they already did when the
+ * transaction entered the mempool. With a batch verifier the proofs are only
+ * queued, and verifier.verifyBatch() has the final say.
+ */
+static bool CheckJoinSplitProofs(const CTransaction& tx, CValidationState &state,
+                                 libzcash::ProofVerifier& verifier)
 {
-    // Don't count coinbase transactions because mining skews the count
-    if (!tx.IsCoinBase()) {
-        transactionsValidated.increment();
-    }
-    if (!CheckTransactionWithoutProofVerification(tx, state)) {
-        return false;
-    }
-
-    // Ensure that zk-SNARKs verify
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
-        if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
+        if (verifier.isVerificationEnabled() && IsJoinSplitProofCached(joinsplit, tx.joinSplitPubKey))
+            continue;
+        int64_t nVerifyStart = GetTimeMicros();
+        bool fVerified = joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey);
+        if (verifier.isVerificationEnabled())
+            joinSplitVerifyTime.observe(GetTimeMicros() - nVerifyStart);
+        if (!fVerified) {
             return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
                                 REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
         }
     }
+    return true;
+}
+
+/** The checks of CheckTransaction that come after those of CheckTransactionWithoutProofVerification */
+static bool CheckTransactionProofsAndOutputs(const CTransaction& tx, CValidationState &state,
+                                             libzcash::ProofVerifier& verifier)
+{
+    if (!CheckJoinSplitProofs(tx, state, verifier)) {
+        return false;
+    }
 
     // Check for vout's without OP_CHECKBLOCKATHEIGHT opcode
     BOOST_FOREACH(const CTxOut& txout, tx.vout)
@@ -1020,6 +1367,19 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
     return true;
 }
 
+bool CheckTransaction(const CTransaction& tx, CValidationState &state,
+                      libzcash::ProofVerifier& verifier)
+{
+    // Don't count coinbase transactions because mining skews the count
+    if (!tx.IsCoinBase()) {
+        transactionsValidated.increment();
+    }
+    if (!CheckTransactionWithoutProofVerification(tx, state)) {
+        return false;
+    }
+    return CheckTransactionProofsAndOutputs(tx, state, verifier);
+}
+
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state)
 {
     // Basic checks that don't depend on any context
@@ -1041,7 +1401,7 @@ bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidatio
 
     // Size limits
     BOOST_STATIC_ASSERT(MAX_BLOCK_SIZE > MAX_TX_SIZE); // sanity
-    if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) > MAX_TX_SIZE)
+    if (tx.GetTotalSize() > MAX_TX_SIZE)
         return state.DoS(100, error("CheckTransaction(): size limits failed"),
                          REJECT_INVALID, "bad-txns-oversize");
 
@@ -1213,11 +1573,20 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+static void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+                        bool* pfMissingInputs, bool fRejectAbsurdFee, int64_t nAcceptTime)
 {
     AssertLockHeld(cs_main);
+    MetricsScopedTimer timer(acceptToMemoryPoolTime);
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -1234,8 +1603,10 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     }
 
 
-    auto verifier = libzcash::ProofVerifier::Strict();
-    if (!CheckTransaction(tx, state, verifier))
+    // The zk-SNARKs are the most expensive part of the checks, they are only
+    // verified below once everything cheaper to fail has passed
+    auto disabledVerifier = libzcash::ProofVerifier::Disabled();
+    if (!CheckTransaction(tx, state, disabledVerifier))
         return error("AcceptToMemoryPool: CheckTransaction failed");
 
 
@@ -1364,9 +1735,26 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
+        // Spends of coinbases have to be found again when a reorg makes these immature
+        bool fSpendsCoinbase = false;
+        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
+            if (coins->IsCoinBase()) {
+                fSpendsCoinbase = true;
+                break;
+            }
+        }
+
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime ? nAcceptTime : GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase);
         unsigned int nSize = entry.GetTxSize();
 
+        // Once the mempool had to evict, it takes at least what was evicted paid to get in
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nFees, mempoolRejectFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
         if (tx.vjoinsplit.size() > 0 && nFees >= ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
             // In future we will we have more accurate and dynamic computation of fees for tx with joinsplits.
@@ -1413,6 +1801,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                          hash.ToString(),
                          nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // All the PHGR proofs of the transaction are checked with one multi-pairing.
+        // A transaction whose proofs fail is invalid whatever the chain tip, so
+        // it is remembered beyond the tip changes that reset recentRejects.
+        auto verifier = libzcash::ProofVerifier::Batch();
+        if (!CheckJoinSplitProofs(tx, state, verifier) || !verifier.verifyBatch()) {
+            if (recentBadProofs)
+                recentBadProofs->insert(hash);
+            if (state.IsValid())
+                return state.DoS(100, error("AcceptToMemoryPool: joinsplit does not verify"),
+                                 REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+            return error("AcceptToMemoryPool: joinsplit does not verify");
+        }
+        CacheJoinSplitProofs(tx);
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!ContextualCheckInputs(tx, state, view, true, chainActive, STANDARD_CONTEXTUAL_SCRIPT_VERIFY_FLAGS, true, Params().GetConsensus()))
@@ -1436,12 +1838,137 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+
+        // Keep the mempool in its budget, which can evict this transaction again
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     return true;
 }
 
+/**
+ * The mapping of the block or undo file holding pos, or NULL if that file is to
+ * be read with stdio: the file still appended to is, as its end is preallocated
+ * space that gets truncated when moving to the next file.
+ */
+static boost::shared_ptr<const CMappedFile> GetMappedDiskFile(const CDiskBlockPos& pos, const char* prefix)
+{
+    boost::shared_ptr<const CMappedFile> mapped;
+    if (!fMmapBlockFiles || pos.IsNull())
+        return mapped;
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.nFile >= nLastBlockFile)
+            return mapped;
+    }
+
+    LOCK(cs_MappedBlockFiles);
+    const MappedBlockFileKey key(CDiskBlockPos(pos.nFile, 0), prefix);
+    for (list<std::pair<MappedBlockFileKey, boost::shared_ptr<const CMappedFile> > >::iterator it = listMappedBlockFiles.begin(); it != listMappedBlockFiles.end(); ++it) {
+        if (it->first == key) {
+            listMappedBlockFiles.splice(listMappedBlockFiles.begin(), listMappedBlockFiles, it);
+            return it->second;
+        }
+    }
+
+    mapped = CMappedFile::Open(GetBlockPosFilename(pos, prefix));
+    if (mapped) {
+        listMappedBlockFiles.push_front(std::make_pair(key, mapped));
+        if (listMappedBlockFiles.size() > MAX_MAPPED_BLOCK_FILES)
+            listMappedBlockFiles.pop_back();
+    }
+    return mapped;
+}
+
+/** Drop the mappings of a block file and its undo file, which are readers' to release. */
+static void ForgetMappedDiskFiles(int nFile)
+{
+    LOCK(cs_MappedBlockFiles);
+    list<std::pair<MappedBlockFileKey, boost::shared_ptr<const CMappedFile> > >::iterator it = listMappedBlockFiles.begin();
+    while (it != listMappedBlockFiles.end()) {
+        if (it->first.first.nFile == nFile)
+            it = listMappedBlockFiles.erase(it);
+        else
+            ++it;
+    }
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
+bool GetAddressIndex(uint8_t type, const uint160 &addressHash, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                     int nStart, int nEnd)
+{
+    if (!fAddressIndex)
+        return error("%s: address index not enabled", __func__);
+    return pblocktree->ReadAddressIndex(type, addressHash, nStart, nEnd, addressIndex);
+}
+
+bool GetSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value)
+{
+    if (!fSpentIndex)
+        return false;
+    return pblocktree->ReadSpentIndex(key, value);
+}
+
+bool GetTimestampIndex(uint32_t nLow, uint32_t nHigh, std::vector<uint256> &hashes)
+{
+    if (!fTimestampIndex)
+        return error("%s: timestamp index not enabled", __func__);
+    return pblocktree->ReadTimestampIndex(nLow, nHigh, hashes);
+}
+
+/**
+ * Where the transaction index places hash. With -compacttxindex these are the
+ * candidates of its truncated txid in the active chain, which may be other
+ * transactions, or none at all for entries of blocks since disconnected.
+ */
+static void FindTxIndexPositions(const uint256& hash, std::vector<CDiskTxPos>& vPos)
+{
+    AssertLockHeld(cs_main);
+    vPos.clear();
+    if (!fTxIndex)
+        return;
+    if (!fCompactTxIndex) {
+        CDiskTxPos postx;
+        if (pblocktree->ReadTxIndex(hash, postx))
+            vPos.push_back(postx);
+        return;
+    }
+    std::vector<std::pair<int, unsigned int> > vEntries;
+    pblocktree->ReadCompactTxIndex(hash, vEntries);
+    for (const std::pair<int, unsigned int>& entry : vEntries) {
+        CBlockIndex* pindex = chainActive[entry.first];
+        if (pindex && (pindex->nStatus & BLOCK_HAVE_DATA))
+            vPos.push_back(CDiskTxPos(pindex->GetBlockPos(), entry.second));
+    }
+}
+
+/** Read the transaction the index places at postx, if it is hash */
+static bool ReadIndexedTransaction(const uint256& hash, const CDiskTxPos& postx, std::string& strTx, uint256& hashBlock)
+{
+    if (!ReadRawTransactionFromDisk(strTx, hashBlock, postx))
+        return error("%s: cannot read %s", __func__, hash.ToString());
+    if (Hash(strTx.begin(), strTx.end()) != hash) {
+        // Expected of compact index candidates, not of a full position
+        if (!fCompactTxIndex)
+            return error("%s: txid mismatch", __func__);
+        return false;
+    }
+    return true;
+}
+
+/** The serialized transaction hash and the hash of its block, from the transaction index */
+static bool ReadTransactionFromIndex(const uint256& hash, std::string& strTx, uint256& hashBlock)
+{
+    std::vector<CDiskTxPos> vPos;
+    FindTxIndexPositions(hash, vPos);
+    for (const CDiskTxPos& postx : vPos)
+        if (ReadIndexedTransaction(hash, postx, strTx, hashBlock))
+            return true;
+    return false;
+}
+
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
 {
     CBlockIndex *pindexSlow = NULL;
@@ -1453,25 +1980,15 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         return true;
     }
 
-    if (fTxIndex) {
-        CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
-            CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
-            hashBlock = header.GetHash();
-            if (txOut.GetHash() != hash)
-                return error("%s: txid mismatch", __func__);
-            return true;
+    std::string strTx;
+    if (ReadTransactionFromIndex(hash, strTx, hashBlock)) {
+        try {
+            CMemoryReader reader(strTx.data(), strTx.data() + strTx.size(), SER_DISK, CLIENT_VERSION);
+            reader >> txOut;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s", __func__, e.what());
         }
+        return true;
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
@@ -1507,75 +2024,420 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 
 
 
-//////////////////////////////////////////////////////////////////////////////
-//
-// CBlock and CBlockIndex
-//
+/** Find a transaction with unspent outputs in its block, located by the coins database */
+static bool FindRawTransactionSlow(const uint256 &hash, std::string &strTx, uint256 &hashBlock)
+{
+    const CCoins* coins = pcoinsTip->AccessCoins(hash);
+    if (!coins || coins->nHeight <= 0)
+        return false;
+    const CBlockIndex* pindex = chainActive[coins->nHeight];
+    std::string strBlock;
+    if (!pindex || !ReadRawBlockFromDisk(strBlock, pindex, Params().MessageStart()))
+        return false;
+    // The transactions are hashed where they lie in the block, none is deserialized
+    try {
+        CBlockView block(strBlock.data(), strBlock.data() + strBlock.size());
+        for (size_t i = 0; i < block.GetTxCount(); i++) {
+            CTransactionView txView = block.GetTx(i);
+            if (txView.GetHash() == hash) {
+                strTx.assign(txView.begin(), txView.end());
+                hashBlock = pindex->GetBlockHash();
+                return true;
+            }
+        }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s at %s", __func__, e.what(), pindex->ToString());
+    }
+    return false;
+}
 
-bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+bool GetRawTransaction(const uint256 &hash, std::string &strTx, uint256 &hashBlock, bool fAllowSlow)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
+    LOCK(cs_main);
 
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(messageStart) << nSize;
+    CTransaction tx;
+    if (mempool.lookup(hash, tx)) {
+        CPublicDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss.reserve(tx.GetTotalSize());
+        ss << tx;
+        strTx.assign(ss.begin(), ss.end());
+        return true;
+    }
 
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    if (ReadTransactionFromIndex(hash, strTx, hashBlock))
+        return true;
 
-    return true;
+    if (!fAllowSlow)
+        return false;
+    return FindRawTransactionSlow(hash, strTx, hashBlock);
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+void GetRawTransactions(const std::vector<uint256> &vHash, std::vector<std::string> &vTx, std::vector<uint256> &vHashBlock, bool fAllowSlow)
 {
-    block.SetNull();
+    LOCK(cs_main);
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    vTx.assign(vHash.size(), std::string());
+    vHashBlock.assign(vHash.size(), uint256());
 
-    // Read block
-    try {
-        filein >> block;
+    // Those in the index are read sorted by file and place, so that the
+    // reads of a file go forward through it rather than seek back and forth
+    std::vector<std::pair<CDiskTxPos, size_t> > vReads;
+    std::vector<CDiskTxPos> vPos;
+    for (size_t i = 0; i < vHash.size(); i++) {
+        CTransaction tx;
+        if (mempool.lookup(vHash[i], tx)) {
+            CPublicDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(tx.GetTotalSize());
+            ss << tx;
+            vTx[i].assign(ss.begin(), ss.end());
+            continue;
+        }
+        FindTxIndexPositions(vHash[i], vPos);
+        for (const CDiskTxPos& postx : vPos)
+            vReads.push_back(std::make_pair(postx, i));
     }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    std::sort(vReads.begin(), vReads.end(), [](const std::pair<CDiskTxPos, size_t>& a, const std::pair<CDiskTxPos, size_t>& b) {
+        return std::make_tuple(a.first.nFile, a.first.nPos, a.first.nTxOffset) < std::make_tuple(b.first.nFile, b.first.nPos, b.first.nTxOffset);
+    });
+    std::string strTx;
+    uint256 hashBlock;
+    for (const std::pair<CDiskTxPos, size_t>& read : vReads) {
+        const size_t i = read.second;
+        if (vTx[i].empty() && ReadIndexedTransaction(vHash[i], read.first, strTx, hashBlock)) {
+            vTx[i].swap(strTx);
+            vHashBlock[i] = hashBlock;
+        }
     }
 
-    // Check the header
-    if (!(CheckEquihashSolution(&block, Params()) &&
-          CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())))
-        return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
+    if (!fAllowSlow)
+        return;
+    for (size_t i = 0; i < vHash.size(); i++)
+        if (vTx[i].empty())
+            FindRawTransactionSlow(vHash[i], vTx[i], vHashBlock[i]);
+}
 
-    return true;
+//////////////////////////////////////////////////////////////////////////////
+//
+// CBlock and CBlockIndex
+//
+
+/** Compress a block as -compressblocks stores it, vCompressed is left empty if it is stored as is */
+static void CompressBlockForDisk(const CBlock& block, std::vector<char>& vCompressed)
+{
+    vCompressed.clear();
+    if (!fCompressBlocks)
+        return;
+    CPublicDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    if (!CompressBlockData(&ss[0], ss.size(), vCompressed))
+        vCompressed.clear();
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
+bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, const std::vector<char>& vCompressed)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
-        return false;
-    if (block.GetHash() != pindex->GetBlockHash())
-        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
-                pindex->ToString(), pindex->GetBlockPos().ToString());
+    CPublicDataStream ss(SER_DISK, CLIENT_VERSION);
+
+    // Index header
+    unsigned int nSize = vCompressed.empty() ? ss.GetSerializeSize(block) : (vCompressed.size() | BLOCK_RECORD_COMPRESSED);
+    ss.reserve(8 + (nSize & ~BLOCK_RECORD_COMPRESSED));
+    ss << FLATDATA(messageStart) << nSize;
+
+    // Block
+    if (vCompressed.empty())
+        ss << block;
+    else
+        ss.write(vCompressed.data(), vCompressed.size());
+
+    // Queued for the writer thread, it is read back from the queue until written
+    CPublicSerializeData data;
+    ss.GetAndClear(data);
+    if (!blockFileWriter.Write(CBlockFileWriter::BLOCK_FILE, pos, data))
+        return error("WriteBlockToDisk: writing the block file failed");
+    pos.nPos += 8;
+
     return true;
 }
 
-CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+/** Whether the size field of a block file record header can be that of a block */
+static bool IsBlockRecordSize(unsigned int nSize)
 {
-    CAmount nSubsidy = 12.5 * COIN;
-    if (nHeight == 0)
-        return 0;
+    if (nSize & BLOCK_RECORD_COMPRESSED)
+        return (nSize & ~BLOCK_RECORD_COMPRESSED) <= MAX_BLOCK_SIZE;
+    return nSize >= 80 && nSize <= MAX_BLOCK_SIZE;
+}
 
-    // Mining slow start
-    // The subsidy is ramped up linearly, skipping the middle payout of
+/** Read the data of a block file record, given the size field of its header, decompressing it if needed */
+template <typename Stream>
+static void ReadBlockRecordData(Stream& s, unsigned int nSize, std::vector<char>& vBlock)
+{
+    if (!IsBlockRecordSize(nSize))
+        throw std::runtime_error("block size out of range");
+    unsigned int nDataSize = nSize & ~BLOCK_RECORD_COMPRESSED;
+    if (!(nSize & BLOCK_RECORD_COMPRESSED)) {
+        vBlock.resize(nDataSize);
+        s.read(vBlock.data(), nDataSize);
+        return;
+    }
+    std::vector<char> vCompressed(nDataSize);
+    s.read(vCompressed.data(), nDataSize);
+    if (!DecompressBlockData(vCompressed.data(), nDataSize, vBlock))
+        throw std::runtime_error("corrupt compressed block");
+}
+
+/** Read the block of a block file record, given the size field of its header */
+template <typename Stream>
+static void ReadBlockRecord(Stream& s, unsigned int nSize, CBlock& block)
+{
+    if (!(nSize & BLOCK_RECORD_COMPRESSED)) {
+        s >> block;
+        return;
+    }
+    std::vector<char> vBlock;
+    ReadBlockRecordData(s, nSize, vBlock);
+    CMemoryReader reader(vBlock.data(), vBlock.data() + vBlock.size(), SER_DISK, CLIENT_VERSION);
+    reader >> block;
+}
+
+/** Read the block of the record whose index header s is at */
+template <typename Stream>
+static void ReadBlockRecord(Stream& s, CBlock& block)
+{
+    CMessageHeader::MessageStartChars blkStart;
+    unsigned int nSize;
+    s >> FLATDATA(blkStart) >> nSize;
+    // Blocks written before -compressblocks existed are read as they always were
+    if (memcmp(blkStart, Params().MessageStart(), sizeof(blkStart)) != 0)
+        nSize = 0;
+    ReadBlockRecord(s, nSize, block);
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    block.SetNull();
+
+    // Read from the index header, whose size field tells whether the block is compressed
+    if (pos.nPos < 8)
+        return error("ReadBlockFromDisk: no index header for %s", pos.ToString());
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - 8);
+
+    bool fRead = false;
+    boost::shared_ptr<const CPublicSerializeData> pending = blockFileWriter.FindPending(CBlockFileWriter::BLOCK_FILE, hpos);
+    if (pending) {
+        try {
+            CMemoryReader reader(pending->data(), pending->data() + pending->size(), SER_DISK, CLIENT_VERSION);
+            ReadBlockRecord(reader, block);
+            fRead = true;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    boost::shared_ptr<const CMappedFile> mapped = fRead ? boost::shared_ptr<const CMappedFile>() : GetMappedDiskFile(hpos, "blk");
+    if (mapped && pos.nPos < mapped->size()) {
+        try {
+            CMemoryReader reader(mapped->data() + hpos.nPos, mapped->data() + mapped->size(), SER_DISK, CLIENT_VERSION);
+            ReadBlockRecord(reader, block);
+            fRead = true;
+        }
+        catch (const std::exception& e) {
+            LogPrint("mmap", "%s: mapped read failed - %s at %s\n", __func__, e.what(), pos.ToString());
+            block.SetNull();
+        }
+    }
+
+    if (!fRead) {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        // Read block
+        try {
+            ReadBlockRecord(filein, block);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    // Check the header
+    if (!(CheckEquihashSolution(&block, Params()) &&
+          CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus())))
+        return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
+
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
+{
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+        return false;
+    if (block.GetHash() != pindex->GetBlockHash())
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    return true;
+}
+
+/** Read the index header WriteBlockToDisk put in front of a block, then the block's bytes */
+template <typename Stream>
+static void ReadRawBlock(Stream& s, std::string& strBlock, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CMessageHeader::MessageStartChars blkStart;
+    unsigned int nSize;
+    s >> FLATDATA(blkStart) >> nSize;
+    if (memcmp(blkStart, messageStart, sizeof(blkStart)) != 0)
+        throw std::runtime_error("block start mismatch");
+    if (!(nSize & BLOCK_RECORD_COMPRESSED)) {
+        if (!IsBlockRecordSize(nSize))
+            throw std::runtime_error("block size out of range");
+        strBlock.resize(nSize);
+        s.read(&strBlock[0], nSize);
+        return;
+    }
+    std::vector<char> vBlock;
+    ReadBlockRecordData(s, nSize, vBlock);
+    strBlock.assign(vBlock.begin(), vBlock.end());
+}
+
+bool ReadRawBlockFromDisk(std::string& strBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.IsNull() || pos.nPos < 8)
+        return error("%s: no block data for %s", __func__, pindex->ToString());
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - 8);
+
+    boost::shared_ptr<const CPublicSerializeData> pending = blockFileWriter.FindPending(CBlockFileWriter::BLOCK_FILE, hpos);
+    if (pending) {
+        try {
+            CMemoryReader reader(pending->data(), pending->data() + pending->size(), SER_DISK, CLIENT_VERSION);
+            ReadRawBlock(reader, strBlock, messageStart);
+            return true;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    boost::shared_ptr<const CMappedFile> mapped = GetMappedDiskFile(hpos, "blk");
+    if (mapped && pos.nPos < mapped->size()) {
+        try {
+            CMemoryReader reader(mapped->data() + hpos.nPos, mapped->data() + mapped->size(), SER_DISK, CLIENT_VERSION);
+            ReadRawBlock(reader, strBlock, messageStart);
+            return true;
+        }
+        catch (const std::exception& e) {
+            LogPrint("mmap", "%s: mapped read failed - %s at %s\n", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+    try {
+        ReadRawBlock(filein, strBlock, messageStart);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    return true;
+}
+
+/** Copy the transaction the index places nTxOffset past the header of the serialized block [pbegin, pend) */
+static void ReadRawTransaction(const char* pbegin, const char* pend, unsigned int nTxOffset, std::string& strTx, uint256& hashBlock)
+{
+    CBlockView block(pbegin, pend);
+    CTransactionView tx = block.GetTxAtOffset(nTxOffset);
+    strTx.assign(tx.begin(), tx.end());
+    hashBlock = block.GetHash();
+}
+
+bool ReadRawTransactionFromDisk(std::string& strTx, uint256& hashBlock, const CDiskTxPos& postx)
+{
+    if (postx.IsNull() || postx.nPos < 8)
+        return error("%s: no index header for %s", __func__, postx.ToString());
+    CDiskBlockPos hpos(postx.nFile, postx.nPos - 8);
+
+    // A block still queued for writing or compressed is read whole, to find the transaction in it
+    std::string strBlock;
+    boost::shared_ptr<const CPublicSerializeData> pending = blockFileWriter.FindPending(CBlockFileWriter::BLOCK_FILE, hpos);
+    if (pending) {
+        try {
+            CMemoryReader reader(pending->data(), pending->data() + pending->size(), SER_DISK, CLIENT_VERSION);
+            ReadRawBlock(reader, strBlock, Params().MessageStart());
+            ReadRawTransaction(strBlock.data(), strBlock.data() + strBlock.size(), postx.nTxOffset, strTx, hashBlock);
+            return true;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), postx.ToString());
+        }
+    }
+
+    // Mapped, the transaction is copied straight from the mapping
+    boost::shared_ptr<const CMappedFile> mapped = GetMappedDiskFile(hpos, "blk");
+    if (mapped && postx.nPos < mapped->size()) {
+        try {
+            CMemoryReader reader(mapped->data() + hpos.nPos, mapped->data() + mapped->size(), SER_DISK, CLIENT_VERSION);
+            CMessageHeader::MessageStartChars blkStart;
+            unsigned int nSize;
+            reader >> FLATDATA(blkStart) >> nSize;
+            if (memcmp(blkStart, Params().MessageStart(), sizeof(blkStart)) == 0 && (nSize & BLOCK_RECORD_COMPRESSED)) {
+                std::vector<char> vBlock;
+                ReadBlockRecordData(reader, nSize, vBlock);
+                ReadRawTransaction(vBlock.data(), vBlock.data() + vBlock.size(), postx.nTxOffset, strTx, hashBlock);
+            } else {
+                ReadRawTransaction(mapped->data() + postx.nPos, mapped->data() + mapped->size(), postx.nTxOffset, strTx, hashBlock);
+            }
+            return true;
+        }
+        catch (const std::exception& e) {
+            LogPrint("mmap", "%s: mapped read failed - %s at %s\n", __func__, e.what(), postx.ToString());
+        }
+    }
+
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, postx.ToString());
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        if (memcmp(blkStart, Params().MessageStart(), sizeof(blkStart)) == 0 && (nSize & BLOCK_RECORD_COMPRESSED)) {
+            std::vector<char> vBlock;
+            ReadBlockRecordData(filein, nSize, vBlock);
+            ReadRawTransaction(vBlock.data(), vBlock.data() + vBlock.size(), postx.nTxOffset, strTx, hashBlock);
+            return true;
+        }
+        // Only the header and the transaction are read, which is no larger than
+        // MAX_TX_SIZE nor than what is left of the block
+        CBlockHeader header;
+        filein >> header;
+        hashBlock = header.GetHash();
+        if (fseek(filein.Get(), postx.nTxOffset, SEEK_CUR) != 0)
+            throw std::ios_base::failure("cannot seek to the transaction");
+        size_t nMaxSize = MAX_TX_SIZE;
+        size_t nTxPos = ::GetSerializeSize(header, SER_DISK, CLIENT_VERSION) + postx.nTxOffset;
+        if (memcmp(blkStart, Params().MessageStart(), sizeof(blkStart)) == 0 && IsBlockRecordSize(nSize) && nSize > nTxPos)
+            nMaxSize = std::min(nMaxSize, (size_t)nSize - nTxPos);
+        std::vector<char> vTx(nMaxSize);
+        size_t nRead = fread(vTx.data(), 1, vTx.size(), filein.Get());
+        CTransactionView tx(vTx.data(), vTx.data() + nRead);
+        strTx.assign(tx.begin(), tx.end());
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), postx.ToString());
+    }
+    return true;
+}
+
+CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+{
+    CAmount nSubsidy = 12.5 * COIN;
+    if (nHeight == 0)
+        return 0;
+
+    // Mining slow start
+    // The subsidy is ramped up linearly, skipping the middle payout of
     // MAX_SUBSIDY/2 to keep the monetary curve consistent with no slow start.
     if (nHeight < consensusParams.nSubsidySlowStartInterval / 2) {
         nSubsidy /= consensusParams.nSubsidySlowStartInterval;
@@ -1705,6 +2567,7 @@ void Misbehaving(NodeId pnode, int howmuch)
     if (howmuch == 0)
         return;
 
+    LOCK(cs_main);
     CNodeState *state = State(pnode);
     if (state == NULL)
         return;
@@ -1797,12 +2660,23 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, chain, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, chain, cacheStore, txdata), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
+bool CProofCheck::operator()() {
+    if (IsJoinSplitProofCached(ptx->vjoinsplit[nJoinSplit], ptx->joinSplitPubKey))
+        return true;
+    auto verifier = libzcash::ProofVerifier::Strict();
+    MetricsScopedTimer timer(joinSplitVerifyTime);
+    if (!ptx->vjoinsplit[nJoinSplit].Verify(*pzcashParams, verifier, ptx->joinSplitPubKey)) {
+        return ::error("CProofCheck(): %s:%d joinsplit does not verify", ptx->GetHash().ToString(), nJoinSplit);
+    }
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1927,7 +2801,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, const CChain& chain, unsigned int flags, bool cacheStore, const Consensus::Params& consensusParams, std::vector<CScriptCheck> *pvChecks)
+bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, const CChain& chain, unsigned int flags, bool cacheStore, const Consensus::Params& consensusParams, std::vector<CScriptCheck> *pvChecks, const PrecomputedTransactionData *txdata)
 {
     if (!tx.IsCoinBase())
     {
@@ -1946,13 +2820,19 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Checked inline, the shared parts of the signature hashes only need to live as long as this loop
+            PrecomputedTransactionData txdataInline;
+            if (!txdata && !pvChecks) {
+                txdataInline = PrecomputedTransactionData(tx);
+                txdata = &txdataInline;
+            }
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, &chain, flags, cacheStore);
+                CScriptCheck check(*coins, tx, i, &chain, flags, cacheStore, txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1968,7 +2848,7 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check(*coins, tx, i, &chain,
-                                flags & ~STANDARD_CONTEXTUAL_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_CONTEXTUAL_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, txdata);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1992,53 +2872,98 @@ namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
+    CPublicDataStream ss(SER_DISK, CLIENT_VERSION);
+
+    // Index header
+    unsigned int nSize = ss.GetSerializeSize(blockundo);
+    ss.reserve(8 + nSize + 32);
+    ss << FLATDATA(messageStart) << nSize;
 
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
+    // Undo data
+    ss << blockundo;
 
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    // calculate & write checksum, over the undo data as just serialized
+    ss << Hash(hashBlock.begin(), hashBlock.end(), ss.begin() + 8, ss.end());
 
-    // calculate & write checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    fileout << hasher.GetHash();
+    // Queued for the writer thread, it is read back from the queue until written
+    CPublicSerializeData data;
+    ss.GetAndClear(data);
+    if (!blockFileWriter.Write(CBlockFileWriter::UNDO_FILE, pos, data))
+        return error("%s: writing the undo file failed", __func__);
+    pos.nPos += 8;
 
     return true;
 }
 
+/**
+ * Deserialize undo data and the checksum after it from [pbegin, pend), returning whether the
+ * checksum matches. It is computed over the bytes as read, not by serializing the data again.
+ */
+static bool ReadUndoRecord(const char* pbegin, const char* pend, CBlockUndo& blockundo, const uint256& hashBlock)
+{
+    CMemoryReader reader(pbegin, pend, SER_DISK, CLIENT_VERSION);
+    reader >> blockundo;
+    const char* pundoEnd = pend - reader.size();
+    uint256 hashChecksum;
+    reader >> hashChecksum;
+    return hashChecksum == Hash(hashBlock.begin(), hashBlock.end(), pbegin, pundoEnd);
+}
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
+    if (pos.nPos < 8)
+        return error("%s: no index header for %s", __func__, pos.ToString());
+    CDiskBlockPos hpos(pos.nFile, pos.nPos - 8);
+
+    bool fChecksumOk = false;
+    bool fRead = false;
+    boost::shared_ptr<const CPublicSerializeData> pending = blockFileWriter.FindPending(CBlockFileWriter::UNDO_FILE, hpos);
+    if (pending) {
+        try {
+            fChecksumOk = ReadUndoRecord(pending->data() + 8, pending->data() + pending->size(), blockundo, hashBlock);
+            fRead = true;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s", __func__, e.what());
+        }
+    }
 
-    // Read block
-    uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
+    boost::shared_ptr<const CMappedFile> mapped = fRead ? boost::shared_ptr<const CMappedFile>() : GetMappedDiskFile(pos, "rev");
+    if (mapped && pos.nPos < mapped->size()) {
+        // Undo data of older files can still be appended past the end of the mapping
+        try {
+            fChecksumOk = ReadUndoRecord(mapped->data() + pos.nPos, mapped->data() + mapped->size(), blockundo, hashBlock);
+            fRead = true;
+        }
+        catch (const std::exception& e) {
+            LogPrint("mmap", "%s: mapped read failed - %s at %s\n", __func__, e.what(), pos.ToString());
+            blockundo = CBlockUndo();
+        }
     }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+
+    if (!fRead) {
+        // Open history file to read, from the index header that gives the size of the undo data
+        CAutoFile filein(OpenUndoFile(hpos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenUndoFile failed", __func__);
+
+        // Read the record in one go
+        try {
+            CMessageHeader::MessageStartChars undoStart;
+            unsigned int nSize;
+            filein >> FLATDATA(undoStart) >> nSize;
+            if (nSize > MAX_SIZE)
+                throw std::runtime_error("undo size out of range");
+            std::vector<char> vRecord(nSize + sizeof(uint256));
+            filein.read(vRecord.data(), vRecord.size());
+            fChecksumOk = ReadUndoRecord(vRecord.data(), vRecord.data() + vRecord.size(), blockundo, hashBlock);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
-    // Verify checksum
-    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
-    hasher << hashBlock;
-    hasher << blockundo;
-    if (hashChecksum != hasher.GetHash())
+    if (!fChecksumOk)
         return error("%s: Checksum mismatch", __func__);
 
     return true;
@@ -2097,7 +3022,20 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+/** Read the undo data of a block */
+static bool ReadBlockUndo(CBlockUndo& blockUndo, const CBlockIndex* pindex)
+{
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull())
+        return error("DisconnectBlock(): no undo data available");
+    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
+        return error("DisconnectBlock(): failure reading undo data");
+    return true;
+}
+
+/** DisconnectBlock with the undo data of the block already read */
+static bool DisconnectBlock(const CBlock& block, const CBlockUndo& blockUndo, CValidationState& state, CBlockIndex* pindex,
+                            CCoinsViewCache& view, bool* pfClean, bool fUpdateIndexes)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2106,21 +3044,26 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock(): no undo data available");
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
-        return error("DisconnectBlock(): failure reading undo data");
-
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
+        if (fUpdateIndexes && fAddressIndex) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                uint8_t addressType;
+                uint160 addressHash;
+                if (GetAddressIndexHash(tx.vout[k].scriptPubKey, addressType, addressHash))
+                    vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, addressHash, pindex->nHeight, i, hash, k, false), tx.vout[k].nValue));
+            }
+        }
+
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
         {
@@ -2157,10 +3100,28 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 const CTxInUndo &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, out))
                     fClean = false;
+
+                if (fUpdateIndexes && fAddressIndex) {
+                    uint8_t addressType;
+                    uint160 addressHash;
+                    if (GetAddressIndexHash(undo.txout.scriptPubKey, addressType, addressHash))
+                        vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, addressHash, pindex->nHeight, i, hash, j, true), -undo.txout.nValue));
+                }
+                if (fUpdateIndexes && fSpentIndex)
+                    vSpentIndex.push_back(std::make_pair(CSpentIndexKey(out.hash, out.n), CSpentIndexValue()));
             }
         }
     }
 
+    if (fUpdateIndexes) {
+        if (fAddressIndex && !pblocktree->EraseAddressIndex(vAddressIndex))
+            return AbortNode(state, "Failed to delete address index");
+        if (fSpentIndex && !pblocktree->UpdateSpentIndex(vSpentIndex))
+            return AbortNode(state, "Failed to delete spent index");
+        if (fTimestampIndex && !pblocktree->EraseTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
+            return AbortNode(state, "Failed to delete timestamp index");
+    }
+
     // set the old best anchor back
     view.PopAnchor(blockUndo.old_tree_root);
 
@@ -2175,38 +3136,221 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     return fClean;
 }
 
-void static FlushBlockFile(bool fFinalize = false)
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean,
+                     bool fUpdateIndexes)
+{
+    if (pfClean)
+        *pfClean = false;
+
+    CBlockUndo blockUndo;
+    if (!ReadBlockUndo(blockUndo, pindex))
+        return false;
+    return DisconnectBlock(block, blockUndo, state, pindex, view, pfClean, fUpdateIndexes);
+}
+
+/** Write and commit the block and undo records queued, then finalize the last files. Returns false if a write failed. */
+bool static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
 
+    if (!blockFileWriter.Sync())
+        return false;
+    if (!fFinalize)
+        return true;
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
 
     fileOld = OpenUndoFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
+        TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
+    return true;
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+// A single proof is far more expensive than a script, keep worker batches small
+static CCheckQueue<CProofCheck> proofcheckqueue(4);
 
 void ThreadScriptCheck() {
     RenameThread("horizen-scriptch");
+    JoinThreadPool("validation");
     scriptcheckqueue.Thread();
 }
 
+void ThreadProofCheck() {
+    RenameThread("horizen-proofch");
+    JoinThreadPool("validation");
+    proofcheckqueue.Thread();
+}
+
+// The queue serves one master at a time: a block being connected, which waits
+// for it, or a relayed transaction, which checks its proofs itself meanwhile
+static CCriticalSection cs_proofcheckqueue;
+
+bool PreVerifyJoinSplitProofs(const CTransaction& tx)
+{
+    if (tx.vjoinsplit.empty())
+        return true;
+    CValidationState state;
+    if (!CheckTransactionWithoutProofVerification(tx, state))
+        return true;
+
+    std::vector<CProofCheck> vChecks;
+    for (unsigned int i = 0; i < tx.vjoinsplit.size(); i++) {
+        if (!IsJoinSplitProofCached(tx.vjoinsplit[i], tx.joinSplitPubKey))
+            vChecks.push_back(CProofCheck(tx, i));
+    }
+
+    bool fOk = true;
+    TRY_LOCK(cs_proofcheckqueue, lockQueue);
+    if (fParallelProofCheck && nScriptCheckThreads && vChecks.size() > 1 && lockQueue) {
+        CCheckQueueControl<CProofCheck> control(&proofcheckqueue);
+        control.Add(vChecks);
+        fOk = control.Wait();
+    } else {
+        BOOST_FOREACH(CProofCheck& check, vChecks) {
+            if (!check()) {
+                fOk = false;
+                break;
+            }
+        }
+    }
+    if (!fOk)
+        return false;
+
+    CacheJoinSplitProofs(tx);
+    return true;
+}
+
+static CCheckQueue<CEquihashCheck> equihashcheckqueue(8);
+
+void ThreadBlockFileWriter() {
+    RenameThread("horizen-blkwrite");
+    blockFileWriter.Thread();
+}
+
+void ThreadEquihashCheck() {
+    RenameThread("horizen-eqcheck");
+    JoinThreadPool("validation");
+    equihashcheckqueue.Thread();
+}
+
+bool CEquihashCheck::operator()() {
+    *pfValid = CheckEquihashSolution(pheader, Params());
+    return *pfValid;
+}
+
+bool CheckEquihashSolutions(const std::vector<CBlockHeader>& headers, std::vector<char>& vValid)
+{
+    vValid.assign(headers.size(), 0);
+    std::vector<CEquihashCheck> vChecks;
+    vChecks.reserve(headers.size());
+    for (unsigned int i = 0; i < headers.size(); i++)
+        vChecks.push_back(CEquihashCheck(headers[i], &vValid[i]));
+
+    if (!nScriptCheckThreads) {
+        bool fAllOk = true;
+        BOOST_FOREACH(CEquihashCheck& check, vChecks)
+            fAllOk &= check();
+        return fAllOk;
+    }
+
+    // The queue serves one master at a time
+    static CCriticalSection cs_equihashcheckqueue;
+    LOCK(cs_equihashcheckqueue);
+    CCheckQueueControl<CEquihashCheck> control(&equihashcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
+static CCheckQueue<CTxCheck> txcheckqueue(16);
+// The queue serves one block at a time, the others are checked serially
+static CCriticalSection cs_txcheckqueue;
+//! Blocks with fewer transactions are not worth handing to the queue
+static const size_t MIN_PARALLEL_TX_CHECKS = 16;
+
+void ThreadTxCheck() {
+    RenameThread("horizen-txcheck");
+    JoinThreadPool("validation");
+    txcheckqueue.Thread();
+}
+
+bool CTxCheck::operator()() {
+    *pnSigOps = GetLegacySigOpCount(*ptx);
+    bool fOk = CheckTransactionWithoutProofVerification(*ptx, *pstate);
+    *pchResult = fOk ? 1 : 2;
+    return fOk;
+}
+
+/**
+ * The context-free checks of the transactions of a block, queued on the -par
+ * threads as soon as it is constructed, so that they run while the caller
+ * checks the block as a whole, and collected by Finish(). The queue stops
+ * early on a failure; Finish() runs what it skipped, in order, so that the
+ * first failing transaction is the one a serial check would report. The
+ * states of the checks are their own, the caller checks the failing
+ * transaction again to report on its state.
+ */
+class CBlockTxChecks
+{
+private:
+    const std::vector<CTransaction>& vtx;
+    std::vector<CValidationState> vState;
+    std::vector<unsigned int> vSigOps;
+    std::vector<char> vResult;
+    CCriticalBlock lockQueue;
+    //! Declared last, so that the workers are done before the results go
+    std::unique_ptr<CCheckQueueControl<CTxCheck> > control;
+
+public:
+    explicit CBlockTxChecks(const std::vector<CTransaction>& vtxIn) :
+        vtx(vtxIn), vState(vtxIn.size()), vSigOps(vtxIn.size(), 0), vResult(vtxIn.size(), 0),
+        lockQueue(cs_txcheckqueue, "cs_txcheckqueue", __FILE__, __LINE__, true)
+    {
+        if (!nScriptCheckThreads || vtx.size() < MIN_PARALLEL_TX_CHECKS || !lockQueue)
+            return;
+        std::vector<CTxCheck> vChecks;
+        vChecks.reserve(vtx.size());
+        for (size_t i = 0; i < vtx.size(); i++)
+            vChecks.push_back(CTxCheck(vtx[i], &vState[i], &vSigOps[i], &vResult[i]));
+        control.reset(new CCheckQueueControl<CTxCheck>(&txcheckqueue));
+        control->Add(vChecks);
+    }
+
+    /** The index of the first transaction failing the checks, vtx.size() if none does */
+    size_t Finish()
+    {
+        if (control)
+            control->Wait();
+        for (size_t i = 0; i < vtx.size(); i++) {
+            if (!vResult[i])
+                CTxCheck(vtx[i], &vState[i], &vSigOps[i], &vResult[i])();
+            if (vResult[i] != 1)
+                return i;
+        }
+        return vtx.size();
+    }
+
+    unsigned int GetSigOpCount() const
+    {
+        unsigned int nSigOps = 0;
+        for (unsigned int n : vSigOps)
+            nSigOps += n;
+        return nSigOps;
+    }
+};
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2320,48 +3464,130 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChain& chain, bool fJustCheck)
+/**
+ * Whether scripts and JoinSplit proofs of this block need to be verified,
+ * or whether it is covered by the checkpoints or by -assumevalid.
+ */
+static bool ExpensiveChecksNeeded(const CBlockIndex* pindex, const CChainParams& chainparams)
 {
-    const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
 
-    bool fExpensiveChecks = true;
     if (fCheckpointsEnabled) {
         CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
         if (pindexLastCheckpoint && pindexLastCheckpoint->GetAncestor(pindex->nHeight) == pindex) {
             // This block is an ancestor of a checkpoint: disable script checks
-            fExpensiveChecks = false;
+            return false;
         }
     }
 
-    auto verifier = libzcash::ProofVerifier::Strict();
-    auto disabledVerifier = libzcash::ProofVerifier::Disabled();
-
-    // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
-        return false;
-
-    // verify that the view's current state corresponds to the previous block
-    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
-    assert(hashPrevBlock == view.GetBestBlock());
-
-    // Special case for the genesis block, skipping connection of its transactions
-    // (its coinbase is unspendable)
-    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck) {
-            view.SetBestBlock(pindex->GetBlockHash());
-            // Before the genesis block, there was an empty tree
-            ZCIncrementalMerkleTree tree;
-            pindex->hashAnchor = tree.root();
-            // The genesis block contained no JoinSplits
-            pindex->hashAnchorEnd = pindex->hashAnchor;
+    if (!hashAssumeValid.IsNull()) {
+        // This block is a member of the assumed-valid chain and an ancestor
+        // of the best header: skip script and proof checks, but still
+        // connect the transactions so the UTXO set, nullifiers and anchors
+        // are fully maintained. Blocks that are close to the best header
+        // (in terms of equivalent proof of work) are always verified, so
+        // a stale -assumevalid is harmless.
+        BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end() && pindexBestHeader != NULL) {
+            if (it->second->GetAncestor(pindex->nHeight) == pindex &&
+                pindexBestHeader->GetAncestor(pindex->nHeight) == pindex) {
+                return (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= ASSUMEVALID_MIN_DEPTH_TIME);
+            }
         }
-        return true;
     }
 
-    // Do not allow blocks that contain transactions which 'overwrite' older transactions,
-    // unless those are already completely spent.
-    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+    return true;
+}
+
+/**
+ * Add the address and spent index entries of the transaction at position nTx
+ * of a block at nHeight. Its inputs must not have been spent in view yet.
+ */
+static void CollectIndexEntries(const CTransaction& tx, unsigned int nTx, int nHeight, const CCoinsViewCache& view,
+                                std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex,
+                                std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >& vSpentIndex)
+{
+    const uint256& hash = tx.GetHash();
+    uint8_t addressType;
+    uint160 addressHash;
+
+    if (!tx.IsCoinBase()) {
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const COutPoint& prevout = tx.vin[j].prevout;
+            const CCoins* coins = view.AccessCoins(prevout.hash);
+            assert(coins && coins->IsAvailable(prevout.n));
+            const CTxOut& prev = coins->vout[prevout.n];
+            bool fHaveAddress = GetAddressIndexHash(prev.scriptPubKey, addressType, addressHash);
+            if (fAddressIndex && fHaveAddress)
+                vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, addressHash, nHeight, nTx, hash, j, true), -prev.nValue));
+            if (fSpentIndex)
+                vSpentIndex.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n),
+                                                     CSpentIndexValue(hash, j, coins->nHeight, prev.nValue, addressType, addressHash)));
+        }
+    }
+
+    if (fAddressIndex) {
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            if (GetAddressIndexHash(tx.vout[k].scriptPubKey, addressType, addressHash))
+                vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, addressHash, nHeight, nTx, hash, k, false), tx.vout[k].nValue));
+        }
+    }
+}
+
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, const CChain& chain, bool fJustCheck,
+                  CBlockConnectStats* pstats)
+{
+    const CChainParams& chainparams = Params();
+    AssertLockHeld(cs_main);
+    int64_t nTimeCheckStart = GetTimeMicros();
+
+    bool fExpensiveChecks = ExpensiveChecksNeeded(pindex, chainparams);
+
+    // The proofs of a block may have been verified on a pre-validation thread,
+    // and the scripts and proofs of a block made of the transactions of one of
+    // our templates were checked on its parent already.
+    bool fProofChecks = fExpensiveChecks && !block.fProofsChecked;
+    bool fScriptChecks = fExpensiveChecks && !block.fScriptsChecked;
+    // When proofs are checked in parallel, CheckBlock skips them and they are
+    // queued on proofcheckqueue while the transactions are connected below.
+    bool fParallelProofs = fProofChecks && fParallelProofCheck && nScriptCheckThreads;
+
+    // Otherwise the PHGR proofs of the whole block are accumulated and checked at once
+    auto verifier = libzcash::ProofVerifier::Batch();
+    auto disabledVerifier = libzcash::ProofVerifier::Disabled();
+
+    // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
+    if (!CheckBlock(block, state, (fProofChecks && !fParallelProofs) ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
+        return false;
+    if (!verifier.verifyBatch())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    if (fProofChecks && !fParallelProofs)
+        block.fProofsChecked = true;
+    if (pstats)
+        pstats->vPhaseMicros[CONNECT_PHASE_CHECK] += GetTimeMicros() - nTimeCheckStart;
+
+    // verify that the view's current state corresponds to the previous block
+    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
+    assert(hashPrevBlock == view.GetBestBlock());
+
+    // Special case for the genesis block, skipping connection of its transactions
+    // (its coinbase is unspendable)
+    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
+        if (!fJustCheck) {
+            view.SetBestBlock(pindex->GetBlockHash());
+            // Before the genesis block, there was an empty tree
+            ZCIncrementalMerkleTree tree;
+            pindex->hashAnchor = tree.root();
+            // The genesis block contained no JoinSplits
+            pindex->hashAnchorEnd = pindex->hashAnchor;
+        }
+        return true;
+    }
+
+    // Do not allow blocks that contain transactions which 'overwrite' older transactions,
+    // unless those are already completely spent.
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
         const CCoins* coins = view.AccessCoins(tx.GetHash());
         if (coins && !coins->IsPruned())
             return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
@@ -2379,7 +3605,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    // Queued script checks point into this, so it must never reallocate
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size());
+    CCriticalBlock lockProofQueue(fParallelProofs ? &cs_proofcheckqueue : NULL, "cs_proofcheckqueue", __FILE__, __LINE__);
+    CCheckQueueControl<CProofCheck> proofcontrol(fParallelProofs ? &proofcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -2389,6 +3620,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
 
     // Construct the incremental merkle tree at the current
     // block position,
@@ -2407,11 +3640,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // match what we asked for.
         assert(tree.root() == old_tree_root);
     }
+    std::vector<uint256> vCommitments;
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
 
+        if (fParallelProofs && !tx.vjoinsplit.empty()) {
+            std::vector<CProofCheck> vProofChecks;
+            vProofChecks.reserve(tx.vjoinsplit.size());
+            for (unsigned int js = 0; js < tx.vjoinsplit.size(); js++)
+                vProofChecks.push_back(CProofCheck(tx, js));
+            proofcontrol.Add(vProofChecks);
+        }
+
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
         if (nSigOps > MAX_BLOCK_SIGOPS)
@@ -2439,12 +3681,19 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
+            // Kept until the script check threads are done with them
+            if (fScriptChecks)
+                txdata.emplace_back(tx);
             std::vector<CScriptCheck> vChecks;
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, chain, flags, false, chainparams.GetConsensus(), nScriptCheckThreads ? &vChecks : NULL))
+            if (!ContextualCheckInputs(tx, state, view, fScriptChecks, chain, flags, false, chainparams.GetConsensus(), nScriptCheckThreads ? &vChecks : NULL,
+                                       fScriptChecks ? &txdata.back() : NULL))
                 return false;
             control.Add(vChecks);
         }
 
+        if (!fJustCheck && (fAddressIndex || fSpentIndex))
+            CollectIndexEntries(tx, i, pindex->nHeight, view, vAddressIndex, vSpentIndex);
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2452,17 +3701,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
-            BOOST_FOREACH(const uint256 &note_commitment, joinsplit.commitments) {
-                // Insert the note commitments into our temporary tree.
-
-                tree.append(note_commitment);
-            }
+            // The note commitments go into our temporary tree all at once
+            vCommitments.insert(vCommitments.end(), joinsplit.commitments.begin(), joinsplit.commitments.end());
         }
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        pos.nTxOffset += tx.GetTotalSize();
     }
 
+    tree.append_range(vCommitments.begin(), vCommitments.end());
     view.PushAnchor(tree);
     if (!fJustCheck) {
         pindex->hashAnchorEnd = tree.root();
@@ -2481,8 +3728,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, false);
+    int64_t nTimeScripts = GetTimeMicros();
+    if (!proofcontrol.Wait())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+    if (fParallelProofs)
+        block.fProofsChecked = true;
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
+    if (pstats) {
+        pstats->vPhaseMicros[CONNECT_PHASE_INPUTS] += nTime1 - nTimeStart;
+        pstats->vPhaseMicros[CONNECT_PHASE_SCRIPTS] += nTimeScripts - nTime1;
+        pstats->vPhaseMicros[CONNECT_PHASE_PROOFS] += nTime2 - nTimeScripts;
+        pstats->nInputs += nInputs;
+    }
 
     if (fJustCheck)
         return true;
@@ -2505,11 +3764,28 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
         setDirtyBlockIndex.insert(pindex);
     }
+    int64_t nTimeUndo = GetTimeMicros();
 
     if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
+        if (fCompactTxIndex ? !pblocktree->WriteCompactTxIndex(vPos, pindex->nHeight) : !pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (fBlockFilterIndex)
+        if (!pblocktree->WriteBlockFilter(CBlockFilter(block, blockundo)))
+            return AbortNode(state, "Failed to write block filter index");
+
+    if (fAddressIndex)
+        if (!pblocktree->WriteAddressIndex(vAddressIndex))
+            return AbortNode(state, "Failed to write address index");
+
+    if (fSpentIndex)
+        if (!pblocktree->UpdateSpentIndex(vSpentIndex))
+            return AbortNode(state, "Failed to write spent index");
+
+    if (fTimestampIndex)
+        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
+            return AbortNode(state, "Failed to write timestamp index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2523,6 +3799,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
+    if (pstats) {
+        pstats->vPhaseMicros[CONNECT_PHASE_UNDO] += nTimeUndo - nTime2;
+        pstats->vPhaseMicros[CONNECT_PHASE_INDEX] += nTime3 - nTimeUndo;
+        pstats->vPhaseMicros[CONNECT_PHASE_CALLBACKS] += nTime4 - nTime3;
+    }
 
     return true;
 }
@@ -2534,6 +3815,54 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+size_t GetCoinCacheLimit(size_t nConfigured, size_t nCacheUsage, int64_t nHeadroom, double dPressure)
+{
+    size_t nLimit = nConfigured;
+    // The cache grows only into the memory left free
+    if (nHeadroom >= 0)
+        nLimit = std::min(nLimit, (size_t)std::max((int64_t)nCacheUsage + nHeadroom - MIN_MEMORY_HEADROOM, (int64_t)0));
+    // Under pressure it hands back half of what it holds, it is flushed to do so
+    if (dPressure >= COIN_CACHE_SHRINK_PRESSURE)
+        nLimit = std::min(nLimit, nCacheUsage / 2);
+    return std::max(nLimit, MIN_COIN_CACHE_USAGE);
+}
+
+/**
+ * Set nCoinCacheUsage to the limit configured for during or after initial
+ * block download, within the memory left. A cache grown during the download
+ * is flushed, and its memory returned to the mempool and the wallet, once the
+ * download is over.
+ */
+size_t GetBlockIndexMemoryUsage(size_t& nSolutionUsage)
+{
+    AssertLockHeld(cs_main);
+    // Entries loaded at startup are allocated in arenas, counted as if one by one
+    size_t nUsage = memusage::DynamicUsage(mapBlockIndex) + memusage::MallocUsage(sizeof(CBlockIndex)) * mapBlockIndex.size();
+    nSolutionUsage = 0;
+    for (BlockMap::const_iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++)
+        nSolutionUsage += it->second->SolutionMemoryUsage();
+    return nUsage + nSolutionUsage;
+}
+
+static void ResizeCoinCache() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    static int64_t nLastResize = 0;
+    int64_t nNow = GetTime();
+    if (!fDynamicCoinCache || nNow < nLastResize + COIN_CACHE_RESIZE_INTERVAL)
+        return;
+    nLastResize = nNow;
+
+    size_t nConfigured = IsInitialBlockDownload() ? nCoinCacheUsageIBD : nCoinCacheUsageSynced;
+    int64_t nHeadroom = GetMemoryHeadroom();
+    double dPressure = GetMemoryPressure();
+    size_t nLimit = GetCoinCacheLimit(nConfigured, pcoinsTip->DynamicMemoryUsage(), nHeadroom, dPressure);
+    // Log only changes of a tenth or more, as the headroom moves all the time
+    if (nLimit * 10 < nCoinCacheUsage * 9 || nLimit * 9 > nCoinCacheUsage * 10)
+        LogPrintf("%s: coins cache limit %.1fMiB (configured %.1fMiB, headroom %.1fMiB, pressure %.2f)\n", __func__,
+            nLimit * (1.0 / 1024 / 1024), nConfigured * (1.0 / 1024 / 1024), nHeadroom * (1.0 / 1024 / 1024), dPressure);
+    nCoinCacheUsage = nLimit;
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -2544,6 +3873,7 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK2(cs_main, cs_LastBlockFile);
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
+    static int64_t nLastCoinsWrite = 0;
     static int64_t nLastSetChain = 0;
     std::set<int> setFilesToPrune;
     bool fFlushForPrune = false;
@@ -2568,9 +3898,13 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastFlush == 0) {
         nLastFlush = nNow;
     }
+    if (nLastCoinsWrite == 0) {
+        nLastCoinsWrite = nNow;
+    }
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
+    ResizeCoinCache();
     size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
@@ -2582,13 +3916,19 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    // Once synced, the modified coins are written every few minutes and stay cached, so that a
+    // shutdown, or a restart after a crash, has only the last few minutes of blocks to write or
+    // connect again. During the initial block download most coins are spent before they are written.
+    bool fCoinsWrite = !fDoFullFlush && mode == FLUSH_STATE_PERIODIC && nCoinsWriteInterval > 0 &&
+                       nNow > nLastCoinsWrite + nCoinsWriteInterval * 1000000 && !IsInitialBlockDownload();
     // Write blocks and block index to disk.
-    if (fDoFullFlush || fPeriodicWrite) {
+    if (fDoFullFlush || fPeriodicWrite || fCoinsWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
-        FlushBlockFile();
+        if (!FlushBlockFile())
+            return AbortNode(state, "Failed to write block or undo data");
         // Then update all block file information (which may refer to block and undo files).
         {
             std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -2597,15 +3937,17 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 vFiles.push_back(make_pair(*it, &vinfoBlockFile[*it]));
                 setDirtyFileInfo.erase(it++);
             }
-            std::vector<const CBlockIndex*> vBlocks;
-            vBlocks.reserve(setDirtyBlockIndex.size());
-            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                vBlocks.push_back(*it);
-                setDirtyBlockIndex.erase(it++);
-            }
+            std::vector<CBlockIndex*> vDirtyBlocks(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+            if (fCheckBlockIndex && nCheckBlockIndexSample < 100)
+                setBlockIndexUnchecked.insert(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+            setDirtyBlockIndex.clear();
+            std::vector<const CBlockIndex*> vBlocks(vDirtyBlocks.begin(), vDirtyBlocks.end());
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // Once written, the solutions are read back from the database when needed
+            for (CBlockIndex* pindex : vDirtyBlocks)
+                pindex->TrimSolution();
         }
         // Finally remove any pruned files
         if (fFlushForPrune)
@@ -2621,11 +3963,28 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // overwrite one. Still, use a conservative safety factor of 2.
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Flush the chainstate (which may refer to block index entries). Unless
+        // everything is asked for, the most recently used coins stay cached, the
+        // outputs just created are likely spent soon.
+        bool fFlushed = (mode == FLUSH_STATE_ALWAYS) ? pcoinsTip->Flush() :
+                        pcoinsTip->WriteBack(nCoinCacheUsage / 100 * COIN_CACHE_KEEP_PERCENT);
+        if (!fFlushed)
+            return AbortNode(state, "Failed to write to coin database");
+        // A background flush only has to be complete when we are asked to
+        // write everything, or when pruning.
+        if (pcoinsflush && (mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsflush->Sync())
             return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
+        nLastCoinsWrite = nNow;
+    } else if (fCoinsWrite) {
+        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            return state.Error("out of disk space");
+        if (!pcoinsTip->WriteDirty())
+            return AbortNode(state, "Failed to write to coin database");
+        nLastCoinsWrite = nNow;
     }
+    if (fDoFullFlush || fPeriodicWrite || fCoinsWrite)
+        flushStateTimes.get(fDoFullFlush ? "full" : fCoinsWrite ? "coins" : "write").observe(GetTimeMicros() - nNow);
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
         // Update best block in wallet (so we can detect restored wallets).
         GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -2648,10 +4007,71 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return std::atomic_load(&pchainTipSnapshot);
+}
+
+/**
+ * Guards the solutions of the block index entries against being freed while
+ * they are copied: the headers are read without cs_main, by REST among others,
+ * while FlushStateToDisk trims them under it.
+ */
+static CCriticalSection cs_blocksolutions;
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    {
+        LOCK(cs_blocksolutions);
+        if (HasSolution())
+            return nSolution;
+    }
+    std::vector<unsigned char> solution;
+    if (!pblocktree->ReadBlockSolution(GetBlockHash(), solution))
+        throw std::runtime_error(strprintf("%s: cannot read the solution of block %s", __func__, GetBlockHash().ToString()));
+    return solution;
+}
+
+void CBlockIndex::TrimSolution()
+{
+    AssertLockHeld(cs_main);
+    std::vector<unsigned char> solution;
+    {
+        LOCK(cs_blocksolutions);
+        solution.swap(nSolution);
+    }
+}
+
+/** Move the tip of chainActive and publish it to GetChainTipSnapshot */
+static void SetActiveTip(CBlockIndex *pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    chainActive.SetTip(pindex);
+    std::shared_ptr<CChainTipSnapshot> snapshot = std::make_shared<CChainTipSnapshot>();
+    if (pindex) {
+        const CChainParams& chainparams = Params();
+        snapshot->pindex = pindex;
+        snapshot->nHeight = pindex->nHeight;
+        snapshot->hashBlock = pindex->GetBlockHash();
+        snapshot->nMedianTimePast = pindex->GetMedianTimePast();
+        snapshot->nChainWork = pindex->nChainWork;
+        snapshot->nBits = pindex->nBits;
+        snapshot->nNextBits = GetNextWorkRequired(pindex, NULL, chainparams.GetConsensus());
+        snapshot->nNetworkSolPS = GetNetworkSolPS(pindex, DEFAULT_NETWORK_SOLPS_LOOKUP, chainparams.GetConsensus());
+        snapshot->nAveragingWindowSolPS = GetNetworkSolPS(pindex, 0, chainparams.GetConsensus());
+        snapshot->dVerificationProgress = Checkpoints::GuessVerificationProgress(chainparams.Checkpoints(), pindex);
+        snapshot->nChainSproutValue = pindex->nChainSproutValue;
+        // pcoinsTip is at the new tip whenever it moves
+        ZCIncrementalMerkleTree tree;
+        if (pcoinsTip && pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), tree))
+            snapshot->nCommitments = tree.size();
+    }
+    std::atomic_store(&pchainTipSnapshot, std::shared_ptr<const CChainTipSnapshot>(snapshot));
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
-    chainActive.SetTip(pindexNew);
+    SetActiveTip(pindexNew);
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -2712,65 +4132,226 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     }
 }
 
-/** Disconnect chainActive's tip. */
-bool static DisconnectTip(CValidationState &state) {
-    CBlockIndex *pindexDelete = chainActive.Tip();
-    assert(pindexDelete);
+/**
+ * Disconnect the blocks of vpindex, chainActive's tip first and each the parent of the one
+ * before. Their blocks and undo data are read ahead in file order, they are disconnected
+ * into one cache layer over pcoinsTip that is flushed once, and the mempool is updated once
+ * for all of them.
+ */
+static bool DisconnectTips(CValidationState &state, const std::vector<CBlockIndex*>& vpindex)
+{
+    assert(!vpindex.empty() && vpindex[0] == chainActive.Tip());
     mempool.check(pcoinsTip);
-    // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete))
-        return AbortNode(state, "Failed to read block");
-    // Apply the block atomically to the chain state.
-    uint256 anchorBeforeDisconnect = pcoinsTip->GetBestAnchor();
+
+    // Read the undo data, then the blocks, in the order they are stored in
+    std::vector<size_t> vOrder(vpindex.size());
+    for (size_t i = 0; i < vOrder.size(); i++)
+        vOrder[i] = i;
+    std::vector<CBlockUndo> vBlockUndo(vpindex.size());
+    std::sort(vOrder.begin(), vOrder.end(), [&vpindex](size_t a, size_t b) {
+        return std::make_pair(vpindex[a]->nFile, vpindex[a]->nUndoPos) < std::make_pair(vpindex[b]->nFile, vpindex[b]->nUndoPos);
+    });
+    for (size_t i : vOrder) {
+        if (!ReadBlockUndo(vBlockUndo[i], vpindex[i]))
+            return error("DisconnectTip(): DisconnectBlock %s failed", vpindex[i]->GetBlockHash().ToString());
+    }
+    std::vector<CBlock> vBlock(vpindex.size());
+    std::sort(vOrder.begin(), vOrder.end(), [&vpindex](size_t a, size_t b) {
+        return std::make_pair(vpindex[a]->nFile, vpindex[a]->nDataPos) < std::make_pair(vpindex[b]->nFile, vpindex[b]->nDataPos);
+    });
+    for (size_t i : vOrder) {
+        if (!ReadBlockFromDisk(vBlock[i], vpindex[i]))
+            return AbortNode(state, "Failed to read block");
+    }
+
+    // The best anchors of the blocks that change it, mempool transactions anchored to them go
+    std::vector<uint256> vAnchorsRemoved;
+    size_t nDisconnected = 0;
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
-            return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        for (; nDisconnected < vpindex.size(); nDisconnected++) {
+            CBlockIndex* pindexDelete = vpindex[nDisconnected];
+            const CBlock& block = vBlock[nDisconnected];
+            // Apply the block atomically to the chain state.
+            uint256 anchorBeforeDisconnect = view.GetBestAnchor();
+            {
+                CCoinsViewCache viewBlock(&view);
+                if (!DisconnectBlock(block, vBlockUndo[nDisconnected], state, pindexDelete, viewBlock, NULL, true)) {
+                    error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+                    break;
+                }
+                assert(viewBlock.Flush());
+            }
+            if (view.GetBestAnchor() != anchorBeforeDisconnect)
+                vAnchorsRemoved.push_back(anchorBeforeDisconnect);
+            // Update chainActive and related variables.
+            UpdateTip(pindexDelete->pprev);
+            // Get the current commitment tree
+            ZCIncrementalMerkleTree newTree;
+            assert(view.GetAnchorAt(view.GetBestAnchor(), newTree));
+            // Let wallets know transactions went from 1-confirmed to
+            // 0-confirmed or conflicted, and update cached incremental witnesses
+            GetMainSignals().BlockDisconnected(block, pindexDelete, newTree);
+        }
+        // The blocks disconnected before a failure stay so, chainActive matches them
         assert(view.Flush());
     }
-    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
-    uint256 anchorAfterDisconnect = pcoinsTip->GetBestAnchor();
+    LogPrint("bench", "- Disconnect %u blocks: %.2fms\n", nDisconnected, (GetTimeMicros() - nStart) * 0.001);
+    if (nDisconnected == 0)
+        return false;
+
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
-    // Resurrect mempool transactions from the disconnected block.
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        // ignore validation errors in resurrected transactions
-        list<CTransaction> removed;
-        CValidationState stateDummy;
-        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
-            mempool.remove(tx, removed, true);
-    }
-    if (anchorBeforeDisconnect != anchorAfterDisconnect) {
-        // The anchor may not change between block disconnects,
-        // in which case we don't want to evict from the mempool yet!
-        mempool.removeWithAnchor(anchorBeforeDisconnect);
-    }
-    mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
+    // Resurrect mempool transactions from the disconnected blocks, the oldest block
+    // first so that transactions come after those they spend
+    for (size_t i = nDisconnected; i-- > 0;) {
+        BOOST_FOREACH(const CTransaction &tx, vBlock[i].vtx) {
+            // ignore validation errors in resurrected transactions
+            list<CTransaction> removed;
+            CValidationState stateDummy;
+            if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+                mempool.remove(tx, removed, true, MPR_REORG);
+        }
+    }
+    // The anchor may not change between block disconnects,
+    // in which case we don't want to evict from the mempool yet!
+    for (const uint256& anchor : vAnchorsRemoved)
+        mempool.removeWithAnchor(anchor);
+    // Coinbases mature least at the lowest height disconnected
+    mempool.removeCoinbaseSpends(pcoinsTip, vpindex[nDisconnected - 1]->nHeight);
     mempool.check(pcoinsTip);
-    // Update chainActive and related variables.
-    UpdateTip(pindexDelete->pprev);
-    // Get the current commitment tree
-    ZCIncrementalMerkleTree newTree;
-    assert(pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), newTree));
-    // Let wallets know transactions went from 1-confirmed to
-    // 0-confirmed or conflicted:
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        SyncWithWallets(tx, NULL);
-    }
-    // Update cached incremental witnesses
-    GetMainSignals().ChainTip(pindexDelete, &block, newTree, false);
+    return nDisconnected == vpindex.size();
+}
+
+/** Disconnect chainActive's tip down to pindexFork, MAX_DISCONNECT_BATCH_BLOCKS blocks at a time. */
+static bool DisconnectTipsTo(CValidationState &state, const CBlockIndex* pindexFork)
+{
+    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
+        std::vector<CBlockIndex*> vpindex;
+        for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex != pindexFork && vpindex.size() < MAX_DISCONNECT_BATCH_BLOCKS; pindex = pindex->pprev)
+            vpindex.push_back(pindex);
+        if (!DisconnectTips(state, vpindex))
+            return false;
+    }
     return true;
 }
 
+/** Disconnect chainActive's tip. */
+bool static DisconnectTip(CValidationState &state) {
+    return DisconnectTips(state, std::vector<CBlockIndex*>(1, chainActive.Tip()));
+}
+
+CBlockConnectStats::CBlockConnectStats() : nHeight(0), nTime(0), nTx(0), nInputs(0), nOutputs(0), nJoinSplits(0), nSize(0)
+{
+    std::fill(vPhaseMicros, vPhaseMicros + CONNECT_PHASE_COUNT, 0);
+}
+
+CBlockConnectTotals::CBlockConnectTotals() : nBlocks(0)
+{
+    std::fill(vTotalMicros, vTotalMicros + CONNECT_PHASE_COUNT, 0);
+    std::fill(vMaxMicros, vMaxMicros + CONNECT_PHASE_COUNT, 0);
+}
+
+const char* GetBlockConnectPhaseName(int phase)
+{
+    switch (phase) {
+    case CONNECT_PHASE_LOAD:       return "load";
+    case CONNECT_PHASE_PREFETCH:   return "prefetch";
+    case CONNECT_PHASE_CHECK:      return "check";
+    case CONNECT_PHASE_INPUTS:     return "inputs";
+    case CONNECT_PHASE_SCRIPTS:    return "scripts";
+    case CONNECT_PHASE_PROOFS:     return "proofs";
+    case CONNECT_PHASE_UNDO:       return "undo";
+    case CONNECT_PHASE_INDEX:      return "index";
+    case CONNECT_PHASE_CALLBACKS:  return "callbacks";
+    case CONNECT_PHASE_FLUSH:      return "flush";
+    case CONNECT_PHASE_CHAINSTATE: return "chainstate";
+    case CONNECT_PHASE_MEMPOOL:    return "mempool";
+    case CONNECT_PHASE_WALLET:     return "wallet";
+    case CONNECT_PHASE_TOTAL:      return "total";
+    default:                       return "unknown";
+    }
+}
+
+//! Stats of the most recently connected blocks, newest last, and their totals since startup; guarded by cs_main
+static std::deque<CBlockConnectStats> dequeBlockConnectStats;
+static CBlockConnectTotals blockConnectTotals;
+
+static void RecordBlockConnectStats(CBlockConnectStats& stats, const CBlock& block, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    stats.hash = pindex->GetBlockHash();
+    stats.nHeight = pindex->nHeight;
+    stats.nTime = GetTime();
+    stats.nTx = block.vtx.size();
+    stats.nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        stats.nOutputs += tx.vout.size();
+        stats.nJoinSplits += tx.vjoinsplit.size();
+    }
+
+    blockConnectTotals.nBlocks++;
+    for (int phase = 0; phase < CONNECT_PHASE_COUNT; phase++) {
+        blockConnectTotals.vTotalMicros[phase] += stats.vPhaseMicros[phase];
+        blockConnectTotals.vMaxMicros[phase] = std::max(blockConnectTotals.vMaxMicros[phase], stats.vPhaseMicros[phase]);
+        connectBlockTimes.get(GetBlockConnectPhaseName(phase)).observe(stats.vPhaseMicros[phase]);
+    }
+
+    dequeBlockConnectStats.push_back(stats);
+    if (dequeBlockConnectStats.size() > BLOCK_CONNECT_STATS_SIZE)
+        dequeBlockConnectStats.pop_front();
+}
+
+void GetBlockConnectStats(size_t nCount, std::vector<CBlockConnectStats>& vRecent, CBlockConnectTotals& totals)
+{
+    LOCK(cs_main);
+    nCount = std::min(nCount, dequeBlockConnectStats.size());
+    vRecent.assign(dequeBlockConnectStats.rbegin(), dequeBlockConnectStats.rbegin() + nCount);
+    totals = blockConnectTotals;
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
 
+/**
+ * Read what a block looks up in the chainstate into the tip cache, from the
+ * database on nPrefetchThreads threads at once, rather than one read at a
+ * time as ConnectBlock reaches each input: the coins of its inputs and of
+ * its own transactions (for the BIP30 check), its nullifiers and the anchors
+ * its JoinSplits refer to.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    std::vector<uint256> vTxids, vNullifiers, vAnchors;
+    std::set<uint256> setBlockTxids;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        vTxids.push_back(tx.GetHash());
+        setBlockTxids.insert(tx.GetHash());
+    }
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            // Outputs created earlier in the block are not in the database
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                if (!setBlockTxids.count(txin.prevout.hash))
+                    vTxids.push_back(txin.prevout.hash);
+        }
+        BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
+            vNullifiers.insert(vNullifiers.end(), joinsplit.nullifiers.begin(), joinsplit.nullifiers.end());
+            vAnchors.push_back(joinsplit.anchor);
+        }
+    }
+    std::sort(vTxids.begin(), vTxids.end());
+    vTxids.erase(std::unique(vTxids.begin(), vTxids.end()), vTxids.end());
+    std::sort(vAnchors.begin(), vAnchors.end());
+    vAnchors.erase(std::unique(vAnchors.begin(), vAnchors.end()), vAnchors.end());
+    pcoinsTip->Prefetch(vTxids, vNullifiers, vAnchors, nPrefetchThreads);
+}
+
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
@@ -2793,9 +4374,17 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    CBlockConnectStats stats;
+    stats.vPhaseMicros[CONNECT_PHASE_LOAD] = nTime2 - nTime1;
+    if (nPrefetchThreads > 0) {
+        PrefetchBlockInputs(*pblock);
+        int64_t nTimePrefetch = GetTimeMicros();
+        stats.vPhaseMicros[CONNECT_PHASE_PREFETCH] = nTimePrefetch - nTime2;
+        nTime2 = nTimePrefetch;
+    }
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainActive);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainActive, false, &stats);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2803,40 +4392,41 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(pindexNew->GetBlockHash());
+        CacheBlockMessage(*pblock);
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
+    stats.vPhaseMicros[CONNECT_PHASE_FLUSH] = nTime4 - nTime3;
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    stats.vPhaseMicros[CONNECT_PHASE_CHAINSTATE] = nTime5 - nTime4;
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    int64_t nTimeMempool = GetTimeMicros();
+    stats.vPhaseMicros[CONNECT_PHASE_MEMPOOL] = nTimeMempool - nTime5;
     // Tell wallet about transactions that went from mempool
-    // to conflicted:
-    BOOST_FOREACH(const CTransaction &tx, txConflicted) {
-        SyncWithWallets(tx, NULL);
-    }
-    // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
-        SyncWithWallets(tx, pblock);
-    }
-    // Update cached incremental witnesses
-    GetMainSignals().ChainTip(pindexNew, pblock, oldTree, true);
+    // to conflicted and about transactions that got confirmed, and
+    // update cached incremental witnesses, all in one go
+    GetMainSignals().BlockConnected(*pblock, pindexNew, std::vector<CTransaction>(txConflicted.begin(), txConflicted.end()), oldTree);
 
     EnforceNodeDeprecation(pindexNew->nHeight);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    stats.vPhaseMicros[CONNECT_PHASE_WALLET] = nTime6 - nTimeMempool;
+    stats.vPhaseMicros[CONNECT_PHASE_TOTAL] = nTime6 - nTime1;
+    RecordBlockConnectStats(stats, *pblock, pindexNew);
     return true;
 }
 
@@ -2923,10 +4513,8 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
     // Disconnect active blocks which are no longer in the best chain.
-    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state))
-            return false;
-    }
+    if (!DisconnectTipsTo(state, pindexFork))
+        return false;
 
     // Build list of new blocks to connect.
     std::vector<CBlockIndex*> vpindexToConnect;
@@ -2989,8 +4577,11 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
     CBlockIndex *pindexNewTip = NULL;
     CBlockIndex *pindexMostWork = NULL;
     const CChainParams& chainParams = Params();
+    int nStopAtHeight = GetArg("-stopatheight", DEFAULT_STOPATHEIGHT);
     do {
         boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
 
         bool fInitialDownload;
         {
@@ -3024,7 +4615,7 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
                 {
                     if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
                     {
-                        pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                        pnode->PushBlockHash(hashNewTip);
                     }
                     else
                     {
@@ -3049,6 +4640,10 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
             LogPrint("forks", "%s():%d - InitialDownload in progress: NOT pushing any inv\n", __func__, __LINE__);
         }
 
+        if (nStopAtHeight && pindexNewTip && pindexNewTip->nHeight >= nStopAtHeight) {
+            LogPrintf("%s: reached -stopatheight=%d, shutting down\n", __func__, nStopAtHeight);
+            StartShutdown();
+        }
     } while(pindexMostWork != chainActive.Tip());
     CheckBlockIndex();
 
@@ -3127,6 +4722,72 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
+void CGlobalForkTips::clear()
+{
+    mapTips.clear();
+    setByAccessTime.clear();
+    nVersion++;
+}
+
+bool CGlobalForkTips::insert(const CBlockIndex* pindex, int nTime)
+{
+    if (!mapTips.insert(std::make_pair(pindex, nTime)).second)
+        return false;
+    setByAccessTime.insert(std::make_pair(nTime, pindex));
+    nVersion++;
+    return true;
+}
+
+size_t CGlobalForkTips::erase(const CBlockIndex* pindex)
+{
+    BlockTimeMap::iterator it = mapTips.find(pindex);
+    if (it == mapTips.end())
+        return 0;
+    setByAccessTime.erase(std::make_pair(it->second, pindex));
+    mapTips.erase(it);
+    nVersion++;
+    return 1;
+}
+
+void CGlobalForkTips::touch(const CBlockIndex* pindex, int nTime)
+{
+    BlockTimeMap::iterator it = mapTips.find(pindex);
+    assert(it != mapTips.end());
+    setByAccessTime.erase(std::make_pair(it->second, pindex));
+    it->second = nTime;
+    setByAccessTime.insert(std::make_pair(nTime, pindex));
+}
+
+int CGlobalForkTips::GetAccessTime(const CBlockIndex* pindex) const
+{
+    BlockTimeMap::const_iterator it = mapTips.find(pindex);
+    assert(it != mapTips.end());
+    return it->second;
+}
+
+std::vector<const CBlockIndex*> CGlobalForkTips::GetDescendants(const CBlockIndex* pindex) const
+{
+    std::vector<const CBlockIndex*> vTips;
+    // Tips are ordered by decreasing height, the lower ones cannot descend from pindex
+    for (const_iterator it = mapTips.begin(); it != mapTips.end() && it->first->nHeight > pindex->nHeight; ++it)
+    {
+        if (it->first->GetAncestor(pindex->nHeight) == pindex)
+            vTips.push_back(it->first);
+    }
+    return vTips;
+}
+
+int CGlobalForkTips::GetMostRecent(std::vector<uint256>& output, int nMax) const
+{
+    int count = 0;
+    for (std::set<std::pair<int, const CBlockIndex*> >::const_reverse_iterator it = setByAccessTime.rbegin();
+         it != setByAccessTime.rend() && count < nMax; ++it, ++count)
+    {
+        output.push_back(it->second->GetBlockHash());
+    }
+    return output.size();
+}
+
 bool addToGlobalForkTips(const CBlockIndex* pindex)
 {
     if (!pindex)
@@ -3145,7 +4806,7 @@ bool addToGlobalForkTips(const CBlockIndex* pindex)
             __func__, __LINE__, pindex->nHeight, pindex->GetBlockHash().ToString());
     }
 
-    return mGlobalForkTips.insert(std::make_pair( pindex, (int)GetTime() )).second;
+    return mGlobalForkTips.insert(pindex, (int)GetTime());
 }
 
 bool updateGlobalForkTips(const CBlockIndex* pindex, bool lookForwardTips)
@@ -3167,7 +4828,7 @@ bool updateGlobalForkTips(const CBlockIndex* pindex, bool lookForwardTips)
     {
         LogPrint("forks", "%s():%d - updating tip in global set: h(%d) [%s]\n",
             __func__, __LINE__, pindex->nHeight, pindex->GetBlockHash().ToString());
-        mGlobalForkTips[pindex] = (int)GetTime();
+        mGlobalForkTips.touch(pindex, (int)GetTime());
         return true;
     }
     else
@@ -3176,43 +4837,20 @@ bool updateGlobalForkTips(const CBlockIndex* pindex, bool lookForwardTips)
         // update the tip instead (for coping with very old tips not in the most recent set)
         if (lookForwardTips)
         {
-            int h = pindex->nHeight;
             bool done = false;
 
-            BOOST_FOREACH(auto mapPair, mGlobalForkTips)
+            BOOST_FOREACH(const CBlockIndex* tipIndex, mGlobalForkTips.GetDescendants(pindex))
             {
-                const CBlockIndex* tipIndex = mapPair.first;
-                if (!tipIndex)
-                    continue;
-
-                LogPrint("forks", "%s():%d - tip %s h(%d)\n",
-                    __func__, __LINE__, tipIndex->GetBlockHash().ToString(), tipIndex->nHeight);
-
                 if (tipIndex == chainActive.Tip() || tipIndex == pindexBestHeader )
                 {
                     LogPrint("forks", "%s():%d - skipping main chain tip\n", __func__, __LINE__);
                     continue;
                 }
- 
-                const CBlockIndex* dum = tipIndex;
-                while ( dum != pindex && dum->nHeight >= h)
-                {
-                    dum = dum->pprev;
-                }
 
-                if (dum == pindex)
-                {
-                    LogPrint("forks", "%s():%d - updating tip access time in global set: h(%d) [%s]\n",
-                        __func__, __LINE__, tipIndex->nHeight, tipIndex->GetBlockHash().ToString());
-                    mGlobalForkTips[tipIndex] = (int)GetTime();
-                    done |= true;
-                }
-                else
-                {
-                    // we must neglect this branch since not linked to the pindex
-                    LogPrint("forks", "%s():%d - stopped at %s h(%d)\n",
-                        __func__, __LINE__, dum->GetBlockHash().ToString(), dum->nHeight);
-                }
+                LogPrint("forks", "%s():%d - updating tip access time in global set: h(%d) [%s]\n",
+                    __func__, __LINE__, tipIndex->nHeight, tipIndex->GetBlockHash().ToString());
+                mGlobalForkTips.touch(tipIndex, (int)GetTime());
+                done = true;
             }
 
             LogPrint("forks", "%s():%d - exiting done[%d]\n", __func__, __LINE__, done);
@@ -3228,21 +4866,7 @@ bool updateGlobalForkTips(const CBlockIndex* pindex, bool lookForwardTips)
 
 int getMostRecentGlobalForkTips(std::vector<uint256>& output)
 {
-    using map_pair = pair<const CBlockIndex*, int>;
-
-    std::vector<map_pair> vTemp(begin(mGlobalForkTips), end(mGlobalForkTips));
-
-    sort(begin(vTemp), end(vTemp), [](const map_pair& a, const map_pair& b) { return a.second < b.second; });
-
-    int count = MAX_NUM_GLOBAL_FORKS;
-    BOOST_REVERSE_FOREACH(auto const &p, vTemp)
-    {
-        output.push_back(p.first->GetBlockHash() );
-        if (--count <= 0)
-            break;
-    }
-
-    return output.size();
+    return mGlobalForkTips.GetMostRecent(output, MAX_NUM_GLOBAL_FORKS);
 }
 
 CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
@@ -3269,6 +4893,7 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
     }
+    pindexNew->BuildDifficultyCache();
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     if (pindexNew->pprev){
         pindexNew->nChainDelay = pindexNew->pprev->nChainDelay + GetBlockDelay(*pindexNew,*(pindexNew->pprev), chainActive.Height(), fIsStartupSyncing);
@@ -3276,11 +4901,17 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         pindexNew->nChainDelay = 0 ;
     }
     if(pindexNew->nChainDelay != 0) {
-        LogPrintf("%s: Block belong to a chain under punishment Delay VAL: %i BLOCKHEIGHT: %d\n",__func__, pindexNew->nChainDelay,pindexNew->nHeight);
+        // Only tell once per penalised branch, a flood of historic blocks must not flood the log as well
+        if (pindexNew->pprev && pindexNew->pprev->nChainDelay == 0)
+            LogPrintf("%s: Block starts a chain under punishment Delay VAL: %i BLOCKHEIGHT: %d\n",__func__, pindexNew->nChainDelay,pindexNew->nHeight);
+        else
+            LogPrint("forks", "%s: Block belong to a chain under punishment Delay VAL: %i BLOCKHEIGHT: %d\n",__func__, pindexNew->nChainDelay,pindexNew->nHeight);
     }
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
-    if (pindexBestHeader == NULL || (pindexBestHeader->nChainWork < pindexNew->nChainWork && pindexNew->nChainDelay==0))
+    if (pindexBestHeader == NULL || (pindexBestHeader->nChainWork < pindexNew->nChainWork && pindexNew->nChainDelay==0)) {
         pindexBestHeader = pindexNew;
+        nBestHeaderHeight = pindexNew->nHeight;
+    }
 
     setDirtyBlockIndex.insert(pindexNew);
 
@@ -3367,8 +4998,23 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     return true;
 }
 
+/**
+ * Pre-allocation step of the block or undo files: larger while the chain is
+ * downloaded or imported, so that the files grow in fewer, bigger extents.
+ * Pruned nodes keep the small steps, they count against the prune target.
+ */
+static unsigned int GetFileChunkSize(unsigned int nChunkSize)
+{
+    if (!fPruneMode && IsInitialBlockDownload())
+        return nChunkSize * IBD_FILE_CHUNK_FACTOR;
+    return nChunkSize;
+}
+
 bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown)
 {
+    // Before cs_LastBlockFile, IsInitialBlockDownload takes cs_main
+    const unsigned int nChunkSize = GetFileChunkSize(BLOCKFILE_CHUNK_SIZE);
+
     // Currently fKnown is false for blocks coming from network, true for blocks loaded from files upon reindexing
     LOCK(cs_LastBlockFile);
 
@@ -3391,7 +5037,8 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (!fKnown) {
             LogPrintf("Leaving block file %i: %s\n", nFile, vinfoBlockFile.at(nFile).ToString());
         }
-        FlushBlockFile(!fKnown);
+        if (!FlushBlockFile(!fKnown))
+            return AbortNode(state, "Failed to write block or undo data");
         nLastBlockFile = nFile;
     }
 
@@ -3402,16 +5049,16 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         vinfoBlockFile.at(nFile).nSize += nAddSize;
 
     if (!fKnown) {
-        unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
-        unsigned int nNewChunks = (vinfoBlockFile.at(nFile).nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
+        unsigned int nOldChunks = (pos.nPos + nChunkSize - 1) / nChunkSize;
+        unsigned int nNewChunks = (vinfoBlockFile.at(nFile).nSize + nChunkSize - 1) / nChunkSize;
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
+            if (CheckDiskSpace(nNewChunks * nChunkSize - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
-                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
-                    AllocateFileRange(file, pos.nPos, nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos);
+                    LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * nChunkSize, pos.nFile);
+                    AllocateFileRange(file, pos.nPos, nNewChunks * nChunkSize - pos.nPos);
                     fclose(file);
                 }
             }
@@ -3428,6 +5075,8 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
 {
     pos.nFile = nFile;
 
+    const unsigned int nChunkSize = GetFileChunkSize(UNDOFILE_CHUNK_SIZE);
+
     LOCK(cs_LastBlockFile);
 
     unsigned int nNewSize;
@@ -3435,16 +5084,16 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     nNewSize = vinfoBlockFile[nFile].nUndoSize += nAddSize;
     setDirtyFileInfo.insert(nFile);
 
-    unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
-    unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
+    unsigned int nOldChunks = (pos.nPos + nChunkSize - 1) / nChunkSize;
+    unsigned int nNewChunks = (nNewSize + nChunkSize - 1) / nChunkSize;
     if (nNewChunks > nOldChunks) {
         if (fPruneMode)
             fCheckForPruning = true;
-        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
+        if (CheckDiskSpace(nNewChunks * nChunkSize - pos.nPos)) {
             FILE *file = OpenUndoFile(pos);
             if (file) {
-                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
-                AllocateFileRange(file, pos.nPos, nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos);
+                LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * nChunkSize, pos.nFile);
+                AllocateFileRange(file, pos.nPos, nNewChunks * nChunkSize - pos.nPos);
                 fclose(file);
             }
         }
@@ -3455,7 +5104,7 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW, bool fCheckSolution)
 {
     // Check block version
     if (block.nVersion < MIN_BLOCK_VERSION)
@@ -3463,7 +5112,7 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
                          REJECT_INVALID, "version-too-low");
 
     // Check Equihash solution is valid
-    if (fCheckPOW && !CheckEquihashSolution(&block, Params()))
+    if (fCheckPOW && fCheckSolution && !CheckEquihashSolution(&block, Params()))
         return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
                          REJECT_INVALID, "invalid-solution");
 
@@ -3481,11 +5130,22 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
 {
     // These are checks that are independent of context.
 
+    // They may have passed already, e.g. on a block pre-validation thread.
+    // If proofs are requested they must have been verified as well.
+    if (block.fChecked && (block.fProofsChecked || !verifier.isVerificationEnabled()))
+        return true;
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
+    // The context-free checks of the transactions are independent of each
+    // other and of the block as a whole, so they start on the -par threads
+    // now and run while the merkle root, sizes and coinbase are checked here.
+    // Failures are still reported in the order of the serial checks.
+    CBlockTxChecks txChecks(block.vtx);
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
@@ -3520,20 +5180,31 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
             return state.DoS(100, error("CheckBlock(): more than one coinbase"),
                              REJECT_INVALID, "bad-cb-multiple");
 
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
+    // Check transactions; the proofs go through the verifier here, in order,
+    // as it may be batching them
+    size_t nFailed = txChecks.Finish();
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        // Don't count coinbase transactions because mining skews the count
+        if (!tx.IsCoinBase())
+            transactionsValidated.increment();
+        if (i == nFailed) {
+            CheckTransactionWithoutProofVerification(tx, state);
+            return error("CheckBlock(): CheckTransaction failed");
+        }
+        if (!CheckTransactionProofsAndOutputs(tx, state, verifier))
             return error("CheckBlock(): CheckTransaction failed");
-
-    unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(tx);
     }
-    if (nSigOps > MAX_BLOCK_SIGOPS)
+
+    if (txChecks.GetSigOpCount() > MAX_BLOCK_SIGOPS)
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
                          REJECT_INVALID, "bad-blk-sigops", true);
 
+    // Only a full check may be skipped later on. Proofs are marked as
+    // verified by the callers, a batching verifier has not finished yet.
+    if (fCheckPOW && fCheckMerkleRoot)
+        block.fChecked = true;
+
     return true;
 }
 
@@ -3668,7 +5339,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool lookForwardTips)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool lookForwardTips, bool fSolutionChecked)
 {
     dump_global_tips(10);
 
@@ -3692,7 +5363,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, true, !fSolutionChecked))
         return false;
 
     // Get prev block index
@@ -3767,17 +5438,25 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
 
     // Write block to history file
     try {
+        // Blocks reindexed from the block files are accounted at their uncompressed size, never less than they take
         unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        std::vector<char> vCompressed;
+        if (dbp == NULL)
+            CompressBlockForDisk(block, vCompressed);
+        if (!vCompressed.empty())
+            nBlockSize = vCompressed.size();
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
         if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart(), vCompressed))
                 AbortNode(state, "Failed to write block");
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos, sForkTips))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
+        if (dbp == NULL)
+            CacheBlockMessage(block);
     } catch (const std::runtime_error& e) {
         return AbortNode(state, std::string("System error: ") + e.what());
     }
@@ -3810,7 +5489,7 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, bool
 
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
         fRequested |= fForceProcessing;
         if (!checked) {
             return error("%s: CheckBlock FAILED", __func__);
@@ -3836,17 +5515,116 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, bool
     return true;
 }
 
-bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex * const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
+void ProcessBlockFromPeer(CNode* pfrom, CBlock& block)
 {
-    AssertLockHeld(cs_main);
-    assert(pindexPrev == chainActive.Tip());
-
-    CCoinsViewCache viewNew(pcoinsTip);
-    CBlockIndex indexDummy(block);
-    indexDummy.pprev = pindexPrev;
-    indexDummy.nHeight = pindexPrev->nHeight + 1;
-    // JoinSplit proofs are verified in ConnectBlock
-    auto verifier = libzcash::ProofVerifier::Disabled();
+    CValidationState state;
+    // Process all blocks from whitelisted peers, even if not requested,
+    // unless we're still syncing with the network.
+    // Such an unrequested block may still be processed, subject to the
+    // conditions in AcceptBlock().
+    bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+    ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        LogPrint("forks", "%s():%d - Pushing reject, DoS[%d]\n", __func__, __LINE__, nDoS);
+        pfrom->PushMessage("reject", std::string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
+/**
+ * Blocks received from peers that wait for their context-free checks.
+ * Each entry holds a reference on the node it came from.
+ */
+static boost::mutex csPrevalidation;
+static boost::condition_variable condPrevalidation;
+static std::deque<std::pair<CNode*, boost::shared_ptr<CBlock> > > queuePrevalidation;
+int nPrevalidationThreads = 0;
+
+bool QueueBlockForPrevalidation(CNode* pfrom, CBlock& block)
+{
+    if (nPrevalidationThreads == 0)
+        return false;
+
+    boost::unique_lock<boost::mutex> lock(csPrevalidation);
+    if (queuePrevalidation.size() >= MAX_PREVALIDATION_QUEUE_SIZE)
+        return false;
+
+    boost::shared_ptr<CBlock> pblock(new CBlock(std::move(block)));
+    {
+        LOCK(cs_vNodes);
+        pfrom->AddRef();
+    }
+    queuePrevalidation.push_back(std::make_pair(pfrom, pblock));
+    condPrevalidation.notify_one();
+    return true;
+}
+
+void ThreadBlockPrevalidation()
+{
+    RenameThread("horizen-prevalid");
+    JoinThreadPool("validation");
+    const CChainParams& chainparams = Params();
+
+    while (true) {
+        CNode* pfrom;
+        boost::shared_ptr<CBlock> pblock;
+        {
+            boost::unique_lock<boost::mutex> lock(csPrevalidation);
+            while (queuePrevalidation.empty())
+                condPrevalidation.wait(lock);
+            pfrom = queuePrevalidation.front().first;
+            pblock = queuePrevalidation.front().second;
+            queuePrevalidation.pop_front();
+        }
+
+        // Don't spend time on proofs that ConnectBlock would skip anyway
+        bool fVerifyProofs = true;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(pblock->GetHash());
+            if (mi != mapBlockIndex.end())
+                fVerifyProofs = ExpensiveChecksNeeded(mi->second, chainparams);
+        }
+
+        // Merkle root, Equihash solution, transactions and proofs are
+        // checked here without holding cs_main; a failure is reported
+        // again by ProcessNewBlock or ConnectBlock, which take care of
+        // marking the block invalid and punishing the peer.
+        CValidationState state;
+        auto verifier = fVerifyProofs ? libzcash::ProofVerifier::Batch() : libzcash::ProofVerifier::Disabled();
+        if (CheckBlock(*pblock, state, verifier) && fVerifyProofs) {
+            if (verifier.verifyBatch())
+                pblock->fProofsChecked = true;
+            else
+                LogPrint("bench", "%s: joinsplit proofs of block %s do not verify\n", __func__, pblock->GetHash().ToString());
+        }
+
+        // Only the contextual checks and the connection are serialized
+        ProcessBlockFromPeer(pfrom, *pblock);
+
+        {
+            LOCK(cs_vNodes);
+            pfrom->Release();
+        }
+    }
+}
+
+bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex * const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
+{
+    AssertLockHeld(cs_main);
+    assert(pindexPrev == chainActive.Tip());
+
+    CCoinsViewCache viewNew(pcoinsTip);
+    CBlockIndex indexDummy(block);
+    indexDummy.pprev = pindexPrev;
+    indexDummy.nHeight = pindexPrev->nHeight + 1;
+    // JoinSplit proofs are verified in ConnectBlock
+    auto verifier = libzcash::ProofVerifier::Disabled();
 
     // NOTE: CheckBlockHeader is called by CheckBlock
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
@@ -3913,6 +5691,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        ForgetMappedDiskFiles(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3930,7 +5709,11 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune)
         return;
     }
 
-    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    if ((unsigned int)chainActive.Tip()->nHeight <= nPruneKeepBlocks) {
+        return;
+    }
+
+    unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - nPruneKeepBlocks;
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -3949,7 +5732,7 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune)
             if (nCurrentUsage + nBuffer < nPruneTarget)  // are we below our target?
                 break;
 
-            // don't prune files that could have a block within MIN_BLOCKS_TO_KEEP of the main chain's tip but keep scanning
+            // don't prune files that could have a block within nPruneKeepBlocks of the main chain's tip but keep scanning
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
 
@@ -3967,6 +5750,106 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune)
            nLastBlockWeCanPrune, count);
 }
 
+/** Pruned blocks FetchPrunedBlock waits for, with the number of callers waiting for each, and the last ones received */
+static boost::mutex csPrunedBlockFetch;
+static boost::condition_variable condPrunedBlockFetch;
+static std::map<uint256, int> mapPrunedBlocksWanted;
+static std::list<std::pair<uint256, boost::shared_ptr<const CBlock> > > listFetchedPrunedBlocks;
+
+/** A block received by FetchPrunedBlock, NULL if there is none. csPrunedBlockFetch must be held. */
+static boost::shared_ptr<const CBlock> FindFetchedPrunedBlock(const uint256& hash)
+{
+    for (const auto& entry : listFetchedPrunedBlocks)
+        if (entry.first == hash)
+            return entry.second;
+    return boost::shared_ptr<const CBlock>();
+}
+
+/** Ask a peer serving the whole chain, and not in setAsked yet, for a block. Returns false if there is none. */
+static bool AskPeerForPrunedBlock(const uint256& hash, std::set<NodeId>& setAsked)
+{
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes) {
+        if (pnode->fDisconnect || !pnode->fSuccessfullyConnected || !(pnode->nServices & NODE_NETWORK) ||
+            setAsked.count(pnode->GetId()))
+            continue;
+        setAsked.insert(pnode->GetId());
+        pnode->PushMessage("getdata", std::vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+        LogPrint("prune", "Prune: asked peer=%d for pruned block %s\n", pnode->GetId(), hash.ToString());
+        return true;
+    }
+    return false;
+}
+
+bool FetchPrunedBlock(const CBlockIndex* pindex, CBlock& block, int64_t nTimeout)
+{
+    const uint256 hash = pindex->GetBlockHash();
+    std::set<NodeId> setAsked;
+    int64_t nDeadline = GetTimeMillis() + nTimeout * 1000;
+    int64_t nNextAsk = 0;
+
+    boost::unique_lock<boost::mutex> lock(csPrunedBlockFetch);
+    mapPrunedBlocksWanted[hash]++;
+    boost::shared_ptr<const CBlock> pblock;
+    while (!(pblock = FindFetchedPrunedBlock(hash))) {
+        int64_t nNow = GetTimeMillis();
+        if (nNow >= nDeadline)
+            break;
+        if (nNow >= nNextAsk) {
+            lock.unlock();
+            bool fAsked = AskPeerForPrunedBlock(hash, setAsked);
+            lock.lock();
+            // Nobody to ask at all, or nobody left while the ones asked are still given time
+            if (!fAsked && setAsked.empty())
+                break;
+            nNextAsk = nNow + PRUNED_BLOCK_PEER_TIMEOUT * 1000;
+            continue;
+        }
+        condPrunedBlockFetch.timed_wait(lock, boost::posix_time::milliseconds(std::min(nDeadline, nNextAsk) - nNow));
+    }
+    if (--mapPrunedBlocksWanted[hash] == 0)
+        mapPrunedBlocksWanted.erase(hash);
+
+    if (!pblock)
+        return error("%s: no peer sent pruned block %s", __func__, hash.ToString());
+    block = *pblock;
+    return true;
+}
+
+/**
+ * Keep a block FetchPrunedBlock waits for. Returns false if it was not asked
+ * for, it is then processed as any other block.
+ */
+static bool ReceivedPrunedBlock(CNode* pfrom, const CBlock& block)
+{
+    const uint256 hash = block.GetHash();
+    {
+        boost::unique_lock<boost::mutex> lock(csPrunedBlockFetch);
+        if (!mapPrunedBlocksWanted.count(hash))
+            return false;
+        if (FindFetchedPrunedBlock(hash))
+            return true;
+    }
+
+    // The hash ties the header to the index, the merkle root the transactions to the header
+    CValidationState state;
+    auto verifier = libzcash::ProofVerifier::Disabled();
+    if (!CheckBlock(block, state, verifier)) {
+        LogPrint("prune", "Prune: pruned block %s from peer=%d does not check: %s\n", hash.ToString(), pfrom->id, state.GetRejectReason());
+        return true;
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(csPrunedBlockFetch);
+        listFetchedPrunedBlocks.push_front(std::make_pair(hash, boost::shared_ptr<const CBlock>(new CBlock(block))));
+        if (listFetchedPrunedBlocks.size() > MAX_FETCHED_PRUNED_BLOCKS)
+            listFetchedPrunedBlocks.pop_back();
+    }
+    condPrunedBlockFetch.notify_all();
+    LogPrint("prune", "Prune: received pruned block %s from peer=%d\n", hash.ToString(), pfrom->id);
+    return true;
+}
+
 bool CheckDiskSpace(uint64_t nAdditionalBytes)
 {
     uint64_t nFreeBytesAvailable = boost::filesystem::space(GetDataDir()).available;
@@ -4014,6 +5897,39 @@ boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
+/**
+ * The entries InsertBlockIndex creates while loading the block index are
+ * carved out of arenas of BLOCK_INDEX_ARENA_SIZE entries rather than
+ * allocated one by one. Maps the start of each arena to its end.
+ */
+static const size_t BLOCK_INDEX_ARENA_SIZE = 16384;
+static std::map<CBlockIndex*, CBlockIndex*> mapBlockIndexArenas;
+static CBlockIndex* pindexArenaNext = NULL;
+static CBlockIndex* pindexArenaEnd = NULL;
+
+static bool IsArenaBlockIndex(CBlockIndex* pindex)
+{
+    std::map<CBlockIndex*, CBlockIndex*>::const_iterator it = mapBlockIndexArenas.upper_bound(pindex);
+    if (it == mapBlockIndexArenas.begin())
+        return false;
+    --it;
+    return std::less<CBlockIndex*>()(pindex, it->second);
+}
+
+/** Free all entries of mapBlockIndex, whether they live in an arena or not */
+static void DeleteBlockIndexEntries()
+{
+    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
+        if (!IsArenaBlockIndex(entry.second))
+            delete entry.second;
+    }
+    mapBlockIndex.clear();
+    for (std::map<CBlockIndex*, CBlockIndex*>::iterator it = mapBlockIndexArenas.begin(); it != mapBlockIndexArenas.end(); it++)
+        delete[] it->first;
+    mapBlockIndexArenas.clear();
+    pindexArenaNext = pindexArenaEnd = NULL;
+}
+
 CBlockIndex * InsertBlockIndex(uint256 hash)
 {
     if (hash.IsNull())
@@ -4025,15 +5941,21 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    if (pindexArenaNext == pindexArenaEnd) {
+        pindexArenaNext = new CBlockIndex[BLOCK_INDEX_ARENA_SIZE];
+        pindexArenaEnd = pindexArenaNext + BLOCK_INDEX_ARENA_SIZE;
+        mapBlockIndexArenas.insert(make_pair(pindexArenaNext, pindexArenaEnd));
+    }
+    CBlockIndex* pindexNew = pindexArenaNext++;
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+//! Fewest block index entries worth an extra thread computing their work at startup
+static const size_t BLOCK_PROOF_MIN_PER_THREAD = 10000;
+
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
@@ -4042,19 +5964,45 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork. Heights are dense, so the entries are put in
+    // height order with a counting sort.
+    int nMaxHeight = -1;
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<size_t> vHeightStart(nMaxHeight + 2, 0);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (int nHeight = 0; nHeight <= nMaxHeight; nHeight++)
+        vHeightStart[nHeight + 1] += vHeightStart[nHeight];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
+
+    // The work of each block does not depend on the others, so it is
+    // computed in parallel; only the sums have to follow the chain
+    vector<arith_uint256> vBlockProof(vSortedByHeight.size());
+    auto proofWorker = [&](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd; i++)
+            vBlockProof[i] = GetBlockProof(*vSortedByHeight[i]);
+    };
+    size_t nProofThreads = std::min((size_t) std::max(GetNumCores(), 1), vSortedByHeight.size() / BLOCK_PROOF_MIN_PER_THREAD);
+    if (nProofThreads <= 1) {
+        proofWorker(0, vSortedByHeight.size());
+    } else {
+        vector<std::thread> threads;
+        threads.reserve(nProofThreads - 1);
+        const size_t nChunk = (vSortedByHeight.size() + nProofThreads - 1) / nProofThreads;
+        for (size_t nBegin = nChunk; nBegin < vSortedByHeight.size(); nBegin += nChunk)
+            threads.emplace_back(proofWorker, nBegin, std::min(nBegin + nChunk, vSortedByHeight.size()));
+        proofWorker(0, std::min(nChunk, vSortedByHeight.size()));
+        BOOST_FOREACH(std::thread& t, threads)
+            t.join();
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+
+    for (size_t i = 0; i < vSortedByHeight.size(); i++)
     {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        CBlockIndex* pindex = vSortedByHeight[i];
+        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + vBlockProof[i];
         pindex->nChainDelay = 0 ;
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -4083,8 +6031,11 @@ bool static LoadBlockIndexDB()
             pindexBestInvalid = pindex;
         if (pindex->pprev)
             pindex->BuildSkip();
-        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+        pindex->BuildDifficultyCache();
+        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex))) {
             pindexBestHeader = pindex;
+            nBestHeaderHeight = pindex->nHeight;
+        }
 
         addToGlobalForkTips(pindex);
     }
@@ -4129,6 +6080,12 @@ bool static LoadBlockIndexDB()
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether loading a UTXO snapshot was interrupted
+    bool fLoadingTxOutSet = false;
+    pblocktree->ReadFlag("txoutsetload", fLoadingTxOutSet);
+    if (fLoadingTxOutSet)
+        return error("LoadBlockIndexDB(): loading a UTXO snapshot was interrupted, the chain state must be rebuilt with -reindex");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -4140,7 +6097,14 @@ bool static LoadBlockIndexDB()
 
     // Check whether we have a transaction index
     pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("compacttxindex", fCompactTxIndex);
+    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? (fCompactTxIndex ? "enabled, compact" : "enabled") : "disabled");
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("timestampindex", fTimestampIndex);
+    LogPrintf("%s: timestamp index %s\n", __func__, fTimestampIndex ? "enabled" : "disabled");
 
     // Fill in-memory data
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
@@ -4160,7 +6124,7 @@ bool static LoadBlockIndexDB()
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
-    chainActive.SetTip(it->second);
+    SetActiveTip(it->second);
     // Set hashAnchorEnd for the end of best chain
     it->second->hashAnchorEnd = pcoinsTip->GetBestAnchor();
 
@@ -4186,60 +6150,106 @@ CVerifyDB::~CVerifyDB()
     uiInterface.ShowProgress("", 100);
 }
 
-bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+/** The blocks of the best chain VerifyDB checks at depth nCheckDepth, the tip first */
+static std::vector<const CBlockIndex*> GetBlocksToVerify(int nCheckDepth) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    std::vector<const CBlockIndex*> vpindex;
+    if (nCheckDepth <= 0)
+        nCheckDepth = 1000000000; // suffices until the year 19000
+    for (const CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
+        if (pindex->nHeight < chainActive.Height() - nCheckDepth)
+            break;
+        vpindex.push_back(pindex);
+    }
+    return vpindex;
+}
+
+/**
+ * Check levels 0 to 2 of VerifyDB for the blocks of vpindex: each is read,
+ * checked on its own and its undo data read. The blocks do not depend on
+ * each other, nor on cs_main, so they are checked on a thread per core.
+ */
+static bool VerifyBlockFiles(const std::vector<const CBlockIndex*>& vpindex, int nCheckLevel, bool fShowProgress)
+{
+    // No need to verify JoinSplits twice
+    auto verifier = libzcash::ProofVerifier::Disabled();
+    auto checkBlock = [&](const CBlockIndex* pindex) {
+        CBlock block;
+        CValidationState state;
+        // check level 0: read from disk
+        if (!ReadBlockFromDisk(block, pindex))
+            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        // check level 1: verify block validity
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, verifier))
+            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        // check level 2: verify undo validity
+        CBlockUndo undo;
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (nCheckLevel >= 2 && !pos.IsNull() && !UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+            return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        return true;
+    };
+    std::atomic<size_t> nNext(0);
+    std::atomic<bool> fFailed(false);
+    auto worker = [&](bool fProgress) {
+        for (size_t i = nNext++; i < vpindex.size() && !fFailed && !ShutdownRequested(); i = nNext++) {
+            if (fProgress)
+                uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(i * 100 / vpindex.size()))));
+            if (!checkBlock(vpindex[i]))
+                fFailed = true;
+        }
+    };
+    size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vpindex.size());
+    std::vector<std::thread> threads;
+    for (size_t n = 1; n < nThreads; n++)
+        threads.emplace_back(worker, false);
+    worker(fShowProgress);
+    for (std::thread& t : threads)
+        t.join();
+    return !fFailed;
+}
+
+bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth, bool fBlockChecks)
 {
     LOCK(cs_main);
     if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
         return true;
 
     // Verify blocks in the best chain
-    if (nCheckDepth <= 0)
-        nCheckDepth = 1000000000; // suffices until the year 19000
-    if (nCheckDepth > chainActive.Height())
-        nCheckDepth = chainActive.Height();
+    std::vector<const CBlockIndex*> vpindex = GetBlocksToVerify(nCheckDepth);
+    nCheckDepth = vpindex.size();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    LogPrintf("Verifying last %i blocks at level %i%s\n", nCheckDepth, nCheckLevel, fBlockChecks ? "" : ", levels 0 to 2 in the background");
+    int64_t nStart = GetTimeMillis();
+    if (fBlockChecks && !VerifyBlockFiles(vpindex, nCheckLevel, true))
+        return false;
+    if (ShutdownRequested())
+        return true;
+
+    // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
     CValidationState state;
-    // No need to verify JoinSplits twice
-    auto verifier = libzcash::ProofVerifier::Disabled();
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    for (CBlockIndex* pindex = chainActive.Tip(); nCheckLevel >= 3 && pindex->nHeight > chainActive.Height() - nCheckDepth; pindex = pindex->pprev)
     {
         boost::this_thread::interruption_point();
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
+        if ((coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) > nCoinCacheUsage)
             break;
         CBlock block;
-        // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, verifier))
-            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
-            if (!fClean) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else
-                nGoodTransactions += block.vtx.size();
-        }
+        bool fClean = true;
+        if (!DisconnectBlock(block, state, pindex, coins, &fClean))
+            return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        pindexState = pindex->pprev;
+        if (!fClean) {
+            nGoodTransactions = 0;
+            pindexFailure = pindex;
+        } else
+            nGoodTransactions += block.vtx.size();
         if (ShutdownRequested())
             return true;
     }
@@ -4263,21 +6273,49 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         }
     }
 
-    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions), verified in %.2fs\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions, (GetTimeMillis() - nStart) * 0.001);
 
     return true;
 }
 
+void ThreadVerifyBlocks(int nCheckLevel, int nCheckDepth)
+{
+    RenameThread("horizen-checkblk");
+    std::vector<const CBlockIndex*> vpindex;
+    {
+        LOCK(cs_main);
+        vpindex = GetBlocksToVerify(nCheckDepth);
+    }
+    nCheckLevel = std::max(0, std::min(2, nCheckLevel));
+    int64_t nStart = GetTimeMillis();
+    // The block index entries stay until shutdown and the blocks where they are, as long as nothing is pruned
+    if (!VerifyBlockFiles(vpindex, nCheckLevel, false)) {
+        strMiscWarning = _("Warning: Corrupted block database detected, restart with -reindex to rebuild it");
+        LogPrintf("*** %s\n", strMiscWarning);
+        uiInterface.ThreadSafeMessageBox(strMiscWarning, "", CClientUIInterface::MSG_ERROR);
+        return;
+    }
+    if (!ShutdownRequested())
+        LogPrintf("Verified last %u blocks at level %i in the background in %.2fs\n", vpindex.size(), nCheckLevel, (GetTimeMillis() - nStart) * 0.001);
+}
+
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
-    chainActive.SetTip(NULL);
+    SetActiveTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    nBestHeaderHeight = -1;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
+    {
+        LOCK(cs_orphans);
+        mapOrphanTransactions.clear();
+        mapOrphanTransactionsByPrev.clear();
+        mapOrphanTransactionsByPeer.clear();
+        mapOrphanBytesByPeer.clear();
+        nOrphanTransactionsBytes = 0;
+    }
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
@@ -4285,21 +6323,26 @@ void UnloadBlockIndex()
     nBlockSequenceId = 1;
     mapBlockSource.clear();
     mapBlocksInFlight.clear();
+    mapBlocksRerequested.clear();
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
+    setBlockIndexUnchecked.clear();
     setDirtyFileInfo.clear();
+    mGlobalForkTips.clear();
     mapNodeState.clear();
     recentRejects.reset(NULL);
+    recentBadProofs.reset(NULL);
+    {
+        LOCK(cs_RecentHeadersMessages);
+        listRecentHeadersMessages.clear();
+    }
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
-    mapBlockIndex.clear();
+    DeleteBlockIndexEntries();
     fHavePruned = false;
 }
 
@@ -4319,6 +6362,7 @@ bool InitBlockIndex() {
 
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    recentBadProofs.reset(new CRollingBloomFilter(20000, 0.000001));
 
     // Check whether we're already initialized
     if (chainActive.Genesis() != NULL)
@@ -4327,6 +6371,14 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fCompactTxIndex = GetBoolArg("-compacttxindex", DEFAULT_COMPACT_TXINDEX);
+    pblocktree->WriteFlag("compacttxindex", fCompactTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
+    fTimestampIndex = GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+    pblocktree->WriteFlag("timestampindex", fTimestampIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4357,6 +6409,180 @@ bool InitBlockIndex() {
     return true;
 }
 
+bool DumpTxOutSet(FILE* fileIn, CTxOutSetSnapshotHeader& header, CValidationState& state)
+{
+    CAutoFile file(fileIn, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return state.Error("Failed to open snapshot file");
+
+    // The records are read from the coin database, so everything has to be
+    // written there first. Only the flush is done under cs_main; the records
+    // are then read from a database snapshot while the chain moves on.
+    boost::scoped_ptr<CLevelDBSnapshot> snapshot;
+    {
+        LOCK(cs_main);
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+            return false;
+
+        snapshot.reset(pcoinsdbview->NewSnapshot());
+        CBlockIndex* pindex = chainActive.Tip();
+        assert(pcoinsdbview->GetBestBlock(*snapshot) == pindex->GetBlockHash());
+        header = CTxOutSetSnapshotHeader();
+        memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+        header.hashBlock = pindex->GetBlockHash();
+        header.nHeight = pindex->nHeight;
+        header.hashAnchor = pcoinsdbview->GetBestAnchor(*snapshot);
+        header.vTxCount.resize(pindex->nHeight + 1);
+        for (; pindex; pindex = pindex->pprev)
+            header.vTxCount[pindex->nHeight] = pindex->nTx;
+    }
+
+    try {
+        // The header has a fixed size, so it is written again once the counts and hashes are known
+        file << header;
+        if (!pcoinsdbview->DumpSnapshot(*snapshot, file, header))
+            return state.Error("Failed to read the coin database");
+        if (fseek(file.Get(), 0, SEEK_SET) != 0)
+            return state.Error("Failed to rewind snapshot file");
+        file << header;
+        FileCommit(file.Get());
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Failed to write snapshot file: %s", e.what()));
+    }
+    LogPrintf("%s: wrote UTXO snapshot at height %d, %u transactions, hash %s\n", __func__,
+        header.nHeight, header.nTransactions, header.hashSerialized.ToString());
+    return true;
+}
+
+bool LoadTxOutSet(FILE* fileIn, const uint256& hashExpected, CTxOutSetSnapshotHeader& header, CValidationState& state)
+{
+    const CChainParams& chainparams = Params();
+    CAutoFile file(fileIn, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return state.Error("Failed to open snapshot file");
+
+    LOCK(cs_main);
+    // The blocks below the snapshot are never downloaded, the node behaves as if they were pruned
+    if (!fPruneMode)
+        return state.Error("Loading a UTXO snapshot requires -prune");
+    if (chainActive.Height() > 0)
+        return state.Error("A UTXO snapshot can only be loaded by a node that has not connected any block yet");
+
+    try {
+        file >> header;
+    } catch (const std::exception& e) {
+        return state.Error(strprintf("Failed to read snapshot header: %s", e.what()));
+    }
+    if (memcmp(header.pchMessageStart, chainparams.MessageStart(), sizeof(header.pchMessageStart)) != 0)
+        return state.Error("The snapshot was made for a different network");
+    // The header only vouches for the records, not for the chain they claim to be the state of
+    if (hashExpected.IsNull() || header.hashSerialized != hashExpected)
+        return state.Error("The snapshot hash does not match the expected one");
+
+    BlockMap::iterator mi = mapBlockIndex.find(header.hashBlock);
+    if (mi == mapBlockIndex.end())
+        return state.Error("The snapshot block header is unknown, wait for the headers to be synced");
+    CBlockIndex* pindexBase = mi->second;
+    if (pindexBase->nHeight != header.nHeight || header.vTxCount.size() != (size_t)header.nHeight + 1 ||
+        !pindexBase->IsValid(BLOCK_VALID_TREE) || (pindexBase->nStatus & BLOCK_FAILED_MASK))
+        return state.Error("The snapshot block is not valid");
+    for (CBlockIndex* pindex = pindexBase; pindex; pindex = pindex->pprev) {
+        unsigned int nTx = header.vTxCount[pindex->nHeight];
+        if (nTx == 0 || (pindex->nTx != 0 && pindex->nTx != nTx))
+            return state.Error(strprintf("The snapshot transaction count of block %d is not valid", pindex->nHeight));
+    }
+
+    // Check the whole file before touching the coin database
+    const long nRecordsPos = ftell(file.Get());
+    CTxOutSetSnapshotHeader result;
+    if (nRecordsPos < 0 || !pcoinsdbview->ReadSnapshot(file, header, false, result))
+        return state.Error("Failed to read snapshot records");
+    if (result.hashSerialized != header.hashSerialized || result.hashShielded != header.hashShielded ||
+        result.nTransactions != header.nTransactions || result.nAnchors != header.nAnchors ||
+        result.nNullifiers != header.nNullifiers)
+        return state.Error("The snapshot records do not match its header");
+
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    // A load interrupted from here on leaves a mixed chain state, see LoadBlockIndexDB
+    if (!pblocktree->WriteFlag("txoutsetload", true))
+        return AbortNode(state, "Failed to write to block index database");
+    if (fseek(file.Get(), nRecordsPos, SEEK_SET) != 0 || !pcoinsdbview->ReadSnapshot(file, header, true, result) ||
+        result.hashSerialized != header.hashSerialized || result.hashShielded != header.hashShielded)
+        return AbortNode(state, "Failed to load the UTXO snapshot into the coin database");
+    pcoinsTip->ResetBestBlock();
+    assert(pcoinsTip->GetBestBlock() == header.hashBlock);
+
+    // All blocks up to the snapshot are treated as pruned, and assumed valid
+    // on the strength of the trusted hash; no history is validated behind
+    std::vector<CBlockIndex*> vChain(pindexBase->nHeight + 1);
+    for (CBlockIndex* pindex = pindexBase; pindex; pindex = pindex->pprev)
+        vChain[pindex->nHeight] = pindex;
+    BOOST_FOREACH(CBlockIndex* pindex, vChain) {
+        pindex->nTx = header.vTxCount[pindex->nHeight];
+        pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0) + pindex->nTx;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            pindex->nSproutValue = boost::none;
+        if (pindex->pprev && pindex->pprev->nChainSproutValue && pindex->nSproutValue)
+            pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
+        else
+            pindex->nChainSproutValue = pindex->pprev ? boost::none : pindex->nSproutValue;
+        pindex->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
+        pindex->nStatus |= BLOCK_ASSUMED_VALID;
+        setDirtyBlockIndex.insert(pindex);
+    }
+    pindexBase->hashAnchorEnd = header.hashAnchor;
+    {
+        LOCK(cs_nBlockSequenceId);
+        pindexBase->nSequenceId = nBlockSequenceId++;
+    }
+    SetActiveTip(pindexBase);
+    setBlockIndexCandidates.insert(pindexBase);
+
+    // Link the downloaded blocks that were waiting for their parents, as in ReceivedBlockTransactions
+    deque<CBlockIndex*> queue;
+    BOOST_FOREACH(CBlockIndex* pindex, vChain) {
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        for (; range.first != range.second; range.first++) {
+            if (pindexBase->GetAncestor(range.first->second->nHeight) != range.first->second)
+                queue.push_back(range.first->second);
+        }
+        mapBlocksUnlinked.erase(pindex);
+    }
+    while (!queue.empty()) {
+        CBlockIndex *pindex = queue.front();
+        queue.pop_front();
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        if (pindex->pprev->nChainSproutValue && pindex->nSproutValue)
+            pindex->nChainSproutValue = *pindex->pprev->nChainSproutValue + *pindex->nSproutValue;
+        else
+            pindex->nChainSproutValue = boost::none;
+        {
+            LOCK(cs_nBlockSequenceId);
+            pindex->nSequenceId = nBlockSequenceId++;
+        }
+        if (!setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip()))
+            setBlockIndexCandidates.insert(pindex);
+        std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
+        for (; range.first != range.second; range.first++)
+            queue.push_back(range.first->second);
+        mapBlocksUnlinked.erase(pindex);
+    }
+    PruneBlockIndexCandidates();
+
+    fHavePruned = true;
+    if (!pblocktree->WriteFlag("prunedblockfiles", true))
+        return AbortNode(state, "Failed to write to block index database");
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    if (!pblocktree->WriteFlag("txoutsetload", false))
+        return AbortNode(state, "Failed to write to block index database");
+
+    LogPrintf("%s: loaded UTXO snapshot at height %d, %u transactions, hash %s\n", __func__,
+        header.nHeight, header.nTransactions, header.hashSerialized.ToString());
+    return true;
+}
+
 CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
 {
     CBlock res{};
@@ -4364,10 +6590,11 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
     if (blkdat.eof())
         return res;
 
-    int blkSize = -1;
+    bool fFound = false;
+    unsigned int blkSize = 0;
 
     //locate Header
-    for(uint64_t nRewind = blkdat.GetPos(); !blkdat.eof() && (blkSize == -1);)
+    for(uint64_t nRewind = blkdat.GetPos(); !blkdat.eof() && !fFound;)
     {
         blkdat.SetPos(nRewind); // Note: setPos does NOT simply overwrite the var returned by GetPos()!!
         nRewind++;              // start one byte further next time, in case of failure
@@ -4383,26 +6610,25 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
                 continue; // just first byte of magic number matches. Keep searching
 
             blkdat >> blkSize; // read size
-            if (blkSize < 80 || blkSize > MAX_BLOCK_SIZE) {
-                blkSize = -1;
+            if (!IsBlockRecordSize(blkSize))
                 continue; // while whole magic number matches, it can't be block size. Keep searching
-            }
+            fFound = true;
         } catch (const std::exception&) {
             // no valid block header found; don't complain
             break;
         }
     }
 
-    if (blkSize == -1)
+    if (!fFound)
         return res;
 
     //Here block has been found. Load it!
     unsigned int blkStartPos = blkdat.GetPos();
     if (pLastLoadedBlkPos != nullptr) pLastLoadedBlkPos->nPos = blkStartPos;
-    blkdat.SetLimit(blkStartPos + blkSize);
+    blkdat.SetLimit(blkStartPos + (blkSize & ~BLOCK_RECORD_COMPRESSED));
     blkdat.SetPos(blkStartPos);
     try {
-        blkdat >> res;
+        ReadBlockRecord(blkdat, blkSize, res);
     } catch (const std::exception& e) {
         LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
     }
@@ -4411,11 +6637,97 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos)
     return res;
 }
 
-bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeadersOnly)
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Process a block loaded from a file, then the blocks met earlier that were
+ * waiting for it as their parent. fSolutionChecked tells that the Equihash
+ * solution of the header was verified already. Returns false if loading the
+ * file should stop.
+ */
+static bool ProcessLoadedBlock(CBlock& loadedBlk, CDiskBlockPos *dbp, bool loadHeadersOnly, bool fSolutionChecked,
+                               int& nLoadedHeaders, int& nLoadedBlocks)
 {
     const CChainParams& chainparams = Params();
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+    // detect out of order blocks, and store them for later
+    uint256 hash = loadedBlk.GetHash();
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(loadedBlk.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                loadedBlk.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(loadedBlk.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0)
+    {
+        CValidationState state;
+        if (loadHeadersOnly)
+        {
+            if (AcceptBlockHeader(loadedBlk, state, /*ppindex*/nullptr, /*lookForwardTips*/false, fSolutionChecked)) //Todo: verify lookForwardTips
+                ++nLoadedHeaders;
+
+            if (state.IsError())
+                return false;
+        } else
+        {
+            if (ProcessNewBlock(state, NULL, &loadedBlk, true, dbp))
+                nLoadedBlocks++;
+
+            if (state.IsError())
+                return false;
+        }
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Breath-first process earlier encountered successors of this block
+    deque<uint256> queue{hash};
+    do
+    {
+        uint256 head = queue.front();
+        queue.pop_front();
+        auto range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second)
+        {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            if (ReadBlockFromDisk(loadedBlk, it->second))
+            {
+                CValidationState dummy;
+                if (loadHeadersOnly)
+                {
+                    LogPrintf("%s: Processing out of order header, child %s of %s\n", __func__, loadedBlk.GetHash().ToString(),
+                            head.ToString());
+                    if (AcceptBlockHeader(loadedBlk, dummy, /*ppindex*/nullptr, /*lookForwardTips*/false))
+                    { //Todo: verify lookForwardTips and correctness of not breaking up
+                        nLoadedHeaders++;
+                        queue.push_back(loadedBlk.GetHash());
+                    }
+                } else {
+                    LogPrintf("%s: Processing out of order block, child %s of %s\n", __func__, loadedBlk.GetHash().ToString(),
+                            head.ToString());
+
+                    //Todo: verify that issue on Process Block does not cause whole stop as before
+                    if (ProcessNewBlock(dummy, NULL, &loadedBlk, true, &it->second))
+                    {
+                        nLoadedBlocks++;
+                        queue.push_back(loadedBlk.GetHash());
+                    }
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+        }
+    } while (!queue.empty());
+
+    return true;
+}
+
+bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeadersOnly)
+{
     int64_t nStart = GetTimeMillis();
 
     int nLoadedHeaders = 0;
@@ -4423,10 +6735,12 @@ bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeade
 
     try
     {
+        // The file is read through from its start
+        FileAdviseSequential(fileIn);
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof())
+        while (!blkdat.eof() && !ShutdownRequested())
         {
             boost::this_thread::interruption_point();
 
@@ -4444,7 +6758,7 @@ bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeade
                     continue; //only first byte of magic number matches. Keep searching...
                 // read size
                 blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                if (!IsBlockRecordSize(nSize))
                     continue; //magic number matches but size can't be block one. Keep searching...
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
@@ -4456,82 +6770,13 @@ bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeade
                 uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
                     dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetLimit(nBlockPos + (nSize & ~BLOCK_RECORD_COMPRESSED));
                 blkdat.SetPos(nBlockPos);
                 CBlock loadedBlk;
-                blkdat >> loadedBlk;
+                ReadBlockRecord(blkdat, nSize, loadedBlk);
                 nRewind = blkdat.GetPos();
-                // detect out of order blocks, and store them for later
-                uint256 hash = loadedBlk.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(loadedBlk.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            loadedBlk.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(loadedBlk.hashPrevBlock, *dbp));
-                    continue;
-                }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0)
-                {
-                    CValidationState state;
-                    if (loadHeadersOnly)
-                    {
-                        if (AcceptBlockHeader(loadedBlk, state, /*ppindex*/nullptr, /*lookForwardTips*/false)) //Todo: verify lookForwardTips
-                            ++nLoadedHeaders;
-
-                        if (state.IsError())
-                            break;
-                    } else
-                    {
-                        if (ProcessNewBlock(state, NULL, &loadedBlk, true, dbp))
-                            nLoadedBlocks++;
-
-                        if (state.IsError())
-                            break;
-                    }
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
-
-                // Breath-first process earlier encountered successors of this block
-                deque<uint256> queue{hash};
-                do
-                {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    auto range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second)
-                    {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(loadedBlk, it->second))
-                        {
-                            CValidationState dummy;
-                            if (loadHeadersOnly)
-                            {
-                                LogPrintf("%s: Processing out of order header, child %s of %s\n", __func__, loadedBlk.GetHash().ToString(),
-                                        head.ToString());
-                                if (AcceptBlockHeader(loadedBlk, dummy, /*ppindex*/nullptr, /*lookForwardTips*/false))
-                                { //Todo: verify lookForwardTips and correctness of not breaking up
-                                    nLoadedHeaders++;
-                                    queue.push_back(loadedBlk.GetHash());
-                                }
-                            } else {
-                                LogPrintf("%s: Processing out of order block, child %s of %s\n", __func__, loadedBlk.GetHash().ToString(),
-                                        head.ToString());
-
-                                //Todo: verify that issue on Process Block does not cause whole stop as before
-                                if (ProcessNewBlock(dummy, NULL, &loadedBlk, true, &it->second))
-                                {
-                                    nLoadedBlocks++;
-                                    queue.push_back(loadedBlk.GetHash());
-                                }
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
-                } while (!queue.empty());
+                if (!ProcessLoadedBlock(loadedBlk, dbp, loadHeadersOnly, false, nLoadedHeaders, nLoadedBlocks))
+                    break;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
@@ -4545,6 +6790,543 @@ bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeade
     return (loadHeadersOnly && (nLoadedHeaders > 0)) || (!loadHeadersOnly && (nLoadedBlocks > 0));
 }
 
+/** The blocks of a blk file, read and given their context-free checks by a reindex worker. */
+struct CReindexFile
+{
+    //! The file does not exist or cannot be opened, reindexing ends there
+    bool fMissing;
+    std::vector<CBlock> vBlocks;
+    std::vector<CDiskBlockPos> vPos;
+    //! For headers-only reindexing, whether the Equihash solution of each header is valid
+    std::vector<bool> vSolutionChecked;
+
+    CReindexFile() : fMissing(false) {}
+};
+
+/**
+ * Work shared by the threads reading blk files ahead of the reindexing one:
+ * they claim files in order, but never more than nWindow files ahead of the
+ * one being processed, to bound the memory held by parsed blocks.
+ */
+struct CReindexQueue
+{
+    boost::mutex cs;
+    boost::condition_variable cond;
+    int nNextFile;   //!< Next file for a worker to read
+    int nProcessing; //!< File the reindexing thread waits for or processes
+    int nEndFile;    //!< First missing file once known
+    int nWindow;
+    std::map<int, boost::shared_ptr<CReindexFile> > mapRead;
+
+    CReindexQueue(int nWindowIn) : nNextFile(0), nProcessing(0), nEndFile(std::numeric_limits<int>::max()), nWindow(nWindowIn) {}
+};
+
+/** Read all blocks of blk file nFile, checking them as ProcessNewBlock or AcceptBlockHeader would before taking cs_main. */
+static void ReadReindexFile(int nFile, bool loadHeadersOnly, CReindexFile& file)
+{
+    CDiskBlockPos pos(nFile, 0);
+    if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk"))) {
+        file.fMissing = true;
+        return;
+    }
+    FILE* fileIn = OpenBlockFile(pos, true);
+    if (!fileIn) {
+        file.fMissing = true; // This error is logged in OpenBlockFile
+        return;
+    }
+    FileAdviseSequential(fileIn);
+
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof())
+    {
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(Params().MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            blkdat >> nSize;
+            if (!IsBlockRecordSize(nSize))
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try
+        {
+            pos.nPos = blkdat.GetPos();
+            blkdat.SetLimit(pos.nPos + (nSize & ~BLOCK_RECORD_COMPRESSED));
+            blkdat.SetPos(pos.nPos);
+            CBlock block;
+            bool fSolutionChecked = false;
+            ReadBlockRecord(blkdat, nSize, block);
+            nRewind = blkdat.GetPos();
+            if (loadHeadersOnly) {
+                // Only the header is needed, do not keep the transactions around
+                block = CBlock(block.GetBlockHeader());
+                fSolutionChecked = CheckEquihashSolution(&block, Params());
+            } else {
+                // Marks the block as checked for ProcessNewBlock, a failure is reported again there
+                CValidationState state;
+                auto verifier = libzcash::ProofVerifier::Disabled();
+                CheckBlock(block, state, verifier);
+            }
+            file.vBlocks.push_back(std::move(block));
+            file.vPos.push_back(pos);
+            file.vSolutionChecked.push_back(fSolutionChecked);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
+
+static void ThreadReindexReader(CReindexQueue* queue, bool loadHeadersOnly)
+{
+    RenameThread("horizen-reindex");
+    while (true) {
+        int nFile;
+        {
+            boost::unique_lock<boost::mutex> lock(queue->cs);
+            while (queue->nNextFile < queue->nEndFile && queue->nNextFile >= queue->nProcessing + queue->nWindow)
+                queue->cond.wait(lock);
+            if (queue->nNextFile >= queue->nEndFile)
+                return;
+            nFile = queue->nNextFile++;
+        }
+
+        boost::shared_ptr<CReindexFile> file(new CReindexFile());
+        try {
+            ReadReindexFile(nFile, loadHeadersOnly, *file);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: error reading blk%05u.dat - %s\n", __func__, (unsigned int)nFile, e.what());
+        }
+
+        boost::unique_lock<boost::mutex> lock(queue->cs);
+        if (file->fMissing)
+            queue->nEndFile = std::min(queue->nEndFile, nFile);
+        queue->mapRead[nFile] = file;
+        queue->cond.notify_all();
+    }
+}
+
+void ReindexBlockFiles(bool loadHeadersOnly, int nThreads)
+{
+    if (nThreads <= 0) {
+        for (int nFile = 0; ; nFile++)
+        {
+            CDiskBlockPos pos(nFile, 0);
+            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
+                break; // No block files left to reindex
+            FILE *file = OpenBlockFile(pos, true);
+            if (!file) break; // This error is logged in OpenBlockFile
+            LogPrintf("Reindexing block file blk%05u.dat%s...\n", (unsigned int)nFile, loadHeadersOnly ? ", headers-only" : "");
+            LoadBlocksFromExternalFile(file, &pos, loadHeadersOnly);
+        }
+        return;
+    }
+
+    // Files are read and checked on nThreads threads, the blocks are then
+    // processed here in file order, already marked as checked
+    CReindexQueue queue(nThreads);
+    boost::thread_group readers;
+    for (int i = 0; i < nThreads; i++)
+        readers.create_thread(boost::bind(&ThreadReindexReader, &queue, loadHeadersOnly));
+
+    try {
+        for (int nFile = 0; ; nFile++)
+        {
+            boost::shared_ptr<CReindexFile> file;
+            {
+                boost::unique_lock<boost::mutex> lock(queue.cs);
+                queue.nProcessing = nFile;
+                queue.cond.notify_all();
+                while (!queue.mapRead.count(nFile))
+                    queue.cond.wait(lock);
+                file = queue.mapRead[nFile];
+                queue.mapRead.erase(nFile);
+            }
+            if (file->fMissing)
+                break; // No block files left to reindex
+
+            LogPrintf("Reindexing block file blk%05u.dat%s...\n", (unsigned int)nFile, loadHeadersOnly ? ", headers-only" : "");
+            int64_t nStart = GetTimeMillis();
+            int nLoadedHeaders = 0;
+            int nLoadedBlocks = 0;
+            for (size_t i = 0; i < file->vBlocks.size(); i++)
+            {
+                boost::this_thread::interruption_point();
+                try {
+                    if (!ProcessLoadedBlock(file->vBlocks[i], &file->vPos[i], loadHeadersOnly, file->vSolutionChecked[i], nLoadedHeaders, nLoadedBlocks))
+                        break;
+                } catch (const std::runtime_error& e) {
+                    AbortNode(std::string("System error: ") + e.what());
+                    break;
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                }
+                // Release the block as soon as it is stored
+                file->vBlocks[i] = CBlock();
+            }
+            if (nLoadedBlocks > 0)
+                LogPrintf("Loaded %i blocks from blk%05u.dat in %dms\n", nLoadedBlocks, (unsigned int)nFile, GetTimeMillis() - nStart);
+        }
+    } catch (...) {
+        readers.interrupt_all();
+        readers.join_all();
+        throw;
+    }
+    readers.interrupt_all();
+    readers.join_all();
+}
+
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/** A mempool transaction as written to mempool.dat. */
+struct CMempoolDumpEntry
+{
+    CTransaction tx;
+    int64_t nTime;
+    CAmount nFeeDelta;
+    //! Whether the JoinSplit proofs were verified by the node that wrote the dump
+    bool fProofsVerified;
+    //! Not written: dumps are ordered by it so that parents are loaded first
+    uint64_t nCountWithAncestors;
+
+    CMempoolDumpEntry() : nTime(0), nFeeDelta(0), fProofsVerified(false), nCountWithAncestors(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(tx);
+        READWRITE(nTime);
+        READWRITE(nFeeDelta);
+        READWRITE(fProofsVerified);
+    }
+};
+
+bool LoadMempool()
+{
+    const int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    CAutoFile file(fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    // Read and check the whole dump before trusting any of its proof markers
+    std::vector<CMempoolDumpEntry> vEntries;
+    try {
+        uint64_t nVersion, nEntries;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s: unknown mempool dump version %d", __func__, nVersion);
+        file >> nEntries;
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        for (uint64_t i = 0; i < nEntries; i++) {
+            vEntries.push_back(CMempoolDumpEntry());
+            file >> vEntries.back();
+            hasher << vEntries.back();
+        }
+        uint256 hashChecksum;
+        file >> hashChecksum;
+        if (hashChecksum != hasher.GetHash())
+            return error("%s: mempool dump checksum mismatch", __func__);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    int nSuccess = 0, nFailed = 0, nExpired = 0;
+    const int64_t nNow = GetTime();
+    BOOST_FOREACH(const CMempoolDumpEntry& entry, vEntries) {
+        const uint256& hash = entry.tx.GetHash();
+        if (entry.nFeeDelta != 0)
+            mempool.PrioritiseTransaction(hash, hash.ToString(), 0, entry.nFeeDelta);
+        if (entry.nTime + nExpiryTimeout <= nNow) {
+            nExpired++;
+            continue;
+        }
+        // Proofs this node verified before do not need to be verified again
+        if (entry.fProofsVerified)
+            CacheJoinSplitProofs(entry.tx);
+
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            if (AcceptToMemoryPool(mempool, state, entry.tx, true, NULL, false, entry.nTime))
+                nSuccess++;
+            else
+                nFailed++;
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", nSuccess, nFailed, nExpired);
+    return true;
+}
+
+static bool CompareMempoolDumpEntryByAncestors(const CMempoolDumpEntry& a, const CMempoolDumpEntry& b)
+{
+    return a.nCountWithAncestors < b.nCountWithAncestors;
+}
+
+void DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::vector<CMempoolDumpEntry> vEntries;
+    {
+        LOCK(mempool.cs);
+        vEntries.reserve(mempool.mapTx.size());
+        for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it) {
+            CMempoolDumpEntry entry;
+            entry.tx = it->second.GetTx();
+            entry.nTime = it->second.GetTime();
+            entry.nFeeDelta = it->second.GetModifiedFee() - it->second.GetFee();
+            entry.fProofsVerified = true;
+            BOOST_FOREACH(const JSDescription& joinsplit, entry.tx.vjoinsplit) {
+                if (!IsJoinSplitProofCached(joinsplit, entry.tx.joinSplitPubKey))
+                    entry.fProofsVerified = false;
+            }
+            entry.nCountWithAncestors = it->second.GetCountWithAncestors();
+            vEntries.push_back(entry);
+        }
+    }
+    std::stable_sort(vEntries.begin(), vEntries.end(), CompareMempoolDumpEntryByAncestors);
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathNew = GetDataDir() / "mempool.dat.new";
+        CAutoFile file(fopen(pathNew.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull()) {
+            LogPrintf("Failed to open %s for writing\n", pathNew.string());
+            return;
+        }
+
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        file << MEMPOOL_DUMP_VERSION << (uint64_t)vEntries.size();
+        BOOST_FOREACH(const CMempoolDumpEntry& entry, vEntries) {
+            file << entry;
+            hasher << entry;
+        }
+        file << hasher.GetHash();
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(pathNew, GetDataDir() / "mempool.dat");
+
+        int64_t nLast = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (nMid - nStart) * 0.000001, (nLast - nMid) * 0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+    }
+}
+
+/** The oldest ancestors of a block, itself included, with each of the properties CheckBlockIndex follows */
+struct CBlockIndexCheckPath
+{
+    CBlockIndex* pindexFirstInvalid; // Oldest ancestor of pindex which is invalid.
+    CBlockIndex* pindexFirstMissing; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstNeverProcessed; // Oldest ancestor of pindex for which nTx == 0.
+    CBlockIndex* pindexFirstNotTreeValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
+    CBlockIndex* pindexFirstNotTransactionsValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
+    CBlockIndex* pindexFirstNotChainValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
+    CBlockIndex* pindexFirstNotScriptsValid; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+
+    CBlockIndexCheckPath() : pindexFirstInvalid(NULL), pindexFirstMissing(NULL), pindexFirstNeverProcessed(NULL),
+        pindexFirstNotTreeValid(NULL), pindexFirstNotTransactionsValid(NULL), pindexFirstNotChainValid(NULL), pindexFirstNotScriptsValid(NULL) {}
+
+    //! Extend the path down to pindex, a child of its last block
+    void Enter(CBlockIndex* pindex)
+    {
+        if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
+        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotTransactionsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
+        // The chain of a UTXO snapshot counts as CHAIN and SCRIPTS valid, as a parent
+        bool fAssumedValid = pindex->nStatus & BLOCK_ASSUMED_VALID;
+        if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && !fAssumedValid && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && !fAssumedValid && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+    }
+
+    //! Shorten the path by its last block, pindex
+    void Leave(CBlockIndex* pindex)
+    {
+        if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
+        if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+        if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
+        if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
+        if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = NULL;
+        if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
+        if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
+    }
+
+    //! The path cut back to its blocks up to nHeight
+    CBlockIndexCheckPath Prefix(int nHeight) const
+    {
+        CBlockIndexCheckPath path(*this);
+        CBlockIndex** vFirst[] = {&path.pindexFirstInvalid, &path.pindexFirstMissing, &path.pindexFirstNeverProcessed,
+                                  &path.pindexFirstNotTreeValid, &path.pindexFirstNotTransactionsValid,
+                                  &path.pindexFirstNotChainValid, &path.pindexFirstNotScriptsValid};
+        for (size_t i = 0; i < ARRAYLEN(vFirst); i++) {
+            if (*vFirst[i] != NULL && (*vFirst[i])->nHeight > nHeight)
+                *vFirst[i] = NULL;
+        }
+        return path;
+    }
+};
+
+/** The consistency checks of one block index entry, nHeight blocks above genesis at the end of path */
+static void CheckBlockIndexEntry(CBlockIndex* pindex, int nHeight, const CBlockIndexCheckPath& path, const Consensus::Params& consensusParams)
+{
+    // Begin: actual consistency checks.
+    if (pindex->pprev == NULL) {
+        // Genesis block checks.
+        assert(pindex->GetBlockHash() == consensusParams.hashGenesisBlock); // Genesis block's hash must match.
+        assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
+    }
+    if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
+    // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
+    // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
+    if (!fHavePruned) {
+        // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
+        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+        assert(path.pindexFirstMissing == path.pindexFirstNeverProcessed);
+    } else {
+        // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+        if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
+    }
+    if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
+    assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+    // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
+    assert((path.pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
+    assert((path.pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
+    assert(pindex->nHeight == nHeight); // nHeight must be consistent.
+    assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
+    assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
+    assert(path.pindexFirstNotTreeValid == NULL); // All mapBlockIndex entries must at least be TREE valid
+    if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(path.pindexFirstNotTreeValid == NULL); // TREE valid implies all parents are TREE valid
+    if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(path.pindexFirstNotChainValid == NULL); // CHAIN valid implies all parents are CHAIN valid
+    if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(path.pindexFirstNotScriptsValid == NULL); // SCRIPTS valid implies all parents are SCRIPTS valid
+    if (path.pindexFirstInvalid == NULL) {
+        // Checks for not-invalid blocks.
+        assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
+    }
+    if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && path.pindexFirstNeverProcessed == NULL) {
+        if (path.pindexFirstInvalid == NULL) {
+            // If this block sorts at least as good as the current tip and
+            // is valid and we have all data for its parents, it must be in
+            // setBlockIndexCandidates.  chainActive.Tip() must also be there
+            // even if some data has been pruned.
+            if (path.pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
+                // LogPrintf("net","ASSERT============>%x  but  %x", pindex->phashBlock, chainActive.Tip()->phashBlock);
+                assert(setBlockIndexCandidates.count(pindex));
+            }
+            // If some parent is missing, then it could be that this block was in
+            // setBlockIndexCandidates but had to be removed because of the missing data.
+            // In this case it must be in mapBlocksUnlinked -- see test below.
+        }
+    } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
+        assert(setBlockIndexCandidates.count(pindex) == 0);
+    }
+    // Check whether this block is in mapBlocksUnlinked.
+    std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeUnlinked = mapBlocksUnlinked.equal_range(pindex->pprev);
+    bool foundInUnlinked = false;
+    while (rangeUnlinked.first != rangeUnlinked.second) {
+        assert(rangeUnlinked.first->first == pindex->pprev);
+        if (rangeUnlinked.first->second == pindex) {
+            foundInUnlinked = true;
+            break;
+        }
+        rangeUnlinked.first++;
+    }
+    if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && path.pindexFirstNeverProcessed != NULL && path.pindexFirstInvalid == NULL) {
+        // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
+        assert(foundInUnlinked);
+    }
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
+    if (path.pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
+    if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && path.pindexFirstNeverProcessed == NULL && path.pindexFirstMissing != NULL) {
+        // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
+        assert(fHavePruned); // We must have pruned.
+        // This block may have entered mapBlocksUnlinked if:
+        //  - it has a descendant that at some point had more work than the
+        //    tip, and
+        //  - we tried switching to that descendant but were missing
+        //    data for some intermediate block between chainActive and the
+        //    tip.
+        // So if this block is itself better than chainActive.Tip() and it wasn't in
+        // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
+            if (path.pindexFirstInvalid == NULL) {
+                assert(foundInUnlinked);
+            }
+        }
+    }
+    // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
+    // End: actual consistency checks.
+}
+
+/**
+ * Check the block index entries that changed since the last call, the
+ * candidates for the tip and unlinked blocks, and nCheckBlockIndexSample
+ * percent of the others. Instead of walking the whole tree, the path of each
+ * is rebuilt from the one of the active chain, where every block's path is a
+ * prefix of the tip's, and the blocks between it and the active chain.
+ */
+static void CheckBlockIndexSampled(const Consensus::Params& consensusParams)
+{
+    std::set<CBlockIndex*> setCheck;
+    setCheck.swap(setBlockIndexUnchecked);
+    setCheck.insert(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+    setCheck.insert(setBlockIndexCandidates.begin(), setBlockIndexCandidates.end());
+    for (std::multimap<CBlockIndex*, CBlockIndex*>::const_iterator it = mapBlocksUnlinked.begin(); it != mapBlocksUnlinked.end(); ++it)
+        setCheck.insert(it->second);
+    setCheck.insert(chainActive.Tip());
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it) {
+        if (insecure_rand() % 100 < nCheckBlockIndexSample)
+            setCheck.insert(it->second);
+    }
+
+    CBlockIndexCheckPath pathActive;
+    for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight++)
+        pathActive.Enter(chainActive[nHeight]);
+
+    std::vector<CBlockIndex*> vFork;
+    BOOST_FOREACH(CBlockIndex* pindex, setCheck) {
+        // Blocks from pindex up to, not including, the active chain
+        vFork.clear();
+        CBlockIndex* pindexFork = pindex;
+        while (pindexFork != NULL && !chainActive.Contains(pindexFork)) {
+            vFork.push_back(pindexFork);
+            pindexFork = pindexFork->pprev;
+        }
+        CBlockIndexCheckPath path;
+        int nHeight = -1;
+        if (pindexFork != NULL) {
+            nHeight = pindexFork->nHeight;
+            path = pathActive.Prefix(nHeight);
+        }
+        for (std::vector<CBlockIndex*>::reverse_iterator it = vFork.rbegin(); it != vFork.rend(); ++it) {
+            path.Enter(*it);
+            nHeight++;
+        }
+        CheckBlockIndexEntry(pindex, nHeight, path, consensusParams);
+    }
+    LogPrint("bench", "    - CheckBlockIndex: %u of %u entries\n", (unsigned int)setCheck.size(), (unsigned int)mapBlockIndex.size());
+}
+
 void static CheckBlockIndex()
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -4567,6 +7349,11 @@ void static CheckBlockIndex()
     if (fReindexFast && (chainActive.Height() < 0))
         return;
 
+    if (nCheckBlockIndexSample < 100) {
+        CheckBlockIndexSampled(consensusParams);
+        return;
+    }
+
     // Build forward-pointing map of the entire block tree.
     std::multimap<CBlockIndex*,CBlockIndex*> forward;
     for(BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); ++it)
@@ -4584,109 +7371,12 @@ void static CheckBlockIndex()
     // block being explored which are the first to have certain properties.
     size_t nNodes = 0;
     int nHeight = 0;
-    CBlockIndex* pindexFirstInvalid = NULL; // Oldest ancestor of pindex which is invalid.
-    CBlockIndex* pindexFirstMissing = NULL; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
-    CBlockIndex* pindexFirstNeverProcessed = NULL; // Oldest ancestor of pindex for which nTx == 0.
-    CBlockIndex* pindexFirstNotTreeValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
-    CBlockIndex* pindexFirstNotTransactionsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
-    CBlockIndex* pindexFirstNotChainValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
-    CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+    CBlockIndexCheckPath path;
     while (pindex != NULL) {
         nNodes++;
-        if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
-        if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotTransactionsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
-
-        // Begin: actual consistency checks.
-        if (pindex->pprev == NULL) {
-            // Genesis block checks.
-            assert(pindex->GetBlockHash() == consensusParams.hashGenesisBlock); // Genesis block's hash must match.
-            assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
-        }
-        if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
-        // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
-        // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
-            // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
-            assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-            assert(pindexFirstMissing == pindexFirstNeverProcessed);
-        } else {
-            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
-            if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
-        }
-        if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
-        // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstNeverProcessed != NULL) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
-        assert((pindexFirstNotTransactionsValid != NULL) == (pindex->nChainTx == 0));
-        assert(pindex->nHeight == nHeight); // nHeight must be consistent.
-        assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
-        assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
-        assert(pindexFirstNotTreeValid == NULL); // All mapBlockIndex entries must at least be TREE valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(pindexFirstNotTreeValid == NULL); // TREE valid implies all parents are TREE valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexFirstNotChainValid == NULL); // CHAIN valid implies all parents are CHAIN valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexFirstNotScriptsValid == NULL); // SCRIPTS valid implies all parents are SCRIPTS valid
-        if (pindexFirstInvalid == NULL) {
-            // Checks for not-invalid blocks.
-            assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
-        }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == NULL) {
-            if (pindexFirstInvalid == NULL) {
-                // If this block sorts at least as good as the current tip and
-                // is valid and we have all data for its parents, it must be in
-                // setBlockIndexCandidates.  chainActive.Tip() must also be there
-                // even if some data has been pruned.
-                if (pindexFirstMissing == NULL || pindex == chainActive.Tip()) {
-                    // LogPrintf("net","ASSERT============>%x  but  %x", pindex->phashBlock, chainActive.Tip()->phashBlock);
-                    assert(setBlockIndexCandidates.count(pindex));
-                }
-                // If some parent is missing, then it could be that this block was in
-                // setBlockIndexCandidates but had to be removed because of the missing data.
-                // In this case it must be in mapBlocksUnlinked -- see test below.
-            }
-        } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
-            assert(setBlockIndexCandidates.count(pindex) == 0);
-        }
-        // Check whether this block is in mapBlocksUnlinked.
-        std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeUnlinked = mapBlocksUnlinked.equal_range(pindex->pprev);
-        bool foundInUnlinked = false;
-        while (rangeUnlinked.first != rangeUnlinked.second) {
-            assert(rangeUnlinked.first->first == pindex->pprev);
-            if (rangeUnlinked.first->second == pindex) {
-                foundInUnlinked = true;
-                break;
-            }
-            rangeUnlinked.first++;
-        }
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != NULL && pindexFirstInvalid == NULL) {
-            // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
-            assert(foundInUnlinked);
-        }
-        if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
-        if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
-            // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
-            // This block may have entered mapBlocksUnlinked if:
-            //  - it has a descendant that at some point had more work than the
-            //    tip, and
-            //  - we tried switching to that descendant but were missing
-            //    data for some intermediate block between chainActive and the
-            //    tip.
-            // So if this block is itself better than chainActive.Tip() and it wasn't in
-            // setBlockIndexCandidates, then it must be in mapBlocksUnlinked.
-            if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && setBlockIndexCandidates.count(pindex) == 0) {
-                if (pindexFirstInvalid == NULL) {
-                    assert(foundInUnlinked);
-                }
-            }
-        }
-        // assert(pindex->GetBlockHash() == pindex->GetBlockHeader().GetHash()); // Perhaps too slow
-        // End: actual consistency checks.
+        path.Enter(pindex);
+
+        CheckBlockIndexEntry(pindex, nHeight, path, consensusParams);
 
         // Try descending into the first subnode.
         std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> range = forward.equal_range(pindex);
@@ -4701,13 +7391,7 @@ void static CheckBlockIndex()
         while (pindex) {
             // We are going to either move to a parent or a sibling of pindex.
             // If pindex was the first with a certain property, unset the corresponding variable.
-            if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
-            if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
-            if (pindex == pindexFirstNeverProcessed) pindexFirstNeverProcessed = NULL;
-            if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
-            if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = NULL;
-            if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
-            if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
+            path.Leave(pindex);
             // Find our parent.
             CBlockIndex* pindexPar = pindex->pprev;
             // Find which child we just visited.
@@ -4837,10 +7521,17 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            return recentRejects->contains(inv.hash) ||
-                   mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoins(inv.hash);
+            if (recentRejects->contains(inv.hash) || mempool.exists(inv.hash))
+                return true;
+            assert(recentBadProofs);
+            if (recentBadProofs->contains(inv.hash))
+                return true;
+            {
+                LOCK(cs_orphans);
+                if (mapOrphanTransactions.count(inv.hash))
+                    return true;
+            }
+            return pcoinsTip->HaveCoins(inv.hash);
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -4849,6 +7540,86 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     return true;
 }
 
+/** Load a block to be sent to a peer, from its cached "block" message if there is one. */
+static void ReadBlockForPeer(CBlock& block, const CBlockIndex* pindex, const CBlockMessages* pentry)
+{
+    if (pentry && pentry->msgBlock) {
+        const CPublicSerializeData& msg = *pentry->msgBlock;
+        CMemoryReader reader(msg.data() + CMessageHeader::HEADER_SIZE, msg.data() + msg.size(), SER_NETWORK, PROTOCOL_VERSION);
+        reader >> block;
+    } else if (!ReadBlockFromDisk(block, pindex))
+        assert(!"cannot load block from disk");
+}
+
+/**
+ * The "block" or "cmpctblock" message for a block. Blocks near the tip are
+ * kept in wire format, so that a new tip is read from disk and checksummed
+ * at most once however many peers fetch it. Requires cs_main.
+ */
+static CSerializedNetMsg GetBlockMessage(const CBlockIndex* pindex, bool fCompact)
+{
+    AssertLockHeld(cs_main);
+    CBlockMessages* pentry = FindRecentBlockMessages(pindex->GetBlockHash());
+    if (!pentry && pindex->nHeight + (int)MAX_RECENT_BLOCK_MESSAGES > chainActive.Height())
+        pentry = &AddRecentBlockMessages(pindex->GetBlockHash());
+
+    if (pentry && (fCompact ? pentry->msgCmpctBlock : pentry->msgBlock))
+        return fCompact ? pentry->msgCmpctBlock : pentry->msgBlock;
+
+    CSerializedNetMsg msg;
+    if (!fCompact) {
+        // The block goes out as stored, it is neither deserialized nor serialized again
+        std::string strBlock;
+        bool fRead = false;
+        if (ReadRawBlockFromDisk(strBlock, pindex, Params().MessageStart())) {
+            try {
+                fRead = CBlockView(strBlock.data(), strBlock.data() + strBlock.size()).GetHash() == pindex->GetBlockHash();
+            } catch (const std::exception& e) {
+                LogPrintf("%s: malformed block %s - %s\n", __func__, pindex->GetBlockHash().ToString(), e.what());
+            }
+        }
+        if (fRead) {
+            CPublicDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss.reserve(CMessageHeader::HEADER_SIZE + strBlock.size());
+            BeginNetMessage(ss, "block");
+            ss.write(strBlock.data(), strBlock.size());
+            msg = EndNetMessage(ss);
+        }
+    }
+    if (!msg) {
+        CBlock block;
+        ReadBlockForPeer(block, pindex, pentry);
+        msg = fCompact ? SerializeNetMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block))
+                       : SerializeNetMessage("block", block);
+    }
+    if (pentry)
+        (fCompact ? pentry->msgCmpctBlock : pentry->msgBlock) = msg;
+    return msg;
+}
+
+/**
+ * The block of a "merkleblock" reply, with its merkle tree built. Blocks near
+ * the tip are kept deserialized, so that the SPV peers fetching a new block
+ * share the hashing of its transactions and of its merkle tree. Requires cs_main.
+ */
+static std::shared_ptr<const CBlock> GetBlockForFilter(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    CBlockMessages* pentry = FindRecentBlockMessages(pindex->GetBlockHash());
+    if (!pentry && pindex->nHeight + (int)MAX_RECENT_BLOCK_MESSAGES > chainActive.Height())
+        pentry = &AddRecentBlockMessages(pindex->GetBlockHash());
+
+    if (pentry && pentry->pblockFiltered)
+        return pentry->pblockFiltered;
+
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    ReadBlockForPeer(*pblock, pindex, pentry);
+    pblock->BuildMerkleTree();
+    if (pentry)
+        pentry->pblockFiltered = pblock;
+    return pblock;
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -4867,7 +7638,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -4907,21 +7678,40 @@ void static ProcessGetData(CNode* pfrom)
                         }
                     }
                 }
+                // Once the upload target is nearly reached, keep what is left of it for
+                // relaying new blocks and fork tips: disconnect the non-whitelisted peers
+                // asking for historical blocks, or for filtered blocks of any age
+                static const int nOneWeek = 7 * 24 * 60 * 60;
+                if (send && !pfrom->fWhitelisted && CNode::OutboundTargetReached(true) &&
+                    ((pindexBestHeader != NULL && pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek) ||
+                     inv.type == MSG_FILTERED_BLOCK))
+                {
+                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+                    pfrom->fDisconnect = true;
+                    send = false;
+                }
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
                     {
-                        LogPrint("forks", "%s():%d - Pushing block [%s]\n", __func__, __LINE__, block.GetHash().ToString() );
-                        pfrom->PushMessage("block", block);
+                        LogPrint("forks", "%s():%d - Pushing block [%s]\n", __func__, __LINE__, inv.hash.ToString() );
+                        pfrom->PushMessage(GetBlockMessage(mi->second, false));
+                    }
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        // The transactions of older blocks, fork tips included, are unlikely
+                        // to still be in the peer's mempool
+                        const bool fCompact = mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                        if (fCompact)
+                            LogPrint("forks", "%s():%d - Pushing compact block [%s]\n", __func__, __LINE__, inv.hash.ToString() );
+                        pfrom->PushMessage(GetBlockMessage(mi->second, fCompact));
                     }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        std::shared_ptr<const CBlock> pblock = GetBlockForFilter(mi->second);
+                        const CBlock& block = *pblock;
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -4935,7 +7725,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->filterInventoryKnown.contains(pair.second))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -4965,15 +7755,18 @@ void static ProcessGetData(CNode* pfrom)
             }
             else if (inv.IsKnownType())
             {
-                // Send stream from relay memory
+                // Send from relay memory
                 bool pushed = false;
+                std::shared_ptr<const CTransaction> ptx;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                    if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                        pushed = true;
-                    }
+                    map<CInv, std::shared_ptr<const CTransaction> >::iterator mi = mapRelay.find(inv);
+                    if (mi != mapRelay.end())
+                        ptx = mi->second;
+                }
+                if (ptx) {
+                    pfrom->PushMessage("tx", *ptx);
+                    pushed = true;
                 }
                 if (!pushed && inv.type == MSG_TX) {
                     CTransaction tx;
@@ -4993,7 +7786,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -5012,7 +7805,27 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+/** A locator of the best header, fork tips on top: the peer uses them in case we need updating a fork */
+static CBlockLocator GetLocatorWithForkTips()
+{
+    CBlockLocator bl = chainActive.GetLocator(pindexBestHeader);
+
+    if (mGlobalForkTips.size() > 1)
+    {
+        std::vector<uint256> vOutput;
+        getMostRecentGlobalForkTips(vOutput);
+
+        BOOST_FOREACH(const uint256& hash, vOutput)
+        {
+            std::vector<uint256>::iterator b = bl.vHave.begin();
+            LogPrint("forks", "%s():%d - adding tip hash [%s]\n", __func__, __LINE__, hash.ToString());
+            bl.vHave.insert(b, hash);
+        }
+    }
+    return bl;
+}
+
+bool ProcessMessage(CNode* pfrom, string strCommand, CPublicDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
     LogPrint("net", "%s() - received: %s (%u bytes) peer=%d\n", __func__, SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -5086,7 +7899,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->fClient = !(pfrom->nServices & NODE_NETWORK);
 
         // Potentially mark this peer as a preferred download peer.
-        UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        {
+            LOCK(cs_main);
+            UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+        }
 
         // Change version
         pfrom->PushMessage("verack");
@@ -5163,6 +7979,34 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Tell the peer we can serve compact blocks when asked for them; we do not
+        // want them pushed unannounced. Older peers ignore the unknown message.
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        pfrom->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, CMPCTBLOCKS_VERSION);
+
+        // Ask for new main chain and fork tips to be announced with their headers (BIP130)
+        pfrom->PushMessage("sendheaders");
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        // New blocks are still announced with inv, whatever the peer prefers
+        if (nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+        }
+    }
+
+
+    else if (strCommand == "sendheaders")
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fPreferHeaders = true;
     }
 
 
@@ -5273,26 +8117,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     // doing this will result in the received block being rejected as an orphan in case it is
                     // not a direct successor.
 
-                    // add fork tips to the locator, they will be used by peer in case we need updating a fork
-                    CBlockLocator bl = chainActive.GetLocator(pindexBestHeader);
-
-                    if (mGlobalForkTips.size() > 1)
-                    {
-                        std::vector<uint256> vOutput;
-                        getMostRecentGlobalForkTips(vOutput);
-
-                        BOOST_FOREACH(const uint256& hash, vOutput)
-                        {
-                            std::vector<uint256>::iterator b = bl.vHave.begin();
-                            LogPrint("forks", "%s():%d - adding tip hash [%s]\n", __func__, __LINE__, hash.ToString());
-                            bl.vHave.insert(b, hash);
-                        }
-                    }
-                    pfrom->PushMessage("getheaders", bl, inv.hash);
+                    pfrom->PushMessage("getheaders", GetLocatorWithForkTips(), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        nodestate->nBlocksInFlight < GetBlocksInTransitLimit(nodestate->nAvgBlockTime)) {
+                        // A new block's transactions are mostly in our mempool already, so only
+                        // ask for their short ids if the peer supports it
+                        vToFetch.push_back(nodestate->fProvidesHeaderAndIDs ? CInv(MSG_CMPCT_BLOCK, inv.hash) : inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -5422,18 +8253,42 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pindex = chainActive.Next(pindex);
             }
  
-            // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
-            vector<CBlock> vHeaders;
-            int nLimit = MAX_HEADERS_RESULTS;
             LogPrint("net", "getheaders from h(%d) to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
-            for (; pindex; pindex = chainActive.Next(pindex))
+            const CBlockIndex* pindexLastSent = chainActive.Tip();
+
+            // Peers syncing from us ask for the same full ranges, whose replies are kept
+            // in wire format rather than rebuilt and serialized for each of them
+            CSerializedNetMsg msgHeaders;
+            if (pindex && hashStop.IsNull())
+                msgHeaders = FindHeadersMessage(pindex, pindexLastSent);
+            if (msgHeaders)
             {
-                vHeaders.push_back(pindex->GetBlockHeader());
-                if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
-                    break;
+                LogPrint("forks", "%s():%d - Pushing cached headers to node[%s]\n", __func__, __LINE__, pfrom->addrName);
+            }
+            else
+            {
+                // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
+                vector<CBlock> vHeaders;
+                int nLimit = MAX_HEADERS_RESULTS;
+                const CBlockIndex* pindexFirst = pindex;
+                for (; pindex; pindex = chainActive.Next(pindex))
+                {
+                    vHeaders.push_back(pindex->GetBlockHeader());
+                    pindexLastSent = pindex;
+                    if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
+                        break;
+                }
+                LogPrint("forks", "%s():%d - Pushing %d headers to node[%s]\n", __func__, __LINE__, vHeaders.size(), pfrom->addrName);
+                msgHeaders = SerializeNetMessage("headers", vHeaders);
+                if (hashStop.IsNull() && vHeaders.size() == MAX_HEADERS_RESULTS)
+                    CacheHeadersMessage(pindexFirst, pindexLastSent, msgHeaders);
             }
-            LogPrint("forks", "%s():%d - Pushing %d headers to node[%s]\n", __func__, __LINE__, vHeaders.size(), pfrom->addrName);
-            pfrom->PushMessage("headers", vHeaders);
+            pfrom->PushMessage(msgHeaders);
+
+            // The peer has these headers now, new blocks on top of them can be announced with theirs
+            CNodeState *nodestate = State(pfrom->GetId());
+            if (nodestate->pindexBestHeaderSent == NULL || pindexLastSent->nChainWork > nodestate->pindexBestHeaderSent->nChainWork)
+                nodestate->pindexBestHeaderSent = pindexLastSent;
         }
         else
         {
@@ -5509,16 +8364,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 std::vector<CBlock> vHeadersMulti;
                 int nLimit = MAX_HEADERS_RESULTS;
 
-                int h = pindexReference->nHeight;
-
                 LogPrint("forks", "%s():%d - Searching up to %s h(%d) from tips backwards\n",
                     __func__, __LINE__, pindexReference->GetBlockHash().ToString(), pindexReference->nHeight);
 
-                // we must follow all forks backwards because we can not tell which is the concerned one
-                // peer will discard headers already known if any
-                BOOST_FOREACH(auto mapPair, mGlobalForkTips)
+                // we must follow all forks stemming from the reference backwards because we can not tell which is
+                // the concerned one, peer will discard headers already known if any
+                BOOST_FOREACH(const CBlockIndex* block, mGlobalForkTips.GetDescendants(pindexReference))
                 {
-                    const CBlockIndex* block = mapPair.first;
                     if (block == chainActive.Tip() || block == pindexBestHeader )
                     {
                         LogPrint("forks", "%s():%d - skipping tips\n", __func__, __LINE__);
@@ -5530,49 +8382,26 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     LogPrint("forks", "%s():%d - tips %s h(%d)\n",
                         __func__, __LINE__, block->GetBlockHash().ToString(), block->nHeight);
 
-                    while (block && 
-                           block != pindexReference &&
-                           block->nHeight >= h)
+                    // stop where an already followed fork joins this one
+                    while (block != pindexReference && !sProcessed.count(block))
                     {
-                        if (!sProcessed.count(block) )
-                        {
-                            LogPrint("forks", "%s():%d - adding %s h(%d)\n",
-                                __func__, __LINE__, block->GetBlockHash().ToString(), block->nHeight);
-                            dHeadersAlternativeMulti.push_front(block->GetBlockHeader());
-                            sProcessed.insert(block);
-                        }
+                        LogPrint("forks", "%s():%d - adding %s h(%d)\n",
+                            __func__, __LINE__, block->GetBlockHash().ToString(), block->nHeight);
+                        dHeadersAlternativeMulti.push_front(block->GetBlockHeader());
+                        sProcessed.insert(block);
                         block = block->pprev;
                     }
 
-                    if (block == pindexReference)
+                    // we must process each deque in order to have a resulting vector with headers in the correct order
+                    // for all possible forks
+                    BOOST_FOREACH(const CBlock& cb, dHeadersAlternativeMulti)
                     {
-                        // we exited from the while loop with the right condition, therefore we must take this branch into account
-                        LogPrint("forks", "%s():%d - found reference %s h(%d)\n",
-                            __func__, __LINE__, block->GetBlockHash().ToString(), block->nHeight);
-
-                        // we must process each deque in order to have a resulting vector with headers in the correct order
-                        // for all possible forks
-                        BOOST_FOREACH(const CBlock& cb, dHeadersAlternativeMulti)
+                        if (--nLimit > 0)
                         {
-                            if (--nLimit > 0)
-                            {
-                                LogPrint("forks", "%s():%d -- [%s]\n", __func__, __LINE__, cb.GetHash().ToString() );
-                                vHeadersMulti.push_back(cb);
-                            }
+                            LogPrint("forks", "%s():%d -- [%s]\n", __func__, __LINE__, cb.GetHash().ToString() );
+                            vHeadersMulti.push_back(cb);
                         }
                     }
-                    else
-                    if (block->nHeight < h)
-                    {
-                        // we must neglect this branch since not linked to the reference
-                        LogPrint("forks", "%s():%d - could not find reference, stopped at %s h(%d)\n",
-                            __func__, __LINE__, block->GetBlockHash().ToString(), block->nHeight);
-                    }
-                    else
-                    {
-                        // should never happen
-                        LogPrint("forks", "%s():%d - block ptr is null\n", __func__, __LINE__);
-                    }
                 }
 
                 LogPrint("forks", "%s():%d - Pushing %d headers to node[%s]\n",
@@ -5596,6 +8425,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // The proofs of shielded transactions are verified before taking
+        // cs_main, which the other peers and the RPC calls would wait for
+        bool fAlreadyHave;
+        {
+            LOCK(cs_main);
+            fAlreadyHave = AlreadyHave(inv);
+        }
+        const bool fProofsVerify = fAlreadyHave || PreVerifyJoinSplitProofs(tx);
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
@@ -5604,10 +8442,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
+        if (!fProofsVerify) {
+            assert(recentBadProofs);
+            recentBadProofs->insert(inv.hash);
+            state.DoS(100, error("%s: joinsplit of tx %s does not verify", __func__, inv.hash.ToString()),
+                      REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
+        }
+
+        if (fProofsVerify && !AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs))
         {
             mempool.check(pcoinsTip);
-            RelayTransaction(tx);
+            RelayMempoolTransaction(tx);
             vWorkQueue.push_back(inv.hash);
 
             LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u)\n",
@@ -5619,16 +8464,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             set<NodeId> setMisbehaving;
             for (unsigned int i = 0; i < vWorkQueue.size(); i++)
             {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
+                // Copied out, AcceptToMemoryPool takes cs_main
+                vector<pair<uint256, COrphanTx> > vOrphans;
+                {
+                    LOCK(cs_orphans);
+                    boost::unordered_map<uint256, set<uint256>, SaltedUint256Hasher>::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
+                    if (itByPrev == mapOrphanTransactionsByPrev.end())
+                        continue;
+                    BOOST_FOREACH(const uint256& orphanHash, itByPrev->second)
+                        vOrphans.push_back(make_pair(orphanHash, mapOrphanTransactions[orphanHash]));
+                }
+                for (vector<pair<uint256, COrphanTx> >::const_iterator mi = vOrphans.begin();
+                     mi != vOrphans.end();
                      ++mi)
                 {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
+                    const uint256& orphanHash = mi->first;
+                    const CTransaction& orphanTx = mi->second.tx;
+                    NodeId fromPeer = mi->second.fromPeer;
                     bool fMissingInputs2 = false;
                     // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
                     // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
@@ -5641,7 +8493,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
                     {
                         LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
+                        RelayMempoolTransaction(orphanTx);
                         vWorkQueue.push_back(orphanHash);
                         vEraseQueue.push_back(orphanHash);
                     }
@@ -5666,6 +8518,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 }
             }
 
+            LOCK(cs_orphans);
             BOOST_FOREACH(uint256 hash, vEraseQueue)
                 EraseOrphanTx(hash);
         }
@@ -5675,8 +8528,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             AddOrphanTx(tx, pfrom->GetId());
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            unsigned int nEvicted = LimitOrphanTxSize(GetMaxOrphanTx(), GetMaxOrphanTxBytes());
             if (nEvicted > 0)
                 LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
         } else {
@@ -5732,6 +8584,52 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Verify the Equihash solutions of the whole batch in parallel and
+        // without holding cs_main, headers we already know are skipped.
+        // A header whose solution did not verify here goes through the full
+        // check in AcceptBlockHeader, which reports the error.
+        //
+        // With -checkpointheaders, the headers of the batch that extend the
+        // checkpointed chain and that a checkpoint further in the batch
+        // commits to, through the hash linkage, are known to be the
+        // checkpointed ones: only a sample of their solutions is checked, and
+        // the solution of each block is still checked in full by CheckBlock
+        // once it is downloaded. All other headers are checked in full, so a
+        // branch forking between two checkpoints gets no discount. Batches
+        // are not held back until a checkpoint comes, as checkpoints are tens
+        // of thousands of headers apart.
+        std::vector<char> vSolutionValid(nCount, 0);
+        {
+            std::vector<CBlockHeader> vUnknown;
+            std::vector<unsigned int> vUnknownPos;
+            {
+                LOCK(cs_main);
+                const Checkpoints::CCheckpointData& checkpoints = chainparams.Checkpoints();
+                size_t nLinked = 0;
+                if (fCheckpointHeaders && fCheckpointsEnabled && nCount > 0) {
+                    BlockMap::iterator mi = mapBlockIndex.find(headers[0].hashPrevBlock);
+                    if (mi != mapBlockIndex.end() && mi->second->nHeight < Checkpoints::GetTotalBlocksEstimate(checkpoints) &&
+                        Checkpoints::IsOnCheckpointedChain(checkpoints, mi->second))
+                        nLinked = Checkpoints::CountLinkedToCheckpoint(checkpoints, mi->second->nHeight, mi->first, headers);
+                }
+                for (unsigned int n = 0; n < nCount; n++) {
+                    const uint256 hash = headers[n].GetHash();
+                    if (mapBlockIndex.count(hash) == 0) {
+                        if (n < nLinked && GetRand(CHECKPOINT_HEADERS_SAMPLE) != 0) {
+                            vSolutionValid[n] = 1;
+                            continue;
+                        }
+                        vUnknown.push_back(headers[n]);
+                        vUnknownPos.push_back(n);
+                    }
+                }
+            }
+            std::vector<char> vUnknownValid;
+            CheckEquihashSolutions(vUnknown, vUnknownValid);
+            for (unsigned int i = 0; i < vUnknown.size(); i++)
+                vSolutionValid[vUnknownPos[i]] = vUnknownValid[i];
+        }
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -5739,6 +8637,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        if (nCount <= MAX_BLOCKS_TO_ANNOUNCE && mapBlockIndex.count(headers[0].hashPrevBlock) == 0) {
+            // An announcement on top of headers we miss, ask for them the way an inv would
+            const uint256 hashLast = headers.back().GetHash();
+            UpdateBlockAvailability(pfrom->GetId(), hashLast);
+            LogPrint("net", "%s():%d - unconnecting headers, getheaders (%d) %s to peer=%d\n",
+                __func__, __LINE__, pindexBestHeader->nHeight, hashLast.ToString(), pfrom->id);
+            pfrom->PushMessage("getheaders", GetLocatorWithForkTips(), hashLast);
+            return true;
+        }
+
         CBlockIndex *pindexLast = NULL;
         int cnt = 0;
         BOOST_FOREACH(const CBlockHeader& header, headers) {
@@ -5751,7 +8659,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             
             bool lookForwardTips = (++cnt == MAX_HEADERS_RESULTS);
              
-            if (!AcceptBlockHeader(header, state, &pindexLast, lookForwardTips)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, lookForwardTips, vSolutionValid[cnt - 1])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -5764,6 +8672,35 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
+        // Announced main chain or fork tips are fetched right away when we are close to being synced,
+        // as for an inv but without the getheaders round trip. Announcements too far ahead of the
+        // blocks we have are left to the regular block download.
+        CNodeState *nodestate = State(pfrom->GetId());
+        if (pindexLast && nCount <= MAX_BLOCKS_TO_ANNOUNCE && pindexLast->IsValid(BLOCK_VALID_TREE) &&
+            chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().nPowTargetSpacing * 20) {
+            std::vector<CBlockIndex*> vToFetch;
+            CBlockIndex *pindexWalk = pindexLast;
+            while (pindexWalk && !(pindexWalk->nStatus & BLOCK_HAVE_DATA) && vToFetch.size() < MAX_BLOCKS_TO_ANNOUNCE) {
+                if (!mapBlocksInFlight.count(pindexWalk->GetBlockHash()))
+                    vToFetch.push_back(pindexWalk);
+                pindexWalk = pindexWalk->pprev;
+            }
+            if (pindexWalk && (pindexWalk->nStatus & BLOCK_HAVE_DATA)) {
+                std::vector<CInv> vGetData;
+                BOOST_REVERSE_FOREACH(CBlockIndex *pindex, vToFetch) {
+                    if (nodestate->nBlocksInFlight >= GetBlocksInTransitLimit(nodestate->nAvgBlockTime))
+                        break;
+                    vGetData.push_back(nodestate->fProvidesHeaderAndIDs ? CInv(MSG_CMPCT_BLOCK, pindex->GetBlockHash()) : CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex);
+                }
+                if (!vGetData.empty()) {
+                    LogPrint("net", "%s():%d - fetching %u announced blocks up to %s from peer=%d\n",
+                        __func__, __LINE__, vGetData.size(), pindexLast->GetBlockHash().ToString(), pfrom->id);
+                    pfrom->PushMessage("getdata", vGetData);
+                }
+            }
+        }
+
         if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
@@ -5794,24 +8731,170 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
-        // Process all blocks from whitelisted peers, even if not requested,
-        // unless we're still syncing with the network.
-        // Such an unrequested block may still be processed, subject to the
-        // conditions in AcceptBlock().
-        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            LogPrint("forks", "%s():%d - Pushing reject, DoS[%d]\n", __func__, __LINE__, nDoS);
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+        // A block asked for after it was pruned is kept aside, not processed again
+        if (ReceivedPrunedBlock(pfrom, block))
+            return true;
+
+        // Hand the block to the pre-validation threads if there are any,
+        // it is processed right here when their queue is full.
+        if (!QueueBlockForPrevalidation(pfrom, block))
+            ProcessBlockFromPeer(pfrom, block);
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex && !fReindexFast) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        const uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "%s():%d - received cmpctblock %s peer=%d\n", __func__, __LINE__, hash.ToString(), pfrom->id);
+
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId()) {
+                // We only ask for compact blocks, they are never pushed to us
+                LogPrint("net", "%s():%d - unrequested cmpctblock %s peer=%d\n", __func__, __LINE__, hash.ToString(), pfrom->id);
+                return true;
+            }
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // Doesn't connect, let the usual headers first download fetch it
+                MarkBlockAsReceived(hash);
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    MarkBlockAsReceived(hash);
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header received in cmpctblock");
+                }
+                return true;
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA) {
+                MarkBlockAsReceived(hash);
+                return true;
+            }
+
+            boost::shared_ptr<PartiallyDownloadedBlock> partialBlock(new PartiallyDownloadedBlock(&mempool));
+            ReadStatus status = partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid compact block from peer=%d", pfrom->id);
+            }
+
+            BlockTransactionsRequest req;
+            if (status == READ_STATUS_OK) {
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock->IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                if (req.indexes.empty())
+                    status = partialBlock->FillBlock(block, std::vector<CTransaction>());
+            }
+
+            if (status == READ_STATUS_FAILED) {
+                // Short id collisions, fall back to the full block
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                pfrom->PushMessage("getdata", vInv);
+            } else if (req.indexes.empty()) {
+                fBlockReconstructed = true;
+            } else {
+                req.blockhash = hash;
+                itInFlight->second.second->partialBlock = partialBlock;
+                pfrom->PushMessage("getblocktxn", req);
+            }
+        }
+
+        if (fBlockReconstructed && !QueueBlockForPrevalidation(pfrom, block))
+            ProcessBlockFromPeer(pfrom, block);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex && !fReindexFast) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(resp.blockhash);
+            if (itInFlight == mapBlocksInFlight.end() || !itInFlight->second.second->partialBlock ||
+                itInFlight->second.first != pfrom->GetId()) {
+                LogPrint("net", "%s():%d - unrequested blocktxn %s peer=%d\n", __func__, __LINE__, resp.blockhash.ToString(), pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = itInFlight->second.second->partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid blocktxn from peer=%d", pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // A mempool transaction matched a short id by chance, fall back to the full block
+                itInFlight->second.second->partialBlock.reset();
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage("getdata", vInv);
+            } else {
+                fBlockReconstructed = true;
             }
         }
 
+        if (fBlockReconstructed && !QueueBlockForPrevalidation(pfrom, block))
+            ProcessBlockFromPeer(pfrom, block);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "%s():%d - getblocktxn for unknown block %s peer=%d\n", __func__, __LINE__, req.blockhash.ToString(), pfrom->id);
+            return true;
+        }
+
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Only recent blocks are sent compactly, answer as if the full block was asked for
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        CBlock block;
+        ReadBlockForPeer(block, mi->second, FindRecentBlockMessages(req.blockhash));
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("getblocktxn with out-of-bounds tx indices from peer=%d", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
     }
 
 
@@ -5830,7 +8913,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -5999,16 +9085,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         // Nodes must NEVER send a data item > 520 bytes (the max size for a script data object,
         // and thus, the maximum size any matched object can have) in a filteradd message
+        bool bad = false;
         if (vData.size() > MAX_SCRIPT_ELEMENT_SIZE)
         {
-            Misbehaving(pfrom->GetId(), 100);
+            bad = true;
         } else {
             LOCK(pfrom->cs_filter);
             if (pfrom->pfilter)
                 pfrom->pfilter->insert(vData);
             else
-                Misbehaving(pfrom->GetId(), 100);
+                bad = true;
         }
+        // Not under cs_filter, as Misbehaving takes cs_main
+        if (bad)
+            Misbehaving(pfrom->GetId(), 100);
     }
 
 
@@ -6061,6 +9151,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 }
 
 // requires LOCK(cs_vRecvMsg)
+/** The class of costly messages strCommand belongs to, a peer gets a bounded share of the handler time for each */
+static MessageClass GetMessageClass(const std::string& strCommand)
+{
+    if (strCommand == "tx")
+        return MSG_CLASS_TX;
+    if (strCommand == "getdata" || strCommand == "getheaders" || strCommand == "getblocks" ||
+        strCommand == "getblocktxn" || strCommand == "mempool" || strCommand == "getaddr")
+        return MSG_CLASS_REQUEST;
+    return MSG_CLASS_UNLIMITED;
+}
+
 bool ProcessMessages(CNode* pfrom)
 {
     //if (fDebug)
@@ -6076,8 +9177,19 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
-    if (!pfrom->vRecvGetData.empty())
+    // A peer out of handler time for a class of costly messages waits for its budget
+    // to refill, while the other peers keep being served; whitelisted peers never wait
+    pfrom->fRecvThrottled = false;
+
+    if (!pfrom->vRecvGetData.empty()) {
+        if (!pfrom->fWhitelisted && !pfrom->msgBudget[MSG_CLASS_REQUEST].Available(GetTimeMicros())) {
+            pfrom->fRecvThrottled = true;
+            return fOk;
+        }
+        int64_t nStart = GetTimeMicros();
         ProcessGetData(pfrom);
+        pfrom->msgBudget[MSG_CLASS_REQUEST].Consume(GetTimeMicros() - nStart);
+    }
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
@@ -6100,6 +9212,12 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        MessageClass msgClass = pfrom->fWhitelisted ? MSG_CLASS_UNLIMITED : GetMessageClass(msg.hdr.GetCommand());
+        if (msgClass != MSG_CLASS_UNLIMITED && !pfrom->msgBudget[msgClass].Available(GetTimeMicros())) {
+            pfrom->fRecvThrottled = true;
+            break;
+        }
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -6123,7 +9241,7 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
+        CPublicDataStream& vRecv = msg.vRecv;
         uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
         unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
         if (nChecksum != hdr.nChecksum)
@@ -6135,8 +9253,10 @@ bool ProcessMessages(CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nStart = GetTimeMicros();
         try
         {
+            MetricsScopedTimer timer(netMessageTimes.get(strCommand));
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
             boost::this_thread::interruption_point();
         }
@@ -6167,6 +9287,9 @@ bool ProcessMessages(CNode* pfrom)
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        if (msgClass != MSG_CLASS_UNLIMITED)
+            pfrom->msgBudget[msgClass].Consume(GetTimeMicros() - nStart);
+
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
 
@@ -6181,6 +9304,47 @@ bool ProcessMessages(CNode* pfrom)
 }
 
 
+namespace {
+/** Orders transaction hashes the way they are announced, see CTxMemPool::CompareDepthAndScore */
+class CompareInvMempoolOrder
+{
+    const CTxMemPool *mp;
+public:
+    CompareInvMempoolOrder(const CTxMemPool *mempool) : mp(mempool) {}
+
+    bool operator()(const uint256& a, const uint256& b) const
+    {
+        return mp->CompareDepthAndScore(a, b);
+    }
+};
+} // anon namespace
+
+/**
+ * The headers to announce pindex with: those of its ancestors the peer is not
+ * known to have, and its own. Fails when the peer has pindex already or misses
+ * more than MAX_BLOCKS_TO_ANNOUNCE headers, the block is announced with an inv
+ * then. Requires cs_main and pto->cs_inventory.
+ */
+static bool GetHeadersToAnnounce(CNode* pto, CNodeState* state, const CBlockIndex* pindex, std::vector<CBlock>& vHeaders)
+{
+    std::vector<const CBlockIndex*> vMissing;
+    const CBlockIndex* pindexWalk = pindex;
+    while (pindexWalk && !PeerHasHeader(state, pindexWalk) && !pto->filterInventoryKnown.contains(pindexWalk->GetBlockHash())) {
+        if (vMissing.size() >= MAX_BLOCKS_TO_ANNOUNCE)
+            return false;
+        vMissing.push_back(pindexWalk);
+        pindexWalk = pindexWalk->pprev;
+    }
+    if (vMissing.empty())
+        return false;
+
+    // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
+    vHeaders.clear();
+    BOOST_REVERSE_FOREACH(const CBlockIndex* pindexMissing, vMissing)
+        vHeaders.push_back(pindexMissing->GetBlockHeader());
+    return true;
+}
+
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -6230,8 +9394,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -6245,23 +9411,32 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         if (fSendTrickle)
         {
-            vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+            vector<CAddress> vAddrToSend;
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                // Other peers' handler threads relay addresses to this node
+                LOCK(pto->cs_vAddrToSend);
+                vAddrToSend.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddrToSend.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+            }
+            vector<CAddress> vAddr;
+            BOOST_FOREACH(const CAddress& addr, vAddrToSend)
+            {
+                vAddr.push_back(addr);
+                // receiver rejects addr messages larger than 1000
+                if (vAddr.size() >= 1000)
+                {
+                    pto->PushMessage("addr", vAddr);
+                    vAddr.clear();
+                }
             }
-            pto->vAddrToSend.clear();
             if (!vAddr.empty())
                 pto->PushMessage("addr", vAddr);
         }
@@ -6287,8 +9462,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         state.rejects.clear();
 
         // Start block sync
-        if (pindexBestHeader == NULL)
+        if (pindexBestHeader == NULL) {
             pindexBestHeader = chainActive.Tip();
+            nBestHeaderHeight = pindexBestHeader->nHeight;
+        }
         bool fFetch = state.fPreferredDownload || (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot); // Download if this is a nice peer, or we have no nice peers and this one might do.
         if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex && !fReindexFast) {
             // Only actively request headers from a single peer, unless we're close to today.
@@ -6325,51 +9502,121 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             GetMainSignals().Broadcast(nTimeBestReceived);
         }
 
+        //
+        // Fork tips go to the inventory at a bounded rate, the most worthy first
+        //
+        if (!state.setForkTipsToAnnounce.empty()) {
+            int64_t nNow = GetTimeMicros();
+            state.dForkRelayAllowance = std::min((double)MAX_FORK_RELAY_INV_PER_SECOND,
+                state.dForkRelayAllowance + (nNow - state.nForkRelayRefillTime) * MAX_FORK_RELAY_INV_PER_SECOND / 1000000.0);
+            state.nForkRelayRefillTime = nNow;
+            while (state.dForkRelayAllowance >= 1 && !state.setForkTipsToAnnounce.empty()) {
+                std::set<const CBlockIndex*, CBlockIndexWorkComparator>::iterator it = --state.setForkTipsToAnnounce.end();
+                const CBlockIndex* pindex = *it;
+                state.setForkTipsToAnnounce.erase(it);
+                // Tips that joined the main chain meanwhile are announced as such
+                if (chainActive.Contains(pindex))
+                    continue;
+                const uint256 hash = pindex->GetBlockHash();
+                {
+                    LOCK(pto->cs_inventory);
+                    if (pto->filterInventoryKnown.contains(hash))
+                        continue;
+                }
+                LogPrint("forks", "%s():%d - Announcing fork tip to Node [%s] (id=%d) hash[%s]\n",
+                    __func__, __LINE__, pto->addrName, pto->GetId(), hash.ToString());
+                pto->PushBlockHash(hash);
+                state.dForkRelayAllowance -= 1;
+            }
+        }
+
+        //
+        // Message: headers
+        //
+        {
+            LOCK(pto->cs_inventory);
+            BOOST_FOREACH(const uint256& hash, pto->vBlockHashesToAnnounce)
+            {
+                if (pto->filterInventoryKnown.contains(hash))
+                    continue;
+                BlockMap::iterator mi = mapBlockIndex.find(hash);
+                assert(mi != mapBlockIndex.end());
+                const CBlockIndex* pindex = mi->second;
+
+                // Main chain and fork tips alike, a peer preferring headers gets those it misses
+                // so that it can validate them and fetch the block right away
+                vector<CBlock> vHeaders;
+                if (state.fPreferHeaders && GetHeadersToAnnounce(pto, &state, pindex, vHeaders)) {
+                    BOOST_FOREACH(const CBlock& header, vHeaders)
+                        pto->filterInventoryKnown.insert(header.GetHash());
+                    if (chainActive.Contains(pindex) &&
+                        (state.pindexBestHeaderSent == NULL || pindex->nChainWork > state.pindexBestHeaderSent->nChainWork))
+                        state.pindexBestHeaderSent = pindex;
+                    LogPrint("net", "%s():%d - announcing %s with %u headers to peer=%d\n",
+                        __func__, __LINE__, hash.ToString(), vHeaders.size(), pto->id);
+                    pto->PushMessage("headers", vHeaders);
+                } else {
+                    pto->vInventoryBlockToSend.push_back(CInv(MSG_BLOCK, hash));
+                }
+            }
+            pto->vBlockHashesToAnnounce.clear();
+        }
+
         //
         // Message: inventory
         //
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
-            BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
+            vInv.reserve(std::max<size_t>(pto->vInventoryBlockToSend.size(), INVENTORY_BROADCAST_MAX));
+
+            // Blocks go out right away
+            BOOST_FOREACH(const CInv& inv, pto->vInventoryBlockToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(inv.hash))
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                pto->filterInventoryKnown.insert(inv.hash);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
+                    LogPrint("forks", "%s():%d - Pushing inv\n", __func__, __LINE__);
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
-
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+            }
+            pto->vInventoryBlockToSend.clear();
+
+            // Transactions are trickled out in batches at Poisson distributed times, to protect privacy,
+            // the highest fee rates first
+            int64_t nNow = GetTimeMicros();
+            bool fSendTxs = pto->fWhitelisted;
+            if (pto->nNextInvSend < nNow) {
+                fSendTxs = true;
+                pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+            }
+            if (fSendTxs && !pto->setInventoryTxToSend.empty()) {
+                vector<uint256> vInvTx;
+                vInvTx.reserve(pto->setInventoryTxToSend.size());
+                BOOST_FOREACH(const uint256& hash, pto->setInventoryTxToSend) {
+                    if (!pto->filterInventoryKnown.contains(hash))
+                        vInvTx.push_back(hash);
+                }
+                size_t nSend = std::min<size_t>(vInvTx.size(), INVENTORY_BROADCAST_MAX);
                 {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
-                        LogPrint("forks", "%s():%d - Pushing inv\n", __func__, __LINE__);
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                    LOCK(mempool.cs);
+                    std::partial_sort(vInvTx.begin(), vInvTx.begin() + nSend, vInvTx.end(), CompareInvMempoolOrder(&mempool));
+                }
+                // What is left waits for the next trickle
+                pto->setInventoryTxToSend.clear();
+                pto->setInventoryTxToSend.insert(vInvTx.begin() + nSend, vInvTx.end());
+                for (size_t i = 0; i < nSend; i++) {
+                    // Not announced if it left the mempool meanwhile
+                    if (!mempool.exists(vInvTx[i]))
+                        continue;
+                    pto->filterInventoryKnown.insert(vInvTx[i]);
+                    vInv.push_back(CInv(MSG_TX, vInvTx[i]));
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
         if (!vInv.empty())
         {
@@ -6413,10 +9660,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nMaxInFlight = GetBlocksInTransitLimit(state.nAvgBlockTime);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nMaxInFlight) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexWaitingFor = NULL;
+            FindNextBlocksToDownload(pto->GetId(), nMaxInFlight - state.nBlocksInFlight, vToDownload, staller, pindexWaitingFor);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
@@ -6429,6 +9678,25 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
+            // The first block in flight is the one holding back the download window: if another peer is late with
+            // it, given how fast that peer has been so far, ask this one too instead of waiting for the timeout
+            if (pindexWaitingFor && state.nBlocksInFlight < nMaxInFlight) {
+                const uint256 &hash = pindexWaitingFor->GetBlockHash();
+                map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+                if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first != pto->GetId() &&
+                    !itInFlight->second.second->partialBlock && !mapBlocksRerequested.count(hash)) {
+                    const CNodeState *stateOwner = State(itInFlight->second.first);
+                    int64_t nAge = nNow - itInFlight->second.second->nTime;
+                    int64_t nExpected = stateOwner->nAvgBlockTime * stateOwner->nBlocksInFlight;
+                    bool fNotSlower = state.nAvgBlockTime == 0 || stateOwner->nAvgBlockTime == 0 || state.nAvgBlockTime < stateOwner->nAvgBlockTime;
+                    if (nAge > 1000000LL * BLOCK_REREQUEST_MIN_AGE && nAge > 2 * nExpected && fNotSlower) {
+                        vGetData.push_back(CInv(MSG_BLOCK, hash));
+                        mapBlocksRerequested[hash] = pto->GetId();
+                        LogPrint("net", "%s():%d Requesting late block %s (%d) from peer=%d as well as peer=%d\n",
+                            __func__, __LINE__, hash.ToString(), pindexWaitingFor->nHeight, pto->id, itInFlight->second.first);
+                    }
+                }
+            }
         }
 
         //
@@ -6472,14 +9740,13 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
-        mapBlockIndex.clear();
+        DeleteBlockIndexEntries();
 
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphanTransactionsByPeer.clear();
+        mapOrphanBytesByPeer.clear();
     }
 } instance_of_cmaincleanup;
 
@@ -6493,6 +9760,8 @@ bool RelayAlternativeChain(CValidationState &state, CBlock *pblock, BlockSet* sF
 
     const CChainParams& chainParams = Params();
     uint256 hashAlternativeTip = pblock->GetHash();
+
+    LOCK(cs_main);
     //LogPrint("forks", "%s():%d - Entering with hash[%s]\n", __func__, __LINE__, hashAlternativeTip.ToString() );
 
     // 1. check this is the best chain tip, in this case exit
@@ -6547,14 +9816,7 @@ bool RelayAlternativeChain(CValidationState &state, CBlock *pblock, BlockSet* sF
     LogPrint("forks", "%s():%d - sForkTips(%d) - h[%d] %s\n",
         __func__, __LINE__, sForkTips->size(), pindex->nHeight, pindex->GetBlockHash().ToString() );
 
-    std::vector<CInv> vInv;
-    
-    BOOST_FOREACH(const CBlockIndex* block, *sForkTips)
-    {
-        vInv.push_back(CInv(MSG_BLOCK, block->GetBlockHash()) );
-    }
-
-    // 5. push inv list up to the alternative tips
+    // 5. queue the alternative tips for the peers, SendMessages announces them at a bounded rate
     int nBlockEstimate = 0;
     if (fCheckpointsEnabled)
         nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainParams.Checkpoints());
@@ -6572,16 +9834,17 @@ bool RelayAlternativeChain(CValidationState &state, CBlock *pblock, BlockSet* sF
             {
                 nodeHeight = nBlockEstimate;
             }
-            if (chainActive.Height() > nodeHeight)
+            CNodeState* nodestate = State(pnode->GetId());
+            if (nodestate && chainActive.Height() > nodeHeight)
             {
+                BOOST_FOREACH(const CBlockIndex* block, *sForkTips)
                 {
-                    BOOST_FOREACH(CInv& inv, vInv)
-                    {
-                        LogPrint("forks", "%s():%d - Pushing inv to Node [%s] (id=%d) hash[%s]\n",
-                            __func__, __LINE__, pnode->addrName, pnode->GetId(), inv.hash.ToString() );
-                        pnode->PushInventory(inv);
-                    }
+                    LogPrint("forks", "%s():%d - Queueing inv to Node [%s] (id=%d) hash[%s]\n",
+                        __func__, __LINE__, pnode->addrName, pnode->GetId(), block->GetBlockHash().ToString() );
+                    nodestate->setForkTipsToAnnounce.insert(block);
                 }
+                while (nodestate->setForkTipsToAnnounce.size() > MAX_FORK_RELAY_QUEUE_SIZE)
+                    nodestate->setForkTipsToAnnounce.erase(nodestate->setForkTipsToAnnounce.begin());
             }
         }
     }
@@ -6748,7 +10011,7 @@ void dump_index(const CBlockIndex* pindex, int val)
 
 void dump_db()
 {
-    if (!LogAcceptCategory("forks") )
+    if (!LogAcceptCategory(LOG_CATEGORY("forks")) )
     {
         return;
     }
@@ -6804,7 +10067,7 @@ void dump_db()
 
 void dump_candidates()
 {
-    if (!LogAcceptCategory("forks") )
+    if (!LogAcceptCategory(LOG_CATEGORY("forks")) )
     {
         return;
     }
@@ -6820,7 +10083,7 @@ void dump_candidates()
 
 void dump_global_tips(int limit)
 {
-    if (!LogAcceptCategory("forks") )
+    if (!LogAcceptCategory(LOG_CATEGORY("forks")) )
     {
         return;
     }
@@ -6853,7 +10116,7 @@ void dump_global_tips(int limit)
 
 void dump_dirty()
 {
-    if (!LogAcceptCategory("forks") )
+    if (!LogAcceptCategory(LOG_CATEGORY("forks")) )
     {
         return;
     }
@@ -10,6 +10,7 @@
 #include "config/bitcoin-config.h"
 #endif
 
+#include "addressindex.h"
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -22,8 +23,10 @@
 #include "versionbits.h"
 
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -34,15 +37,19 @@
 
 class CTransaction;
 class CCoins;
+class CCoinsViewBackgroundFlush;
 class CCoinsViewCache;
+class CCoinsViewDB;
 class CCoinsView;
 class CBlock;
 class CBlockLocator;
 class CBlockTreeDB;
+class CProofCheck;
 class CScriptCheck;
 class CValidationState;
 
 struct CNodeStateStats;
+struct CTxOutSetSnapshotHeader;
 
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = MAX_BLOCK_SIZE;
@@ -63,32 +70,132 @@ static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphantxsize, maximum total size in kilobytes of the orphan transactions kept in memory */
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE = 500;
+/** Larger orphan transactions are not kept, a peer with a legitimate one will send it again once its parents are known */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** A peer may fill at most 1/ORPHAN_TX_PEER_SHARE of the orphan pool, by count and by size */
+static const unsigned int ORPHAN_TX_PEER_SHARE = 4;
+/** Seconds an orphan transaction is kept without its parents showing up */
+static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
+/** Seconds between scans of the orphan pool for expired transactions */
+static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool, save the mempool on shutdown and load it on restart */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -blockfilterindex, keep a filter of each block's scriptPubKeys for wallet rescans */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Default for -compacttxindex, keep -txindex by truncated txid and block height rather than by full position */
+static const bool DEFAULT_COMPACT_TXINDEX = false;
+/** Defaults for -addressindex, -spentindex and -timestampindex, the explorer indexes */
+static const bool DEFAULT_ADDRESSINDEX = false;
+static const bool DEFAULT_SPENTINDEX = false;
+static const bool DEFAULT_TIMESTAMPINDEX = false;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Factor of the pre-allocation chunk sizes during initial block download, when not pruning */
+static const unsigned int IBD_FILE_CHUNK_FACTOR = 4;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** -parproofs default (verify JoinSplit proofs of connected blocks on the -par worker threads) */
+static const bool DEFAULT_PARALLEL_PROOF_CHECK = true;
+/** -prevalidationthreads default (threads doing the context-free checks of received blocks, 0 = none) */
+static const int DEFAULT_PREVALIDATION_THREADS = 0;
+/** -prefetchthreads default (threads reading the inputs of a block into the coins cache before it is connected, 0 = none) */
+static const int DEFAULT_PREFETCH_THREADS = 8;
+/** -reindexthreads default (threads reading and checking blk files ahead of a reindex, 0 = none) */
+static const int DEFAULT_REINDEX_THREADS = 2;
+/** Maximum number of received blocks waiting for pre-validation before they are processed inline */
+static const unsigned int MAX_PREVALIDATION_QUEUE_SIZE = 64;
+/** Maximum number of blocks disconnected, their blocks and undo data held in memory, before the coins cache is flushed in a reorg */
+static const unsigned int MAX_DISCONNECT_BATCH_BLOCKS = 16;
+/** -checkblocksbackground default */
+static const bool DEFAULT_CHECKBLOCKS_BACKGROUND = false;
+/** -checkpointheaders default, sampling the solutions of the headers a checkpoint commits to during header sync */
+static const bool DEFAULT_CHECKPOINT_HEADERS = true;
+/** One in this many of the headers a checkpoint commits to has its solution checked with -checkpointheaders */
+static const unsigned int CHECKPOINT_HEADERS_SAMPLE = 32;
+/** -checkblockindexsample default: walk the whole block tree */
+static const unsigned int DEFAULT_CHECK_BLOCK_INDEX_SAMPLE = 100;
+/** -stopatheight default (shut down once the tip reaches this height, 0 = never) */
+static const int DEFAULT_STOPATHEIGHT = 0;
+/** Number of blocks that can be requested at any given time from a single peer, until its download speed is known. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the number of blocks in flight from a single peer whose download speed is known. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER = 64;
+/** Seconds worth of blocks, at its measured speed, kept in flight from each peer. */
+static const int BLOCK_DOWNLOAD_QUEUE_TIME = 10;
+/** Weight of the last block, out of 8, in the moving average of the time a peer takes per block. */
+static const int BLOCK_DOWNLOAD_TIME_WEIGHT = 2;
+/** -mmapblockfiles default, reading older block and undo files through read-only memory mappings */
+static const bool DEFAULT_MMAP_BLOCK_FILES = false;
+/** Most block and undo files kept mapped at once with -mmapblockfiles */
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 64;
+/** -compressblocks default, storing new blocks zlib compressed in the block files */
+static const bool DEFAULT_COMPRESS_BLOCKS = false;
+/** Number of blocks near the tip kept in wire format, for the peers fetching them right after they are announced. */
+static const unsigned int MAX_RECENT_BLOCK_MESSAGES = 8;
+/** Average delay between trickled transaction announcements in seconds, half of it for outbound
+ *  peers; whitelisted peers are sent them right away */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Most transactions announced per trickle, limiting the impact of low-fee transaction floods */
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
+/** Fork tips announced to a peer per second at most, after a burst of as many */
+static const unsigned int MAX_FORK_RELAY_INV_PER_SECOND = 8;
+/** Fork tips waiting to be announced to a peer at most, the least worthy are dropped */
+static const unsigned int MAX_FORK_RELAY_QUEUE_SIZE = 128;
+/** Headers sent at most to announce a block to a peer that prefers headers, the block is announced
+ *  with an inv when the peer misses more of its ancestors */
+static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 160;
+/** Number of full "headers" replies kept in wire format, for the peers syncing through the same ranges. */
+static const unsigned int MAX_RECENT_HEADERS_MESSAGES = 32;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
- *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
+ *  harder). This is the smallest window, see BLOCK_DOWNLOAD_WINDOW_TIME. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** The download window grows beyond BLOCK_DOWNLOAD_WINDOW to hold this many seconds worth of blocks at the
+ *  measured download speed of all peers together, up to MAX_BLOCK_DOWNLOAD_WINDOW. */
+static const unsigned int BLOCK_DOWNLOAD_WINDOW_TIME = 60;
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 8192;
+/** Seconds the block holding back the download window must have been in flight, and at least twice as long as
+ *  its peer should take for it, before it is requested from a second peer as well. */
+static const unsigned int BLOCK_REREQUEST_MIN_AGE = 5;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Blocks within this much equivalent proof-of-work time (in seconds) of the best header are verified even below -assumevalid. */
+static const int64_t ASSUMEVALID_MIN_DEPTH_TIME = 60 * 60 * 24 * 7 * 2;
+/** -dynamicdbcache default: resize the coins cache to the memory left, and grow it during initial block download */
+static const bool DEFAULT_DYNAMIC_DB_CACHE = true;
+/** Seconds between resizings of the coins cache to the memory left */
+static const unsigned int COIN_CACHE_RESIZE_INTERVAL = 10;
+/** Memory left to the rest of the process, and the system, when the coins cache grows into what is free */
+static const int64_t MIN_MEMORY_HEADROOM = 256 << 20;
+/** Percentage of time stalled on memory (see GetMemoryPressure) from which the coins cache is halved */
+static const double COIN_CACHE_SHRINK_PRESSURE = 10.0;
+/** Percentage of its limit the coins cache keeps, of the most recently used coins, when written to disk but not emptied */
+static const unsigned int COIN_CACHE_KEEP_PERCENT = 50;
+/** -coinswriteinterval default: seconds between writes of the modified coins, which stay cached, once synced */
+static const unsigned int DEFAULT_COINS_WRITE_INTERVAL = 5 * 60;
+/** The coins cache is never limited below this */
+static const size_t MIN_COIN_CACHE_USAGE = 4 << 20;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /* Maximum number of heigths meaningful when looking for block finality */
@@ -122,14 +229,43 @@ extern bool fImporting;
 extern bool fReindex;
 extern bool fReindexFast;
 extern int nScriptCheckThreads;
+extern bool fParallelProofCheck;
+extern int nPrevalidationThreads;
+extern int nPrefetchThreads;
 extern bool fTxIndex;
+/** Whether the transaction index is kept in the compact format, by truncated txid, height and offset */
+extern bool fCompactTxIndex;
+/** Whether to keep a filter of the scriptPubKeys of each connected block, used by wallet rescans */
+extern bool fBlockFilterIndex;
+/** Whether to index the outputs paid to and spent from each address */
+extern bool fAddressIndex;
+/** Whether to index where each output was spent */
+extern bool fSpentIndex;
+/** Whether to index the blocks by their timestamp */
+extern bool fTimestampIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
+/** Percentage of the unchanged block index entries CheckBlockIndex verifies, see -checkblockindexsample */
+extern unsigned int nCheckBlockIndexSample;
 extern bool fCheckpointsEnabled;
+/** Whether the solutions of headers linked to a checkpoint are only sampled during header sync (-checkpointheaders) */
+extern bool fCheckpointHeaders;
+extern bool fMmapBlockFiles;
+/** Whether new blocks are written compressed to the block files (-compressblocks) */
+extern bool fCompressBlocks;
+/** Block whose ancestors are assumed to have valid scripts and JoinSplit proofs (-assumevalid) */
+extern uint256 hashAssumeValid;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
+/** Memory the coins cache may use before it is flushed, resized by FlushStateToDisk if -dynamicdbcache */
 extern size_t nCoinCacheUsage;
+/** The coins cache limits configured for after, and during, initial block download */
+extern size_t nCoinCacheUsageSynced;
+extern size_t nCoinCacheUsageIBD;
+extern bool fDynamicCoinCache;
+/** Seconds between writes of the modified coins once synced, so that little is left to write at shutdown, 0 for none */
+extern int64_t nCoinsWriteInterval;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -149,12 +285,52 @@ struct CompareBlocksByHeight
 };
 
 typedef std::map<const CBlockIndex*, int, CompareBlocksByHeight> BlockTimeMap;
-extern BlockTimeMap mGlobalForkTips;
 
 typedef std::set<const CBlockIndex*, CompareBlocksByHeight> BlockSet;
-extern BlockSet sGlobalForkTips;
 static const int MAX_NUM_GLOBAL_FORKS = 3;
 
+/**
+ * The tips of the known forks with the time they were last accessed. Iterating
+ * gives (tip, time) pairs by decreasing height as a BlockTimeMap does, while a
+ * second index ordered by access time gives the most recent tips directly.
+ */
+class CGlobalForkTips
+{
+private:
+    BlockTimeMap mapTips;
+    std::set<std::pair<int, const CBlockIndex*> > setByAccessTime;
+    uint64_t nVersion;
+
+public:
+    typedef BlockTimeMap::const_iterator iterator;
+    typedef BlockTimeMap::const_iterator const_iterator;
+
+    CGlobalForkTips() : nVersion(0) {}
+
+    const_iterator begin() const { return mapTips.begin(); }
+    const_iterator end() const { return mapTips.end(); }
+    size_t size() const { return mapTips.size(); }
+    size_t count(const CBlockIndex* pindex) const { return mapTips.count(pindex); }
+    void clear();
+    /** Changes whenever a tip is added or removed, access times aside. */
+    uint64_t GetVersion() const { return nVersion; }
+
+    /** Add a tip accessed at nTime, returns false if it was known already. */
+    bool insert(const CBlockIndex* pindex, int nTime);
+    /** Remove a tip, returns the number of tips removed. */
+    size_t erase(const CBlockIndex* pindex);
+    /** Set the access time of a known tip. */
+    void touch(const CBlockIndex* pindex, int nTime);
+    /** The access time of a known tip. */
+    int GetAccessTime(const CBlockIndex* pindex) const;
+
+    /** The tips higher than pindex and descending from it, by decreasing height. */
+    std::vector<const CBlockIndex*> GetDescendants(const CBlockIndex* pindex) const;
+    /** Append the hashes of at most nMax tips, most recently accessed first. */
+    int GetMostRecent(std::vector<uint256>& output, int nMax) const;
+};
+extern CGlobalForkTips mGlobalForkTips;
+
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
@@ -170,6 +346,14 @@ extern bool fPruneMode;
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** Block files with a block within this many blocks of the tip are not pruned (-prunekeepblocks, at least MIN_BLOCKS_TO_KEEP) */
+extern unsigned int nPruneKeepBlocks;
+/** Seconds getblock waits for peers to send a block that was pruned */
+static const int64_t PRUNED_BLOCK_FETCH_TIMEOUT = 30;
+/** Seconds to wait for a peer asked for a pruned block before asking another one */
+static const int64_t PRUNED_BLOCK_PEER_TIMEOUT = 5;
+/** Number of blocks fetched from peers after they were pruned kept in memory */
+static const unsigned int MAX_FETCHED_PRUNED_BLOCKS = 16;
 
 // Require that user allocate at least 550MB for block & undo files (blk???.dat and rev???.dat)
 // At 1MB per block, 288 blocks = 288MB.
@@ -209,6 +393,12 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file, possibly headers only */
 bool LoadBlocksFromExternalFile(FILE* fileIn, CDiskBlockPos *dbp, bool loadHeadersOnly);
+/** Reindex the blocks of all blk files in order, with nThreads threads reading and checking the next files meanwhile */
+void ReindexBlockFiles(bool loadHeadersOnly, int nThreads);
+/** Load the mempool written by DumpMempool, returns whether a dump was read */
+bool LoadMempool();
+/** Write the mempool to mempool.dat */
+void DumpMempool();
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -217,6 +407,8 @@ bool LoadBlockIndex();
 void UnloadBlockIndex();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
+/** Process a single deserialized message, as ProcessMessages does; also used to replay synthetic traffic */
+bool ProcessMessage(CNode* pfrom, std::string strCommand, CPublicDataStream& vRecv, int64_t nTimeReceived);
 /**
  * Send queued protocol messages to be sent to a give node.
  *
@@ -226,6 +418,24 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the JoinSplit proof checking thread */
+void ThreadProofCheck();
+/** Run an instance of the Equihash solution checking thread */
+void ThreadEquihashCheck();
+/** Run an instance of the thread doing the context-free checks of the transactions of a block */
+void ThreadTxCheck();
+/** Run an instance of the thread doing the context-free checks of blocks received from peers */
+void ThreadBlockPrevalidation();
+/** Run the thread writing the block and undo files */
+void ThreadBlockFileWriter();
+/**
+ * Queue a block received from pfrom for ThreadBlockPrevalidation, which then
+ * processes it. Returns false (leaving block untouched) if there are no
+ * pre-validation threads or their queue is full.
+ */
+bool QueueBlockForPrevalidation(CNode* pfrom, CBlock& block);
+/** Process a block received from a peer and punish the peer if it is invalid */
+void ProcessBlockFromPeer(CNode* pfrom, CBlock& block);
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -234,6 +444,21 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(const std::string& strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
+/** Retrieve a transaction serialized, those in blocks as stored, without deserializing them */
+bool GetRawTransaction(const uint256 &hash, std::string &strTx, uint256 &hashBlock, bool fAllowSlow = false);
+/**
+ * GetRawTransaction of many transactions, the ones from the transaction index
+ * read in the order they lie in the block files. vTx[i] is left empty if
+ * vHash[i] is not found.
+ */
+void GetRawTransactions(const std::vector<uint256> &vHash, std::vector<std::string> &vTx, std::vector<uint256> &vHashBlock, bool fAllowSlow = false);
+/** Read the address index entries of an address between two heights (nEnd 0 for no limit) */
+bool GetAddressIndex(uint8_t type, const uint160 &addressHash, std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                     int nStart = 0, int nEnd = 0);
+/** Look up where an output was spent */
+bool GetSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+/** Hashes of the blocks with a timestamp in [nLow, nHigh] */
+bool GetTimestampIndex(uint32_t nLow, uint32_t nHigh, std::vector<uint256> &hashes);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state, CBlock *pblock = NULL);
 /** Find an alternative chain tip and propagate to the network */
@@ -272,20 +497,63 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune);
  */
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
+/**
+ * Get a block whose data was pruned from the peers serving the whole chain,
+ * asking them one after the other for at most nTimeout seconds. The blocks
+ * fetched are only kept in a small memory cache, they are not written back
+ * to the block files. Must not be called with cs_main held.
+ */
+bool FetchPrunedBlock(const CBlockIndex* pindex, CBlock& block, int64_t nTimeout);
+
 /** Create a new block index entry for a given block hash */
 CBlockIndex * InsertBlockIndex(uint256 hash);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+/** Blocks to keep in flight from a peer taking nAvgBlockTime microseconds per block, 0 if not measured yet. */
+int GetBlocksInTransitLimit(int64_t nAvgBlockTime);
+/** Size of the block download window when all peers together deliver dBlocksPerSecond. */
+int GetBlockDownloadWindow(double dBlocksPerSecond);
+/**
+ * Limit of the coins cache, now using nCacheUsage, given the configured one and the memory headroom
+ * and pressure as GetMemoryHeadroom and GetMemoryPressure give them (-1 if unknown).
+ */
+size_t GetCoinCacheLimit(size_t nConfigured, size_t nCacheUsage, int64_t nHeadroom, double dPressure);
+/** Memory used by the block index, and in nSolutionUsage the part of it taken by Equihash solutions (requires cs_main) */
+size_t GetBlockIndexMemoryUsage(size_t& nSolutionUsage);
+/** Memory used by the orphan pool, with nOrphans set to the number of transactions in it */
+size_t GetOrphanPoolMemoryUsage(size_t& nOrphans);
+/** Relay a transaction, sharing the one of its mempool entry if it has one rather than copying it */
+void RelayMempoolTransaction(const CTransaction& tx);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/** Write the UTXO set of the active tip to a snapshot file, the file is closed on return. */
+bool DumpTxOutSet(FILE* fileIn, CTxOutSetSnapshotHeader& header, CValidationState& state);
+/**
+ * Replace the (empty) UTXO set of a new pruned node with a snapshot file, and
+ * make its block the active tip. The headers of its chain must be known, and
+ * the snapshot hash must match hashExpected, obtained from a trusted source.
+ * The chain up to the snapshot block is marked BLOCK_ASSUMED_VALID, its blocks
+ * are never validated. The file is closed on return.
+ */
+bool LoadTxOutSet(FILE* fileIn, const uint256& hashExpected, CTxOutSetSnapshotHeader& header, CValidationState& state);
+
+/**
+ * Verify the JoinSplit proofs of a transaction that are not in the proof
+ * cache without cs_main, on the proof check threads unless a block is using
+ * them, and cache them if they all verify, so that AcceptToMemoryPool does not
+ * verify them while holding cs_main. Returns false if a proof does not verify;
+ * transactions that fail the cheaper stateless checks are left to
+ * AcceptToMemoryPool.
+ */
+bool PreVerifyJoinSplitProofs(const CTransaction& tx);
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+                        bool* pfMissingInputs, bool fRejectAbsurdFee=false, int64_t nAcceptTime=0);
 
 /** Get the BIP9 state for a given deployment at the current tip. */
 ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::DeploymentPos pos);
@@ -298,6 +566,8 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInTransitLimit;
+    int64_t nAvgBlockTime;
 };
 
 struct CDiskTxPos : public CDiskBlockPos
@@ -367,11 +637,11 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline, and they use txdata (if not NULL) which must outlive them.
  */
 bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
                            const CChain& chain, unsigned int flags, bool cacheStore, const Consensus::Params& consensusParams,
-                           std::vector<CScriptCheck> *pvChecks = NULL);
+                           std::vector<CScriptCheck> *pvChecks = NULL, const PrecomputedTransactionData *txdata = NULL);
 
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state, int nHeight, int dosLevel,
@@ -418,12 +688,14 @@ private:
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
+    const PrecomputedTransactionData *txdata;
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), chain(nullptr), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, const CChain* chainIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): ptxTo(0), nIn(0), chain(nullptr), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(NULL) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, const CChain* chainIn, unsigned int nFlagsIn, bool cacheIn,
+                 const PrecomputedTransactionData* txdataIn = NULL) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), chain(chainIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        ptxTo(&txToIn), nIn(nInIn), chain(chainIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
 
@@ -435,16 +707,105 @@ public:
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        std::swap(txdata, check.txdata);
     }
 
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the zk-SNARK proof verification of one JoinSplit
+ * Note that this stores a reference to the transaction holding the JoinSplit
+ */
+class CProofCheck
+{
+private:
+    const CTransaction *ptx;
+    unsigned int nJoinSplit;
+
+public:
+    CProofCheck(): ptx(0), nJoinSplit(0) {}
+    CProofCheck(const CTransaction& txIn, unsigned int nJoinSplitIn) :
+        ptx(&txIn), nJoinSplit(nJoinSplitIn) { }
+
+    bool operator()();
+
+    void swap(CProofCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nJoinSplit, check.nJoinSplit);
+    }
+};
+
+
+/**
+ * Closure representing the Equihash solution check of one header
+ * The result is also stored in the flag pointed to, as the queue only
+ * reports whether all checks passed.
+ */
+class CEquihashCheck
+{
+private:
+    const CBlockHeader *pheader;
+    char *pfValid;
+
+public:
+    CEquihashCheck(): pheader(0), pfValid(0) {}
+    CEquihashCheck(const CBlockHeader& headerIn, char* pfValidIn) :
+        pheader(&headerIn), pfValid(pfValidIn) { }
+
+    bool operator()();
+
+    void swap(CEquihashCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+/**
+ * Closure representing the context-free checks of one transaction of a block,
+ * those of CheckTransactionWithoutProofVerification, and its sigop count.
+ * The outcome goes to the state, count and result pointed to; the result is
+ * 0 until the check ran, then 1 if it passed and 2 if it failed.
+ */
+class CTxCheck
+{
+private:
+    const CTransaction *ptx;
+    CValidationState *pstate;
+    unsigned int *pnSigOps;
+    char *pchResult;
+
+public:
+    CTxCheck(): ptx(0), pstate(0), pnSigOps(0), pchResult(0) {}
+    CTxCheck(const CTransaction& txIn, CValidationState* pstateIn, unsigned int* pnSigOpsIn, char* pchResultIn) :
+        ptx(&txIn), pstate(pstateIn), pnSigOps(pnSigOpsIn), pchResult(pchResultIn) { }
+
+    bool operator()();
+
+    void swap(CTxCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(pstate, check.pstate);
+        std::swap(pnSigOps, check.pnSigOps);
+        std::swap(pchResult, check.pchResult);
+    }
+};
+
+/**
+ * Check the Equihash solutions of a batch of headers on the -par threads.
+ * vValid[i] is set to whether headers[i] has a valid solution; a header that
+ * was skipped because another one failed is reported as invalid.
+ */
+bool CheckEquihashSolutions(const std::vector<CBlockHeader>& headers, std::vector<char>& vValid);
 
 /** Functions for disk access for blocks */
-bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Write a block and its index header to the block files, vCompressed is its data under -compressblocks */
+bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart, const std::vector<char>& vCompressed = std::vector<char>());
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block's serialized bytes as stored, without deserializing or checking it */
+bool ReadRawBlockFromDisk(std::string& strBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+/** Read the bytes of the transaction at postx in the transaction index, and the hash of its block */
+bool ReadRawTransactionFromDisk(std::string& strTx, uint256& hashBlock, const CDiskTxPos& postx);
 CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos);
 
 /** Functions for validating blocks and updating the block tree */
@@ -452,17 +813,75 @@ CBlock LoadBlockFrom(CBufferedFile& blkdat, CDiskBlockPos* pLastLoadedBlkPos);
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified.
+ *  fUpdateIndexes also removes the block from the address, spent and timestamp indexes. */
+bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL,
+                     bool fUpdateIndexes = false);
+
+/** Phases of connecting a block to the tip, as timed in CBlockConnectStats */
+enum BlockConnectPhase {
+    CONNECT_PHASE_LOAD,       //! Reading the block from disk
+    CONNECT_PHASE_PREFETCH,   //! Reading the coins, nullifiers and anchors of the block into the tip cache
+    CONNECT_PHASE_CHECK,      //! CheckBlock, with the JoinSplit proofs unless they are checked in parallel
+    CONNECT_PHASE_INPUTS,     //! Fetching the inputs and updating the coins, checking scripts unless in parallel
+    CONNECT_PHASE_SCRIPTS,    //! Waiting for the parallel script checks
+    CONNECT_PHASE_PROOFS,     //! Waiting for the parallel JoinSplit proof checks
+    CONNECT_PHASE_UNDO,       //! Writing the undo data
+    CONNECT_PHASE_INDEX,      //! Writing the transaction, filter, address, spent and timestamp indexes
+    CONNECT_PHASE_CALLBACKS,  //! UpdatedTransaction callbacks
+    CONNECT_PHASE_FLUSH,      //! Flushing the block's coins into the tip cache
+    CONNECT_PHASE_CHAINSTATE, //! FlushStateToDisk
+    CONNECT_PHASE_MEMPOOL,    //! Removing the block's transactions and their conflicts from the mempool
+    CONNECT_PHASE_WALLET,     //! Handing the transactions and the new tip to the wallets and notification listeners
+    CONNECT_PHASE_TOTAL,
+    CONNECT_PHASE_COUNT
+};
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, const CChain& chain, bool fJustCheck = false);
+const char* GetBlockConnectPhaseName(int phase);
+
+//! Number of recently connected blocks whose CBlockConnectStats are kept
+static const unsigned int BLOCK_CONNECT_STATS_SIZE = 1000;
+
+/** How long connecting a block to the tip took, by phase, and what it contained */
+struct CBlockConnectStats
+{
+    uint256 hash;
+    int nHeight;
+    //! When it was connected
+    int64_t nTime;
+    unsigned int nTx;
+    unsigned int nInputs;
+    unsigned int nOutputs;
+    unsigned int nJoinSplits;
+    unsigned int nSize;
+    int64_t vPhaseMicros[CONNECT_PHASE_COUNT];
+
+    CBlockConnectStats();
+};
+
+/** Sum and maximum of each phase over the blocks connected since startup */
+struct CBlockConnectTotals
+{
+    uint64_t nBlocks;
+    int64_t vTotalMicros[CONNECT_PHASE_COUNT];
+    int64_t vMaxMicros[CONNECT_PHASE_COUNT];
+
+    CBlockConnectTotals();
+};
+
+/** The stats of up to nCount of the most recently connected blocks, newest first, and the totals */
+void GetBlockConnectStats(size_t nCount, std::vector<CBlockConnectStats>& vRecent, CBlockConnectTotals& totals);
+
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  The times of its phases are added to pstats, if provided. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, const CChain& chain, bool fJustCheck = false,
+                  CBlockConnectStats* pstats = NULL);
 
 /** Find the position in block files (blk??????.dat) in which a block must be written. */
 bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false);
 
 /** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true, bool fCheckSolution = true);
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 libzcash::ProofVerifier& verifier,
                 bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -482,7 +901,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
  * If dbp is non-NULL, the file is known to already reside on disk
  */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, bool fRequested, CDiskBlockPos* dbp, BlockSet* sForkTips = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool lookForwardTips = false);
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool lookForwardTips = false, bool fSolutionChecked = false);
 
 
 
@@ -545,9 +964,13 @@ class CVerifyDB {
 public:
     CVerifyDB();
     ~CVerifyDB();
-    bool VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
+    /** Verify the last nCheckDepth blocks at nCheckLevel; levels 0 to 2 are skipped if not fBlockChecks, see ThreadVerifyBlocks */
+    bool VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth, bool fBlockChecks = true);
 };
 
+/** Run levels 0 to 2 of VerifyDB for the last nCheckDepth blocks, in the background once the node is started */
+void ThreadVerifyBlocks(int nCheckLevel, int nCheckDepth);
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
@@ -560,9 +983,56 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/**
+ * Summary of the tip of chainActive, built at every change of the tip and
+ * never modified once published, for readers that only need the tip and do
+ * not want to wait for cs_main, such as the RPC calls polled by monitoring.
+ */
+struct CChainTipSnapshot
+{
+    /**
+     * The tip itself, NULL before the genesis block. Block index entries
+     * live until the index is unloaded at shutdown; without cs_main only the
+     * fields that do not change once connected, such as its header, height
+     * and pprev, may be read.
+     */
+    const CBlockIndex* pindex;
+    int nHeight;
+    uint256 hashBlock;
+    int64_t nMedianTimePast;
+    arith_uint256 nChainWork;
+    //! Target of the tip, and the one the next block must meet
+    uint32_t nBits;
+    uint32_t nNextBits;
+    //! Network solution rates at the tip over DEFAULT_NETWORK_SOLPS_LOOKUP
+    //! blocks and over the difficulty averaging window, see GetNetworkSolPS
+    int64_t nNetworkSolPS;
+    int64_t nAveragingWindowSolPS;
+    //! As of the tip change, see Checkpoints::GuessVerificationProgress
+    double dVerificationProgress;
+    //! Note commitments in the tree of the tip
+    uint64_t nCommitments;
+    boost::optional<CAmount> nChainSproutValue;
+
+    CChainTipSnapshot() : pindex(NULL), nHeight(-1), nMedianTimePast(0), nBits(0), nNextBits(0),
+                          nNetworkSolPS(0), nAveragingWindowSolPS(0), dVerificationProgress(0), nCommitments(0) {}
+};
+
+/** The tip of chainActive as of its last change; never NULL */
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+
+/** Height of pindexBestHeader, -1 if none, readable without cs_main */
+extern std::atomic<int> nBestHeaderHeight;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The background writer below pcoinsTip, NULL unless -asyncflush is set (protected by cs_main) */
+extern CCoinsViewBackgroundFlush *pcoinsflush;
+
+/** The coin database at the bottom of the pcoinsTip stack (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
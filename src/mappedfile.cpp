@@ -0,0 +1,43 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)pdata, nSize);
+#endif
+}
+
+boost::shared_ptr<const CMappedFile> CMappedFile::Open(const boost::filesystem::path& path)
+{
+    boost::shared_ptr<const CMappedFile> mapped;
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return mapped;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            mapped.reset(new CMappedFile((const char*)p, st.st_size));
+        else
+            LogPrintf("Unable to map file %s: %s\n", path.string(), strerror(errno));
+    }
+    // The mapping holds its own reference to the file
+    close(fd);
+#endif
+    return mapped;
+}
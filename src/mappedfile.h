@@ -0,0 +1,40 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include <stddef.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * A whole file mapped read-only in memory. Meant for files only ever appended
+ * to: the bytes written after the mapping was made may or may not be part of
+ * it, and truncating the file while mapped is not safe. Deleting it is.
+ */
+class CMappedFile
+{
+private:
+    const char* pdata;
+    size_t nSize;
+
+    CMappedFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+
+    // Disallow copies
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    ~CMappedFile();
+
+    /** Map a file, or return NULL if it is empty or cannot be mapped (always on Windows). */
+    static boost::shared_ptr<const CMappedFile> Open(const boost::filesystem::path& path);
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
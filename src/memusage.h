@@ -7,7 +7,10 @@
 
 #include <stdlib.h>
 
+#include <deque>
+#include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -74,8 +77,8 @@ static inline size_t DynamicUsage(const std::vector<X>& v)
     return MallocUsage(v.capacity() * sizeof(X));
 }
 
-template<typename X>
-static inline size_t DynamicUsage(const std::set<X>& s)
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y>& s)
 {
     return MallocUsage(sizeof(stl_tree_node<X>)) * s.size();
 }
@@ -86,6 +89,52 @@ static inline size_t DynamicUsage(const std::map<X, Y>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
 }
 
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::multimap<X, Y>& m)
+{
+    return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
+}
+
+template<typename X>
+struct stl_list_node
+{
+private:
+    void* next;
+    void* prev;
+    X x;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::list<X>& l)
+{
+    return MallocUsage(sizeof(stl_list_node<X>)) * l.size();
+}
+
+/** A deque allocates its elements in blocks of 512 bytes, or of one element if larger */
+template<typename X>
+static inline size_t DynamicUsage(const std::deque<X>& d)
+{
+    size_t nPerBlock = sizeof(X) < 512 ? 512 / sizeof(X) : 1;
+    size_t nBlocks = d.size() / nPerBlock + 1;
+    return MallocUsage(nPerBlock * sizeof(X)) * nBlocks + MallocUsage(sizeof(void*) * (nBlocks + 2));
+}
+
+struct stl_shared_counter
+{
+    /* Various platforms use different sized counters here.
+     * Conservatively assume that they won't be larger than size_t. */
+    void* class_type;
+    size_t use_count;
+    size_t weak_count;
+};
+
+/** The object and its reference counts, which std::make_shared allocates at once */
+template<typename X>
+static inline size_t DynamicUsage(const std::shared_ptr<X>& p)
+{
+    return p ? MallocUsage(sizeof(X) + sizeof(stl_shared_counter)) : 0;
+}
+
 // Boost data structures
 
 template<typename X>
@@ -9,6 +9,9 @@
 #include "consensus/consensus.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <assert.h>
+
 using namespace std;
 
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
@@ -16,10 +19,7 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
     header = block.GetBlockHeader();
 
     vector<bool> vMatch;
-    vector<uint256> vHashes;
-
     vMatch.reserve(block.vtx.size());
-    vHashes.reserve(block.vtx.size());
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -31,10 +31,9 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
         }
         else
             vMatch.push_back(false);
-        vHashes.push_back(hash);
     }
 
-    txn = CPartialMerkleTree(vHashes, vMatch);
+    txn = CPartialMerkleTree(block, vMatch);
 }
 
 CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
@@ -42,57 +41,51 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, const std::set<uint256>& txids)
     header = block.GetBlockHeader();
 
     vector<bool> vMatch;
-    vector<uint256> vHashes;
-
     vMatch.reserve(block.vtx.size());
-    vHashes.reserve(block.vtx.size());
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
-    {
-        const uint256& hash = block.vtx[i].GetHash();
-        if (txids.count(hash))
-            vMatch.push_back(true);
-        else
-            vMatch.push_back(false);
-        vHashes.push_back(hash);
-    }
+        vMatch.push_back(txids.count(block.vtx[i].GetHash()) != 0);
 
-    txn = CPartialMerkleTree(vHashes, vMatch);
+    txn = CPartialMerkleTree(block, vMatch);
 }
 
-uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid) {
-    if (height == 0) {
-        // hash at height 0 is the txids themself
-        return vTxid[pos];
-    } else {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyond the end of the array - copy left hash otherwise1
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
-    }
-}
-
-void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
-    // determine whether this node is the parent of at least one matched txid
-    bool fParentOfMatch = false;
-    for (unsigned int p = pos << height; p < (pos+1) << height && p < nTransactions; p++)
-        fParentOfMatch |= vMatch[p];
+void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTree, const std::vector<bool> &vParentOfMatch, const std::vector<unsigned int> &vLevel) {
+    // whether this node is the parent of at least one matched txid
+    bool fParentOfMatch = vParentOfMatch[vLevel[height] + pos];
     // store as flag bit
     vBits.push_back(fParentOfMatch);
     if (height==0 || !fParentOfMatch) {
         // if at height 0, or nothing interesting below, store hash and stop
-        vHash.push_back(CalcHash(height, pos, vTxid));
+        vHash.push_back(vTree[vLevel[height] + pos]);
     } else {
         // otherwise, don't store any hash, but descend into the subtrees
-        TraverseAndBuild(height-1, pos*2, vTxid, vMatch);
+        TraverseAndBuild(height-1, pos*2, vTree, vParentOfMatch, vLevel);
         if (pos*2+1 < CalcTreeWidth(height-1))
-            TraverseAndBuild(height-1, pos*2+1, vTxid, vMatch);
+            TraverseAndBuild(height-1, pos*2+1, vTree, vParentOfMatch, vLevel);
+    }
+}
+
+void CPartialMerkleTree::Build(const std::vector<uint256> &vTree, const std::vector<bool> &vMatch) {
+    // reset state
+    vBits.clear();
+    vHash.clear();
+    if (nTransactions == 0)
+        return;
+
+    // mark the parents of the matched txids, a level at a time, as the hashes of the tree are
+    std::vector<bool> vParentOfMatch(vMatch.begin(), vMatch.begin() + nTransactions);
+    vParentOfMatch.reserve(vTree.size());
+    std::vector<unsigned int> vLevel(1, 0);
+    for (unsigned int nSize = nTransactions; nSize > 1; nSize = (nSize + 1) / 2) {
+        unsigned int j = vLevel.back();
+        for (unsigned int i = 0; i < nSize; i += 2)
+            vParentOfMatch.push_back(vParentOfMatch[j+i] || (i+1 < nSize && vParentOfMatch[j+i+1]));
+        vLevel.push_back(j + nSize);
     }
+    assert(vTree.size() == vParentOfMatch.size());
+
+    // traverse the partial tree
+    TraverseAndBuild(vLevel.size() - 1, 0, vTree, vParentOfMatch, vLevel);
 }
 
 uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, unsigned int &nBitsUsed, unsigned int &nHashUsed, std::vector<uint256> &vMatch) {
@@ -132,17 +125,28 @@ uint256 CPartialMerkleTree::TraverseAndExtract(int height, unsigned int pos, uns
 }
 
 CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) : nTransactions(vTxid.size()), fBad(false) {
-    // reset state
-    vBits.clear();
-    vHash.clear();
-
-    // calculate height of tree
-    int nHeight = 0;
-    while (CalcTreeWidth(nHeight) > 1)
-        nHeight++;
+    // the whole merkle tree, level by level, the last hash of a level of odd size paired with itself
+    std::vector<uint256> vTree(vTxid);
+    vTree.reserve(vTxid.size() * 2 + 16);
+    unsigned int j = 0;
+    for (unsigned int nSize = nTransactions; nSize > 1; nSize = (nSize + 1) / 2) {
+        for (unsigned int i = 0; i < nSize; i += 2) {
+            const uint256 &left = vTree[j+i], &right = vTree[std::min(i+1, nSize-1) + j];
+            vTree.push_back(Hash(BEGIN(left), END(left), BEGIN(right), END(right)));
+        }
+        j += nSize;
+    }
+    Build(vTree, vMatch);
+}
 
-    // traverse the partial tree
-    TraverseAndBuild(nHeight, 0, vTxid, vMatch);
+CPartialMerkleTree::CPartialMerkleTree(const CBlock &block, const std::vector<bool> &vMatch) : nTransactions(block.vtx.size()), fBad(false) {
+    // the tree of the block is built once, it must be the one of its transactions
+    size_t nNodes = 1;
+    for (size_t nSize = block.vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        nNodes += nSize;
+    if (block.vMerkleTree.size() != nNodes || (nTransactions > 0 && block.vMerkleTree[0] != block.vtx[0].GetHash()))
+        block.BuildMerkleTree();
+    Build(block.vMerkleTree, vMatch);
 }
 
 CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
@@ -67,11 +67,15 @@ protected:
         return (nTransactions+(1 << height)-1) >> height;
     }
 
-    /** calculate the hash of a node in the merkle tree (at leaf level: the txid's themselves) */
-    uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid);
+    /**
+     * recursive function that traverses tree nodes, storing the data as bits and hashes.
+     * vTree holds all the nodes of the merkle tree level by level, as in CBlock::vMerkleTree,
+     * vParentOfMatch whether each of them is the parent of a matched txid, vLevel where each level starts
+     */
+    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTree, const std::vector<bool> &vParentOfMatch, const std::vector<unsigned int> &vLevel);
 
-    /** recursive function that traverses tree nodes, storing the data as bits and hashes */
-    void TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
+    /** build from the whole merkle tree of the transactions, laid out as CBlock::vMerkleTree */
+    void Build(const std::vector<uint256> &vTree, const std::vector<bool> &vMatch);
 
     /**
      * recursive function that traverses tree nodes, consuming the bits and hashes produced by TraverseAndBuild.
@@ -107,6 +111,9 @@ public:
     /** Construct a partial merkle tree from a list of transaction ids, and a mask that selects a subset of them */
     CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    /** Construct a partial merkle tree from the merkle tree of a block, built by CBlock::BuildMerkleTree, and a mask of its transactions */
+    CPartialMerkleTree(const CBlock &block, const std::vector<bool> &vMatch);
+
     CPartialMerkleTree();
 
     /**
@@ -136,6 +143,8 @@ public:
      * Create from a CBlock, filtering transactions according to filter
      * Note that this will call IsRelevantAndUpdate on the filter for each transaction,
      * thus the filter will likely be modified.
+     * The merkle tree of the block is reused if it was built already, so that a
+     * block kept in memory is hashed once for all the filters it is matched against.
      */
     CMerkleBlock(const CBlock& block, CBloomFilter& filter);
 
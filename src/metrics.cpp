@@ -6,7 +6,11 @@
 
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "httpserver.h"
 #include "main.h"
+#include "net.h"
+#include "pow.h"
+#include "rpc/protocol.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utiltime.h"
@@ -15,6 +19,7 @@
 
 #include <boost/thread.hpp>
 #include <boost/thread/synchronized_value.hpp>
+#include <algorithm>
 #include <string>
 #ifdef WIN32
 #include <io.h>
@@ -72,6 +77,62 @@ double AtomicTimer::rate(const AtomicCounter& count)
     return duration > 0 ? (double)count.get() / duration : 0;
 }
 
+//! Shard of the calling thread, handed out round-robin as threads first observe something
+static size_t GetMetricsShard()
+{
+    static std::atomic<size_t> nNextShard(0);
+    static thread_local size_t nShard = nNextShard++ % METRICS_HISTOGRAM_SHARDS;
+    return nShard;
+}
+
+MetricsHistogram::Shard::Shard() : sum(0)
+{
+    for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+        buckets[i] = 0;
+}
+
+void MetricsHistogram::observe(int64_t micros)
+{
+    micros = std::max(micros, (int64_t)0);
+    size_t bucket = std::lower_bound(METRICS_HISTOGRAM_BOUNDS, METRICS_HISTOGRAM_BOUNDS + METRICS_HISTOGRAM_BUCKETS - 1, micros) - METRICS_HISTOGRAM_BOUNDS;
+    Shard& shard = shards[GetMetricsShard()];
+    shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(micros, std::memory_order_relaxed);
+}
+
+void MetricsHistogram::snapshot(std::vector<uint64_t>& counts, uint64_t& sum) const
+{
+    counts.assign(METRICS_HISTOGRAM_BUCKETS, 0);
+    sum = 0;
+    for (const Shard& shard : shards) {
+        for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+            counts[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        sum += shard.sum.load(std::memory_order_relaxed);
+    }
+}
+
+MetricsHistogram& MetricsHistogramFamily::get(const std::string& label)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    auto it = histograms.find(label);
+    if (it != histograms.end())
+        return *it->second;
+    // Labels can come from peers; do not let them grow the family without bound
+    std::unique_ptr<MetricsHistogram>& histogram = histograms[histograms.size() < METRICS_MAX_LABELS ? label : "other"];
+    if (!histogram)
+        histogram.reset(new MetricsHistogram());
+    return *histogram;
+}
+
+std::vector<std::pair<std::string, const MetricsHistogram*>> MetricsHistogramFamily::list() const
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    std::vector<std::pair<std::string, const MetricsHistogram*>> result;
+    for (const auto& entry : histograms)
+        result.push_back(std::make_pair(entry.first, entry.second.get()));
+    return result;
+}
+
 CCriticalSection cs_metrics;
 
 boost::synchronized_value<int64_t> nNodeStartTime;
@@ -82,6 +143,17 @@ AtomicCounter solutionTargetChecks;
 AtomicCounter minedBlocks;
 AtomicTimer miningTimer;
 
+MetricsHistogramFamily connectBlockTimes;
+MetricsHistogram acceptToMemoryPoolTime;
+MetricsHistogram joinSplitVerifyTime;
+MetricsHistogramFamily flushStateTimes;
+MetricsHistogramFamily netMessageTimes;
+MetricsHistogramFamily rpcCallTimes;
+MetricsHistogram minerStaleWorkTime;
+
+static std::list<std::shared_ptr<MinerThreadMetrics>> minerThreadMetrics;
+static int nNextMinerThreadId = 0;
+
 boost::synchronized_value<std::list<uint256>> trackedBlocks;
 
 boost::synchronized_value<std::list<std::string>> messageBox;
@@ -112,6 +184,28 @@ double GetLocalSolPS()
     return miningTimer.rate(solutionTargetChecks);
 }
 
+std::shared_ptr<MinerThreadMetrics> RegisterMinerThread(const std::string& solver)
+{
+    LOCK(cs_metrics);
+    std::shared_ptr<MinerThreadMetrics> metrics(new MinerThreadMetrics(nNextMinerThreadId++, solver));
+    minerThreadMetrics.push_back(metrics);
+    return metrics;
+}
+
+void UnregisterMinerThread(const std::shared_ptr<MinerThreadMetrics>& metrics)
+{
+    LOCK(cs_metrics);
+    minerThreadMetrics.remove(metrics);
+    if (minerThreadMetrics.empty())
+        nNextMinerThreadId = 0;
+}
+
+std::vector<std::shared_ptr<MinerThreadMetrics>> GetMinerThreadMetrics()
+{
+    LOCK(cs_metrics);
+    return std::vector<std::shared_ptr<MinerThreadMetrics>>(minerThreadMetrics.begin(), minerThreadMetrics.end());
+}
+
 int EstimateNetHeightInner(int height, int64_t tipmediantime,
                            int heightLastCheckpoint, int64_t timeLastCheckpoint,
                            int64_t genesisTime, int64_t targetSpacing)
@@ -149,6 +243,108 @@ void TriggerRefresh()
     MilliSleep(200);
 }
 
+static void AppendMetricHeader(std::string& out, const std::string& name, const std::string& type, const std::string& help)
+{
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+static void AppendMetric(std::string& out, const std::string& name, const std::string& type, const std::string& help, uint64_t value)
+{
+    AppendMetricHeader(out, name, type, help);
+    out += strprintf("%s %u\n", name, value);
+}
+
+static void AppendHistogram(std::string& out, const std::string& name, const std::string& labels, const MetricsHistogram& histogram)
+{
+    std::vector<uint64_t> counts;
+    uint64_t sum;
+    histogram.snapshot(counts, sum);
+
+    // Buckets are cumulative, and the count is taken from them so that it
+    // matches even if observations were made while adding the shards up
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++) {
+        cumulative += counts[i];
+        std::string le = i + 1 < METRICS_HISTOGRAM_BUCKETS ? strprintf("%g", METRICS_HISTOGRAM_BOUNDS[i] * 0.000001) : "+Inf";
+        out += strprintf("%s_bucket{%sle=\"%s\"} %u\n", name, labels.empty() ? "" : labels + ",", le, cumulative);
+    }
+    std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    out += strprintf("%s_sum%s %.6f\n", name, braces, sum * 0.000001);
+    out += strprintf("%s_count%s %u\n", name, braces, cumulative);
+}
+
+static void AppendHistogramFamily(std::string& out, const std::string& name, const std::string& label, const std::string& help, const MetricsHistogramFamily& family)
+{
+    AppendMetricHeader(out, name, "histogram", help);
+    // Sanitized, as message commands come from peers; this also leaves nothing to escape
+    for (const auto& entry : family.list())
+        AppendHistogram(out, name, label + "=\"" + SanitizeString(entry.first) + "\"", *entry.second);
+}
+
+std::string GetPrometheusMetrics()
+{
+    std::string out;
+
+    AppendMetric(out, "zend_uptime_seconds", "gauge", "Seconds since the node started.", GetUptime());
+    AppendMetric(out, "zend_transactions_validated_total", "counter", "Non-coinbase transactions checked.", transactionsValidated.value.load());
+    AppendMetric(out, "zend_eh_solver_runs_total", "counter", "Equihash solver runs of the local miner.", ehSolverRuns.value.load());
+    AppendMetric(out, "zend_solution_target_checks_total", "counter", "Equihash solutions checked against the target by the local miner.", solutionTargetChecks.value.load());
+    AppendMetric(out, "zend_mined_blocks_total", "counter", "Blocks mined locally.", minedBlocks.value.load());
+    AppendMetric(out, "zend_mempool_transactions", "gauge", "Transactions in the mempool.", mempool.size());
+    AppendMetric(out, "zend_mempool_bytes", "gauge", "Serialized size of the transactions in the mempool.", mempool.GetTotalTxSize());
+    {
+        LOCK(cs_vNodes);
+        AppendMetric(out, "zend_peers", "gauge", "Connected peers.", vNodes.size());
+    }
+    {
+        // A scrape must not wait for a block to connect, or for the block
+        // index to load; these are left out when cs_main is busy
+        TRY_LOCK(cs_main, lockMain);
+        if (lockMain && pcoinsTip) {
+            AppendMetric(out, "zend_block_height", "gauge", "Height of the active chain tip.", std::max(chainActive.Height(), 0));
+            AppendMetric(out, "zend_dbcache_hits_total", "counter", "Coins lookups answered by the coins cache.", pcoinsTip->GetCacheHits());
+            AppendMetric(out, "zend_dbcache_misses_total", "counter", "Coins lookups read from the chainstate database.", pcoinsTip->GetCacheMisses());
+            AppendMetric(out, "zend_dbcache_bytes", "gauge", "Memory used by the coins cache.", pcoinsTip->DynamicMemoryUsage());
+        }
+    }
+
+    AppendHistogramFamily(out, "zend_connect_block_seconds", "phase", "Time spent connecting blocks to the tip, by phase.", connectBlockTimes);
+    AppendMetricHeader(out, "zend_accept_to_mempool_seconds", "histogram", "Time spent checking transactions for the mempool.");
+    AppendHistogram(out, "zend_accept_to_mempool_seconds", "", acceptToMemoryPoolTime);
+    AppendMetricHeader(out, "zend_joinsplit_verify_seconds", "histogram", "Time spent verifying a JoinSplit proof.");
+    AppendHistogram(out, "zend_joinsplit_verify_seconds", "", joinSplitVerifyTime);
+    AppendHistogramFamily(out, "zend_flush_state_seconds", "kind", "Time spent writing the block index and the coins cache to disk.", flushStateTimes);
+    AppendHistogramFamily(out, "zend_net_message_seconds", "command", "Time spent processing P2P messages, by command.", netMessageTimes);
+    AppendHistogramFamily(out, "zend_rpc_call_seconds", "method", "Time spent executing RPC calls, by method.", rpcCallTimes);
+    AppendMetricHeader(out, "zend_miner_stale_work_seconds", "histogram", "Time from a new tip until a local mining thread works on a template for it.");
+    AppendHistogram(out, "zend_miner_stale_work_seconds", "", minerStaleWorkTime);
+
+    return out;
+}
+
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string&)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests allowed");
+        return false;
+    }
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, GetPrometheusMetrics());
+    return true;
+}
+
+bool StartHTTPMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics, HTTP_QUEUE_REST);
+    return true;
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
+
 static bool metrics_ThreadSafeMessageBox(const std::string& message,
                                       const std::string& caption,
                                       unsigned int style)
@@ -208,7 +404,7 @@ int printStats(bool mining)
     int lines = 5;
 
     int height = chainActive.Height();
-    int64_t netsolps = GetNetworkHashPS(120, -1);
+    int64_t netsolps = GetNetworkHashPS(DEFAULT_NETWORK_SOLPS_LOOKUP, -1);
     int connections = 0;
     int tlsConnections = 0;
     {
@@ -2,11 +2,18 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#ifndef ZCASH_METRICS_H
+#define ZCASH_METRICS_H
+
 #include "uint256.h"
+#include "utiltime.h"
 
 #include <atomic>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 struct AtomicCounter {
     std::atomic<uint64_t> value;
@@ -54,21 +61,120 @@ public:
     double rate(const AtomicCounter& count);
 };
 
+/**
+ * Counters of a single mining thread. They are updated alongside the global
+ * ehSolverRuns/solutionTargetChecks counters and miningTimer.
+ */
+struct MinerThreadMetrics {
+    int id;
+    std::string solver;
+    AtomicCounter ehSolverRuns;
+    AtomicCounter solutionTargetChecks;
+    AtomicTimer timer;
+
+    MinerThreadMetrics(int idIn, const std::string& solverIn) : id(idIn), solver(solverIn) {}
+};
+
+//! Upper bounds of the latency histogram buckets, in microseconds; a last bucket takes the rest
+static const int64_t METRICS_HISTOGRAM_BOUNDS[] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+static const size_t METRICS_HISTOGRAM_BUCKETS = sizeof(METRICS_HISTOGRAM_BOUNDS) / sizeof(METRICS_HISTOGRAM_BOUNDS[0]) + 1;
+//! Each histogram is split in this many shards, so that threads timing the
+//! same code mostly update cache lines of their own
+static const size_t METRICS_HISTOGRAM_SHARDS = 8;
+//! Most labels of a MetricsHistogramFamily, further labels are counted as "other"
+static const size_t METRICS_MAX_LABELS = 64;
+
+/**
+ * Latency histogram, cheap enough to update from hot paths: an observation
+ * is two relaxed atomic increments on the shard of the calling thread.
+ */
+class MetricsHistogram {
+private:
+    struct Shard {
+        std::atomic<uint64_t> buckets[METRICS_HISTOGRAM_BUCKETS];
+        std::atomic<uint64_t> sum;
+        //! Keeps the counters of neighbouring shards off each other's cache lines
+        char padding[64];
+
+        Shard();
+    };
+    Shard shards[METRICS_HISTOGRAM_SHARDS];
+
+public:
+    void observe(int64_t micros);
+
+    /**
+     * Adds up the shards: the number of observations of each bucket, not
+     * cumulative, and the sum of all of them in microseconds.
+     */
+    void snapshot(std::vector<uint64_t>& counts, uint64_t& sum) const;
+};
+
+/** Histograms told apart by a label, such as a message command or a RPC method */
+class MetricsHistogramFamily {
+private:
+    mutable std::mutex mtx;
+    std::map<std::string, std::unique_ptr<MetricsHistogram>> histograms;
+
+public:
+    //! The histogram of a label, created on first use; valid as long as the family
+    MetricsHistogram& get(const std::string& label);
+    std::vector<std::pair<std::string, const MetricsHistogram*>> list() const;
+};
+
+/** Times its own scope into a histogram */
+class MetricsScopedTimer {
+private:
+    MetricsHistogram& histogram;
+    int64_t start_time;
+
+public:
+    explicit MetricsScopedTimer(MetricsHistogram& histogramIn) : histogram(histogramIn), start_time(GetTimeMicros()) {}
+    ~MetricsScopedTimer() { histogram.observe(GetTimeMicros() - start_time); }
+};
+
 extern AtomicCounter transactionsValidated;
 extern AtomicCounter ehSolverRuns;
 extern AtomicCounter solutionTargetChecks;
 extern AtomicTimer miningTimer;
 
+//! ConnectTip and ConnectBlock phases, labelled by GetBlockConnectPhaseName
+extern MetricsHistogramFamily connectBlockTimes;
+extern MetricsHistogram acceptToMemoryPoolTime;
+//! Verification of a single JoinSplit proof
+extern MetricsHistogram joinSplitVerifyTime;
+//! FlushStateToDisk runs that wrote something, "write" for the block index only or "full"
+extern MetricsHistogramFamily flushStateTimes;
+//! ProcessMessage by message command
+extern MetricsHistogramFamily netMessageTimes;
+//! RPC calls by method
+extern MetricsHistogramFamily rpcCallTimes;
+//! From a new tip to a mining thread working on a template for it
+extern MetricsHistogram minerStaleWorkTime;
+
 void TrackMinedBlock(uint256 hash);
 
 void MarkStartTime();
 double GetLocalSolPS();
+
+std::shared_ptr<MinerThreadMetrics> RegisterMinerThread(const std::string& solver);
+void UnregisterMinerThread(const std::shared_ptr<MinerThreadMetrics>& metrics);
+std::vector<std::shared_ptr<MinerThreadMetrics>> GetMinerThreadMetrics();
 int EstimateNetHeightInner(int height, int64_t tipmediantime,
                            int heightLastCheckpoint, int64_t timeLastCheckpoint,
                            int64_t genesisTime, int64_t targetSpacing);
 
 void TriggerRefresh();
 
+/** The metrics in the Prometheus text exposition format */
+std::string GetPrometheusMetrics();
+/** Serve GetPrometheusMetrics at /metrics on the HTTP server */
+bool StartHTTPMetrics();
+void StopHTTPMetrics();
+
 void ConnectMetricsScreen();
 void ThreadShowMetricsScreen();
 
@@ -110,3 +216,5 @@ const std::string METRICS_ART =
 "                 [0;34;46m8%[0;1;34;94;46m8888888888888888888888[0;34;46mt8[0m                 \n"
 "                       [0;34;46m8XSt;[0;1;34;94;46m8888[0;34;46m;t%X8[0m                       \n";
 // ZEN MOD END
+
+#endif // ZCASH_METRICS_H
@@ -23,6 +23,7 @@
 #include "pow.h"
 #include "primitives/transaction.h"
 #include "random.h"
+#include "threadpool.h"
 #include "timedata.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -74,6 +75,36 @@ public:
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
+namespace {
+/**
+ * Mempool transactions whose scripts passed for a template on top of
+ * hashTemplateTip, with their sigop count including P2SH. Both only depend
+ * on the outputs spent and on the tip, so templates rebuilt on the same tip
+ * skip the script checks of the transactions seen before.
+ * Protected by cs_main.
+ */
+uint256 hashTemplateTip;
+std::map<uint256, unsigned int> mapTemplateChecked;
+
+/**
+ * Recent templates that passed TestBlockValidity, by GetTemplateHash. A block
+ * found on one of them has had its scripts and proofs checked on its parent.
+ * Protected by cs_main.
+ */
+const size_t MAX_CHECKED_TEMPLATES = 16;
+std::deque<uint256> dequeCheckedTemplates;
+
+/** Hash of the parent and of the transactions after the coinbase, which miners may change */
+uint256 GetTemplateHash(const CBlock& block)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << block.hashPrevBlock;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        ss << block.vtx[i].GetHash();
+    return ss.GetHash();
+}
+}
+
 // We want to sort transactions by priority and fee rate, so:
 class TxPriorityCompare
 {
@@ -130,7 +161,7 @@ void GetBlockTxPriorityData(const CBlock *pblock, int nHeight, int64_t nMedianTi
         double dPriority = 0;
         CAmount nTotalIn = 0;
         CAmount nFee = 0;
-        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        unsigned int nTxSize = tx.GetTotalSize();
         uint256 hash = tx.GetHash();
         bool fMissingInputs = false;
 
@@ -274,7 +305,7 @@ void GetBlockTxPriorityDataOld(const CBlock *pblock, int nHeight, int64_t nMedia
         if (fMissingInputs) continue;
 
         // Priority is sum(valuein * age) / modified_txsize
-        unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        unsigned int nTxSize = tx.GetTotalSize();
         dPriority = tx.ComputePriority(dPriority, nTxSize);
 
         uint256 hash = tx.GetHash();
@@ -384,6 +415,13 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
 
         CCoinsViewCache view(pcoinsTip);
 
+        if (hashTemplateTip != pindexPrev->GetBlockHash()) {
+            hashTemplateTip = pindexPrev->GetBlockHash();
+            mapTemplateChecked.clear();
+        }
+        // Only what is still in the mempool is carried over to the next template
+        std::map<uint256, unsigned int> mapChecked;
+
         // Priority order to process transactions
         list<COrphan> vOrphan; // list memory doesn't move
         map<uint256, vector<COrphan*> > mapDependers;
@@ -418,7 +456,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
             vecPriority.pop_back();
 
             // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            unsigned int nTxSize = tx.GetTotalSize();
             if (nBlockSize + nTxSize >= nBlockMaxSize)
                 continue;
 
@@ -455,16 +493,24 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
 
             CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
             CValidationState state;
-            if (!ContextualCheckInputs(tx, state, view, true, chainActive, MANDATORY_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_CHECKBLOCKATHEIGHT, true, Params().GetConsensus()))
-                continue;
+            std::map<uint256, unsigned int>::const_iterator itChecked = mapTemplateChecked.find(hash);
+            if (itChecked != mapTemplateChecked.end()) {
+                nTxSigOps = itChecked->second;
+                if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+                    continue;
+            } else {
+                nTxSigOps += GetP2SHSigOpCount(tx, view);
+                if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+                    continue;
+
+                // Note that flags: we don't want to set mempool/IsStandard()
+                // policy here, but we still have to ensure that the block we
+                // create only contains transactions that are valid in new blocks.
+                if (!ContextualCheckInputs(tx, state, view, true, chainActive, MANDATORY_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_CHECKBLOCKATHEIGHT, true, Params().GetConsensus()))
+                    continue;
+            }
+            mapChecked[hash] = nTxSigOps;
 
             UpdateCoins(tx, state, view, nHeight);
 
@@ -502,6 +548,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
             }
         }
 
+        mapTemplateChecked.swap(mapChecked);
+
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
         LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
@@ -527,11 +575,28 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlo
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
             throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed");
+
+        if (dequeCheckedTemplates.size() >= MAX_CHECKED_TEMPLATES)
+            dequeCheckedTemplates.pop_front();
+        dequeCheckedTemplates.push_back(GetTemplateHash(*pblock));
     }
 
     return pblocktemplate.release();
 }
 
+bool MarkTemplateBlockChecked(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    // Everything is validated again once the tip has moved
+    if (block.hashPrevBlock != chainActive.Tip()->GetBlockHash())
+        return false;
+    if (std::find(dequeCheckedTemplates.begin(), dequeCheckedTemplates.end(), GetTemplateHash(block)) == dequeCheckedTemplates.end())
+        return false;
+    block.fScriptsChecked = true;
+    block.fProofsChecked = true;
+    return true;
+}
+
 #ifdef ENABLE_WALLET
 boost::optional<CScript> GetMinerScriptPubKey(CReserveKey& reservekey)
 #else
@@ -597,7 +662,7 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = txCoinbase;
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    pblock->hashMerkleRoot = pblock->UpdateMerkleTreeCoinbase();
 }
 
 #ifdef ENABLE_WALLET
@@ -614,6 +679,7 @@ static bool ProcessBlockFound(CBlock* pblock)
         LOCK(cs_main);
         if (pblock->hashPrevBlock != chainActive.Tip()->GetBlockHash())
             return error("HorizenMiner: generated block is stale");
+        MarkTemplateBlockChecked(*pblock);
     }
 
 #ifdef ENABLE_WALLET
@@ -639,6 +705,230 @@ static bool ProcessBlockFound(CBlock* pblock)
     return true;
 }
 
+/**
+ * An Equihash solver as used by a mining thread. An engine is created once per
+ * thread and reused for every nonce, so solvers with large working memory only
+ * allocate it once.
+ */
+class CEquihashSolverEngine
+{
+public:
+    virtual ~CEquihashSolverEngine() {}
+
+    virtual std::string GetName() const = 0;
+
+    /**
+     * Run the solver on the given state, passing each solution to validBlock.
+     * Returns true if validBlock accepted a solution. May throw
+     * EhSolverCancelledException when cancelled returns true.
+     */
+    virtual bool Solve(const crypto_generichash_blake2b_state& state,
+                       const std::function<bool(std::vector<unsigned char>)>& validBlock,
+                       const std::function<bool(EhSolverCancelCheck)>& cancelled) = 0;
+
+    /** Create the engine selected by -equihashsolver for the given parameters. */
+    static std::unique_ptr<CEquihashSolverEngine> Create(const std::string& name, unsigned int n, unsigned int k);
+};
+
+class CDefaultSolverEngine : public CEquihashSolverEngine
+{
+private:
+    unsigned int n;
+    unsigned int k;
+
+public:
+    CDefaultSolverEngine(unsigned int nIn, unsigned int kIn) : n(nIn), k(kIn) {}
+
+    std::string GetName() const { return "default"; }
+
+    bool Solve(const crypto_generichash_blake2b_state& state,
+               const std::function<bool(std::vector<unsigned char>)>& validBlock,
+               const std::function<bool(EhSolverCancelCheck)>& cancelled)
+    {
+        return EhOptimisedSolve(n, k, state, validBlock, cancelled);
+    }
+};
+
+class CTrompSolverEngine : public CEquihashSolverEngine
+{
+private:
+    // The solver heaps are allocated here once, setstate() resets them
+    equi eq;
+
+public:
+    CTrompSolverEngine() : eq(1) {}
+
+    std::string GetName() const { return "tromp"; }
+
+    bool Solve(const crypto_generichash_blake2b_state& state,
+               const std::function<bool(std::vector<unsigned char>)>& validBlock,
+               const std::function<bool(EhSolverCancelCheck)>& cancelled)
+    {
+        eq.setstate(&state);
+
+        // Intialization done, start algo driver.
+        eq.digit0(0);
+        eq.xfull = eq.bfull = eq.hfull = 0;
+        eq.showbsizes(0);
+        // Give up on stale work between rounds, like the default solver does
+        if (cancelled(ListGeneration))
+            throw EhSolverCancelledException();
+        for (u32 r = 1; r < WK; r++) {
+            (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
+            eq.xfull = eq.bfull = eq.hfull = 0;
+            eq.showbsizes(r);
+            if (cancelled(RoundEnd))
+                throw EhSolverCancelledException();
+        }
+        eq.digitK(0);
+        if (cancelled(FinalColliding))
+            throw EhSolverCancelledException();
+
+        // Convert solution indices to byte array (decompress) and pass it to validBlock method.
+        for (size_t s = 0; s < eq.nsols; s++) {
+            LogPrint("pow", "Checking solution %d\n", s+1);
+            std::vector<eh_index> index_vector(PROOFSIZE);
+            for (size_t i = 0; i < PROOFSIZE; i++) {
+                index_vector[i] = eq.sols[s][i];
+            }
+            std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
+
+            if (validBlock(sol_char)) {
+                // If we find a POW solution, do not try other solutions
+                // because they become invalid as we created a new block in blockchain.
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+std::unique_ptr<CEquihashSolverEngine> CEquihashSolverEngine::Create(const std::string& name, unsigned int n, unsigned int k)
+{
+    if (name == "tromp") {
+        if (n == WN && k == WK)
+            return std::unique_ptr<CEquihashSolverEngine>(new CTrompSolverEngine());
+        LogPrintf("Equihash solver \"tromp\" only supports n = %u, k = %u, using \"default\"\n", WN, WK);
+    }
+    return std::unique_ptr<CEquihashSolverEngine>(new CDefaultSolverEngine(n, k));
+}
+
+/**
+ * The template all mining threads work on. ThreadMinerTemplates builds it
+ * once as soon as the tip changes, or when the mempool has changed and it is
+ * a minute old, rather than every thread building its own in turn under
+ * cs_main. Its coinbase pays to a placeholder of the size of a P2PKH output,
+ * which each thread replaces with its own script.
+ */
+static boost::mutex csMinerTemplate;
+static boost::condition_variable condMinerTemplate;
+static std::shared_ptr<const CBlockTemplate> pMinerTemplate;
+//! Bumped for every new template
+static uint64_t nMinerTemplateId = 0;
+//! Tips notified so far, and those when the current template was started
+static uint64_t nMinerTips = 0;
+static uint64_t nMinerTemplateTips = 0;
+//! GetTimeMicros of the last tip notification
+static int64_t nMinerTipTime = 0;
+
+static bool MinerTemplateCurrent()
+{
+    return pMinerTemplate && nMinerTemplateTips == nMinerTips;
+}
+
+void static ThreadMinerTemplates()
+{
+    RenameThread("horizen-mintmpl");
+    const CChainParams& chainparams = Params();
+    const CScript scriptPlaceholder = CScript() << OP_DUP << OP_HASH160 << ToByteVector(CKeyID()) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    {
+        boost::unique_lock<boost::mutex> lock(csMinerTemplate);
+        pMinerTemplate.reset();
+        nMinerTips = nMinerTemplateTips = 0;
+    }
+    boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
+        [](const uint256& hashNewTip) {
+            boost::unique_lock<boost::mutex> lock(csMinerTemplate);
+            nMinerTips++;
+            nMinerTipTime = GetTimeMicros();
+            condMinerTemplate.notify_all();
+        }
+    );
+
+    try {
+        unsigned int nTransactionsUpdatedLast = 0;
+        int64_t nBuilt = 0;
+        while (true) {
+            uint64_t nTips;
+            {
+                boost::unique_lock<boost::mutex> lock(csMinerTemplate);
+                while (MinerTemplateCurrent() &&
+                       (mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast || GetTime() - nBuilt <= 60))
+                    condMinerTemplate.timed_wait(lock, boost::posix_time::seconds(1));
+                nTips = nMinerTips;
+            }
+
+            // Don't build templates for an obsolete chain, as the miners wait for peers anyway
+            if (chainparams.MiningRequiresPeers()) {
+                bool fvNodesEmpty;
+                {
+                    LOCK(cs_vNodes);
+                    fvNodesEmpty = vNodes.empty();
+                }
+                if (fvNodesEmpty || IsInitialBlockDownload()) {
+                    MilliSleep(1000);
+                    continue;
+                }
+            }
+
+            nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+            nBuilt = GetTime();
+            std::shared_ptr<CBlockTemplate> pblocktemplate;
+            try {
+                pblocktemplate.reset(CreateNewBlock(scriptPlaceholder));
+            } catch (const std::runtime_error& e) {
+                LogPrintf("HorizenMiner: CreateNewBlock failed: %s\n", e.what());
+            }
+            if (!pblocktemplate) {
+                MilliSleep(1000);
+                continue;
+            }
+            // Built once here, so that each thread only rehashes the path of its own coinbase
+            pblocktemplate->block.BuildMerkleTree();
+
+            boost::unique_lock<boost::mutex> lock(csMinerTemplate);
+            pMinerTemplate = pblocktemplate;
+            nMinerTemplateTips = nTips;
+            nMinerTemplateId++;
+            condMinerTemplate.notify_all();
+        }
+    } catch (const boost::thread_interrupted&) {
+        c.disconnect();
+        throw;
+    }
+}
+
+/**
+ * Wait for a template on the last tip notified, and return it with its id
+ * and the time that tip was notified at
+ */
+static std::shared_ptr<const CBlockTemplate> GetMinerTemplate(uint64_t& nId, int64_t& nTipTime)
+{
+    boost::unique_lock<boost::mutex> lock(csMinerTemplate);
+    while (!MinerTemplateCurrent())
+        condMinerTemplate.wait(lock);
+    nId = nMinerTemplateId;
+    nTipTime = nMinerTipTime;
+    return pMinerTemplate;
+}
+
+static uint64_t GetMinerTemplateId()
+{
+    boost::unique_lock<boost::mutex> lock(csMinerTemplate);
+    return nMinerTemplateId;
+}
+
 #ifdef ENABLE_WALLET
 void static BitcoinMiner(CWallet *pwallet)
 #else
@@ -648,6 +938,7 @@ void static BitcoinMiner()
     LogPrintf("HorizenMiner started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
     RenameThread("horizzen-miner");
+    JoinThreadPool("miner");
     const CChainParams& chainparams = Params();
 
 #ifdef ENABLE_WALLET
@@ -657,13 +948,18 @@ void static BitcoinMiner()
 
     // Each thread has its own counter
     unsigned int nExtraNonce = 0;
+    // Notification time of the tip of the last template taken
+    int64_t nLastTipTime = 0;
 
     unsigned int n = chainparams.EquihashN();
     unsigned int k = chainparams.EquihashK();
 
-    std::string solver = GetArg("-equihashsolver", "default");
-    assert(solver == "tromp" || solver == "default");
-    LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
+    std::string solverName = GetArg("-equihashsolver", "default");
+    assert(solverName == "tromp" || solverName == "default");
+    std::unique_ptr<CEquihashSolverEngine> solver(CEquihashSolverEngine::Create(solverName, n, k));
+    LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver->GetName(), n, k);
+
+    std::shared_ptr<MinerThreadMetrics> threadMetrics = RegisterMinerThread(solver->GetName());
 
     std::mutex m_cs;
     bool cancelSolver = false;
@@ -674,6 +970,7 @@ void static BitcoinMiner()
         }
     );
     miningTimer.start();
+    threadMetrics->timer.start();
 
     try {
         while (true) {
@@ -681,6 +978,7 @@ void static BitcoinMiner()
                 // Busy-wait for the network to come online so we don't waste time mining
                 // on an obsolete chain. In regtest mode we expect to fly solo.
                 miningTimer.stop();
+                threadMetrics->timer.stop();
                 do {
                     bool fvNodesEmpty;
                     {
@@ -692,20 +990,33 @@ void static BitcoinMiner()
                     MilliSleep(1000);
                 } while (true);
                 miningTimer.start();
+                threadMetrics->timer.start();
             }
 
             //
-            // Create new block
+            // Take the shared template
             //
-            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+            uint64_t nTemplateId;
+            int64_t nTipTime;
+            std::shared_ptr<const CBlockTemplate> ptemplate = GetMinerTemplate(nTemplateId, nTipTime);
             CBlockIndex* pindexPrev = chainActive.Tip();
+            if (ptemplate->block.hashPrevBlock != pindexPrev->GetBlockHash()) {
+                // The tip has moved on, and its notification is about to follow
+                MilliSleep(10);
+                continue;
+            }
+            if (nTipTime != nLastTipTime) {
+                if (nLastTipTime != 0)
+                    minerStaleWorkTime.observe(GetTimeMicros() - nTipTime);
+                nLastTipTime = nTipTime;
+            }
 
 #ifdef ENABLE_WALLET
-            unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
+            boost::optional<CScript> scriptPubKey = GetMinerScriptPubKey(reservekey);
 #else
-            unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey());
+            boost::optional<CScript> scriptPubKey = GetMinerScriptPubKey();
 #endif
-            if (!pblocktemplate.get())
+            if (!scriptPubKey)
             {
                 if (GetArg("-mineraddress", "").empty()) {
                     LogPrintf("Error in HorizenMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
@@ -713,9 +1024,21 @@ void static BitcoinMiner()
                     // Should never reach here, because -mineraddress validity is checked in init.cpp
                     LogPrintf("Error in HorizenMiner: Invalid -mineraddress\n");
                 }
+                miningTimer.stop();
+                UnregisterMinerThread(threadMetrics);
+                c.disconnect();
                 return;
             }
-            CBlock *pblock = &pblocktemplate->block;
+            CBlock block(ptemplate->block);
+            CBlock *pblock = &block; // pointer for convenience
+            CMutableTransaction txCoinbase(pblock->vtx[0]);
+            txCoinbase.vout[0].scriptPubKey = *scriptPubKey;
+            pblock->vtx[0] = txCoinbase;
+            // Threads sharing the template start from nonces of their own
+            arith_uint256 nonce = UintToArith256(GetRandHash());
+            nonce <<= 32;
+            nonce >>= 16;
+            pblock->nNonce = ArithToUint256(nonce);
             IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
             LogPrintf("Running HorizenMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
                 ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
@@ -723,7 +1046,6 @@ void static BitcoinMiner()
             //
             // Search
             //
-            int64_t nStart = GetTime();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
 
             while (true) {
@@ -748,19 +1070,20 @@ void static BitcoinMiner()
 
                 // (x_1, x_2, ...) = A(I, V, n, k)
                 LogPrint("pow", "Running Equihash solver \"%s\" with nNonce = %s\n",
-                         solver, pblock->nNonce.ToString());
+                         solver->GetName(), pblock->nNonce.ToString());
 
                 std::function<bool(std::vector<unsigned char>)> validBlock =
 #ifdef ENABLE_WALLET
-                        [&pblock, &hashTarget, &pwallet, &reservekey, &m_cs, &cancelSolver, &chainparams]
+                        [&pblock, &hashTarget, &pwallet, &reservekey, &m_cs, &cancelSolver, &chainparams, &threadMetrics]
 #else
-                        [&pblock, &hashTarget, &m_cs, &cancelSolver, &chainparams]
+                        [&pblock, &hashTarget, &m_cs, &cancelSolver, &chainparams, &threadMetrics]
 #endif
                         (std::vector<unsigned char> soln) {
                     // Write the solution to the hash and compute the result.
                     LogPrint("pow", "- Checking solution against target\n");
                     pblock->nSolution = soln;
                     solutionTargetChecks.increment();
+                    threadMetrics->solutionTargetChecks.increment();
 
                     if (UintToArith256(pblock->GetHash()) > hashTarget) {
                         return false;
@@ -785,6 +1108,7 @@ void static BitcoinMiner()
                     if (chainparams.MineBlocksOnDemand()) {
                         // Increment here because throwing skips the call below
                         ehSolverRuns.increment();
+                        threadMetrics->ehSolverRuns.increment();
                         throw boost::thread_interrupted();
                     }
 
@@ -795,52 +1119,18 @@ void static BitcoinMiner()
                     return cancelSolver;
                 };
 
-                // TODO: factor this out into a function with the same API for each solver.
-                if (solver == "tromp") {
-                    // Create solver and initialize it.
-                    equi eq(1);
-                    eq.setstate(&curr_state);
-
-                    // Intialization done, start algo driver.
-                    eq.digit0(0);
-                    eq.xfull = eq.bfull = eq.hfull = 0;
-                    eq.showbsizes(0);
-                    for (u32 r = 1; r < WK; r++) {
-                        (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(r);
-                    }
-                    eq.digitK(0);
+                try {
+                    // If we find a valid block, we rebuild
+                    bool found = solver->Solve(curr_state, validBlock, cancelled);
                     ehSolverRuns.increment();
-
-                    // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                    for (size_t s = 0; s < eq.nsols; s++) {
-                        LogPrint("pow", "Checking solution %d\n", s+1);
-                        std::vector<eh_index> index_vector(PROOFSIZE);
-                        for (size_t i = 0; i < PROOFSIZE; i++) {
-                            index_vector[i] = eq.sols[s][i];
-                        }
-                        std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
-
-                        if (validBlock(sol_char)) {
-                            // If we find a POW solution, do not try other solutions
-                            // because they become invalid as we created a new block in blockchain.
-                            break;
-                        }
-                    }
-                } else {
-                    try {
-                        // If we find a valid block, we rebuild
-                        bool found = EhOptimisedSolve(n, k, curr_state, validBlock, cancelled);
-                        ehSolverRuns.increment();
-                        if (found) {
-                            break;
-                        }
-                    } catch (EhSolverCancelledException&) {
-                        LogPrint("pow", "Equihash solver cancelled\n");
-                        std::lock_guard<std::mutex> lock{m_cs};
-                        cancelSolver = false;
+                    threadMetrics->ehSolverRuns.increment();
+                    if (found) {
+                        break;
                     }
+                } catch (EhSolverCancelledException&) {
+                    LogPrint("pow", "Equihash solver cancelled\n");
+                    std::lock_guard<std::mutex> lock{m_cs};
+                    cancelSolver = false;
                 }
 
                 // Check for stop or if block needs to be rebuilt
@@ -850,7 +1140,7 @@ void static BitcoinMiner()
                     break;
                 if ((UintToArith256(pblock->nNonce) & 0xffff) == 0xffff)
                     break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
+                if (GetMinerTemplateId() != nTemplateId)
                     break;
                 if (pindexPrev != chainActive.Tip())
                     break;
@@ -864,6 +1154,7 @@ void static BitcoinMiner()
     catch (const boost::thread_interrupted&)
     {
         miningTimer.stop();
+        UnregisterMinerThread(threadMetrics);
         c.disconnect();
         LogPrintf("HorizenMiner terminated\n");
         throw;
@@ -871,11 +1162,13 @@ void static BitcoinMiner()
     catch (const std::runtime_error &e)
     {
         miningTimer.stop();
+        UnregisterMinerThread(threadMetrics);
         c.disconnect();
         LogPrintf("HorizenMiner runtime error: %s\n", e.what());
         return;
     }
     miningTimer.stop();
+    UnregisterMinerThread(threadMetrics);
     c.disconnect();
 }
 
@@ -901,6 +1194,7 @@ void GenerateBitcoins(bool fGenerate, int nThreads)
         return;
 
     minerThreads = new boost::thread_group();
+    minerThreads->create_thread(&ThreadMinerTemplates);
     for (int i = 0; i < nThreads; i++) {
 #ifdef ENABLE_WALLET
         minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet));
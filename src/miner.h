@@ -40,6 +40,13 @@ void GetBlockTxPriorityDataOld(const CBlock *pblock, int nHeight, int64_t nMedia
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn,  unsigned int nBlockMaxComplexitySize);
+/**
+ * If the transactions of the block after the coinbase are those of a recent
+ * template on the current tip, mark them as having passed their script and
+ * JoinSplit proof checks, so that connecting the block only checks the
+ * header, the solution and the coinbase again. Requires cs_main.
+ */
+bool MarkTemplateBlockChecked(const CBlock& block);
 #ifdef ENABLE_WALLET
 boost::optional<CScript> GetMinerScriptPubKey(CReserveKey& reservekey);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
@@ -12,8 +12,11 @@
 #include "addrman.h"
 #include "chainparams.h"
 #include "clientversion.h"
+#include "consensus/consensus.h"
+#include "memusage.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "socketevents.h"
 #include "ui_interface.h"
 #include "crypto/common.h"
 #include "zen/utiltls.h"
@@ -26,9 +29,14 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
+#include <math.h>
+
 #include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/thread.hpp>
 
 #include <openssl/conf.h>
@@ -89,13 +97,15 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
+//! Watches the peer and listen sockets when set, otherwise select() is used
+static CSocketEvents* pSocketEvents = NULL;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
 bool fAddressesInitialized = false;
 TLSManager tlsmanager = TLSManager();
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, std::shared_ptr<const CTransaction> > mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -113,7 +123,24 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
-boost::condition_variable messageHandlerCondition;
+
+/** An outbound connection picked by ThreadOpenConnections, holding its outbound slot until a connector thread is done with it */
+struct CPendingConnect {
+    CAddress addr;
+    CSemaphoreGrant grant;
+};
+
+// The connections waiting for a connector thread, and the addresses queued or being connected to,
+// so that an unresponsive address only holds up its own connector thread
+static boost::mutex csPendingConnects;
+static boost::condition_variable condPendingConnects;
+static std::list<CPendingConnect> lPendingConnects;
+static std::set<CService> setConnecting;
+
+// Each message handler thread serves the nodes whose id modulo nMessageHandlerThreads is its own index,
+// so the messages of a node are always processed in order by the same thread
+static int nMessageHandlerThreads = 1;
+static boost::condition_variable messageHandlerConditions[MAX_MESSAGE_HANDLER_THREADS];
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -352,6 +379,10 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+uint64_t CNode::nMaxOutboundTotalBytesSentInCycle = 0;
+uint64_t CNode::nMaxOutboundCycleStartTime = 0;
+uint64_t CNode::nMaxOutboundLimit = 0;
+uint64_t CNode::nMaxOutboundTimeframe = MAX_UPLOAD_TIMEFRAME;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -417,7 +448,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!pSocketEvents && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -714,11 +745,13 @@ void CNode::copyStats(CNodeStats &stats)
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
 
-    // If ssl != NULL it means TLS connection was established successfully
+    // Inbound connections have an ssl before their handshake completed
     {
         LOCK(cs_hSocket);
         stats.fTLSEstablished = (ssl != NULL) && (SSL_get_state(ssl) == TLS_ST_OK);
-        stats.fTLSVerified = (ssl != NULL) && ValidatePeerCertificate(ssl);
+        stats.fTLSVerified = stats.fTLSEstablished && ValidatePeerCertificate(ssl);
+        bool fKernelRecv;
+        GetKernelTLSStatus(stats.fTLSEstablished ? ssl : NULL, stats.fTLSKernel, fKernelRecv);
     }
 }
 #undef X
@@ -731,13 +764,14 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, nRecvVersion));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, nRecvVersion);
 
         CNetMessage& msg = vRecvMsg.back();
 
         // absorb network data
         int handled;
-        if (!msg.in_data)
+        bool fHeader = !msg.in_data;
+        if (fHeader)
             handled = msg.readHeader(pch, nBytes);
         else
             handled = msg.readData(pch, nBytes);
@@ -750,18 +784,44 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             return false;
         }
 
+        // The header is in: the payload gets a buffer it fits in
+        if (fHeader && msg.in_data) {
+            CPublicSerializeData vch;
+            netMessageBufferPool.Get(vch, msg.hdr.nMessageSize);
+            msg.vRecv.Swap(vch);
+        }
+
         pch += handled;
         nBytes -= handled;
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            messageHandlerConditions[id % nMessageHandlerThreads].notify_one();
         }
     }
 
     return true;
 }
 
+// requires LOCK(cs_vRecvMsg)
+char* CNode::GetRecvDataBuffer(unsigned int& nBytes)
+{
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return NULL;
+    return vRecvMsg.back().prepareData(nBytes);
+}
+
+// requires LOCK(cs_vRecvMsg)
+void CNode::ReceivedMsgData(unsigned int nBytes)
+{
+    CNetMessage& msg = vRecvMsg.back();
+    msg.nDataPos += nBytes;
+    if (msg.complete()) {
+        msg.nTime = GetTimeMicros();
+        messageHandlerConditions[id % nMessageHandlerThreads].notify_one();
+    }
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -794,21 +854,96 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 }
 
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
+{
+    unsigned int nCopy = nBytes;
+    char* pchDest = prepareData(nCopy);
+    if (nCopy == 0)
+        return 0;
+
+    memcpy(pchDest, pch, nCopy);
+    nDataPos += nCopy;
+
+    return nCopy;
+}
+
+char* CNetMessage::prepareData(unsigned int& nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
-    unsigned int nCopy = std::min(nRemaining, nBytes);
+    nBytes = std::min(nRemaining, nBytes);
+    if (nBytes == 0)
+        return NULL;
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    if (vRecv.size() < nDataPos + nBytes) {
+        // Size up to 256 KiB ahead, but never more than the total message size. This stays
+        // within the capacity the pooled buffer was given, only the bytes are zeroed.
+        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nBytes + 256 * 1024));
     }
 
-    memcpy(&vRecv[nDataPos], pch, nCopy);
-    nDataPos += nCopy;
+    return &vRecv[nDataPos];
+}
 
-    return nCopy;
+CNetMessageBufferPool netMessageBufferPool;
+
+//! Size class of a buffer holding nSize bytes: 0 up to MIN_RECV_BUFFER_SIZE, doubling with each class
+static unsigned int RecvBufferClass(size_t nSize)
+{
+    unsigned int nClass = 0;
+    while (((size_t)MIN_RECV_BUFFER_SIZE << nClass) < nSize)
+        nClass++;
+    return nClass;
+}
+
+CNetMessageBufferPool::CNetMessageBufferPool() : vFree(RecvBufferClass(MAX_PROTOCOL_MESSAGE_LENGTH) + 1), nPooledBytes(0)
+{
+}
+
+void CNetMessageBufferPool::Get(CPublicSerializeData& vch, unsigned int nSize)
+{
+    vch.clear();
+    if (nSize == 0)
+        return;
+    unsigned int nClass = RecvBufferClass(nSize);
+    if (nClass < vFree.size()) {
+        LOCK(cs);
+        std::vector<CPublicSerializeData>& vClass = vFree[nClass];
+        if (!vClass.empty()) {
+            vch.swap(vClass.back());
+            vClass.pop_back();
+            nPooledBytes -= vch.capacity();
+            return;
+        }
+    }
+    vch.reserve(nClass < vFree.size() ? (size_t)MIN_RECV_BUFFER_SIZE << nClass : nSize);
 }
 
+void CNetMessageBufferPool::Put(CPublicSerializeData& vch)
+{
+    size_t nCapacity = vch.capacity();
+    if (nCapacity < MIN_RECV_BUFFER_SIZE)
+        return;
+    // The largest class the buffer holds
+    unsigned int nClass = RecvBufferClass(nCapacity);
+    if (((size_t)MIN_RECV_BUFFER_SIZE << nClass) > nCapacity)
+        nClass--;
+    if (nClass >= vFree.size())
+        return;
+
+    LOCK(cs);
+    if (nPooledBytes + nCapacity > MAX_POOLED_RECV_BUFFER_BYTES)
+        return;
+    vch.clear();
+    vFree[nClass].push_back(CPublicSerializeData());
+    vFree[nClass].back().swap(vch);
+    nPooledBytes += nCapacity;
+}
+
+size_t CNetMessageBufferPool::GetPooledBytes()
+{
+    LOCK(cs);
+    return nPooledBytes;
+}
+
+
 
 
 
@@ -816,19 +951,40 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+//! Small messages are copied into TLS records of up to this size, instead of each taking a record
+static const size_t MAX_TLS_COALESCE_SIZE = 16 * 1024;
+//! Most queued messages handed to the kernel in a single sendmsg
+static const int MAX_SEND_IOVECS = 64;
+
+/** Copy nSize bytes of the send queue, starting at the unsent part of it, into pch. */
+static void CopySendData(CNode *pnode, std::deque<CSerializedNetMsg>::const_iterator it, size_t nSize, char *pch)
+{
+    size_t nOffset = pnode->nSendOffset;
+    while (nSize > 0)
+    {
+        assert(it != pnode->vSendMsg.end());
+        size_t nCopy = std::min(nSize, (*it)->size() - nOffset);
+        memcpy(pch, &(**it)[nOffset], nCopy);
+        pch += nCopy;
+        nSize -= nCopy;
+        nOffset = 0;
+        ++it;
+    }
+}
 
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSerializedNetMsg>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end())
     {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        const size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+        assert(nRemaining > 0);
 
         bool bIsSSL = false;
         int nBytes = 0, nRet = 0;
+        size_t nToSend = 0;
         {
             LOCK(pnode->cs_hSocket);
             
@@ -842,13 +998,51 @@ void SocketSendData(CNode *pnode)
             
             if (bIsSSL)
             {
+                // A write that could not complete has to be retried with the same bytes, which the
+                // send queue still holds as nothing of it was dropped (they may move, thanks to
+                // SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER)
+                if (pnode->nSendRetrySize > 0)
+                    nToSend = pnode->nSendRetrySize;
+                else if (nRemaining >= MAX_TLS_COALESCE_SIZE)
+                    nToSend = nRemaining;
+                else
+                    nToSend = std::min(pnode->nSendSize - pnode->nSendOffset, MAX_TLS_COALESCE_SIZE);
+
+                char buf[MAX_TLS_COALESCE_SIZE];
+                const char *pch = &(**it)[pnode->nSendOffset];
+                if (nToSend > nRemaining)
+                {
+                    CopySendData(pnode, it, nToSend, buf);
+                    pch = buf;
+                }
+
                 ERR_clear_error(); // clear the error queue, otherwise we may be reading an old error that occurred previously in the current thread
-                nBytes = SSL_write(pnode->ssl, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset);
+                nBytes = SSL_write(pnode->ssl, pch, nToSend);
                 nRet = SSL_get_error(pnode->ssl, nBytes);
+                pnode->nSendRetrySize = (nBytes > 0) ? 0 : nToSend;
             }
             else
             {
-                nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+                nToSend = nRemaining;
+                nBytes = send(pnode->hSocket, &(**it)[pnode->nSendOffset], nToSend, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+                // Hand the kernel as much of the queue as it takes, without copying it
+                struct iovec iov[MAX_SEND_IOVECS];
+                int nIov = 0;
+                for (std::deque<CSerializedNetMsg>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; ++itIov, ++nIov)
+                {
+                    const size_t nOffset = (itIov == it) ? pnode->nSendOffset : 0;
+                    iov[nIov].iov_base = (void*)&(**itIov)[nOffset];
+                    iov[nIov].iov_len = (*itIov)->size() - nOffset;
+                    nToSend += iov[nIov].iov_len;
+                }
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = nIov;
+                nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
                 nRet = WSAGetLastError();
             }
         }
@@ -856,18 +1050,27 @@ void SocketSendData(CNode *pnode)
         {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
 
-            if (pnode->nSendOffset == data.size())
+            // Drop the messages sent in full, a write may end inside any of them
+            size_t nLeft = nBytes;
+            while (nLeft > 0)
             {
+                const size_t nUnsent = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nUnsent)
+                {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nUnsent;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 it++;
             }
-            else
+
+            if ((size_t)nBytes < nToSend)
             {
-                // could not send full message; stop sending more
+                // could not send everything; stop sending more
                 break;
             }
         }
@@ -1099,7 +1302,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!pSocketEvents && !IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1153,22 +1356,9 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         unsigned long err_code = 0;
         if (bUseTLS)
         {
-            ssl = tlsmanager.accept( hSocket, addr, err_code);
+            ssl = tlsmanager.startAccept(hSocket, addr, err_code);
             if(!ssl)
             {
-                if (err_code == TLSManager::SELECT_TIMEDOUT)
-                {
-                    // can fail also for timeout in select on fd, that is not a ssl error and we should not
-                    // consider this node as non TLS
-                    LogPrint("tls", "%s():%d - Connection from %s timedout\n", __func__, __LINE__, addr.ToStringIP());
-                }
-                else
-                {
-                    // Further reconnection will be made in non-TLS (unencrypted) mode
-                    vNonTLSNodesInbound.push_back(NODE_ADDR(addr.ToStringIP(), GetTimeMillis()));
-                    LogPrint("tls", "%s():%d - err_code %x, adding connection from %s vNonTLSNodesInbound list (sz=%d)\n",
-                        __func__, __LINE__, err_code, addr.ToStringIP(), vNonTLSNodesInbound.size());
-                }
                 CloseSocket(hSocket);
                 return;
             }
@@ -1189,7 +1379,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     else
     {
         unsigned long err_code = 0;
-        ssl = tlsmanager.accept( hSocket, addr, err_code);
+        ssl = tlsmanager.startAccept(hSocket, addr, err_code);
         if(!ssl)
         {
             LogPrint("tls", "%s():%d - err_code %x, failure accepting connection from %s\n",
@@ -1198,25 +1388,13 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
             return;
         }
     }
-    
-    // certificate validation is disabled by default    
-    if (CNode::GetTlsValidate())
-    {
-        if (ssl && !ValidatePeerCertificate(ssl))
-        {
-            LogPrintf ("TLS: ERROR: Wrong client certificate from %s. Connection will be closed.\n", addr.ToString());
-        
-            SSL_shutdown(ssl);
-            CloseSocket(hSocket);
-            SSL_free(ssl);
-            return;
-        }
-    }
 #endif // USE_TLS
 
     CNode* pnode = new CNode(hSocket, addr, "", true, ssl);
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
+    // The socket handler completes the handshake, see ContinueTLSAccept
+    pnode->fTLSHandshake = (ssl != NULL);
 
     {
         LOCK(cs_vNodes);
@@ -1224,6 +1402,42 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/** Advance the TLS handshake of an inbound peer, once its socket is ready. */
+static void ContinueTLSAccept(CNode* pnode)
+{
+    unsigned long err_code = 0;
+    int ret = tlsmanager.continueHandshake(pnode, err_code);
+    if (ret == 0)
+        return;
+
+    if (ret < 0) {
+        if (CNode::GetTlsFallbackNonTls())
+        {
+            LOCK(cs_vNonTLSNodesInbound);
+            // Further reconnection will be made in non-TLS (unencrypted) mode
+            vNonTLSNodesInbound.push_back(NODE_ADDR(pnode->addr.ToStringIP(), GetTimeMillis()));
+            LogPrint("tls", "%s():%d - err_code %x, adding connection from %s vNonTLSNodesInbound list (sz=%d)\n",
+                __func__, __LINE__, err_code, pnode->addr.ToStringIP(), vNonTLSNodesInbound.size());
+        }
+        else
+        {
+            LogPrint("tls", "%s():%d - err_code %x, failure accepting connection from %s\n",
+                __func__, __LINE__, err_code, pnode->addr.ToStringIP());
+        }
+        pnode->fDisconnect = true;
+        return;
+    }
+
+    // certificate validation is disabled by default
+    if (CNode::GetTlsValidate() && !ValidatePeerCertificate(pnode->ssl))
+    {
+        LogPrintf ("TLS: ERROR: Wrong client certificate from %s. Connection will be closed.\n", pnode->addr.ToString());
+        pnode->fDisconnect = true;
+        return;
+    }
+    pnode->fTLSHandshake = false;
+}
+
 #if defined(USE_TLS)
 void ThreadNonTLSPoolsCleaner()
 {
@@ -1238,9 +1452,111 @@ void ThreadNonTLSPoolsCleaner()
 #endif // USE_TLS 
 
 
+/**
+ * Implement the following logic:
+ * * If there is data to send, wait for sending data. As this only
+ *   happens when optimistic write failed, we choose to first drain the
+ *   write buffer in this case before receiving more. This avoids
+ *   needlessly queueing received data, if the remote peer is not themselves
+ *   receiving data. This means properly utilizing TCP flow control signalling.
+ * * Otherwise, if there is no (complete) message in the receive buffer,
+ *   or there is space left in the buffer, wait for receiving data.
+ * * (if neither of the above applies, there is certainly one message
+ *   in the receiver buffer ready to be processed).
+ * Together, that means that at least one of the following is always possible,
+ * so we don't deadlock:
+ * * We send some data.
+ * * We wait for data to be received (and disconnect after timeout).
+ * * We process a message in the buffer (message handler thread).
+ */
+static void GetSocketInterest(CNode* pnode, bool& fSend, bool& fRecv)
+{
+    fSend = false;
+    fRecv = false;
+    if (pnode->fTLSHandshake) {
+        fSend = pnode->fTLSHandshakeWantWrite;
+        fRecv = !fSend;
+        return;
+    }
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (lockSend && !pnode->vSendMsg.empty()) {
+            fSend = true;
+            return;
+        }
+    }
+    {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (lockRecv && (
+            pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+            pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+            fRecv = true;
+    }
+}
+
+/**
+ * Register new peer sockets with pSocketEvents, wait up to nTimeout
+ * milliseconds and record the readiness it reports on the nodes.
+ * The sockets are edge triggered, so a node stays readable or writable
+ * until a read or write on it would block.
+ */
+static void WaitSocketEvents(std::vector<bool>& vListenReady, int nTimeout)
+{
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->fSocketRegistered)
+                continue;
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            if (!pSocketEvents->Add(pnode->hSocket, pnode->id, false)) {
+                pnode->fDisconnect = true;
+                continue;
+            }
+            pnode->fSocketRegistered = true;
+            pnode->fSocketReadable = true;
+            pnode->fSocketWritable = true;
+        }
+    }
+
+    std::vector<CSocketEvents::Event> vEvents;
+    if (!pSocketEvents->Wait(vEvents, nTimeout)) {
+        LogPrintf("socket %s error %s\n", pSocketEvents->GetName(), NetworkErrorString(WSAGetLastError()));
+        MilliSleep(50);
+    }
+    boost::this_thread::interruption_point();
+    if (vEvents.empty())
+        return;
+
+    LOCK(cs_vNodes);
+    std::map<NodeId, CNode*> mapNodes;
+    BOOST_FOREACH(CNode* pnode, vNodes)
+        mapNodes[pnode->id] = pnode;
+    BOOST_FOREACH(const CSocketEvents::Event& event, vEvents)
+    {
+        if (event.nTag < 0) {
+            size_t i = -event.nTag - 1;
+            if (i < vListenReady.size())
+                vListenReady[i] = true;
+            continue;
+        }
+        // Events for nodes that were disconnected meanwhile are dropped
+        std::map<NodeId, CNode*>::iterator it = mapNodes.find(event.nTag);
+        if (it == mapNodes.end())
+            continue;
+        if (event.nFlags & CSocketEvents::EVENT_RECV)
+            it->second->fSocketReadable = true;
+        if (event.nFlags & CSocketEvents::EVENT_SEND)
+            it->second->fSocketWritable = true;
+    }
+}
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    bool fBusy = false;
     while (true)
     {
         //
@@ -1309,103 +1625,89 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
         fd_set fdsetRecv;
         fd_set fdsetSend;
         fd_set fdsetError;
         FD_ZERO(&fdsetRecv);
         FD_ZERO(&fdsetSend);
         FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+        std::vector<bool> vListenReady(vhListenSocket.size(), false);
 
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+        if (pSocketEvents) {
+            WaitSocketEvents(vListenReady, fBusy ? 0 : 50);
+        } else {
+            struct timeval timeout;
+            timeout.tv_sec  = 0;
+            timeout.tv_usec = 50000; // frequency to poll pnode->vSend
 
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                LOCK(pnode->cs_hSocket);
-                
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+            SOCKET hSocketMax = 0;
+            bool have_fds = false;
 
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+                FD_SET(hListenSocket.socket, &fdsetRecv);
+                hSocketMax = max(hSocketMax, hListenSocket.socket);
+                have_fds = true;
+            }
 
+            {
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
                 {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
+                    LOCK(pnode->cs_hSocket);
+
+                    if (pnode->hSocket == INVALID_SOCKET)
                         continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+
+                    FD_SET(pnode->hSocket, &fdsetError);
+                    hSocketMax = max(hSocketMax, pnode->hSocket);
+                    have_fds = true;
+
+                    bool fSend, fRecv;
+                    GetSocketInterest(pnode, fSend, fRecv);
+                    if (fSend)
+                        FD_SET(pnode->hSocket, &fdsetSend);
+                    else if (fRecv)
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
-        }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+            int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                                 &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+            boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
+            if (nSelect == SOCKET_ERROR)
             {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                if (have_fds)
+                {
+                    int nErr = WSAGetLastError();
+                    LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+                    for (unsigned int i = 0; i <= hSocketMax; i++)
+                        FD_SET(i, &fdsetRecv);
+                }
+                FD_ZERO(&fdsetSend);
+                FD_ZERO(&fdsetError);
+                MilliSleep(timeout.tv_usec/1000);
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+
+            for (unsigned int i = 0; i < vhListenSocket.size(); i++)
+                vListenReady[i] = vhListenSocket[i].socket != INVALID_SOCKET && FD_ISSET(vhListenSocket[i].socket, &fdsetRecv);
         }
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        for (unsigned int i = 0; i < vhListenSocket.size(); i++)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (vListenReady[i])
             {
-                AcceptConnection(hListenSocket);
+                AcceptConnection(vhListenSocket[i]);
             }
         }
 
         //
         // Service each socket
         //
+        fBusy = false;
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
@@ -1417,15 +1719,41 @@ void ThreadSocketHandler()
         {
             boost::this_thread::interruption_point();
 
-            if (tlsmanager.threadSocketHandler(pnode,fdsetRecv,fdsetSend,fdsetError)==-1){
+            bool fRecv = false, fSend = false;
+            if (pSocketEvents) {
+                bool fWantSend, fWantRecv;
+                GetSocketInterest(pnode, fWantSend, fWantRecv);
+                fSend = fWantSend && pnode->fSocketWritable;
+                fRecv = !fWantSend && fWantRecv && pnode->fSocketReadable;
+            } else {
+                LOCK(pnode->cs_hSocket);
+                if (pnode->hSocket != INVALID_SOCKET) {
+                    fRecv = FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError);
+                    fSend = FD_ISSET(pnode->hSocket, &fdsetSend);
+                }
+            }
+
+            if (pnode->fTLSHandshake) {
+                if (fRecv || fSend)
+                    ContinueTLSAccept(pnode);
+            } else if (tlsmanager.threadSocketHandler(pnode, fRecv, fSend) == -1) {
                 continue;
             }
+            // Nothing tells when the rest of the data is read, so do not wait before reading again
+            if (fRecv && pnode->fSocketReadable)
+                fBusy = true;
 
             //
             // Inactivity checking
             //
             int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
+            if (pnode->fTLSHandshake && nTime - pnode->nTimeConnected > DEFAULT_CONNECT_TIMEOUT / 1000)
+            {
+                // Not a TLS error, so the peer is not moved to the non-TLS pool
+                LogPrint("tls", "%s():%d - Connection from %s timedout\n", __func__, __LINE__, pnode->addr.ToStringIP());
+                pnode->fDisconnect = true;
+            }
+            else if (nTime - pnode->nTimeConnected > 60)
             {
                 if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
                 {
@@ -1477,24 +1805,27 @@ void ThreadDNSAddressSeed()
 
     LogPrintf("Loading addresses from DNS seeds (could take a while)\n");
 
-    BOOST_FOREACH(const CDNSSeedData &seed, vSeeds) {
-        if (HaveNameProxy()) {
+    if (HaveNameProxy()) {
+        BOOST_FOREACH(const CDNSSeedData &seed, vSeeds)
             AddOneShot(seed.host);
-        } else {
-            vector<CNetAddr> vIPs;
+    } else {
+        // Query all the seeds at once, so that a slow one does not hold up the others
+        vector<string> vHosts;
+        BOOST_FOREACH(const CDNSSeedData &seed, vSeeds)
+            vHosts.push_back(seed.host);
+        vector<vector<CService> > vServices;
+        LookupMany(vHosts, vServices, Params().GetDefaultPort());
+        for (unsigned int i = 0; i < vSeeds.size(); i++) {
             vector<CAddress> vAdd;
-            if (LookupHost(seed.host.c_str(), vIPs))
+            BOOST_FOREACH(const CService& service, vServices[i])
             {
-                BOOST_FOREACH(const CNetAddr& ip, vIPs)
-                {
-                    int nOneDay = 24*3600;
-                    CAddress addr = CAddress(CService(ip, Params().GetDefaultPort()));
-                    addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
-                    vAdd.push_back(addr);
-                    found++;
-                }
+                int nOneDay = 24*3600;
+                CAddress addr = CAddress(CService((CNetAddr)service, Params().GetDefaultPort()));
+                addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
+                vAdd.push_back(addr);
+                found++;
             }
-            addrman.Add(vAdd, CNetAddr(seed.name, true));
+            addrman.Add(vAdd, CNetAddr(vSeeds[i].name, true));
         }
     }
 
@@ -1602,6 +1933,11 @@ void ThreadOpenConnections()
                 }
             }
         }
+        {
+            boost::lock_guard<boost::mutex> lock(csPendingConnects);
+            BOOST_FOREACH(const CService& addr, setConnecting)
+                setConnected.insert(addr.GetGroup());
+        }
 
         int64_t nANow = GetTime();
 
@@ -1637,7 +1973,38 @@ void ThreadOpenConnections()
         }
 
         if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
+            QueueNetworkConnection(addrConnect, grant);
+    }
+}
+
+void QueueNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant& grant)
+{
+    boost::lock_guard<boost::mutex> lock(csPendingConnects);
+    if (!setConnecting.insert(addrConnect).second)
+        return;
+    lPendingConnects.push_back(CPendingConnect());
+    lPendingConnects.back().addr = addrConnect;
+    grant.MoveTo(lPendingConnects.back().grant);
+    condPendingConnects.notify_one();
+}
+
+void ThreadConnector()
+{
+    while (true)
+    {
+        std::list<CPendingConnect> lConnect;
+        {
+            boost::unique_lock<boost::mutex> lock(csPendingConnects);
+            while (lPendingConnects.empty())
+                condPendingConnects.wait(lock);
+            lConnect.splice(lConnect.begin(), lPendingConnects, lPendingConnects.begin());
+        }
+
+        CPendingConnect& connect = lConnect.front();
+        OpenNetworkConnection(connect.addr, &connect.grant);
+
+        boost::lock_guard<boost::mutex> lock(csPendingConnects);
+        setConnecting.erase(connect.addr);
     }
 }
 
@@ -1675,10 +2042,12 @@ void ThreadOpenAddedConnections()
                 lAddresses.push_back(strAddNode);
         }
 
+        // Look all the added nodes up at once
         list<vector<CService> > lservAddressesToAdd(0);
-        BOOST_FOREACH(const std::string& strAddNode, lAddresses) {
-            vector<CService> vservNode(0);
-            if(Lookup(strAddNode.c_str(), vservNode, Params().GetDefaultPort(), fNameLookup, 0))
+        vector<vector<CService> > vservNodes;
+        LookupMany(vector<string>(lAddresses.begin(), lAddresses.end()), vservNodes, Params().GetDefaultPort(), fNameLookup);
+        BOOST_FOREACH(const vector<CService>& vservNode, vservNodes) {
+            if (!vservNode.empty())
             {
                 lservAddressesToAdd.push_back(vservNode);
                 {
@@ -1767,7 +2136,7 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+void ThreadMessageHandler(int nThread)
 {
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1778,9 +2147,11 @@ void ThreadMessageHandler()
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->id % nMessageHandlerThreads != nThread)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -1804,7 +2175,8 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize())
+                    // A peer out of handler time is polled again after the wait below
+                    if (pnode->nSendSize < SendBufferSize() && !pnode->fRecvThrottled)
                     {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
@@ -1831,7 +2203,7 @@ void ThreadMessageHandler()
         }
 
         if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+            messageHandlerConditions[nThread].timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
     }
 }
 
@@ -2038,6 +2410,17 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("TLS is not used!\n");
 #endif
 
+    if (pSocketEvents == NULL && GetBoolArg("-socketevents", DEFAULT_SOCKET_EVENTS)) {
+        pSocketEvents = CSocketEvents::Create();
+        for (unsigned int i = 0; pSocketEvents && i < vhListenSocket.size(); i++) {
+            if (!pSocketEvents->Add(vhListenSocket[i].socket, -(int64_t)(i + 1), true)) {
+                delete pSocketEvents;
+                pSocketEvents = NULL;
+            }
+        }
+    }
+    LogPrintf("Using %s to watch peer sockets\n", pSocketEvents ? pSocketEvents->GetName() : "select");
+
     //
     // Start threads
     //
@@ -2053,11 +2436,19 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Initiate outbound connections from -addnode
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "addcon", &ThreadOpenAddedConnections));
 
-    // Initiate outbound connections
+    // Initiate outbound connections, established by the connector threads
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
+    int nConnectThreads = std::max(1, std::min((int)GetArg("-connectthreads", DEFAULT_CONNECT_THREADS), MAX_CONNECT_THREADS));
+    for (int i = 0; i < nConnectThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "connector", &ThreadConnector));
 
-    // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    // Process messages, slow peers only hold up the others served by the same thread
+    nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    LogPrintf("Using %d message handler threads\n", nMessageHandlerThreads);
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        boost::function<void()> messageHandler = boost::bind(&ThreadMessageHandler, i);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", messageHandler));
+    }
 
 #if defined(USE_TLS)
     if (CNode::GetTlsFallbackNonTls())
@@ -2068,7 +2459,7 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     
     // Dump network addresses
-    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(&DumpAddresses, DUMP_ADDRESSES_INTERVAL, "dumpaddresses", true);
 }
 
 bool StopNode()
@@ -2105,6 +2496,11 @@ void CNode::NetCleanup()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+    delete pSocketEvents;
+    pSocketEvents = NULL;
+    // The queued connections hold outbound slots
+    lPendingConnects.clear();
+    setConnecting.clear();
     delete semOutbound;
     semOutbound = NULL;
     delete pnodeLocalHost;
@@ -2118,14 +2514,12 @@ void CNode::NetCleanup()
 
 void RelayTransaction(const CTransaction& tx)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, ss);
+    RelayTransaction(std::make_shared<const CTransaction>(tx));
 }
 
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+void RelayTransaction(const std::shared_ptr<const CTransaction>& ptx)
 {
+    const CTransaction& tx = *ptx;
     CInv inv(MSG_TX, tx.GetHash());
     {
         LOCK(cs_mapRelay);
@@ -2136,8 +2530,8 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Shared with the mempool entry rather than kept serialized a second time
+        mapRelay.insert(std::make_pair(inv, ptx));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -2165,6 +2559,89 @@ void CNode::RecordBytesSent(uint64_t bytes)
 {
     LOCK(cs_totalBytesSent);
     nTotalBytesSent += bytes;
+
+    uint64_t now = GetTime();
+    if (nMaxOutboundCycleStartTime + nMaxOutboundTimeframe < now)
+    {
+        // timeframe expired, reset cycle
+        nMaxOutboundCycleStartTime = now;
+        nMaxOutboundTotalBytesSentInCycle = 0;
+    }
+
+    nMaxOutboundTotalBytesSentInCycle += bytes;
+}
+
+void CNode::SetMaxOutboundTarget(uint64_t limit)
+{
+    LOCK(cs_totalBytesSent);
+    nMaxOutboundLimit = limit;
+}
+
+uint64_t CNode::GetMaxOutboundTarget()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxOutboundLimit;
+}
+
+void CNode::SetMaxOutboundTimeframe(uint64_t timeframe)
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundTimeframe != timeframe)
+    {
+        // reset measure-cycle in case of changing the timeframe
+        nMaxOutboundCycleStartTime = GetTime();
+    }
+    nMaxOutboundTimeframe = timeframe;
+}
+
+uint64_t CNode::GetMaxOutboundTimeframe()
+{
+    LOCK(cs_totalBytesSent);
+    return nMaxOutboundTimeframe;
+}
+
+uint64_t CNode::GetMaxOutboundTimeLeftInCycle()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+
+    if (nMaxOutboundCycleStartTime == 0)
+        return nMaxOutboundTimeframe;
+
+    uint64_t cycleEndTime = nMaxOutboundCycleStartTime + nMaxOutboundTimeframe;
+    uint64_t now = GetTime();
+    return (cycleEndTime < now) ? 0 : cycleEndTime - now;
+}
+
+bool CNode::OutboundTargetReached(bool historicalBlockServingLimit)
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return false;
+
+    if (historicalBlockServingLimit)
+    {
+        // keep a buffer large enough to relay a full block for every block
+        // expected before the end of the current timeframe
+        uint64_t timeLeftInCycle = GetMaxOutboundTimeLeftInCycle();
+        uint64_t buffer = timeLeftInCycle / Params().GetConsensus().nPowTargetSpacing * MAX_BLOCK_SIZE;
+        if (buffer >= nMaxOutboundLimit || nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit - buffer)
+            return true;
+    }
+    else if (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit)
+        return true;
+
+    return false;
+}
+
+uint64_t CNode::GetOutboundTargetBytesLeft()
+{
+    LOCK(cs_totalBytesSent);
+    if (nMaxOutboundLimit == 0)
+        return 0;
+
+    return (nMaxOutboundTotalBytesSentInCycle >= nMaxOutboundLimit) ? 0 : nMaxOutboundLimit - nMaxOutboundTotalBytesSentInCycle;
 }
 
 uint64_t CNode::GetTotalBytesRecv()
@@ -2189,21 +2666,21 @@ void CNode::Fuzz(int nChance)
     case 0:
         // xor a random byte with a random value:
         if (!ssSend.empty()) {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CPublicDataStream::size_type pos = GetRand(ssSend.size());
             ssSend[pos] ^= (unsigned char)(GetRand(256));
         }
         break;
     case 1:
         // delete a random byte:
         if (!ssSend.empty()) {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CPublicDataStream::size_type pos = GetRand(ssSend.size());
             ssSend.erase(ssSend.begin()+pos);
         }
         break;
     case 2:
         // insert a random byte at a random position
         {
-            CDataStream::size_type pos = GetRand(ssSend.size());
+            CPublicDataStream::size_type pos = GetRand(ssSend.size());
             char ch = (char)GetRand(256);
             ssSend.insert(ssSend.begin()+pos, ch);
         }
@@ -2318,14 +2795,24 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn, SSL *sslIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
     addrKnown(5000, 0.001),
-    setInventoryKnown(SendBufferSize() / 1000)
+    filterInventoryKnown(MAX_INVENTORY_KNOWN, 0.000001)
 {
     ssl = sslIn;
     nServices = 0;
     hSocket = hSocketIn;
+    fSocketRegistered = false;
+    fSocketReadable = false;
+    fSocketWritable = false;
+    fTLSHandshake = false;
+    fTLSHandshakeWantWrite = false;
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
@@ -2347,11 +2834,14 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSendRetrySize = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
     fSentAddr = false;
+    nNextInvSend = 0;
+    fRecvThrottled = false;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2443,6 +2933,37 @@ CNode::~CNode()
     GetNodeSignals().FinalizeNode(GetId());
 }
 
+size_t CNode::DynamicMemoryUsage()
+{
+    size_t nUsage = 0;
+    {
+        LOCK(cs_vSend);
+        nUsage += memusage::MallocUsage(ssSend.capacity()) + memusage::DynamicUsage(vSendMsg) + nSendSize;
+    }
+    {
+        LOCK(cs_vRecvMsg);
+        nUsage += memusage::DynamicUsage(vRecvGetData) + memusage::DynamicUsage(vRecvMsg);
+        BOOST_FOREACH(const CNetMessage &msg, vRecvMsg)
+            nUsage += memusage::MallocUsage(msg.hdrbuf.capacity()) + memusage::MallocUsage(msg.vRecv.capacity());
+    }
+    {
+        LOCK(cs_vAddrToSend);
+        nUsage += memusage::DynamicUsage(vAddrToSend) + addrKnown.DynamicMemoryUsage();
+    }
+    {
+        LOCK(cs_inventory);
+        nUsage += filterInventoryKnown.DynamicMemoryUsage() + memusage::DynamicUsage(setInventoryTxToSend) +
+                  memusage::DynamicUsage(vInventoryBlockToSend) + memusage::DynamicUsage(vBlockHashesToAnnounce) +
+                  memusage::DynamicUsage(setAskFor) + memusage::DynamicUsage(mapAskFor) + memusage::DynamicUsage(setKnown);
+    }
+    {
+        LOCK(cs_filter);
+        if (pfilter)
+            nUsage += memusage::MallocUsage(sizeof(CBloomFilter)) + pfilter->DynamicMemoryUsage();
+    }
+    return nUsage;
+}
+
 void CNode::AskFor(const CInv& inv)
 {
     if (mapAskFor.size() > MAPASKFOR_MAX_SZ || setAskFor.size() > SETASKFOR_MAX_SZ)
@@ -2477,11 +2998,42 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
+void BeginNetMessage(CPublicDataStream& ss, const char* pszCommand)
+{
+    assert(ss.size() == 0);
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+}
+
+/** Set the size and checksum in the header of the message held by ss, returning the payload size. */
+static unsigned int FinalizeMessageHeader(CPublicDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    return nSize;
+}
+
+CSerializedNetMsg EndNetMessage(CPublicDataStream& ss)
+{
+    FinalizeMessageHeader(ss);
+    // The message takes the buffer of ss, which is not reused
+    boost::shared_ptr<CPublicSerializeData> data = boost::make_shared<CPublicSerializeData>();
+    ss.GetAndClear(*data);
+    return data;
+}
+
 void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
-    assert(ssSend.size() == 0);
-    ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+    BeginNetMessage(ssSend, pszCommand);
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
 
@@ -2513,26 +3065,36 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
-
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    unsigned int nSize = FinalizeMessageHeader(ssSend);
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    // Copied out, so that ssSend keeps its buffer for the next message
+    boost::shared_ptr<CPublicSerializeData> data = boost::make_shared<CPublicSerializeData>(ssSend.begin(), ssSend.end());
+    ssSend.clear();
+    vSendMsg.push_back(data);
+    nSendSize += data->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
+
+void CNode::PushMessage(const CSerializedNetMsg& msg)
+{
+    assert(msg->size() >= CMessageHeader::HEADER_SIZE);
+    const char* pszCommand = &(*msg)[MESSAGE_START_SIZE];
+    LOCK(cs_vSend);
+    LogPrint("net", "sending: %s (%d bytes, shared) peer=%d\n",
+        SanitizeString(std::string(pszCommand, strnlen(pszCommand, CMessageHeader::COMMAND_SIZE))),
+        msg->size() - CMessageHeader::HEADER_SIZE, id);
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    // If write queue empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
@@ -10,7 +10,6 @@
 #include "compat.h"
 #include "hash.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -20,6 +19,7 @@
 #include "utilstrencodings.h"
 
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -28,6 +28,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 // Enable OpenSSL Support for Zen
@@ -39,6 +40,7 @@
 class CAddrMan;
 class CScheduler;
 class CNode;
+class CTransaction;
 
 namespace boost {
     class thread_group;
@@ -62,10 +64,75 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/** -msghandlerthreads default, the number of threads the peers are spread over to process their messages */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+/** The maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+/** -connectthreads default, the number of outbound connections being established at once */
+static const int DEFAULT_CONNECT_THREADS = 8;
+/** The maximum number of connector threads */
+static const int MAX_CONNECT_THREADS = 16;
+/** Inventory items remembered per peer as known to it, not to announce them again */
+static const unsigned int MAX_INVENTORY_KNOWN = 5000;
+/** -maxuploadtarget default, in MiB per timeframe (0 = no limit) */
+static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
+/** The timeframe over which -maxuploadtarget is measured, in seconds */
+static const uint64_t MAX_UPLOAD_TIMEFRAME = 60 * 60 * 24;
+/** Message handler time a peer is granted per second for each class of costly messages, in microseconds */
+static const int64_t MSG_CLASS_TIME_PER_SECOND = 100000;
+/** Message handler time a peer can use at once for each class of costly messages, in microseconds */
+static const int64_t MSG_CLASS_TIME_BURST = 2000000;
+
+/** Classes of messages a peer can only use a share of the message handler time for */
+enum MessageClass
+{
+    MSG_CLASS_TX,       //!< transactions to validate
+    MSG_CLASS_REQUEST,  //!< requests for data to serve: getdata, getheaders, getblocks, mempool...
+    MSG_CLASS_COUNT,
+    MSG_CLASS_UNLIMITED = MSG_CLASS_COUNT //!< messages we asked for or that are cheap to handle
+};
+
+/**
+ * Handler time budget of a class of messages from a peer: a token bucket
+ * refilled at MSG_CLASS_TIME_PER_SECOND up to MSG_CLASS_TIME_BURST. Handling a
+ * message may overdraw it; the class then waits until the budget is positive
+ * again.
+ */
+class CMessageTimeBudget
+{
+private:
+    int64_t nBudget;      //!< in microseconds, negative when overdrawn
+    int64_t nLastRefill;  //!< in microseconds, 0 until first used
+
+public:
+    CMessageTimeBudget() : nBudget(MSG_CLASS_TIME_BURST), nLastRefill(0) {}
+
+    /** Whether a message of the class can be handled at nNow (in microseconds) */
+    bool Available(int64_t nNow)
+    {
+        if (nLastRefill == 0 || nNow < nLastRefill) {
+            nLastRefill = nNow;
+        } else {
+            // Only the time accounted for moves on, polling often loses nothing to rounding
+            int64_t nRefill = (nNow - nLastRefill) * MSG_CLASS_TIME_PER_SECOND / 1000000;
+            nBudget = std::min(MSG_CLASS_TIME_BURST, nBudget + nRefill);
+            nLastRefill += nRefill * 1000000 / MSG_CLASS_TIME_PER_SECOND;
+        }
+        return nBudget > 0;
+    }
+
+    /** Charge the time taken handling a message */
+    void Consume(int64_t nMicros) { nBudget -= nMicros; }
+
+    int64_t GetBudget() const { return nBudget; }
+};
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
 
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
+
 void AddOneShot(const std::string& strDest);
 void AddressCurrentlyConnected(const CService& addr);
 CNode* FindNode(const CNetAddr& ip);
@@ -74,6 +141,8 @@ CNode* FindNode(const std::string& addrName);
 CNode* FindNode(const CService& ip);
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest = NULL);
 bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = NULL, const char *strDest = NULL, bool fOneShot = false);
+/** Hand an outbound connection over to a connector thread with its slot, without waiting for it */
+void QueueNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant& grant);
 unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
@@ -159,7 +228,8 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+//! Transactions recently announced, for the peers that ask for them
+extern std::map<CInv, std::shared_ptr<const CTransaction> > mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -189,6 +259,8 @@ public:
     uint64_t nServices;
     bool fTLSEstablished;
     bool fTLSVerified;
+    //! Whether the kernel encrypts the records sent to the peer (-tlsktls)
+    bool fTLSKernel;
     int64_t nLastSend;
     int64_t nLastRecv;
     int64_t nTimeConnected;
@@ -209,15 +281,47 @@ public:
 
 
 
+/**
+ * Payload buffers of received messages, recycled once the messages are processed so that
+ * receiving does not allocate a new buffer for every message, nor
+ * grow it by reallocating. Buffers are kept in power of two size classes, from
+ * MIN_RECV_BUFFER_SIZE up to MAX_PROTOCOL_MESSAGE_LENGTH, and MAX_POOLED_RECV_BUFFER_BYTES in all.
+ */
+class CNetMessageBufferPool
+{
+public:
+    CNetMessageBufferPool();
+
+    /** An empty buffer in vch that holds at least nSize bytes without reallocating */
+    void Get(CPublicSerializeData& vch, unsigned int nSize);
+    /** Take back the buffer of vch, which is left empty */
+    void Put(CPublicSerializeData& vch);
+
+    /** Bytes held by the buffers in the pool */
+    size_t GetPooledBytes();
+
+private:
+    CCriticalSection cs;
+    std::vector<std::vector<CPublicSerializeData> > vFree;
+    size_t nPooledBytes;
+};
+
+/** Smallest size class of pooled receive buffers */
+static const unsigned int MIN_RECV_BUFFER_SIZE = 4 * 1024;
+/** Most bytes kept by the buffers in the receive buffer pool */
+static const size_t MAX_POOLED_RECV_BUFFER_BYTES = 32 * 1024 * 1024;
+
+extern CNetMessageBufferPool netMessageBufferPool;
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    CPublicDataStream hdrbuf;       // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
-    CDataStream vRecv;              // received message data
+    CPublicDataStream vRecv;        // received message data
     unsigned int nDataPos;
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
@@ -230,6 +334,13 @@ public:
         nTime = 0;
     }
 
+    ~CNetMessage()
+    {
+        CPublicSerializeData vch;
+        vRecv.Swap(vch);
+        netMessageBufferPool.Put(vch);
+    }
+
     bool complete() const
     {
         if (!in_data)
@@ -245,8 +356,33 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+    // Room for up to nBytes more of the payload, to be written in place; nBytes is set to how many fit
+    char* prepareData(unsigned int& nBytes);
 };
 
+/**
+ * A complete message (header and payload) queued for sending. It is never
+ * modified once built, so the same message can be queued on many nodes.
+ */
+typedef boost::shared_ptr<const CPublicSerializeData> CSerializedNetMsg;
+
+/** Put the header of a message in ss, whose payload is then appended to ss. */
+void BeginNetMessage(CPublicDataStream& ss, const char* pszCommand);
+/** Set the size and checksum of a message started with BeginNetMessage and take its data. */
+CSerializedNetMsg EndNetMessage(CPublicDataStream& ss);
+
+/**
+ * Serialize a message once for any number of nodes, e.g. a block every peer
+ * asks for. Only for objects serialized the same way for every peer version.
+ */
+template<typename T>
+CSerializedNetMsg SerializeNetMessage(const char* pszCommand, const T& obj)
+{
+    CPublicDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    BeginNetMessage(ss, pszCommand);
+    ss << obj;
+    return EndNetMessage(ss);
+}
 
 
 
@@ -262,16 +398,27 @@ public:
     uint64_t nServices;
     SOCKET hSocket;
     CCriticalSection cs_hSocket;
-    CDataStream ssSend;
+    // Readiness reported by CSocketEvents, kept until a read or write would block (socket handler thread only)
+    bool fSocketRegistered;
+    bool fSocketReadable;
+    bool fSocketWritable;
+    // Inbound TLS handshake still in progress, and whether it waits to write (socket handler thread only)
+    bool fTLSHandshake;
+    bool fTLSHandshakeWantWrite;
+    CPublicDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
+    size_t nSendRetrySize; // size of an SSL_write that must be retried with the same bytes, 0 if none
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializedNetMsg> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Handler time budgets of the costly message classes, and whether the next message waits for one (cs_vRecvMsg)
+    CMessageTimeBudget msgBudget[MSG_CLASS_COUNT];
+    bool fRecvThrottled;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -337,12 +484,19 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend; // protects vAddrToSend and addrKnown, which other peers' handlers relay to
     bool fGetAddr;
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
-    std::vector<CInv> vInventoryToSend;
+    CRollingBloomFilter filterInventoryKnown;
+    // Transactions to announce, in batches ordered by fee rate at nNextInvSend
+    std::set<uint256> setInventoryTxToSend;
+    // Blocks and other inventory to announce right away
+    std::vector<CInv> vInventoryBlockToSend;
+    // New main chain and fork tips, announced with their headers to peers that sent "sendheaders"
+    std::vector<uint256> vBlockHashesToAnnounce;
+    int64_t nNextInvSend;
     CCriticalSection cs_inventory;
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
@@ -369,6 +523,12 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // Outbound limit & stats, guarded by cs_totalBytesSent
+    static uint64_t nMaxOutboundTotalBytesSentInCycle;
+    static uint64_t nMaxOutboundCycleStartTime;
+    static uint64_t nMaxOutboundLimit;
+    static uint64_t nMaxOutboundTimeframe;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -393,8 +553,19 @@ public:
         return total;
     }
 
+    // Memory held by the buffers and relay state of the node; a message queued
+    // on several nodes at once is counted for each of them
+    size_t DynamicMemoryUsage();
+
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
+    // requires LOCK(cs_vRecvMsg)
+    // Where up to nBytes of the payload of the message being received can be read in place, with nBytes
+    // set to how many, or NULL if the next bytes are not payload: pass them to ReceiveMsgBytes instead
+    char* GetRecvDataBuffer(unsigned int& nBytes);
+    // requires LOCK(cs_vRecvMsg)
+    // Account for nBytes read in place, at the buffer GetRecvDataBuffer returned
+    void ReceivedMsgData(unsigned int nBytes);
 
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
@@ -419,6 +590,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -427,6 +599,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -441,7 +614,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
@@ -449,11 +622,21 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            if (filterInventoryKnown.contains(inv.hash))
+                return;
+            if (inv.type == MSG_TX)
+                setInventoryTxToSend.insert(inv.hash);
+            else
+                vInventoryBlockToSend.push_back(inv);
         }
     }
 
+    void PushBlockHash(const uint256& hash)
+    {
+        LOCK(cs_inventory);
+        vBlockHashesToAnnounce.push_back(hash);
+    }
+
     void AskFor(const CInv& inv);
 
     // TODO: Document the postcondition of this function.  Is cs_vSend locked?
@@ -467,6 +650,9 @@ public:
 
     void PushVersion();
 
+    /** Queue a message built with SerializeNetMessage, sharing its data. */
+    void PushMessage(const CSerializedNetMsg& msg);
+
 
     void PushMessage(const char* pszCommand)
     {
@@ -663,6 +849,25 @@ public:
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
 
+    //! set the max outbound target in bytes per timeframe, 0 for no limit
+    static void SetMaxOutboundTarget(uint64_t limit);
+    static uint64_t GetMaxOutboundTarget();
+
+    //! set the timeframe of the max outbound target, in seconds
+    static void SetMaxOutboundTimeframe(uint64_t timeframe);
+    static uint64_t GetMaxOutboundTimeframe();
+
+    //! check if the outbound target is reached
+    //! if historicalBlockServingLimit is set, the bytes kept back for relaying
+    //! the blocks still to come in the current timeframe count as already sent
+    static bool OutboundTargetReached(bool historicalBlockServingLimit);
+
+    //! bytes left in the current timeframe, 0 if there is no limit
+    static uint64_t GetOutboundTargetBytesLeft();
+
+    //! seconds left in the current timeframe, 0 if there is no limit
+    static uint64_t GetMaxOutboundTimeLeftInCycle();
+
     // resource deallocation on cleanup, called at node shutdown
     static void NetCleanup();
 
@@ -673,9 +878,10 @@ public:
 
 
 
-class CTransaction;
+/** Announce a transaction to the peers and keep it for those that ask for it in the next 15 minutes */
+void RelayTransaction(const std::shared_ptr<const CTransaction>& ptx);
+/** The same, with a copy of tx; pass the one of the mempool entry instead where there is one */
 void RelayTransaction(const CTransaction& tx);
-void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
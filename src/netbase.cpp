@@ -27,6 +27,7 @@
 #include <arpa/inet.h>
 #endif
 #include <fcntl.h>
+#include <poll.h>
 #endif
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
@@ -43,6 +44,12 @@ static proxyType nameProxy;
 static CCriticalSection cs_proxyInfos;
 int nConnectTimeout = DEFAULT_CONNECT_TIMEOUT;
 bool fNameLookup = false;
+int64_t nDNSCacheTTL = DEFAULT_DNS_CACHE_TTL;
+
+//! Names looked up, by the time their addresses expire
+static CCriticalSection cs_mapDNSCache;
+static std::map<std::string, std::pair<int64_t, std::vector<CNetAddr> > > mapDNSCache;
+static const size_t MAX_DNS_CACHE_SIZE = 1000;
 
 static const unsigned char pchIPv4[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
 
@@ -86,10 +93,28 @@ void SplitHostPort(std::string in, int &portOut, std::string &hostOut) {
         hostOut = in;
 }
 
-bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions, bool fAllowLookup)
+/** The addresses of an addrinfo list */
+static void GetAddrInfoAddresses(const struct addrinfo* aiRes, std::vector<CNetAddr>& vIP)
 {
-    vIP.clear();
+    for (const struct addrinfo* aiTrav = aiRes; aiTrav != NULL; aiTrav = aiTrav->ai_next)
+    {
+        if (aiTrav->ai_family == AF_INET)
+        {
+            assert(aiTrav->ai_addrlen >= sizeof(sockaddr_in));
+            vIP.push_back(CNetAddr(((struct sockaddr_in*)(aiTrav->ai_addr))->sin_addr));
+        }
+
+        if (aiTrav->ai_family == AF_INET6)
+        {
+            assert(aiTrav->ai_addrlen >= sizeof(sockaddr_in6));
+            vIP.push_back(CNetAddr(((struct sockaddr_in6*)(aiTrav->ai_addr))->sin6_addr));
+        }
+    }
+}
 
+/** Names that need no resolver: onion addresses and, where they are parsed here, IP literals */
+static bool LookupLiteral(const char *pszName, std::vector<CNetAddr>& vIP)
+{
     {
         CNetAddr addr;
         if (addr.SetSpecial(std::string(pszName))) {
@@ -119,6 +144,19 @@ bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsign
     }
 #endif
 #endif
+    return false;
+}
+
+/**
+ * Resolve the names, all at once where getaddrinfo_a is available. Names
+ * looked up through the resolver are cached for nDNSCacheTTL seconds, or
+ * a tenth of that if they did not resolve.
+ */
+static void ResolveNames(const std::vector<std::string>& vNames, std::vector<std::vector<CNetAddr> >& vIPs, bool fAllowLookup)
+{
+    vIPs.assign(vNames.size(), std::vector<CNetAddr>());
+    if (vNames.empty())
+        return;
 
     struct addrinfo aiHint;
     memset(&aiHint, 0, sizeof(struct addrinfo));
@@ -131,61 +169,126 @@ bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsign
     aiHint.ai_flags = fAllowLookup ? AI_ADDRCONFIG : AI_NUMERICHOST;
 #endif
 
-    struct addrinfo *aiRes = NULL;
 #ifdef HAVE_GETADDRINFO_A
-    struct gaicb gcb, *query = &gcb;
-    memset(query, 0, sizeof(struct gaicb));
-    gcb.ar_name = pszName;
-    gcb.ar_request = &aiHint;
-    int nErr = getaddrinfo_a(GAI_NOWAIT, &query, 1, NULL);
+    std::vector<struct gaicb> vRequests(vNames.size());
+    std::vector<struct gaicb*> vQueries(vNames.size());
+    for (unsigned int i = 0; i < vNames.size(); i++) {
+        memset(&vRequests[i], 0, sizeof(struct gaicb));
+        vRequests[i].ar_name = vNames[i].c_str();
+        vRequests[i].ar_request = &aiHint;
+        vQueries[i] = &vRequests[i];
+    }
+    int nErr = getaddrinfo_a(GAI_NOWAIT, &vQueries[0], vQueries.size(), NULL);
     if (nErr)
     {
-        LogPrint("net", "%s():%d - getaddrinfo_a() query failed at [%s], err=%s\n", __func__, __LINE__, pszName, gai_strerror(nErr));
-        return false;
+        LogPrint("net", "%s():%d - getaddrinfo_a() query failed at [%s], err=%s\n", __func__, __LINE__, vNames[0], gai_strerror(nErr));
+        return;
     }
 
-    do {
-        // Should set the timeout limit to a resonable value to avoid
-        // generating unnecessary checking call during the polling loop,
-        // while it can still response to stop request quick enough.
-        // 2 seconds looks fine in our situation.
+    // Wait for the requests still in progress, which are the ones left in vQueries.
+    // Should set the timeout limit to a resonable value to avoid
+    // generating unnecessary checking call during the polling loop,
+    // while it can still response to stop request quick enough.
+    // 2 seconds looks fine in our situation.
+    std::vector<int> vErr(vNames.size(), EAI_INPROGRESS);
+    while (true) {
+        bool fPending = false;
+        for (unsigned int i = 0; i < vQueries.size(); i++) {
+            if (vQueries[i] && (vErr[i] = gai_error(vQueries[i])) != EAI_INPROGRESS)
+                vQueries[i] = NULL;
+            fPending |= vQueries[i] != NULL;
+        }
+        if (!fPending)
+            break;
         struct timespec ts = { 2, 0 };
-        gai_suspend(&query, 1, &ts);
-        boost::this_thread::interruption_point();
+        gai_suspend(&vQueries[0], vQueries.size(), &ts);
+        try {
+            boost::this_thread::interruption_point();
+        } catch (const boost::thread_interrupted&) {
+            for (unsigned int i = 0; i < vQueries.size(); i++)
+                if (vQueries[i])
+                    gai_cancel(vQueries[i]);
+            throw;
+        }
+    }
+#endif
 
-        nErr = gai_error(query);
-        if (0 == nErr)
-            aiRes = query->ar_result;
-    } while (nErr == EAI_INPROGRESS);
+    std::vector<std::pair<std::string, std::vector<CNetAddr> > > vResolved;
+    for (unsigned int i = 0; i < vNames.size(); i++) {
+        struct addrinfo *aiRes = NULL;
+#ifdef HAVE_GETADDRINFO_A
+        int nErr = vErr[i];
+        if (nErr == 0)
+            aiRes = vRequests[i].ar_result;
 #else
-    int nErr = getaddrinfo(pszName, NULL, &aiHint, &aiRes);
+        int nErr = getaddrinfo(vNames[i].c_str(), NULL, &aiHint, &aiRes);
 #endif
-    if (nErr)
-    {
-        LogPrint("net", "%s():%d - getaddrinfo_a() response failed from [%s], err=%s\n", __func__, __LINE__, pszName, gai_strerror(nErr));
-        return false;
+        if (nErr)
+            LogPrint("net", "%s():%d - getaddrinfo_a() response failed from [%s], err=%s\n", __func__, __LINE__, vNames[i], gai_strerror(nErr));
+        else {
+            GetAddrInfoAddresses(aiRes, vIPs[i]);
+            freeaddrinfo(aiRes);
+        }
+        if (fAllowLookup)
+            vResolved.push_back(std::make_pair(vNames[i], vIPs[i]));
     }
 
-    struct addrinfo *aiTrav = aiRes;
-    while (aiTrav != NULL && (nMaxSolutions == 0 || vIP.size() < nMaxSolutions))
-    {
-        if (aiTrav->ai_family == AF_INET)
-        {
-            assert(aiTrav->ai_addrlen >= sizeof(sockaddr_in));
-            vIP.push_back(CNetAddr(((struct sockaddr_in*)(aiTrav->ai_addr))->sin_addr));
-        }
+    if (nDNSCacheTTL > 0 && !vResolved.empty()) {
+        int64_t nNow = GetTime();
+        LOCK(cs_mapDNSCache);
+        if (mapDNSCache.size() + vResolved.size() > MAX_DNS_CACHE_SIZE)
+            mapDNSCache.clear();
+        for (unsigned int i = 0; i < vResolved.size(); i++)
+            mapDNSCache[vResolved[i].first] = std::make_pair(nNow + (vResolved[i].second.empty() ? nDNSCacheTTL / 10 : nDNSCacheTTL), vResolved[i].second);
+    }
+}
 
-        if (aiTrav->ai_family == AF_INET6)
-        {
-            assert(aiTrav->ai_addrlen >= sizeof(sockaddr_in6));
-            vIP.push_back(CNetAddr(((struct sockaddr_in6*)(aiTrav->ai_addr))->sin6_addr));
-        }
+/** The cached addresses of a name, false if it is not cached or has expired */
+static bool LookupCached(const std::string& strName, std::vector<CNetAddr>& vIP)
+{
+    LOCK(cs_mapDNSCache);
+    std::map<std::string, std::pair<int64_t, std::vector<CNetAddr> > >::iterator it = mapDNSCache.find(strName);
+    if (it == mapDNSCache.end())
+        return false;
+    if (it->second.first <= GetTime()) {
+        mapDNSCache.erase(it);
+        return false;
+    }
+    vIP = it->second.second;
+    return true;
+}
 
-        aiTrav = aiTrav->ai_next;
+/** Look the names up, literals and cached names first, and the others at once */
+static void LookupInternMany(const std::vector<std::string>& vNames, std::vector<std::vector<CNetAddr> >& vIPs, unsigned int nMaxSolutions, bool fAllowLookup)
+{
+    vIPs.assign(vNames.size(), std::vector<CNetAddr>());
+    std::vector<std::string> vResolve;
+    std::vector<unsigned int> vResolvePos;
+    for (unsigned int i = 0; i < vNames.size(); i++) {
+        if (LookupLiteral(vNames[i].c_str(), vIPs[i]))
+            continue;
+        if (fAllowLookup && LookupCached(vNames[i], vIPs[i]))
+            continue;
+        vResolve.push_back(vNames[i]);
+        vResolvePos.push_back(i);
     }
 
-    freeaddrinfo(aiRes);
+    std::vector<std::vector<CNetAddr> > vResolved;
+    ResolveNames(vResolve, vResolved, fAllowLookup);
+    for (unsigned int i = 0; i < vResolve.size(); i++)
+        vIPs[vResolvePos[i]].swap(vResolved[i]);
 
+    if (nMaxSolutions > 0)
+        for (unsigned int i = 0; i < vIPs.size(); i++)
+            if (vIPs[i].size() > nMaxSolutions)
+                vIPs[i].resize(nMaxSolutions);
+}
+
+bool static LookupIntern(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions, bool fAllowLookup)
+{
+    std::vector<std::vector<CNetAddr> > vIPs;
+    LookupInternMany(std::vector<std::string>(1, std::string(pszName)), vIPs, nMaxSolutions, fAllowLookup);
+    vIP.swap(vIPs[0]);
     return (vIP.size() > 0);
 }
 
@@ -235,6 +338,21 @@ bool LookupNumeric(const char *pszName, CService& addr, int portDefault)
     return Lookup(pszName, addr, portDefault, false);
 }
 
+void LookupMany(const std::vector<std::string>& vNames, std::vector<std::vector<CService> >& vAddrs, int portDefault, bool fAllowLookup)
+{
+    std::vector<std::string> vHosts(vNames.size());
+    std::vector<int> vPorts(vNames.size(), portDefault);
+    for (unsigned int i = 0; i < vNames.size(); i++)
+        SplitHostPort(vNames[i], vPorts[i], vHosts[i]);
+
+    std::vector<std::vector<CNetAddr> > vIPs;
+    LookupInternMany(vHosts, vIPs, 0, fAllowLookup);
+    vAddrs.assign(vNames.size(), std::vector<CService>());
+    for (unsigned int i = 0; i < vNames.size(); i++)
+        for (unsigned int j = 0; j < vIPs[i].size(); j++)
+            vAddrs[i].push_back(CService(vIPs[i][j], vPorts[i]));
+}
+
 struct timeval MillisToTimeval(int64_t nTimeout)
 {
     struct timeval timeout;
@@ -243,6 +361,23 @@ struct timeval MillisToTimeval(int64_t nTimeout)
     return timeout;
 }
 
+int WaitForSocket(SOCKET hSocket, bool fWrite, int64_t nTimeout)
+{
+#ifdef WIN32
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(hSocket, &fdset);
+    return select(hSocket + 1, fWrite ? NULL : &fdset, fWrite ? &fdset : NULL, NULL, &timeout);
+#else
+    struct pollfd pfd;
+    pfd.fd = hSocket;
+    pfd.events = fWrite ? POLLOUT : POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, nTimeout);
+#endif
+}
+
 /**
  * Read bytes from socket. This will either read the full number of bytes requested
  * or return False on error or timeout.
@@ -277,14 +412,7 @@ bool static InterruptibleRecv(uint8_t* data, size_t len, int timeout, SOCKET& hS
         } else { // Other error or blocking
             int nErr = WSAGetLastError();
             if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
-                if (!IsSelectableSocket(hSocket)) {
-                    return false;
-                }
-                struct timeval tval = MillisToTimeval(std::min(endTime - curTime, maxWait));
-                fd_set fdset;
-                FD_ZERO(&fdset);
-                FD_SET(hSocket, &fdset);
-                int nRet = select(hSocket + 1, &fdset, NULL, NULL, &tval);
+                int nRet = WaitForSocket(hSocket, false, std::min(endTime - curTime, maxWait));
                 if (nRet == SOCKET_ERROR) {
                     return false;
                 }
@@ -478,11 +606,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
-            struct timeval timeout = MillisToTimeval(nTimeout);
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
+            int nRet = WaitForSocket(hSocket, true, nTimeout);
             if (nRet == 0)
             {
                 LogPrint("net", "connection to %s timeout\n", addrConnect.ToString());
@@ -491,7 +615,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
             }
             if (nRet == SOCKET_ERROR)
             {
-                LogPrintf("select() for %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
+                LogPrintf("waiting for the connection to %s failed: %s\n", addrConnect.ToString(), NetworkErrorString(WSAGetLastError()));
                 CloseSocket(hSocket);
                 return false;
             }
@@ -508,7 +632,7 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
             }
             if (nRet != 0)
             {
-                LogPrintf("connect() to %s failed after select(): %s\n", addrConnect.ToString(), NetworkErrorString(nRet));
+                LogPrintf("connect() to %s failed after waiting: %s\n", addrConnect.ToString(), NetworkErrorString(nRet));
                 CloseSocket(hSocket);
                 return false;
             }
@@ -18,9 +18,12 @@
 
 extern int nConnectTimeout;
 extern bool fNameLookup;
+extern int64_t nDNSCacheTTL;
 
 /** -timeout default */
 static const int DEFAULT_CONNECT_TIMEOUT = 5000;
+/** -dnscachettl default, seconds the addresses of a resolved name are reused for (getaddrinfo does not report record TTLs) */
+static const int64_t DEFAULT_DNS_CACHE_TTL = 300;
 
 #ifdef WIN32
 // In MSVC, this is defined as a macro, undefine it to prevent a compile and link error
@@ -195,6 +198,8 @@ bool LookupHost(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nM
 bool Lookup(const char *pszName, CService& addr, int portDefault = 0, bool fAllowLookup = true);
 bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault = 0, bool fAllowLookup = true, unsigned int nMaxSolutions = 0);
 bool LookupNumeric(const char *pszName, CService& addr, int portDefault = 0);
+/** Look up several "host[:port]" names at once, vAddrs[i] is empty for the names that did not resolve */
+void LookupMany(const std::vector<std::string>& vNames, std::vector<std::vector<CService> >& vAddrs, int portDefault = 0, bool fAllowLookup = true);
 bool ConnectSocket(const CService &addr, SOCKET& hSocketRet, int nTimeout, bool *outProxyConnectionFailed = 0);
 bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest, int portDefault, int nTimeout, bool *outProxyConnectionFailed = 0);
 /** Return readable error string for a network error code */
@@ -207,5 +212,11 @@ bool SetSocketNonBlocking(SOCKET& hSocket, bool fNonBlocking);
  * Convert milliseconds to a struct timeval for e.g. select.
  */
 struct timeval MillisToTimeval(int64_t nTimeout);
+/**
+ * Wait at most nTimeout milliseconds until a socket can be read, or written if
+ * fWrite. Returns 1 if it can, 0 on timeout and SOCKET_ERROR on error. Uses
+ * poll() where available, which is not limited to sockets below FD_SETSIZE.
+ */
+int WaitForSocket(SOCKET hSocket, bool fWrite, int64_t nTimeout);
 
 #endif // BITCOIN_NETBASE_H
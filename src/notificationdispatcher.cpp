@@ -0,0 +1,209 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notificationdispatcher.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+
+CNotificationDispatcher* pNotificationDispatcher = NULL;
+
+char GetMempoolEventLabel(MemPoolRemovalReason reason)
+{
+    switch (reason) {
+    case MPR_BLOCK:
+        return 'B';
+    case MPR_CONFLICT:
+        return 'C';
+    case MPR_EXPIRY:
+        return 'E';
+    case MPR_SIZELIMIT:
+        return 'S';
+    case MPR_REORG:
+        return 'R';
+    default:
+        return 'U';
+    }
+}
+
+CNotificationDispatcher::CNotificationDispatcher(const std::vector<CNotificationPublisher*>& vPublishersIn, size_t nMaxQueued) :
+    vPublishers(vPublishersIn), fRawBlocks(false), fRawTransactions(false), fMempoolEvents(false), fStop(false), fDropping(false)
+{
+    // Publishers that drop their raw notifiers later keep getting the payloads; they ignore them
+    for (CNotificationPublisher* publisher : vPublishers) {
+        fRawBlocks |= publisher->WantsRawBlocks();
+        fRawTransactions |= publisher->WantsRawTransactions();
+        fMempoolEvents |= publisher->WantsMempoolEvents();
+    }
+    stats.nMaxQueued = std::max(nMaxQueued, (size_t)1);
+    dispatcherThread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "notify",
+                                                 boost::function<void()>(boost::bind(&CNotificationDispatcher::ThreadDispatch, this))));
+    if (fMempoolEvents) {
+        mempool.NotifyEntryAdded.connect(boost::bind(&CNotificationDispatcher::MempoolEntryAdded, this, _1, _2));
+        mempool.NotifyEntryRemoved.connect(boost::bind(&CNotificationDispatcher::MempoolEntryRemoved, this, _1, _2, _3));
+    }
+}
+
+CNotificationDispatcher::~CNotificationDispatcher()
+{
+    if (fMempoolEvents) {
+        mempool.NotifyEntryAdded.disconnect(boost::bind(&CNotificationDispatcher::MempoolEntryAdded, this, _1, _2));
+        mempool.NotifyEntryRemoved.disconnect(boost::bind(&CNotificationDispatcher::MempoolEntryRemoved, this, _1, _2, _3));
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fStop = true;
+    }
+    condQueue.notify_all();
+    dispatcherThread.join();
+    if (!queue.empty())
+        LogPrintf("Notification dispatcher: discarded %u notifications at shutdown\n", queue.size());
+}
+
+void CNotificationDispatcher::Enqueue(CNotification& notification)
+{
+    if (queue.size() >= stats.nMaxQueued) {
+        if (!fDropping)
+            LogPrintf("Notification dispatcher: queue full (%u), dropping notifications until the publishers catch up\n", queue.size());
+        fDropping = true;
+        stats.nDropped++;
+        return;
+    }
+    fDropping = false;
+    queue.push_back(CNotification());
+    std::swap(queue.back(), notification);
+    stats.nPeakQueued = std::max(stats.nPeakQueued, queue.size());
+}
+
+void CNotificationDispatcher::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    CNotification notification;
+    notification.hash = tx.GetHash();
+    if (fRawTransactions) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+        notification.raw = std::make_shared<const std::string>(ss.begin(), ss.end());
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Enqueue(notification);
+    }
+    condQueue.notify_one();
+}
+
+void CNotificationDispatcher::SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock)
+{
+    std::vector<CNotification> vNotifications(vtx.size());
+    for (size_t i = 0; i < vtx.size(); i++) {
+        vNotifications[i].hash = vtx[i].GetHash();
+        if (fRawTransactions) {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << vtx[i];
+            vNotifications[i].raw = std::make_shared<const std::string>(ss.begin(), ss.end());
+        }
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        for (CNotification& notification : vNotifications)
+            Enqueue(notification);
+    }
+    condQueue.notify_one();
+}
+
+void CNotificationDispatcher::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    // The raw block is read by the dispatcher thread
+    CNotification notification;
+    notification.type = NOTIFY_BLOCK;
+    notification.hash = pindex->GetBlockHash();
+    notification.pindex = pindex;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Enqueue(notification);
+    }
+    condQueue.notify_one();
+}
+
+void CNotificationDispatcher::MempoolEntryAdded(const CTransaction& tx, uint64_t nSequence)
+{
+    CNotification notification;
+    notification.type = NOTIFY_MEMPOOL;
+    notification.hash = tx.GetHash();
+    notification.chMempoolEvent = 'A';
+    notification.nMempoolSequence = nSequence;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Enqueue(notification);
+    }
+    condQueue.notify_one();
+}
+
+void CNotificationDispatcher::MempoolEntryRemoved(const CTransaction& tx, MemPoolRemovalReason reason, uint64_t nSequence)
+{
+    CNotification notification;
+    notification.type = NOTIFY_MEMPOOL;
+    notification.hash = tx.GetHash();
+    notification.chMempoolEvent = GetMempoolEventLabel(reason);
+    notification.nMempoolSequence = nSequence;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Enqueue(notification);
+    }
+    condQueue.notify_one();
+}
+
+void CNotificationDispatcher::ThreadDispatch()
+{
+    std::vector<CNotification> vBatch;
+    while (true) {
+        vBatch.clear();
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (queue.empty() && !fStop)
+                condQueue.wait(lock);
+            if (fStop)
+                return;
+            while (!queue.empty() && vBatch.size() < MAX_NOTIFICATION_BATCH_SIZE) {
+                vBatch.push_back(CNotification());
+                std::swap(vBatch.back(), queue.front());
+                queue.pop_front();
+            }
+        }
+
+        // The block is copied as stored, without deserializing it; cs_main
+        // is only held for that, as the block could be pruned meanwhile
+        if (fRawBlocks) {
+            for (CNotification& notification : vBatch) {
+                if (notification.type != NOTIFY_BLOCK)
+                    continue;
+                std::string strBlock;
+                LOCK(cs_main);
+                if ((notification.pindex->nStatus & BLOCK_HAVE_DATA) &&
+                    ReadRawBlockFromDisk(strBlock, notification.pindex, Params().MessageStart()))
+                    notification.raw = std::make_shared<const std::string>(std::move(strBlock));
+            }
+        }
+
+        for (CNotificationPublisher* publisher : vPublishers)
+            publisher->Publish(vBatch);
+
+        boost::unique_lock<boost::mutex> lock(cs);
+        stats.nPublished += vBatch.size();
+        stats.nBatches++;
+    }
+}
+
+CNotificationStats CNotificationDispatcher::GetStats() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    CNotificationStats result = stats;
+    result.nQueued = queue.size();
+    return result;
+}
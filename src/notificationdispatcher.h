@@ -0,0 +1,142 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NOTIFICATIONDISPATCHER_H
+#define BITCOIN_NOTIFICATIONDISPATCHER_H
+
+#include "txmempool.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CBlockIndex;
+
+//! -notificationqueue default, in notifications
+static const unsigned int DEFAULT_NOTIFICATION_QUEUE_SIZE = 10000;
+//! Most notifications handed to the publishers at once
+static const unsigned int MAX_NOTIFICATION_BATCH_SIZE = 1000;
+
+enum NotificationType {
+    NOTIFY_TRANSACTION, //! A transaction was added to the mempool or connected
+    NOTIFY_BLOCK,       //! A new tip
+    NOTIFY_MEMPOOL,     //! A transaction entered or left the mempool, see chMempoolEvent
+};
+
+/**
+ * Events of the mempool sequence notifications: 'A' for an addition, and for
+ * a removal its reason: 'B' included in a block, 'C' conflicting with a
+ * block, 'E' expired, 'S' evicted for size, 'R' invalidated by a reorg,
+ * 'U' anything else.
+ */
+char GetMempoolEventLabel(MemPoolRemovalReason reason);
+
+/** A new tip, transaction or mempool change to publish, with payloads shared by all the publishers */
+struct CNotification
+{
+    NotificationType type;
+    uint256 hash;
+    //! The new tip, for block notifications
+    const CBlockIndex* pindex;
+    //! Network serialization of the block or transaction; NULL unless a
+    //! publisher wants it, or if the block could not be read
+    std::shared_ptr<const std::string> raw;
+    //! Mempool event label and mempool sequence number, for mempool notifications
+    char chMempoolEvent;
+    uint64_t nMempoolSequence;
+
+    CNotification() : type(NOTIFY_TRANSACTION), pindex(NULL), chMempoolEvent(0), nMempoolSequence(0) {}
+};
+
+/** Publisher of notifications, such as the ZMQ or AMQP notification interfaces */
+class CNotificationPublisher
+{
+public:
+    virtual ~CNotificationPublisher() {}
+
+    //! Whether the raw serialization of blocks, or of transactions, has to be provided
+    virtual bool WantsRawBlocks() const = 0;
+    virtual bool WantsRawTransactions() const = 0;
+    //! Whether the mempool sequence notifications have to be dispatched
+    virtual bool WantsMempoolEvents() const = 0;
+
+    //! Publish notifications, in order. Only called from the dispatcher thread.
+    virtual void Publish(const std::vector<CNotification>& vNotifications) = 0;
+};
+
+/** Counters of a CNotificationDispatcher */
+struct CNotificationStats
+{
+    //! Notifications waiting in the queue, and the most there ever were
+    size_t nQueued;
+    size_t nPeakQueued;
+    size_t nMaxQueued;
+    uint64_t nPublished;
+    uint64_t nBatches;
+    //! Notifications dropped because the queue was full
+    uint64_t nDropped;
+
+    CNotificationStats() : nQueued(0), nPeakQueued(0), nMaxQueued(0), nPublished(0), nBatches(0), nDropped(0) {}
+};
+
+/**
+ * Publishes block and transaction notifications from a thread of its own,
+ * so that slow publishers do not hold up validation.
+ *
+ * The validation and mempool signals only queue the notifications. The payloads are
+ * built once and shared by all the publishers: transactions are serialized
+ * when queued, blocks are copied as stored on disk by the dispatcher thread.
+ * The queue is bounded; while the publishers are behind by nMaxQueued
+ * notifications, new ones are dropped and counted rather than waited for.
+ */
+class CNotificationDispatcher : public CValidationInterface
+{
+private:
+    std::vector<CNotificationPublisher*> vPublishers;
+    bool fRawBlocks;
+    bool fRawTransactions;
+    bool fMempoolEvents;
+
+    mutable boost::mutex cs;
+    boost::condition_variable condQueue;
+    std::deque<CNotification> queue;
+    bool fStop;
+    bool fDropping;
+    CNotificationStats stats;
+
+    boost::thread dispatcherThread;
+
+    //! Queue a notification; cs must be held
+    void Enqueue(CNotification& notification);
+    void ThreadDispatch();
+
+protected:
+    // CValidationInterface
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+
+    // CTxMemPool signals, fired under mempool.cs so queued in sequence order
+    void MempoolEntryAdded(const CTransaction& tx, uint64_t nSequence);
+    void MempoolEntryRemoved(const CTransaction& tx, MemPoolRemovalReason reason, uint64_t nSequence);
+
+public:
+    //! Starts the dispatcher thread; the publishers must outlive the dispatcher
+    CNotificationDispatcher(const std::vector<CNotificationPublisher*>& vPublishersIn, size_t nMaxQueued);
+    //! Stops the dispatcher thread, discarding the notifications still queued
+    ~CNotificationDispatcher();
+
+    CNotificationStats GetStats() const;
+};
+
+extern CNotificationDispatcher* pNotificationDispatcher;
+
+#endif // BITCOIN_NOTIFICATIONDISPATCHER_H
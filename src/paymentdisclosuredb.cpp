@@ -9,6 +9,8 @@
 
 #include <boost/filesystem.hpp>
 
+#include <leveldb/write_batch.h>
+
 using namespace std;
 
 static boost::filesystem::path emptyPath;
@@ -43,6 +45,14 @@ PaymentDisclosureDB::PaymentDisclosureDB(const boost::filesystem::path& dbPath)
 }
 
 PaymentDisclosureDB::~PaymentDisclosureDB() {
+    if (writer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            stopping_ = true;
+        }
+        cond_.notify_all();
+        writer_.join();
+    }
     if (db != nullptr) {
         delete db;
     }
@@ -66,6 +76,89 @@ bool PaymentDisclosureDB::Put(const PaymentDisclosureKey& key, const PaymentDisc
     return true;
 }
 
+bool PaymentDisclosureDB::PutBatch(const std::vector<PaymentDisclosureKeyInfo>& entries)
+{
+    if (db == nullptr) {
+        return false;
+    }
+
+    std::map<std::string, PaymentDisclosureInfo> batch;
+    for (const PaymentDisclosureKeyInfo& entry : entries)
+        batch[entry.first.ToString()] = entry.second;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    WriteBatch(batch);
+    return true;
+}
+
+void PaymentDisclosureDB::WriteBatch(const std::map<std::string, PaymentDisclosureInfo>& entries)
+{
+    leveldb::WriteBatch batch;
+    for (const std::pair<const std::string, PaymentDisclosureInfo>& entry : entries) {
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(ssValue.GetSerializeSize(entry.second));
+        ssValue << entry.second;
+        batch.Put(entry.first, leveldb::Slice(&ssValue[0], ssValue.size()));
+    }
+    leveldb::Status status = db->Write(writeOptions, &batch);
+    HandleError(status);
+}
+
+bool PaymentDisclosureDB::PutAsync(const std::vector<PaymentDisclosureKeyInfo>& entries)
+{
+    if (db == nullptr) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (const PaymentDisclosureKeyInfo& entry : entries)
+            pending_[entry.first.ToString()] = entry.second;
+        // Started on first use, so that databases only written to directly have no thread
+        if (!writer_.joinable())
+            writer_ = std::thread(&PaymentDisclosureDB::ThreadWriter, this);
+    }
+    cond_.notify_all();
+    return true;
+}
+
+void PaymentDisclosureDB::ThreadWriter()
+{
+    RenameThread("horizen-pdisc");
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        cond_.wait(lock, [this]{ return stopping_ || !pending_.empty(); });
+        if (pending_.empty())
+            return;
+
+        // Get keeps finding the entries in writing_ until they are written,
+        // without waiting for the write
+        writing_.swap(pending_);
+        lock.unlock();
+        bool fWritten = true;
+        try {
+            WriteBatch(writing_);
+        } catch (const std::exception& e) {
+            LogPrintf("PaymentDisclosure: writing %u entries failed: %s\n", writing_.size(), e.what());
+            fWritten = false;
+        }
+        lock.lock();
+        if (!fWritten)
+            writeFailed_ = true;
+        writing_.clear();
+        cond_.notify_all();
+    }
+}
+
+bool PaymentDisclosureDB::Flush()
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    cond_.wait(lock, [this]{ return pending_.empty() && writing_.empty(); });
+    bool fGood = !writeFailed_;
+    writeFailed_ = false;
+    return fGood;
+}
+
 bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosureInfo& info)
 {
     if (db == nullptr) {
@@ -74,8 +167,18 @@ bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosure
 
     std::lock_guard<std::mutex> guard(lock_);
 
+    // What is queued is newer than what is being written, which is newer than what is written
+    std::string strKey = key.ToString();
+    for (const std::map<std::string, PaymentDisclosureInfo>* entries : {&pending_, &writing_}) {
+        std::map<std::string, PaymentDisclosureInfo>::const_iterator it = entries->find(strKey);
+        if (it != entries->end()) {
+            info = it->second;
+            return true;
+        }
+    }
+
     std::string strValue;
-    leveldb::Status status = db->Get(readOptions, key.ToString(), &strValue);
+    leveldb::Status status = db->Get(readOptions, strKey, &strValue);
     if (!status.ok()) {
         if (status.IsNotFound())
             return false;
@@ -91,3 +194,34 @@ bool PaymentDisclosureDB::Get(const PaymentDisclosureKey& key, PaymentDisclosure
     }
     return true;
 }
+
+bool PaymentDisclosureDB::ForEach(const std::string& prefix,
+                                  const std::function<bool(const std::string&, const PaymentDisclosureInfo&)>& f)
+{
+    if (db == nullptr) {
+        return false;
+    }
+
+    // The iterator reads a snapshot, the lock is not needed while it runs
+    std::unique_ptr<leveldb::Iterator> it(db->NewIterator(readOptions));
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        PaymentDisclosureInfo info;
+        try {
+            CDataStream ssValue(it->value().data(), it->value().data() + it->value().size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> info;
+        } catch (const std::exception&) {
+            LogPrintf("PaymentDisclosure: cannot read entry %s\n", it->key().ToString());
+            continue;
+        }
+        if (!f(it->key().ToString(), info))
+            break;
+    }
+    HandleError(it->status());
+    return true;
+}
+
+std::string PaymentDisclosureDB::KeyPrefix(const uint256& txid)
+{
+    // As JSOutPoint::ToString() puts it
+    return strprintf("JSOutPoint(%s, ", txid.ToString().substr(0,10));
+}
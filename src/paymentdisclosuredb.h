@@ -7,11 +7,16 @@
 
 #include "paymentdisclosure.h"
 
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
+#include <map>
 #include <string>
 #include <mutex>
 #include <future>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include <boost/optional.hpp>
 
@@ -27,6 +32,18 @@ protected:
     leveldb::WriteOptions writeOptions;
     mutable std::mutex lock_;
 
+    // Entries queued by PutAsync, by key, and those the writer thread is writing
+    std::map<std::string, PaymentDisclosureInfo> pending_;
+    std::map<std::string, PaymentDisclosureInfo> writing_;
+    std::condition_variable cond_;
+    std::thread writer_;
+    bool stopping_ = false;
+    // Whether a write of the writer thread failed since the last Flush
+    bool writeFailed_ = false;
+
+    void WriteBatch(const std::map<std::string, PaymentDisclosureInfo>& entries);
+    void ThreadWriter();
+
 public:
     static std::shared_ptr<PaymentDisclosureDB> sharedInstance();
 
@@ -35,7 +52,26 @@ public:
     ~PaymentDisclosureDB();
 
     bool Put(const PaymentDisclosureKey& key, const PaymentDisclosureInfo& info);
+    /** Write the entries in one batch */
+    bool PutBatch(const std::vector<PaymentDisclosureKeyInfo>& entries);
+    /**
+     * Queue the entries to be written in the background, batched with any
+     * others queued meanwhile. Get sees them at once.
+     */
+    bool PutAsync(const std::vector<PaymentDisclosureKeyInfo>& entries);
+    /** Wait for the queued entries to be written, false if any write failed since the last flush */
+    bool Flush();
     bool Get(const PaymentDisclosureKey& key, PaymentDisclosureInfo& info);
+    /**
+     * Call f with the key and the info of each entry written whose key starts
+     * with prefix, in key order, until f returns false. The keys of the
+     * joinsplits of a transaction share the prefix KeyPrefix(txid); as the
+     * keys keep only the first 10 hex digits of the txid, other transactions
+     * may share it too. Entries still queued are not visited.
+     */
+    bool ForEach(const std::string& prefix,
+                 const std::function<bool(const std::string&, const PaymentDisclosureInfo&)>& f);
+    static std::string KeyPrefix(const uint256& txid);
 };
 
 
@@ -11,6 +11,8 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay, std::string _dataTypeString)
 {
@@ -20,10 +22,6 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
     buckets.insert(buckets.end(), defaultBuckets.begin(), defaultBuckets.end());
     buckets.push_back(std::numeric_limits<double>::infinity());
 
-    for (unsigned int i = 0; i < buckets.size(); i++) {
-        bucketMap[buckets[i]] = i;
-    }
-
     confAvg.resize(maxConfirms);
     curBlockConf.resize(maxConfirms);
     unconfTxs.resize(maxConfirms);
@@ -55,9 +53,10 @@ void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 
 unsigned int TxConfirmStats::FindBucketIndex(double val)
 {
-    auto it = bucketMap.lower_bound(val);
-    assert(it != bucketMap.end());
-    return it->second;
+    // A binary search of the sorted bounds, without the pointer chasing of a map
+    std::vector<double>::const_iterator it = std::lower_bound(buckets.begin(), buckets.end(), val);
+    assert(it != buckets.end());
+    return it - buckets.begin();
 }
 
 void TxConfirmStats::Record(int blocksToConfirm, double val)
@@ -120,7 +119,8 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
         curFarBucket = bucket;
         nConf += confAvg[confTarget - 1][bucket];
         totalNum += txCtAvg[bucket];
-        for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
+        // No transaction has waited for longer than there are blocks
+        for (unsigned int confct = confTarget; confct < GetMaxConfirms() && confct <= nBlockHeight; confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
         // If we have enough transaction data points in this range of buckets,
@@ -230,7 +230,6 @@ void TxConfirmStats::Read(CAutoFile& filein)
     avg = fileAvg;
     confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
 
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
@@ -247,9 +246,6 @@ void TxConfirmStats::Read(CAutoFile& filein)
     }
     oldUnconfTxs.resize(buckets.size());
 
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
-
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
 }
@@ -303,13 +299,21 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
     unsigned int entryHeight = pos->second.blockHeight;
     unsigned int bucketIndex = pos->second.bucketIndex;
 
-    if (stats != NULL)
+    if (stats != NULL) {
         stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+        if (stats == &feeStats) {
+            shortFeeStats.removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+            longFeeStats.removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+        }
+        // The estimates count the transactions that have waited a block or more
+        if (entryHeight < nBestSeenHeight)
+            fEstimatesStale = true;
+    }
     mapMemPoolTxs.erase(hash);
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
-    : nBestSeenHeight(0)
+    : nBestSeenHeight(0), fEstimatesStale(true)
 {
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
     std::vector<double> vfeelist;
@@ -317,6 +321,8 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
         vfeelist.push_back(bucketBoundary);
     }
     feeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY, "FeeRate");
+    shortFeeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, SHORT_DECAY, "FeeRate (short)");
+    longFeeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, LONG_DECAY, "FeeRate (long)");
 
     minTrackedPriority = AllowFreeThreshold() < MIN_PRIORITY ? MIN_PRIORITY : AllowFreeThreshold();
     std::vector<double> vprilist;
@@ -396,11 +402,18 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     else if (isFeeDataPoint(feeRate, curPri)) {
         mapMemPoolTxs[hash].stats = &feeStats;
         mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        shortFeeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        longFeeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
     }
     else {
         LogPrint("estimatefee", "not adding");
     }
     LogPrint("estimatefee", "\n");
+
+    // A transaction entering at the best height seen is not counted by any
+    // estimate before the next block
+    if (mapMemPoolTxs[hash].stats != NULL && txHeight != nBestSeenHeight)
+        fEstimatesStale = true;
 }
 
 void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry& entry)
@@ -437,6 +450,8 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
         feeStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+        shortFeeStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+        longFeeStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
     }
 }
 
@@ -452,6 +467,7 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
         return;
     }
     nBestSeenHeight = nBlockHeight;
+    fEstimatesStale = true;
 
     // Only want to be updating estimates when our blockchain is synced,
     // otherwise we'll miscalculate how many blocks its taking to get included.
@@ -484,6 +500,8 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     // Clear the current block states
     feeStats.ClearCurrent(nBlockHeight);
+    shortFeeStats.ClearCurrent(nBlockHeight);
+    longFeeStats.ClearCurrent(nBlockHeight);
     priStats.ClearCurrent(nBlockHeight);
 
     // Repopulate the current block states
@@ -492,19 +510,51 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     // Update all exponential averages with the current block states
     feeStats.UpdateMovingAverages();
+    shortFeeStats.UpdateMovingAverages();
+    longFeeStats.UpdateMovingAverages();
     priStats.UpdateMovingAverages();
 
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
              entries.size(), mapMemPoolTxs.size());
 }
 
-CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
+TxConfirmStats& CBlockPolicyEstimator::GetFeeStats(FeeEstimateHorizon horizon)
+{
+    switch (horizon) {
+    case SHORT_HORIZON:
+        return shortFeeStats;
+    case LONG_HORIZON:
+        return longFeeStats;
+    default:
+        return feeStats;
+    }
+}
+
+const std::vector<double>& CBlockPolicyEstimator::GetEstimates(TxConfirmStats& stats, std::vector<double>& vEstimates,
+                                                               double sufficientTxVal)
+{
+    if (fEstimatesStale) {
+        for (unsigned int i = 0; i < NUM_FEE_ESTIMATE_HORIZONS; i++)
+            feeEstimates[i].clear();
+        priEstimates.clear();
+        fEstimatesStale = false;
+    }
+    if (vEstimates.empty()) {
+        for (unsigned int confTarget = 1; confTarget <= stats.GetMaxConfirms(); confTarget++)
+            vEstimates.push_back(stats.EstimateMedianVal(confTarget, sufficientTxVal, MIN_SUCCESS_PCT, true, nBestSeenHeight));
+    }
+    return vEstimates;
+}
+
+CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget, FeeEstimateHorizon horizon)
 {
+    TxConfirmStats& stats = GetFeeStats(horizon);
+
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > stats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = GetEstimates(stats, feeEstimates[horizon], SUFFICIENT_FEETXS)[confTarget - 1];
 
     if (median < 0)
         return CFeeRate(0);
@@ -518,7 +568,7 @@ double CBlockPolicyEstimator::estimatePriority(int confTarget)
     if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
         return -1;
 
-    return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    return GetEstimates(priStats, priEstimates, SUFFICIENT_PRITXS)[confTarget - 1];
 }
 
 void CBlockPolicyEstimator::Write(CAutoFile& fileout)
@@ -526,6 +576,9 @@ void CBlockPolicyEstimator::Write(CAutoFile& fileout)
     fileout << nBestSeenHeight;
     feeStats.Write(fileout);
     priStats.Write(fileout);
+    // After what older versions read, which they leave alone
+    shortFeeStats.Write(fileout);
+    longFeeStats.Write(fileout);
 }
 
 void CBlockPolicyEstimator::Read(CAutoFile& filein)
@@ -534,5 +587,22 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     filein >> nFileBestSeenHeight;
     feeStats.Read(filein);
     priStats.Read(filein);
+    try {
+        shortFeeStats.Read(filein);
+        longFeeStats.Read(filein);
+    } catch (const std::ios_base::failure&) {
+        // Written by a version that kept no short and long horizons
+    }
+    // The horizons must share the buckets of feeStats, else they start over
+    std::vector<double> vfeelist(feeStats.GetBuckets().begin(), feeStats.GetBuckets().end() - 1);
+    if (shortFeeStats.GetBuckets() != feeStats.GetBuckets()) {
+        shortFeeStats = TxConfirmStats();
+        shortFeeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, SHORT_DECAY, "FeeRate (short)");
+    }
+    if (longFeeStats.GetBuckets() != feeStats.GetBuckets()) {
+        longFeeStats = TxConfirmStats();
+        longFeeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, LONG_DECAY, "FeeRate (long)");
+    }
     nBestSeenHeight = nFileBestSeenHeight;
+    fEstimatesStale = true;
 }
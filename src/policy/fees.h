@@ -68,6 +68,21 @@ class CTxMemPoolEntry;
 
 /** Decay of .998 is a half-life of 346 blocks or about 2.4 days */
 static const double DEFAULT_DECAY = .998;
+/** Decay of .962 is a half-life of 18 blocks, for estimates that follow the last hour or so */
+static const double SHORT_DECAY = .962;
+/** Decay of .9998 is a half-life of 3465 blocks, for estimates that ride out bursts of days */
+static const double LONG_DECAY = .9998;
+
+/**
+ * How far back a fee estimate looks. Each horizon keeps fee stats of its own,
+ * decaying at SHORT_DECAY, DEFAULT_DECAY and LONG_DECAY respectively.
+ */
+enum FeeEstimateHorizon {
+    SHORT_HORIZON,
+    MEDIUM_HORIZON,
+    LONG_HORIZON
+};
+static const unsigned int NUM_FEE_ESTIMATE_HORIZONS = 3;
 
 /**
  * We will instantiate two instances of this class, one to track transactions
@@ -84,8 +99,7 @@ class TxConfirmStats
 {
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
-    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive), ascending
 
     // For each bucket X:
     // Count the total # of txs in each bucket
@@ -174,6 +188,9 @@ public:
     /** Return the max number of confirms we're tracking */
     unsigned int GetMaxConfirms() { return confAvg.size(); }
 
+    /** Return the upper bounds of the buckets, the last one infinite */
+    const std::vector<double>& GetBuckets() const { return buckets; }
+
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout);
 
@@ -246,8 +263,8 @@ public:
     /** Is this transaction likely included in a block because of its priority?*/
     bool isPriDataPoint(const CFeeRate &fee, double pri);
 
-    /** Return a fee estimate */
-    CFeeRate estimateFee(int confTarget);
+    /** Return a fee estimate, from the stats of the given horizon */
+    CFeeRate estimateFee(int confTarget, FeeEstimateHorizon horizon = MEDIUM_HORIZON);
 
     /** Return a priority estimate */
     double estimatePriority(int confTarget);
@@ -273,11 +290,32 @@ private:
     // map of txids to information about that transaction
     std::map<uint256, TxStatsInfo> mapMemPoolTxs;
 
-    /** Classes to track historical data on transaction confirmations */
+    /**
+     * Classes to track historical data on transaction confirmations. The fee
+     * stats of the short and long horizons track the same transactions, in
+     * the same buckets, as feeStats.
+     */
     TxConfirmStats feeStats, priStats;
+    TxConfirmStats shortFeeStats, longFeeStats;
 
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /**
+     * The answers of estimateFee by horizon and of estimatePriority, for
+     * every target, -1 where there is none. A table is worked out whole on
+     * the first call after the stats change: once per block, and otherwise
+     * only when the mempool transactions that have waited a block or more
+     * change.
+     */
+    std::vector<double> feeEstimates[NUM_FEE_ESTIMATE_HORIZONS];
+    std::vector<double> priEstimates;
+    bool fEstimatesStale;
+
+    TxConfirmStats& GetFeeStats(FeeEstimateHorizon horizon);
+    /** Return the estimates table of stats, filling it if the stats changed since */
+    const std::vector<double>& GetEstimates(TxConfirmStats& stats, std::vector<double>& vEstimates,
+                                            double sufficientTxVal);
 };
 #endif /*BITCOIN_POLICYESTIMATOR_H */
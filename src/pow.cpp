@@ -26,6 +26,19 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     if (pindexLast == NULL)
         return nProofOfWorkLimit;
 
+    // The block before the averaging window is found over the skip list,
+    // and the sum of the window is that of the chain up to its end minus
+    // that of the chain up to its start
+    if (pindexLast->fDifficultyCache) {
+        if (pindexLast->nHeight < params.nPowAveragingWindow)
+            return nProofOfWorkLimit;
+        const CBlockIndex* pindexFirst = pindexLast->GetAncestor(pindexLast->nHeight - params.nPowAveragingWindow);
+        if (pindexFirst->fDifficultyCache) {
+            arith_uint256 bnAvg {(pindexLast->nChainTargetSum - pindexFirst->nChainTargetSum) / params.nPowAveragingWindow};
+            return CalculateNextWorkRequired(bnAvg, pindexLast->GetMedianTimePast(), pindexFirst->GetMedianTimePast(), params);
+        }
+    }
+
     // Find the first block in the averaging interval
     const CBlockIndex* pindexFirst = pindexLast;
     arith_uint256 bnTot {0};
@@ -84,8 +97,9 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& param
     unsigned int n = params.EquihashN();
     unsigned int k = params.EquihashK();
 
-    // Hash state
-    crypto_generichash_blake2b_state state;
+    // Hash state. CBLAKE2b generates all the hashes of the solution in one
+    // batch, in parallel if the CPU supports it.
+    CBLAKE2b state;
     EhInitialiseState(n, k, state);
 
     // I = the block header minus nonce and solution.
@@ -96,7 +110,7 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& param
     ss << pblock->nNonce;
 
     // H(I||V||...
-    crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+    state.Write((unsigned char*)&ss[0], ss.size());
 
     bool isValid;
     EhIsValidSolution(n, k, state, pblock->nSolution, isValid);
@@ -199,6 +213,39 @@ arith_uint256 GetBlockProof(const CBlockIndex& block)
     return (~bnTarget / (bnTarget + 1)) + 1;
 }
 
+int64_t GetNetworkSolPS(const CBlockIndex* pindex, int lookup, const Consensus::Params& params)
+{
+    if (pindex == NULL || !pindex->nHeight)
+        return 0;
+
+    // If lookup is nonpositive, then use difficulty averaging window.
+    if (lookup <= 0)
+        lookup = params.nPowAveragingWindow;
+
+    // If lookup is larger than chain, then set it to chain length.
+    if (lookup > pindex->nHeight)
+        lookup = pindex->nHeight;
+
+    const CBlockIndex *pb0 = pindex;
+    int64_t minTime = pb0->GetBlockTime();
+    int64_t maxTime = minTime;
+    for (int i = 0; i < lookup; i++) {
+        pb0 = pb0->pprev;
+        int64_t time = pb0->GetBlockTime();
+        minTime = std::min(time, minTime);
+        maxTime = std::max(time, maxTime);
+    }
+
+    // In case there's a situation where minTime == maxTime, we don't want a divide by zero exception.
+    if (minTime == maxTime)
+        return 0;
+
+    arith_uint256 workDiff = pindex->nChainWork - pb0->nChainWork;
+    int64_t timeDiff = maxTime - minTime;
+
+    return (int64_t)(workDiff.getdouble() / timeDiff);
+}
+
 int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& from, const CBlockIndex& tip, const Consensus::Params& params)
 {
     arith_uint256 r;
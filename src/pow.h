@@ -33,6 +33,16 @@ void generateEquihash(CBlock& block);
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params&);
 arith_uint256 GetBlockProof(const CBlockIndex& block);
 
+/** Default number of blocks the network solution rate is estimated over */
+static const int DEFAULT_NETWORK_SOLPS_LOOKUP = 120;
+
+/**
+ * Estimate of the network solutions per second from the work and times of the
+ * lookup blocks up to pindex, or of the difficulty averaging window if lookup
+ * is nonpositive; 0 if there are no such blocks or their times do not differ.
+ */
+int64_t GetNetworkSolPS(const CBlockIndex* pindex, int lookup, const Consensus::Params&);
+
 /** Return the time it would take to redo the work difference between from and to, assuming the current hashrate corresponds to the difficulty at tip, in seconds. */
 int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& from, const CBlockIndex& tip, const Consensus::Params&);
 
@@ -9,6 +9,7 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 
 uint256 CBlockHeader::GetHash() const
 {
@@ -60,15 +61,17 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
+        }
+        // The pairs of a level are adjacent, hash them all in one batch
+        int nPairs = nSize / 2;
+        vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[j+nSize].begin(), vMerkleTree[j].begin(), nPairs);
+        if (nSize % 2 == 1) {
+            const uint256& last = vMerkleTree[j+nSize-1];
+            vMerkleTree[j+nSize+nPairs] = Hash(BEGIN(last), END(last), BEGIN(last), END(last));
         }
         j += nSize;
     }
@@ -78,6 +81,26 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     return (vMerkleTree.empty() ? uint256() : vMerkleTree.back());
 }
 
+uint256 CBlock::UpdateMerkleTreeCoinbase() const
+{
+    // The tree must be the one of these transactions
+    size_t nNodes = 0;
+    for (size_t nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        nNodes += nSize;
+    if (vtx.empty() || vMerkleTree.size() != nNodes + 1)
+        return BuildMerkleTree();
+
+    vMerkleTree[0] = vtx[0].GetHash();
+    int j = 0;
+    for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        vMerkleTree[j+nSize] = Hash(BEGIN(vMerkleTree[j]),  END(vMerkleTree[j]),
+                                    BEGIN(vMerkleTree[j+1]), END(vMerkleTree[j+1]));
+        j += nSize;
+    }
+    return vMerkleTree.back();
+}
+
 std::vector<uint256> CBlock::GetMerkleBranch(int nIndex) const
 {
     if (vMerkleTree.empty())
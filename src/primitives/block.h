@@ -85,6 +85,12 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    // set once the context-free checks, respectively the JoinSplit proof
+    // verification, have passed for this block
+    mutable bool fChecked;
+    mutable bool fProofsChecked;
+    // set when the scripts of the transactions passed on top of hashPrevBlock
+    mutable bool fScriptsChecked;
 
     CBlock()
     {
@@ -110,6 +116,9 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fChecked = false;
+        fProofsChecked = false;
+        fScriptsChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -132,6 +141,10 @@ public:
     // merkle root).
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
+    // Recompute the merkle root when only the coinbase changed since the
+    // last BuildMerkleTree, rehashing just the leftmost path of the tree.
+    uint256 UpdateMerkleTreeCoinbase() const;
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
     static uint256 CheckMerkleBranch(uint256 hash, const std::vector<uint256>& vMerkleBranch, int nIndex);
     std::string ToString() const;
@@ -229,12 +229,40 @@ uint256 CMutableTransaction::GetHash() const
     return SerializeHash(*this);
 }
 
+namespace {
+/** A CHashWriter that also counts the bytes written to it. */
+class CSizingHashWriter : public CHashWriter
+{
+private:
+    size_t nBytes;
+
+public:
+    CSizingHashWriter(int nTypeIn, int nVersionIn) : CHashWriter(nTypeIn, nVersionIn), nBytes(0) {}
+
+    CSizingHashWriter& write(const char *pch, size_t size) {
+        nBytes += size;
+        CHashWriter::write(pch, size);
+        return (*this);
+    }
+
+    size_t size() const { return nBytes; }
+};
+}
+
 void CTransaction::UpdateHash() const
 {
-    *const_cast<uint256*>(&hash) = SerializeHash(*this);
+    // Measure the size in the same pass, JoinSplit proofs make walking the tx twice costly
+    CSizingHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ::Serialize(ss, *this, ss.GetType(), ss.GetVersion());
+    *const_cast<uint256*>(&hash) = ss.GetHash();
+    *const_cast<unsigned int*>(&nTotalSize) = ss.size();
 }
 
-CTransaction::CTransaction() : nVersion(TRANSPARENT_TX_VERSION), vin(), vout(), nLockTime(0), vjoinsplit(), joinSplitPubKey(), joinSplitSig() { }
+CTransaction::CTransaction() : nVersion(TRANSPARENT_TX_VERSION), vin(), vout(), nLockTime(0), vjoinsplit(), joinSplitPubKey(), joinSplitSig()
+{
+    // The hash of the null transaction stays null
+    *const_cast<unsigned int*>(&nTotalSize) = ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION);
+}
 
 CTransaction::CTransaction(const CMutableTransaction &tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), vjoinsplit(tx.vjoinsplit),
                                                             joinSplitPubKey(tx.joinSplitPubKey), joinSplitSig(tx.joinSplitSig)
@@ -251,6 +279,7 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<uint256*>(&joinSplitPubKey) = tx.joinSplitPubKey;
     *const_cast<joinsplit_sig_t*>(&joinSplitSig) = tx.joinSplitSig;
     *const_cast<uint256*>(&hash) = tx.hash;
+    *const_cast<unsigned int*>(&nTotalSize) = tx.nTotalSize;
     return *this;
 }
 
@@ -306,7 +335,7 @@ unsigned int CTransaction::CalculateModifiedSize(unsigned int nTxSize) const
     // Providing any more cleanup incentive than making additional inputs free would
     // risk encouraging people to create junk outputs to redeem later.
     if (nTxSize == 0)
-        nTxSize = ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION);
+        nTxSize = GetTotalSize();
     for (std::vector<CTxIn>::const_iterator it(vin.begin()); it != vin.end(); ++it)
     {
         unsigned int offset = 41U + std::min(110U, (unsigned int)it->scriptSig.size());
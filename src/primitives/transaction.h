@@ -184,10 +184,16 @@ public:
     // Returns the calculated h_sig
     uint256 h_sig(ZCJoinSplit& params, const uint256& joinSplitPubKey) const;
 
+    // The serialized size of all but the proof, whose size is fixed by its kind
+    static constexpr size_t SERIALIZED_SIZE_WITHOUT_PROOF =
+        2 * sizeof(CAmount) +
+        (3 + 2 * ZC_NUM_JS_INPUTS + ZC_NUM_JS_OUTPUTS) * sizeof(uint256) +
+        ZC_NUM_JS_OUTPUTS * sizeof(ZCNoteEncryption::Ciphertext);
+
     size_t GetSerializeSize(int nType, int nVersion, int nTxVersion) const {
 		CSizeComputer s(nType, nVersion);
 		auto os = WithTxVersion(&s, nTxVersion);
-		NCONST_PTR(this)->SerializationOp(os, CSerActionSerialize(), nType, nVersion);
+		Serialize(os, nType, nVersion);
 		return s.size();
 	}
 
@@ -196,6 +202,18 @@ public:
 		NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize(), nType, nVersion);
 	}
 
+	// Sizing needs no walk over the fields when the proof is of the kind the
+	// transaction version calls for, otherwise the walk throws as serializing does
+	void Serialize(OverrideStreamTx<CSizeComputer>& s, int nType, int nVersion) const {
+		const int txVersion = s.GetTxVersion();
+		bool useGroth = (txVersion == GROTH_TX_VERSION);
+		bool isGroth = (boost::get<libzcash::GrothProof>(&proof) != nullptr);
+		if ((txVersion >= TRANSPARENT_TX_VERSION || useGroth) && useGroth == isGroth)
+			s.write(NULL, SERIALIZED_SIZE_WITHOUT_PROOF + (useGroth ? libzcash::GROTH_PROOF_SIZE : libzcash::PHGR_PROOF_SIZE));
+		else
+			NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize(), nType, nVersion);
+	}
+
 	template<typename OverrideStreamTx>
 	void Unserialize(OverrideStreamTx& s, int nType, int nVersion) {
 		SerializationOp(s, CSerActionUnserialize(), nType, nVersion);
@@ -424,6 +442,8 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
+    /** Memory only: serialized size, measured while hashing. */
+    const unsigned int nTotalSize = 0;
     void UpdateHash() const;
 
 public:
@@ -488,6 +508,11 @@ public:
         return hash;
     }
 
+    /** Serialized size, the same as ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) without walking the tx. */
+    unsigned int GetTotalSize() const {
+        return nTotalSize;
+    }
+
     // Return sum of txouts.
     CAmount GetValueOut() const;
     // GetValueIn() is a method on CCoinsViewCache, because
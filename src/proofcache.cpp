@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "proofcache.h"
+
+#include "cuckoocache.h"
+#include "hash.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+class CProofCache
+{
+private:
+    uint256 nonce;
+    //! Entries are nonced hashes like the signature cache ones, so they can share its hasher
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_proofcache;
+
+public:
+    CProofCache() : nonce(GetRandHash()) {}
+
+    uint256 ComputeEntry(const JSDescription& joinsplit, const uint256& joinSplitPubKey) const
+    {
+        // Everything the proof is checked against except the ciphertexts and
+        // the ephemeral key, which are not part of its statement
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << joinSplitPubKey;
+        ss << joinsplit.vpub_old << joinsplit.vpub_new << joinsplit.anchor;
+        ss << joinsplit.nullifiers << joinsplit.commitments << joinsplit.randomSeed << joinsplit.macs;
+        const bool fGroth = joinsplit.proof.which() == 1;
+        ss << fGroth;
+        ::SerReadWriteSproutProof(ss, joinsplit.proof, fGroth, CSerActionSerialize(), SER_GETHASH, 0);
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        return setValid.setup_bytes(n);
+    }
+};
+
+//! Sized by InitProofCache before any thread uses it
+CProofCache proofCache;
+
+}
+
+void InitProofCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE)), MAX_MAX_PROOF_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = proofCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for JoinSplit proof cache, able to store %zu elements\n",
+            (nElems * sizeof(uint256)) >> 20, nMaxCacheSize >> 20, nElems);
+}
+
+bool IsJoinSplitProofCached(const JSDescription& joinsplit, const uint256& joinSplitPubKey)
+{
+    return proofCache.Get(proofCache.ComputeEntry(joinsplit, joinSplitPubKey));
+}
+
+void CacheJoinSplitProofs(const CTransaction& tx)
+{
+    BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit)
+        proofCache.Set(proofCache.ComputeEntry(joinsplit, tx.joinSplitPubKey));
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PROOFCACHE_H
+#define BITCOIN_PROOFCACHE_H
+
+#include <stdint.h>
+
+class CTransaction;
+class JSDescription;
+class uint256;
+
+//! -maxproofcachesize default in MiB; at 32 bytes per entry that is about 130000 JoinSplits
+static const unsigned int DEFAULT_MAX_PROOF_CACHE_SIZE = 4;
+//! Largest -maxproofcachesize accepted, in MiB
+static const int64_t MAX_MAX_PROOF_CACHE_SIZE = 16384;
+
+/**
+ * Cache of JoinSplit proofs known to verify, so that the proofs of a
+ * transaction accepted to the mempool are not verified again when it is
+ * mined. Entries are a salted hash of the JoinSplit public key and of all the
+ * JoinSplit fields the proof statement depends on.
+ */
+
+/** Size the proof cache from -maxproofcachesize, must be called before any transaction is checked. */
+void InitProofCache();
+
+/** Whether the proof of joinsplit was verified before for this public key. */
+bool IsJoinSplitProofCached(const JSDescription& joinsplit, const uint256& joinSplitPubKey);
+
+/** Remember that all JoinSplit proofs of tx verify; only call once they were actually verified. */
+void CacheJoinSplitProofs(const CTransaction& tx);
+
+#endif // BITCOIN_PROOFCACHE_H
@@ -12,6 +12,37 @@ namespace
 {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context* secp256k1_context_verify = NULL;
+
+/**
+ * Public keys parsed by the signature checks of this thread, by the last byte
+ * of their x coordinate. The script check threads take the inputs of a block
+ * in runs, in order, and the inputs of a transaction are often signed by the
+ * same key, as when a pool pays out from its coinbase outputs, so the key is
+ * not decompressed again for each of them.
+ */
+const unsigned int VERIFY_PUBKEY_CACHE_SIZE = 16;
+
+struct CParsedPubKey
+{
+    CPubKey key;
+    secp256k1_pubkey parsed;
+};
+
+thread_local CParsedPubKey verifyPubKeyCache[VERIFY_PUBKEY_CACHE_SIZE];
+
+bool ParseVerifyPubKey(const CPubKey& key, secp256k1_pubkey& parsed)
+{
+    CParsedPubKey& entry = verifyPubKeyCache[key[COMPRESSED_PUBLIC_KEY_SIZE - 1] % VERIFY_PUBKEY_CACHE_SIZE];
+    if (entry.key == key) {
+        parsed = entry.parsed;
+        return true;
+    }
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &parsed, key.begin(), key.size()))
+        return false;
+    entry.key = key;
+    entry.parsed = parsed;
+    return true;
+}
 }
 
 
@@ -20,7 +51,7 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
         return false;
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+    if (!ParseVerifyPubKey(*this, pubkey)) {
         return false;
     }
     if (vchSig.size() == 0) {
@@ -22,6 +22,11 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const long MAX_REST_HEADERS_RESULTS = 2000;
+static const long MAX_REST_BLOCKHASHES_RESULTS = 2000;
+static const long MAX_REST_BLOCKS_RESULTS = 500;
+//! A block range reply stops early, after a whole block, once it is this large
+static const size_t MAX_REST_BLOCKS_BYTES = 32 * 1000 * 1000;
 
 enum RetFormat {
     RF_UNDEF,
@@ -56,8 +61,10 @@ struct CCoin {
     }
 };
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+extern bool TxToJSONFromCache(const uint256& txid, bool fHex, UniValue& entry);
+extern void TxToJSONAndCache(const CTransaction& tx, const std::string& strHex, const uint256& hashBlock, bool fHex, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern bool blockToJSONCached(const CBlockIndex* blockindex, bool txDetails, UniValue& result);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
@@ -129,7 +136,7 @@ static bool rest_headers(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
 
     long count = strtol(path[0].c_str(), NULL, 10);
-    if (count < 1 || count > 2000)
+    if (count < 1 || count > MAX_REST_HEADERS_RESULTS)
         return RESTERR(req, HTTP_BAD_REQUEST, "Header count out of range: " + path[0]);
 
     string hashStr = path[1];
@@ -211,6 +218,14 @@ static bool rest_block(HTTPRequest* req,
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
+        UniValue objBlock;
+        if (rf == RF_JSON && blockToJSONCached(pblockindex, showTxDetails, objBlock)) {
+            string strJSON = objBlock.write() + "\n";
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strJSON);
+            return true;
+        }
+
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
@@ -237,7 +252,11 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
+        UniValue objBlock;
+        {
+            LOCK(cs_main);
+            objBlock = blockToJSON(block, pblockindex, showTxDetails);
+        }
         string strJSON = objBlock.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
@@ -253,6 +272,126 @@ static bool rest_block(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Parse "<height>/<count>" and collect up to count blocks of the active chain from height on */
+static bool ParseHeightRange(HTTPRequest* req, const string& strRange, long nMaxCount, const string& strUsage,
+                             std::vector<const CBlockIndex*>& vIndex)
+{
+    vector<string> path;
+    boost::split(path, strRange, boost::is_any_of("/"));
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No height and count specified. Use " + strUsage + ".");
+
+    int32_t nHeight;
+    if (!ParseInt32(path[0], &nHeight) || nHeight < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[0]);
+    int32_t nCount;
+    if (!ParseInt32(path[1], &nCount) || nCount < 1 || nCount > nMaxCount)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Count out of range: " + path[1]);
+
+    LOCK(cs_main);
+    if (nHeight > chainActive.Height())
+        return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range: " + path[0]);
+    int nEnd = std::min(chainActive.Height() + 1, nHeight + nCount);
+    vIndex.reserve(nEnd - nHeight);
+    for (int h = nHeight; h < nEnd; h++)
+        vIndex.push_back(chainActive[h]);
+    return true;
+}
+
+/** Raw blocks of the active chain, concatenated in height order as they are stored on disk */
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    std::vector<const CBlockIndex*> vIndex;
+    if (!ParseHeightRange(req, params[0], MAX_REST_BLOCKS_RESULTS, "/rest/blocks/<height>/<count>.<ext>", vIndex))
+        return false;
+
+    // Each block goes into the reply as soon as it is read, so only one
+    // block at a time is held besides the reply itself.
+    string strBlock;
+    size_t nBytes = 0;
+    BOOST_FOREACH(const CBlockIndex* pindex, vIndex) {
+        if (nBytes >= MAX_REST_BLOCKS_BYTES)
+            break;
+        {
+            LOCK(cs_main);
+            bool fHaveData = (pindex->nStatus & BLOCK_HAVE_DATA);
+            if (!fHaveData || !ReadRawBlockFromDisk(strBlock, pindex, Params().MessageStart())) {
+                req->DiscardReplyData();
+                string strHash = pindex->GetBlockHash().GetHex();
+                if (!fHaveData && fHavePruned)
+                    return RESTERR(req, HTTP_NOT_FOUND, strHash + " not available (pruned data)");
+                return RESTERR(req, HTTP_NOT_FOUND, strHash + " not found");
+            }
+        }
+        nBytes += strBlock.size();
+        if (rf == RF_BINARY)
+            req->WriteReplyData(strBlock);
+        else
+            req->WriteReplyData(HexStr(strBlock.begin(), strBlock.end()));
+    }
+
+    if (rf == RF_BINARY) {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK);
+    } else {
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, "\n");
+    }
+    return true;
+}
+
+/** Hashes of the active chain's blocks from a height on */
+static bool rest_blockhashes_by_height(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    std::vector<const CBlockIndex*> vIndex;
+    if (!ParseHeightRange(req, params[0], MAX_REST_BLOCKHASHES_RESULTS, "/rest/blockhashesbyheight/<height>/<count>.<ext>", vIndex))
+        return false;
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        CDataStream ssHashes(SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_FOREACH(const CBlockIndex* pindex, vIndex)
+            ssHashes << pindex->GetBlockHash();
+        if (rf == RF_BINARY) {
+            req->WriteHeader("Content-Type", "application/octet-stream");
+            req->WriteReply(HTTP_OK, ssHashes.str());
+        } else {
+            req->WriteHeader("Content-Type", "text/plain");
+            req->WriteReply(HTTP_OK, HexStr(ssHashes.begin(), ssHashes.end()) + "\n");
+        }
+        return true;
+    }
+    case RF_JSON: {
+        UniValue jsonHashes(UniValue::VARR);
+        jsonHashes.reserve(vIndex.size());
+        BOOST_FOREACH(const CBlockIndex* pindex, vIndex)
+            jsonHashes.push_back(pindex->GetBlockHash().GetHex());
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, jsonHashes.write() + "\n");
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_block_extended(HTTPRequest* req, const std::string& strURIPart)
 {
     return rest_block(req, strURIPart, true);
@@ -350,32 +489,50 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CTransaction tx;
+    if (rf == RF_JSON) {
+        LOCK(cs_main);
+        UniValue objTx(UniValue::VOBJ);
+        if (TxToJSONFromCache(hash, false, objTx)) {
+            string strJSON = objTx.write() + "\n";
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, strJSON);
+            return true;
+        }
+    }
+
+    // The binary and hex formats serve the transaction as stored
+    string strTx;
     uint256 hashBlock = uint256();
-    if (!GetTransaction(hash, tx, hashBlock, true))
+    if (!GetRawTransaction(hash, strTx, hashBlock, true))
         return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
 
-    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-    ssTx << tx;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryTx = ssTx.str();
         req->WriteHeader("Content-Type", "application/octet-stream");
-        req->WriteReply(HTTP_OK, binaryTx);
+        req->WriteReply(HTTP_OK, strTx);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssTx.begin(), ssTx.end()) + "\n";
+        string strHex = HexStr(strTx.begin(), strTx.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
     }
 
     case RF_JSON: {
+        CTransaction tx;
+        try {
+            CDataStream ssTx(strTx.data(), strTx.data() + strTx.size(), SER_NETWORK, PROTOCOL_VERSION);
+            ssTx >> tx;
+        } catch (const std::exception&) {
+            return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, hashStr + " cannot be deserialized");
+        }
         UniValue objTx(UniValue::VOBJ);
-        TxToJSON(tx, hashBlock, objTx);
+        {
+            LOCK(cs_main);
+            TxToJSONAndCache(tx, HexStr(strTx.begin(), strTx.end()), hashBlock, false, objTx);
+        }
         string strJSON = objTx.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
@@ -598,13 +755,15 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/blocks/", rest_blocks},
+      {"/rest/blockhashesbyheight/", rest_blockhashes_by_height},
       {"/rest/getutxos", rest_getutxos},
 };
 
 bool StartREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
-        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
+        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler, HTTP_QUEUE_REST);
     return true;
 }
 
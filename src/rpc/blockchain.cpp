@@ -10,9 +10,11 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "rpc/jsoncache.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 #include "zen/delay.h"
 
@@ -20,6 +22,8 @@
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
+
 #include <regex>
 
 using namespace std;
@@ -27,24 +31,11 @@ using namespace std;
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
-double GetDifficultyINTERNAL(const CBlockIndex* blockindex, bool networkDifficulty)
+double GetDifficultyFromBits(uint32_t bits)
 {
-    // Floating point number that is a multiple of the minimum difficulty,
-    // minimum difficulty = 1.0.
-    if (blockindex == NULL)
-    {
-        if (chainActive.Tip() == NULL)
-            return 1.0;
-        else
-            blockindex = chainActive.Tip();
-    }
-
-    uint32_t bits;
-    if (networkDifficulty) {
-        bits = GetNextWorkRequired(blockindex, nullptr, Params().GetConsensus());
-    } else {
-        bits = blockindex->nBits;
-    }
+    // No target yet, as in the tip snapshot before the genesis block
+    if (bits == 0)
+        return 1.0;
 
     uint32_t powLimit =
         UintToArith256(Params().GetConsensus().powLimit).GetCompact();
@@ -69,6 +60,28 @@ double GetDifficultyINTERNAL(const CBlockIndex* blockindex, bool networkDifficul
     return dDiff;
 }
 
+double GetDifficultyINTERNAL(const CBlockIndex* blockindex, bool networkDifficulty)
+{
+    // Floating point number that is a multiple of the minimum difficulty,
+    // minimum difficulty = 1.0.
+    if (blockindex == NULL)
+    {
+        if (chainActive.Tip() == NULL)
+            return 1.0;
+        else
+            blockindex = chainActive.Tip();
+    }
+
+    uint32_t bits;
+    if (networkDifficulty) {
+        bits = GetNextWorkRequired(blockindex, nullptr, Params().GetConsensus());
+    } else {
+        bits = blockindex->nBits;
+    }
+
+    return GetDifficultyFromBits(bits);
+}
+
 double GetDifficulty(const CBlockIndex* blockindex)
 {
     return GetDifficultyINTERNAL(blockindex, false);
@@ -112,10 +125,12 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.pushKV("merkleroot", blockindex->hashMerkleRoot.GetHex());
     result.pushKV("time", (int64_t)blockindex->nTime);
     result.pushKV("nonce", blockindex->nNonce.GetHex());
-    result.pushKV("solution", HexStr(blockindex->nSolution));
+    result.pushKV("solution", HexStr(blockindex->GetSolution()));
     result.pushKV("bits", strprintf("%08x", blockindex->nBits));
     result.pushKV("difficulty", GetDifficulty(blockindex));
     result.pushKV("chainwork", blockindex->nChainWork.GetHex());
+    if (blockindex->nStatus & BLOCK_ASSUMED_VALID)
+        result.pushKV("assumedvalid", true);
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
@@ -125,30 +140,49 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+static UniValue blockTxToJSON(const CTransaction& tx, bool txDetails)
+{
+    if (txDetails)
+    {
+        UniValue objTx(UniValue::VOBJ);
+        TxToJSON(tx, uint256(), objTx);
+        return objTx;
+    }
+    return tx.GetHash().GetHex();
+}
+
+/** The fields of blockToJSON that change as the chain grows */
+static void blockChainStateToJSON(const CBlockIndex* blockindex, UniValue& result)
 {
-    UniValue result(UniValue::VOBJ);
-    result.pushKV("hash", block.GetHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
     if (chainActive.Contains(blockindex))
         confirmations = chainActive.Height() - blockindex->nHeight + 1;
     result.pushKV("confirmations", confirmations);
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+}
+
+/**
+ * The fields of blockToJSON that stay as they are, with a placeholder where
+ * blockChainStateToJSON puts the confirmations. Without fTxs the "tx" entry
+ * is left empty, for blockToJSONStream to write the transactions into.
+ */
+static UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, bool fTxs)
+{
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("hash", block.GetHash().GetHex());
+    result.pushKV("confirmations", -1);
     result.pushKV("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
     result.pushKV("height", blockindex->nHeight);
     result.pushKV("version", block.nVersion);
     result.pushKV("merkleroot", block.hashMerkleRoot.GetHex());
     UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    if (fTxs)
     {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx.GetHash().GetHex());
+        BOOST_FOREACH(const CTransaction&tx, block.vtx)
+            txs.push_back(blockTxToJSON(tx, txDetails));
     }
     result.pushKV("tx", txs);
     result.pushKV("time", block.GetBlockTime());
@@ -165,12 +199,89 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     if (blockindex->pprev)
         result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
     return result;
 }
 
+//! A rough figure of the memory the JSON of a block takes, for the JSON cache
+static size_t blockJSONUsage(const CBlock& block, bool txDetails)
+{
+    size_t nUsage = 1024 + block.vtx.size() * 160;
+    if (txDetails)
+        nUsage += ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) * 6;
+    return nUsage;
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue result = blockToJSON(block, blockindex, txDetails, true);
+    if (chainActive.Contains(blockindex))
+        jsonCache.PutBlock(blockindex->GetBlockHash(), txDetails, result, blockJSONUsage(block, txDetails));
+    blockChainStateToJSON(blockindex, result);
+    return result;
+}
+
+/**
+ * The JSON of a block of the active chain from the JSON cache, as blockToJSON
+ * renders it now. cs_main must be held.
+ */
+bool blockToJSONCached(const CBlockIndex* blockindex, bool txDetails, UniValue& result)
+{
+    std::shared_ptr<const UniValue> cached = jsonCache.GetBlock(blockindex->GetBlockHash(), txDetails);
+    if (!cached)
+        return false;
+    result = *cached;
+    blockChainStateToJSON(blockindex, result);
+    return true;
+}
+
+/** Write the JSON of a block the cache had, with the fields of chainstate in their places */
+static void blockCachedToJSONStream(const UniValue& cached, const UniValue& chainstate, JSONStreamWriter& out)
+{
+    const std::vector<std::string>& keys = cached.getKeys();
+    const std::vector<UniValue>& values = cached.getValues();
+
+    out.BeginObject();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        out.Key(keys[i]);
+        out.Value(chainstate.exists(keys[i]) ? chainstate[keys[i]] : values[i]);
+    }
+    const std::vector<std::string>& stateKeys = chainstate.getKeys();
+    for (size_t i = 0; i < stateKeys.size(); i++)
+    {
+        if (cached.exists(stateKeys[i]))
+            continue;
+        out.Key(stateKeys[i]);
+        out.Value(chainstate.getValues()[i]);
+    }
+    out.EndObject();
+}
+
+/** Same result as blockToJSON, only one transaction is held in memory at a time */
+static void blockToJSONStream(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONStreamWriter& out)
+{
+    UniValue result = blockToJSON(block, blockindex, txDetails, false);
+    blockChainStateToJSON(blockindex, result);
+    const std::vector<std::string>& keys = result.getKeys();
+    const std::vector<UniValue>& values = result.getValues();
+
+    out.BeginObject();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        out.Key(keys[i]);
+        if (keys[i] != "tx")
+        {
+            out.Value(values[i]);
+            continue;
+        }
+        out.BeginArray();
+        BOOST_FOREACH(const CTransaction&tx, block.vtx)
+            out.Value(blockTxToJSON(tx, txDetails));
+        out.EndArray();
+    }
+    out.EndObject();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -184,8 +295,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetChainTipSnapshot()->nHeight;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -201,8 +311,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainTipSnapshot()->hashBlock.GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -218,8 +327,35 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getdifficulty", "")
         );
 
-    LOCK(cs_main);
-    return GetNetworkDifficulty();
+    return GetDifficultyFromBits(GetChainTipSnapshot()->nNextBits);
+}
+
+static UniValue mempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    AssertLockHeld(mempool.cs);
+    UniValue info(UniValue::VOBJ);
+    info.pushKV("size", (int)e.GetTxSize());
+    info.pushKV("fee", ValueFromAmount(e.GetFee()));
+    info.pushKV("time", e.GetTime());
+    info.pushKV("height", (int)e.GetHeight());
+    info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
+    info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    BOOST_FOREACH(const string& dep, setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    info.pushKV("depends", depends);
+    return info;
 }
 
 UniValue mempoolToJSON(bool fVerbose = false)
@@ -229,33 +365,7 @@ UniValue mempoolToJSON(bool fVerbose = false)
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
         BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
-        {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
-            UniValue info(UniValue::VOBJ);
-            info.pushKV("size", (int)e.GetTxSize());
-            info.pushKV("fee", ValueFromAmount(e.GetFee()));
-            info.pushKV("time", e.GetTime());
-            info.pushKV("height", (int)e.GetHeight());
-            info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
-            info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            BOOST_FOREACH(const string& dep, setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.pushKV("depends", depends);
-            o.pushKV(hash.ToString(), info);
-        }
+            o.pushKV(entry.first.ToString(), mempoolEntryToJSON(entry.second));
         return o;
     }
     else
@@ -273,17 +383,27 @@ UniValue mempoolToJSON(bool fVerbose = false)
 
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() > 1)
+    if (fHelp || params.size() > 2)
         throw runtime_error(
-            "getrawmempool ( verbose )\n"
+            "getrawmempool ( verbose mempool_sequence )\n"
             "\nReturns all transaction ids in memory pool as a json array of string transaction ids.\n"
             "\nArguments:\n"
             "1. verbose           (boolean, optional, default=false) true for a json object, false for array of transaction ids\n"
+            "2. mempool_sequence  (boolean, optional, default=false) if verbose is false, also return the mempool sequence\n"
+            "                     number the transaction ids are current at, to sync with the mempoolsequence notifications\n"
             "\nResult: (for verbose = false):\n"
             "[                     (json array of string)\n"
             "  \"transactionid\"     (string) The transaction id\n"
             "  ,...\n"
             "]\n"
+            "\nResult: (for verbose = false and mempool_sequence = true):\n"
+            "{                           (json object)\n"
+            "  \"txids\" : [               (json array of string)\n"
+            "    \"transactionid\"         (string) The transaction id\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"mempool_sequence\" : n    (numeric) The mempool sequence number of the last addition or removal\n"
+            "}\n"
             "\nResult: (for verbose = true):\n"
             "{                           (json object)\n"
             "  \"transactionid\" : {       (json object)\n"
@@ -309,9 +429,43 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
+    bool fSequence = false;
+    if (params.size() > 1)
+        fSequence = params[1].get_bool();
+
+    if (fSequence) {
+        if (fVerbose)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbose results cannot contain the mempool sequence");
+
+        // The transaction ids and the sequence number have to be read at once
+        LOCK(mempool.cs);
+        UniValue o(UniValue::VOBJ);
+        o.pushKV("txids", mempoolToJSON(false));
+        o.pushKV("mempool_sequence", mempool.GetSequence());
+        return o;
+    }
+
     return mempoolToJSON(fVerbose);
 }
 
+void getrawmempool_stream(const UniValue& params, JSONStreamWriter& out)
+{
+    if (params.size() > 1 || params.size() == 0 || !params[0].isBool() || !params[0].get_bool())
+    {
+        out.Value(getrawmempool(params, false));
+        return;
+    }
+
+    LOCK2(cs_main, mempool.cs);
+    out.BeginObject();
+    BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+    {
+        out.Key(entry.first.ToString());
+        out.Value(mempoolEntryToJSON(entry.second));
+    }
+    out.EndObject();
+}
+
 UniValue getblockhash(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -337,6 +491,44 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
     return pblockindex->GetBlockHash().GetHex();
 }
 
+UniValue getblockhashes(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getblockhashes high low\n"
+            "\nReturns the hashes of the main chain blocks with a timestamp in a range (requires -timestampindex).\n"
+            "\nArguments:\n"
+            "1. high         (numeric, required) The newer block timestamp\n"
+            "2. low          (numeric, required) The older block timestamp\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"hash\"         (string) The block hash\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockhashes", "1231614698 1231024505")
+            + HelpExampleRpc("getblockhashes", "1231614698, 1231024505")
+        );
+
+    int64_t nHigh = params[0].get_int64();
+    int64_t nLow = params[1].get_int64();
+    if (nLow < 0 || nHigh < nLow || nHigh > std::numeric_limits<uint32_t>::max())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid timestamp range");
+
+    std::vector<uint256> hashes;
+    if (!GetTimestampIndex(nLow, nHigh, hashes))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information for the timestamp range (is -timestampindex enabled?)");
+
+    LOCK(cs_main);
+    UniValue result(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, hashes) {
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        if (it != mapBlockIndex.end() && chainActive.Contains(it->second))
+            result.push_back(hash.GetHex());
+    }
+    return result;
+}
+
 UniValue getblockheader(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -358,6 +550,7 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             "  \"nonce\" : n,           (numeric) The nonce\n"
             "  \"bits\" : \"1d00ffff\", (string) The bits\n"
             "  \"difficulty\" : x.xxx,  (numeric) The difficulty\n"
+            "  \"assumedvalid\" : true, (boolean) Only for the unvalidated blocks up to a snapshot loaded with loadtxoutset\n"
             "  \"previousblockhash\" : \"hash\",  (string) The hash of the previous block\n"
             "  \"nextblockhash\" : \"hash\"       (string) The hash of the next block\n"
             "}\n"
@@ -393,6 +586,91 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+/**
+ * Parse the getblock parameters and find the block they select.
+ * Returns the requested verbosity.
+ */
+static int getblockFind(const UniValue& params, CBlockIndex*& pblockindex)
+{
+    AssertLockHeld(cs_main);
+
+    std::string strHash = params[0].get_str();
+
+    // If height is supplied, find the hash
+    if (strHash.size() < (2 * sizeof(uint256))) {
+        // std::stoi allows characters, whereas we want to be strict
+        regex r("[[:digit:]]+");
+        if (!regex_match(strHash, r)) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+        }
+
+        int nHeight = -1;
+        try {
+            nHeight = std::stoi(strHash);
+        }
+        catch (const std::exception &e) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
+        }
+
+        if (nHeight < 0 || nHeight > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        }
+        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
+    }
+
+    uint256 hash(uint256S(strHash));
+
+    int verbosity = 1;
+    if (params.size() > 1) {
+        if(params[1].isNum()) {
+            verbosity = params[1].get_int();
+        } else {
+            verbosity = params[1].get_bool() ? 1 : 0;
+        }
+    }
+
+    if (verbosity < 0 || verbosity > 2) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
+    }
+
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    pblockindex = mapBlockIndex[hash];
+    return verbosity;
+}
+
+/**
+ * Parse the getblock parameters and read the block they select, asking the
+ * peers for it if it was pruned. Returns the requested verbosity.
+ */
+static int getblockRead(const UniValue& params, CBlock& block, CBlockIndex*& pblockindex)
+{
+    int verbosity;
+    bool fPruned;
+    {
+        LOCK(cs_main);
+        verbosity = getblockFind(params, pblockindex);
+        fPruned = fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0;
+        if (!fPruned && !ReadBlockFromDisk(block, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    }
+
+    // Without cs_main, the message handler needs it to take the block in
+    if (fPruned && !FetchPrunedBlock(pblockindex, block, PRUNED_BLOCK_FETCH_TIMEOUT))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data) and no peer sent it");
+
+    return verbosity;
+}
+
+static UniValue blockToHex(const CBlock& block)
+{
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+    return strHex;
+}
+
 UniValue getblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -401,6 +679,7 @@ UniValue getblock(const UniValue& params, bool fHelp)
             "\nIf verbosity is 0, returns a string that is serialized, hex-encoded data for the block.\n"
             "If verbosity is 1, returns an Object with information about the block.\n"
             "If verbosity is 2, returns an Object with information about the block and information about each transaction. \n"
+            "A block whose data was pruned is asked from the peers, waiting for it up to " + strprintf("%d", PRUNED_BLOCK_FETCH_TIMEOUT) + " seconds.\n"
             "\nArguments:\n"
             "1. \"hash|height\"     (string, required) The block hash or height\n"
              "2. verbosity              (numeric, optional, default=1) 0 for hex encoded data, 1 for a json object, and 2 for json object with transaction data,\n"
@@ -441,108 +720,230 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "12800")
         );
 
-    LOCK(cs_main);
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        int verbosity = getblockFind(params, pblockindex);
+        UniValue result;
+        if (verbosity > 0 && blockToJSONCached(pblockindex, verbosity >= 2, result))
+            return result;
+    }
 
-    std::string strHash = params[0].get_str();
+    CBlock block;
+    int verbosity = getblockRead(params, block, pblockindex);
 
-    // If height is supplied, find the hash
-    if (strHash.size() < (2 * sizeof(uint256))) {
-        // std::stoi allows characters, whereas we want to be strict
-        regex r("[[:digit:]]+");
-        if (!regex_match(strHash, r)) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
+    if (verbosity == 0)
+        return blockToHex(block);
 
-        int nHeight = -1;
-        try {
-            nHeight = std::stoi(strHash);
-        }
-        catch (const std::exception &e) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid block height parameter");
-        }
+    LOCK(cs_main);
+    return blockToJSON(block, pblockindex, verbosity >= 2);
+}
 
-        if (nHeight < 0 || nHeight > chainActive.Height()) {
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
-        }
-        strHash = chainActive[nHeight]->GetBlockHash().GetHex();
+void getblock_stream(const UniValue& params, JSONStreamWriter& out)
+{
+    if (params.size() < 1 || params.size() > 2)
+    {
+        out.Value(getblock(params, false));
+        return;
     }
 
-    uint256 hash(uint256S(strHash));
-
-    int verbosity = 1;
-    if (params.size() > 1) {
-        if(params[1].isNum()) {
-            verbosity = params[1].get_int();
-        } else {
-            verbosity = params[1].get_bool() ? 1 : 0;
-        }
+    CBlockIndex* pblockindex;
+    std::shared_ptr<const UniValue> cached;
+    UniValue chainstate(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        int verbosity = getblockFind(params, pblockindex);
+        if (verbosity > 0)
+            cached = jsonCache.GetBlock(pblockindex->GetBlockHash(), verbosity >= 2);
+        if (cached)
+            blockChainStateToJSON(pblockindex, chainstate);
     }
-
-    if (verbosity < 0 || verbosity > 2) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
+    if (cached) {
+        blockCachedToJSONStream(*cached, chainstate, out);
+        return;
     }
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    int verbosity = getblockRead(params, block, pblockindex);
 
-    if (verbosity == 0)
-    {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+    if (verbosity == 0) {
+        out.Value(blockToHex(block));
+    } else {
+        LOCK(cs_main);
+        // Blocks small enough for the JSON cache are rendered whole to be kept
+        if (chainActive.Contains(pblockindex) && jsonCache.IsCacheable(blockJSONUsage(block, verbosity >= 2)))
+            out.Value(blockToJSON(block, pblockindex, verbosity >= 2));
+        else
+            blockToJSONStream(block, pblockindex, verbosity >= 2, out);
     }
-
-    return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=\"hash_serialized\") \"hash_serialized\" to compute the\n"
+            "                 statistics from the whole set along with its serialized hash, which may take some\n"
+            "                 time, or \"muhash\" to return the statistics kept as the set is written, right away.\n"
+            "                 Those are of a consistent view of the set at the returned best block, which\n"
+            "                 can be behind the tip if blocks were connected while they were being computed.\n"
             "\nResult:\n"
             "{\n"
-            "  \"height\":n,     (numeric) The current block height (index)\n"
-            "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
+            "  \"height\":n,     (numeric) The block height (index) of the statistics\n"
+            "  \"bestblock\": \"hex\",   (string) the block hash hex of the statistics\n"
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"muhash\": \"hash\",      (string) The MuHash of the unspent outputs, whatever their order\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (not with \"muhash\")\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fScan = true;
+    if (params.size() > 0) {
+        std::string strHashType = params[0].get_str();
+        if (strHashType == "muhash")
+            fScan = false;
+        else if (strHashType != "hash_serialized")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+    }
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
+    // Flushing takes cs_main; the records are then read from a snapshot of
+    // the coin database without it, so validation is not held up meanwhile
     FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
-        ret.pushKV("height", (int64_t)stats.nHeight);
-        ret.pushKV("bestblock", stats.hashBlock.GetHex());
-        ret.pushKV("transactions", (int64_t)stats.nTransactions);
-        ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
-        ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
-        ret.pushKV("hash_serialized", stats.hashSerialized.GetHex());
-        ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+    if (fScan) {
+        if (!pcoinsdbview->GetStats(stats))
+            return ret;
+    } else {
+        // The running statistics are those of the last write
+        if (pcoinsflush && !pcoinsflush->Sync())
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Cannot write the coin database");
+        if (!pcoinsdbview->GetTxOutSetStats(stats))
+            throw JSONRPCError(RPC_DATABASE_ERROR, "The UTXO set statistics are not kept, use \"hash_serialized\"");
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        if (mi != mapBlockIndex.end())
+            stats.nHeight = mi->second->nHeight;
     }
+    ret.pushKV("height", (int64_t)stats.nHeight);
+    ret.pushKV("bestblock", stats.hashBlock.GetHex());
+    ret.pushKV("transactions", (int64_t)stats.nTransactions);
+    ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+    ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
+    ret.pushKV("muhash", stats.hashMuHash.GetHex());
+    if (fScan)
+        ret.pushKV("hash_serialized", stats.hashSerialized.GetHex());
+    ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+    return ret;
+}
+
+static UniValue TxOutSetSnapshotToJSON(const CTxOutSetSnapshotHeader& header, const boost::filesystem::path& path)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("path", path.string());
+    ret.pushKV("height", header.nHeight);
+    ret.pushKV("bestblock", header.hashBlock.GetHex());
+    ret.pushKV("bestanchor", header.hashAnchor.GetHex());
+    ret.pushKV("transactions", (int64_t)header.nTransactions);
+    ret.pushKV("anchors", (int64_t)header.nAnchors);
+    ret.pushKV("nullifiers", (int64_t)header.nNullifiers);
+    ret.pushKV("hash_serialized", header.hashSerialized.GetHex());
+    ret.pushKV("hash_shielded", header.hashShielded.GetHex());
     return ret;
 }
 
+static const std::string txOutSetSnapshotHelp =
+    "{\n"
+    "  \"path\": \"path\",            (string) the absolute path of the snapshot file\n"
+    "  \"height\": n,                 (numeric) the height of the snapshot block\n"
+    "  \"bestblock\": \"hex\",        (string) the hash of the snapshot block\n"
+    "  \"bestanchor\": \"hex\",       (string) the best anchor at the snapshot block\n"
+    "  \"transactions\": n,           (numeric) the number of transactions with unspent outputs\n"
+    "  \"anchors\": n,                (numeric) the number of anchors\n"
+    "  \"nullifiers\": n,             (numeric) the number of nullifiers\n"
+    "  \"hash_serialized\": \"hash\", (string) the same hash as gettxoutsetinfo \"hash_serialized\" returns at that block\n"
+    "  \"hash_shielded\": \"hash\"    (string) the hash of the anchors and nullifiers\n"
+    "}\n";
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\nWrites the unspent transaction output set, anchors and nullifiers at the current tip to a snapshot file,\n"
+            "which a new node can load with loadtxoutset instead of validating the whole chain.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) the snapshot file, relative to the data directory unless absolute.\n"
+            "                   It must not exist yet.\n"
+            "\nResult:\n"
+            + txOutSetSnapshotHelp +
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "File " + path.string() + " already exists");
+
+    CTxOutSetSnapshotHeader header;
+    CValidationState state;
+    if (!DumpTxOutSet(fopen(path.string().c_str(), "wb"), header, state)) {
+        boost::filesystem::remove(path);
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+    }
+    return TxOutSetSnapshotToJSON(header, path);
+}
+
+UniValue loadtxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "loadtxoutset \"filename\" \"hash_serialized\"\n"
+            "\nLoads a snapshot file written by dumptxoutset and makes its block the active tip, skipping the\n"
+            "download and validation of all blocks below it. The blocks below the snapshot are treated as pruned.\n"
+            "This requires -prune, a node that has not connected any block yet, and the headers of the snapshot\n"
+            "chain, so wait for the headers to be synced first. The blocks up to the snapshot are only assumed valid,\n"
+            "getblockheader reports them as \"assumedvalid\", and are never validated, not even in the background.\n"
+            "\nArguments:\n"
+            "1. \"filename\"          (string, required) the snapshot file, relative to the data directory unless absolute\n"
+            "2. \"hash_serialized\"   (string, required) the expected hash_serialized of the snapshot, obtained from a\n"
+            "                         trusted node with gettxoutsetinfo \"hash_serialized\" at the snapshot block\n"
+            "\nResult:\n"
+            + txOutSetSnapshotHelp +
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"f8dbe0a5a21cdbefd7a6beb3ed74bc9d1e3b010bd7ee5d2a6e2fd5093c5bc6a8\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"f8dbe0a5a21cdbefd7a6beb3ed74bc9d1e3b010bd7ee5d2a6e2fd5093c5bc6a8\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    uint256 hashExpected = ParseHashV(params[1], "hash_serialized");
+
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open file " + path.string());
+
+    CTxOutSetSnapshotHeader header;
+    CValidationState state;
+    if (LoadTxOutSet(file, hashExpected, header, state))
+        ActivateBestChain(state);
+    if (!state.IsValid())
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+    return TxOutSetSnapshotToJSON(header, path);
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -623,6 +1024,59 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     return ret;
 }
 
+/** Compact one database (CLevelDBWrapper or CCoinsViewDB) and report its size before and after */
+template <typename DB>
+static UniValue CompactDatabase(DB& db, const std::string& strName)
+{
+    uint64_t nBefore = db.EstimateSize();
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Compacting the %s database\n", strName);
+    db.CompactFull();
+    LogPrintf("Compacted the %s database in %dms\n", strName, GetTimeMillis() - nStart);
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("sizebefore", nBefore);
+    result.pushKV("sizeafter", db.EstimateSize());
+    return result;
+}
+
+UniValue compactdb(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "compactdb ( \"database\" )\n"
+            "\nCompacts the LevelDB databases, which reclaims the space of deleted and overwritten records.\n"
+            "This can take minutes; the node keeps working meanwhile.\n"
+            "\nArguments:\n"
+            "1. \"database\"   (string, optional, default=all) One of \"chainstate\", \"index\" or \"all\"\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {      (object) For each compacted database\n"
+            "    \"sizebefore\": n,    (numeric) The approximate size on disk before, in bytes\n"
+            "    \"sizeafter\": n      (numeric) The approximate size on disk after, in bytes\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("compactdb", "\"chainstate\"")
+            + HelpExampleRpc("compactdb", "\"chainstate\"")
+        );
+
+    std::string strDatabase = params.size() > 0 ? params[0].get_str() : "all";
+    if (strDatabase != "chainstate" && strDatabase != "index" && strDatabase != "all")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database: " + strDatabase);
+    if (!pcoinsdbview || !pblocktree)
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Databases not loaded");
+
+    // LevelDB compacts alongside reads and writes, so cs_main is not held
+    UniValue result(UniValue::VOBJ);
+    if (strDatabase != "index")
+        result.pushKV("chainstate", CompactDatabase(*pcoinsdbview, "chainstate"));
+    if (strDatabase != "chainstate")
+        result.pushKV("index", CompactDatabase(*pblocktree, "block index"));
+    return result;
+}
+
 UniValue verifychain(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
@@ -652,10 +1106,10 @@ UniValue verifychain(const UniValue& params, bool fHelp)
 }
 
 /** Implementation of IsSuperMajority with better feedback */
-static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
+static UniValue SoftForkMajorityDesc(int minVersion, const CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
 {
     int nFound = 0;
-    CBlockIndex* pstart = pindex;
+    const CBlockIndex* pstart = pindex;
     for (int i = 0; i < consensusParams.nMajorityWindow && pstart != NULL; i++)
     {
         if (pstart->nVersion >= minVersion)
@@ -671,7 +1125,7 @@ static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nR
     return rv;
 }
 
-static UniValue SoftForkDesc(const std::string &name, int version, CBlockIndex* pindex, const Consensus::Params& consensusParams)
+static UniValue SoftForkDesc(const std::string &name, int version, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     UniValue rv(UniValue::VOBJ);
     rv.pushKV("id", name);
@@ -743,25 +1197,23 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockchaininfo", "")
         );
 
-    LOCK(cs_main);
+    // Read from the tip snapshot, cs_main is only needed for the prune height
+    std::shared_ptr<const CChainTipSnapshot> snapshot = GetChainTipSnapshot();
+    const CBlockIndex* tip = snapshot->pindex;
 
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("chain",                 Params().NetworkIDString());
-    obj.pushKV("blocks",                (int)chainActive.Height());
-    obj.pushKV("headers",               pindexBestHeader ? pindexBestHeader->nHeight : -1);
-    obj.pushKV("bestblockhash",         chainActive.Tip()->GetBlockHash().GetHex());
-    obj.pushKV("difficulty",            (double)GetNetworkDifficulty());
-    obj.pushKV("verificationprogress",  Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.Tip()));
-    obj.pushKV("chainwork",             chainActive.Tip()->nChainWork.GetHex());
+    obj.pushKV("blocks",                snapshot->nHeight);
+    obj.pushKV("headers",               nBestHeaderHeight.load());
+    obj.pushKV("bestblockhash",         snapshot->hashBlock.GetHex());
+    obj.pushKV("difficulty",            GetDifficultyFromBits(snapshot->nNextBits));
+    obj.pushKV("verificationprogress",  snapshot->dVerificationProgress);
+    obj.pushKV("chainwork",             snapshot->nChainWork.GetHex());
     obj.pushKV("pruned",                fPruneMode);
+    obj.pushKV("commitments",           snapshot->nCommitments);
 
-    ZCIncrementalMerkleTree tree;
-    pcoinsTip->GetAnchorAt(pcoinsTip->GetBestAnchor(), tree);
-    obj.pushKV("commitments",           tree.size());
-
-    CBlockIndex* tip = chainActive.Tip();
     UniValue valuePools(UniValue::VARR);
-    valuePools.push_back(ValuePoolDesc("sprout", tip->nChainSproutValue, boost::none));
+    valuePools.push_back(ValuePoolDesc("sprout", snapshot->nChainSproutValue, boost::none));
     obj.pushKV("valuePools",            valuePools);
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -775,9 +1227,10 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.pushKV("softforks",             softforks);
     obj.pushKV("bip9_softforks", bip9_softforks);
 
-    if (fPruneMode)
+    if (fPruneMode && tip)
     {
-        CBlockIndex *block = chainActive.Tip();
+        LOCK(cs_main);
+        const CBlockIndex *block = tip;
         while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
             block = block->pprev;
 
@@ -834,17 +1287,11 @@ UniValue getchaintips(const UniValue& params, bool fHelp)
 
     bool bShowPenaltyInfo = (params.size() >= 1)? params[0].getBool() : false;
 
-    /* Build up a list of chain tips.  We start with the list of all
-       known blocks, and successively remove blocks that appear as pprev
-       of another block. */
+    /* The chain tips are the blocks that are not the pprev of another block,
+       which the global fork tips keep track of as blocks are added. */
     std::set<const CBlockIndex*, CompareBlocksByHeight> setTips;
-    for(const PAIRTYPE(const uint256, CBlockIndex*)& item: mapBlockIndex)
-        setTips.insert(item.second);
-    for(const PAIRTYPE(const uint256, CBlockIndex*)& item: mapBlockIndex) {
-        const CBlockIndex* pprev = item.second->pprev;
-        if (pprev)
-            setTips.erase(pprev);
-    }
+    for(const PAIRTYPE(const CBlockIndex*, int)& item: mGlobalForkTips)
+        setTips.insert(item.first);
 
     // Always report the currently active tip.
     setTips.insert(chainActive.Tip());
@@ -902,6 +1349,92 @@ UniValue getchaintips(const UniValue& params, bool fHelp)
     return res;
 }
 
+UniValue getblockconnectstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getblockconnectstats ( count )\n"
+            "\nReturns how long connecting blocks to the tip took, by phase, in microseconds:\n"
+            "the totals since startup, and the details of the most recently connected blocks.\n"
+            "Blocks later disconnected by a reorg are kept in the list.\n"
+            "\nArguments:\n"
+            "1. count    (numeric, optional, default=10) number of recent blocks to return, at most "
+            + strprintf("%u", BLOCK_CONNECT_STATS_SIZE) + "\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blocks\": xxxxx,             (numeric) blocks connected since startup\n"
+            "  \"phases\": {                  (json object) totals of each phase\n"
+            "    \"phase\": {                 (json object) load, prefetch, check, inputs, scripts, proofs, undo,\n"
+            "                                 index, callbacks, flush, chainstate, mempool, wallet or total\n"
+            "      \"total\": xxxxx,          (numeric) time spent in the phase\n"
+            "      \"max\": xxxxx             (numeric) longest time spent in the phase by a block\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"recent\": [                  (json array) most recently connected blocks, newest first\n"
+            "    {\n"
+            "      \"height\": xxxxx,         (numeric) block height\n"
+            "      \"hash\": \"hash\",          (string) block hash\n"
+            "      \"time\": xxxxx,           (numeric) when the block was connected, in seconds since epoch\n"
+            "      \"tx\": xxxxx,             (numeric) number of transactions\n"
+            "      \"inputs\": xxxxx,         (numeric) number of transparent inputs\n"
+            "      \"outputs\": xxxxx,        (numeric) number of transparent outputs\n"
+            "      \"joinsplits\": xxxxx,     (numeric) number of joinsplits\n"
+            "      \"size\": xxxxx,           (numeric) block size in bytes\n"
+            "      \"phases\": {              (json object) time spent in each phase\n"
+            "        \"phase\": xxxxx, ...\n"
+            "      }\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockconnectstats", "")
+            + HelpExampleCli("getblockconnectstats", "100")
+            + HelpExampleRpc("getblockconnectstats", "100")
+        );
+
+    int nCount = 10;
+    if (params.size() > 0) {
+        nCount = params[0].get_int();
+        if (nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count, must be non-negative");
+    }
+
+    std::vector<CBlockConnectStats> vRecent;
+    CBlockConnectTotals totals;
+    GetBlockConnectStats(nCount, vRecent, totals);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("blocks", (uint64_t)totals.nBlocks);
+    UniValue phases(UniValue::VOBJ);
+    for (int phase = 0; phase < CONNECT_PHASE_COUNT; phase++) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("total", totals.vTotalMicros[phase]);
+        obj.pushKV("max", totals.vMaxMicros[phase]);
+        phases.pushKV(GetBlockConnectPhaseName(phase), obj);
+    }
+    ret.pushKV("phases", phases);
+
+    UniValue recent(UniValue::VARR);
+    for (const CBlockConnectStats& stats : vRecent) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("height", stats.nHeight);
+        obj.pushKV("hash", stats.hash.GetHex());
+        obj.pushKV("time", stats.nTime);
+        obj.pushKV("tx", (uint64_t)stats.nTx);
+        obj.pushKV("inputs", (uint64_t)stats.nInputs);
+        obj.pushKV("outputs", (uint64_t)stats.nOutputs);
+        obj.pushKV("joinsplits", (uint64_t)stats.nJoinSplits);
+        obj.pushKV("size", (uint64_t)stats.nSize);
+        UniValue blockPhases(UniValue::VOBJ);
+        for (int phase = 0; phase < CONNECT_PHASE_COUNT; phase++)
+            blockPhases.pushKV(GetBlockConnectPhaseName(phase), stats.vPhaseMicros[phase]);
+        obj.pushKV("phases", blockPhases);
+        recent.push_back(obj);
+    }
+    ret.pushKV("recent", recent);
+    return ret;
+}
+
 UniValue mempoolInfoToJSON()
 {
     UniValue ret(UniValue::VOBJ);
@@ -1071,26 +1604,104 @@ int64_t blocksToOvertakeTarget(const CBlockIndex* forkTip, const CBlockIndex* ta
     return gap;
 }
 
-UniValue getblockfinalityindex(const UniValue& params, bool fHelp)
+/**
+ * The finality indexes of the blocks in the last MAX_BLOCK_AGE_FOR_FINALITY
+ * of the main chain, as the minimum of blocksToOvertakeTarget over all tips.
+ *
+ * A tip forking below the target gives a gap that does not depend on the
+ * target, while all the others (the main tip first) give the same gap from
+ * the depth of the target. The first part is kept per height, as a running
+ * minimum over the tips forking below it, and rebuilt only when the main tip
+ * or the set of fork tips changes. Protected by cs_main.
+ */
+class CFinalityCache
 {
-    if (fHelp || params.size() < 1 || params.size() > 2)
-        throw runtime_error(
-            "getblockfinalityindex \"hash\"\n"
-            "\nReturns the minimum number of consecutive blocks a miner should mine from now in order to revert the block of given hash\n"
-            "\nExamples:\n"
-            + HelpExampleCli("getblockfinalityindex", "\"hash\"")
-        );
-    LOCK(cs_main);
+private:
+    const CBlockIndex* pindexTip;
+    uint64_t nForkTipsVersion;
+    int nStartHeight;
+    //! Minimum gap over the fork tips stemming from the main chain below nStartHeight + i
+    std::vector<int64_t> vForkGap;
 
-    uint256 hash = ParseHashV(params[0], "parameter 1");
+public:
+    CFinalityCache() : pindexTip(NULL), nForkTipsVersion(0), nStartHeight(0) {}
 
-    if (mapBlockIndex.count(hash) == 0)
+    void Update()
+    {
+        AssertLockHeld(cs_main);
+        if (pindexTip == chainActive.Tip() && nForkTipsVersion == mGlobalForkTips.GetVersion())
+            return;
+
+        pindexTip = chainActive.Tip();
+        nForkTipsVersion = mGlobalForkTips.GetVersion();
+        vForkGap.clear();
+        if (!pindexTip)
+            return;
+
+        const int nTipHeight = pindexTip->nHeight;
+        nStartHeight = std::max(0, nTipHeight - MAX_BLOCK_AGE_FOR_FINALITY + 2);
+        std::vector<int64_t> vGapAtFork(nTipHeight - nStartHeight + 1, LLONG_MAX);
+        int64_t nBelowStart = LLONG_MAX;
+        for (CGlobalForkTips::const_iterator it = mGlobalForkTips.begin(); it != mGlobalForkTips.end(); ++it)
+        {
+            const CBlockIndex* forkTip = it->first;
+            // Tips are ordered by decreasing height, see blocksToOvertakeTarget
+            if (nTipHeight - forkTip->nHeight >= MAX_BLOCK_AGE_FOR_FINALITY)
+                break;
+            const int nForkHeight = chainActive.FindFork(forkTip)->nHeight;
+            if (nForkHeight >= nTipHeight)
+                continue;
+            // A target above nForkHeight gets this gap, the main chain tip is the target ever
+            const int64_t gap = blocksToOvertakeTarget(forkTip, pindexTip);
+            if (nForkHeight < nStartHeight)
+                nBelowStart = std::min(nBelowStart, gap);
+            else
+                vGapAtFork[nForkHeight - nStartHeight] = std::min(vGapAtFork[nForkHeight - nStartHeight], gap);
+        }
+
+        vForkGap.resize(vGapAtFork.size());
+        int64_t gap = nBelowStart;
+        for (size_t i = 0; i < vForkGap.size(); i++)
+        {
+            vForkGap[i] = gap;
+            gap = std::min(gap, vGapAtFork[i]);
+        }
+    }
+
+    /** The finality index of a main chain block no older than MAX_BLOCK_AGE_FOR_FINALITY, Update() must have been called. */
+    int64_t Get(const CBlockIndex* pindex) const
+    {
+        AssertLockHeld(cs_main);
+        assert(pindex->nHeight >= nStartHeight && pindex->nHeight - nStartHeight < (int)vForkGap.size());
+
+        int64_t targetToTipDelta = chainActive.Height() - pindex->nHeight + 1;
+        int64_t gap;
+        if (targetToTipDelta < PENALTY_THRESHOLD + 1) {
+            // an attacker can mine from previous block up to tip + 1
+            gap = targetToTipDelta + 1;
+        } else {
+            // penalty applies
+            gap = (targetToTipDelta * (targetToTipDelta + 1) / 2);
+        }
+        return std::min(gap, vForkGap[pindex->nHeight - nStartHeight]);
+    }
+};
+
+static CFinalityCache finalityCache;
+
+/** The finality index of the block with the given hash, throws the RPC error telling why it cannot be told. */
+static int64_t GetBlockFinalityIndex(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No such block header");
 
     if (hash == Params().GetConsensus().hashGenesisBlock)
         throw JSONRPCError(RPC_INVALID_PARAMS, "Finality does not apply to genesis block");
 
-    CBlockIndex* pTargetBlockIdx = mapBlockIndex[hash];
+    CBlockIndex* pTargetBlockIdx = mi->second;
 
     if (fHavePruned && !(pTargetBlockIdx->nStatus & BLOCK_HAVE_DATA) && pTargetBlockIdx->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
@@ -1111,28 +1722,64 @@ UniValue getblockfinalityindex(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Old block: older than 2000!");
     }
 
-    std::set<const CBlockIndex*, CompareBlocksByHeight> setTips;
-    for(auto mapPair: mGlobalForkTips)
+    finalityCache.Update();
+    int64_t minGap = finalityCache.Get(pTargetBlockIdx);
+
+    LogPrint("forks", "%s():%d - returning [%d]\n", __func__, __LINE__, minGap);
+    return minGap;
+}
+
+UniValue getblockfinalityindex(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockfinalityindex \"hash\"|[\"hash\",...]\n"
+            "\nReturns the minimum number of consecutive blocks a miner should mine from now in order to revert the block of given hash\n"
+            "\nArguments:\n"
+            "1. \"hash\"          (string or array, required) The block hash, or an array of block hashes\n"
+            "\nResult for a single hash:\n"
+            "n                    (numeric) The finality index of the block\n"
+            "\nResult for an array of hashes:\n"
+            "[\n"
+            "  {\n"
+            "    \"hash\": \"hash\",          (string) The block hash\n"
+            "    \"finalityindex\": n,      (numeric) The finality index of the block, unless it cannot be told\n"
+            "    \"error\": \"message\"      (string) Why the finality index cannot be told, if so\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfinalityindex", "\"hash\"")
+            + HelpExampleRpc("getblockfinalityindex", "[\"hash1\", \"hash2\"]")
+        );
+
+    if (!params[0].isArray())
     {
-        const CBlockIndex* idx = mapPair.first;
-        setTips.insert(idx);
+        uint256 hash = ParseHashV(params[0], "parameter 1");
+        LOCK(cs_main);
+        return GetBlockFinalityIndex(hash);
     }
-    setTips.insert(chainActive.Tip());
 
-//    dump_global_tips();
+    // The hashes are parsed first, so that the lock is taken once for all blocks
+    const UniValue& hashes = params[0].get_array();
+    std::vector<uint256> vHashes;
+    vHashes.reserve(hashes.size());
+    for (size_t i = 0; i < hashes.size(); i++)
+        vHashes.push_back(ParseHashV(hashes[i], "parameter 1"));
 
-    // For each tip find the stemming block on the main chain
-    // In case of main tip such a block would be the tip itself
-    //-----------------------------------------------------------------------
-    int64_t minGap = LLONG_MAX;
-    for(auto selectedTip: setTips)
+    UniValue ret(UniValue::VARR);
+    LOCK(cs_main);
+    BOOST_FOREACH(const uint256& hash, vHashes)
     {
-        int64_t gap = blocksToOvertakeTarget(selectedTip, pTargetBlockIdx);
-        minGap = std::min(minGap, gap);
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("hash", hash.GetHex());
+        try {
+            entry.pushKV("finalityindex", GetBlockFinalityIndex(hash));
+        } catch (const UniValue& objError) {
+            entry.pushKV("error", find_value(objError, "message"));
+        }
+        ret.push_back(entry);
     }
-
-    LogPrint("forks", "%s():%d - returning [%d]\n", __func__, __LINE__, minGap);
-    return minGap;
+    return ret;
 }
 
 UniValue getglobaltips(const UniValue& params, bool fHelp)
@@ -31,6 +31,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "generate", 0 },
     { "getnetworkhashps", 0 },
     { "getnetworkhashps", 1 },
+    { "getlocalsolps", 0 },
     { "sendtoaddress", 1 },
     { "sendtoaddress", 4 },
     { "settxfee", 0 },
@@ -45,6 +46,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 1 },
     { "getbalance", 2 },
     { "getblockhash", 0 },
+    { "getblockhashes", 0 },
+    { "getblockhashes", 1 },
+    { "getaddressbalance", 0 },
+    { "getaddresstxids", 0 },
+    { "getaddressdeltas", 0 },
+    { "getspentinfo", 0 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -72,6 +79,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockheader", 1 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
+    { "getrawtransactions", 0 },
+    { "getrawtransactions", 1 },
     { "createrawtransaction", 0 },
     { "createrawtransaction", 1 },
     { "signrawtransaction", 1 },
@@ -81,6 +90,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
+    { "gettxoutproofs", 0 },
+    { "verifytxoutproofs", 0 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
@@ -89,18 +100,22 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "verifychain", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
+    { "getrawmempool", 1 },
     { "estimatefee", 0 },
     { "estimatepriority", 0 },
     { "prioritisetransaction", 1 },
     { "prioritisetransaction", 2 },
     { "setban", 2 },
     { "setban", 3 },
+    { "getlockstats", 0 },
     { "zcrawjoinsplit", 1 },
     { "zcrawjoinsplit", 2 },
     { "zcrawjoinsplit", 3 },
     { "zcrawjoinsplit", 4 },
     { "zcbenchmark", 1 },
     { "zcbenchmark", 2 },
+    { "zcbenchmark", 3 },
+    { "zcbenchmark", 4 },
     { "getblocksubsidy", 0},
     { "z_listreceivedbyaddress", 1},
     { "z_getbalance", 1},
@@ -113,13 +128,15 @@ static const CRPCConvertParam vRPCConvertParams[] =
 	{ "z_sendmany", 4},
     { "z_shieldcoinbase", 2},
     { "z_shieldcoinbase", 3},
+    { "z_shieldcoinbase", 4},
     { "z_getoperationstatus", 0},
     { "z_getoperationresult", 0},
     { "z_importkey", 2 },
     { "z_importviewingkey", 2 },
     { "z_getpaymentdisclosure", 1},
     { "z_getpaymentdisclosure", 2},
-    { "getchaintips", 0}
+    { "getchaintips", 0},
+    { "getblockconnectstats", 0 }
 };
 
 class CRPCConvertTable
@@ -0,0 +1,98 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsoncache.h"
+
+#include "chain.h"
+#include "main.h"
+
+CJSONCache jsonCache;
+
+void CJSONCache::Erase(std::map<Key, CEntry>::iterator it)
+{
+    nUsage -= it->second.nUsage;
+    lruKeys.erase(it->second.itLRU);
+    mapEntries.erase(it);
+}
+
+std::shared_ptr<const UniValue> CJSONCache::Get(const Key& key, std::string* pstrHex, uint256* phashBlock)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    std::map<Key, CEntry>::iterator it = mapEntries.find(key);
+    if (it == mapEntries.end())
+        return nullptr;
+
+    BlockMap::const_iterator mi = mapBlockIndex.find(it->second.hashBlock);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+        Erase(it);
+        return nullptr;
+    }
+
+    lruKeys.splice(lruKeys.begin(), lruKeys, it->second.itLRU);
+    if (pstrHex)
+        *pstrHex = it->second.strHex;
+    if (phashBlock)
+        *phashBlock = it->second.hashBlock;
+    return it->second.json;
+}
+
+void CJSONCache::Put(const Key& key, UniValue&& json, const std::string& strHex, const uint256& hashBlock, size_t nUsageIn)
+{
+    if (!IsCacheable(nUsageIn))
+        return;
+
+    LOCK(cs);
+
+    std::map<Key, CEntry>::iterator it = mapEntries.find(key);
+    if (it != mapEntries.end())
+        Erase(it);
+
+    lruKeys.push_front(key);
+    CEntry& entry = mapEntries[key];
+    entry.json = std::make_shared<const UniValue>(std::move(json));
+    entry.strHex = strHex;
+    entry.hashBlock = hashBlock;
+    entry.nUsage = nUsageIn + strHex.size();
+    entry.itLRU = lruKeys.begin();
+    nUsage += entry.nUsage;
+
+    while (nUsage > nMaxUsage && !lruKeys.empty())
+        Erase(mapEntries.find(lruKeys.back()));
+}
+
+void CJSONCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    while (nUsage > nMaxUsage && !lruKeys.empty())
+        Erase(mapEntries.find(lruKeys.back()));
+}
+
+bool CJSONCache::IsCacheable(size_t nUsageIn)
+{
+    LOCK(cs);
+    // Larger than a quarter of the cache, it would only push out the others
+    return nUsageIn <= nMaxUsage / 4;
+}
+
+std::shared_ptr<const UniValue> CJSONCache::GetBlock(const uint256& hash, bool fTxDetails)
+{
+    return Get(Key(hash, fTxDetails ? BLOCK_TXS : BLOCK), NULL, NULL);
+}
+
+void CJSONCache::PutBlock(const uint256& hash, bool fTxDetails, UniValue json, size_t nUsageIn)
+{
+    Put(Key(hash, fTxDetails ? BLOCK_TXS : BLOCK), std::move(json), std::string(), hash, nUsageIn);
+}
+
+std::shared_ptr<const UniValue> CJSONCache::GetTx(const uint256& txid, std::string& strHex, uint256& hashBlock)
+{
+    return Get(Key(txid, TX), &strHex, &hashBlock);
+}
+
+void CJSONCache::PutTx(const uint256& txid, UniValue json, const std::string& strHex, const uint256& hashBlock, size_t nUsageIn)
+{
+    Put(Key(txid, TX), std::move(json), strHex, hashBlock, nUsageIn);
+}
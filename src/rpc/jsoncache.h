@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONCACHE_H
+#define BITCOIN_RPC_JSONCACHE_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <univalue.h>
+
+/** Default for -rpcjsoncache, megabytes of rendered block and transaction JSON kept for RPC and REST */
+static const unsigned int DEFAULT_RPC_JSON_CACHE_SIZE = 32;
+
+/**
+ * The verbose JSON of blocks and transactions of the active chain, as
+ * getblock, getrawtransaction and the REST interface render it, kept in LRU
+ * order up to a size. Explorers ask for the same recent ones over and over.
+ *
+ * What changes as the chain grows, the confirmations and the next block, is
+ * left to the callers to fill in. An entry is only served while its block is
+ * in the active chain, so the entries of the blocks a reorg disconnects are
+ * dropped when they are next looked up. The lookups need cs_main for that.
+ */
+class CJSONCache
+{
+private:
+    enum Kind { TX, BLOCK, BLOCK_TXS };
+    typedef std::pair<uint256, int> Key;
+
+    struct CEntry {
+        std::shared_ptr<const UniValue> json;
+        //! Of transactions, their serialized hex
+        std::string strHex;
+        uint256 hashBlock;
+        size_t nUsage;
+        std::list<Key>::iterator itLRU;
+    };
+
+    CCriticalSection cs;
+    std::list<Key> lruKeys;
+    std::map<Key, CEntry> mapEntries;
+    size_t nUsage;
+    size_t nMaxUsage;
+
+    std::shared_ptr<const UniValue> Get(const Key& key, std::string* pstrHex, uint256* phashBlock);
+    void Put(const Key& key, UniValue&& json, const std::string& strHex, const uint256& hashBlock, size_t nUsageIn);
+    void Erase(std::map<Key, CEntry>::iterator it);
+
+public:
+    CJSONCache() : nUsage(0), nMaxUsage(DEFAULT_RPC_JSON_CACHE_SIZE * 1000000) {}
+
+    //! Limit the cache to about nMaxUsageIn bytes, 0 to keep nothing
+    void SetMaxUsage(size_t nMaxUsageIn);
+    //! Whether an entry of about nUsageIn bytes would be kept
+    bool IsCacheable(size_t nUsageIn);
+
+    //! The JSON of the block hash, with or without the transaction details, if it is cached
+    std::shared_ptr<const UniValue> GetBlock(const uint256& hash, bool fTxDetails);
+    //! Cache the JSON of a block of the active chain, nUsageIn is a rough figure of its size
+    void PutBlock(const uint256& hash, bool fTxDetails, UniValue json, size_t nUsageIn);
+
+    //! The JSON of the transaction txid, if it is cached, with its hex and the hash of its block
+    std::shared_ptr<const UniValue> GetTx(const uint256& txid, std::string& strHex, uint256& hashBlock);
+    //! Cache the JSON of a transaction of the active chain, without the fields of its block
+    void PutTx(const uint256& txid, UniValue json, const std::string& strHex, const uint256& hashBlock, size_t nUsageIn);
+};
+
+extern CJSONCache jsonCache;
+
+#endif // BITCOIN_RPC_JSONCACHE_H
@@ -37,16 +37,18 @@ using namespace std;
 using namespace zen;
 
 /**
- * Return average network hashes per second based on the last 'lookup' blocks,
- * or over the difficulty averaging window if 'lookup' is nonpositive.
- * If 'height' is nonnegative, compute the estimate at the time when a given block was found.
+ * Return average network hashes per second based on the 'lookup' blocks up to
+ * pb, or over the difficulty averaging window if 'lookup' is nonpositive.
+ * Only reads the headers and chain work of pb and its ancestors, which do not
+ * change once they are in the block index, so it does not need cs_main.
  */
-int64_t GetNetworkHashPS(int lookup, int height) {
-    CBlockIndex *pb = chainActive.Tip();
-
-    if (height >= 0 && height < chainActive.Height())
-        pb = chainActive[height];
-
+/**
+ * Return average network hashes per second based on the 'lookup' blocks up to
+ * pb, or over the difficulty averaging window if 'lookup' is nonpositive.
+ * Only reads the headers and chain work of pb and its ancestors, which do not
+ * change once they are in the block index, so it does not need cs_main.
+ */
+static int64_t GetNetworkHashPSAt(const CBlockIndex *pb, int lookup) {
     if (pb == NULL || !pb->nHeight)
         return 0;
 
@@ -58,7 +60,7 @@ int64_t GetNetworkHashPS(int lookup, int height) {
     if (lookup > pb->nHeight)
         lookup = pb->nHeight;
 
-    CBlockIndex *pb0 = pb;
+    const CBlockIndex *pb0 = pb;
     int64_t minTime = pb0->GetBlockTime();
     int64_t maxTime = minTime;
     for (int i = 0; i < lookup; i++) {
@@ -78,22 +80,83 @@ int64_t GetNetworkHashPS(int lookup, int height) {
     return (int64_t)(workDiff.getdouble() / timeDiff);
 }
 
+/**
+ * Return average network hashes per second based on the last 'lookup' blocks,
+ * or over the difficulty averaging window if 'lookup' is nonpositive.
+ * If 'height' is nonnegative, compute the estimate at the time when a given block was found.
+ */
+int64_t GetNetworkHashPS(int lookup, int height) {
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    // The rates at the tip over the default lookup and the averaging window
+    // are kept in the tip snapshot
+    std::shared_ptr<const CChainTipSnapshot> snapshot = GetChainTipSnapshot();
+    if (height < 0 || height >= snapshot->nHeight) {
+        if (lookup == DEFAULT_NETWORK_SOLPS_LOOKUP)
+            return snapshot->nNetworkSolPS;
+        if (lookup <= 0 || lookup == consensusParams.nPowAveragingWindow)
+            return snapshot->nAveragingWindowSolPS;
+    }
+
+    LOCK(cs_main);
+    CBlockIndex *pb = chainActive.Tip();
+
+    if (height >= 0 && height < chainActive.Height())
+        pb = chainActive[height];
+
+    return GetNetworkSolPS(pb, lookup, consensusParams);
+}
+
 UniValue getlocalsolps(const UniValue& params, bool fHelp)
 {
-    if (fHelp)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "getlocalsolps\n"
+            "getlocalsolps ( verbose )\n"
             "\nReturns the average local solutions per second since this node was started.\n"
             "This is the same information shown on the metrics screen (if enabled).\n"
-            "\nResult:\n"
+            "\nArguments:\n"
+            "1. verbose      (boolean, optional, default=false) Also return the rate of each running mining thread\n"
+            "\nResult (for verbose = false):\n"
             "xxx.xxxxx     (numeric) Solutions per second average\n"
+            "\nResult (for verbose = true):\n"
+            "{\n"
+            "  \"solps\": xxx.xxxxx,          (numeric) Solutions per second average\n"
+            "  \"threads\": [                 (array) The running mining threads\n"
+            "    {\n"
+            "      \"id\": n,                 (numeric) Thread number\n"
+            "      \"solver\": \"name\",        (string) Equihash solver used by the thread\n"
+            "      \"solps\": xxx.xxxxx,      (numeric) Solutions per second average of the thread\n"
+            "      \"solverruns\": n,         (numeric) Number of completed solver runs\n"
+            "      \"solutions\": n           (numeric) Number of solutions checked against the target\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getlocalsolps", "")
+            + HelpExampleCli("getlocalsolps", "true")
             + HelpExampleRpc("getlocalsolps", "")
        );
 
     LOCK(cs_main);
-    return GetLocalSolPS();
+    if (params.size() == 0 || !params[0].get_bool())
+        return GetLocalSolPS();
+
+    UniValue threads(UniValue::VARR);
+    for (const std::shared_ptr<MinerThreadMetrics>& metrics : GetMinerThreadMetrics()) {
+        UniValue thread(UniValue::VOBJ);
+        thread.pushKV("id", metrics->id);
+        thread.pushKV("solver", metrics->solver);
+        thread.pushKV("solps", metrics->timer.rate(metrics->solutionTargetChecks));
+        thread.pushKV("solverruns", metrics->ehSolverRuns.get());
+        thread.pushKV("solutions", metrics->solutionTargetChecks.get());
+        threads.push_back(thread);
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("solps", GetLocalSolPS());
+    obj.pushKV("threads", threads);
+    return obj;
 }
 
 UniValue getnetworksolps(const UniValue& params, bool fHelp)
@@ -114,8 +177,7 @@ UniValue getnetworksolps(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getnetworksolps", "")
        );
 
-    LOCK(cs_main);
-    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
+    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : DEFAULT_NETWORK_SOLPS_LOOKUP, params.size() > 1 ? params[1].get_int() : -1);
 }
 
 UniValue getnetworkhashps(const UniValue& params, bool fHelp)
@@ -137,8 +199,7 @@ UniValue getnetworkhashps(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getnetworkhashps", "")
        );
 
-    LOCK(cs_main);
-    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
+    return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : DEFAULT_NETWORK_SOLPS_LOOKUP, params.size() > 1 ? params[1].get_int() : -1);
 }
 
 #ifdef ENABLE_MINING
@@ -316,24 +377,24 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getmininginfo", "")
         );
 
-
-    LOCK(cs_main);
+    // The chain fields come from the tip snapshot, without cs_main
+    std::shared_ptr<const CChainTipSnapshot> snapshot = GetChainTipSnapshot();
 
     UniValue obj(UniValue::VOBJ);
-    obj.pushKV("blocks",           (int)chainActive.Height());
+    obj.pushKV("blocks",           snapshot->nHeight);
     obj.pushKV("currentblocksize", (uint64_t)nLastBlockSize);
     obj.pushKV("currentblocktx",   (uint64_t)nLastBlockTx);
-    obj.pushKV("difficulty",       (double)GetNetworkDifficulty());
+    obj.pushKV("difficulty",       GetDifficultyFromBits(snapshot->nNextBits));
     obj.pushKV("errors",           GetWarnings("statusbar"));
     obj.pushKV("genproclimit",     (int)GetArg("-genproclimit", -1));
-    obj.pushKV("localsolps"  ,     getlocalsolps(params, false));
-    obj.pushKV("networksolps",     getnetworksolps(params, false));
-    obj.pushKV("networkhashps",    getnetworksolps(params, false));
+    obj.pushKV("localsolps"  ,     GetLocalSolPS());
+    obj.pushKV("networksolps",     snapshot->nNetworkSolPS);
+    obj.pushKV("networkhashps",    snapshot->nNetworkSolPS);
     obj.pushKV("pooledtx",         (uint64_t)mempool.size());
     obj.pushKV("testnet",          Params().TestnetToBeDeprecatedFieldRPC());
     obj.pushKV("chain",            Params().NetworkIDString());
 #ifdef ENABLE_MINING
-    obj.pushKV("generate",         getgenerate(params, false));
+    obj.pushKV("generate",         GetBoolArg("-gen", false));
 #endif
     return obj;
 }
@@ -371,6 +432,9 @@ UniValue prioritisetransaction(const UniValue& params, bool fHelp)
 }
 
 
+//! Number of previous templates a "templatediff" request can refer to
+static const size_t MAX_TEMPLATE_DIFF_BASES = 4;
+
 // NOTE: Assumes a conclusive result; if result is inconclusive, it must be handled by caller
 static UniValue BIP22ValidationResult(const CValidationState& state)
 {
@@ -406,7 +470,9 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "       \"capabilities\":[       (array, optional) A list of strings\n"
             "           \"support\"           (string) client side supported feature, 'longpoll', 'coinbasetxn', 'coinbasevalue', 'proposal', 'serverlist', 'workid'\n"
             "           ,...\n"
-            "         ]\n"
+            "         ],\n"
+            "       \"templatediff\":\"id\"   (string, optional) The longpollid of a template the client already has. If it is one of the last\n"
+            "                                 " + strprintf("%u", MAX_TEMPLATE_DIFF_BASES) + " templates, 'transactions' only lists the transactions it lacks\n"
             "     }\n"
             "\n"
 
@@ -428,6 +494,8 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "      }\n"
             "      ,...\n"
             "  ],\n"
+            "  \"txids\" : [ \"xxxx\", ... ],      (array of string) only with 'templatediff': the hashes of all non-coinbase transactions in block order, 'depends' indexes refer to it\n"
+            "  \"removed\" : [ \"xxxx\", ... ],    (array of string) only with 'templatediff': the hashes of the transactions of the base template that are no longer included\n"
 //            "  \"coinbaseaux\" : {                  (json object) data that should be included in the coinbase's scriptSig content\n"
 //            "      \"flags\" : \"flags\"            (string) \n"
 //            "  },\n"
@@ -467,6 +535,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     std::string strMode = "template";
     UniValue lpval = NullUniValue;
+    UniValue diffval = NullUniValue;
     // TODO: Re-enable coinbasevalue once a specification has been written
     bool coinbasetxn = true;
     if (params.size() > 0)
@@ -482,6 +551,9 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         else
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
         lpval = find_value(oparam, "longpollid");
+        diffval = find_value(oparam, "templatediff");
+        if (!diffval.isNull() && !diffval.isStr())
+            throw JSONRPCError(RPC_TYPE_ERROR, "templatediff must be a longpollid string");
 
         if (strMode == "proposal")
         {
@@ -576,6 +648,10 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     static CBlockIndex* pindexPrev;
     static int64_t nStart;
     static CBlockTemplate* pblocktemplate;
+    // Hex encodings of the transactions of pblocktemplate, carried over between templates
+    static map<uint256, std::string> mapTxHex;
+    // Transactions of the last templates handed out, by longpollid
+    static std::list<std::pair<std::string, std::set<uint256> > > lTemplateTxs;
     if (pindexPrev != chainActive.Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
@@ -602,6 +678,17 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
+        map<uint256, std::string> mapTxHexNew;
+        BOOST_FOREACH (const CTransaction& tx, pblocktemplate->block.vtx) {
+            std::string& strHex = mapTxHexNew[tx.GetHash()];
+            map<uint256, std::string>::iterator it = mapTxHex.find(tx.GetHash());
+            if (it != mapTxHex.end())
+                strHex.swap(it->second);
+            else
+                strHex = EncodeHexTx(tx);
+        }
+        mapTxHex.swap(mapTxHexNew);
+
         // Need to update only after we know CreateNewBlockWithKey succeeded
         pindexPrev = pindexPrevNew;
     }
@@ -613,8 +700,29 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
 
     UniValue aCaps(UniValue::VARR); aCaps.push_back("proposal");
 
+    const std::string strLongPollId = chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast);
+    if (lTemplateTxs.empty() || lTemplateTxs.back().first != strLongPollId) {
+        std::set<uint256> setTxs;
+        for (size_t j = 1; j < pblock->vtx.size(); j++)
+            setTxs.insert(pblock->vtx[j].GetHash());
+        lTemplateTxs.push_back(std::make_pair(strLongPollId, std::set<uint256>()));
+        lTemplateTxs.back().second.swap(setTxs);
+        if (lTemplateTxs.size() > MAX_TEMPLATE_DIFF_BASES)
+            lTemplateTxs.pop_front();
+    }
+
+    // The template the client already has, if it asked for a diff against one we still know
+    const std::set<uint256>* psetBaseTxs = NULL;
+    if (diffval.isStr()) {
+        BOOST_FOREACH (const PAIRTYPE(std::string, std::set<uint256>)& item, lTemplateTxs) {
+            if (item.first == diffval.get_str())
+                psetBaseTxs = &item.second;
+        }
+    }
+
     UniValue txCoinbase = NullUniValue;
     UniValue transactions(UniValue::VARR);
+    UniValue txids(UniValue::VARR);
     map<uint256, int64_t> setTxIndex;
     int i = 0;
     BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
@@ -624,9 +732,16 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         if (tx.IsCoinBase() && !coinbasetxn)
             continue;
 
+        if (psetBaseTxs && !tx.IsCoinBase()) {
+            txids.push_back(txHash.GetHex());
+            if (psetBaseTxs->count(txHash))
+                continue;
+        }
+
         UniValue entry(UniValue::VOBJ);
 
-        entry.pushKV("data", EncodeHexTx(tx));
+        map<uint256, std::string>::const_iterator itHex = mapTxHex.find(txHash);
+        entry.pushKV("data", itHex != mapTxHex.end() ? itHex->second : EncodeHexTx(tx));
 
         entry.pushKV("hash", txHash.GetHex());
 
@@ -677,6 +792,15 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.pushKV("version", pblock->nVersion);
     result.pushKV("previousblockhash", pblock->hashPrevBlock.GetHex());
     result.pushKV("transactions", transactions);
+    if (psetBaseTxs) {
+        UniValue removed(UniValue::VARR);
+        BOOST_FOREACH (const uint256& hash, *psetBaseTxs) {
+            if (!setTxIndex.count(hash))
+                removed.push_back(hash.GetHex());
+        }
+        result.pushKV("txids", txids);
+        result.pushKV("removed", removed);
+    }
     if (coinbasetxn) {
         assert(txCoinbase.isObject());
         result.pushKV("coinbasetxn", txCoinbase);
@@ -684,7 +808,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         result.pushKV("coinbaseaux", aux);
         result.pushKV("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue);
     }
-    result.pushKV("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast));
+    result.pushKV("longpollid", strLongPollId);
     result.pushKV("target", hashTarget.GetHex());
     result.pushKV("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1);
     result.pushKV("mutable", aMutable);
@@ -761,6 +885,8 @@ UniValue submitblock(const UniValue& params, bool fHelp)
             // Otherwise, we might only have the header - process the block before returning
             fBlockPresent = true;
         }
+        if (MarkTemplateBlockChecked(block))
+            LogPrint("pow", "submitblock: %s was built on one of our templates\n", hash.ToString());
     }
 
     CValidationState state;
@@ -785,14 +911,16 @@ UniValue submitblock(const UniValue& params, bool fHelp)
 
 UniValue estimatefee(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 1)
+    if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
-            "estimatefee nblocks\n"
+            "estimatefee nblocks ( \"horizon\" )\n"
             "\nEstimates the approximate fee per kilobyte\n"
             "needed for a transaction to begin confirmation\n"
             "within nblocks blocks.\n"
             "\nArguments:\n"
             "1. nblocks     (numeric)\n"
+            "2. \"horizon\"   (string, optional, default=\"medium\") How far back the fees looked at go:\n"
+            "                \"short\" (half-life of 18 blocks), \"medium\" (346 blocks) or \"long\" (3465 blocks)\n"
             "\nResult:\n"
             "n :    (numeric) estimated fee-per-kilobyte\n"
             "\n"
@@ -800,15 +928,27 @@ UniValue estimatefee(const UniValue& params, bool fHelp)
             "blocks have been observed to make an estimate.\n"
             "\nExample:\n"
             + HelpExampleCli("estimatefee", "6")
+            + HelpExampleCli("estimatefee", "6 \"short\"")
             );
 
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM));
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM)(UniValue::VSTR));
 
     int nBlocks = params[0].get_int();
     if (nBlocks < 1)
         nBlocks = 1;
 
-    CFeeRate feeRate = mempool.estimateFee(nBlocks);
+    FeeEstimateHorizon horizon = MEDIUM_HORIZON;
+    if (params.size() > 1) {
+        std::string strHorizon = params[1].get_str();
+        if (strHorizon == "short")
+            horizon = SHORT_HORIZON;
+        else if (strHorizon == "long")
+            horizon = LONG_HORIZON;
+        else if (strHorizon != "medium")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "horizon must be \"short\", \"medium\" or \"long\"");
+    }
+
+    CFeeRate feeRate = mempool.estimateFee(nBlocks, horizon);
     if (feeRate == CFeeRate(0))
         return -1.0;
 
@@ -3,13 +3,18 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addrman.h"
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "notificationdispatcher.h"
 #include "rpc/server.h"
+#include "scheduler.h"
+#include "script/sigcache.h"
+#include "threadpool.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
@@ -41,6 +46,10 @@ using namespace std;
  **/
 UniValue getinfo(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+#endif
+
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getinfo\n"
@@ -69,10 +78,11 @@ UniValue getinfo(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getinfo", "")
         );
 
+    // The chain fields come from the tip snapshot; cs_main is only taken for
+    // the wallet, which needs it before its own lock
+    std::shared_ptr<const CChainTipSnapshot> snapshot = GetChainTipSnapshot();
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
-#else
-    LOCK(cs_main);
+    LOCK2(pwallet ? &cs_main : NULL, pwallet ? &pwallet->cs_wallet : NULL);
 #endif
 
     proxyType proxy;
@@ -82,23 +92,23 @@ UniValue getinfo(const UniValue& params, bool fHelp)
     obj.pushKV("version", CLIENT_VERSION);
     obj.pushKV("protocolversion", PROTOCOL_VERSION);
 #ifdef ENABLE_WALLET
-    if (pwalletMain) {
-        obj.pushKV("walletversion", pwalletMain->GetVersion());
-        obj.pushKV("balance",       ValueFromAmount(pwalletMain->GetBalance()));
+    if (pwallet) {
+        obj.pushKV("walletversion", pwallet->GetVersion());
+        obj.pushKV("balance",       ValueFromAmount(pwallet->GetBalance()));
     }
 #endif
-    obj.pushKV("blocks",        (int)chainActive.Height());
+    obj.pushKV("blocks",        snapshot->nHeight);
     obj.pushKV("timeoffset",    0);
     obj.pushKV("connections",   (int)vNodes.size());
     obj.pushKV("proxy",         (proxy.IsValid() ? proxy.proxy.ToStringIPPort() : string()));
-    obj.pushKV("difficulty",    (double)GetDifficulty());
+    obj.pushKV("difficulty",    GetDifficultyFromBits(snapshot->nBits));
     obj.pushKV("testnet",       Params().TestnetToBeDeprecatedFieldRPC());
 #ifdef ENABLE_WALLET
-    if (pwalletMain) {
-        obj.pushKV("keypoololdest", pwalletMain->GetOldestKeyPoolTime());
-        obj.pushKV("keypoolsize",   (int)pwalletMain->GetKeyPoolSize());
+    if (pwallet) {
+        obj.pushKV("keypoololdest", pwallet->GetOldestKeyPoolTime());
+        obj.pushKV("keypoolsize",   (int)pwallet->GetKeyPoolSize());
     }
-    if (pwalletMain && pwalletMain->IsCrypted())
+    if (pwallet && pwallet->IsCrypted())
         obj.pushKV("unlocked_until", nWalletUnlockTime);
     obj.pushKV("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK()));
 #endif
@@ -116,8 +126,9 @@ public:
     UniValue operator()(const CKeyID &keyID) const {
         UniValue obj(UniValue::VOBJ);
         CPubKey vchPubKey;
+        CWallet* const pwallet = GetWalletForJSONRPCRequest();
         obj.pushKV("isscript", false);
-        if (pwalletMain && pwalletMain->GetPubKey(keyID, vchPubKey)) {
+        if (pwallet && pwallet->GetPubKey(keyID, vchPubKey)) {
             obj.pushKV("pubkey", HexStr(vchPubKey));
             obj.pushKV("iscompressed", vchPubKey.IsCompressed());
         }
@@ -127,8 +138,9 @@ public:
     UniValue operator()(const CScriptID &scriptID) const {
         UniValue obj(UniValue::VOBJ);
         CScript subscript;
+        CWallet* const pwallet = GetWalletForJSONRPCRequest();
         obj.pushKV("isscript", true);
-        if (pwalletMain && pwalletMain->GetCScript(scriptID, subscript)) {
+        if (pwallet && pwallet->GetCScript(scriptID, subscript)) {
             std::vector<CTxDestination> addresses;
             txnouttype whichType;
             int nRequired;
@@ -149,6 +161,10 @@ public:
 
 UniValue validateaddress(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+#endif
+
     if (fHelp || params.size() != 1)
         throw runtime_error(
             "validateaddress \"zcashaddress\"\n"
@@ -172,7 +188,7 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
         );
 
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
+    LOCK2(cs_main, pwallet ? &pwallet->cs_wallet : NULL);
 #else
     LOCK(cs_main);
 #endif
@@ -197,13 +213,13 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
         ret.pushKV("scriptPubKey", HexStr(scriptPubKey.begin(), scriptPubKey.end()));
 
 #ifdef ENABLE_WALLET
-        isminetype mine = pwalletMain ? IsMine(*pwalletMain, dest) : ISMINE_NO;
+        isminetype mine = pwallet ? IsMine(*pwallet, dest) : ISMINE_NO;
         ret.pushKV("ismine", (mine & ISMINE_SPENDABLE) ? true : false);
         ret.pushKV("iswatchonly", (mine & ISMINE_WATCH_ONLY) ? true: false);
         UniValue detail = boost::apply_visitor(DescribeAddressVisitor(), dest);
         ret.pushKVs(detail);
-        if (pwalletMain && pwalletMain->mapAddressBook.count(dest))
-            ret.pushKV("account", pwalletMain->mapAddressBook[dest].name);
+        if (pwallet && pwallet->mapAddressBook.count(dest))
+            ret.pushKV("account", pwallet->mapAddressBook[dest].name);
 #endif
     }
     return ret;
@@ -212,6 +228,10 @@ UniValue validateaddress(const UniValue& params, bool fHelp)
 
 UniValue z_validateaddress(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+#endif
+
     if (fHelp || params.size() != 1)
         throw runtime_error(
             "z_validateaddress \"zaddr\"\n"
@@ -234,7 +254,7 @@ UniValue z_validateaddress(const UniValue& params, bool fHelp)
 
 
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 #else
     LOCK(cs_main);
 #endif
@@ -249,7 +269,7 @@ UniValue z_validateaddress(const UniValue& params, bool fHelp)
         libzcash::PaymentAddress addr = address.Get();
 
 #ifdef ENABLE_WALLET
-        isMine = pwalletMain->HaveSpendingKey(addr);
+        isMine = pwallet->HaveSpendingKey(addr);
 #endif
         payingKey = addr.a_pk.GetHex();
         transmissionKey = addr.pk_enc.GetHex();
@@ -278,6 +298,10 @@ UniValue z_validateaddress(const UniValue& params, bool fHelp)
  */
 CScript _createmultisig_redeemScript(const UniValue& params)
 {
+#ifdef ENABLE_WALLET
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+#endif
+
     int nRequired = params[0].get_int();
     const UniValue& keys = params[1].get_array();
 
@@ -298,14 +322,14 @@ CScript _createmultisig_redeemScript(const UniValue& params)
 #ifdef ENABLE_WALLET
         // Case 1: Bitcoin address and we have full public key:
         CBitcoinAddress address(ks);
-        if (pwalletMain && address.IsValid())
+        if (pwallet && address.IsValid())
         {
             CKeyID keyID;
             if (!address.GetKeyID(keyID))
                 throw runtime_error(
                     strprintf("%s does not refer to a key",ks));
             CPubKey vchPubKey;
-            if (!pwalletMain->GetPubKey(keyID, vchPubKey))
+            if (!pwallet->GetPubKey(keyID, vchPubKey))
                 throw runtime_error(
                     strprintf("no full public key for address %s",ks));
             if (!vchPubKey.IsFullyValid())
@@ -434,6 +458,573 @@ UniValue verifymessage(const UniValue& params, bool fHelp)
     return (pubkey.GetID() == keyID);
 }
 
+/**
+ * Parse the addresses of an address index query: either a single address or
+ * an object with an "addresses" array.
+ */
+static void ParseIndexAddresses(const UniValue& param, std::vector<std::pair<uint8_t, uint160> >& vAddresses)
+{
+    std::vector<UniValue> vStrings;
+    if (param.isStr()) {
+        vStrings.push_back(param);
+    } else if (param.isObject()) {
+        const UniValue& addresses = find_value(param.get_obj(), "addresses");
+        if (!addresses.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Addresses is expected to be an array");
+        vStrings = addresses.getValues();
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Expected an address or an object with an addresses array");
+    }
+
+    BOOST_FOREACH(const UniValue& str, vStrings) {
+        CBitcoinAddress address(str.get_str());
+        uint8_t type;
+        uint160 hash;
+        if (!address.IsValid() || !GetAddressIndexHash(address.Get(), type, hash))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + str.get_str());
+        vAddresses.push_back(std::make_pair(type, hash));
+    }
+}
+
+/** Read the address index entries of the queried addresses, optionally limited to a "start" and "end" height */
+static void ReadIndexAddresses(const UniValue& param, std::vector<std::pair<uint8_t, uint160> >& vAddresses,
+                               std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex)
+{
+    ParseIndexAddresses(param, vAddresses);
+
+    int nStart = 0, nEnd = 0;
+    if (param.isObject()) {
+        const UniValue& start = find_value(param.get_obj(), "start");
+        const UniValue& end = find_value(param.get_obj(), "end");
+        if (start.isNum())
+            nStart = start.get_int();
+        if (end.isNum())
+            nEnd = end.get_int();
+        if (nStart < 0 || nEnd < 0 || (nEnd > 0 && nEnd < nStart))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start or end height");
+    }
+
+    for (size_t i = 0; i < vAddresses.size(); i++) {
+        if (!GetAddressIndex(vAddresses[i].first, vAddresses[i].second, addressIndex, nStart, nEnd))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address (is -addressindex enabled?)");
+    }
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\" | {\"addresses\": [\"address\",...]}\n"
+            "\nReturns the balance of one or more transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string or object, required) An address, or an object with an \"addresses\" array\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\"  (numeric) The current balance in satoshis\n"
+            "  \"received\" (numeric) The total number of satoshis received, including change\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"znXWB3XGptd5S8h4bbsoFmNj3eAU4D4sBaN\"]}'")
+            + HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"znXWB3XGptd5S8h4bbsoFmNj3eAU4D4sBaN\"]}")
+        );
+
+    std::vector<std::pair<uint8_t, uint160> > vAddresses;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    ReadIndexAddresses(params[0], vAddresses, addressIndex);
+
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    for (size_t i = 0; i < addressIndex.size(); i++) {
+        nBalance += addressIndex[i].second;
+        if (addressIndex[i].second > 0)
+            nReceived += addressIndex[i].second;
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("balance", nBalance);
+    result.pushKV("received", nReceived);
+    return result;
+}
+
+UniValue getaddresstxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids \"address\" | {\"addresses\": [\"address\",...], \"start\": n, \"end\": n}\n"
+            "\nReturns the ids of the transactions paying to or spending from transparent addresses, in chain order\n"
+            "(requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string or object, required) An address, or an object with an \"addresses\" array\n"
+            "                   and optional \"start\" and \"end\" block heights\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"transactionid\"  (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"znXWB3XGptd5S8h4bbsoFmNj3eAU4D4sBaN\"]}'")
+            + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"znXWB3XGptd5S8h4bbsoFmNj3eAU4D4sBaN\"]}")
+        );
+
+    std::vector<std::pair<uint8_t, uint160> > vAddresses;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    ReadIndexAddresses(params[0], vAddresses, addressIndex);
+
+    // Merge the entries of all addresses into chain order, once per transaction
+    std::set<std::pair<std::pair<int, uint32_t>, uint256> > setTxids;
+    for (size_t i = 0; i < addressIndex.size(); i++) {
+        const CAddressIndexKey& key = addressIndex[i].first;
+        setTxids.insert(std::make_pair(std::make_pair(key.blockHeight, key.txIndex), key.txhash));
+    }
+
+    UniValue result(UniValue::VARR);
+    result.reserve(setTxids.size());
+    for (std::set<std::pair<std::pair<int, uint32_t>, uint256> >::const_iterator it = setTxids.begin(); it != setTxids.end(); ++it)
+        result.push_back(it->second.GetHex());
+    return result;
+}
+
+UniValue getaddressdeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressdeltas \"address\" | {\"addresses\": [\"address\",...], \"start\": n, \"end\": n}\n"
+            "\nReturns every change to the balance of transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string or object, required) An address, or an object with an \"addresses\" array\n"
+            "                   and optional \"start\" and \"end\" block heights\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"satoshis\"  (numeric) The difference of satoshis, negative for spends\n"
+            "    \"txid\"      (string) The related transaction id\n"
+            "    \"index\"     (numeric) The output index, or the input index for spends\n"
+            "    \"blockindex\" (numeric) The position of the transaction in its block\n"
+            "    \"height\"    (numeric) The block height\n"
+            "    \"address\"   (string) The address\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"znXWB3XGptd5S8h4bbsoFmNj3eAU4D4sBaN\"]}'")
+            + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"znXWB3XGptd5S8h4bbsoFmNj3eAU4D4sBaN\"]}")
+        );
+
+    std::vector<std::pair<uint8_t, uint160> > vAddresses;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    ReadIndexAddresses(params[0], vAddresses, addressIndex);
+
+    UniValue result(UniValue::VARR);
+    result.reserve(addressIndex.size());
+    for (size_t i = 0; i < addressIndex.size(); i++) {
+        const CAddressIndexKey& key = addressIndex[i].first;
+        UniValue delta(UniValue::VOBJ);
+        delta.pushKV("satoshis", addressIndex[i].second);
+        delta.pushKV("txid", key.txhash.GetHex());
+        delta.pushKV("index", (int)key.index);
+        delta.pushKV("blockindex", (int)key.txIndex);
+        delta.pushKV("height", key.blockHeight);
+        delta.pushKV("address", CBitcoinAddress(GetAddressIndexDestination(key.type, key.hashBytes)).ToString());
+        result.push_back(delta);
+    }
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getspentinfo {\"txid\": \"txid\", \"index\": n}\n"
+            "\nReturns the transaction and input that spent an output (requires -spentindex).\n"
+            "\nArguments:\n"
+            "1. {\"txid\": \"txid\", \"index\": n}  (object, required) The output\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\"   (string) The id of the spending transaction\n"
+            "  \"index\"  (numeric) The spending input index\n"
+            "  \"height\" (numeric) The height of the block the spent output was created in\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'")
+            + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}")
+        );
+
+    uint256 txid = ParseHashV(find_value(params[0].get_obj(), "txid"), "txid");
+    const UniValue& index = find_value(params[0].get_obj(), "index");
+    if (!index.isNum() || index.get_int() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid index");
+
+    CSpentIndexValue value;
+    if (!GetSpentIndex(CSpentIndexKey(txid, index.get_int()), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info (unspent output, or is -spentindex disabled?)");
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("txid", value.txid.GetHex());
+    result.pushKV("index", (int)value.inputIndex);
+    result.pushKV("height", value.blockHeight);
+    return result;
+}
+
+UniValue getnotificationinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getnotificationinfo\n"
+            "\nReturns the state of the queue of ZeroMQ and AMQP notifications.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queued\": n,        (numeric) Notifications waiting to be published\n"
+            "  \"peakqueued\": n,    (numeric) Most notifications ever waiting at once\n"
+            "  \"maxqueued\": n,     (numeric) Size of the queue, see -notificationqueue\n"
+            "  \"published\": n,     (numeric) Notifications handed to the publishers\n"
+            "  \"batches\": n,       (numeric) Batches they were handed over in\n"
+            "  \"dropped\": n        (numeric) Notifications dropped because the queue was full\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnotificationinfo", "")
+            + HelpExampleRpc("getnotificationinfo", "")
+        );
+
+    if (!pNotificationDispatcher)
+        throw JSONRPCError(RPC_MISC_ERROR, "No ZeroMQ or AMQP notifications are enabled");
+
+    CNotificationStats stats = pNotificationDispatcher->GetStats();
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("queued", (uint64_t)stats.nQueued);
+    result.pushKV("peakqueued", (uint64_t)stats.nPeakQueued);
+    result.pushKV("maxqueued", (uint64_t)stats.nMaxQueued);
+    result.pushKV("published", stats.nPublished);
+    result.pushKV("batches", stats.nBatches);
+    result.pushKV("dropped", stats.nDropped);
+    return result;
+}
+
+static UniValue LockTimesToJSON(const CLockTimes& times)
+{
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("total_us", times.nTotalMicros);
+    result.pushKV("max_us", times.nMaxMicros);
+    UniValue histogram(UniValue::VARR);
+    for (int i = 0; i < LOCK_PROFILE_BUCKETS; i++)
+        histogram.push_back(times.vBuckets[i]);
+    result.pushKV("histogram", histogram);
+    return result;
+}
+
+UniValue getlockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockstats ( reset )\n"
+            "\nReturns the wait and hold times of the sampled lock acquisitions, by lock, most waited for first.\n"
+            "One in -lockprofile acquisitions of each thread is sampled.\n"
+            "\nArguments:\n"
+            "1. reset       (boolean, optional, default=false) Clear the times after returning them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"interval\": n,           (numeric) One in how many acquisitions is sampled, 0 if disabled\n"
+            "  \"locks\": [\n"
+            "    {\n"
+            "      \"name\": \"name\",       (string) The lock, as named where it is taken\n"
+            "      \"samples\": n,        (numeric) Sampled acquisitions\n"
+            "      \"wait\": {            (object) Time spent waiting for the lock\n"
+            "        \"total_us\": n,     (numeric) Sum of the sampled times, in microseconds\n"
+            "        \"max_us\": n,       (numeric) Longest sampled time, in microseconds\n"
+            "        \"histogram\": [...] (array) Element i counts the times under 2^i microseconds not counted\n"
+            "                               before it, the last one all the longer times\n"
+            "      },\n"
+            "      \"hold\": {...},        (object) Time spent holding the lock, as for wait\n"
+            "      \"sites\": [           (array) Where the lock was taken, most waited for first\n"
+            "        {\n"
+            "          \"site\": \"file:line\", (string) The LOCK statement\n"
+            "          \"samples\": n,\n"
+            "          \"wait_us\": n,      (numeric) Sum of the sampled wait times\n"
+            "          \"max_wait_us\": n,\n"
+            "          \"hold_us\": n,      (numeric) Sum of the sampled hold times\n"
+            "          \"max_hold_us\": n\n"
+            "        }, ...\n"
+            "      ]\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleRpc("getlockstats", "true")
+        );
+
+    bool fReset = params.size() > 0 && params[0].get_bool();
+    std::vector<CLockSiteStats> vSites = GetLockProfile(fReset);
+
+    // Sites of the same lock are added up, the lock being known by its name
+    std::map<std::string, std::pair<CLockTimes, CLockTimes> > mapLocks;
+    for (const CLockSiteStats& site : vSites) {
+        std::pair<CLockTimes, CLockTimes>& times = mapLocks[site.strName];
+        times.first.Add(site.wait);
+        times.second.Add(site.hold);
+    }
+    std::sort(vSites.begin(), vSites.end(), [](const CLockSiteStats& a, const CLockSiteStats& b) {
+        return a.wait.nTotalMicros > b.wait.nTotalMicros;
+    });
+    std::vector<std::pair<std::string, std::pair<CLockTimes, CLockTimes> > > vLocks(mapLocks.begin(), mapLocks.end());
+    std::sort(vLocks.begin(), vLocks.end(), [](const std::pair<std::string, std::pair<CLockTimes, CLockTimes> >& a,
+                                               const std::pair<std::string, std::pair<CLockTimes, CLockTimes> >& b) {
+        return a.second.first.nTotalMicros > b.second.first.nTotalMicros;
+    });
+
+    UniValue locks(UniValue::VARR);
+    for (const auto& lock : vLocks) {
+        if (lock.second.first.nCount == 0)
+            continue;
+        UniValue sites(UniValue::VARR);
+        for (const CLockSiteStats& site : vSites) {
+            if (site.strName != lock.first || site.wait.nCount == 0)
+                continue;
+            UniValue entry(UniValue::VOBJ);
+            entry.pushKV("site", strprintf("%s:%d", site.strFile, site.nLine));
+            entry.pushKV("samples", site.wait.nCount);
+            entry.pushKV("wait_us", site.wait.nTotalMicros);
+            entry.pushKV("max_wait_us", site.wait.nMaxMicros);
+            entry.pushKV("hold_us", site.hold.nTotalMicros);
+            entry.pushKV("max_hold_us", site.hold.nMaxMicros);
+            sites.push_back(entry);
+        }
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("name", lock.first);
+        entry.pushKV("samples", lock.second.first.nCount);
+        entry.pushKV("wait", LockTimesToJSON(lock.second.first));
+        entry.pushKV("hold", LockTimesToJSON(lock.second.second));
+        entry.pushKV("sites", sites);
+        locks.push_back(entry);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("interval", (uint64_t)nLockProfileInterval.load());
+    result.pushKV("locks", locks);
+    return result;
+}
+
+UniValue getthreadpoolinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getthreadpoolinfo\n"
+            "\nReturns the pools of worker threads, where they run and how busy they keep their CPUs.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"name\",        (string) The pool: validation, http, rpc, scheduler or miner\n"
+            "    \"threads\": n,           (numeric) Threads of the pool running now\n"
+            "    \"cpus\": [n, ...],       (array) The CPUs the pool is pinned to, see -threadaffinity; empty if any\n"
+            "    \"cpu_seconds\": n,       (numeric) CPU time used by the threads of the pool so far\n"
+            "    \"thread_seconds\": n,    (numeric) Time the threads of the pool have been running, added up\n"
+            "    \"utilization\": n        (numeric) cpu_seconds over thread_seconds: 1 is a thread always busy\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getthreadpoolinfo", "")
+            + HelpExampleRpc("getthreadpoolinfo", "")
+        );
+
+    UniValue result(UniValue::VARR);
+    for (const CThreadPoolStats& stats : GetThreadPoolStats()) {
+        UniValue cpus(UniValue::VARR);
+        for (int nCPU : stats.vCPUs)
+            cpus.push_back(nCPU);
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("name", stats.strName);
+        entry.pushKV("threads", stats.nThreads);
+        entry.pushKV("cpus", cpus);
+        entry.pushKV("cpu_seconds", stats.dCPUSeconds);
+        entry.pushKV("thread_seconds", stats.dThreadSeconds);
+        entry.pushKV("utilization", stats.dThreadSeconds > 0 ? stats.dCPUSeconds / stats.dThreadSeconds : 0.0);
+        result.push_back(entry);
+    }
+    return result;
+}
+
+UniValue getschedulerinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getschedulerinfo\n"
+            "\nReturns the tasks waiting in the scheduler and how the periodic tasks ran so far.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queued\": n,              (numeric) Tasks waiting to be due\n"
+            "  \"tasks\": [\n"
+            "    {\n"
+            "      \"name\": \"name\",       (string) The task\n"
+            "      \"runs\": n,            (numeric) Times it ran\n"
+            "      \"total_us\": n,        (numeric) Time it ran for in all, in microseconds\n"
+            "      \"max_us\": n,          (numeric) Longest run, in microseconds\n"
+            "      \"max_late_us\": n      (numeric) Longest a run started after it was due, in microseconds\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getschedulerinfo", "")
+            + HelpExampleRpc("getschedulerinfo", "")
+        );
+
+    if (!pschedulerMain)
+        throw JSONRPCError(RPC_MISC_ERROR, "The scheduler is not running");
+
+    boost::chrono::system_clock::time_point first, last;
+    size_t nQueued = pschedulerMain->getQueueInfo(first, last);
+    UniValue tasks(UniValue::VARR);
+    for (const auto& entry : pschedulerMain->getTaskStats()) {
+        UniValue task(UniValue::VOBJ);
+        task.pushKV("name", entry.first);
+        task.pushKV("runs", entry.second.nRuns);
+        task.pushKV("total_us", entry.second.nTotalMicros);
+        task.pushKV("max_us", entry.second.nMaxMicros);
+        task.pushKV("max_late_us", entry.second.nMaxLateMicros);
+        tasks.push_back(task);
+    }
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("queued", (uint64_t)nQueued);
+    result.pushKV("tasks", tasks);
+    return result;
+}
+
+UniValue getmemoryinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmemoryinfo\n"
+            "\nReturns the memory used by each subsystem, in bytes. The figures are estimated from the sizes\n"
+            "of the data structures and leave out allocator overhead and the caches of the databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blockindex\": {\n"
+            "    \"entries\": n,           (numeric) Headers in the block index\n"
+            "    \"usage\": n,             (numeric) Memory used by the block index\n"
+            "    \"solutions\": n          (numeric) The part of usage taken by Equihash solutions\n"
+            "  },\n"
+            "  \"coins\": {\n"
+            "    \"usage\": n,             (numeric) Memory used by the coins cache, anchors and nullifiers apart\n"
+            "    \"limit\": n,             (numeric) Limit of the coins cache now, see -dbcache\n"
+            "    \"backend\": n            (numeric) Coins being flushed, the nullifier filter and anchor trees of the database\n"
+            "  },\n"
+            "  \"shielded\": n,            (numeric) Memory used by the anchors and nullifiers of the coins cache\n"
+            "  \"mempool\": {\n"
+            "    \"transactions\": n,      (numeric) Transactions in the mempool\n"
+            "    \"usage\": n,             (numeric) Memory used by the mempool\n"
+            "    \"limit\": n              (numeric) Limit of the mempool, see -maxmempool\n"
+            "  },\n"
+            "  \"orphans\": {\n"
+            "    \"transactions\": n,      (numeric) Transactions in the orphan pool\n"
+            "    \"usage\": n              (numeric) Memory used by the orphan pool\n"
+            "  },\n"
+            "  \"sigcache\": n,            (numeric) Memory of the signature cache, see -maxsigcachesize\n"
+            "  \"wallets\": {              (object) Memory used by each wallet, by file name\n"
+            "    \"file\": n, ...\n"
+            "  },\n"
+            "  \"addrman\": {\n"
+            "    \"addresses\": n,         (numeric) Addresses known\n"
+            "    \"usage\": n              (numeric) Memory used by the address manager\n"
+            "  },\n"
+            "  \"peers\": {\n"
+            "    \"connections\": n,       (numeric) Connected peers\n"
+            "    \"usage\": n,             (numeric) Memory of the send and receive buffers and relay state of the peers\n"
+            "    \"recvpool\": n           (numeric) Receive buffers kept for reuse\n"
+            "  },\n"
+            "  \"total\": n                (numeric) Sum of the usage above\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmemoryinfo", "")
+            + HelpExampleRpc("getmemoryinfo", "")
+        );
+
+    size_t nTotal = 0;
+    UniValue result(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        size_t nSolutionUsage;
+        size_t nBlockIndexUsage = GetBlockIndexMemoryUsage(nSolutionUsage);
+        UniValue blockindex(UniValue::VOBJ);
+        blockindex.pushKV("entries", (uint64_t)mapBlockIndex.size());
+        blockindex.pushKV("usage", (uint64_t)nBlockIndexUsage);
+        blockindex.pushKV("solutions", (uint64_t)nSolutionUsage);
+        result.pushKV("blockindex", blockindex);
+
+        size_t nShieldedUsage = pcoinsTip->ShieldedMemoryUsage();
+        size_t nCoinsUsage = pcoinsTip->DynamicMemoryUsage() - nShieldedUsage;
+        size_t nBackendUsage = pcoinsTip->BackendMemoryUsage();
+        UniValue coins(UniValue::VOBJ);
+        coins.pushKV("usage", (uint64_t)nCoinsUsage);
+        coins.pushKV("limit", (uint64_t)nCoinCacheUsage);
+        coins.pushKV("backend", (uint64_t)nBackendUsage);
+        result.pushKV("coins", coins);
+        result.pushKV("shielded", (uint64_t)nShieldedUsage);
+        nTotal += nBlockIndexUsage + nCoinsUsage + nBackendUsage + nShieldedUsage;
+    }
+
+    size_t nMempoolUsage = mempool.DynamicMemoryUsage();
+    UniValue pool(UniValue::VOBJ);
+    pool.pushKV("transactions", (uint64_t)mempool.size());
+    pool.pushKV("usage", (uint64_t)nMempoolUsage);
+    pool.pushKV("limit", GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+    result.pushKV("mempool", pool);
+    nTotal += nMempoolUsage;
+
+    size_t nOrphans;
+    size_t nOrphanUsage = GetOrphanPoolMemoryUsage(nOrphans);
+    UniValue orphans(UniValue::VOBJ);
+    orphans.pushKV("transactions", (uint64_t)nOrphans);
+    orphans.pushKV("usage", (uint64_t)nOrphanUsage);
+    result.pushKV("orphans", orphans);
+    nTotal += nOrphanUsage;
+
+    size_t nSigCacheUsage = GetSignatureCacheMemoryUsage();
+    result.pushKV("sigcache", (uint64_t)nSigCacheUsage);
+    nTotal += nSigCacheUsage;
+
+    UniValue wallets(UniValue::VOBJ);
+#ifdef ENABLE_WALLET
+    for (const CWallet* pwallet : vpwallets) {
+        size_t nWalletUsage = pwallet->DynamicMemoryUsage();
+        wallets.pushKV(pwallet->strWalletFile, (uint64_t)nWalletUsage);
+        nTotal += nWalletUsage;
+    }
+#endif
+    result.pushKV("wallets", wallets);
+
+    size_t nAddrManUsage = addrman.DynamicMemoryUsage();
+    UniValue addresses(UniValue::VOBJ);
+    addresses.pushKV("addresses", (uint64_t)addrman.size());
+    addresses.pushKV("usage", (uint64_t)nAddrManUsage);
+    result.pushKV("addrman", addresses);
+    nTotal += nAddrManUsage;
+
+    // Held so that the peers are not deleted while their buffers are counted without cs_vNodes
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
+            pnode->AddRef();
+    }
+    size_t nPeerUsage = 0;
+    for (CNode* pnode : vNodesCopy)
+        nPeerUsage += memusage::MallocUsage(sizeof(CNode)) + pnode->DynamicMemoryUsage();
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodesCopy)
+            pnode->Release();
+    }
+    size_t nRecvPoolUsage = netMessageBufferPool.GetPooledBytes();
+    UniValue peers(UniValue::VOBJ);
+    peers.pushKV("connections", (uint64_t)vNodesCopy.size());
+    peers.pushKV("usage", (uint64_t)nPeerUsage);
+    peers.pushKV("recvpool", (uint64_t)nRecvPoolUsage);
+    result.pushKV("peers", peers);
+    nTotal += nPeerUsage + nRecvPoolUsage;
+
+    result.pushKV("total", (uint64_t)nTotal);
+    return result;
+}
+
 UniValue setmocktime(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -90,6 +90,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"services\":\"xxxxxxxxxxxxxxxx\",   (string) The services offered\n"
             "    \"tls_established\": true:false,     (boolean) Status of TLS connection\n"
             "    \"tls_verified\": true:false,        (boolean) Status of peer certificate. Will be true if a peer certificate can be verified with some trusted root certs \n"
+            "    \"tls_kernel\": true:false,          (boolean) Whether the kernel encrypts the data sent to the peer (-tlsktls)\n"
             "    \"lastsend\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last send\n"
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
@@ -108,7 +109,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"inflightlimit\": n,        (numeric) How many blocks we ask from this peer at once\n"
+            "    \"blocktime\": n,            (numeric) The average time this peer took per block we asked, in milliseconds (0 until known)\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -135,6 +138,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         obj.pushKV("services", strprintf("%016x", stats.nServices));
         obj.pushKV("tls_established", stats.fTLSEstablished);
         obj.pushKV("tls_verified", stats.fTLSVerified);
+        obj.pushKV("tls_kernel", stats.fTLSKernel);
         obj.pushKV("lastsend", stats.nLastSend);
         obj.pushKV("lastrecv", stats.nLastRecv);
         obj.pushKV("bytessent", stats.nSendBytes);
@@ -160,6 +164,8 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.pushKV("inflight", heights);
+            obj.pushKV("inflightlimit", statestats.nBlocksInTransitLimit);
+            obj.pushKV("blocktime", statestats.nAvgBlockTime / 1000);
         }
         obj.pushKV("whitelisted", stats.fWhitelisted);
 
@@ -367,7 +373,16 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"uploadtarget\":\n"
+            "  {\n"
+            "    \"timeframe\": n,                         (numeric) Length of the measuring timeframe in seconds\n"
+            "    \"target\": n,                            (numeric) Target in bytes\n"
+            "    \"target_reached\": true|false,           (boolean) True if target is reached\n"
+            "    \"serve_historical_blocks\": true|false,  (boolean) True if serving historical blocks\n"
+            "    \"bytes_left_in_cycle\": t,               (numeric) Bytes left in current time cycle\n"
+            "    \"time_left_in_cycle\": t                 (numeric) Seconds left in current time cycle\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getnettotals", "")
@@ -378,6 +393,15 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     obj.pushKV("totalbytesrecv", CNode::GetTotalBytesRecv());
     obj.pushKV("totalbytessent", CNode::GetTotalBytesSent());
     obj.pushKV("timemillis", GetTimeMillis());
+
+    UniValue outboundLimit(UniValue::VOBJ);
+    outboundLimit.pushKV("timeframe", CNode::GetMaxOutboundTimeframe());
+    outboundLimit.pushKV("target", CNode::GetMaxOutboundTarget());
+    outboundLimit.pushKV("target_reached", CNode::OutboundTargetReached(false));
+    outboundLimit.pushKV("serve_historical_blocks", !CNode::OutboundTargetReached(true));
+    outboundLimit.pushKV("bytes_left_in_cycle", CNode::GetOutboundTargetBytesLeft());
+    outboundLimit.pushKV("time_left_in_cycle", CNode::GetMaxOutboundTimeLeftInCycle());
+    obj.pushKV("uploadtarget", outboundLimit);
     return obj;
 }
 
@@ -12,6 +12,7 @@
 #include "merkleblock.h"
 #include "net.h"
 #include "primitives/transaction.h"
+#include "rpc/jsoncache.h"
 #include "rpc/server.h"
 #include "script/script.h"
 #include "script/script_error.h"
@@ -23,6 +24,7 @@
 #endif
 
 #include <stdint.h>
+#include <thread>
 
 #include <boost/assign/list_of.hpp>
 
@@ -112,7 +114,8 @@ UniValue TxJoinSplitToJSON(const CTransaction& tx) {
     return vjoinsplit;
 }
 
-void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+/** The fields of TxToJSON of the transaction itself */
+static void TxBodyToJSON(const CTransaction& tx, UniValue& entry)
 {
     entry.pushKV("txid", tx.GetHash().GetHex());
     entry.pushKV("version", tx.nVersion);
@@ -150,7 +153,11 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
     UniValue vjoinsplit = TxJoinSplitToJSON(tx);
     entry.pushKV("vjoinsplit", vjoinsplit);
+}
 
+/** The fields of TxToJSON of the block of the transaction, which change as the chain grows */
+static void TxBlockToJSON(const uint256& hashBlock, UniValue& entry)
+{
     if (!hashBlock.IsNull()) {
         entry.pushKV("blockhash", hashBlock.GetHex());
         BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
@@ -167,6 +174,52 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
     }
 }
 
+void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
+{
+    TxBodyToJSON(tx, entry);
+    TxBlockToJSON(hashBlock, entry);
+}
+
+/** TxToJSON from the fields the JSON cache keeps, with the "hex" first if fHex */
+static void TxCachedToJSON(const UniValue& cached, const std::string& strHex, const uint256& hashBlock, bool fHex, UniValue& entry)
+{
+    if (fHex)
+        entry.pushKV("hex", strHex);
+    entry.pushKVs(cached);
+    TxBlockToJSON(hashBlock, entry);
+}
+
+/**
+ * TxToJSON of the transaction txid if the JSON cache has it, with the "hex"
+ * first if fHex. cs_main must be held.
+ */
+bool TxToJSONFromCache(const uint256& txid, bool fHex, UniValue& entry)
+{
+    std::string strHex;
+    uint256 hashBlock;
+    std::shared_ptr<const UniValue> cached = jsonCache.GetTx(txid, strHex, hashBlock);
+    if (!cached)
+        return false;
+    TxCachedToJSON(*cached, strHex, hashBlock, fHex, entry);
+    return true;
+}
+
+/**
+ * TxToJSON of a transaction read with its hex, with the "hex" first if fHex,
+ * keeping it in the JSON cache if its block is in the active chain. cs_main
+ * must be held.
+ */
+void TxToJSONAndCache(const CTransaction& tx, const std::string& strHex, const uint256& hashBlock, bool fHex, UniValue& entry)
+{
+    UniValue body(UniValue::VOBJ);
+    TxBodyToJSON(tx, body);
+    TxCachedToJSON(body, strHex, hashBlock, fHex, entry);
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+    if (!hashBlock.IsNull() && mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+        jsonCache.PutTx(tx.GetHash(), std::move(body), strHex, hashBlock, 512 + strHex.size() * 4);
+}
+
 UniValue getrawtransaction(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -267,22 +320,176 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
-    CTransaction tx;
+    UniValue result(UniValue::VOBJ);
+    if (fVerbose && TxToJSONFromCache(hash, true, result))
+        return result;
+
+    // Served as stored, the transaction is only deserialized to be described
+    std::string strTx;
     uint256 hashBlock;
-    if (!GetTransaction(hash, tx, hashBlock, true))
+    if (!GetRawTransaction(hash, strTx, hashBlock, true))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
 
-    string strHex = EncodeHexTx(tx);
+    string strHex = HexStr(strTx.begin(), strTx.end());
 
     if (!fVerbose)
         return strHex;
 
-    UniValue result(UniValue::VOBJ);
-    result.pushKV("hex", strHex);
-    TxToJSON(tx, hashBlock, result);
+    CTransaction tx;
+    try {
+        CDataStream ssTx(strTx.data(), strTx.data() + strTx.size(), SER_NETWORK, PROTOCOL_VERSION);
+        ssTx >> tx;
+    } catch (const std::exception&) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Cannot deserialize the transaction");
+    }
+
+    TxToJSONAndCache(tx, strHex, hashBlock, true, result);
     return result;
 }
 
+UniValue getrawtransactions(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getrawtransactions [\"txid\",...] ( verbose )\n"
+            "\nReturn the raw transaction data of several transactions, as getrawtransaction does for one.\n"
+            "The transactions found in the transaction index are read in the order they are stored in,\n"
+            "which is much faster than one getrawtransaction call each.\n"
+
+            "\nArguments:\n"
+            "1. [\"txid\",...]  (array, required) The transaction ids\n"
+            "2. verbose         (numeric, optional, default=0) If 0, return strings, other return json objects\n"
+
+            "\nResult:\n"
+            "[                 (array) In the order of the txids, null for those not found\n"
+            "  \"data\"          (string) If verbose is 0, as getrawtransaction returns it\n"
+            "  {...}           (json object) If verbose is non-zero, as getrawtransaction returns it\n"
+            "  ,...\n"
+            "]\n"
+
+            "\nExamples:\n"
+            + HelpExampleCli("getrawtransactions", "\"[\\\"mytxid\\\",\\\"othertxid\\\"]\"")
+            + HelpExampleRpc("getrawtransactions", "[\"mytxid\",\"othertxid\"], 1")
+        );
+    LOCK(cs_main);
+
+    const UniValue& txids = params[0].get_array();
+    std::vector<uint256> vHash;
+    vHash.reserve(txids.size());
+    for (size_t idx = 0; idx < txids.size(); idx++)
+        vHash.push_back(ParseHashV(txids[idx], "txid"));
+
+    bool fVerbose = false;
+    if (params.size() > 1)
+        fVerbose = (params[1].get_int() != 0);
+
+    // Described from the JSON cache, the cached ones need not be read
+    std::vector<UniValue> vCached(vHash.size());
+    std::vector<uint256> vHashRead;
+    if (fVerbose) {
+        for (size_t i = 0; i < vHash.size(); i++) {
+            UniValue entry(UniValue::VOBJ);
+            if (TxToJSONFromCache(vHash[i], true, entry))
+                vCached[i] = entry;
+            else
+                vHashRead.push_back(vHash[i]);
+        }
+    } else {
+        vHashRead = vHash;
+    }
+
+    std::vector<std::string> vTxRead;
+    std::vector<uint256> vHashBlockRead;
+    GetRawTransactions(vHashRead, vTxRead, vHashBlockRead, true);
+
+    UniValue result(UniValue::VARR);
+    size_t nRead = 0;
+    for (size_t i = 0; i < vHash.size(); i++) {
+        if (!vCached[i].isNull()) {
+            result.push_back(vCached[i]);
+            continue;
+        }
+        const std::string& strTx = vTxRead[nRead];
+        const uint256& hashBlock = vHashBlockRead[nRead];
+        nRead++;
+        if (strTx.empty()) {
+            result.push_back(NullUniValue);
+            continue;
+        }
+        string strHex = HexStr(strTx.begin(), strTx.end());
+        if (!fVerbose) {
+            result.push_back(strHex);
+            continue;
+        }
+        CTransaction tx;
+        try {
+            CDataStream ssTx(strTx.data(), strTx.data() + strTx.size(), SER_NETWORK, PROTOCOL_VERSION);
+            ssTx >> tx;
+        } catch (const std::exception&) {
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Cannot deserialize the transaction");
+        }
+        UniValue entry(UniValue::VOBJ);
+        TxToJSONAndCache(tx, strHex, hashBlock, true, entry);
+        result.push_back(entry);
+    }
+    return result;
+}
+
+/**
+ * The block of a transaction, from the coins of its unspent outputs or the
+ * transaction index. cs_main must be held.
+ */
+static CBlockIndex* FindTxBlock(const uint256& txid)
+{
+    CCoins coins;
+    if (pcoinsTip->GetCoins(txid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
+        return chainActive[coins.nHeight];
+
+    CTransaction tx;
+    uint256 hashBlock;
+    if (!GetTransaction(txid, tx, hashBlock, false) || hashBlock.IsNull())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not yet in block");
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi == mapBlockIndex.end())
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Transaction index corrupt");
+    return mi->second;
+}
+
+//! The txids of a JSON array, which must not repeat
+static set<uint256> ParseTxids(const UniValue& txids)
+{
+    set<uint256> setTxids;
+    for (size_t idx = 0; idx < txids.size(); idx++) {
+        const UniValue& txid = txids[idx];
+        if (txid.get_str().length() != 64 || !IsHex(txid.get_str()))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid txid ")+txid.get_str());
+        uint256 hash(uint256S(txid.get_str()));
+        if (!setTxids.insert(hash).second)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated txid: ")+txid.get_str());
+    }
+    return setTxids;
+}
+
+//! Serialize the proof of some transactions of a block, all of which must be in it
+static std::string GetTxOutProof(const CBlockIndex* pblockindex, const set<uint256>& setTxids)
+{
+    CBlock block;
+    if(!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    unsigned int ntxFound = 0;
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        if (setTxids.count(tx.GetHash()))
+            ntxFound++;
+    if (ntxFound != setTxids.size())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "(Not all) transactions not found in specified block");
+
+    CDataStream ssMB(SER_NETWORK, PROTOCOL_VERSION);
+    CMerkleBlock mb(block, setTxids);
+    ssMB << mb;
+    return HexStr(ssMB.begin(), ssMB.end());
+}
+
 UniValue gettxoutproof(const UniValue& params, bool fHelp)
 {
     if (fHelp || (params.size() != 1 && params.size() != 2))
@@ -305,63 +512,99 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
             "\"data\"           (string) A string that is a serialized, hex-encoded data for the proof.\n"
         );
 
-    set<uint256> setTxids;
-    uint256 oneTxid;
-    UniValue txids = params[0].get_array();
-    for (size_t idx = 0; idx < txids.size(); idx++) {
-        const UniValue& txid = txids[idx];
-        if (txid.get_str().length() != 64 || !IsHex(txid.get_str()))
-            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid txid ")+txid.get_str());
-        uint256 hash(uint256S(txid.get_str()));
-        if (setTxids.count(hash))
-            throw JSONRPCError(RPC_INVALID_PARAMETER, string("Invalid parameter, duplicated txid: ")+txid.get_str());
-       setTxids.insert(hash);
-       oneTxid = hash;
-    }
+    set<uint256> setTxids = ParseTxids(params[0].get_array());
+    if (setTxids.empty())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, no txids");
+    // The block of the last of them, as they were listed, is looked up
+    uint256 oneTxid(uint256S(params[0].get_array()[params[0].size() - 1].get_str()));
 
     LOCK(cs_main);
 
     CBlockIndex* pblockindex = NULL;
-
-    uint256 hashBlock;
     if (params.size() > 1)
     {
-        hashBlock = uint256S(params[1].get_str());
+        uint256 hashBlock = uint256S(params[1].get_str());
         if (!mapBlockIndex.count(hashBlock))
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
     } else {
-        CCoins coins;
-        if (pcoinsTip->GetCoins(oneTxid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
-            pblockindex = chainActive[coins.nHeight];
+        pblockindex = FindTxBlock(oneTxid);
     }
 
-    if (pblockindex == NULL)
-    {
-        CTransaction tx;
-        if (!GetTransaction(oneTxid, tx, hashBlock, false) || hashBlock.IsNull())
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not yet in block");
-        if (!mapBlockIndex.count(hashBlock))
-            throw JSONRPCError(RPC_INTERNAL_ERROR, "Transaction index corrupt");
-        pblockindex = mapBlockIndex[hashBlock];
-    }
+    return GetTxOutProof(pblockindex, setTxids);
+}
 
-    CBlock block;
-    if(!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+UniValue gettxoutproofs(const UniValue& params, bool fHelp)
+{
+    if (fHelp || (params.size() != 1 && params.size() != 2))
+        throw runtime_error(
+            "gettxoutproofs [\"txid\",...] ( blockhash )\n"
+            "\nReturns hex-encoded proofs that transactions were included in blocks, one per block\n"
+            "with all the given transactions of that block, each block being read once.\n"
+            "\nThe blocks are found as by gettxoutproof, for each transaction on its own: from an\n"
+            "unspent output of the transaction, or with -txindex.\n"
+            "\nArguments:\n"
+            "1. \"txids\"       (string) A json array of txids to prove\n"
+            "    [\n"
+            "      \"txid\"     (string) A transaction hash\n"
+            "      ,...\n"
+            "    ]\n"
+            "2. \"block hash\"  (string, optional) If specified, looks for all the txids in the block with this hash\n"
+            "\nResult:\n"
+            "[                      (array of json objects) The proofs, in the order of the heights of their blocks\n"
+            "  {\n"
+            "    \"blockhash\" : \"hash\",  (string) The block of the proof\n"
+            "    \"txids\" : [\"txid\",...], (array of strings) The given transactions of the block\n"
+            "    \"proof\" : \"data\"       (string) The proof, as returned by gettxoutproof for those transactions\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettxoutproofs", "\"[\\\"mytxid\\\",...]\"")
+            + HelpExampleRpc("gettxoutproofs", "[\"mytxid\",...]")
+        );
 
-    unsigned int ntxFound = 0;
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-        if (setTxids.count(tx.GetHash()))
-            ntxFound++;
-    if (ntxFound != setTxids.size())
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "(Not all) transactions not found in specified block");
+    set<uint256> setTxids = ParseTxids(params[0].get_array());
 
-    CDataStream ssMB(SER_NETWORK, PROTOCOL_VERSION);
-    CMerkleBlock mb(block, setTxids);
-    ssMB << mb;
-    std::string strHex = HexStr(ssMB.begin(), ssMB.end());
-    return strHex;
+    LOCK(cs_main);
+
+    // Group the transactions by block
+    std::map<CBlockIndex*, set<uint256> > mapBlockTxids;
+    if (params.size() > 1)
+    {
+        uint256 hashBlock = uint256S(params[1].get_str());
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        if (!setTxids.empty())
+            mapBlockTxids[mi->second] = setTxids;
+    } else {
+        for (const uint256& txid : setTxids) {
+            try {
+                mapBlockTxids[FindTxBlock(txid)].insert(txid);
+            } catch (const UniValue& objError) {
+                throw JSONRPCError(find_value(objError, "code").get_int(), find_value(objError, "message").get_str() + ": " + txid.GetHex());
+            }
+        }
+    }
+
+    std::vector<std::pair<CBlockIndex*, set<uint256> > > vBlockTxids(mapBlockTxids.begin(), mapBlockTxids.end());
+    std::sort(vBlockTxids.begin(), vBlockTxids.end(), [](const std::pair<CBlockIndex*, set<uint256> >& a, const std::pair<CBlockIndex*, set<uint256> >& b) {
+        return a.first->nHeight < b.first->nHeight;
+    });
+
+    UniValue result(UniValue::VARR);
+    for (const std::pair<CBlockIndex*, set<uint256> >& blockTxids : vBlockTxids) {
+        UniValue txids(UniValue::VARR);
+        for (const uint256& txid : blockTxids.second)
+            txids.push_back(txid.GetHex());
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("blockhash", blockTxids.first->GetBlockHash().GetHex());
+        entry.pushKV("txids", txids);
+        entry.pushKV("proof", GetTxOutProof(blockTxids.first, blockTxids.second));
+        result.push_back(entry);
+    }
+    return result;
 }
 
 UniValue verifytxoutproof(const UniValue& params, bool fHelp)
@@ -397,6 +640,54 @@ UniValue verifytxoutproof(const UniValue& params, bool fHelp)
     return res;
 }
 
+UniValue verifytxoutproofs(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "verifytxoutproofs [\"proof\",...]\n"
+            "\nVerifies proofs as verifytxoutproof does, returning the transactions each commits to\n"
+            "and throwing an RPC error if the block of one of them is not in our best chain\n"
+            "\nArguments:\n"
+            "1. \"proofs\"    (array, required) The hex-encoded proofs generated by gettxoutproof or gettxoutproofs\n"
+            "\nResult:\n"
+            "[                  (array) For each proof in order, as verifytxoutproof returns for it\n"
+            "  [\"txid\",...]    (array, strings) The txid(s) which the proof commits to, or empty array if it is invalid\n"
+            "  ,...\n"
+            "]\n"
+        );
+
+    // The proofs are checked without cs_main, which is taken once to find
+    // their blocks
+    UniValue proofs = params[0].get_array();
+    std::vector<CBlockHeader> vHeaders(proofs.size());
+    std::vector<vector<uint256> > vMatches(proofs.size());
+    std::vector<bool> vValid(proofs.size());
+    for (size_t i = 0; i < proofs.size(); i++) {
+        CDataStream ssMB(ParseHexV(proofs[i], "proof"), SER_NETWORK, PROTOCOL_VERSION);
+        CMerkleBlock merkleBlock;
+        ssMB >> merkleBlock;
+        vHeaders[i] = merkleBlock.header;
+        vValid[i] = merkleBlock.txn.ExtractMatches(vMatches[i]) == merkleBlock.header.hashMerkleRoot;
+    }
+
+    UniValue result(UniValue::VARR);
+
+    LOCK(cs_main);
+
+    for (size_t i = 0; i < proofs.size(); i++) {
+        UniValue res(UniValue::VARR);
+        if (vValid[i]) {
+            BlockMap::iterator mi = mapBlockIndex.find(vHeaders[i].GetHash());
+            if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("Block of proof %u not found in chain", i));
+            for (const uint256& hash : vMatches[i])
+                res.push_back(hash.GetHex());
+        }
+        result.push_back(res);
+    }
+    return result;
+}
+
 UniValue createrawtransaction(const UniValue& params, bool fHelp)
 {   
     if (fHelp || params.size() != 2)
@@ -624,6 +915,10 @@ static void TxInErrorToJSON(const CTxIn& txin, UniValue& vErrorsRet, const std::
 
 UniValue signrawtransaction(const UniValue& params, bool fHelp)
 {
+#ifdef ENABLE_WALLET
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+#endif
+
     if (fHelp || params.size() < 1 || params.size() > 4)
         throw runtime_error(
             "signrawtransaction \"hexstring\" ( [{\"txid\":\"id\",\"vout\":n,\"scriptPubKey\":\"hex\",\"redeemScript\":\"hex\"},...] [\"privatekey1\",...] sighashtype )\n"
@@ -683,7 +978,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         );
 
 #ifdef ENABLE_WALLET
-    LOCK2(cs_main, pwalletMain ? &pwalletMain->cs_wallet : NULL);
+    LOCK2(cs_main, pwallet ? &pwallet->cs_wallet : NULL);
 #else
     LOCK(cs_main);
 #endif
@@ -746,7 +1041,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         }
     }
 #ifdef ENABLE_WALLET
-    else if (pwalletMain)
+    else if (pwallet)
         EnsureWalletIsUnlocked();
 #endif
 
@@ -800,7 +1095,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     }
 
 #ifdef ENABLE_WALLET
-    const CKeyStore& keystore = ((fGivenKeys || !pwalletMain) ? tempKeystore : *pwalletMain);
+    const CKeyStore& keystore = ((fGivenKeys || !pwallet) ? tempKeystore : *pwallet);
 #else
     const CKeyStore& keystore = tempKeystore;
 #endif
@@ -828,29 +1123,58 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     // Script verification errors
     UniValue vErrors(UniValue::VARR);
 
-    // Sign what we can:
+    // The scripts being spent, or NULL for inputs not found
+    vector<const CScript*> vPrevPubKeys(mergedTx.vin.size());
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
-        CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
-            TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
-            continue;
-        }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-
-        txin.scriptSig.clear();
-        // Only sign SIGHASH_SINGLE if there's a corresponding output:
-        if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+        const CCoins* coins = view.AccessCoins(mergedTx.vin[i].prevout.hash);
+        if (coins != NULL && coins->IsAvailable(mergedTx.vin[i].prevout.n))
+            vPrevPubKeys[i] = &coins->vout[mergedTx.vin[i].prevout.n].scriptPubKey;
+    }
 
-        // ... and merge in other signatures:
-        BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
-            txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
-        }
-        ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, STANDARD_NONCONTEXTUAL_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&mergedTx, i), &serror)) {
-            TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
+    // Sign what we can. The signature hash of an input blanks the scripts of
+    // all others, so every input is signed and checked against one copy of
+    // the transaction taken before signing, sharing its precomputed parts,
+    // and runs of inputs are signed on threads of their own.
+    const CTransaction txConst(mergedTx);
+    const PrecomputedTransactionData txdata(txConst);
+    vector<string> vInputErrors(mergedTx.vin.size());
+    auto signInputs = [&](unsigned int nBegin, unsigned int nEnd) {
+        for (unsigned int i = nBegin; i < nEnd; i++) {
+            if (vPrevPubKeys[i] == NULL) {
+                vInputErrors[i] = "Input not found or already spent";
+                continue;
+            }
+            const CScript& prevPubKey = *vPrevPubKeys[i];
+            CScript& scriptSig = mergedTx.vin[i].scriptSig;
+
+            scriptSig.clear();
+            // Only sign SIGHASH_SINGLE if there's a corresponding output:
+            if (!fHashSingle || (i < mergedTx.vout.size()))
+                ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, nHashType, &txdata), prevPubKey, scriptSig);
+
+            // ... and merge in other signatures:
+            const TransactionSignatureChecker checker(&txConst, i, nullptr, &txdata);
+            BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
+                scriptSig = CombineSignatures(prevPubKey, checker, scriptSig, txv.vin[i].scriptSig);
+            }
+            ScriptError serror = SCRIPT_ERR_OK;
+            if (!VerifyScript(scriptSig, prevPubKey, STANDARD_NONCONTEXTUAL_SCRIPT_VERIFY_FLAGS, checker, &serror)) {
+                vInputErrors[i] = ScriptErrorString(serror);
+            }
         }
+    };
+    unsigned int nThreads = std::min((unsigned int) std::max(GetNumCores(), 1), (unsigned int) mergedTx.vin.size() / MIN_SIGNATURE_INPUTS_PER_THREAD);
+    nThreads = std::max(nThreads, 1U);
+    vector<std::thread> threads;
+    for (unsigned int n = 1; n < nThreads; n++)
+        threads.emplace_back(signInputs, mergedTx.vin.size() * n / nThreads, mergedTx.vin.size() * (n + 1) / nThreads);
+    signInputs(0, mergedTx.vin.size() / nThreads);
+    for (std::thread& t : threads)
+        t.join();
+
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
+        if (!vInputErrors[i].empty())
+            TxInErrorToJSON(mergedTx.vin[i], vErrors, vInputErrors[i]);
     }
     bool fComplete = vErrors.empty();
 
@@ -887,7 +1211,6 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("sendrawtransaction", "\"signedhex\"")
         );
 
-    LOCK(cs_main);
     RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL));
 
     // parse hex string from parameter
@@ -896,6 +1219,11 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX decode failed");
     uint256 hashTx = tx.GetHash();
 
+    // Proofs that do not verify are reported by AcceptToMemoryPool below
+    PreVerifyJoinSplitProofs(tx);
+
+    LOCK(cs_main);
+
     bool fOverrideFees = false;
     if (params.size() > 1)
         fOverrideFees = params[1].get_bool();
@@ -921,7 +1249,7 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     } else if (fHaveChain) {
         throw JSONRPCError(RPC_TRANSACTION_ALREADY_IN_CHAIN, "transaction already in block chain");
     }
-    RelayTransaction(tx);
+    RelayMempoolTransaction(tx);
 
     return hashTx.GetHex();
 }
@@ -7,6 +7,7 @@
 
 #include "base58.h"
 #include "init.h"
+#include "metrics.h"
 #include "random.h"
 #include "sync.h"
 #include "ui_interface.h"
@@ -14,6 +15,7 @@
 #include "utilstrencodings.h"
 #include "asyncrpcqueue.h"
 
+#include <atomic>
 #include <memory>
 
 #include <univalue.h>
@@ -35,6 +37,7 @@ static bool fRPCRunning = false;
 static bool fRPCInWarmup = true;
 static std::string rpcWarmupStatus("RPC server started");
 static CCriticalSection cs_rpcWarmup;
+static thread_local std::string strRequestURI;
 /* Timer-creating functions */
 static std::vector<RPCTimerInterface*> timerInterfaces;
 /* Map of name to timer.
@@ -255,160 +258,189 @@ UniValue stop(const UniValue& params, bool fHelp)
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         okSafeMode  okParallel
+  //  --------------------- ------------------------  -----------------------  ----------  ----------
     /* Overall control/query calls */
-    { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
-    { "control",            "help",                   &help,                   true  },
-    { "control",            "stop",                   &stop,                   true  },
-    { "control",            "dbg_log",                &dbg_log,                true  },
+    { "control",            "getinfo",                &getinfo,                true,  false }, /* uses wallet if enabled */
+    { "control",            "help",                   &help,                   true,  false },
+    { "control",            "stop",                   &stop,                   true,  false },
+    { "control",            "dbg_log",                &dbg_log,                true,  false },
+    { "control",            "getnotificationinfo",    &getnotificationinfo,    true,  true  },
+    { "control",            "getlockstats",           &getlockstats,           true,  true  },
+    { "control",            "getthreadpoolinfo",      &getthreadpoolinfo,      true,  true  },
+    { "control",            "getschedulerinfo",       &getschedulerinfo,       true,  true  },
+    { "control",            "getmemoryinfo",          &getmemoryinfo,          true,  true  },
 
     /* P2P networking */
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
-    { "network",            "addnode",                &addnode,                true  },
-    { "network",            "disconnectnode",         &disconnectnode,         true  },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
-    { "network",            "getconnectioncount",     &getconnectioncount,     true  },
-    { "network",            "getnettotals",           &getnettotals,           true  },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true  },
-    { "network",            "ping",                   &ping,                   true  },
-    { "network",            "setban",                 &setban,                 true  },
-    { "network",            "listbanned",             &listbanned,             true  },
-    { "network",            "clearbanned",            &clearbanned,            true  },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  false },
+    { "network",            "addnode",                &addnode,                true,  false },
+    { "network",            "disconnectnode",         &disconnectnode,         true,  false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  false },
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,  true  },
+    { "network",            "getnettotals",           &getnettotals,           true,  false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,  false },
+    { "network",            "ping",                   &ping,                   true,  false },
+    { "network",            "setban",                 &setban,                 true,  false },
+    { "network",            "listbanned",             &listbanned,             true,  false },
+    { "network",            "clearbanned",            &clearbanned,            true,  false },
 
     /* Block chain and UTXO */
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
-    { "blockchain",         "getblockcount",          &getblockcount,          true  },
-    { "blockchain",         "getblock",               &getblock,               true  },
-    { "blockchain",         "getblockhash",           &getblockhash,           true  },
-    { "blockchain",         "getblockfinalityindex",  &getblockfinalityindex,  true  },
-    { "blockchain",         "getglobaltips",          &getglobaltips,          true  },
-    { "blockchain",         "getblockheader",         &getblockheader,         true  },
-    { "blockchain",         "getchaintips",           &getchaintips,           true  },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
-    { "blockchain",         "gettxout",               &gettxout,               true  },
-    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
-    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
-    { "blockchain",         "verifychain",            &verifychain,            true  },
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  true  },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  true  },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,  true  },
+    { "blockchain",         "getblock",               &getblock,               true,  true  },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,  true  },
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true,  true  },
+    { "blockchain",         "getblockfinalityindex",  &getblockfinalityindex,  true,  false },
+    { "blockchain",         "getglobaltips",          &getglobaltips,          true,  false },
+    { "blockchain",         "getblockheader",         &getblockheader,         true,  true  },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,  false },
+    { "blockchain",         "getblockconnectstats",   &getblockconnectstats,   true,  true  },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,  true  },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  true  },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,  true  },
+    { "blockchain",         "gettxout",               &gettxout,               true,  true  },
+    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,  true  },
+    { "blockchain",         "gettxoutproofs",         &gettxoutproofs,         true,  true  },
+    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true,  true  },
+    { "blockchain",         "verifytxoutproofs",      &verifytxoutproofs,      true,  true  },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,  false },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           true,  false },
+    { "blockchain",         "verifychain",            &verifychain,            true,  false },
+    { "blockchain",         "compactdb",              &compactdb,              true,  false },
 
     /* Mining */
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true  },
-    { "mining",             "getmininginfo",          &getmininginfo,          true  },
-    { "mining",             "getlocalsolps",          &getlocalsolps,          true  },
-    { "mining",             "getnetworksolps",        &getnetworksolps,        true  },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true  },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true  },
-    { "mining",             "submitblock",            &submitblock,            true  },
-    { "mining",             "getblocksubsidy",        &getblocksubsidy,        true  },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,  false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,  false },
+    { "mining",             "getlocalsolps",          &getlocalsolps,          true,  false },
+    { "mining",             "getnetworksolps",        &getnetworksolps,        true,  false },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,  false },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,  false },
+    { "mining",             "submitblock",            &submitblock,            true,  false },
+    { "mining",             "getblocksubsidy",        &getblocksubsidy,        true,  false },
 
 #ifdef ENABLE_MINING
     /* Coin generation */
-    { "generating",         "getgenerate",            &getgenerate,            true  },
-    { "generating",         "setgenerate",            &setgenerate,            true  },
-    { "generating",         "generate",               &generate,               true  },
+    { "generating",         "getgenerate",            &getgenerate,            true,  false },
+    { "generating",         "setgenerate",            &setgenerate,            true,  false },
+    { "generating",         "generate",               &generate,               true,  false },
 #endif
 
     /* Raw transactions */
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true  },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
-    { "rawtransactions",    "decodescript",           &decodescript,           true  },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
-    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
-    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,  false },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,  true  },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,  true  },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,  true  },
+    { "rawtransactions",    "getrawtransactions",     &getrawtransactions,     true,  true  },
+    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false, false },
+    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false, false }, /* uses wallet if enabled */
 #ifdef ENABLE_WALLET
-    { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false },
+    { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false, false },
 #endif
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true  },
-    { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
-    { "util",               "verifymessage",          &verifymessage,          true  },
-    { "util",               "estimatefee",            &estimatefee,            true  },
-    { "util",               "estimatepriority",       &estimatepriority,       true  },
-    { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
+    { "util",               "createmultisig",         &createmultisig,         true,  false },
+    { "util",               "validateaddress",        &validateaddress,        true,  false }, /* uses wallet if enabled */
+    { "util",               "verifymessage",          &verifymessage,          true,  true  },
+    { "util",               "estimatefee",            &estimatefee,            true,  true  },
+    { "util",               "estimatepriority",       &estimatepriority,       true,  true  },
+    { "util",               "z_validateaddress",      &z_validateaddress,      true,  false }, /* uses wallet if enabled */
+
+    /* Explorer indexes */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      true,  true  },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        true,  true  },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       true,  true  },
+    { "addressindex",       "getspentinfo",           &getspentinfo,           true,  true  },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true  },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
-    { "hidden",             "setmocktime",            &setmocktime,            true  },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,  false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,  false },
+    { "hidden",             "setmocktime",            &setmocktime,            true,  false },
 #ifdef ENABLE_WALLET
-    { "hidden",             "resendwallettransactions", &resendwallettransactions, true},
+    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,  false },
 #endif
 
 #ifdef ENABLE_WALLET
     /* Wallet */
-    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true  },
-    { "wallet",             "backupwallet",           &backupwallet,           true  },
-    { "wallet",             "dumpprivkey",            &dumpprivkey,            true  },
-    { "wallet",             "dumpwallet",             &dumpwallet,             true  },
-    { "wallet",             "encryptwallet",          &encryptwallet,          true  },
-    { "wallet",             "getaccountaddress",      &getaccountaddress,      true  },
-    { "wallet",             "getaccount",             &getaccount,             true  },
-    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true  },
-    { "wallet",             "getbalance",             &getbalance,             false },
-    { "wallet",             "getnewaddress",          &getnewaddress,          true  },
-    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true  },
-    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false },
-    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false },
-    { "wallet",             "gettransaction",         &gettransaction,         false },
-    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false },
-    { "wallet",             "getwalletinfo",          &getwalletinfo,          false },
-    { "wallet",             "importprivkey",          &importprivkey,          true  },
-    { "wallet",             "importwallet",           &importwallet,           true  },
-    { "wallet",             "importaddress",          &importaddress,          true  },
-    { "wallet",             "keypoolrefill",          &keypoolrefill,          true  },
-    { "wallet",             "listaccounts",           &listaccounts,           false },
-    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false },
-    { "wallet",             "listlockunspent",        &listlockunspent,        false },
-    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false },
-    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false },
-    { "wallet",             "listsinceblock",         &listsinceblock,         false },
-    { "wallet",             "listtransactions",       &listtransactions,       false },
-    { "wallet",             "listunspent",            &listunspent,            false },
-    { "wallet",             "lockunspent",            &lockunspent,            true  },
-    { "wallet",             "move",                   &movecmd,                false },
-    { "wallet",             "sendfrom",               &sendfrom,               false },
-    { "wallet",             "sendmany",               &sendmany,               false },
-    { "wallet",             "sendtoaddress",          &sendtoaddress,          false },
-    { "wallet",             "setaccount",             &setaccount,             true  },
-    { "wallet",             "settxfee",               &settxfee,               true  },
-    { "wallet",             "signmessage",            &signmessage,            true  },
-    { "wallet",             "walletlock",             &walletlock,             true  },
-    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true  },
-    { "wallet",             "walletpassphrase",       &walletpassphrase,       true  },
-    { "wallet",             "zcbenchmark",            &zc_benchmark,           true  },
-    { "wallet",             "zcrawkeygen",            &zc_raw_keygen,          true  },
-    { "wallet",             "zcrawjoinsplit",         &zc_raw_joinsplit,       true  },
-    { "wallet",             "zcrawreceive",           &zc_raw_receive,         true  },
-    { "wallet",             "zcsamplejoinsplit",      &zc_sample_joinsplit,    true  },
-    { "wallet",             "z_listreceivedbyaddress",&z_listreceivedbyaddress,false },
-    { "wallet",             "z_getbalance",           &z_getbalance,           false },
-    { "wallet",             "z_gettotalbalance",      &z_gettotalbalance,      false },
-    { "wallet",             "z_sendmany",             &z_sendmany,             false },
-    { "wallet",             "z_shieldcoinbase",       &z_shieldcoinbase,       false },
-    { "wallet",             "z_getoperationstatus",   &z_getoperationstatus,   true  },
-    { "wallet",             "z_getoperationresult",   &z_getoperationresult,   true  },
-    { "wallet",             "z_listoperationids",     &z_listoperationids,     true  },
-    { "wallet",             "z_getnewaddress",        &z_getnewaddress,        true  },
-    { "wallet",             "z_listaddresses",        &z_listaddresses,        true  },
-    { "wallet",             "z_exportkey",            &z_exportkey,            true  },
-    { "wallet",             "z_importkey",            &z_importkey,            true  },
-    { "wallet",             "z_exportviewingkey",     &z_exportviewingkey,     true  },
-    { "wallet",             "z_importviewingkey",     &z_importviewingkey,     true  },
-    { "wallet",             "z_exportwallet",         &z_exportwallet,         true  },
-    { "wallet",             "z_importwallet",         &z_importwallet,         true  },
+    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,  false },
+    { "wallet",             "backupwallet",           &backupwallet,           true,  false },
+    { "wallet",             "dumpprivkey",            &dumpprivkey,            true,  false },
+    { "wallet",             "dumpwallet",             &dumpwallet,             true,  false },
+    { "wallet",             "encryptwallet",          &encryptwallet,          true,  false },
+    { "wallet",             "getaccountaddress",      &getaccountaddress,      true,  false },
+    { "wallet",             "getaccount",             &getaccount,             true,  false },
+    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,  false },
+    { "wallet",             "getbalance",             &getbalance,             false, false },
+    { "wallet",             "getnewaddress",          &getnewaddress,          true,  false },
+    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,  false },
+    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false, false },
+    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false, false },
+    { "wallet",             "gettransaction",         &gettransaction,         false, false },
+    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false, false },
+    { "wallet",             "getwalletinfo",          &getwalletinfo,          false, false },
+    { "wallet",             "importprivkey",          &importprivkey,          true,  false },
+    { "wallet",             "importwallet",           &importwallet,           true,  false },
+    { "wallet",             "importaddress",          &importaddress,          true,  false },
+    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,  false },
+    { "wallet",             "listaccounts",           &listaccounts,           false, false },
+    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false, false },
+    { "wallet",             "listlockunspent",        &listlockunspent,        false, false },
+    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false, false },
+    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false, false },
+    { "wallet",             "listsinceblock",         &listsinceblock,         false, false },
+    { "wallet",             "listtransactions",       &listtransactions,       false, false },
+    { "wallet",             "listunspent",            &listunspent,            false, false },
+    { "wallet",             "lockunspent",            &lockunspent,            true,  false },
+    { "wallet",             "move",                   &movecmd,                false, false },
+    { "wallet",             "sendfrom",               &sendfrom,               false, false },
+    { "wallet",             "sendmany",               &sendmany,               false, false },
+    { "wallet",             "sendtoaddress",          &sendtoaddress,          false, false },
+    { "wallet",             "setaccount",             &setaccount,             true,  false },
+    { "wallet",             "settxfee",               &settxfee,               true,  false },
+    { "wallet",             "signmessage",            &signmessage,            true,  false },
+    { "wallet",             "walletlock",             &walletlock,             true,  false },
+    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true,  false },
+    { "wallet",             "walletpassphrase",       &walletpassphrase,       true,  false },
+    { "wallet",             "zcbenchmark",            &zc_benchmark,           true,  false },
+    { "wallet",             "zcrawkeygen",            &zc_raw_keygen,          true,  false },
+    { "wallet",             "zcrawjoinsplit",         &zc_raw_joinsplit,       true,  false },
+    { "wallet",             "zcrawreceive",           &zc_raw_receive,         true,  false },
+    { "wallet",             "zcsamplejoinsplit",      &zc_sample_joinsplit,    true,  false },
+    { "wallet",             "z_listreceivedbyaddress",&z_listreceivedbyaddress,false, false },
+    { "wallet",             "z_getbalance",           &z_getbalance,           false, false },
+    { "wallet",             "z_gettotalbalance",      &z_gettotalbalance,      false, false },
+    { "wallet",             "z_sendmany",             &z_sendmany,             false, false },
+    { "wallet",             "z_shieldcoinbase",       &z_shieldcoinbase,       false, false },
+    { "wallet",             "z_getoperationstatus",   &z_getoperationstatus,   true,  false },
+    { "wallet",             "z_getoperationresult",   &z_getoperationresult,   true,  false },
+    { "wallet",             "z_listoperationids",     &z_listoperationids,     true,  false },
+    { "wallet",             "z_getnewaddress",        &z_getnewaddress,        true,  false },
+    { "wallet",             "z_listaddresses",        &z_listaddresses,        true,  false },
+    { "wallet",             "z_exportkey",            &z_exportkey,            true,  false },
+    { "wallet",             "z_importkey",            &z_importkey,            true,  false },
+    { "wallet",             "z_exportviewingkey",     &z_exportviewingkey,     true,  false },
+    { "wallet",             "z_importviewingkey",     &z_importviewingkey,     true,  false },
+    { "wallet",             "z_exportwallet",         &z_exportwallet,         true,  false },
+    { "wallet",             "z_importwallet",         &z_importwallet,         true,  false },
 
     // TODO: rearrange into another category 
-    { "disclosure",         "z_getpaymentdisclosure", &z_getpaymentdisclosure, true  }, 
-    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true },
-    { "wallet",             "listaddresses",          &listaddresses,          true  }
+    { "disclosure",         "z_getpaymentdisclosure", &z_getpaymentdisclosure, true,  false }, 
+    { "disclosure",         "z_validatepaymentdisclosure", &z_validatepaymentdisclosure, true,  false },
+    { "wallet",             "listaddresses",          &listaddresses,          true,  false }
 #endif // ENABLE_WALLET
 };
 
+/**
+ * Calls with large results that can also be written straight to the reply
+ */
+static const CRPCStreamCommand vRPCStreamCommands[] =
+{ //  name                      actor (function)
+  //  ------------------------  -----------------------
+    { "getblock",               &getblock_stream         },
+    { "getrawmempool",          &getrawmempool_stream    },
+};
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -419,6 +451,11 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+    {
+        const CRPCStreamCommand *pcmd = &vRPCStreamCommands[vcidx];
+        mapStreamCommands[pcmd->name] = pcmd;
+    }
 }
 
 const CRPCCommand *CRPCTable::operator[](const std::string &name) const
@@ -435,20 +472,24 @@ bool StartRPC()
     fRPCRunning = true;
     g_rpcSignals.Started();
 
-    // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
-    getAsyncRPCQueue()->addWorker();
-/*
-    int n = GetArg("-rpcasyncthreads", 1);
-    if (n<1) {
+    // Operations lock the wallet inputs they select, so they can be proven in parallel
+    int n = GetArg("-rpcasyncthreads", DEFAULT_RPC_ASYNC_THREADS);
+    if (n < 1) {
         LogPrintf("ERROR: Invalid value %d for -rpcasyncthreads.  Must be at least 1.\n", n);
-        strerr = strprintf(_("An error occurred while setting up the Async RPC threads, invalid parameter value of %d (must be at least 1)."), n);
+        std::string strerr = strprintf(_("An error occurred while setting up the Async RPC threads, invalid parameter value of %d (must be at least 1)."), n);
         uiInterface.ThreadSafeMessageBox(strerr, "", CClientUIInterface::MSG_ERROR);
-        StartShutdown();
-        return;
+        return false;
     }
+    int nLow = GetArg("-rpcasynclowprioritythreads", DEFAULT_RPC_ASYNC_LOW_PRIORITY_THREADS);
+    if (nLow < 0) {
+        LogPrintf("ERROR: Invalid value %d for -rpcasynclowprioritythreads.  Must not be negative.\n", nLow);
+        std::string strerr = strprintf(_("An error occurred while setting up the Async RPC threads, invalid parameter value of %d (must not be negative)."), nLow);
+        uiInterface.ThreadSafeMessageBox(strerr, "", CClientUIInterface::MSG_ERROR);
+        return false;
+    }
+    getAsyncRPCQueue()->setWorkerLimit(OperationPriority::LOW, nLow);
     for (int i = 0; i < n; i++)
         getAsyncRPCQueue()->addWorker();
-*/
     return true;
 }
 
@@ -475,6 +516,16 @@ bool IsRPCRunning()
     return fRPCRunning;
 }
 
+void SetRPCRequestURI(const std::string& strURI)
+{
+    strRequestURI = strURI;
+}
+
+const std::string& GetRPCRequestURI()
+{
+    return strRequestURI;
+}
+
 void SetRPCWarmupStatus(const std::string& newStatus)
 {
     LOCK(cs_rpcWarmup);
@@ -550,11 +601,90 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+static bool IsParallelRequest(const UniValue& req)
 {
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    if (!valMethod.isStr())
+        return false;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->okParallel;
+}
+
+/** Run of batch requests shared by the threads executing it */
+class JSONRPCBatchRun
+{
+private:
+    const UniValue& vReq;
+    std::vector<UniValue>& vRet;
+    const std::string strURI;
+    std::atomic<size_t> nNext;
+    const size_t nEnd;
+    size_t nPending;
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+
+public:
+    JSONRPCBatchRun(const UniValue& vReqIn, std::vector<UniValue>& vRetIn, size_t nBegin, size_t nEndIn) :
+        vReq(vReqIn), vRet(vRetIn), strURI(GetRPCRequestURI()), nNext(nBegin), nEnd(nEndIn), nPending(nEndIn - nBegin)
+    {
+    }
+
+    /** Execute requests of the run until none is left unclaimed */
+    void Work()
+    {
+        size_t reqIdx;
+        SetRPCRequestURI(strURI);
+        while ((reqIdx = nNext++) < nEnd) {
+            vRet[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+
+            boost::lock_guard<boost::mutex> lock(cs);
+            if (--nPending == 0)
+                cond.notify_all();
+        }
+    }
+
+    /** Wait for the requests claimed by other threads to finish */
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nPending > 0)
+            cond.wait(lock);
+    }
+};
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCWorkDispatcher& dispatch, unsigned int nMaxHelpers)
+{
+    std::vector<UniValue> vRet(vReq.size());
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx + 1;
+        if (dispatch && nMaxHelpers > 0 && IsParallelRequest(vReq[reqIdx])) {
+            while (nEnd < vReq.size() && IsParallelRequest(vReq[nEnd]))
+                nEnd++;
+        }
+
+        if (nEnd - reqIdx == 1) {
+            vRet[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+        } else {
+            // Helpers which only get to run once the run is done find nothing
+            // left to claim, so this thread never waits on a queued helper
+            boost::shared_ptr<JSONRPCBatchRun> run(new JSONRPCBatchRun(vReq, vRet, reqIdx, nEnd));
+            size_t nHelpers = std::min<size_t>(nMaxHelpers, nEnd - reqIdx - 1);
+            for (size_t i = 0; i < nHelpers; i++) {
+                if (!dispatch(boost::bind(&JSONRPCBatchRun::Work, run)))
+                    break;
+            }
+            run->Work();
+            run->Wait();
+        }
+        reqIdx = nEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (size_t i = 0; i < vRet.size(); i++)
+        ret.push_back(vRet[i]);
 
     return ret.write() + "\n";
 }
@@ -574,6 +704,7 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
         throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
 
     g_rpcSignals.PreCommand(*pcmd);
+    MetricsScopedTimer timer(rpcCallTimes.get(strMethod));
 
     try
     {
@@ -588,6 +719,119 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+bool CRPCTable::canStream(const std::string &strMethod) const
+{
+    return mapStreamCommands.count(strMethod) > 0;
+}
+
+void CRPCTable::executeStream(const std::string &strMethod, const UniValue &params, JSONStreamWriter& out) const
+{
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    // Find method
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    map<string, const CRPCStreamCommand*>::const_iterator it = mapStreamCommands.find(strMethod);
+    if (!pcmd || it == mapStreamCommands.end())
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+
+    g_rpcSignals.PreCommand(*pcmd);
+    MetricsScopedTimer timer(rpcCallTimes.get(strMethod));
+
+    try
+    {
+        // Execute
+        it->second->actor(params, out);
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    g_rpcSignals.PostCommand(*pcmd);
+}
+
+JSONStreamWriter::JSONStreamWriter(const Sink& sinkIn, size_t nChunkSizeIn) :
+    sink(sinkIn), nChunkSize(nChunkSizeIn), fAfterKey(false)
+{
+}
+
+void JSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            strBuf += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void JSONStreamWriter::Written()
+{
+    if (strBuf.size() >= nChunkSize)
+        Flush();
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    strBuf += '{';
+    vEmpty.push_back(true);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    strBuf += '}';
+    vEmpty.pop_back();
+    Written();
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    strBuf += '[';
+    vEmpty.push_back(true);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fAfterKey);
+    strBuf += ']';
+    vEmpty.pop_back();
+    Written();
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    Separate();
+    strBuf += UniValue(key).write();
+    strBuf += ':';
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& val)
+{
+    Separate();
+    strBuf += val.write();
+    Written();
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (strBuf.empty())
+        return;
+    sink(strBuf);
+    strBuf.clear();
+}
+
 std::string HelpExampleCli(const std::string& methodname, const std::string& args)
 {
     return "> zen-cli " + methodname + " " + args + "\n";
@@ -21,6 +21,7 @@
 
 class AsyncRPCQueue;
 class CRPCCommand;
+class CWallet;
 class uint256;
 
 namespace RPCServer
@@ -48,9 +49,22 @@ public:
 /** Query whether RPC is running */
 bool IsRPCRunning();
 
+/**
+ * The HTTP endpoint of the request this thread is executing, e.g.
+ * "/wallet/<file>" to address one of several loaded wallets. Set by the HTTP
+ * handler, and carried over to the threads helping with a batch.
+ */
+void SetRPCRequestURI(const std::string& strURI);
+const std::string& GetRPCRequestURI();
+
 /** Get the async queue*/
 std::shared_ptr<AsyncRPCQueue> getAsyncRPCQueue();
 
+/** Default number of workers servicing the async queue */
+static const int DEFAULT_RPC_ASYNC_THREADS = 1;
+/** Default limit on the workers running low priority operations at once, 0 for none */
+static const int DEFAULT_RPC_ASYNC_LOW_PRIORITY_THREADS = 0;
+
 
 /**
  * Set the RPC warmup status.  When this is done, all RPC calls will error out
@@ -119,6 +133,53 @@ void RPCRunLater(const std::string& name, boost::function<void(void)> func, int6
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
 
+//! Size of the pieces a JSONStreamWriter hands to its sink
+static const size_t JSON_STREAM_CHUNK_SIZE = 1 << 16;
+
+/**
+ * Writes a compact JSON document piece by piece, handing it to a sink in
+ * chunks, so that a large result never has to be held in memory whole.
+ */
+class JSONStreamWriter
+{
+public:
+    typedef boost::function<void(const std::string&)> Sink;
+
+    JSONStreamWriter(const Sink& sinkIn, size_t nChunkSizeIn = JSON_STREAM_CHUNK_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Key of the next value of the current object */
+    void Key(const std::string& key);
+    /** Write a complete value */
+    void Value(const UniValue& val);
+    /** Hand everything written so far to the sink */
+    void Flush();
+
+private:
+    Sink sink;
+    size_t nChunkSize;
+    std::string strBuf;
+    //! For each open object or array, whether nothing was written to it yet
+    std::vector<bool> vEmpty;
+    bool fAfterKey;
+
+    void Separate();
+    void Written();
+};
+
+/** Writes the result of a call to a JSONStreamWriter instead of returning it */
+typedef void(*rpcstreamfn_type)(const UniValue& params, JSONStreamWriter& out);
+
+class CRPCStreamCommand
+{
+public:
+    std::string name;
+    rpcstreamfn_type actor;
+};
+
 class CRPCCommand
 {
 public:
@@ -126,6 +187,8 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    //! Read-only call that may run alongside the neighbouring calls of a batch
+    bool okParallel;
 };
 
 /**
@@ -135,6 +198,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, const CRPCStreamCommand*> mapStreamCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -148,6 +212,16 @@ public:
      * @throws an exception (UniValue) when an error happens.
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
+
+    /** Whether the result of a method can be written with executeStream */
+    bool canStream(const std::string &method) const;
+
+    /**
+     * Execute a method, writing its result to out.
+     * @throws an exception (UniValue) when an error happens, possibly after
+     * part of the result was written.
+     */
+    void executeStream(const std::string &method, const UniValue &params, JSONStreamWriter& out) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -166,12 +240,16 @@ extern CAmount AmountFromValue(const UniValue& value);
 extern UniValue ValueFromAmount(const CAmount& amount);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
 extern double GetNetworkDifficulty(const CBlockIndex* blockindex = NULL);
+//! Difficulty of a compact target, as a multiple of the minimum difficulty (1.0 for 0)
+extern double GetDifficultyFromBits(uint32_t bits);
 extern int64_t blocksToOvertakeTarget(const CBlockIndex* forkTip, const CBlockIndex* targetBlock);
 extern std::string HelpRequiringPassphrase();
 extern std::string HelpExampleCli(const std::string& methodname, const std::string& args);
 extern std::string HelpExampleRpc(const std::string& methodname, const std::string& args);
 
 extern void EnsureWalletIsUnlocked();
+//! The wallet of the "/wallet/<file>" endpoint the request came in on, pwalletMain for "/"
+extern CWallet* GetWalletForJSONRPCRequest();
 
 extern UniValue getconnectioncount(const UniValue& params, bool fHelp); // in rpcnet.cpp
 extern UniValue getpeerinfo(const UniValue& params, bool fHelp);
@@ -212,6 +290,15 @@ extern UniValue getaddressesbyaccount(const UniValue& params, bool fHelp);
 extern UniValue sendtoaddress(const UniValue& params, bool fHelp);
 extern UniValue signmessage(const UniValue& params, bool fHelp);
 extern UniValue verifymessage(const UniValue& params, bool fHelp);
+extern UniValue getaddressbalance(const UniValue& params, bool fHelp);
+extern UniValue getaddresstxids(const UniValue& params, bool fHelp);
+extern UniValue getaddressdeltas(const UniValue& params, bool fHelp);
+extern UniValue getspentinfo(const UniValue& params, bool fHelp);
+extern UniValue getnotificationinfo(const UniValue& params, bool fHelp);
+extern UniValue getlockstats(const UniValue& params, bool fHelp);
+extern UniValue getthreadpoolinfo(const UniValue& params, bool fHelp);
+extern UniValue getschedulerinfo(const UniValue& params, bool fHelp);
+extern UniValue getmemoryinfo(const UniValue& params, bool fHelp);
 extern UniValue getreceivedbyaddress(const UniValue& params, bool fHelp);
 extern UniValue getreceivedbyaccount(const UniValue& params, bool fHelp);
 extern UniValue getbalance(const UniValue& params, bool fHelp);
@@ -248,6 +335,7 @@ extern UniValue zc_raw_receive(const UniValue& params, bool fHelp);
 extern UniValue zc_sample_joinsplit(const UniValue& params, bool fHelp);
 
 extern UniValue getrawtransaction(const UniValue& params, bool fHelp); // in rcprawtransaction.cpp
+extern UniValue getrawtransactions(const UniValue& params, bool fHelp);
 extern UniValue listunspent(const UniValue& params, bool fHelp);
 extern UniValue lockunspent(const UniValue& params, bool fHelp);
 extern UniValue listlockunspent(const UniValue& params, bool fHelp);
@@ -258,7 +346,9 @@ extern UniValue fundrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue sendrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue gettxoutproof(const UniValue& params, bool fHelp);
+extern UniValue gettxoutproofs(const UniValue& params, bool fHelp);
 extern UniValue verifytxoutproof(const UniValue& params, bool fHelp);
+extern UniValue verifytxoutproofs(const UniValue& params, bool fHelp);
 
 extern UniValue getblockcount(const UniValue& params, bool fHelp); // in rpcblockchain.cpp
 extern UniValue getbestblockhash(const UniValue& params, bool fHelp);
@@ -266,15 +356,22 @@ extern UniValue getdifficulty(const UniValue& params, bool fHelp);
 extern UniValue settxfee(const UniValue& params, bool fHelp);
 extern UniValue getmempoolinfo(const UniValue& params, bool fHelp);
 extern UniValue getrawmempool(const UniValue& params, bool fHelp);
+extern void getrawmempool_stream(const UniValue& params, JSONStreamWriter& out);
 extern UniValue getblockhash(const UniValue& params, bool fHelp);
+extern UniValue getblockhashes(const UniValue& params, bool fHelp);
 extern UniValue getblockheader(const UniValue& params, bool fHelp);
 extern UniValue getblock(const UniValue& params, bool fHelp);
+extern void getblock_stream(const UniValue& params, JSONStreamWriter& out);
 extern UniValue getblockfinalityindex(const UniValue& params, bool fHelp);
 extern UniValue getglobaltips(const UniValue& params, bool fHelp);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
+extern UniValue dumptxoutset(const UniValue& params, bool fHelp);
+extern UniValue loadtxoutset(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
+extern UniValue compactdb(const UniValue& params, bool fHelp);
 extern UniValue getchaintips(const UniValue& params, bool fHelp);
+extern UniValue getblockconnectstats(const UniValue& params, bool fHelp);
 extern UniValue invalidateblock(const UniValue& params, bool fHelp);
 extern UniValue reconsiderblock(const UniValue& params, bool fHelp);
 
@@ -307,6 +404,15 @@ extern UniValue dbg_log(const UniValue &params, bool fHelp); // print a line in
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+
+/** Hands func to another RPC worker thread, returns false if it could not be queued */
+typedef boost::function<bool(const boost::function<void(void)>&)> RPCWorkDispatcher;
+
+/**
+ * Execute a batch of requests. Runs of consecutive okParallel calls are also
+ * handed to up to nMaxHelpers other worker threads through dispatch, the
+ * replies keep the order of the requests.
+ */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCWorkDispatcher& dispatch = RPCWorkDispatcher(), unsigned int nMaxHelpers = 0);
 
 #endif // BITCOIN_RPCSERVER_H
@@ -6,17 +6,39 @@
 
 #include "reverselock.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nThreadsServicingQueue(0), nThreadsServicingLongTasks(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
 CScheduler::~CScheduler()
 {
     assert(nThreadsServicingQueue == 0);
+    assert(nThreadsServicingLongTasks == 0);
+}
+
+void CScheduler::runTask(const Task& task, boost::unique_lock<boost::mutex>& lock)
+{
+    boost::chrono::system_clock::time_point start = boost::chrono::system_clock::now();
+    {
+        // Unlock before calling f, so it can reschedule itself or another task
+        // without deadlocking:
+        reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
+        task.f();
+    }
+    if (task.strName.empty())
+        return;
+    int64_t nMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::system_clock::now() - start).count();
+    int64_t nLateMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(start - task.due).count();
+    TaskStats& stats = mapTaskStats[task.strName];
+    stats.nRuns++;
+    stats.nTotalMicros += nMicros;
+    stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+    stats.nMaxLateMicros = std::max(stats.nMaxLateMicros, nLateMicros);
 }
 
 
@@ -40,9 +62,11 @@ void CScheduler::serviceQueue()
 
             // Some boost versions have a conflicting overload of wait_until that returns void.
             // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
+            while (!shouldStop() && !taskQueue.empty()) {
+                // Copy the time: another thread may take the first task while this one waits
+                boost::chrono::system_clock::time_point timeToWaitFor = taskQueue.begin()->first;
+                if (newTaskScheduled.wait_until<>(lock, timeToWaitFor) == boost::cv_status::timeout)
+                    break; // Exit loop after timeout, it means we reached the time of the event
             }
 
             // If there are multiple threads, the queue can empty while we're waiting (another
@@ -50,15 +74,18 @@ void CScheduler::serviceQueue()
             if (shouldStop() || taskQueue.empty())
                 continue;
 
-            Function f = taskQueue.begin()->second;
+            Task task = taskQueue.begin()->second;
             taskQueue.erase(taskQueue.begin());
+            if (stopWhenEmpty && taskQueue.empty())
+                newLongTaskDue.notify_all();
 
-            {
-                // Unlock before calling f, so it can reschedule itself or another task
-                // without deadlocking:
-                reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+            if (task.fLongRunning && nThreadsServicingLongTasks > 0) {
+                // Leave it to serviceLongRunning, the tasks due next must not wait for it
+                longTaskQueue.push_back(task);
+                newLongTaskDue.notify_one();
+                continue;
             }
+            runTask(task, lock);
         } catch (...) {
             --nThreadsServicingQueue;
             throw;
@@ -67,6 +94,28 @@ void CScheduler::serviceQueue()
     --nThreadsServicingQueue;
 }
 
+void CScheduler::serviceLongRunning()
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    ++nThreadsServicingLongTasks;
+
+    try {
+        while (!shouldStopLongRunning()) {
+            if (longTaskQueue.empty()) {
+                newLongTaskDue.wait(lock);
+                continue;
+            }
+            Task task = longTaskQueue.front();
+            longTaskQueue.pop_front();
+            runTask(task, lock);
+        }
+    } catch (...) {
+        --nThreadsServicingLongTasks;
+        throw;
+    }
+    --nThreadsServicingLongTasks;
+}
+
 void CScheduler::stop(bool drain)
 {
     {
@@ -77,31 +126,41 @@ void CScheduler::stop(bool drain)
             stopRequested = true;
     }
     newTaskScheduled.notify_all();
+    newLongTaskDue.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                          const std::string& strName, bool fLongRunning)
 {
+    Task task;
+    task.f = f;
+    task.strName = strName;
+    task.fLongRunning = fLongRunning;
+    task.due = t;
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        taskQueue.insert(std::make_pair(t, task));
     }
     newTaskScheduled.notify_one();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds,
+                                 const std::string& strName, bool fLongRunning)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), strName, fLongRunning);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds,
+                   const std::string& strName, bool fLongRunning)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds, strName, fLongRunning), deltaSeconds, strName, fLongRunning);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds,
+                               const std::string& strName, bool fLongRunning)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds, strName, fLongRunning), deltaSeconds, strName, fLongRunning);
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
@@ -115,3 +174,9 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+std::map<std::string, CScheduler::TaskStats> CScheduler::getTaskStats() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return mapTaskStats;
+}
@@ -13,7 +13,9 @@
 #include <boost/function.hpp>
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
+#include <deque>
 #include <map>
+#include <string>
 
 //
 // Simple class for background tasks that should be run
@@ -32,6 +34,11 @@
 // delete t;
 // delete s; // Must be done after thread is interrupted/joined.
 //
+// Tasks that may take long, such as writing a file, can be marked so:
+// the threads running serviceQueue then hand them to the threads running
+// serviceLongRunning, if there are any, and go on with the tasks due after
+// them on time. Named tasks are timed, see getTaskStats.
+//
 
 class CScheduler
 {
@@ -41,18 +48,32 @@ public:
 
     typedef boost::function<void(void)> Function;
 
+    // How the runs of a named task went
+    struct TaskStats {
+        uint64_t nRuns;
+        int64_t nTotalMicros;
+        int64_t nMaxMicros;
+        // Longest a run started after it was due
+        int64_t nMaxLateMicros;
+
+        TaskStats() : nRuns(0), nTotalMicros(0), nMaxMicros(0), nMaxLateMicros(0) {}
+    };
+
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    void schedule(Function f, boost::chrono::system_clock::time_point t,
+                  const std::string& strName = "", bool fLongRunning = false);
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds,
+                         const std::string& strName = "", bool fLongRunning = false);
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    void scheduleEvery(Function f, int64_t deltaSeconds,
+                       const std::string& strName = "", bool fLongRunning = false);
 
     // To keep things as simple as possible, there is no unschedule.
 
@@ -60,6 +81,10 @@ public:
     // and interrupted using boost::interrupt_thread
     void serviceQueue();
 
+    // Runs the long-running tasks once due, 'forever'. Should be run in
+    // threads of its own, interrupted as those running serviceQueue.
+    void serviceLongRunning();
+
     // Tell any threads running serviceQueue to stop as soon as they're
     // done servicing whatever task they're currently servicing (drain=false)
     // or when there is no work left to be done (drain=true)
@@ -70,14 +95,32 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Returns how the named tasks ran so far, by name
+    std::map<std::string, TaskStats> getTaskStats() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        std::string strName;
+        bool fLongRunning;
+        boost::chrono::system_clock::time_point due;
+    };
+
+    std::multimap<boost::chrono::system_clock::time_point, Task> taskQueue;
+    // Long-running tasks that are due, for serviceLongRunning
+    std::deque<Task> longTaskQueue;
     boost::condition_variable newTaskScheduled;
+    boost::condition_variable newLongTaskDue;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    int nThreadsServicingLongTasks;
     bool stopRequested;
     bool stopWhenEmpty;
+    std::map<std::string, TaskStats> mapTaskStats;
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    bool shouldStopLongRunning() { return stopRequested || (stopWhenEmpty && taskQueue.empty() && longTaskQueue.empty()); }
+    // Call the task with newTaskMutex released, then account for it
+    void runTask(const Task& task, boost::unique_lock<boost::mutex>& lock);
 };
 
 #endif
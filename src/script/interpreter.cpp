@@ -1072,6 +1072,12 @@ public:
         ::WriteCompactSize(s, nInputs);
         for (unsigned int nInput = 0; nInput < nInputs; nInput++)
              SerializeInput(s, nInput, nType, nVersion);
+        SerializeTail(s, nType, nVersion);
+    }
+
+    /** Serialize what follows the inputs of txTo */
+    template<typename S>
+    void SerializeTail(S &s, int nType, int nVersion) const {
         // Serialize vout
         unsigned int nOutputs = fHashNone ? 0 : (fHashSingle ? nIn+1 : txTo.vout.size());
         ::WriteCompactSize(s, nOutputs);
@@ -1102,7 +1108,29 @@ public:
 
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
+{
+    // A single input is serialized once anyway
+    if (txTo.vin.size() < 2)
+        return;
+
+    // Serializing for no input in particular blanks all of them
+    const CScript scriptBlank;
+    CTransactionSignatureSerializer txTmp(txTo, scriptBlank, NOT_AN_INPUT, SIGHASH_ALL);
+    CDataStream ss(SER_GETHASH, 0);
+    vInputEnd.reserve(txTo.vin.size());
+    for (unsigned int nInput = 0; nInput < txTo.vin.size(); nInput++) {
+        txTmp.SerializeInput(ss, nInput, SER_GETHASH, 0);
+        vInputEnd.push_back(ss.size());
+    }
+    vchInputs.assign(ss.begin(), ss.end());
+    ss.clear();
+    txTmp.SerializeTail(ss, SER_GETHASH, 0);
+    vchTail.assign(ss.begin(), ss.end());
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      const PrecomputedTransactionData* txdata)
 {
     if (nIn >= txTo.vin.size() && nIn != NOT_AN_INPUT) {
         //  nIn out of range
@@ -1123,6 +1151,20 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
 
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
+    if (txdata && txdata->vInputEnd.size() == txTo.vin.size() && nIn != NOT_AN_INPUT &&
+        !(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        // Same bytes as below, only the input being signed is serialized here
+        const uint32_t nStart = nIn > 0 ? txdata->vInputEnd[nIn - 1] : 0;
+        const uint32_t nEnd = txdata->vInputEnd[nIn];
+        ss << txTo.nVersion;
+        ::WriteCompactSize(ss, txTo.vin.size());
+        ss.write((const char*)txdata->vchInputs.data(), nStart);
+        txTmp.SerializeInput(ss, nIn, SER_GETHASH, 0);
+        ss.write((const char*)txdata->vchInputs.data() + nEnd, txdata->vchInputs.size() - nEnd);
+        ss.write((const char*)txdata->vchTail.data(), txdata->vchTail.size());
+        ss << nHashType;
+        return ss.GetHash();
+    }
     ss << txTmp << nHashType;
     return ss.GetHash();
 }
@@ -1147,7 +1189,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
 
     uint256 sighash;
     try {
-        sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+        sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, txdata);
     } catch (logic_error ex) {
         return false;
     }
@@ -1219,15 +1261,10 @@ bool CheckReplayProtectionData(const CChain* chain, int nHeight, const std::vect
     }
 #endif
 
-    CBlockIndex* pblockindex = (*chain)[nHeight];
-    uint256 blockHash = pblockindex->GetBlockHash();
-    std::vector<unsigned char> vchBlockHash(blockHash.begin(), blockHash.end());
-
-    if (vchBlockHash.empty() || vchCompareTo.empty()) {
-        return false;
-    }
-
-    return (vchCompareTo == vchBlockHash);
+    // Compared in place, this runs for nearly every replay protected output
+    const uint256 blockHash = (*chain)[nHeight]->GetBlockHash();
+    return vchCompareTo.size() == blockHash.size() &&
+           std::equal(vchCompareTo.begin(), vchCompareTo.end(), blockHash.begin());
 }
 
 bool TransactionSignatureChecker::CheckBlockHash(const int32_t nHeight, const std::vector<unsigned char>& vchCompareTo) const
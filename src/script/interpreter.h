@@ -92,7 +92,28 @@ enum
 
 static const unsigned int CONTEXTUAL_SCRIPT_VERIFY_FLAGS = SCRIPT_VERIFY_CHECKBLOCKATHEIGHT;
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * The parts of the signature hash serialization of a transaction that are the same for all its inputs
+ * with SIGHASH_ALL: every input with a blank script, and the outputs, lock time and JoinSplits after them.
+ * Built once per transaction with more than one input, so that hashing for each input does not serialize
+ * the whole transaction again.
+ */
+class PrecomputedTransactionData
+{
+public:
+    //! The inputs of the transaction, each serialized as for another input being signed
+    std::vector<unsigned char> vchInputs;
+    //! Where each input ends in vchInputs
+    std::vector<uint32_t> vInputEnd;
+    //! Everything following the inputs, up to the hash type
+    std::vector<unsigned char> vchTail;
+
+    PrecomputedTransactionData() {}
+    explicit PrecomputedTransactionData(const CTransaction& tx);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      const PrecomputedTransactionData* txdata = NULL);
 
 class BaseSignatureChecker
 {
@@ -120,13 +141,17 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    //! Chain OP_CHECKBLOCKATHEIGHT is checked against, possibly from the script check threads: it must not
+    //! change until the checks are done, as in ConnectBlock which holds cs_main while waiting for them
     const CChain* chain;
+    const PrecomputedTransactionData* txdata;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn) : txTo(txToIn), nIn(nInIn), chain(chainIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn, const PrecomputedTransactionData* txdataIn = NULL) :
+        txTo(txToIn), nIn(nInIn), chain(chainIn), txdata(txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
     bool CheckBlockHash(const int32_t nHeight, const std::vector<unsigned char>& nBlockHash) const;
@@ -7,20 +7,55 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <cstring>
 #include <vector>
 
+//! -maxsigcachesize default in MiB; at 32 bytes per entry that is about a million signatures
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+//! Largest -maxsigcachesize accepted, in MiB
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+
 class CPubKey;
 
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ *
+ * This may exhibit platform endian dependent behavior but because these are
+ * nonced hashes (random) and this state is only ever used locally it is safe.
+ * All that matters is local consistency.
+ */
+class SignatureCacheHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select <8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin()+4*hash_select, 4);
+        return u;
+    }
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn, chainIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CChain* chainIn, bool storeIn=true,
+                                       const PrecomputedTransactionData* txdataIn=NULL) :
+        TransactionSignatureChecker(txToIn, nInIn, chainIn, txdataIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size the signature cache from -maxsigcachesize, must be called before any signature is checked. */
+void InitSignatureCache();
+/** Bytes allocated for the signature cache, fixed by InitSignatureCache. */
+size_t GetSignatureCacheMemoryUsage();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -15,6 +15,9 @@ class CTransaction;
 
 struct CMutableTransaction;
 
+/** The fewest inputs worth signing on a thread of their own */
+static const unsigned int MIN_SIGNATURE_INPUTS_PER_THREAD = 8;
+
 /** Virtual base class for signature creators. */
 class BaseSignatureCreator {
 protected:
@@ -35,10 +38,12 @@ class TransactionSignatureCreator : public BaseSignatureCreator {
     const CTransaction* txTo;
     unsigned int nIn;
     int nHashType;
+    const PrecomputedTransactionData* txdata;
     const TransactionSignatureChecker checker;
 
 public:
-    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, int nHashTypeIn=SIGHASH_ALL);
+    TransactionSignatureCreator(const CKeyStore* keystoreIn, const CTransaction* txToIn, unsigned int nInIn, int nHashTypeIn=SIGHASH_ALL,
+                                const PrecomputedTransactionData* txdataIn=NULL);
     const BaseSignatureChecker& Checker() const { return checker; }
     bool CreateSig(std::vector<unsigned char>& vchSig, const CKeyID& keyid, const CScript& scriptCode) const;
 };
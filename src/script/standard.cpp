@@ -43,6 +43,55 @@ const char* GetTxnOutputType(txnouttype t)
 }
 
 
+/**
+ * Match the canonical forms of the pay-to-pubkey-hash, pay-to-script-hash and
+ * pay-to-pubkey templates by their bytes, without walking the opcodes of the
+ * script against every template. These do not depend on the chain, unlike
+ * their replay protected variants.
+ *
+ * Returns the type of a script that is exactly one of them, with the
+ * solutions Solver returns for it, or TX_NONSTANDARD. A script that only
+ * starts with one of them can at most be its replay protected variant,
+ * which is set in replayTypeRet for Solver to try alone.
+ */
+static txnouttype MatchCanonicalTemplate(const CScript& script, vector<valtype>& vSolutionsRet, txnouttype& replayTypeRet)
+{
+    replayTypeRet = TX_NONSTANDARD;
+    const size_t size = script.size();
+    if (size >= 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG)
+    {
+        if (size > 25) {
+            replayTypeRet = TX_PUBKEYHASH_REPLAY;
+            return TX_NONSTANDARD;
+        }
+        vSolutionsRet.assign(1, valtype(script.begin() + 3, script.begin() + 23));
+        return TX_PUBKEYHASH;
+    }
+    if (size >= 23 && script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL)
+    {
+        if (size > 23) {
+            replayTypeRet = TX_SCRIPTHASH_REPLAY;
+            return TX_NONSTANDARD;
+        }
+        // The template matching pushes the hash, and its match the hash again
+        vSolutionsRet.assign(2, valtype(script.begin() + 2, script.begin() + 22));
+        return TX_SCRIPTHASH;
+    }
+    if (size >= 35 && script[0] >= 33 && script[0] <= 65 && size >= (size_t)script[0] + 2 &&
+        script[script[0] + 1] == OP_CHECKSIG)
+    {
+        const size_t keySize = script[0];
+        if (size > keySize + 2) {
+            replayTypeRet = TX_PUBKEY_REPLAY;
+            return TX_NONSTANDARD;
+        }
+        vSolutionsRet.assign(1, valtype(script.begin() + 1, script.begin() + 1 + keySize));
+        return TX_PUBKEY;
+    }
+    return TX_NONSTANDARD;
+}
+
 /**
  * Return public keys or hashes from scriptPubKey, for 'standard' transaction types.
  */
@@ -78,6 +127,15 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
         mTemplates.insert(make_pair(TX_NULL_DATA_REPLAY, CScript() << OP_RETURN << OP_SMALLDATA << OP_SMALLDATA << OP_CHECKBLOCKATHEIGHT));
     }
 
+    rpAttributes.SetNull();
+    txnouttype replayType;
+    typeRet = MatchCanonicalTemplate(scriptPubKey, vSolutionsRet, replayType);
+    if (typeRet != TX_NONSTANDARD)
+        return true;
+    // The other templates fail on the first opcodes of the script
+    pair<multimap<txnouttype, CScript>::const_iterator, multimap<txnouttype, CScript>::const_iterator> templates =
+        replayType != TX_NONSTANDARD ? mTemplates.equal_range(replayType) : make_pair(mTemplates.begin(), mTemplates.end());
+
 #if !defined(BITCOIN_TX)
     const int32_t nChActHeight = chainActive.Height();
 #else
@@ -86,11 +144,10 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
 
     // patch level of the replay protection forks
     ReplayProtectionLevel rpLevel = ForkManager::getInstance().getReplayProtectionLevel(nChActHeight);
-    rpAttributes.SetNull();
 
     // Scan templates
     const CScript& script1 = scriptPubKey;
-    BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, mTemplates)
+    BOOST_FOREACH(const PAIRTYPE(txnouttype, CScript)& tplate, templates)
     {
         const CScript& script2 = tplate.second;
         vSolutionsRet.clear();
@@ -333,7 +390,7 @@ bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, vector<vector<unsi
                     }
                     catch(...)
                     {
-                        LogPrint("%s: %s():%d - unexpected exception\n", __FILE__, __func__, __LINE__);
+                        LogPrintf("%s: %s():%d - unexpected exception\n", __FILE__, __func__, __LINE__);
                         break;
                     }
 
@@ -9,6 +9,7 @@
 #include "compat/endian.h"
 
 #include <algorithm>
+#include <array>
 #include <assert.h>
 #include <ios>
 #include <limits>
@@ -18,6 +19,7 @@
 #include <stdint.h>
 #include <string>
 #include <string.h>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -25,9 +27,29 @@
 #include <boost/optional.hpp>
 
 class CScript;
+class uint160;
+class uint256;
 
 static const unsigned int MAX_SIZE = 0x02000000;
 
+/**
+ * Types serialized as the bytes they hold in memory, which is what they take.
+ * Vectors and arrays of them are written and read with one call to the stream
+ * and have their sizes without a walk over the elements.
+ */
+template<typename T> struct is_serialize_flat : std::false_type {};
+template<> struct is_serialize_flat<unsigned char> : std::true_type {};
+template<> struct is_serialize_flat<uint160> : std::true_type {};
+template<> struct is_serialize_flat<uint256> : std::true_type {};
+template<typename T, std::size_t N> struct is_serialize_flat<boost::array<T, N> > : is_serialize_flat<T>
+{
+    static_assert(sizeof(boost::array<T, N>) == N * sizeof(T), "boost::array is not packed");
+};
+template<typename T, std::size_t N> struct is_serialize_flat<std::array<T, N> > : is_serialize_flat<T>
+{
+    static_assert(sizeof(std::array<T, N>) == N * sizeof(T), "std::array is not packed");
+};
+
 /**
  * Dummy data type to identify deserializing constructors.
  *
@@ -109,6 +131,11 @@ template<typename Stream> inline void ser_writedata32(Stream &s, uint32_t obj)
     obj = htole32(obj);
     s.write((char*)&obj, 4);
 }
+template<typename Stream> inline void ser_writedata32be(Stream &s, uint32_t obj)
+{
+    obj = htobe32(obj);
+    s.write((char*)&obj, 4);
+}
 template<typename Stream> inline void ser_writedata64(Stream &s, uint64_t obj)
 {
     obj = htole64(obj);
@@ -132,6 +159,12 @@ template<typename Stream> inline uint32_t ser_readdata32(Stream &s)
     s.read((char*)&obj, 4);
     return le32toh(obj);
 }
+template<typename Stream> inline uint32_t ser_readdata32be(Stream &s)
+{
+    uint32_t obj;
+    s.read((char*)&obj, 4);
+    return be32toh(obj);
+}
 template<typename Stream> inline uint64_t ser_readdata64(Stream &s)
 {
     uint64_t obj;
@@ -391,6 +424,7 @@ I ReadVarInt(Stream& is)
 #define FLATDATA(obj) REF(CFlatData((char*)&(obj), (char*)&(obj) + sizeof(obj)))
 #define VARINT(obj) REF(WrapVarInt(REF(obj)))
 #define LIMITED_STRING(obj,n) REF(LimitedString< n >(REF(obj)))
+#define COMPACTSIZE(obj) REF(CCompactSize(REF(obj)))
 
 /** 
  * Wrapper for serializing arrays and POD.
@@ -454,6 +488,28 @@ public:
     }
 };
 
+class CCompactSize
+{
+protected:
+    uint64_t &n;
+public:
+    CCompactSize(uint64_t& nIn) : n(nIn) { }
+
+    unsigned int GetSerializeSize(int, int) const {
+        return GetSizeOfCompactSize(n);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int, int) const {
+        WriteCompactSize<Stream>(s, n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int) {
+        n = ReadCompactSize<Stream>(s);
+    }
+};
+
 template<size_t Limit>
 class LimitedString
 {
@@ -504,16 +560,16 @@ template<typename Stream, typename C> void Unserialize(Stream& is, std::basic_st
 
 /**
  * vector
- * vectors of unsigned char are a special case and are intended to be serialized as a single opaque blob.
+ * vectors of flat types, such as unsigned char and uint256, are a special case and are serialized as a single opaque blob.
  */
-template<typename T, typename A> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&);
-template<typename T, typename A, typename V> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const V&);
+template<typename T, typename A> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::true_type);
+template<typename T, typename A> unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::false_type);
 template<typename T, typename A> inline unsigned int GetSerializeSize(const std::vector<T, A>& v, int nType, int nVersion);
-template<typename Stream, typename T, typename A> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&);
-template<typename Stream, typename T, typename A, typename V> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const V&);
+template<typename Stream, typename T, typename A> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T, typename A> void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::false_type);
 template<typename Stream, typename T, typename A> inline void Serialize(Stream& os, const std::vector<T, A>& v, int nType, int nVersion);
-template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const unsigned char&);
-template<typename Stream, typename T, typename A, typename V> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const V&);
+template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::false_type);
 template<typename Stream, typename T, typename A> inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersion);
 
 /**
@@ -532,7 +588,15 @@ template<typename Stream, typename T> void Unserialize(Stream& is, boost::option
 
 /**
  * array
+ * arrays of flat types are serialized as a single opaque blob.
  */
+template<typename T> unsigned int GetSerializeSize_array(const T* item, std::size_t N, int nType, int nVersion, std::true_type);
+template<typename T> unsigned int GetSerializeSize_array(const T* item, std::size_t N, int nType, int nVersion, std::false_type);
+template<typename Stream, typename T> void Serialize_array(Stream& os, const T* item, std::size_t N, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T> void Serialize_array(Stream& os, const T* item, std::size_t N, int nType, int nVersion, std::false_type);
+template<typename Stream, typename T> void Unserialize_array(Stream& is, T* item, std::size_t N, int nType, int nVersion, std::true_type);
+template<typename Stream, typename T> void Unserialize_array(Stream& is, T* item, std::size_t N, int nType, int nVersion, std::false_type);
+
 template<typename T, std::size_t N> unsigned int GetSerializeSize(const boost::array<T, N> &item, int nType, int nVersion);
 template<typename Stream, typename T, std::size_t N> void Serialize(Stream& os, const boost::array<T, N>& item, int nType, int nVersion);
 template<typename Stream, typename T, std::size_t N> void Unserialize(Stream& is, boost::array<T, N>& item, int nType, int nVersion);
@@ -633,13 +697,13 @@ void Unserialize(Stream& is, std::basic_string<C>& str, int, int)
  * vector
  */
 template<typename T, typename A>
-unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&)
+unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::true_type)
 {
     return (GetSizeOfCompactSize(v.size()) + v.size() * sizeof(T));
 }
 
-template<typename T, typename A, typename V>
-unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, const V&)
+template<typename T, typename A>
+unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nVersion, std::false_type)
 {
     unsigned int nSize = GetSizeOfCompactSize(v.size());
     for (typename std::vector<T, A>::const_iterator vi = v.begin(); vi != v.end(); ++vi)
@@ -650,20 +714,20 @@ unsigned int GetSerializeSize_impl(const std::vector<T, A>& v, int nType, int nV
 template<typename T, typename A>
 inline unsigned int GetSerializeSize(const std::vector<T, A>& v, int nType, int nVersion)
 {
-    return GetSerializeSize_impl(v, nType, nVersion, T());
+    return GetSerializeSize_impl(v, nType, nVersion, is_serialize_flat<T>());
 }
 
 
 template<typename Stream, typename T, typename A>
-void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const unsigned char&)
+void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::true_type)
 {
     WriteCompactSize(os, v.size());
     if (!v.empty())
         os.write((char*)&v[0], v.size() * sizeof(T));
 }
 
-template<typename Stream, typename T, typename A, typename V>
-void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, const V&)
+template<typename Stream, typename T, typename A>
+void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVersion, std::false_type)
 {
     WriteCompactSize(os, v.size());
     for (typename std::vector<T, A>::const_iterator vi = v.begin(); vi != v.end(); ++vi)        
@@ -677,12 +741,12 @@ void Serialize_impl(Stream& os, const std::vector<T, A>& v, int nType, int nVers
 template<typename Stream, typename T, typename A>
 inline void Serialize(Stream& os, const std::vector<T, A>& v, int nType, int nVersion)
 {
-    Serialize_impl(os, v, nType, nVersion, T());
+    Serialize_impl(os, v, nType, nVersion, is_serialize_flat<T>());
 }
 
 
 template<typename Stream, typename T, typename A>
-void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const unsigned char&)
+void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::true_type)
 {
     // Limit size per read so bogus size value won't cause out of memory
     v.clear();
@@ -697,8 +761,8 @@ void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion,
     }
 }
 
-template<typename Stream, typename T, typename A, typename V>
-void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const V&)
+template<typename Stream, typename T, typename A>
+void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, std::false_type)
 {
     v.clear();
     unsigned int nSize = ReadCompactSize(is);
@@ -718,7 +782,7 @@ void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion,
 template<typename Stream, typename T, typename A>
 inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersion)
 {
-    Unserialize_impl(is, v, nType, nVersion, T());
+    Unserialize_impl(is, v, nType, nVersion, is_serialize_flat<T>());
 }
 
 
@@ -795,8 +859,14 @@ void Unserialize(Stream& is, boost::optional<T>& item, int nType, int nVersion)
 /**
  * array
  */
-template<typename T, std::size_t N>
-unsigned int GetSerializeSize(const boost::array<T, N> &item, int nType, int nVersion)
+template<typename T>
+unsigned int GetSerializeSize_array(const T* item, std::size_t N, int nType, int nVersion, std::true_type)
+{
+    return N * sizeof(T);
+}
+
+template<typename T>
+unsigned int GetSerializeSize_array(const T* item, std::size_t N, int nType, int nVersion, std::false_type)
 {
     unsigned int size = 0;
     for (size_t i = 0; i < N; i++) {
@@ -805,47 +875,69 @@ unsigned int GetSerializeSize(const boost::array<T, N> &item, int nType, int nVe
     return size;
 }
 
-template<typename Stream, typename T, std::size_t N>
-void Serialize(Stream& os, const boost::array<T, N>& item, int nType, int nVersion)
+template<typename Stream, typename T>
+void Serialize_array(Stream& os, const T* item, std::size_t N, int nType, int nVersion, std::true_type)
+{
+    os.write((char*)item, N * sizeof(T));
+}
+
+template<typename Stream, typename T>
+void Serialize_array(Stream& os, const T* item, std::size_t N, int nType, int nVersion, std::false_type)
 {
     for (size_t i = 0; i < N; i++) {
         Serialize(os, item[i], nType, nVersion);
     }
 }
 
-template<typename Stream, typename T, std::size_t N>
-void Unserialize(Stream& is, boost::array<T, N>& item, int nType, int nVersion)
+template<typename Stream, typename T>
+void Unserialize_array(Stream& is, T* item, std::size_t N, int nType, int nVersion, std::true_type)
+{
+    is.read((char*)item, N * sizeof(T));
+}
+
+template<typename Stream, typename T>
+void Unserialize_array(Stream& is, T* item, std::size_t N, int nType, int nVersion, std::false_type)
 {
     for (size_t i = 0; i < N; i++) {
         Unserialize(is, item[i], nType, nVersion);
     }
 }
 
+template<typename T, std::size_t N>
+unsigned int GetSerializeSize(const boost::array<T, N> &item, int nType, int nVersion)
+{
+    return GetSerializeSize_array(item.data(), N, nType, nVersion, is_serialize_flat<T>());
+}
+
+template<typename Stream, typename T, std::size_t N>
+void Serialize(Stream& os, const boost::array<T, N>& item, int nType, int nVersion)
+{
+    Serialize_array(os, item.data(), N, nType, nVersion, is_serialize_flat<T>());
+}
+
+template<typename Stream, typename T, std::size_t N>
+void Unserialize(Stream& is, boost::array<T, N>& item, int nType, int nVersion)
+{
+    Unserialize_array(is, item.data(), N, nType, nVersion, is_serialize_flat<T>());
+}
+
 
 template<typename T, std::size_t N>
 unsigned int GetSerializeSize(const std::array<T, N> &item, int nType, int nVersion)
 {
-    unsigned int size = 0;
-    for (size_t i = 0; i < N; i++) {
-        size += GetSerializeSize(item[0], nType, nVersion);
-    }
-    return size;
+    return GetSerializeSize_array(item.data(), N, nType, nVersion, is_serialize_flat<T>());
 }
 
 template<typename Stream, typename T, std::size_t N>
 void Serialize(Stream& os, const std::array<T, N>& item, int nType, int nVersion)
 {
-    for (size_t i = 0; i < N; i++) {
-        Serialize(os, item[i], nType, nVersion);
-    }
+    Serialize_array(os, item.data(), N, nType, nVersion, is_serialize_flat<T>());
 }
 
 template<typename Stream, typename T, std::size_t N>
 void Unserialize(Stream& is, std::array<T, N>& item, int nType, int nVersion)
 {
-    for (size_t i = 0; i < N; i++) {
-        Unserialize(is, item[i], nType, nVersion);
-    }
+    Unserialize_array(is, item.data(), N, nType, nVersion, is_serialize_flat<T>());
 }
 
 
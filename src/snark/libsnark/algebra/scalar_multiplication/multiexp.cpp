@@ -0,0 +1,33 @@
+/** @file
+ *****************************************************************************
+
+ Implementation of the multi-exponentiation method selection.
+ See multiexp.hpp .
+
+ *****************************************************************************
+ * @author     This file is part of libsnark, developed by SCIPR Lab
+ *             and contributors (see AUTHORS).
+ * @copyright  MIT license (see LICENSE file)
+ *****************************************************************************/
+
+#include <atomic>
+#include <vector>
+
+#include "algebra/fields/bigint.hpp"
+#include "algebra/scalar_multiplication/multiexp.hpp"
+
+namespace libsnark {
+
+static std::atomic<multi_exp_method> selected_multi_exp_method(multi_exp_method_BDLO12);
+
+void set_multi_exp_method(const multi_exp_method method)
+{
+    selected_multi_exp_method = method;
+}
+
+multi_exp_method get_multi_exp_method()
+{
+    return selected_multi_exp_method;
+}
+
+} // libsnark
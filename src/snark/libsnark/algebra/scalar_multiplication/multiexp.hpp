@@ -14,6 +14,27 @@
 
 namespace libsnark {
 
+/**
+ * Algorithm multi_exp uses for each of its chunks when use_multiexp is set,
+ * chosen for the whole process with set_multi_exp_method.
+ */
+enum multi_exp_method {
+    /**
+     * Variant of the Bos-Coster algorithm, keeping the exponents in a heap
+     * and subtracting the second largest from the largest.
+     */
+    multi_exp_method_bos_coster,
+    /**
+     * Bucket method of [BDLO12], also attributed to Pippenger: the bases are
+     * added to a bucket per window digit, then the buckets are summed, for
+     * one addition per base and window.
+     */
+    multi_exp_method_BDLO12
+};
+
+void set_multi_exp_method(const multi_exp_method method);
+multi_exp_method get_multi_exp_method();
+
 /**
  * Naive multi-exponentiation individually multiplies each base by the
  * corresponding scalar and adds up the results.
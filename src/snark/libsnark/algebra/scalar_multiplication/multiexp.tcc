@@ -37,69 +37,10 @@ public:
 
     bool operator<(const ordered_exponent<n> &other) const
     {
-#if defined(__x86_64__) && defined(USE_ASM)
-        if (n == 3)
-        {
-            int64_t res;
-            __asm__
-                ("// check for overflow           \n\t"
-                 "mov $0, %[res]                  \n\t"
-                 ADD_CMP(16)
-                 ADD_CMP(8)
-                 ADD_CMP(0)
-                 "jmp done%=                      \n\t"
-                 "subtract%=:                     \n\t"
-                 "mov $1, %[res]                  \n\t"
-                 "done%=:                         \n\t"
-                 : [res] "=&r" (res)
-                 : [A] "r" (other.r.data), [mod] "r" (this->r.data)
-                 : "cc", "%rax");
-            return res;
-        }
-        else if (n == 4)
-        {
-            int64_t res;
-            __asm__
-                ("// check for overflow           \n\t"
-                 "mov $0, %[res]                  \n\t"
-                 ADD_CMP(24)
-                 ADD_CMP(16)
-                 ADD_CMP(8)
-                 ADD_CMP(0)
-                 "jmp done%=                      \n\t"
-                 "subtract%=:                     \n\t"
-                 "mov $1, %[res]                  \n\t"
-                 "done%=:                         \n\t"
-                 : [res] "=&r" (res)
-                 : [A] "r" (other.r.data), [mod] "r" (this->r.data)
-                 : "cc", "%rax");
-            return res;
-        }
-        else if (n == 5)
-        {
-            int64_t res;
-            __asm__
-                ("// check for overflow           \n\t"
-                 "mov $0, %[res]                  \n\t"
-                 ADD_CMP(32)
-                 ADD_CMP(24)
-                 ADD_CMP(16)
-                 ADD_CMP(8)
-                 ADD_CMP(0)
-                 "jmp done%=                      \n\t"
-                 "subtract%=:                     \n\t"
-                 "mov $1, %[res]                  \n\t"
-                 "done%=:                         \n\t"
-                 : [res] "=&r" (res)
-                 : [A] "r" (other.r.data), [mod] "r" (this->r.data)
-                 : "cc", "%rax");
-            return res;
-        }
-        else
-#endif
-        {
-            return (mpn_cmp(this->r.data, other.r.data, n) < 0);
-        }
+        // No inline assembly here: the USE_ASM comparison this had gave
+        // wrong orders once inlined in the heap operations of
+        // multi_exp_inner by GCC 12 at -O2, and wrong multi-exponentiations
+        return (mpn_cmp(this->r.data, other.r.data, n) < 0);
     }
 };
 
@@ -266,6 +207,114 @@ T multi_exp_inner(typename std::vector<T>::const_iterator vec_start,
     return opt_result;
 }
 
+/*
+  The bucket method of [Bernstein, Doumen, Lange, Oosterwijk, "Faster batch
+  forgery identification", INDOCRYPT '12], Section 4. The exponents are split
+  in windows of c bits, from the most significant one. For each window every
+  base is added to the bucket of its digit, and the buckets are summed with a
+  running sum so that bucket j is counted j times, before the result is
+  doubled c times for the next window.
+*/
+template<typename T, typename FieldT>
+T multi_exp_inner_BDLO12(typename std::vector<T>::const_iterator vec_start,
+                         typename std::vector<T>::const_iterator vec_end,
+                         typename std::vector<FieldT>::const_iterator scalar_start,
+                         typename std::vector<FieldT>::const_iterator scalar_end)
+{
+    const mp_size_t n = std::remove_reference<decltype(*scalar_start)>::type::num_limbs;
+    const size_t length = vec_end - vec_start;
+
+    if (length < 4)
+    {
+        return naive_exp<T, FieldT>(vec_start, vec_end, scalar_start, scalar_end);
+    }
+
+    // About log2(length) - log2(log2(length)) bits per window balances the
+    // additions to the buckets against those summing them
+    const size_t log2_length = log2(length);
+    const size_t c = log2_length - log2(log2_length);
+
+    std::vector<bigint<n> > bn_exponents(length);
+    size_t num_bits = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        bn_exponents[i] = (scalar_start + i)->as_bigint();
+        num_bits = std::max(num_bits, bn_exponents[i].num_bits());
+    }
+    assert(scalar_start + length == scalar_end);
+
+    const size_t num_groups = (num_bits + c - 1) / c;
+    const size_t num_buckets = UINT64_C(1) << c;
+
+    T result = T::zero();
+    bool result_nonzero = false;
+    std::vector<T> buckets(num_buckets);
+    std::vector<bool> bucket_nonzero(num_buckets);
+
+    for (size_t k = num_groups; k-- > 0; )
+    {
+        if (result_nonzero)
+        {
+            for (size_t i = 0; i < c; i++)
+            {
+                result = result.dbl();
+            }
+        }
+
+        std::fill(bucket_nonzero.begin(), bucket_nonzero.end(), false);
+
+        for (size_t i = 0; i < length; i++)
+        {
+            size_t id = 0;
+            for (size_t j = 0; j < c; j++)
+            {
+                if (bn_exponents[i].test_bit(k*c + j))
+                {
+                    id |= UINT64_C(1) << j;
+                }
+            }
+
+            if (id == 0)
+            {
+                continue;
+            }
+
+            if (bucket_nonzero[id])
+            {
+#ifdef USE_MIXED_ADDITION
+                buckets[id] = buckets[id].mixed_add(*(vec_start + i));
+#else
+                buckets[id] = buckets[id] + *(vec_start + i);
+#endif
+            }
+            else
+            {
+                buckets[id] = *(vec_start + i);
+                bucket_nonzero[id] = true;
+            }
+        }
+
+        // result += sum of j * buckets[j], as the sum of the running sums
+        T running_sum = T::zero();
+        bool running_sum_nonzero = false;
+        for (size_t j = num_buckets - 1; j > 0; j--)
+        {
+            if (bucket_nonzero[j])
+            {
+                running_sum = running_sum_nonzero ? running_sum + buckets[j] : buckets[j];
+                running_sum_nonzero = true;
+            }
+            if (running_sum_nonzero)
+            {
+                result = result_nonzero ? result + running_sum : running_sum;
+                result_nonzero = true;
+            }
+        }
+    }
+
+    return result;
+}
+
 template<typename T, typename FieldT>
 T multi_exp(typename std::vector<T>::const_iterator vec_start,
             typename std::vector<T>::const_iterator vec_end,
@@ -284,7 +333,20 @@ T multi_exp(typename std::vector<T>::const_iterator vec_start,
 
     std::vector<T> partial(chunks, T::zero());
 
-    if (use_multiexp)
+    if (use_multiexp && get_multi_exp_method() == multi_exp_method_BDLO12)
+    {
+#ifdef MULTICORE
+#pragma omp parallel for
+#endif
+        for (size_t i = 0; i < chunks; ++i)
+        {
+            partial[i] = multi_exp_inner_BDLO12<T, FieldT>(vec_start + i*one,
+                                                           (i == chunks-1 ? vec_end : vec_start + (i+1)*one),
+                                                           scalar_start + i*one,
+                                                           (i == chunks-1 ? scalar_end : scalar_start + (i+1)*one));
+        }
+    }
+    else if (use_multiexp)
     {
 #ifdef MULTICORE
 #pragma omp parallel for
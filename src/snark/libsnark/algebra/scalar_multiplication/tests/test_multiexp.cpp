@@ -0,0 +1,49 @@
+/**
+ *****************************************************************************
+ * @author     This file is part of libsnark, developed by SCIPR Lab
+ *             and contributors (see AUTHORS).
+ * @copyright  MIT license (see LICENSE file)
+ *****************************************************************************/
+#include "common/profiling.hpp"
+#include "algebra/curves/alt_bn128/alt_bn128_pp.hpp"
+#include "algebra/scalar_multiplication/multiexp.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace libsnark;
+
+template<typename GroupT, typename FieldT>
+void test_multi_exp(const multi_exp_method method)
+{
+    set_multi_exp_method(method);
+
+    for (size_t length : {1, 2, 3, 4, 5, 9, 33, 100, 1000})
+    {
+        std::vector<GroupT> bases;
+        std::vector<FieldT> scalars;
+        for (size_t i = 0; i < length; ++i)
+        {
+            bases.emplace_back(GroupT::random_element());
+            scalars.emplace_back(FieldT::random_element());
+        }
+        /* small and zero exponents too */
+        scalars[0] = FieldT::zero();
+        scalars[length / 2] = FieldT(3);
+
+        const GroupT expected = naive_plain_exp<GroupT, FieldT>(bases.begin(), bases.end(), scalars.begin(), scalars.end());
+        for (size_t chunks : {1, 3})
+        {
+            EXPECT_EQ(expected, (multi_exp<GroupT, FieldT>(bases.begin(), bases.end(), scalars.begin(), scalars.end(), chunks, true)));
+        }
+    }
+
+    set_multi_exp_method(multi_exp_method_BDLO12);
+}
+
+TEST(algebra, multi_exp)
+{
+    alt_bn128_pp::init_public_params();
+    test_multi_exp<G1<alt_bn128_pp>, Fr<alt_bn128_pp> >(multi_exp_method_bos_coster);
+    test_multi_exp<G1<alt_bn128_pp>, Fr<alt_bn128_pp> >(multi_exp_method_BDLO12);
+    test_multi_exp<G2<alt_bn128_pp>, Fr<alt_bn128_pp> >(multi_exp_method_BDLO12);
+}
@@ -397,8 +397,12 @@ r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover(const r1cs_ppzksnark_proving_key
                                                 const r1cs_ppzksnark_auxiliary_input<ppT> &auxiliary_input,
                                                 const r1cs_ppzksnark_constraint_system<ppT> &constraint_system);
 
+/**
+ * The same prover, reading the proving key from a stream as it goes instead of
+ * holding all of it in memory.
+ */
 template<typename ppT>
-r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover_streaming(std::ifstream &proving_key_file,
+r1cs_ppzksnark_proof<ppT> r1cs_ppzksnark_prover_streaming(std::istream &proving_key_file,
                                                           const r1cs_ppzksnark_primary_input<ppT> &primary_input,
                                                           const r1cs_ppzksnark_auxiliary_input<ppT> &auxiliary_input,
                                                           const r1cs_ppzksnark_constraint_system<ppT> &constraint_system);
@@ -0,0 +1,147 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "util.h"
+
+#if defined(__linux__)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#define USE_KQUEUE 1
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+
+namespace {
+
+//! Number of events fetched from the kernel per call
+static const int MAX_EVENTS = 256;
+
+#ifdef USE_EPOLL
+class CSocketEventsEpoll : public CSocketEvents
+{
+private:
+    int fd;
+
+public:
+    explicit CSocketEventsEpoll(int fdIn) : fd(fdIn) {}
+    ~CSocketEventsEpoll() { close(fd); }
+
+    bool Add(SOCKET hSocket, int64_t nTag, bool fListen)
+    {
+        struct epoll_event ev;
+        ev.events = fListen ? EPOLLIN : (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        ev.data.u64 = nTag;
+        if (epoll_ctl(fd, EPOLL_CTL_ADD, hSocket, &ev) == 0)
+            return true;
+        // The descriptor of a socket closed in a child process that inherited it
+        if (errno == EEXIST && epoll_ctl(fd, EPOLL_CTL_MOD, hSocket, &ev) == 0)
+            return true;
+        return error("%s: epoll_ctl failed: %s", __func__, NetworkErrorString(errno));
+    }
+
+    bool Wait(std::vector<Event>& vEvents, int nTimeout)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(fd, events, MAX_EVENTS, nTimeout);
+        if (n < 0)
+            return errno == EINTR;
+        for (int i = 0; i < n; i++) {
+            Event event;
+            event.nTag = events[i].data.u64;
+            event.nFlags = 0;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                event.nFlags |= EVENT_RECV;
+            if (events[i].events & EPOLLOUT)
+                event.nFlags |= EVENT_SEND;
+            vEvents.push_back(event);
+        }
+        return true;
+    }
+
+    const char* GetName() const { return "epoll"; }
+};
+#endif
+
+#ifdef USE_KQUEUE
+class CSocketEventsKqueue : public CSocketEvents
+{
+private:
+    int fd;
+
+public:
+    explicit CSocketEventsKqueue(int fdIn) : fd(fdIn) {}
+    ~CSocketEventsKqueue() { close(fd); }
+
+    bool Add(SOCKET hSocket, int64_t nTag, bool fListen)
+    {
+        struct kevent changes[2];
+        int n = 0;
+        EV_SET(&changes[n++], hSocket, EVFILT_READ, EV_ADD | (fListen ? 0 : EV_CLEAR), 0, 0, (void*)(intptr_t)nTag);
+        if (!fListen)
+            EV_SET(&changes[n++], hSocket, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, (void*)(intptr_t)nTag);
+        if (kevent(fd, changes, n, NULL, 0, NULL) != 0)
+            return error("%s: kevent failed: %s", __func__, NetworkErrorString(errno));
+        return true;
+    }
+
+    bool Wait(std::vector<Event>& vEvents, int nTimeout)
+    {
+        struct kevent events[MAX_EVENTS];
+        struct timespec ts;
+        ts.tv_sec = nTimeout / 1000;
+        ts.tv_nsec = (nTimeout % 1000) * 1000000;
+        int n = kevent(fd, NULL, 0, events, MAX_EVENTS, &ts);
+        if (n < 0)
+            return errno == EINTR;
+        for (int i = 0; i < n; i++) {
+            Event event;
+            event.nTag = (intptr_t)events[i].udata;
+            event.nFlags = 0;
+            if (events[i].filter == EVFILT_READ || (events[i].flags & (EV_EOF | EV_ERROR)))
+                event.nFlags |= EVENT_RECV;
+            if (events[i].filter == EVFILT_WRITE)
+                event.nFlags |= EVENT_SEND;
+            vEvents.push_back(event);
+        }
+        return true;
+    }
+
+    const char* GetName() const { return "kqueue"; }
+};
+#endif
+
+}
+
+bool CSocketEvents::IsSupported()
+{
+#if defined(USE_EPOLL) || defined(USE_KQUEUE)
+    return true;
+#else
+    return false;
+#endif
+}
+
+CSocketEvents* CSocketEvents::Create()
+{
+#if defined(USE_EPOLL)
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd >= 0)
+        return new CSocketEventsEpoll(fd);
+    LogPrintf("%s: epoll_create1 failed: %s\n", __func__, NetworkErrorString(errno));
+#elif defined(USE_KQUEUE)
+    int fd = kqueue();
+    if (fd >= 0)
+        return new CSocketEventsKqueue(fd);
+    LogPrintf("%s: kqueue failed: %s\n", __func__, NetworkErrorString(errno));
+#endif
+    return NULL;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#include "compat.h"
+
+#include <stdint.h>
+#include <vector>
+
+//! -socketevents default
+static const bool DEFAULT_SOCKET_EVENTS = true;
+
+/**
+ * Readiness notifications for many sockets at once, using epoll on Linux and
+ * kqueue on BSD and macOS. Unlike select() the cost of a wait does not grow
+ * with the number of sockets, and sockets above FD_SETSIZE can be watched.
+ *
+ * Peer sockets are edge-triggered: an event is only reported when new data
+ * arrives or send buffer space is freed, so the caller has to remember that a
+ * socket is ready until a read or write on it would block. Listening sockets
+ * are level-triggered. A socket stops being watched when it is closed.
+ */
+class CSocketEvents
+{
+public:
+    enum {
+        EVENT_RECV = 1,   //!< Data, end of stream or an error to read
+        EVENT_SEND = 2,   //!< Space in the send buffer
+    };
+
+    struct Event {
+        int64_t nTag;
+        int nFlags;
+    };
+
+    /** Whether this platform has a backend. */
+    static bool IsSupported();
+    /** Create the backend of this platform, or NULL if there is none or it failed. */
+    static CSocketEvents* Create();
+
+    virtual ~CSocketEvents() {}
+
+    /** Start watching a socket; nTag is reported back in its events. */
+    virtual bool Add(SOCKET hSocket, int64_t nTag, bool fListen) = 0;
+    /** Wait at most nTimeout milliseconds and append the events received to vEvents. */
+    virtual bool Wait(std::vector<Event>& vEvents, int nTimeout) = 0;
+    virtual const char* GetName() const = 0;
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
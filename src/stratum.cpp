@@ -0,0 +1,600 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "arith_uint256.h"
+#include "base58.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "miner.h"
+#include "netbase.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validationinterface.h"
+
+#include <map>
+#include <set>
+#include <string.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <univalue.h>
+
+namespace {
+
+/** Bytes of the header nonce fixed per connection (NONCE_1); the miner picks the rest */
+const size_t STRATUM_NONCE1_SIZE = 4;
+/** Longest request accepted, with plenty of room for a submit with an Equihash solution */
+const size_t MAX_STRATUM_LINE = 16384;
+const unsigned int MAX_STRATUM_CLIENTS = 128;
+/** Jobs kept at the same tip, so that shares for the last few are still accepted */
+const size_t MAX_STRATUM_JOBS = 8;
+/** Seconds after which a job is rebuilt, if the mempool has changed since */
+const int64_t STRATUM_JOB_REFRESH = 30;
+/** Seconds between checks of whether the job is due for a rebuild */
+const int STRATUM_REFRESH_CHECK = 5;
+
+/** Error codes of ZIP 301 */
+enum StratumError {
+    STRATUM_ERROR_OTHER = 20,
+    STRATUM_ERROR_JOB_NOT_FOUND = 21,
+    STRATUM_ERROR_DUPLICATE = 22,
+    STRATUM_ERROR_LOW_DIFFICULTY = 23,
+    STRATUM_ERROR_UNAUTHORIZED = 24,
+    STRATUM_ERROR_NOT_SUBSCRIBED = 25,
+};
+
+struct StratumJob
+{
+    CBlock block;
+    arith_uint256 target;
+    std::set<uint256> setShares;
+};
+
+struct StratumClient
+{
+    struct bufferevent* bev;
+    CService addr;
+    std::string strNonce1;
+    bool fSubscribed;
+    bool fAuthorized;
+};
+
+/** Wakes the Stratum thread up for a new job at each new tip */
+class CStratumNotifier : public CValidationInterface
+{
+protected:
+    virtual void UpdatedBlockTip(const CBlockIndex* pindex);
+};
+
+// Everything below is only touched by the Stratum thread once it is started
+struct event_base* eventBase = NULL;
+struct event* eventNewTip = NULL;
+struct event* eventRefresh = NULL;
+std::vector<struct evconnlistener*> vListeners;
+boost::thread threadStratum;
+CStratumNotifier stratumNotifier;
+
+std::vector<CSubNet> vStratumAllow;
+CScript scriptStratum;
+arith_uint256 shareTarget;
+
+std::set<StratumClient*> setClients;
+uint32_t nNextNonce1 = 0;
+
+//! Jobs by id, fixed-width hex so that the oldest comes first
+std::map<std::string, StratumJob> mapJobs;
+uint64_t nNextJob = 0;
+int64_t nJobTime = 0;
+unsigned int nJobTransactionsUpdated = 0;
+
+void CStratumNotifier::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    event_active(eventNewTip, 0, 0);
+}
+
+std::string EncodeLE32(uint32_t n)
+{
+    unsigned char b[4];
+    WriteLE32(b, n);
+    return HexStr(b, b + sizeof(b));
+}
+
+bool DecodeLE32(const std::string& str, uint32_t& n)
+{
+    if (str.size() != 8 || !IsHex(str))
+        return false;
+    std::vector<unsigned char> b = ParseHex(str);
+    n = ReadLE32(&b[0]);
+    return true;
+}
+
+UniValue Notification(const std::string& method, const UniValue& params)
+{
+    UniValue msg(UniValue::VOBJ);
+    msg.push_back(Pair("id", NullUniValue));
+    msg.push_back(Pair("method", method));
+    msg.push_back(Pair("params", params));
+    return msg;
+}
+
+UniValue Reply(const UniValue& id, const UniValue& result)
+{
+    UniValue msg(UniValue::VOBJ);
+    msg.push_back(Pair("id", id));
+    msg.push_back(Pair("result", result));
+    msg.push_back(Pair("error", NullUniValue));
+    return msg;
+}
+
+UniValue ReplyError(const UniValue& id, int code, const std::string& message)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(code);
+    error.push_back(message);
+    error.push_back(NullUniValue);
+    UniValue msg(UniValue::VOBJ);
+    msg.push_back(Pair("id", id));
+    msg.push_back(Pair("result", NullUniValue));
+    msg.push_back(Pair("error", error));
+    return msg;
+}
+
+void Send(StratumClient* client, const UniValue& msg)
+{
+    std::string strLine = msg.write() + "\n";
+    evbuffer_add(bufferevent_get_output(client->bev), strLine.data(), strLine.size());
+}
+
+UniValue TargetNotification(const StratumJob& job)
+{
+    UniValue params(UniValue::VARR);
+    params.push_back(ArithToUint256(job.target).GetHex());
+    return Notification("mining.set_target", params);
+}
+
+UniValue JobNotification(const std::string& strJob, const StratumJob& job, bool fClean)
+{
+    const CBlock& block = job.block;
+    UniValue params(UniValue::VARR);
+    params.push_back(strJob);
+    params.push_back(EncodeLE32(block.nVersion));
+    params.push_back(HexStr(block.hashPrevBlock.begin(), block.hashPrevBlock.end()));
+    params.push_back(HexStr(block.hashMerkleRoot.begin(), block.hashMerkleRoot.end()));
+    params.push_back(HexStr(block.hashReserved.begin(), block.hashReserved.end()));
+    params.push_back(EncodeLE32(block.nTime));
+    params.push_back(EncodeLE32(block.nBits));
+    params.push_back(fClean);
+    return Notification("mining.notify", params);
+}
+
+/** Build a job from a fresh CreateNewBlock template and hand it to every authorized client */
+void NewJob(bool fClean)
+{
+    if (IsInitialBlockDownload())
+        return;
+
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    boost::scoped_ptr<CBlockTemplate> pblocktemplate;
+    try {
+        pblocktemplate.reset(CreateNewBlock(scriptStratum));
+    } catch (const std::exception& e) {
+        LogPrintf("stratum: CreateNewBlock failed: %s\n", e.what());
+        return;
+    }
+    if (!pblocktemplate)
+        return;
+    CBlock& block = pblocktemplate->block;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    // Shares for jobs at an earlier tip are stale whatever the reason we were woken up for
+    if (mapJobs.empty() || mapJobs.rbegin()->second.block.hashPrevBlock != block.hashPrevBlock)
+        fClean = true;
+    bool fNewTarget = true;
+    if (fClean) {
+        mapJobs.clear();
+    } else {
+        while (mapJobs.size() >= MAX_STRATUM_JOBS)
+            mapJobs.erase(mapJobs.begin());
+    }
+
+    // Shares are never harder than the block itself
+    arith_uint256 blockTarget;
+    blockTarget.SetCompact(block.nBits);
+    arith_uint256 target = std::max(shareTarget, blockTarget);
+    if (!mapJobs.empty())
+        fNewTarget = mapJobs.rbegin()->second.target != target;
+
+    std::string strJob = strprintf("%016x", nNextJob++);
+    StratumJob& job = mapJobs[strJob];
+    job.block = block;
+    job.target = target;
+    nJobTime = GetTime();
+    nJobTransactionsUpdated = nTransactionsUpdated;
+    LogPrint("stratum", "stratum: job %s on %s with %u transactions\n",
+             strJob, block.hashPrevBlock.ToString(), block.vtx.size());
+
+    UniValue notifyTarget = TargetNotification(job);
+    UniValue notifyJob = JobNotification(strJob, job, fClean);
+    BOOST_FOREACH(StratumClient* client, setClients) {
+        if (!client->fAuthorized)
+            continue;
+        if (fNewTarget)
+            Send(client, notifyTarget);
+        Send(client, notifyJob);
+    }
+}
+
+void SubmitBlock(const StratumJob& job, const CBlockHeader& header)
+{
+    CBlock block(job.block);
+    block.nTime = header.nTime;
+    block.nNonce = header.nNonce;
+    block.nSolution = header.nSolution;
+    {
+        LOCK(cs_main);
+        MarkTemplateBlockChecked(block);
+    }
+
+    CValidationState state;
+    if (ProcessNewBlock(state, NULL, &block, true, NULL) && state.IsValid())
+        LogPrintf("stratum: block %s accepted\n", block.GetHash().ToString());
+    else
+        LogPrintf("stratum: block %s rejected: %s\n", block.GetHash().ToString(), state.GetRejectReason());
+}
+
+UniValue HandleSubmit(StratumClient* client, const UniValue& id, const UniValue& params)
+{
+    if (!client->fAuthorized)
+        return ReplyError(id, STRATUM_ERROR_UNAUTHORIZED, "Unauthorized worker");
+    if (params.size() < 5 || !params[1].isStr() || !params[2].isStr() || !params[3].isStr() || !params[4].isStr())
+        return ReplyError(id, STRATUM_ERROR_OTHER, "Malformed submit");
+
+    std::map<std::string, StratumJob>::iterator it = mapJobs.find(params[1].get_str());
+    if (it == mapJobs.end())
+        return ReplyError(id, STRATUM_ERROR_JOB_NOT_FOUND, "Job not found");
+    StratumJob& job = it->second;
+
+    uint32_t nTime;
+    if (!DecodeLE32(params[2].get_str(), nTime) || nTime < job.block.nTime || nTime > GetTime() + MAX_FUTURE_BLOCK_TIME_LOCAL)
+        return ReplyError(id, STRATUM_ERROR_OTHER, "Invalid ntime");
+
+    const std::string& strNonce2 = params[3].get_str();
+    if (strNonce2.size() != 2 * (32 - STRATUM_NONCE1_SIZE) || !IsHex(strNonce2))
+        return ReplyError(id, STRATUM_ERROR_OTHER, "Invalid nonce_2");
+    std::vector<unsigned char> vNonce = ParseHex(client->strNonce1 + strNonce2);
+
+    std::vector<unsigned char> vSolution;
+    try {
+        CDataStream ss(ParseHex(params[4].get_str()), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> vSolution;
+        if (!ss.empty())
+            throw std::ios_base::failure("trailing data");
+    } catch (const std::exception&) {
+        return ReplyError(id, STRATUM_ERROR_OTHER, "Invalid solution encoding");
+    }
+
+    CBlockHeader header = job.block.GetBlockHeader();
+    header.nTime = nTime;
+    memcpy(header.nNonce.begin(), &vNonce[0], vNonce.size());
+    header.nSolution = vSolution;
+
+    uint256 hash = header.GetHash();
+    if (job.setShares.count(hash))
+        return ReplyError(id, STRATUM_ERROR_DUPLICATE, "Duplicate share");
+    if (!CheckEquihashSolution(&header, Params()))
+        return ReplyError(id, STRATUM_ERROR_OTHER, "Invalid solution");
+    if (UintToArith256(hash) > job.target)
+        return ReplyError(id, STRATUM_ERROR_LOW_DIFFICULTY, "Low difficulty share");
+    job.setShares.insert(hash);
+
+    arith_uint256 blockTarget;
+    blockTarget.SetCompact(header.nBits);
+    if (UintToArith256(hash) <= blockTarget)
+        SubmitBlock(job, header);
+    return Reply(id, true);
+}
+
+/** Handle one request line; returns false if the client should be dropped */
+bool HandleLine(StratumClient* client, const std::string& strLine)
+{
+    UniValue request;
+    if (!request.read(strLine) || !request.isObject())
+        return false;
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr() || !params.isArray())
+        return false;
+
+    const std::string& strMethod = method.get_str();
+    if (strMethod == "mining.subscribe") {
+        client->fSubscribed = true;
+        UniValue result(UniValue::VARR);
+        result.push_back(NullUniValue); // Sessions are not resumed
+        result.push_back(client->strNonce1);
+        Send(client, Reply(id, result));
+    } else if (strMethod == "mining.authorize") {
+        if (!client->fSubscribed) {
+            Send(client, ReplyError(id, STRATUM_ERROR_NOT_SUBSCRIBED, "Not subscribed"));
+            return true;
+        }
+        client->fAuthorized = true;
+        Send(client, Reply(id, true));
+        if (!mapJobs.empty()) {
+            Send(client, TargetNotification(mapJobs.rbegin()->second));
+            Send(client, JobNotification(mapJobs.rbegin()->first, mapJobs.rbegin()->second, true));
+        }
+    } else if (strMethod == "mining.submit") {
+        Send(client, HandleSubmit(client, id, params));
+    } else {
+        Send(client, ReplyError(id, STRATUM_ERROR_OTHER, "Method not found"));
+    }
+    return true;
+}
+
+void Disconnect(StratumClient* client)
+{
+    LogPrint("stratum", "stratum: disconnecting %s\n", client->addr.ToString());
+    bufferevent_free(client->bev);
+    setClients.erase(client);
+    delete client;
+}
+
+void ReadCallback(struct bufferevent* bev, void* ctx)
+{
+    StratumClient* client = static_cast<StratumClient*>(ctx);
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char* line;
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_CRLF)) != NULL) {
+        std::string strLine(line, n_read_out);
+        free(line);
+        if (!HandleLine(client, strLine)) {
+            Disconnect(client);
+            return;
+        }
+    }
+    if (evbuffer_get_length(input) > MAX_STRATUM_LINE)
+        Disconnect(client);
+}
+
+void EventCallback(struct bufferevent* bev, short what, void* ctx)
+{
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+        Disconnect(static_cast<StratumClient*>(ctx));
+}
+
+bool ClientAllowed(const CNetAddr& netaddr)
+{
+    BOOST_FOREACH(const CSubNet& subnet, vStratumAllow)
+        if (subnet.Match(netaddr))
+            return true;
+    return false;
+}
+
+void AcceptCallback(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* address, int socklen, void* ctx)
+{
+    CService addr;
+    if (!addr.SetSockAddr(address) || !ClientAllowed(addr) || setClients.size() >= MAX_STRATUM_CLIENTS) {
+        LogPrint("stratum", "stratum: refusing connection from %s\n", addr.ToString());
+        evutil_closesocket(fd);
+        return;
+    }
+    struct bufferevent* bev = bufferevent_socket_new(eventBase, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+
+    StratumClient* client = new StratumClient();
+    client->bev = bev;
+    client->addr = addr;
+    client->strNonce1 = EncodeLE32(nNextNonce1++);
+    client->fSubscribed = false;
+    client->fAuthorized = false;
+    setClients.insert(client);
+    bufferevent_setcb(bev, ReadCallback, NULL, EventCallback, client);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+    LogPrint("stratum", "stratum: accepted connection from %s\n", addr.ToString());
+}
+
+void NewTipCallback(evutil_socket_t, short, void*)
+{
+    NewJob(true);
+}
+
+void RefreshCallback(evutil_socket_t, short, void*)
+{
+    if (mapJobs.empty() || (mempool.GetTransactionsUpdated() != nJobTransactionsUpdated &&
+                            GetTime() - nJobTime >= STRATUM_JOB_REFRESH))
+        NewJob(false);
+}
+
+bool InitStratumAllowList()
+{
+    vStratumAllow.clear();
+    vStratumAllow.push_back(CSubNet("127.0.0.0/8")); // always allow IPv4 local subnet
+    vStratumAllow.push_back(CSubNet("::1"));         // always allow IPv6 localhost
+    if (mapMultiArgs.count("-stratumallowip")) {
+        const std::vector<std::string>& vAllow = mapMultiArgs["-stratumallowip"];
+        BOOST_FOREACH (std::string strAllow, vAllow) {
+            CSubNet subnet(strAllow);
+            if (!subnet.IsValid()) {
+                uiInterface.ThreadSafeMessageBox(
+                    strprintf("Invalid -stratumallowip subnet specification: %s. Valid are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24).", strAllow),
+                    "", CClientUIInterface::MSG_ERROR);
+                return false;
+            }
+            vStratumAllow.push_back(subnet);
+        }
+    }
+    return true;
+}
+
+bool BindStratumAddresses()
+{
+    int defaultPort = GetArg("-stratumport", DEFAULT_STRATUM_PORT);
+    std::vector<std::pair<std::string, int> > endpoints;
+
+    // Determine what addresses to bind to, as for the RPC server
+    if (!mapArgs.count("-stratumallowip")) {
+        endpoints.push_back(std::make_pair("::1", defaultPort));
+        endpoints.push_back(std::make_pair("127.0.0.1", defaultPort));
+        if (mapArgs.count("-stratumbind"))
+            LogPrintf("WARNING: option -stratumbind was ignored because -stratumallowip was not specified, refusing to allow everyone to connect\n");
+    } else if (mapArgs.count("-stratumbind")) {
+        const std::vector<std::string>& vbind = mapMultiArgs["-stratumbind"];
+        for (std::vector<std::string>::const_iterator i = vbind.begin(); i != vbind.end(); ++i) {
+            int port = defaultPort;
+            std::string host;
+            SplitHostPort(*i, port, host);
+            endpoints.push_back(std::make_pair(host, port));
+        }
+    } else {
+        endpoints.push_back(std::make_pair("::", defaultPort));
+        endpoints.push_back(std::make_pair("0.0.0.0", defaultPort));
+    }
+
+    for (std::vector<std::pair<std::string, int> >::iterator i = endpoints.begin(); i != endpoints.end(); ++i) {
+        CService addr;
+        struct sockaddr_storage sockaddr;
+        socklen_t len = sizeof(sockaddr);
+        struct evconnlistener* listener = NULL;
+        if (LookupNumeric(i->first.c_str(), addr, i->second) && addr.GetSockAddr((struct sockaddr*)&sockaddr, &len))
+            listener = evconnlistener_new_bind(eventBase, AcceptCallback, NULL, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE,
+                                               -1, (struct sockaddr*)&sockaddr, len);
+        if (listener) {
+            LogPrint("stratum", "Binding Stratum on address %s port %i\n", i->first, i->second);
+            vListeners.push_back(listener);
+        } else {
+            LogPrintf("Binding Stratum on address %s port %i failed.\n", i->first, i->second);
+        }
+    }
+    return !vListeners.empty();
+}
+
+void ThreadStratum()
+{
+    RenameThread("horizen-stratum");
+    LogPrint("stratum", "Entering Stratum event loop\n");
+    event_base_dispatch(eventBase);
+    LogPrint("stratum", "Exited Stratum event loop\n");
+}
+
+void FreeStratumEvents()
+{
+    BOOST_FOREACH(StratumClient* client, setClients) {
+        bufferevent_free(client->bev);
+        delete client;
+    }
+    setClients.clear();
+    BOOST_FOREACH(struct evconnlistener* listener, vListeners)
+        evconnlistener_free(listener);
+    vListeners.clear();
+    if (eventNewTip)
+        event_free(eventNewTip);
+    if (eventRefresh)
+        event_free(eventRefresh);
+    eventNewTip = eventRefresh = NULL;
+    event_base_free(eventBase);
+    eventBase = NULL;
+    mapJobs.clear();
+}
+
+} // anon namespace
+
+bool StartStratumServer()
+{
+    if (!GetBoolArg("-stratum", DEFAULT_STRATUM_ENABLE))
+        return true;
+    assert(!eventBase);
+
+    CBitcoinAddress address(GetArg("-mineraddress", ""));
+    CKeyID keyID;
+    if (!address.GetKeyID(keyID)) {
+        uiInterface.ThreadSafeMessageBox(
+            "-stratum requires -mineraddress to be set to a transparent address",
+            "", CClientUIInterface::MSG_ERROR);
+        return false;
+    }
+    scriptStratum = CScript() << OP_DUP << OP_HASH160 << ToByteVector(keyID) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    int64_t nDifficulty = GetArg("-stratumdifficulty", DEFAULT_STRATUM_DIFFICULTY);
+    if (nDifficulty < 1) {
+        uiInterface.ThreadSafeMessageBox(
+            strprintf("Invalid -stratumdifficulty: %d (must be at least 1)", nDifficulty),
+            "", CClientUIInterface::MSG_ERROR);
+        return false;
+    }
+    shareTarget = UintToArith256(Params().GetConsensus().powLimit) / arith_uint256((uint64_t)nDifficulty);
+
+    if (!InitStratumAllowList())
+        return false;
+
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    eventBase = event_base_new();
+    if (!eventBase) {
+        LogPrintf("stratum: Unable to create event_base\n");
+        return false;
+    }
+    if (!BindStratumAddresses()) {
+        LogPrintf("Unable to bind any endpoint for Stratum server\n");
+        FreeStratumEvents();
+        return false;
+    }
+
+    eventNewTip = event_new(eventBase, -1, 0, NewTipCallback, NULL);
+    eventRefresh = event_new(eventBase, -1, EV_PERSIST, RefreshCallback, NULL);
+    struct timeval tv = {STRATUM_REFRESH_CHECK, 0};
+    event_add(eventRefresh, &tv);
+    GetRandBytes((unsigned char*)&nNextNonce1, sizeof(nNextNonce1));
+
+    RegisterValidationInterface(&stratumNotifier);
+    // The first job is built by the Stratum thread, as are all later ones
+    event_active(eventNewTip, 0, 0);
+    threadStratum = boost::thread(&ThreadStratum);
+    LogPrintf("Stratum server listening on port %i\n", GetArg("-stratumport", DEFAULT_STRATUM_PORT));
+    return true;
+}
+
+void InterruptStratumServer()
+{
+    if (eventBase) {
+        LogPrint("stratum", "Interrupting Stratum server\n");
+        event_base_loopbreak(eventBase);
+    }
+}
+
+void StopStratumServer()
+{
+    if (!eventBase)
+        return;
+    LogPrint("stratum", "Stopping Stratum server\n");
+    UnregisterValidationInterface(&stratumNotifier);
+    event_base_loopbreak(eventBase);
+    threadStratum.join();
+    FreeStratumEvents();
+}
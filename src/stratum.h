@@ -0,0 +1,26 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * Equihash Stratum (ZIP 301) work server, handing out jobs built by
+ * CreateNewBlock and submitting the blocks found straight to ProcessNewBlock.
+ */
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include <stdint.h>
+
+static const bool DEFAULT_STRATUM_ENABLE = false;
+static const uint16_t DEFAULT_STRATUM_PORT = 3333;
+/** Share difficulty, as a divisor of the proof of work limit */
+static const int64_t DEFAULT_STRATUM_DIFFICULTY = 1;
+
+/** Start the Stratum server, if -stratum is set. Returns false on configuration errors. */
+bool StartStratumServer();
+/** Break out of the Stratum event loop */
+void InterruptStratumServer();
+/** Stop the Stratum server and drop its clients */
+void StopStratumServer();
+
+#endif // BITCOIN_STRATUM_H
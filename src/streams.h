@@ -113,17 +113,15 @@ public:
     }
 #endif
 
-    CBaseDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    // Byte vectors of any allocator, vector_type included
+    template<typename Allocator>
+    CBaseDataStream(const std::vector<char, Allocator>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CBaseDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
-    {
-        Init(nTypeIn, nVersionIn);
-    }
-
-    CBaseDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    template<typename Allocator>
+    CBaseDataStream(const std::vector<unsigned char, Allocator>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
@@ -162,6 +160,7 @@ public:
     const_iterator end() const                       { return vch.end(); }
     iterator end()                                   { return vch.end(); }
     size_type size() const                           { return vch.size() - nReadPos; }
+    size_type capacity() const                       { return vch.capacity(); }
     bool empty() const                               { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c=0)         { vch.resize(n + nReadPos, c); }
     void reserve(size_type n)                        { vch.reserve(n + nReadPos); }
@@ -251,6 +250,13 @@ public:
         return true;
     }
 
+    // Exchange the whole buffer with vchOther, to reuse an allocation; reading starts over
+    void Swap(vector_type& vchOther)
+    {
+        vch.swap(vchOther);
+        nReadPos = 0;
+    }
+
 
     //
     // Stream subset
@@ -343,8 +349,12 @@ public:
         return (*this);
     }
 
-    void GetAndClear(CSerializeData &d) {
-        d.insert(d.end(), begin(), end());
+    // Move the unread data to the end of d; into an empty d the buffer is handed over, not copied
+    void GetAndClear(vector_type &d) {
+        if (d.empty() && nReadPos == 0)
+            d.swap(vch);
+        else
+            d.insert(d.end(), begin(), end());
         clear();
     }
 };
@@ -362,13 +372,43 @@ public:
             CBaseDataStream(pbegin, pend, nTypeIn, nVersionIn) { }
 #endif
 
-    CDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) :
+    template<typename Allocator>
+    CDataStream(const std::vector<char, Allocator>& vchIn, int nTypeIn, int nVersionIn) :
             CBaseDataStream(vchIn, nTypeIn, nVersionIn) { }
 
-    CDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) :
+    template<typename Allocator>
+    CDataStream(const std::vector<unsigned char, Allocator>& vchIn, int nTypeIn, int nVersionIn) :
+            CBaseDataStream(vchIn, nTypeIn, nVersionIn) { }
+
+};
+
+/**
+ * Byte-vector for data that is public anyway: blocks, transactions and the
+ * network messages carrying them. Unlike CSerializeData it is not cleared
+ * before deletion, which for blocks costs as much as writing them.
+ */
+typedef std::vector<char> CPublicSerializeData;
+
+/** A CDataStream for public data only, its buffer is freed without being cleared */
+class CPublicDataStream : public CBaseDataStream<CPublicSerializeData>
+{
+public:
+    explicit CPublicDataStream(int nTypeIn, int nVersionIn) : CBaseDataStream(nTypeIn, nVersionIn) { }
+
+    CPublicDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) :
+            CBaseDataStream(pbegin, pend, nTypeIn, nVersionIn) { }
+
+#if !defined(_MSC_VER) || _MSC_VER >= 1300
+    CPublicDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) :
+            CBaseDataStream(pbegin, pend, nTypeIn, nVersionIn) { }
+#endif
+
+    template<typename Allocator>
+    CPublicDataStream(const std::vector<char, Allocator>& vchIn, int nTypeIn, int nVersionIn) :
             CBaseDataStream(vchIn, nTypeIn, nVersionIn) { }
 
-    CDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) :
+    template<typename Allocator>
+    CPublicDataStream(const std::vector<unsigned char, Allocator>& vchIn, int nTypeIn, int nVersionIn) :
             CBaseDataStream(vchIn, nTypeIn, nVersionIn) { }
 
 };
@@ -661,4 +701,47 @@ public:
     }
 };
 
+/** Stream subset deserializing straight from a read-only buffer it does not own, without copying it. */
+class CMemoryReader
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    int nType;
+    int nVersion;
+
+public:
+    CMemoryReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pbegin(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+    size_t size() const          { return pend - pbegin; }
+
+    CMemoryReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::read(): end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+        return (*this);
+    }
+
+    CMemoryReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CMemoryReader::ignore(): end of data");
+        pbegin += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CMemoryReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 #endif // BITCOIN_STREAMS_H
@@ -6,13 +6,16 @@
 #ifndef BITCOIN_SUPPORT_ALLOCATORS_SECURE_H
 #define BITCOIN_SUPPORT_ALLOCATORS_SECURE_H
 
-#include "support/pagelocker.h"
+#include "support/cleanse.h"
+#include "support/lockedpool.h"
 
+#include <new>
 #include <string>
 
 //
 // Allocator that locks its contents from being paged
 // out of memory and clears its contents before deletion.
+// The memory comes from LockedPoolManager, locked in blocks.
 //
 template <typename T>
 struct secure_allocator : public std::allocator<T> {
@@ -39,10 +42,9 @@ struct secure_allocator : public std::allocator<T> {
 
     T* allocate(std::size_t n, const void* hint = 0)
     {
-        T* p;
-        p = std::allocator<T>::allocate(n, hint);
-        if (p != NULL)
-            LockedPageManager::Instance().LockRange(p, sizeof(T) * n);
+        T* p = static_cast<T*>(LockedPoolManager::Instance().Alloc(sizeof(T) * n));
+        if (p == NULL)
+            throw std::bad_alloc();
         return p;
     }
 
@@ -50,9 +52,8 @@ struct secure_allocator : public std::allocator<T> {
     {
         if (p != NULL) {
             memory_cleanse(p, sizeof(T) * n);
-            LockedPageManager::Instance().UnlockRange(p, sizeof(T) * n);
+            LockedPoolManager::Instance().Free(p);
         }
-        std::allocator<T>::deallocate(p, n);
     }
 };
 
@@ -0,0 +1,131 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "support/lockedpool.h"
+
+#include "support/cleanse.h"
+#include "support/pagelocker.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#ifdef WIN32
+#ifdef _WIN32_WINNT
+#undef _WIN32_WINNT
+#endif
+#define _WIN32_WINNT 0x0501
+#define WIN32_LEAN_AND_MEAN 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+LockedPoolManager* LockedPoolManager::_instance = NULL;
+boost::once_flag LockedPoolManager::init_flag = BOOST_ONCE_INIT;
+
+Arena::Arena(void* base_in, size_t size, size_t alignment_in) :
+    base(static_cast<char*>(base_in)), end(static_cast<char*>(base_in) + size), alignment(alignment_in)
+{
+    // The whole block is one free chunk to begin with
+    SizeToChunkMap::iterator it = size_to_free_chunk.insert(std::make_pair(size, base));
+    chunks_free[base] = it;
+    chunks_free_end[end] = it;
+}
+
+void* Arena::Alloc(size_t size)
+{
+    size = (size + alignment - 1) & ~(alignment - 1);
+    SizeToChunkMap::iterator it = size_to_free_chunk.lower_bound(size);
+    if (it == size_to_free_chunk.end())
+        return NULL;
+
+    // Take the piece from the end of the chunk, so that what is left of it keeps its start
+    char* chunk = it->second;
+    const size_t size_left = it->first - size;
+    char* piece = chunk + size_left;
+    chunks_free_end.erase(chunk + it->first);
+    size_to_free_chunk.erase(it);
+    if (size_left > 0) {
+        SizeToChunkMap::iterator it_left = size_to_free_chunk.insert(std::make_pair(size_left, chunk));
+        chunks_free[chunk] = it_left;
+        chunks_free_end[piece] = it_left;
+    } else {
+        chunks_free.erase(chunk);
+    }
+    chunks_used[piece] = size;
+    return piece;
+}
+
+void Arena::Free(void* ptr)
+{
+    std::map<char*, size_t>::iterator it_used = chunks_used.find(static_cast<char*>(ptr));
+    assert(it_used != chunks_used.end()); // Cannot free a piece that was not handed out
+    char* chunk = it_used->first;
+    size_t size = it_used->second;
+    chunks_used.erase(it_used);
+
+    // Merge with the free chunks before and after
+    std::map<char*, SizeToChunkMap::iterator>::iterator it_prev = chunks_free_end.find(chunk);
+    if (it_prev != chunks_free_end.end()) {
+        chunk -= it_prev->second->first;
+        size += it_prev->second->first;
+        size_to_free_chunk.erase(it_prev->second);
+        chunks_free_end.erase(it_prev);
+    }
+    std::map<char*, SizeToChunkMap::iterator>::iterator it_next = chunks_free.find(chunk + size);
+    if (it_next != chunks_free.end()) {
+        size += it_next->second->first;
+        size_to_free_chunk.erase(it_next->second);
+        chunks_free.erase(it_next);
+    }
+    SizeToChunkMap::iterator it = size_to_free_chunk.insert(std::make_pair(size, chunk));
+    chunks_free[chunk] = it;
+    chunks_free_end[chunk + size] = it;
+}
+
+size_t Arena::GetUsed() const
+{
+    size_t used = 0;
+    for (const std::pair<char* const, size_t>& chunk : chunks_used)
+        used += chunk.second;
+    return used;
+}
+
+void* LockedPageAllocator::AllocateLocked(size_t len, bool* fLocked)
+{
+    void* addr;
+#ifdef WIN32
+    addr = VirtualAlloc(NULL, len, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+#ifdef MADV_DONTDUMP
+    // Keep secrets out of core dumps as well
+    madvise(addr, len, MADV_DONTDUMP);
+#endif
+#endif
+    if (addr)
+        *fLocked = MemoryPageLocker().Lock(addr, len);
+    return addr;
+}
+
+void LockedPageAllocator::FreeLocked(void* addr, size_t len)
+{
+    memory_cleanse(addr, len);
+    MemoryPageLocker().Unlock(addr, len);
+#ifdef WIN32
+    VirtualFree(addr, 0, MEM_RELEASE);
+#else
+    munmap(addr, len);
+#endif
+}
+
+LockedPoolManager::LockedPoolManager() : LockedPoolBase<LockedPageAllocator>(GetSystemPageSize())
+{
+}
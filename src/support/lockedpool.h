@@ -0,0 +1,199 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_LOCKEDPOOL_H
+#define BITCOIN_SUPPORT_LOCKEDPOOL_H
+
+#include <assert.h>
+#include <list>
+#include <map>
+#include <stddef.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/once.hpp>
+
+/**
+ * Hands out pieces of one block of memory, best fit first. A piece freed is
+ * merged with the free pieces next to it, so that the block does not end up
+ * cut into pieces too small to use.
+ */
+class Arena
+{
+public:
+    Arena(void* base, size_t size, size_t alignment);
+
+    /** A piece of at least size bytes, NULL if there is no free piece that large */
+    void* Alloc(size_t size);
+    /** Give back a piece from Alloc */
+    void Free(void* ptr);
+
+    bool Contains(const void* ptr) const { return ptr >= base && ptr < end; }
+    bool IsEmpty() const { return chunks_used.empty(); }
+    void* GetBase() const { return base; }
+    size_t GetSize() const { return end - base; }
+    size_t GetUsed() const;
+    size_t GetChunksFree() const { return chunks_free.size(); }
+
+private:
+    typedef std::multimap<size_t, char*> SizeToChunkMap;
+    //! The free chunks, by size, to find the best fit
+    SizeToChunkMap size_to_free_chunk;
+    //! The free chunks by their start and by their end, to merge a chunk freed with its neighbours
+    std::map<char*, SizeToChunkMap::iterator> chunks_free;
+    std::map<char*, SizeToChunkMap::iterator> chunks_free_end;
+    //! The pieces handed out, with their sizes
+    std::map<char*, size_t> chunks_used;
+
+    char* base;
+    char* end;
+    size_t alignment;
+};
+
+/** The use of a LockedPool, for tests and diagnostics */
+struct LockedPoolStats {
+    size_t used;
+    size_t total;
+    //! The part of total that could be locked
+    size_t locked;
+    size_t arenas;
+};
+
+/**
+ * Memory for keys and other secrets, from blocks of pages that are locked
+ * once, when they are allocated, and handed out by an Arena each. This
+ * spares allocating secrets a call to the OS and the page bookkeeping of
+ * LockedPageManager each time. An allocation larger than a block gets a
+ * block of its own. A block that is no longer used is given back to the
+ * OS, unless it is the last one.
+ *
+ * The Allocator policy class allocates and frees the locked blocks, so that
+ * tests need not lock memory.
+ */
+template <class Allocator>
+class LockedPoolBase
+{
+public:
+    //! Size of the blocks of locked memory
+    static const size_t ARENA_SIZE = 256 * 1024;
+    //! Alignment of the pieces handed out, enough for any type
+    static const size_t ARENA_ALIGN = 16;
+
+    explicit LockedPoolBase(size_t page_size) : page_size(page_size)
+    {
+        assert(!(page_size & (page_size - 1))); // size must be power of two
+    }
+
+    ~LockedPoolBase()
+    {
+        for (LockedArena& arena : arenas)
+            allocator.FreeLocked(arena.GetBase(), arena.GetSize());
+    }
+
+    /** At least size bytes of locked memory, NULL if no more memory can be allocated */
+    void* Alloc(size_t size)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        // Pieces are never empty, so that each one has an address of its own
+        if (size == 0)
+            size = 1;
+        for (LockedArena& arena : arenas) {
+            void* p = arena.Alloc(size);
+            if (p)
+                return p;
+        }
+        size_t arena_size = (size + page_size - 1) & ~(page_size - 1);
+        if (arena_size < ARENA_SIZE)
+            arena_size = ARENA_SIZE;
+        bool fLocked = false;
+        void* base = allocator.AllocateLocked(arena_size, &fLocked);
+        if (!base)
+            return NULL;
+        arenas.emplace_back(base, arena_size, fLocked);
+        return arenas.back().Alloc(size);
+    }
+
+    /** Give back memory from Alloc; its contents are left as they are */
+    void Free(void* ptr)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        for (typename std::list<LockedArena>::iterator it = arenas.begin(); it != arenas.end(); ++it) {
+            if (!it->Contains(ptr))
+                continue;
+            it->Free(ptr);
+            if (it->IsEmpty() && arenas.size() > 1) {
+                allocator.FreeLocked(it->GetBase(), it->GetSize());
+                arenas.erase(it);
+            }
+            return;
+        }
+        assert(!"Cannot free memory that was not allocated from the pool");
+    }
+
+    LockedPoolStats GetStats()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        LockedPoolStats stats = {0, 0, 0, arenas.size()};
+        for (const LockedArena& arena : arenas) {
+            stats.used += arena.GetUsed();
+            stats.total += arena.GetSize();
+            if (arena.fLocked)
+                stats.locked += arena.GetSize();
+        }
+        return stats;
+    }
+
+private:
+    struct LockedArena : public Arena {
+        //! Whether the OS let the block be locked; it is used either way
+        bool fLocked;
+
+        LockedArena(void* base, size_t size, bool fLockedIn) : Arena(base, size, ARENA_ALIGN), fLocked(fLockedIn) {}
+    };
+
+    Allocator allocator;
+    boost::mutex mutex;
+    size_t page_size;
+    std::list<LockedArena> arenas;
+};
+
+/**
+ * OS-dependent allocation of locked blocks of pages.
+ * Defined as policy class to make stubbing for test possible.
+ */
+class LockedPageAllocator
+{
+public:
+    /** Allocate len bytes of pages and lock them, setting fLocked to whether locking worked. NULL on failure */
+    void* AllocateLocked(size_t len, bool* fLocked);
+    /** Cleanse, unlock and free pages from AllocateLocked */
+    void FreeLocked(void* addr, size_t len);
+};
+
+/**
+ * Singleton pool of locked memory, for secure_allocator. Created on demand
+ * for the same reasons as LockedPageManager.
+ */
+class LockedPoolManager : public LockedPoolBase<LockedPageAllocator>
+{
+public:
+    static LockedPoolManager& Instance()
+    {
+        boost::call_once(LockedPoolManager::CreateInstance, LockedPoolManager::init_flag);
+        return *LockedPoolManager::_instance;
+    }
+
+private:
+    LockedPoolManager();
+
+    static void CreateInstance()
+    {
+        static LockedPoolManager instance;
+        LockedPoolManager::_instance = &instance;
+    }
+
+    static LockedPoolManager* _instance;
+    static boost::once_flag init_flag;
+};
+
+#endif // BITCOIN_SUPPORT_LOCKEDPOOL_H
@@ -31,8 +31,7 @@
 LockedPageManager* LockedPageManager::_instance = NULL;
 boost::once_flag LockedPageManager::init_flag = BOOST_ONCE_INIT;
 
-/** Determine system page size in bytes */
-static inline size_t GetSystemPageSize()
+size_t GetSystemPageSize()
 {
     size_t page_size;
 #if defined(WIN32)
@@ -119,6 +119,9 @@ public:
     bool Unlock(const void* addr, size_t len);
 };
 
+/** Determine system page size in bytes */
+size_t GetSystemPageSize();
+
 /**
  * Singleton class to keep track of locked (ie, non-swappable) memory pages, for use in
  * std::allocator templates.
@@ -9,9 +9,101 @@
 
 #include <stdio.h>
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 
+std::atomic<unsigned int> nLockProfileInterval(DEFAULT_LOCK_PROFILE_INTERVAL);
+
+CLockTimes::CLockTimes() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+{
+    for (int i = 0; i < LOCK_PROFILE_BUCKETS; i++)
+        vBuckets[i] = 0;
+}
+
+void CLockTimes::Add(int64_t nMicros)
+{
+    // The clock is not monotonic
+    uint64_t n = nMicros > 0 ? nMicros : 0;
+    int nBucket = 0;
+    while (nBucket < LOCK_PROFILE_BUCKETS - 1 && n >= ((uint64_t)1 << nBucket))
+        nBucket++;
+    vBuckets[nBucket]++;
+    nCount++;
+    nTotalMicros += n;
+    nMaxMicros = std::max(nMaxMicros, n);
+}
+
+void CLockTimes::Add(const CLockTimes& other)
+{
+    for (int i = 0; i < LOCK_PROFILE_BUCKETS; i++)
+        vBuckets[i] += other.vBuckets[i];
+    nCount += other.nCount;
+    nTotalMicros += other.nTotalMicros;
+    nMaxMicros = std::max(nMaxMicros, other.nMaxMicros);
+}
+
+struct CLockSite {
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    CLockTimes wait;
+    CLockTimes hold;
+};
+
+// A plain mutex, so the profiler does not profile itself. Sites are keyed by
+// the string literals of the LOCK macros, which makes them as many as the
+// LOCK statements at most, and they are never deleted, so that acquisitions
+// still holding a lock can record into theirs.
+static std::mutex csLockProfile;
+static std::map<std::tuple<const char*, const char*, int>, std::unique_ptr<CLockSite> > mapLockSites;
+
+CLockSite* LockProfileEnter(const char* pszName, const char* pszFile, int nLine, int64_t nWaitMicros)
+{
+    std::lock_guard<std::mutex> lock(csLockProfile);
+    std::unique_ptr<CLockSite>& site = mapLockSites[std::make_tuple(pszName, pszFile, nLine)];
+    if (!site) {
+        site.reset(new CLockSite());
+        site->pszName = pszName;
+        site->pszFile = pszFile;
+        site->nLine = nLine;
+    }
+    site->wait.Add(nWaitMicros);
+    return site.get();
+}
+
+void LockProfileLeave(CLockSite* site, int64_t nHoldMicros)
+{
+    std::lock_guard<std::mutex> lock(csLockProfile);
+    site->hold.Add(nHoldMicros);
+}
+
+std::vector<CLockSiteStats> GetLockProfile(bool fReset)
+{
+    std::lock_guard<std::mutex> lock(csLockProfile);
+    std::vector<CLockSiteStats> vStats;
+    vStats.reserve(mapLockSites.size());
+    for (auto& entry : mapLockSites) {
+        CLockSite& site = *entry.second;
+        CLockSiteStats stats;
+        stats.strName = site.pszName;
+        stats.strFile = site.pszFile;
+        stats.nLine = site.nLine;
+        stats.wait = site.wait;
+        stats.hold = site.hold;
+        vStats.push_back(stats);
+        if (fReset) {
+            site.wait = CLockTimes();
+            site.hold = CLockTimes();
+        }
+    }
+    return vStats;
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
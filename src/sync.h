@@ -7,6 +7,12 @@
 #define BITCOIN_SYNC_H
 
 #include "threadsafety.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -99,16 +105,75 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+//! -lockprofile default: one in this many lock acquisitions of each thread is timed
+static const unsigned int DEFAULT_LOCK_PROFILE_INTERVAL = 1000;
+//! Buckets of the lock profiler histograms, see CLockTimes
+static const int LOCK_PROFILE_BUCKETS = 24;
+
+/** Sampled wait or hold times of a lock */
+struct CLockTimes {
+    uint64_t nCount;
+    uint64_t nTotalMicros;
+    uint64_t nMaxMicros;
+    //! Bucket i counts the times under 2^i microseconds that are not in a lower
+    //! bucket; the last bucket counts all the longer ones
+    uint64_t vBuckets[LOCK_PROFILE_BUCKETS];
+
+    CLockTimes();
+    void Add(int64_t nMicros);
+    void Add(const CLockTimes& other);
+};
+
+/** Sampled times of the acquisitions of a lock at one site */
+struct CLockSiteStats {
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    CLockTimes wait;
+    CLockTimes hold;
+};
+
+/**
+ * Lock profiler. It times one in nLockProfileInterval blocking acquisitions
+ * of each thread, so it can stay on in production; 0 turns it off. Only
+ * sampled acquisitions take the profiler's own lock.
+ */
+extern std::atomic<unsigned int> nLockProfileInterval;
+
+struct CLockSite;
+//! Record the wait of a sampled acquisition, returns the site to record its hold time in
+CLockSite* LockProfileEnter(const char* pszName, const char* pszFile, int nLine, int64_t nWaitMicros);
+void LockProfileLeave(CLockSite* site, int64_t nHoldMicros);
+//! Sampled times of all the sites so far, optionally clearing them
+std::vector<CLockSiteStats> GetLockProfile(bool fReset);
+
+inline bool LockProfileSample()
+{
+    static thread_local unsigned int nCountdown = 0;
+    // Restarts the countdown when the interval is lowered or disabled
+    unsigned int nInterval = nLockProfileInterval.load(std::memory_order_relaxed);
+    if (nCountdown > 1 && nCountdown <= nInterval) {
+        nCountdown--;
+        return false;
+    }
+    nCountdown = nInterval;
+    return nCountdown != 0;
+}
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    //! Where to record the hold time, if this acquisition was sampled
+    CLockSite* profileSite;
+    int64_t nLockedMicros;
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        int64_t nStart = LockProfileSample() ? GetTimeMicros() : 0;
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -117,6 +182,10 @@ private:
 #ifdef DEBUG_LOCKCONTENTION
         }
 #endif
+        if (nStart) {
+            nLockedMicros = GetTimeMicros();
+            profileSite = LockProfileEnter(pszName, pszFile, nLine, nLockedMicros - nStart);
+        }
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -129,7 +198,7 @@ private:
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), profileSite(NULL), nLockedMicros(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -137,7 +206,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : profileSite(NULL), nLockedMicros(0)
     {
         if (!pmutexIn) return;
 
@@ -150,8 +219,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (profileSite)
+                LockProfileLeave(profileSite, GetTimeMicros() - nLockedMicros);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -11,6 +11,11 @@
 #include "uint256.h"
 #include "test/test_bitcoin.h"
 #include "chainparams.h"
+#include "chain.h"
+#include "primitives/block.h"
+#include "random.h"
+
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -26,4 +31,75 @@ BOOST_AUTO_TEST_CASE(sanity)
     BOOST_CHECK(Checkpoints::GetTotalBlocksEstimate(checkpoints) >= 134444);
 }
 */
+
+BOOST_AUTO_TEST_CASE(checkpointed_chain)
+{
+    // Two chains of 20 blocks sharing the first 10
+    std::vector<uint256> vHashes(30);
+    std::vector<CBlockIndex> vMain(20), vFork(10);
+    for (int i = 0; i < 30; i++)
+        vHashes[i] = ArithToUint256(arith_uint256(i + 1));
+    for (int i = 0; i < 20; i++) {
+        vMain[i].nHeight = i;
+        vMain[i].pprev = i ? &vMain[i - 1] : NULL;
+        vMain[i].phashBlock = &vHashes[i];
+        vMain[i].BuildSkip();
+    }
+    for (int i = 0; i < 10; i++) {
+        vFork[i].nHeight = 10 + i;
+        vFork[i].pprev = i ? &vFork[i - 1] : &vMain[9];
+        vFork[i].phashBlock = &vHashes[20 + i];
+        vFork[i].BuildSkip();
+    }
+
+    Checkpoints::CCheckpointData data;
+    BOOST_CHECK(Checkpoints::IsOnCheckpointedChain(data, &vFork[9]));
+
+    data.mapCheckpoints[0] = vMain[0].GetBlockHash();
+    data.mapCheckpoints[5] = vMain[5].GetBlockHash();
+    BOOST_CHECK(Checkpoints::IsOnCheckpointedChain(data, &vMain[4]));
+    BOOST_CHECK(Checkpoints::IsOnCheckpointedChain(data, &vFork[9]));
+
+    data.mapCheckpoints[12] = vMain[12].GetBlockHash();
+    BOOST_CHECK(Checkpoints::IsOnCheckpointedChain(data, &vMain[12]));
+    BOOST_CHECK(Checkpoints::IsOnCheckpointedChain(data, &vMain[19]));
+    BOOST_CHECK(Checkpoints::IsOnCheckpointedChain(data, &vFork[1])); // below the checkpoint at 12
+    BOOST_CHECK(!Checkpoints::IsOnCheckpointedChain(data, &vFork[2]));
+    BOOST_CHECK(!Checkpoints::IsOnCheckpointedChain(data, &vFork[9]));
+}
+
+BOOST_AUTO_TEST_CASE(linked_to_checkpoint)
+{
+    // A batch of 10 headers after a parent at height 100
+    const uint256 hashParent = GetRandHash();
+    std::vector<CBlockHeader> headers(10);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].hashPrevBlock = i ? headers[i - 1].GetHash() : hashParent;
+        headers[i].nNonce = GetRandHash();
+    }
+
+    // No checkpoint among them, nothing vouches for the headers
+    Checkpoints::CCheckpointData data;
+    data.mapCheckpoints[100] = hashParent;
+    BOOST_CHECK_EQUAL(Checkpoints::CountLinkedToCheckpoint(data, 100, hashParent, headers), 0U);
+
+    // Up to the last checkpoint in the batch
+    data.mapCheckpoints[103] = headers[2].GetHash();
+    data.mapCheckpoints[107] = headers[6].GetHash();
+    BOOST_CHECK_EQUAL(Checkpoints::CountLinkedToCheckpoint(data, 100, hashParent, headers), 7U);
+
+    // A header that differs from a checkpoint ends the run, those before it stay linked
+    data.mapCheckpoints[107] = GetRandHash();
+    BOOST_CHECK_EQUAL(Checkpoints::CountLinkedToCheckpoint(data, 100, hashParent, headers), 3U);
+
+    // As does a header that does not link to the one before
+    data.mapCheckpoints[107] = headers[6].GetHash();
+    headers[1].nNonce = GetRandHash();
+    BOOST_CHECK_EQUAL(Checkpoints::CountLinkedToCheckpoint(data, 100, hashParent, headers), 0U);
+
+    // A branch that forks off between checkpoints is never linked
+    headers[0].hashPrevBlock = GetRandHash();
+    BOOST_CHECK_EQUAL(Checkpoints::CountLinkedToCheckpoint(data, 100, hashParent, headers), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
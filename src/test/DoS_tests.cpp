@@ -12,12 +12,14 @@
 #include "main.h"
 #include "net.h"
 #include "pow.h"
+#include "random.h"
 #include "script/sign.h"
 #include "serialize.h"
 #include "util.h"
 
 #include "test/test_bitcoin.h"
 
+#include <limits>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
@@ -28,13 +30,17 @@
 // Tests this internal-to-main.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanBytes);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    int64_t nTimeExpire;
+    unsigned int nSize;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern boost::unordered_map<uint256, std::set<uint256>, SaltedUint256Hasher> mapOrphanTransactionsByPrev;
+extern std::map<NodeId, std::set<uint256> > mapOrphanTransactionsByPeer;
+extern size_t nOrphanTransactionsBytes;
 
 CService ip(uint32_t i)
 {
@@ -188,13 +194,128 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     }
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    size_t nBytes = nOrphanTransactionsBytes;
+    LimitOrphanTxSize(10, nBytes / 2);
+    BOOST_CHECK(nOrphanTransactionsBytes <= nBytes / 2);
+    LimitOrphanTxSize(0, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
+    BOOST_CHECK_EQUAL(nOrphanTransactionsBytes, 0);
+}
+
+static CTransaction MakeOrphan()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.n = 0;
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1*CENT;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphans_quotas)
+{
+    // A peer only gets its share of the pool
+    unsigned int nQuota = DEFAULT_MAX_ORPHAN_TRANSACTIONS / ORPHAN_TX_PEER_SHARE;
+    for (unsigned int i = 0; i < nQuota; i++)
+        BOOST_CHECK(AddOrphanTx(MakeOrphan(), 1));
+    BOOST_CHECK(!AddOrphanTx(MakeOrphan(), 1));
+    BOOST_CHECK(AddOrphanTx(MakeOrphan(), 2));
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPeer[1].size(), nQuota);
+
+    // Erasing a peer's orphans leaves the others
+    EraseOrphansFor(1);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 1);
+    BOOST_CHECK(!mapOrphanTransactionsByPeer.count(1));
+    BOOST_CHECK(AddOrphanTx(MakeOrphan(), 1));
+
+    // Orphans expire, at the next sweep after their time
+    SetMockTime(GetTime() + ORPHAN_TX_EXPIRE_TIME + ORPHAN_TX_EXPIRE_INTERVAL);
+    LimitOrphanTxSize(DEFAULT_MAX_ORPHAN_TRANSACTIONS, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
+    BOOST_CHECK_EQUAL(nOrphanTransactionsBytes, 0);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_prevalidation)
+{
+    CAddress addr(ip(0xa0b0c004));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    dummyNode.nVersion = 1;
+
+    // Without pre-validation threads the block is left to the caller
+    CBlock block;
+    block.nVersion = 1; // Fails the context-free checks
+    BOOST_CHECK(!QueueBlockForPrevalidation(&dummyNode, block));
+    BOOST_CHECK_EQUAL(block.nVersion, 1);
+
+    int nPrevalidationThreadsOld = nPrevalidationThreads;
+    nPrevalidationThreads = 1;
+    std::vector<uint256> vQueued;
+    for (int i = 0; i < 3; i++) {
+        CBlock block;
+        block.nVersion = 1;
+        block.nNonce = GetRandHash();
+        vQueued.push_back(block.GetHash());
+        BOOST_CHECK(QueueBlockForPrevalidation(&dummyNode, block));
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_CHECK_EQUAL(dummyNode.GetRefCount(), 3);
+    }
+
+    // The worker starts with all of the blocks queued, and releases the
+    // node once it has processed each of them
+    boost::thread worker(&ThreadBlockPrevalidation);
+    for (int i = 0; i < 1000; i++) {
+        {
+            LOCK(cs_vNodes);
+            if (dummyNode.GetRefCount() == 0)
+                break;
+        }
+        MilliSleep(10);
+    }
+    worker.interrupt();
+    worker.join();
+    nPrevalidationThreads = nPrevalidationThreadsOld;
+    {
+        LOCK(cs_vNodes);
+        BOOST_CHECK_EQUAL(dummyNode.GetRefCount(), 0);
+    }
+
+    // Each block is rejected, in the order it was received
+    std::vector<uint256> vRejected;
+    {
+        LOCK(dummyNode.cs_vSend);
+        BOOST_FOREACH(const CSerializedNetMsg& msg, dummyNode.vSendMsg) {
+            CDataStream ss(&(*msg)[0], &(*msg)[0] + msg->size(), SER_NETWORK, PROTOCOL_VERSION);
+            CMessageHeader hdr(Params().MessageStart());
+            ss >> hdr;
+            if (hdr.GetCommand() != "reject")
+                continue;
+            std::string strMsg, strReason;
+            unsigned char ccode;
+            uint256 hash;
+            ss >> strMsg >> ccode >> strReason >> hash;
+            BOOST_CHECK_EQUAL(strMsg, "block");
+            BOOST_CHECK_EQUAL(strReason, "version-too-low");
+            vRejected.push_back(hash);
+        }
+    }
+    BOOST_CHECK(vRejected == vQueued);
+
+    // ... and the peer punished for it
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(dummyNode.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nMisbehavior, 300);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,95 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "pubkey.h"
+#include "random.h"
+#include "script/script.h"
+#include "streams.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, BasicTestingSetup)
+
+static uint160 RandomHash160()
+{
+    uint256 hash = GetRandHash();
+    return uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20));
+}
+
+static std::string SerializedKey(const CAddressIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_key_roundtrip)
+{
+    CAddressIndexKey key(ADDRESS_TYPE_SCRIPTHASH, RandomHash160(),
+                         123456, 7, GetRandHash(), 3, true);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    BOOST_CHECK_EQUAL(ss.size(), key.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+
+    CAddressIndexKey read;
+    ss >> read;
+    BOOST_CHECK_EQUAL(read.type, key.type);
+    BOOST_CHECK(read.hashBytes == key.hashBytes);
+    BOOST_CHECK_EQUAL(read.blockHeight, key.blockHeight);
+    BOOST_CHECK_EQUAL(read.txIndex, key.txIndex);
+    BOOST_CHECK(read.txhash == key.txhash);
+    BOOST_CHECK_EQUAL(read.index, key.index);
+    BOOST_CHECK_EQUAL(read.spending, key.spending);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_key_order)
+{
+    // The database orders keys bytewise, which must follow the chain order
+    uint160 hash;
+    uint256 txhash = GetRandHash();
+    BOOST_CHECK(SerializedKey(CAddressIndexKey(ADDRESS_TYPE_PUBKEYHASH, hash, 255, 0, txhash, 0, false)) <
+                SerializedKey(CAddressIndexKey(ADDRESS_TYPE_PUBKEYHASH, hash, 256, 0, txhash, 0, false)));
+    BOOST_CHECK(SerializedKey(CAddressIndexKey(ADDRESS_TYPE_PUBKEYHASH, hash, 1000, 2, txhash, 0, false)) <
+                SerializedKey(CAddressIndexKey(ADDRESS_TYPE_PUBKEYHASH, hash, 1000, 256, txhash, 0, false)));
+
+    CDataStream ssLow(SER_DISK, CLIENT_VERSION), ssHigh(SER_DISK, CLIENT_VERSION);
+    ssLow << CTimestampIndexKey(0x01ff, uint256());
+    ssHigh << CTimestampIndexKey(0x0200, uint256());
+    BOOST_CHECK(ssLow.str() < ssHigh.str());
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_script_hash)
+{
+    CKeyID keyID(RandomHash160());
+    uint256 blockHash = GetRandHash();
+    std::vector<unsigned char> vHeight(3, 1);
+
+    uint8_t type;
+    uint160 hash;
+    CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << ToByteVector(keyID) << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK(GetAddressIndexHash(p2pkh, type, hash));
+    BOOST_CHECK_EQUAL(type, ADDRESS_TYPE_PUBKEYHASH);
+    BOOST_CHECK(hash == keyID);
+
+    CScript replay = CScript(p2pkh) << ToByteVector(blockHash) << vHeight << OP_CHECKBLOCKATHEIGHT;
+    BOOST_CHECK(GetAddressIndexHash(replay, type, hash));
+    BOOST_CHECK_EQUAL(type, ADDRESS_TYPE_PUBKEYHASH);
+    BOOST_CHECK(hash == keyID);
+
+    CScriptID scriptID(p2pkh);
+    CScript p2sh = CScript() << OP_HASH160 << ToByteVector(scriptID) << OP_EQUAL;
+    BOOST_CHECK(GetAddressIndexHash(p2sh, type, hash));
+    BOOST_CHECK_EQUAL(type, ADDRESS_TYPE_SCRIPTHASH);
+    BOOST_CHECK(GetAddressIndexDestination(type, hash) == CTxDestination(scriptID));
+
+    CScript opreturn = CScript() << OP_RETURN << ToByteVector(blockHash);
+    BOOST_CHECK(!GetAddressIndexHash(opreturn, type, hash));
+    BOOST_CHECK_EQUAL(type, ADDRESS_TYPE_NONE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,8 @@
 #include "util.h"
 
 #include "support/allocators/secure.h"
+#include "support/lockedpool.h"
+#include "support/pagelocker.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
@@ -117,4 +119,98 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(test_Arena)
+{
+    std::vector<char> block(4096);
+    Arena arena(&block[0], block.size(), 16);
+    BOOST_CHECK(arena.IsEmpty());
+
+    // Pieces are aligned and rounded up
+    char* a = static_cast<char*>(arena.Alloc(1));
+    char* b = static_cast<char*>(arena.Alloc(100));
+    char* c = static_cast<char*>(arena.Alloc(16));
+    BOOST_CHECK(a && b && c);
+    BOOST_CHECK(arena.Contains(a) && arena.Contains(b) && arena.Contains(c));
+    BOOST_CHECK_EQUAL((a - &block[0]) % 16, 0);
+    BOOST_CHECK_EQUAL((b - &block[0]) % 16, 0);
+    BOOST_CHECK_EQUAL(arena.GetUsed(), 16U + 112U + 16U);
+    BOOST_CHECK(arena.Alloc(4096) == NULL);
+
+    // A piece freed between two used ones is reused for one that fits
+    arena.Free(b);
+    BOOST_CHECK_EQUAL(arena.GetChunksFree(), 2U);
+    char* d = static_cast<char*>(arena.Alloc(112));
+    BOOST_CHECK(d == b);
+    BOOST_CHECK_EQUAL(arena.GetChunksFree(), 1U);
+
+    // Freeing everything merges the block back into one chunk
+    arena.Free(a);
+    arena.Free(c);
+    arena.Free(d);
+    BOOST_CHECK(arena.IsEmpty());
+    BOOST_CHECK_EQUAL(arena.GetChunksFree(), 1U);
+    BOOST_CHECK(arena.Alloc(4096) == &block[0]);
+}
+
+// Dummy allocator of locked blocks, counting what it hands out
+static int test_blocks_allocated;
+class TestLockedPageAllocator
+{
+public:
+    void* AllocateLocked(size_t len, bool* fLocked)
+    {
+        test_blocks_allocated++;
+        *fLocked = true;
+        return malloc(len);
+    }
+    void FreeLocked(void* addr, size_t len)
+    {
+        test_blocks_allocated--;
+        free(addr);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_LockedPoolBase)
+{
+    test_blocks_allocated = 0;
+    {
+        typedef LockedPoolBase<TestLockedPageAllocator> TestPool;
+        TestPool pool(4096);
+
+        // Many small pieces share one block
+        std::vector<void*> pieces;
+        for (int i = 0; i < 1000; i++)
+            pieces.push_back(pool.Alloc(32));
+        BOOST_CHECK_EQUAL(test_blocks_allocated, 1);
+        BOOST_CHECK_EQUAL(pool.GetStats().used, 32000U);
+        BOOST_CHECK_EQUAL(pool.GetStats().locked, (size_t)TestPool::ARENA_SIZE);
+
+        // A piece larger than a block gets a block of its own, given back once freed
+        void* large = pool.Alloc(TestPool::ARENA_SIZE + 1);
+        BOOST_CHECK(large != NULL);
+        BOOST_CHECK_EQUAL(test_blocks_allocated, 2);
+        BOOST_CHECK_EQUAL(pool.GetStats().total, (size_t)TestPool::ARENA_SIZE * 2 + 4096);
+        pool.Free(large);
+        BOOST_CHECK_EQUAL(test_blocks_allocated, 1);
+
+        // The last block is kept
+        for (void* piece : pieces)
+            pool.Free(piece);
+        BOOST_CHECK_EQUAL(pool.GetStats().used, 0U);
+        BOOST_CHECK_EQUAL(test_blocks_allocated, 1);
+    }
+    BOOST_CHECK_EQUAL(test_blocks_allocated, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_secure_allocator)
+{
+    // Secrets come from the locked pool
+    LockedPoolStats before = LockedPoolManager::Instance().GetStats();
+    {
+        SecureString str(1000, 'x');
+        BOOST_CHECK(LockedPoolManager::Instance().GetStats().used >= before.used + 1000);
+    }
+    BOOST_CHECK_EQUAL(LockedPoolManager::Instance().GetStats().used, before.used);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -269,6 +269,39 @@ BOOST_AUTO_TEST_CASE(base58_keys_invalid)
     }
 }
 
+// Round trips across the limb boundaries of the codec, with leading zeroes
+BOOST_AUTO_TEST_CASE(base58_RoundTrip)
+{
+    for (size_t len = 1; len <= 80; len++) {
+        for (size_t zeroes = 0; zeroes <= 2 && zeroes <= len; zeroes++) {
+            std::vector<unsigned char> data(len, 0);
+            for (size_t i = zeroes; i < len; i++)
+                data[i] = insecure_rand() & 0xff;
+            // Exactly zeroes leading zero bytes, unless they are all zero
+            if (zeroes < len)
+                data[zeroes] |= 1;
+            std::string str = EncodeBase58(data);
+            size_t nOnes = str.find_first_not_of('1');
+            BOOST_CHECK_EQUAL(nOnes == std::string::npos ? str.size() : nOnes, zeroes);
+            std::vector<unsigned char> result;
+            BOOST_CHECK(DecodeBase58(str, result));
+            BOOST_CHECK(result == data);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(base58_AddressCache)
+{
+    CKeyID id;
+    GetRandBytes(id.begin(), id.size());
+    CBitcoinAddress addr(id);
+    std::string str = addr.ToString();
+    BOOST_CHECK_EQUAL(str, static_cast<const CBase58Data&>(addr).ToString());
+    // The second encoding comes from the cache
+    BOOST_CHECK_EQUAL(CBitcoinAddress(id).ToString(), str);
+    BOOST_CHECK(CBitcoinAddress(str).Get() == CTxDestination(id));
+}
+
 
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcompression.h"
+
+#include "arith_uint256.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcompression_tests, BasicTestingSetup)
+
+/** A serialized block of transactions spending and paying P2PKH outputs */
+static std::vector<char> MakeBlockData()
+{
+    CBlock block;
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(), false);
+    for (unsigned int i = 0; i < 100; i++) {
+        CMutableTransaction mtx;
+        uint256 hashSig = GetRandHash();
+        CScript scriptSig = CScript() << std::vector<unsigned char>(hashSig.begin(), hashSig.end()) << std::vector<unsigned char>(33, 0x02);
+        mtx.vin.push_back(CTxIn(ArithToUint256(arith_uint256(i + 1)), 0, scriptSig));
+        mtx.vout.push_back(CTxOut(1000 * i, scriptPubKey));
+        block.vtx.push_back(CTransaction(mtx));
+    }
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block;
+    return std::vector<char>(ss.begin(), ss.end());
+}
+
+BOOST_AUTO_TEST_CASE(block_data_roundtrip)
+{
+    std::vector<char> vBlock = MakeBlockData();
+    std::vector<char> vData;
+    if (!CanCompressBlocks()) {
+        BOOST_CHECK(!CompressBlockData(vBlock.data(), vBlock.size(), vData));
+        return;
+    }
+
+    BOOST_CHECK(CompressBlockData(vBlock.data(), vBlock.size(), vData));
+    BOOST_CHECK(vData.size() < vBlock.size());
+    std::vector<char> vDecompressed;
+    BOOST_CHECK(DecompressBlockData(vData.data(), vData.size(), vDecompressed));
+    BOOST_CHECK(vDecompressed == vBlock);
+
+    // Truncated or damaged data is rejected, not half read
+    BOOST_CHECK(!DecompressBlockData(vData.data(), vData.size() - 1, vDecompressed));
+    vData[vData.size() / 2] ^= 0x55;
+    BOOST_CHECK(!DecompressBlockData(vData.data(), vData.size(), vDecompressed));
+    BOOST_CHECK(!DecompressBlockData(vData.data(), 3, vDecompressed));
+}
+
+BOOST_AUTO_TEST_CASE(incompressible_block_data)
+{
+    // Random bytes are stored as they are
+    std::vector<unsigned char> vRandom(10000);
+    GetRandBytes(vRandom.data(), vRandom.size());
+    std::vector<char> vData;
+    BOOST_CHECK(!CompressBlockData((const char*)vRandom.data(), vRandom.size(), vData));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
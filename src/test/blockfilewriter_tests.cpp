@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilewriter.h"
+
+#include "main.h"
+
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilewriter_tests, TestingSetup)
+
+//! Far from the block files the testing setup writes to
+static const int TEST_FILE = 1000;
+
+/** The nSize bytes of the block or undo file at pos */
+static CPublicSerializeData ReadFileBytes(CBlockFileWriter::FileType type, const CDiskBlockPos& pos, size_t nSize)
+{
+    CPublicSerializeData data(nSize);
+    FILE* file = (type == CBlockFileWriter::BLOCK_FILE) ? OpenBlockFile(pos, true) : OpenUndoFile(pos, true);
+    if (!file)
+        return CPublicSerializeData();
+    if (fread(data.data(), 1, nSize, file) != nSize)
+        data.clear();
+    fclose(file);
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(write_without_thread)
+{
+    CBlockFileWriter writer;
+    CDiskBlockPos pos(TEST_FILE, 0);
+    CPublicSerializeData data(100, 'a');
+    const CPublicSerializeData expected = data;
+
+    BOOST_CHECK(writer.Write(CBlockFileWriter::BLOCK_FILE, pos, data));
+    BOOST_CHECK(data.empty());
+    // Nothing is queued, the record is in the file already
+    BOOST_CHECK(!writer.FindPending(CBlockFileWriter::BLOCK_FILE, pos));
+    BOOST_CHECK(ReadFileBytes(CBlockFileWriter::BLOCK_FILE, pos, 100) == expected);
+    BOOST_CHECK(writer.Sync());
+}
+
+BOOST_AUTO_TEST_CASE(write_on_thread)
+{
+    CBlockFileWriter writer;
+    boost::thread thread(&CBlockFileWriter::Thread, &writer);
+
+    std::vector<CDiskBlockPos> vPos;
+    std::vector<CPublicSerializeData> vExpected;
+    for (unsigned int i = 0; i < 50; i++) {
+        CDiskBlockPos pos(TEST_FILE + 1, i * 1000);
+        CPublicSerializeData data(1000, (char)i);
+        vPos.push_back(pos);
+        vExpected.push_back(data);
+        BOOST_CHECK(writer.Write(i % 2 ? CBlockFileWriter::UNDO_FILE : CBlockFileWriter::BLOCK_FILE, pos, data));
+    }
+    // A record not written yet is read back from the queue
+    for (unsigned int i = 0; i < vPos.size(); i++) {
+        boost::shared_ptr<const CPublicSerializeData> pending = writer.FindPending(i % 2 ? CBlockFileWriter::UNDO_FILE : CBlockFileWriter::BLOCK_FILE, vPos[i]);
+        if (pending)
+            BOOST_CHECK(*pending == vExpected[i]);
+    }
+
+    BOOST_CHECK(writer.Sync());
+    for (unsigned int i = 0; i < vPos.size(); i++) {
+        CBlockFileWriter::FileType type = i % 2 ? CBlockFileWriter::UNDO_FILE : CBlockFileWriter::BLOCK_FILE;
+        BOOST_CHECK(!writer.FindPending(type, vPos[i]));
+        BOOST_CHECK(ReadFileBytes(type, vPos[i], 1000) == vExpected[i]);
+    }
+
+    // Once the thread is stopped, records are written by the caller again
+    thread.interrupt();
+    thread.join();
+    CDiskBlockPos pos(TEST_FILE + 1, 50 * 1000);
+    CPublicSerializeData data(10, 'z');
+    BOOST_CHECK(writer.Write(CBlockFileWriter::BLOCK_FILE, pos, data));
+    BOOST_CHECK(ReadFileBytes(CBlockFileWriter::BLOCK_FILE, pos, 10) == CPublicSerializeData(10, 'z'));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
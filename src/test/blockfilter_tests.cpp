@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "undo.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static GCSFilter::Element RandomElement()
+{
+    uint256 hash = GetRandHash();
+    return GCSFilter::Element(hash.begin(), hash.end());
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_match)
+{
+    uint256 hashBlock = GetRandHash();
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; i++) {
+        included.insert(RandomElement());
+        excluded.insert(RandomElement());
+    }
+
+    GCSFilter filter(hashBlock, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), included.size());
+    for (const GCSFilter::Element& element : included)
+        BOOST_CHECK(filter.Match(element));
+    BOOST_CHECK(filter.MatchAny(included));
+    // False positives happen with probability 1/M per element
+    BOOST_CHECK(!filter.MatchAny(excluded));
+
+    GCSFilter::ElementSet mixed = excluded;
+    mixed.insert(*included.begin());
+    BOOST_CHECK(filter.MatchAny(mixed));
+
+    // Decoding gives the same filter, and a truncated encoding is rejected
+    GCSFilter decoded(hashBlock, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), filter.GetN());
+    BOOST_CHECK(decoded.MatchAny(included));
+    std::vector<unsigned char> truncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 10);
+    BOOST_CHECK_THROW(GCSFilter(hashBlock, truncated), std::ios_base::failure);
+
+    GCSFilter empty;
+    BOOST_CHECK(!empty.MatchAny(included));
+    BOOST_CHECK(!GCSFilter(hashBlock, GCSFilter::ElementSet()).MatchAny(included));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_scripts)
+{
+    CKeyID keyCreated(uint160(std::vector<unsigned char>(20, 1)));
+    CKeyID keySpent(uint160(std::vector<unsigned char>(20, 2)));
+    CKeyID keyOther(uint160(std::vector<unsigned char>(20, 3)));
+
+    // Outputs carry the replay protection suffix, which the filter ignores
+    CScript scriptCreated = GetScriptForDestination(keyCreated, false);
+    scriptCreated << ToByteVector(GetRandHash()) << 1000 << OP_CHECKBLOCKATHEIGHT;
+    BOOST_CHECK(GetFilterElement(scriptCreated) == GetFilterElement(GetScriptForDestination(keyCreated, false)));
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = scriptCreated;
+    tx.vout[1].scriptPubKey = CScript() << OP_RETURN << ToByteVector(GetRandHash());
+    CBlock block;
+    block.vtx.push_back(CMutableTransaction());
+    block.vtx.push_back(tx);
+
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(1, GetScriptForDestination(keySpent, false))));
+
+    CBlockFilter filter(block, blockundo);
+    BOOST_CHECK(!filter.HasJoinSplits());
+    BOOST_CHECK_EQUAL(filter.GetFilter().GetN(), 2);
+    BOOST_CHECK(filter.GetFilter().Match(GetFilterElement(GetScriptForDestination(keyCreated, false))));
+    BOOST_CHECK(filter.GetFilter().Match(GetFilterElement(GetScriptForDestination(keySpent, false))));
+    BOOST_CHECK(!filter.GetFilter().Match(GetFilterElement(GetScriptForDestination(keyOther, false))));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << filter;
+    CBlockFilter filter2;
+    ss >> filter2;
+    BOOST_CHECK(filter2.GetBlockHash() == block.GetHash());
+    BOOST_CHECK(filter2.GetFilter().GetEncoded() == filter.GetFilter().GetEncoded());
+    BOOST_CHECK(filter2.GetFilter().Match(GetFilterElement(GetScriptForDestination(keySpent, false))));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
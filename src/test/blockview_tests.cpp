@@ -0,0 +1,118 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockview.h"
+
+#include "arith_uint256.h"
+#include "primitives/block.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockview_tests, BasicTestingSetup)
+
+/** A block with transparent, PHGR and Groth transactions, the shielded ones with JoinSplits */
+static CBlock MakeBlock()
+{
+    CBlock block;
+    block.nSolution.resize(1344, 0x5a);
+    CScript scriptPubKey = GetScriptForDestination(CKeyID(), false);
+    int32_t versions[] = {TRANSPARENT_TX_VERSION, PHGR_TX_VERSION, GROTH_TX_VERSION, PHGR_TX_VERSION};
+    for (unsigned int i = 0; i < 8; i++) {
+        CMutableTransaction mtx;
+        mtx.nVersion = versions[i % 4];
+        for (unsigned int j = 0; j <= i % 3; j++) {
+            CScript scriptSig = CScript() << std::vector<unsigned char>(72 + j, 0x30) << std::vector<unsigned char>(33, 0x02);
+            mtx.vin.push_back(CTxIn(ArithToUint256(arith_uint256(i * 10 + j + 1)), j, scriptSig));
+        }
+        for (unsigned int j = 0; j <= i % 2; j++)
+            mtx.vout.push_back(CTxOut(1000 * i + j, scriptPubKey));
+        mtx.nLockTime = i;
+        if (mtx.nVersion != TRANSPARENT_TX_VERSION && i != 3) {
+            for (unsigned int j = 0; j < i % 3 + 1; j++) {
+                JSDescription jsdesc;
+                if (mtx.nVersion == GROTH_TX_VERSION)
+                    jsdesc.proof = libzcash::GrothProof();
+                jsdesc.anchor = GetRandHash();
+                jsdesc.nullifiers[0] = GetRandHash();
+                mtx.vjoinsplit.push_back(jsdesc);
+            }
+            mtx.joinSplitPubKey = GetRandHash();
+        }
+        block.vtx.push_back(CTransaction(mtx));
+    }
+    return block;
+}
+
+template <typename T>
+static std::string Serialized(const T& obj)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << obj;
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(block_view_matches_deserialization)
+{
+    CBlock block = MakeBlock();
+    std::string strBlock = Serialized(block);
+    CBlockView view(strBlock.data(), strBlock.data() + strBlock.size());
+
+    BOOST_CHECK(view.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(std::string(view.GetHeader().first, view.GetHeader().second), Serialized(block.GetBlockHeader()));
+    BOOST_REQUIRE_EQUAL(view.GetTxCount(), block.vtx.size());
+
+    // Offsets past the header as the transaction index keeps them
+    unsigned int nTxOffset = GetSizeOfCompactSize(block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        CTransactionView txView = view.GetTx(i);
+        BOOST_CHECK_EQUAL(std::string(txView.begin(), txView.end()), Serialized(tx));
+        BOOST_CHECK(txView.GetHash() == tx.GetHash());
+        BOOST_CHECK_EQUAL(txView.GetVersion(), tx.nVersion);
+
+        BOOST_REQUIRE_EQUAL(txView.GetInputCount(), tx.vin.size());
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            CSerializedSpan input = txView.GetInput(j);
+            BOOST_CHECK_EQUAL(std::string(input.first, input.second), Serialized(tx.vin[j]));
+        }
+        BOOST_REQUIRE_EQUAL(txView.GetOutputCount(), tx.vout.size());
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            CSerializedSpan output = txView.GetOutput(j);
+            BOOST_CHECK_EQUAL(std::string(output.first, output.second), Serialized(tx.vout[j]));
+        }
+        BOOST_CHECK_THROW(txView.GetInput(tx.vin.size()), std::ios_base::failure);
+
+        CTransactionView indexed = view.GetTxAtOffset(nTxOffset);
+        BOOST_CHECK(indexed.GetHash() == tx.GetHash());
+        nTxOffset += tx.GetTotalSize();
+    }
+    BOOST_CHECK(view.GetTx(block.vtx.size() - 1).end() == strBlock.data() + strBlock.size());
+    BOOST_CHECK_THROW(view.GetTx(block.vtx.size()), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(block_view_rejects_truncated_data)
+{
+    CBlock block = MakeBlock();
+    std::string strBlock = Serialized(block);
+
+    // Cut in the header, then in the last transaction
+    BOOST_CHECK_THROW(CBlockView(strBlock.data(), strBlock.data() + 100), std::ios_base::failure);
+    CBlockView view(strBlock.data(), strBlock.data() + strBlock.size() - 1);
+    for (size_t i = 0; i + 1 < block.vtx.size(); i++)
+        BOOST_CHECK(view.GetTx(i).GetHash() == block.vtx[i].GetHash());
+    BOOST_CHECK_THROW(view.GetTx(block.vtx.size() - 1), std::ios_base::failure);
+
+    std::string strTx = Serialized(block.vtx[1]);
+    BOOST_CHECK_THROW(CTransactionView(strTx.data(), strTx.data() + 3), std::ios_base::failure);
+    BOOST_CHECK_THROW(CTransactionView(strTx.data(), strTx.data() + strTx.size() - 1), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
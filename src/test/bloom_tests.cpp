@@ -537,4 +537,28 @@ BOOST_AUTO_TEST_CASE(rolling_bloom)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blocked_bloom)
+{
+    CBlockedBloomFilter filter(10000);
+    BOOST_CHECK_EQUAL(filter.capacity(), 10000);
+
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 10000; i++) {
+        hashes.push_back(GetRandHash());
+        filter.insert(hashes.back());
+    }
+    BOOST_CHECK_EQUAL(filter.size(), 10000);
+    for (const uint256& hash : hashes)
+        BOOST_CHECK(filter.contains(hash));
+
+    // About 0.1% false positives when full, so about 100 of 100,000
+    unsigned int nHits = 0;
+    for (int i = 0; i < 100000; i++) {
+        if (filter.contains(GetRandHash()))
+            ++nHits;
+    }
+    BOOST_TEST_MESSAGE("BlockedBloomFilter got " << nHits << " false positives (~100 expected)");
+    BOOST_CHECK(nHits < 300);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
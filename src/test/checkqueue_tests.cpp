@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/** Counts how often each check ran, failing the ones it was told to */
+struct CountingCheck {
+    std::atomic<int>* pnRuns;
+    bool fOk;
+
+    CountingCheck() : pnRuns(NULL), fOk(true) {}
+    CountingCheck(std::atomic<int>* pnRunsIn, bool fOkIn) : pnRuns(pnRunsIn), fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        ++*pnRuns;
+        return fOk;
+    }
+
+    void swap(CountingCheck& check)
+    {
+        std::swap(pnRuns, check.pnRuns);
+        std::swap(fOk, check.fOk);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(checkqueue_runs_each_check_once)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 7; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, boost::ref(queue)));
+
+    for (int nRound = 0; nRound < 200; nRound++) {
+        const size_t nChecks = insecure_rand() % 3000;
+        std::vector<std::atomic<int> > vRuns(nChecks);
+        for (std::atomic<int>& nRuns : vRuns)
+            nRuns = 0;
+
+        CCheckQueueControl<CountingCheck> control(&queue);
+        for (size_t i = 0; i < nChecks;) {
+            std::vector<CountingCheck> vChecks;
+            for (size_t n = insecure_rand() % 50; n > 0 && i < nChecks; n--, i++)
+                vChecks.push_back(CountingCheck(&vRuns[i], true));
+            control.Add(vChecks);
+        }
+        BOOST_CHECK(control.Wait());
+        for (std::atomic<int>& nRuns : vRuns)
+            BOOST_CHECK_EQUAL(nRuns.load(), 1);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_reports_failure)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, boost::ref(queue)));
+
+    std::atomic<int> nRuns(0);
+    for (int nRound = 0; nRound < 100; nRound++) {
+        // One failing check among many, anywhere in the block; the next round starts clean
+        const size_t nChecks = 1 + insecure_rand() % 1000;
+        const size_t nFailing = insecure_rand() % nChecks;
+        CCheckQueueControl<CountingCheck> control(&queue);
+        std::vector<CountingCheck> vChecks;
+        for (size_t i = 0; i < nChecks; i++)
+            vChecks.push_back(CountingCheck(&nRuns, i != nFailing));
+        control.Add(vChecks);
+        BOOST_CHECK(!control.Wait());
+
+        CCheckQueueControl<CountingCheck> controlNext(&queue);
+        std::vector<CountingCheck> vNext(1, CountingCheck(&nRuns, true));
+        controlNext.Add(vNext);
+        BOOST_CHECK(controlNext.Wait());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,12 +10,15 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "txdb.h"
 #include "undo.h"
 #include "pubkey.h"
 
+#include <limits>
 #include <vector>
 #include <map>
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
 
@@ -148,6 +151,13 @@ public:
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
+    bool IsCached(const uint256 &txid) const { return cacheCoins.count(txid); }
+    bool IsDirty(const uint256 &txid) const
+    {
+        CCoinsMap::const_iterator it = cacheCoins.find(txid);
+        return it != cacheCoins.end() && (it->second.flags & CCoinsCacheEntry::DIRTY);
+    }
+
 };
 
 }
@@ -688,6 +698,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             }
         }
 
+        if (insecure_rand() % 250 == 0) {
+            // Now and then, write the top cache back keeping part or all of it.
+            if (insecure_rand() % 2)
+                stack.back()->WriteBack(insecure_rand() % (stack.back()->DynamicMemoryUsage() + 1));
+            else
+                stack.back()->WriteDirty();
+            stack.back()->SelfTest();
+        }
+
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
@@ -726,6 +745,85 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_write_back)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<uint256> txids(200);
+    for (size_t i = 0; i < txids.size(); i++) {
+        txids[i] = GetRandHash();
+        CCoinsModifier coins = cache.ModifyCoins(txids[i]);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = i + 1;
+    }
+    // With room for all, everything is written and kept, unmodified
+    BOOST_CHECK(cache.WriteBack(std::numeric_limits<size_t>::max()));
+    cache.SelfTest();
+    for (size_t i = 0; i < txids.size(); i++) {
+        CCoins coins;
+        BOOST_CHECK(base.GetCoins(txids[i], coins) && coins.vout[0].nValue == (CAmount)i + 1);
+        BOOST_CHECK(cache.IsCached(txids[i]) && !cache.IsDirty(txids[i]));
+    }
+
+    // The last ones used are kept, the others evicted down to the target
+    for (size_t i = 150; i < txids.size(); i++)
+        BOOST_CHECK(cache.AccessCoins(txids[i]));
+    cache.ModifyCoins(txids[100])->vout[0].nValue = 1000;
+    // A spent one is written, but there is nothing to keep of it
+    cache.ModifyCoins(txids[0])->Clear();
+    size_t nTarget = cache.DynamicMemoryUsage() / 2;
+    BOOST_CHECK(cache.WriteBack(nTarget));
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nTarget);
+    BOOST_CHECK(cache.IsCached(txids[100]) && !cache.IsDirty(txids[100]));
+    for (size_t i = 150; i < txids.size(); i++)
+        BOOST_CHECK(cache.IsCached(txids[i]));
+    BOOST_CHECK(!cache.IsCached(txids[0]));
+    BOOST_CHECK(cache.GetCacheSize() < txids.size() - 1);
+
+    // Evicted coins are read back from the base
+    CCoins coins;
+    BOOST_CHECK(!base.GetCoins(txids[0], coins) || coins.IsPruned());
+    BOOST_CHECK(base.GetCoins(txids[100], coins) && coins.vout[0].nValue == 1000);
+    for (size_t i = 1; i < txids.size(); i++)
+        BOOST_CHECK(cache.AccessCoins(txids[i]));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_write_dirty)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<uint256> txids(100);
+    for (size_t i = 0; i < txids.size(); i++) {
+        txids[i] = GetRandHash();
+        CCoinsModifier coins = cache.ModifyCoins(txids[i]);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = i + 1;
+    }
+    BOOST_CHECK(cache.WriteDirty());
+    cache.SelfTest();
+    for (size_t i = 0; i < txids.size(); i++)
+        BOOST_CHECK(cache.IsCached(txids[i]) && !cache.IsDirty(txids[i]));
+
+    // Only what changed since is written again, spent coins leave the cache
+    cache.ModifyCoins(txids[10])->vout[0].nValue = 1000;
+    cache.ModifyCoins(txids[20])->Clear();
+    BOOST_CHECK(cache.WriteDirty());
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), txids.size() - 1);
+    BOOST_CHECK(cache.IsCached(txids[10]) && !cache.IsDirty(txids[10]));
+    BOOST_CHECK(!cache.IsCached(txids[20]));
+
+    CCoins coins;
+    BOOST_CHECK(!base.GetCoins(txids[20], coins) || coins.IsPruned());
+    for (size_t i = 0; i < txids.size(); i++) {
+        if (i != 20)
+            BOOST_CHECK(base.GetCoins(txids[i], coins) && coins.vout[0].nValue == (i == 10 ? 1000 : (CAmount)i + 1));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
 {
     CCoinsViewTest base;
@@ -839,4 +937,382 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(background_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewBackgroundFlush flush(&db);
+    CCoinsViewCache cache(&flush);
+
+    uint256 txid1 = GetRandHash();
+    uint256 txid2 = GetRandHash();
+    uint256 block1 = GetRandHash();
+    uint256 block2 = GetRandHash();
+
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid1);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 1000;
+        coins->vout[0].scriptPubKey = CScript() << OP_1;
+    }
+    cache.SetBestBlock(block1);
+    BOOST_CHECK(cache.Flush());
+
+    // Visible through the flush layer whether or not it is written yet
+    BOOST_CHECK(flush.HaveCoins(txid1));
+    BOOST_CHECK(flush.GetBestBlock() == block1);
+    BOOST_CHECK(cache.HaveCoins(txid1));
+
+    // Spend it and add another one; this waits for the first write
+    cache.ModifyCoins(txid1)->Clear();
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid2);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 2000;
+        coins->vout[0].scriptPubKey = CScript() << OP_2;
+    }
+    cache.SetBestBlock(block2);
+    BOOST_CHECK(cache.Flush());
+
+    BOOST_CHECK(!flush.HaveCoins(txid1));
+    BOOST_CHECK(flush.HaveCoins(txid2));
+    BOOST_CHECK(flush.GetBestBlock() == block2);
+
+    BOOST_CHECK(flush.Sync());
+    BOOST_CHECK(!db.HaveCoins(txid1));
+    BOOST_CHECK(db.HaveCoins(txid2));
+    BOOST_CHECK(db.GetBestBlock() == block2);
+
+    CCoins coins;
+    BOOST_CHECK(cache.GetCoins(txid2, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 2000);
+}
+
+BOOST_FIXTURE_TEST_CASE(txoutset_snapshot, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 nullifier = GetRandHash();
+    uint256 block = GetRandHash();
+    ZCIncrementalMerkleTree tree;
+    tree.append(GetRandHash());
+
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->vout.resize(2);
+            coins->vout[1].nValue = 5000;
+            coins->vout[1].scriptPubKey = CScript() << OP_1;
+            coins->nHeight = 7;
+        }
+        cache.PushAnchor(tree);
+        cache.SetNullifier(nullifier, true);
+        cache.SetBestBlock(block);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CTxOutSetSnapshotHeader header;
+    header.hashBlock = block;
+    header.nHeight = 7;
+    header.hashAnchor = db.GetBestAnchor();
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    boost::scoped_ptr<CLevelDBSnapshot> snapshot(db.NewSnapshot());
+    BOOST_CHECK(db.DumpSnapshot(*snapshot, file, header));
+    BOOST_CHECK_EQUAL(header.nTransactions, 1);
+    BOOST_CHECK_EQUAL(header.nNullifiers, 1);
+
+    CCoinsStats stats;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK(header.hashSerialized == stats.hashSerialized);
+
+    // Verify only: nothing is written
+    CCoinsViewDB db2(1 << 20, true);
+    CTxOutSetSnapshotHeader result;
+    rewind(file.Get());
+    BOOST_CHECK(db2.ReadSnapshot(file, header, false, result));
+    BOOST_CHECK(result.hashSerialized == header.hashSerialized);
+    BOOST_CHECK(result.hashShielded == header.hashShielded);
+    BOOST_CHECK(!db2.HaveCoins(txid));
+
+    rewind(file.Get());
+    BOOST_CHECK(db2.ReadSnapshot(file, header, true, result));
+    BOOST_CHECK(result.hashSerialized == header.hashSerialized);
+    BOOST_CHECK(db2.GetBestBlock() == block);
+    BOOST_CHECK(db2.GetBestAnchor() == tree.root());
+    BOOST_CHECK(db2.GetNullifier(nullifier));
+    ZCIncrementalMerkleTree tree2;
+    BOOST_CHECK(db2.GetAnchorAt(tree.root(), tree2));
+    BOOST_CHECK(tree2.root() == tree.root());
+    CCoins coins;
+    BOOST_CHECK(db2.GetCoins(txid, coins));
+    BOOST_CHECK_EQUAL(coins.vout[1].nValue, 5000);
+
+    CCoinsStats stats2;
+    BOOST_CHECK(db2.GetStats(stats2));
+    BOOST_CHECK(stats2.hashSerialized == stats.hashSerialized);
+}
+
+static void CheckTxOutSetStats(const CCoinsViewDB& db)
+{
+    CCoinsStats running, scanned;
+    BOOST_CHECK(db.GetTxOutSetStats(running));
+    BOOST_CHECK(db.GetStats(scanned));
+    BOOST_CHECK(running.hashBlock == scanned.hashBlock);
+    BOOST_CHECK_EQUAL(running.nTransactions, scanned.nTransactions);
+    BOOST_CHECK_EQUAL(running.nTransactionOutputs, scanned.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(running.nSerializedSize, scanned.nSerializedSize);
+    BOOST_CHECK_EQUAL(running.nTotalAmount, scanned.nTotalAmount);
+    BOOST_CHECK(running.hashMuHash == scanned.hashMuHash);
+}
+
+BOOST_FIXTURE_TEST_CASE(txoutset_stats, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewBackgroundFlush flush(&db);
+    CheckTxOutSetStats(db);
+
+    // Transactions with several outputs, some of them spent and some whole
+    // transactions spent across flushes, directly and in the background
+    std::vector<uint256> vTxids;
+    for (int round = 0; round < 6; round++) {
+        CCoinsViewCache cache(round % 2 ? (CCoinsView*)&flush : (CCoinsView*)&db);
+        for (int i = 0; i < 40; i++) {
+            uint256 txid = GetRandHash();
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            coins->nHeight = round;
+            coins->fCoinBase = i == 0;
+            coins->vout.resize(1 + insecure_rand() % 12);
+            for (CTxOut& out : coins->vout) {
+                out.nValue = insecure_rand() % 100000;
+                out.scriptPubKey = CScript() << OP_1 << std::vector<unsigned char>(insecure_rand() % 40, 1);
+            }
+            vTxids.push_back(txid);
+        }
+        for (const uint256& txid : vTxids) {
+            if (insecure_rand() % 4 != 0 || !cache.HaveCoins(txid))
+                continue;
+            CCoinsModifier coins = cache.ModifyCoins(txid);
+            if (insecure_rand() % 3 == 0)
+                coins->Clear();
+            else
+                coins->Spend(insecure_rand() % coins->vout.size());
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(flush.Sync());
+        CheckTxOutSetStats(db);
+    }
+
+    // A snapshot loaded into another database has the same statistics
+    CTxOutSetSnapshotHeader header;
+    header.hashBlock = db.GetBestBlock();
+    header.hashAnchor = db.GetBestAnchor();
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    boost::scoped_ptr<CLevelDBSnapshot> snapshot(db.NewSnapshot());
+    BOOST_CHECK(db.DumpSnapshot(*snapshot, file, header));
+    CCoinsViewDB db2(1 << 20, true);
+    CTxOutSetSnapshotHeader result;
+    rewind(file.Get());
+    BOOST_CHECK(db2.ReadSnapshot(file, header, true, result));
+    CheckTxOutSetStats(db2);
+    CCoinsStats stats, stats2;
+    BOOST_CHECK(db.GetTxOutSetStats(stats));
+    BOOST_CHECK(db2.GetTxOutSetStats(stats2));
+    BOOST_CHECK(stats.hashMuHash == stats2.hashMuHash);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, stats2.nSerializedSize);
+}
+
+BOOST_FIXTURE_TEST_CASE(anchor_deltas, TestingSetup)
+{
+    // More anchors than the tree cache holds, so the first ones are rebuilt
+    // from disk, and longer chains than ANCHOR_DELTA_MAX_CHAIN
+    CCoinsViewDB db(1 << 20, true);
+    ZCIncrementalMerkleTree tree;
+    std::vector<ZCIncrementalMerkleTree> vTrees;
+    {
+        CCoinsViewCache cache(&db);
+        for (size_t i = 0; i < 2 * ANCHOR_TREE_CACHE_SIZE; i++) {
+            for (size_t j = 0; j <= i % 3; j++)
+                appendRandomCommitment(tree);
+            cache.PushAnchor(tree);
+            vTrees.push_back(tree);
+            // Deltas within a flush and across flushes
+            if (i % 7 == 6)
+                BOOST_CHECK(cache.Flush());
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    for (const ZCIncrementalMerkleTree& expected : vTrees) {
+        ZCIncrementalMerkleTree read;
+        BOOST_CHECK(db.GetAnchorAt(expected.root(), read));
+        BOOST_CHECK(read.root() == expected.root());
+    }
+
+    // Disconnecting removes the anchors, their parents stay readable
+    {
+        CCoinsViewCache cache(&db);
+        for (size_t i = vTrees.size() - 1; i >= vTrees.size() - 3; i--)
+            cache.PopAnchor(vTrees[i - 1].root());
+        BOOST_CHECK(cache.Flush());
+    }
+    ZCIncrementalMerkleTree read;
+    BOOST_CHECK(!db.GetAnchorAt(vTrees.back().root(), read));
+    BOOST_CHECK(db.GetAnchorAt(vTrees[vTrees.size() - 4].root(), read));
+    BOOST_CHECK(read.root() == vTrees[vTrees.size() - 4].root());
+
+    // Snapshots hold whole trees however they are stored
+    CTxOutSetSnapshotHeader header;
+    header.hashAnchor = db.GetBestAnchor();
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    boost::scoped_ptr<CLevelDBSnapshot> snapshot(db.NewSnapshot());
+    BOOST_CHECK(db.DumpSnapshot(*snapshot, file, header));
+    BOOST_CHECK_EQUAL(header.nAnchors, vTrees.size() - 3);
+    CCoinsViewDB db2(1 << 20, true);
+    CTxOutSetSnapshotHeader result;
+    rewind(file.Get());
+    BOOST_CHECK(db2.ReadSnapshot(file, header, true, result));
+    BOOST_CHECK(result.hashShielded == header.hashShielded);
+    BOOST_CHECK(db2.GetAnchorAt(vTrees.front().root(), read));
+    BOOST_CHECK(read.root() == vTrees.front().root());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_output_records, TestingSetup)
+{
+    // Outputs are stored one record each: spend some of a transaction with few
+    // outputs, read one by one, and of one with many, read with a cursor
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txidSmall = GetRandHash();
+    uint256 txidLarge = GetRandHash();
+    CCoins expectedSmall, expectedLarge;
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier small = cache.ModifyCoins(txidSmall);
+            for (unsigned int i = 0; i < 3; i++)
+                small->vout.push_back(CTxOut(1000 + i, CScript() << OP_1));
+            small->nHeight = 5;
+            small->fCoinBase = true;
+        }
+        {
+            CCoinsModifier large = cache.ModifyCoins(txidLarge);
+            for (unsigned int i = 0; i < 40; i++)
+                large->vout.push_back(CTxOut(2000 + i, CScript() << OP_2));
+            large->nHeight = 6;
+        }
+        expectedSmall = *cache.AccessCoins(txidSmall);
+        expectedLarge = *cache.AccessCoins(txidLarge);
+        // GetStats wants a best block it knows
+        cache.SetBestBlock(chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    for (int round = 0; round < 3; round++) {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier large = cache.ModifyCoins(txidLarge);
+            for (unsigned int i = round; i < large->vout.size(); i += 3)
+                large->Spend(i);
+        }
+        expectedLarge = *cache.AccessCoins(txidLarge);
+        cache.ModifyCoins(txidSmall)->Spend(round);
+        expectedSmall = *cache.AccessCoins(txidSmall);
+        BOOST_CHECK(cache.Flush());
+
+        CCoins coins;
+        BOOST_CHECK(db.GetCoins(txidLarge, coins) == !expectedLarge.IsPruned());
+        if (!expectedLarge.IsPruned())
+            BOOST_CHECK(coins == expectedLarge);
+        BOOST_CHECK(db.GetCoins(txidSmall, coins) == !expectedSmall.IsPruned());
+        if (!expectedSmall.IsPruned())
+            BOOST_CHECK(coins == expectedSmall);
+
+        CCoinsStats stats;
+        BOOST_CHECK(db.GetStats(stats));
+        size_t nUnspent = 0;
+        for (const CCoins* pcoins : {&expectedSmall, &expectedLarge})
+            for (const CTxOut& out : pcoins->vout)
+                nUnspent += !out.IsNull();
+        BOOST_CHECK_EQUAL(stats.nTransactionOutputs, nUnspent);
+    }
+    // All spent, no record is left
+    BOOST_CHECK(!db.HaveCoins(txidSmall));
+    BOOST_CHECK(!db.HaveCoins(txidLarge));
+    CCoinsStats stats;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_prefetch, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<uint256> vTxids;
+    uint256 nullifier = GetRandHash();
+    ZCIncrementalMerkleTree tree;
+    tree.append(GetRandHash());
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 50; i++) {
+            vTxids.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyCoins(vTxids.back());
+            coins->vout.push_back(CTxOut(i + 1, CScript() << OP_1));
+        }
+        cache.SetNullifier(nullifier, true);
+        cache.PushAnchor(tree);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCache cache(&db);
+    std::vector<uint256> vLookups(vTxids);
+    vLookups.push_back(GetRandHash());
+    cache.Prefetch(vLookups, {nullifier, GetRandHash()}, {tree.root()}, 4);
+    // What exists is cached, the rest is not
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), vTxids.size());
+    uint64_t nMisses = cache.GetCacheMisses();
+    for (size_t i = 0; i < vTxids.size(); i++) {
+        const CCoins* coins = cache.AccessCoins(vTxids[i]);
+        BOOST_CHECK(coins && coins->vout[0].nValue == (CAmount)i + 1);
+    }
+    BOOST_CHECK_EQUAL(cache.GetCacheMisses(), nMisses);
+    BOOST_CHECK(cache.GetNullifier(nullifier));
+    ZCIncrementalMerkleTree read;
+    BOOST_CHECK(cache.GetAnchorAt(tree.root(), read));
+    BOOST_CHECK(read.root() == tree.root());
+}
+
+BOOST_FIXTURE_TEST_CASE(nullifier_filter, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    std::vector<uint256> vSpent;
+    {
+        // Enough to outgrow the filter and have it rebuilt
+        CCoinsViewCache cache(&db);
+        for (size_t i = 0; i < NULLIFIER_FILTER_MIN_ELEMENTS + 1000; i++) {
+            vSpent.push_back(GetRandHash());
+            cache.SetNullifier(vSpent.back(), true);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoinsViewCache cache(&db);
+    for (const uint256& nf : vSpent)
+        BOOST_CHECK(db.GetNullifier(nf));
+
+    // Lookups of unspent nullifiers are not cached
+    size_t nUsage = cache.DynamicMemoryUsage();
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(!cache.GetNullifier(GetRandHash()));
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsage);
+
+    // Unspent again, it stays in the filter but is read as not spent
+    cache.SetNullifier(vSpent[0], false);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!db.GetNullifier(vSpent[0]));
+    BOOST_CHECK(db.GetNullifier(vSpent[1]));
+
+    // And spent once more
+    CCoinsViewCache cache2(&db);
+    cache2.SetNullifier(vSpent[0], true);
+    BOOST_CHECK(cache2.Flush());
+    BOOST_CHECK(db.GetNullifier(vSpent[0]));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
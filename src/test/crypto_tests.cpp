@@ -8,7 +8,10 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
+#include "hash.h"
 #include "random.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
@@ -131,6 +134,34 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Batches around the eight-way kernel size, against one hash at a time
+    for (int blocks = 0; blocks <= 34; blocks++) {
+        std::vector<unsigned char> in(64 * blocks), out(32 * blocks), expected(32 * blocks);
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = insecure_rand();
+        for (int i = 0; i < blocks; i++)
+            CHash256().Write(&in[64 * i], 64).Finalize(&expected[32 * i]);
+        SHA256D64(out.data(), in.data(), blocks);
+        BOOST_CHECK(out == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sha256compress64)
+{
+    // Batches around the eight-way kernel size, against one compression at a time
+    for (int blocks = 0; blocks <= 34; blocks++) {
+        std::vector<unsigned char> in(64 * blocks), out(32 * blocks), expected(32 * blocks);
+        for (size_t i = 0; i < in.size(); i++)
+            in[i] = insecure_rand();
+        for (int i = 0; i < blocks; i++)
+            CSHA256().Write(&in[64 * i], 64).FinalizeNoPadding(&expected[32 * i]);
+        SHA256Compress64(out.data(), in.data(), blocks);
+        BOOST_CHECK(out == expected);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -248,4 +279,48 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+static std::string MuHashHex(const MuHash3072& muhash) {
+    unsigned char hash[MuHash3072::OUTPUT_SIZE];
+    muhash.Finalize(hash);
+    return HexStr(hash, hash + sizeof(hash));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_testvectors) {
+    const unsigned char abc[] = {'a', 'b', 'c'}, xyz[] = {'x', 'y', 'z'}, q[] = {'q'};
+    BOOST_CHECK_EQUAL(MuHashHex(MuHash3072()), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+    BOOST_CHECK_EQUAL(MuHashHex(MuHash3072().Insert(abc, 3)), "dd026e59b7cd56a8ba5c21c0acb5a1940b96712a41a49507d7cb55be6c8dbad5");
+    BOOST_CHECK_EQUAL(MuHashHex(MuHash3072().Insert(abc, 3).Insert(xyz, 3).Remove(q, 1)), "eb095f1e1dda66eddca3bf20776c76bd16e960afe17f66762d26c73fb91832e6");
+
+    // The order of the strings does not matter, and removing one undoes adding it
+    std::vector<uint256> vData;
+    for (int i = 0; i < 8; i++)
+        vData.push_back(GetRandHash());
+    MuHash3072 forward, backward, removed;
+    for (int i = 0; i < 8; i++) {
+        forward.Insert(vData[i].begin(), 32);
+        backward.Insert(vData[7 - i].begin(), 32);
+    }
+    BOOST_CHECK_EQUAL(MuHashHex(forward), MuHashHex(backward));
+    for (int i = 0; i < 4; i++)
+        removed.Remove(vData[i].begin(), 32);
+    removed.Insert(abc, 3);
+    MuHash3072 combined = forward;
+    combined *= removed;
+    MuHash3072 expected;
+    for (int i = 4; i < 8; i++)
+        expected.Insert(vData[i].begin(), 32);
+    expected.Insert(abc, 3);
+    BOOST_CHECK_EQUAL(MuHashHex(combined), MuHashHex(expected));
+    combined /= removed;
+    BOOST_CHECK_EQUAL(MuHashHex(combined), MuHashHex(forward));
+
+    // And it is the same once serialized
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << combined;
+    BOOST_CHECK_EQUAL(ss.size(), MuHash3072::SERIALIZED_SIZE);
+    MuHash3072 read;
+    ss >> read;
+    BOOST_CHECK_EQUAL(MuHashHex(read), MuHashHex(forward));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
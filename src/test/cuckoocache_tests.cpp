@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+
+#include "random.h"
+#include "script/sigcache.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+typedef CuckooCache::cache<uint256, SignatureCacheHasher> TestCache;
+
+static std::vector<uint256> RandomHashes(size_t n)
+{
+    std::vector<uint256> hashes(n);
+    for (uint256& hash : hashes)
+        hash = GetRandHash();
+    return hashes;
+}
+
+/** Fraction of the hashes that are still in the cache. */
+static double HitRate(const TestCache& cc, const std::vector<uint256>& hashes)
+{
+    size_t count = 0;
+    for (const uint256& hash : hashes)
+        count += cc.contains(hash, false);
+    return (double)count / hashes.size();
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    TestCache cc;
+    cc.setup_bytes(1 << 20);
+    for (const uint256& hash : RandomHashes(20000))
+        cc.insert(hash);
+    for (const uint256& hash : RandomHashes(20000))
+        BOOST_CHECK(!cc.contains(hash, false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    TestCache cc;
+    uint32_t size = cc.setup_bytes(1 << 20);
+    BOOST_CHECK_EQUAL(size, (1 << 20) / sizeof(uint256));
+
+    // Nearly everything fits below the 90% load the epochs aim for
+    std::vector<uint256> hashes = RandomHashes(size * 8 / 10);
+    for (const uint256& hash : hashes)
+        cc.insert(hash);
+    BOOST_CHECK(HitRate(cc, hashes) > 0.98);
+
+    // Twice the size: the most recent inserts are the ones that are kept
+    std::vector<uint256> more = RandomHashes(size * 2);
+    for (const uint256& hash : more)
+        cc.insert(hash);
+    BOOST_CHECK(HitRate(cc, std::vector<uint256>(more.end() - size / 4, more.end())) > 0.95);
+    BOOST_CHECK(HitRate(cc, hashes) < 0.1);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    TestCache cc;
+    uint32_t size = cc.setup_bytes(1 << 20);
+    std::vector<uint256> hashes = RandomHashes(size);
+    std::vector<uint256> first(hashes.begin(), hashes.begin() + size / 2);
+    std::vector<uint256> second(hashes.begin() + size / 2, hashes.end());
+
+    for (const uint256& hash : first)
+        cc.insert(hash);
+    // Erased entries stay visible until their slot is needed
+    for (const uint256& hash : first)
+        cc.contains(hash, true);
+    BOOST_CHECK(HitRate(cc, first) > 0.98);
+
+    // The erased half makes room for the second half
+    for (const uint256& hash : second)
+        cc.insert(hash);
+    BOOST_CHECK(HitRate(cc, second) > 0.98);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -99,6 +99,14 @@ void TestEquihashValidator(unsigned int n, unsigned int k, const std::string &I,
     bool isValid;
     EhIsValidSolution(n, k, state, GetMinimalFromIndices(soln, cBitLen), isValid);
     BOOST_CHECK(isValid == expected);
+
+    // The batched BLAKE2b path must agree
+    CBLAKE2b batchState;
+    EhInitialiseState(n, k, batchState);
+    batchState.Write((unsigned char*)&I[0], I.size());
+    batchState.Write(V.begin(), V.size());
+    EhIsValidSolution(n, k, batchState, GetMinimalFromIndices(soln, cBitLen), isValid);
+    BOOST_CHECK(isValid == expected);
 }
 
 #ifdef ENABLE_MINING
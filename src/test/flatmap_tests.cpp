@@ -0,0 +1,114 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flatmap.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+struct IntHasher
+{
+    size_t operator()(int key) const { return key * 2654435761u; }
+};
+
+typedef flatmap<int, std::string, IntHasher> TestMap;
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatmap_random)
+{
+    TestMap map;
+    std::map<int, std::string> ref;
+
+    for (int i = 0; i < 100000; i++) {
+        int key = insecure_rand() % 2000;
+        switch (insecure_rand() % 4) {
+        case 0: {
+            std::pair<TestMap::iterator, bool> ret = map.insert(std::make_pair(key, std::to_string(i)));
+            BOOST_CHECK_EQUAL(ret.second, ref.insert(std::make_pair(key, std::to_string(i))).second);
+            BOOST_CHECK_EQUAL(ret.first->second, ref[key]);
+            break;
+        }
+        case 1: {
+            TestMap::iterator it = map.find(key);
+            BOOST_CHECK_EQUAL(it == map.end(), ref.count(key) == 0);
+            if (it != map.end())
+                map.erase(it);
+            ref.erase(key);
+            break;
+        }
+        case 2:
+            map[key] += "x";
+            ref[key] += "x";
+            break;
+        case 3: {
+            TestMap::const_iterator it = map.find(key);
+            BOOST_CHECK_EQUAL(it == map.end(), ref.count(key) == 0);
+            if (it != map.end())
+                BOOST_CHECK_EQUAL(it->second, ref[key]);
+            break;
+        }
+        }
+        BOOST_CHECK_EQUAL(map.size(), ref.size());
+    }
+
+    // Erasing while iterating, as done by BatchWrite
+    size_t count = 0;
+    for (TestMap::iterator it = map.begin(); it != map.end(); ) {
+        BOOST_CHECK_EQUAL(it->second, ref[it->first]);
+        ref.erase(it->first);
+        map.erase(it++);
+        count++;
+    }
+    BOOST_CHECK(ref.empty());
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(count > 0);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_stable_references)
+{
+    TestMap map;
+    std::string* first = &map[0];
+    *first = "first";
+    // Grow the table several times
+    for (int i = 1; i < 10000; i++)
+        map[i] = std::to_string(i);
+    BOOST_CHECK_EQUAL(first, &map[0]);
+    BOOST_CHECK_EQUAL(*first, "first");
+    BOOST_CHECK_EQUAL(map.size(), 10000);
+
+    // Erased entries are recycled
+    size_t usage = memusage::DynamicUsage(map);
+    for (int i = 0; i < 5000; i++)
+        map.erase(i);
+    for (int i = 10000; i < 15000; i++)
+        map[i] = std::to_string(i);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), usage);
+
+    // Clearing releases everything
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), memusage::DynamicUsage(TestMap()));
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_reserve)
+{
+    // A reserved map takes what DynamicMemoryUsageFor says, at any size
+    for (size_t n : {0, 1, 12, 13, 64, 65, 1000}) {
+        TestMap map;
+        map.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            map[i] = "x";
+        BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), TestMap::DynamicMemoryUsageFor(n));
+    }
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(TestMap()), TestMap::DynamicMemoryUsageFor(0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -47,4 +47,51 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(murmurhash3_lanes)
+{
+    // The seeds hashed together must each get the hash they get alone, whatever the length of the tail
+    std::vector<unsigned char> vData = ParseHex("00112233445566778899aabbccddeeff");
+    uint32_t seeds[MURMURHASH3_LANES];
+    uint32_t hashes[MURMURHASH3_LANES];
+    for (int l = 0; l < MURMURHASH3_LANES; l++)
+        seeds[l] = l * 0xFBA4C795 + 0x5a5a5a5a;
+    for (size_t nSize = 0; nSize <= vData.size(); nSize++) {
+        MurmurHash3(seeds, hashes, vData.data(), nSize);
+        for (int l = 0; l < MURMURHASH3_LANES; l++)
+            BOOST_CHECK_EQUAL(hashes[l], MurmurHash3(seeds[l], vData.data(), nSize));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x726fdb47dd0e0e31ull);
+    static const unsigned char t0[1] = {0};
+    hasher.Write(t0, 1);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x74f839c593dc67fdull);
+    static const unsigned char t1[7] = {1,2,3,4,5,6,7};
+    hasher.Write(t1, 7);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x93f5f5799a932462ull);
+    hasher.Write(0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x3f2acc7f57c29bdbull);
+    static const unsigned char t2[2] = {16,17};
+    hasher.Write(t2, 2);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x4bc1b3f0968dd39cull);
+    static const unsigned char t3[9] = {18,19,20,21,22,23,24,25,26};
+    hasher.Write(t3, 9);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x2f2e6163076bcfadull);
+    static const unsigned char t4[5] = {27,28,29,30,31};
+    hasher.Write(t4, 5);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x7127512f72f27cceull);
+    hasher.Write(0x2726252423222120ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x0e3ea96b5304a7d0ull);
+    hasher.Write(0x2F2E2D2C2B2A2928ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0xe612a3cb9ecba951ull);
+
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")), 0x7127512f72f27cceull);
+
+    // SipHash-1-3, as used for hash tables, on the same key and input
+    BOOST_CHECK_EQUAL(SipHash13Uint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")), 0x81157b6c16a7b60dull);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -193,6 +193,32 @@ BOOST_AUTO_TEST_CASE(key_test1)
 }
 */
 
+BOOST_AUTO_TEST_CASE(verify_same_slot)
+{
+    // Keys parsed for verification are kept per thread by the last byte of
+    // their x coordinate; keys sharing it must not be mistaken for each other
+    std::string strMsg = "Very secret message";
+    uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+    std::vector<CKey> vKeys;
+    std::vector<std::vector<unsigned char> > vSigs;
+    while (vKeys.size() < 3) {
+        CKey key;
+        key.MakeNewKey(true);
+        if (!vKeys.empty() && key.GetPubKey()[32] % 16 != vKeys[0].GetPubKey()[32] % 16)
+            continue;
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hashMsg, vchSig));
+        vKeys.push_back(key);
+        vSigs.push_back(vchSig);
+    }
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < vKeys.size(); i++) {
+            for (size_t j = 0; j < vKeys.size(); j++)
+                BOOST_CHECK_EQUAL(vKeys[i].GetPubKey().Verify(hashMsg, vSigs[j]), i == j);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(zc_address_test)
 {
     for (size_t i = 0; i < 1000; i++) {
@@ -4,6 +4,7 @@
 
 #include "chainparams.h"
 #include "main.h"
+#include "txdb.h"
 
 #include "test/test_bitcoin.h"
 
@@ -101,4 +102,63 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(chain_tip_snapshot)
+{
+    // The testing setup connected the genesis block
+    LOCK(cs_main);
+    std::shared_ptr<const CChainTipSnapshot> snapshot = GetChainTipSnapshot();
+    BOOST_CHECK(snapshot->pindex == chainActive.Tip());
+    BOOST_CHECK_EQUAL(snapshot->nHeight, chainActive.Height());
+    BOOST_CHECK(snapshot->hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(snapshot->nChainWork == chainActive.Tip()->nChainWork);
+    BOOST_CHECK_EQUAL(snapshot->nBits, chainActive.Tip()->nBits);
+}
+
+BOOST_AUTO_TEST_CASE(block_index_trimmed_solution)
+{
+    // The testing setup connected and flushed the genesis block
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Genesis();
+    const CBlockHeader& genesis = Params().GenesisBlock();
+    BOOST_CHECK(!pindex->HasSolution());
+    BOOST_CHECK(pindex->GetSolution() == genesis.nSolution);
+    BOOST_CHECK(pindex->GetBlockHeader().GetHash() == genesis.GetHash());
+
+    // Rewriting a trimmed entry keeps its solution on disk
+    std::vector<const CBlockIndex*> vBlocks(1, pindex);
+    BOOST_CHECK(pblocktree->WriteBatchSync(std::vector<std::pair<int, const CBlockFileInfo*> >(), 0, vBlocks));
+    std::vector<unsigned char> solution;
+    BOOST_CHECK(pblocktree->ReadBlockSolution(genesis.GetHash(), solution));
+    BOOST_CHECK(solution == genesis.nSolution);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_limits)
+{
+    // Peers not timed yet get the fixed limit
+    BOOST_CHECK_EQUAL(GetBlocksInTransitLimit(0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    // Otherwise BLOCK_DOWNLOAD_QUEUE_TIME worth of blocks, within bounds
+    BOOST_CHECK_EQUAL(GetBlocksInTransitLimit(1000000LL * BLOCK_DOWNLOAD_QUEUE_TIME / 20), 20);
+    BOOST_CHECK_EQUAL(GetBlocksInTransitLimit(1000), MAX_BLOCKS_IN_TRANSIT_PER_FAST_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInTransitLimit(1000000LL * 60), MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // The download window only grows beyond BLOCK_DOWNLOAD_WINDOW with the speed of all peers together
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(0), (int)BLOCK_DOWNLOAD_WINDOW);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(64), 64 * (int)BLOCK_DOWNLOAD_WINDOW_TIME);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(1e6), (int)MAX_BLOCK_DOWNLOAD_WINDOW);
+}
+
+BOOST_AUTO_TEST_CASE(coin_cache_limit)
+{
+    const size_t nConfigured = 400 << 20;
+    // Headroom and pressure unknown, or plenty of memory left
+    BOOST_CHECK_EQUAL(GetCoinCacheLimit(nConfigured, 100 << 20, -1, -1), nConfigured);
+    BOOST_CHECK_EQUAL(GetCoinCacheLimit(nConfigured, 100 << 20, 4LL << 30, 0.5), nConfigured);
+    // The cache only grows into the headroom beyond MIN_MEMORY_HEADROOM
+    BOOST_CHECK_EQUAL(GetCoinCacheLimit(nConfigured, 100 << 20, MIN_MEMORY_HEADROOM + (50 << 20), -1), (size_t)150 << 20);
+    BOOST_CHECK_EQUAL(GetCoinCacheLimit(nConfigured, 100 << 20, 0, -1), MIN_COIN_CACHE_USAGE);
+    // Under pressure it is halved
+    BOOST_CHECK_EQUAL(GetCoinCacheLimit(nConfigured, 100 << 20, -1, COIN_CACHE_SHRINK_PRESSURE), (size_t)50 << 20);
+    BOOST_CHECK_EQUAL(GetCoinCacheLimit(nConfigured, 0, -1, 50), MIN_COIN_CACHE_USAGE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "core_memusage.h"
 #include "main.h"
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -101,4 +103,180 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    // A chain of three transactions, each spending the previous one
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0) {
+            tx[i].vin[0].prevout.hash = tx[i - 1].GetHash();
+            tx[i].vin[0].prevout.n = 0;
+        }
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL * (3 - i);
+    }
+    const uint64_t nSize = ::GetSerializeSize(tx[1], SER_NETWORK, PROTOCOL_VERSION);
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000LL, 2, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 100LL, 1, 0.0, 1));
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 10000LL, 3, 0.0, 1));
+
+    const CTxMemPoolEntry& root = pool.mapTx[tx[0].GetHash()];
+    const CTxMemPoolEntry& middle = pool.mapTx[tx[1].GetHash()];
+    const CTxMemPoolEntry& leaf = pool.mapTx[tx[2].GetHash()];
+    BOOST_CHECK_EQUAL(root.GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(root.GetModFeesWithDescendants(), 11100);
+    BOOST_CHECK_EQUAL(leaf.GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(leaf.GetSizeWithAncestors(), root.GetTxSize() + 2 * nSize);
+    BOOST_CHECK_EQUAL(middle.GetModFeesWithAncestors(), 1100);
+
+    BOOST_CHECK((*pool.setByModFeeRate.begin())->first == tx[2].GetHash());
+    BOOST_CHECK((*pool.setByEntryTime.begin())->first == tx[1].GetHash());
+    // The leaf pays well, but only together with its cheap parent
+    BOOST_CHECK((*pool.setByAncestorScore.begin())->first == tx[2].GetHash());
+    BOOST_CHECK((*pool.setByAncestorScore.rbegin())->first == tx[1].GetHash());
+
+    pool.PrioritiseTransaction(tx[1].GetHash(), tx[1].GetHash().ToString(), 0.0, 100000LL);
+    BOOST_CHECK_EQUAL(middle.GetModifiedFee(), 100100);
+    BOOST_CHECK_EQUAL(root.GetModFeesWithDescendants(), 111100);
+    BOOST_CHECK_EQUAL(leaf.GetModFeesWithAncestors(), 111100);
+    BOOST_CHECK((*pool.setByModFeeRate.begin())->first == tx[1].GetHash());
+    BOOST_CHECK((*pool.setByAncestorScore.rbegin())->first == tx[0].GetHash());
+
+    // Mined without its children
+    std::list<CTransaction> removed;
+    pool.remove(tx[0], removed, false);
+    BOOST_CHECK_EQUAL(middle.GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(leaf.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(leaf.GetModFeesWithAncestors(), 110100);
+    BOOST_CHECK_EQUAL(pool.setByAncestorScore.size(), 2);
+
+    pool.remove(tx[1], removed, true);
+    BOOST_CHECK(pool.setByModFeeRate.empty());
+    BOOST_CHECK(pool.setByEntryTime.empty());
+    BOOST_CHECK(pool.setByAncestorScore.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAnnounceOrderTest)
+{
+    // A parent paying little with a child paying a lot, and an unrelated transaction in between
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL;
+    }
+    tx[1].vin[0].prevout.hash = tx[0].GetHash();
+    tx[1].vin[0].prevout.n = 0;
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 100LL, 1, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 100000LL, 2, 0.0, 1));
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 1000LL, 3, 0.0, 1));
+
+    // Parents first, then by fee rate
+    BOOST_CHECK(pool.CompareDepthAndScore(tx[0].GetHash(), tx[1].GetHash()));
+    BOOST_CHECK(!pool.CompareDepthAndScore(tx[1].GetHash(), tx[0].GetHash()));
+    BOOST_CHECK(pool.CompareDepthAndScore(tx[2].GetHash(), tx[0].GetHash()));
+    BOOST_CHECK(pool.CompareDepthAndScore(tx[2].GetHash(), tx[1].GetHash()));
+
+    // Transactions gone from the mempool last
+    uint256 hashGone = GetRandHash();
+    BOOST_CHECK(pool.CompareDepthAndScore(tx[1].GetHash(), hashGone));
+    BOOST_CHECK(!pool.CompareDepthAndScore(hashGone, tx[1].GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Three unrelated transactions paying 1, 10 and 100 times the relay fee
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL;
+    }
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000LL, 300, 0.0, 1));
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 10000LL, 100, 0.0, 1));
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 100000LL, 200, 0.0, 1));
+    BOOST_CHECK(pool.GetMinFee(1).GetFeePerK() == 0);
+
+    // Nothing to do within the limit
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // The cheapest goes first, and raises the minimum fee above what it paid
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(pool.exists(tx[1].GetHash()));
+    const size_t nSize = ::GetSerializeSize(tx[0], SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(pool.GetMinFee(1) > CFeeRate(1000LL, nSize));
+
+    // Expiry goes by entry time
+    BOOST_CHECK_EQUAL(pool.Expire(150), 1);
+    BOOST_CHECK(!pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.exists(tx[2].GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolJoinSplitUsageTest)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 2;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10000LL;
+    size_t nUsage = RecursiveDynamicUsage(CTransaction(tx));
+
+    // The proofs and ciphertexts are held in the joinsplits themselves
+    tx.vjoinsplit.resize(2);
+    CTransaction txJoinSplit(tx);
+    BOOST_CHECK(RecursiveDynamicUsage(txJoinSplit) >= nUsage + 2 * sizeof(JSDescription));
+
+    CTxMemPool pool(CFeeRate(1000));
+    pool.addUnchecked(txJoinSplit.GetHash(), CTxMemPoolEntry(txJoinSplit, 0, 0, 0.0, 1));
+    BOOST_CHECK(pool.DynamicMemoryUsage() >= 2 * sizeof(JSDescription));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSharedTxTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10000LL;
+    uint256 hash = tx.GetHash();
+    BOOST_CHECK(!pool.get(hash));
+
+    // Copies of the entry share its transaction
+    pool.addUnchecked(hash, CTxMemPoolEntry(tx, 1000LL, 0, 0.0, 1));
+    std::shared_ptr<const CTransaction> ptx = pool.get(hash);
+    BOOST_CHECK(ptx && ptx->GetHash() == hash);
+    BOOST_CHECK(ptx == pool.get(hash));
+    BOOST_CHECK(&pool.mapTx[hash].GetTx() == ptx.get());
+
+    // ... which lasts as long as it is held elsewhere
+    std::list<CTransaction> removed;
+    pool.remove(tx, removed, false);
+    BOOST_CHECK(!pool.get(hash));
+    BOOST_CHECK(ptx->GetHash() == hash);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,17 +3,21 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "arith_uint256.h"
+#include "coins.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "random.h"
 #include "uint256.h"
 #include "util.h"
+#include "zcash/IncrementalMerkleTree.hpp"
 #include "crypto/equihash.h"
 //#include "pow/tromp/equi_miner.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
@@ -473,4 +477,76 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 }
 */
 
+BOOST_AUTO_TEST_CASE(CheckedTemplateBlock)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    LOCK(cs_main);
+
+    boost::scoped_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey));
+    BOOST_REQUIRE(pblocktemplate);
+
+    // A block found on the template may change the header and the coinbase
+    CBlock block = pblocktemplate->block;
+    block.nNonce = GetRandHash();
+    block.vtx[0] = CTransaction(createCoinbase(CScript() << OP_FALSE, 0, chainActive.Height() + 1));
+    BOOST_CHECK(MarkTemplateBlockChecked(block));
+    BOOST_CHECK(block.fScriptsChecked);
+    BOOST_CHECK(block.fProofsChecked);
+
+    // Not the transactions after it
+    CMutableTransaction mtx;
+    mtx.nVersion = PHGR_TX_VERSION;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    JSDescription js;
+    js.anchor = ZCIncrementalMerkleTree::empty_root();
+    js.nullifiers[0] = GetRandHash();
+    js.nullifiers[1] = GetRandHash();
+    mtx.vjoinsplit.push_back(js);
+
+    CBlock blockAltered = pblocktemplate->block;
+    blockAltered.vtx.push_back(CTransaction(mtx));
+    BOOST_CHECK(!MarkTemplateBlockChecked(blockAltered));
+    BOOST_CHECK(!blockAltered.fScriptsChecked);
+    BOOST_CHECK(!blockAltered.fProofsChecked);
+
+    // Nor the parent
+    CBlock blockOtherParent = pblocktemplate->block;
+    blockOtherParent.hashPrevBlock = GetRandHash();
+    BOOST_CHECK(!MarkTemplateBlockChecked(blockOtherParent));
+    BOOST_CHECK(!blockOtherParent.fScriptsChecked);
+    BOOST_CHECK(!blockOtherParent.fProofsChecked);
+
+    // The altered block spends a coin it cannot unlock, with a proof that
+    // does not verify: connecting it only skips the checks it is marked for
+    CCoinsViewCache view(pcoinsTip);
+    {
+        CCoinsModifier coins = view.ModifyCoins(mtx.vin[0].prevout.hash);
+        coins->fCoinBase = false;
+        coins->nVersion = 1;
+        coins->nHeight = chainActive.Height();
+        coins->vout.resize(1);
+        coins->vout[0].nValue = COIN;
+        coins->vout[0].scriptPubKey = CScript() << OP_FALSE;
+    }
+    CBlockIndex indexDummy(blockAltered);
+    indexDummy.pprev = chainActive.Tip();
+    indexDummy.nHeight = chainActive.Height() + 1;
+
+    CValidationState stateScripts;
+    blockAltered.fProofsChecked = true;
+    BOOST_CHECK(!ConnectBlock(blockAltered, stateScripts, &indexDummy, view, chainActive, true));
+    BOOST_CHECK(stateScripts.GetRejectReason() != "bad-txns-joinsplit-verification-failed");
+
+    CValidationState stateProofs;
+    blockAltered.fScriptsChecked = true;
+    blockAltered.fProofsChecked = false;
+    BOOST_CHECK(!ConnectBlock(blockAltered, stateProofs, &indexDummy, view, chainActive, true));
+    BOOST_CHECK_EQUAL(stateProofs.GetRejectReason(), "bad-txns-joinsplit-verification-failed");
+
+    CValidationState state;
+    blockAltered.fProofsChecked = true;
+    BOOST_CHECK(ConnectBlock(blockAltered, state, &indexDummy, view, chainActive, true));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
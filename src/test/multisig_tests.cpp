@@ -274,6 +274,54 @@ BOOST_AUTO_TEST_CASE(multisig_Solver1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(multisig_Solver_canonical)
+{
+    // The canonical pay-to-pubkey-hash, pay-to-script-hash and pay-to-pubkey
+    // scripts are matched by their bytes; what Solver returns for them, and
+    // for scripts that only look like them, must not depend on it
+    CKey key;
+    key.MakeNewKey(true);
+    valtype pubkey = ToByteVector(key.GetPubKey());
+    valtype hash = ToByteVector(key.GetPubKey().GetID());
+
+    vector<valtype> solutions;
+    txnouttype whichType;
+
+    CScript p2pkh = CScript() << OP_DUP << OP_HASH160 << hash << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK(Solver(p2pkh, whichType, solutions));
+    BOOST_CHECK_EQUAL(whichType, TX_PUBKEYHASH);
+    BOOST_CHECK(solutions == vector<valtype>(1, hash));
+
+    CScript p2sh = CScript() << OP_HASH160 << hash << OP_EQUAL;
+    BOOST_CHECK(Solver(p2sh, whichType, solutions));
+    BOOST_CHECK_EQUAL(whichType, TX_SCRIPTHASH);
+    BOOST_CHECK(solutions == vector<valtype>(2, hash));
+
+    CScript p2pk = CScript() << pubkey << OP_CHECKSIG;
+    BOOST_CHECK(Solver(p2pk, whichType, solutions));
+    BOOST_CHECK_EQUAL(whichType, TX_PUBKEY);
+    BOOST_CHECK(solutions == vector<valtype>(1, pubkey));
+
+    // A non minimal push of the hash still matches the template
+    CScript p2pkhPushData1;
+    p2pkhPushData1 << OP_DUP << OP_HASH160 << OP_PUSHDATA1;
+    p2pkhPushData1.push_back(20);
+    p2pkhPushData1.insert(p2pkhPushData1.end(), hash.begin(), hash.end());
+    p2pkhPushData1 << OP_EQUALVERIFY << OP_CHECKSIG;
+    BOOST_CHECK(Solver(p2pkhPushData1, whichType, solutions));
+    BOOST_CHECK_EQUAL(whichType, TX_PUBKEYHASH);
+    BOOST_CHECK(solutions == vector<valtype>(1, hash));
+
+    // Truncated, or followed by something other than replay protection data
+    CScript truncated(p2pkh.begin(), p2pkh.end() - 1);
+    BOOST_CHECK(!Solver(truncated, whichType, solutions));
+    BOOST_CHECK_EQUAL(whichType, TX_NONSTANDARD);
+    BOOST_CHECK(!Solver(CScript(p2pkh) << OP_NOP, whichType, solutions));
+    BOOST_CHECK(!Solver(CScript(p2sh) << OP_NOP, whichType, solutions));
+    BOOST_CHECK(!Solver(CScript(p2pk) << OP_NOP, whichType, solutions));
+    BOOST_CHECK(!Solver(CScript() << valtype(32, 0x02) << OP_CHECKSIG, whichType, solutions));
+}
+
 BOOST_AUTO_TEST_CASE(multisig_Sign)
 {
     // Test SignSignature() (and therefore the version of Solver() that signs transactions)
@@ -316,5 +364,48 @@ BOOST_AUTO_TEST_CASE(multisig_Sign)
     }
 }
 
+BOOST_AUTO_TEST_CASE(multisig_Sign_precomputed)
+{
+    // Signing against precomputed transaction data gives the same signatures
+    CBasicKeyStore keystore;
+    CKey key[2];
+    for (int i = 0; i < 2; i++)
+    {
+        key[i].MakeNewKey(true);
+        keystore.AddKey(key[i]);
+    }
+
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(3);
+    txFrom.vout[0].scriptPubKey = GetScriptForDestination(key[0].GetPubKey().GetID(), false);
+    txFrom.vout[1].scriptPubKey << OP_2 << ToByteVector(key[0].GetPubKey()) << ToByteVector(key[1].GetPubKey()) << OP_2 << OP_CHECKMULTISIG;
+    txFrom.vout[2].scriptPubKey << ToByteVector(key[1].GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction txTo;
+    txTo.vin.resize(3);
+    txTo.vout.resize(1);
+    for (int i = 0; i < 3; i++)
+    {
+        txTo.vin[i].prevout.n = i;
+        txTo.vin[i].prevout.hash = txFrom.GetHash();
+        txTo.vin[i].scriptSig << OP_1;
+    }
+    txTo.vout[0].nValue = 1;
+
+    const CTransaction txToConst(txTo);
+    const PrecomputedTransactionData txdata(txToConst);
+    for (int i = 0; i < 3; i++)
+    {
+        CScript scriptSig, scriptSigPrecomputed;
+        BOOST_CHECK(ProduceSignature(TransactionSignatureCreator(&keystore, &txToConst, i), txFrom.vout[i].scriptPubKey, scriptSig));
+        BOOST_CHECK(ProduceSignature(TransactionSignatureCreator(&keystore, &txToConst, i, SIGHASH_ALL, &txdata), txFrom.vout[i].scriptPubKey, scriptSigPrecomputed));
+        BOOST_CHECK(scriptSig == scriptSigPrecomputed);
+
+        // The scripts of the other inputs do not take part
+        txTo.vin[i].scriptSig = scriptSig;
+        BOOST_CHECK(VerifyScript(scriptSig, txFrom.vout[i].scriptPubKey, STANDARD_NONCONTEXTUAL_SCRIPT_VERIFY_FLAGS, MutableTransactionSignatureChecker(&txTo, i)));
+    }
+}
+
 
 BOOST_AUTO_TEST_SUITE_END()
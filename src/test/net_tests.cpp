@@ -0,0 +1,79 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    CNetMessageBufferPool pool;
+
+    // Buffers are sized to their class
+    CPublicSerializeData vch;
+    pool.Get(vch, 100);
+    BOOST_CHECK(vch.empty());
+    BOOST_CHECK(vch.capacity() >= MIN_RECV_BUFFER_SIZE);
+    pool.Get(vch, MIN_RECV_BUFFER_SIZE + 1);
+    BOOST_CHECK(vch.capacity() >= 2 * MIN_RECV_BUFFER_SIZE);
+
+    // and come back for a message of the same class, emptied
+    vch.resize(MIN_RECV_BUFFER_SIZE + 1, 'x');
+    const char* pchBuffer = vch.data();
+    pool.Put(vch);
+    BOOST_CHECK(vch.empty());
+    BOOST_CHECK(pool.GetPooledBytes() >= 2 * MIN_RECV_BUFFER_SIZE);
+    CPublicSerializeData vchAgain;
+    pool.Get(vchAgain, 2 * MIN_RECV_BUFFER_SIZE);
+    BOOST_CHECK(vchAgain.data() == pchBuffer);
+    BOOST_CHECK(vchAgain.empty());
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+
+    // Larger messages do not get them
+    pool.Put(vchAgain);
+    CPublicSerializeData vchLarge;
+    pool.Get(vchLarge, 4 * MIN_RECV_BUFFER_SIZE);
+    BOOST_CHECK(vchLarge.data() != pchBuffer);
+    BOOST_CHECK(vchLarge.capacity() >= 4 * MIN_RECV_BUFFER_SIZE);
+
+    // Nor is the pool growing without bounds
+    std::vector<CPublicSerializeData> vBuffers(MAX_POOLED_RECV_BUFFER_BYTES / MAX_PROTOCOL_MESSAGE_LENGTH + 2);
+    for (CPublicSerializeData& vchMax : vBuffers)
+        pool.Get(vchMax, MAX_PROTOCOL_MESSAGE_LENGTH);
+    for (CPublicSerializeData& vchMax : vBuffers)
+        pool.Put(vchMax);
+    BOOST_CHECK(pool.GetPooledBytes() <= MAX_POOLED_RECV_BUFFER_BYTES);
+}
+
+BOOST_AUTO_TEST_CASE(message_time_budget)
+{
+    CMessageTimeBudget budget;
+    int64_t nNow = 1000000000;
+
+    // A full burst is available at first
+    BOOST_CHECK(budget.Available(nNow));
+    BOOST_CHECK_EQUAL(budget.GetBudget(), MSG_CLASS_TIME_BURST);
+
+    // Overdrawing it makes the class wait until it is paid back
+    budget.Consume(MSG_CLASS_TIME_BURST + MSG_CLASS_TIME_PER_SECOND);
+    BOOST_CHECK(!budget.Available(nNow));
+    nNow += 500000;
+    BOOST_CHECK(!budget.Available(nNow));
+    nNow += 500000;
+    BOOST_CHECK(!budget.Available(nNow));
+    // one microsecond of budget every ten
+    for (int i = 0; i < 9; i++)
+        BOOST_CHECK(!budget.Available(++nNow));
+    BOOST_CHECK(budget.Available(++nNow));
+
+    // and it never refills beyond a burst
+    nNow += 3600 * 1000000LL;
+    BOOST_CHECK(budget.Available(nNow));
+    BOOST_CHECK_EQUAL(budget.GetBudget(), MSG_CLASS_TIME_BURST);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -93,6 +93,22 @@ BOOST_AUTO_TEST_CASE(netbase_lookupnumeric)
     BOOST_CHECK(TestParse(":::", ""));
 }
 
+BOOST_AUTO_TEST_CASE(netbase_lookupmany)
+{
+    vector<string> vNames;
+    vNames.push_back("127.0.0.1");
+    vNames.push_back(":::");
+    vNames.push_back("[::1]:8333");
+    vNames.push_back("5wyqrzbvrdsumnok.onion:9033");
+    vector<vector<CService> > vAddrs;
+    LookupMany(vNames, vAddrs, 65535, false);
+    BOOST_CHECK_EQUAL(vAddrs.size(), 4U);
+    BOOST_CHECK(vAddrs[0].size() == 1 && vAddrs[0][0].ToString() == "127.0.0.1:65535");
+    BOOST_CHECK(vAddrs[1].empty());
+    BOOST_CHECK(vAddrs[2].size() == 1 && vAddrs[2][0].ToString() == "[::1]:8333");
+    BOOST_CHECK(vAddrs[3].size() == 1 && vAddrs[3][0].ToString() == "5wyqrzbvrdsumnok.onion:9033");
+}
+
 BOOST_AUTO_TEST_CASE(onioncat_test)
 {
     // values from https://web.archive.org/web/20121122003543/http://www.cypherpunk.at/onioncat/wiki/OnionCat
@@ -77,6 +77,11 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
             CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
             ss << pmt1;
 
+            // the tree built from the merkle tree of the block must be the same
+            CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+            ssBlock << CPartialMerkleTree(block, vMatch);
+            BOOST_CHECK(ss.str() == ssBlock.str());
+
             // verify CPartialMerkleTree's size guarantees
             unsigned int n = std::min<unsigned int>(nTx, 1 + vMatchTxid1.size()*nHeight);
             BOOST_CHECK(ss.size() <= 10 + (258*n+7)/8);
@@ -124,4 +129,32 @@ BOOST_AUTO_TEST_CASE(pmt_malleability)
     BOOST_CHECK(tree.ExtractMatches(vTxid).IsNull());
 }
 
+BOOST_AUTO_TEST_CASE(pmt_coinbase_update)
+{
+    static const unsigned int nTxCounts[] = {1, 2, 3, 7, 17, 256, 513};
+
+    for (unsigned int nTx : nTxCounts) {
+        CBlock block;
+        for (unsigned int j=0; j<nTx; j++) {
+            CMutableTransaction tx;
+            tx.nLockTime = j;
+            block.vtx.push_back(CTransaction(tx));
+        }
+        block.BuildMerkleTree();
+
+        // Only rehashing the coinbase path gives the root of a fresh tree
+        for (unsigned int nExtraNonce = 1; nExtraNonce < 4; nExtraNonce++) {
+            CMutableTransaction coinbase(block.vtx[0]);
+            coinbase.nLockTime = nTx + nExtraNonce;
+            block.vtx[0] = CTransaction(coinbase);
+            uint256 root = block.UpdateMerkleTreeCoinbase();
+
+            CBlock fresh;
+            fresh.vtx = block.vtx;
+            BOOST_CHECK(root == fresh.BuildMerkleTree());
+            BOOST_CHECK(block.vMerkleTree == fresh.vMerkleTree);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -88,6 +88,10 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
             BOOST_CHECK(mpool.estimateFee(1) == CFeeRate(0));
             BOOST_CHECK(mpool.estimateFee(2).GetFeePerK() < 8*baseRate.GetFeePerK() + deltaFee);
             BOOST_CHECK(mpool.estimateFee(2).GetFeePerK() > 8*baseRate.GetFeePerK() - deltaFee);
+            // 30 blocks of 40 fee transactions are far from the 5000 the
+            // long horizon wants in the stats at a decay of .9998
+            for (unsigned int i = 1; i <= MAX_BLOCK_CONFIRMS; i++)
+                BOOST_CHECK(mpool.estimateFee(i, LONG_HORIZON) == CFeeRate(0));
         }
     }
 
@@ -93,4 +93,31 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(GetNetworkSolPS_test)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<CBlockIndex> blocks(200);
+    for (int i = 0; i < 200; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1269211443 + i * params.nPowTargetSpacing;
+        blocks[i].nBits = 0x1d00ffff;
+        blocks[i].nChainWork = i ? blocks[i - 1].nChainWork + GetBlockProof(blocks[i - 1]) : arith_uint256(0);
+    }
+    const double dSolPS = GetBlockProof(blocks[0]).getdouble() / params.nPowTargetSpacing;
+
+    BOOST_CHECK_EQUAL(GetNetworkSolPS(NULL, DEFAULT_NETWORK_SOLPS_LOOKUP, params), 0);
+    BOOST_CHECK_EQUAL(GetNetworkSolPS(&blocks[0], DEFAULT_NETWORK_SOLPS_LOOKUP, params), 0);
+    BOOST_CHECK_CLOSE((double)GetNetworkSolPS(&blocks[199], DEFAULT_NETWORK_SOLPS_LOOKUP, params), dSolPS, 0.0001);
+    // Nonpositive lookups and lookups beyond the genesis block are bounded
+    BOOST_CHECK_CLOSE((double)GetNetworkSolPS(&blocks[199], 0, params), dSolPS, 0.0001);
+    BOOST_CHECK_CLOSE((double)GetNetworkSolPS(&blocks[10], 1000, params), dSolPS, 0.0001);
+
+    // Only the blocks in the window count
+    blocks[199 - DEFAULT_NETWORK_SOLPS_LOOKUP - 1].nTime = blocks[0].nTime;
+    BOOST_CHECK_CLOSE((double)GetNetworkSolPS(&blocks[199], DEFAULT_NETWORK_SOLPS_LOOKUP, params), dSolPS, 0.0001);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
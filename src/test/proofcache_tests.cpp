@@ -0,0 +1,46 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "proofcache.h"
+
+#include "primitives/transaction.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(proofcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(proofcache_entries)
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.joinSplitPubKey = GetRandHash();
+    JSDescription js;
+    js.anchor = GetRandHash();
+    js.nullifiers[0] = GetRandHash();
+    js.randomSeed = GetRandHash();
+    mtx.vjoinsplit.push_back(js);
+    CTransaction tx(mtx);
+
+    BOOST_CHECK(!IsJoinSplitProofCached(tx.vjoinsplit[0], tx.joinSplitPubKey));
+    CacheJoinSplitProofs(tx);
+    BOOST_CHECK(IsJoinSplitProofCached(tx.vjoinsplit[0], tx.joinSplitPubKey));
+
+    // The proof statement depends on the public key and on the JoinSplit fields
+    BOOST_CHECK(!IsJoinSplitProofCached(tx.vjoinsplit[0], GetRandHash()));
+    JSDescription other = tx.vjoinsplit[0];
+    other.nullifiers[1] = GetRandHash();
+    BOOST_CHECK(!IsJoinSplitProofCached(other, tx.joinSplitPubKey));
+    other = tx.vjoinsplit[0];
+    other.vpub_new = 1;
+    BOOST_CHECK(!IsJoinSplitProofCached(other, tx.joinSplitPubKey));
+
+    // Not part of the statement
+    other = tx.vjoinsplit[0];
+    other.ephemeralKey = GetRandHash();
+    BOOST_CHECK(IsJoinSplitProofCached(other, tx.joinSplitPubKey));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -823,6 +823,68 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
     BOOST_CHECK(ids.size()==0);
 }
 
+// The OrderOperation records the order in which operations run
+std::atomic<int64_t> gOrder(0);
+
+class OrderOperation : public AsyncRPCOperation {
+public:
+    int64_t order = -1;
+    OrderOperation(OperationPriority priority) {
+        set_priority(priority);
+    }
+    virtual ~OrderOperation() {}
+    virtual void main() {
+        set_state(OperationStatus::EXECUTING);
+        order = gOrder++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        set_state(OperationStatus::SUCCESS);
+    }
+};
+
+// This tests that normal priority operations run before low priority ones, and the worker limits
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_priority)
+{
+    gOrder = 0;
+
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+    std::shared_ptr<OrderOperation> low1(new OrderOperation(OperationPriority::LOW));
+    std::shared_ptr<OrderOperation> low2(new OrderOperation(OperationPriority::LOW));
+    std::shared_ptr<OrderOperation> normal(new OrderOperation(OperationPriority::NORMAL));
+    q->addOperation(low1);
+    q->addOperation(low2);
+    q->addOperation(normal);
+    BOOST_CHECK(q->getOperationCount() == 3);
+    BOOST_CHECK_EQUAL(normal->getStatus()["priority"].get_str(), "normal");
+    BOOST_CHECK_EQUAL(low1->getStatus()["priority"].get_str(), "low");
+
+    q->addWorker();
+    q->finishAndWait();
+    BOOST_CHECK_EQUAL(normal->order, 0);
+    BOOST_CHECK_EQUAL(low1->order, 1);
+    BOOST_CHECK_EQUAL(low2->order, 2);
+
+    // With one of two workers allowed to run low priority operations, they run one at a time
+    gOrder = 0;
+    q = std::make_shared<AsyncRPCQueue>();
+    q->setWorkerLimit(OperationPriority::LOW, 1);
+    BOOST_CHECK_EQUAL(q->getWorkerLimit(OperationPriority::LOW), 1);
+    BOOST_CHECK_EQUAL(q->getWorkerLimit(OperationPriority::NORMAL), 0);
+    std::vector<std::shared_ptr<OrderOperation>> ops;
+    for (int i = 0; i < 3; i++) {
+        ops.push_back(std::shared_ptr<OrderOperation>(new OrderOperation(OperationPriority::LOW)));
+        q->addOperation(ops.back());
+    }
+    q->addWorker();
+    q->addWorker();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    BOOST_CHECK_EQUAL(gOrder.load(), 1);
+    q->finishAndWait();
+    BOOST_CHECK_EQUAL(gOrder.load(), 3);
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(ops[i]->order, i);
+    }
+}
+
 // This tests z_getoperationstatus, z_getoperationresult, z_listoperationids
 BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
 {
@@ -1347,6 +1409,13 @@ BOOST_AUTO_TEST_CASE(rpc_z_shieldcoinbase_parameters)
     "100 -1"
     ), runtime_error);
 
+    // invalid maximum number of transactions, must be at least 0
+    BOOST_CHECK_THROW(CallRPC("z_shieldcoinbase "
+    "tmRr6yJonqGK23UVhrKuyvTpF8qxQQjKigJ "
+    "tnpoQJVnYBZZqkFadj2bJJLThNCxbADGB5gSGeYTAGGrT5tejsxY9Zc1BtY8nnHmZkB "
+    "100 50 -1"
+    ), runtime_error);
+
     // Mutable tx containing contextual information we need to build tx
     UniValue retValue = CallRPC("getblockcount");
     int nHeight = retValue.get_int();
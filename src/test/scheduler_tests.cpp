@@ -109,4 +109,52 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void WaitForFlag(boost::mutex& mutex, boost::condition_variable& cond, bool& fFlag)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (!fFlag)
+        cond.wait(lock);
+}
+
+static void SetFlag(boost::mutex& mutex, boost::condition_variable& cond, bool& fFlag)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fFlag = true;
+    cond.notify_all();
+}
+
+BOOST_AUTO_TEST_CASE(long_running_tasks_run_apart)
+{
+    CScheduler scheduler;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fRelease = false, fTimerRan = false;
+
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    threads.create_thread(boost::bind(&CScheduler::serviceLongRunning, &scheduler));
+
+    // A long-running task blocked until released, then a timer due after it;
+    // both are due once the threads have had time to start
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule(boost::bind(&WaitForFlag, boost::ref(mutex), boost::ref(cond), boost::ref(fRelease)),
+                       now + boost::chrono::milliseconds(100), "long", true);
+    scheduler.schedule(boost::bind(&SetFlag, boost::ref(mutex), boost::ref(cond), boost::ref(fTimerRan)),
+                       now + boost::chrono::milliseconds(101), "timer");
+
+    // The timer runs while the long-running task still blocks
+    WaitForFlag(mutex, cond, fTimerRan);
+    BOOST_CHECK(!fRelease);
+    SetFlag(mutex, cond, fRelease);
+
+    scheduler.stop(true);
+    threads.join_all();
+
+    std::map<std::string, CScheduler::TaskStats> mapStats = scheduler.getTaskStats();
+    BOOST_CHECK_EQUAL(mapStats.size(), 2U);
+    BOOST_CHECK_EQUAL(mapStats["long"].nRuns, 1U);
+    BOOST_CHECK_EQUAL(mapStats["timer"].nRuns, 1U);
+    BOOST_CHECK(mapStats["long"].nMaxMicros >= mapStats["long"].nTotalMicros);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -85,6 +85,37 @@ BOOST_AUTO_TEST_CASE(boost_arrays)
     BOOST_CHECK_EQUAL(GetSerializeSize(test, 0, 0), 8);
 }
 
+BOOST_AUTO_TEST_CASE(flat_arrays_and_vectors)
+{
+    // Written in one go, the same bytes as element by element
+    std::vector<uint256> vHash;
+    vHash.push_back(uint256S("01"));
+    vHash.push_back(uint256S("ff00"));
+    std::array<std::array<unsigned char, 3>, 2> arr = {{ {{1, 2, 3}}, {{4, 5, 6}} }};
+
+    CDataStream ss(SER_DISK, 0);
+    ss << vHash << arr;
+
+    CDataStream ssElements(SER_DISK, 0);
+    WriteCompactSize(ssElements, vHash.size());
+    for (const uint256& hash : vHash)
+        ssElements << hash;
+    for (const std::array<unsigned char, 3>& a : arr)
+        for (unsigned char c : a)
+            ssElements << c;
+    BOOST_CHECK_EQUAL(HexStr(ss.begin(), ss.end()), HexStr(ssElements.begin(), ssElements.end()));
+
+    BOOST_CHECK_EQUAL(GetSerializeSize(vHash, 0, 0), 1 + 2 * 32);
+    BOOST_CHECK_EQUAL(GetSerializeSize(arr, 0, 0), 6);
+
+    std::vector<uint256> vHashRead;
+    std::array<std::array<unsigned char, 3>, 2> arrRead;
+    ss >> vHashRead >> arrRead;
+    BOOST_CHECK(vHashRead == vHash);
+    BOOST_CHECK(arrRead == arr);
+    BOOST_CHECK(ss.empty());
+}
+
 BOOST_AUTO_TEST_CASE(sizes)
 {
     BOOST_CHECK_EQUAL(sizeof(char), GetSerializeSize(char(0), 0));
@@ -346,4 +377,60 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(get_and_clear)
+{
+    // Into an empty vector the buffer is handed over
+    CPublicDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << uint32_t(0x01020304) << std::string("public");
+    const char* pch = &ss[0];
+    CPublicSerializeData d;
+    ss.GetAndClear(d);
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK_EQUAL(d.size(), 11);
+    BOOST_CHECK(d.data() == pch);
+
+    // Otherwise the unread data is appended
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << uint8_t(1) << uint8_t(2) << uint8_t(3);
+    uint8_t n;
+    ss2 >> n;
+    CSerializeData d2(1, 'x');
+    ss2.GetAndClear(d2);
+    BOOST_CHECK(ss2.empty());
+    BOOST_CHECK(d2 == CSerializeData({'x', 2, 3}));
+
+    CPublicDataStream ss3(d, SER_DISK, CLIENT_VERSION);
+    uint32_t n3;
+    std::string str;
+    ss3 >> n3 >> str;
+    BOOST_CHECK_EQUAL(n3, 0x01020304);
+    BOOST_CHECK_EQUAL(str, "public");
+}
+
+BOOST_AUTO_TEST_CASE(memory_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    ss << (uint32_t)0x01020304 << std::string("mapped") << (uint8_t)5;
+    const std::vector<char> data(ss.begin(), ss.end());
+
+    CMemoryReader reader(&data[0], &data[0] + data.size(), SER_DISK, 0);
+    uint32_t n;
+    std::string str;
+    uint8_t b;
+    reader >> n >> str;
+    BOOST_CHECK_EQUAL(n, 0x01020304);
+    BOOST_CHECK_EQUAL(str, "mapped");
+    BOOST_CHECK_EQUAL(reader.size(), 1);
+    reader >> b;
+    BOOST_CHECK_EQUAL(b, 5);
+
+    // Reading past the end throws instead of touching the bytes after the buffer
+    BOOST_CHECK_THROW(reader >> b, std::ios_base::failure);
+    CMemoryReader reader2(&data[0], &data[0] + data.size(), SER_DISK, 0);
+    BOOST_CHECK_THROW(reader2.ignore(data.size() + 1), std::ios_base::failure);
+    reader2.ignore(4);
+    reader2 >> str;
+    BOOST_CHECK_EQUAL(str, "mapped");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
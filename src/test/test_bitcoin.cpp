@@ -10,7 +10,9 @@
 
 #include "key.h"
 #include "main.h"
+#include "proofcache.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -68,6 +70,8 @@ BasicTestingSetup::BasicTestingSetup()
     fPrintToDebugLog = false; // don't want to write to debug.log file
     fCheckBlockIndex = true;
     SelectParams(CBaseChainParams::MAIN);
+    InitSignatureCache();
+    InitProofCache();
 }
 BasicTestingSetup::~BasicTestingSetup()
 {
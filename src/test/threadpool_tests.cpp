@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "threadpool.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(threadpool_tests, BasicTestingSetup)
+
+static const CThreadPoolStats* FindPool(const std::vector<CThreadPoolStats>& vStats, const std::string& strName)
+{
+    for (const CThreadPoolStats& stats : vStats)
+        if (stats.strName == strName)
+            return &stats;
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(threadpool_parse_cpus)
+{
+    std::vector<int> vExpected = {0, 1, 2, 3, 8, 10, 11};
+    BOOST_CHECK(ParseCPUSet("0-3,8,10-11") == vExpected);
+    BOOST_CHECK(ParseCPUSet("8,0-3,11,10,2") == vExpected);
+    BOOST_CHECK(ParseCPUSet("5") == std::vector<int>(1, 5));
+    BOOST_CHECK(ParseCPUSet("").empty());
+    BOOST_CHECK(ParseCPUSet("3-1").empty());
+    BOOST_CHECK(ParseCPUSet("0-").empty());
+    BOOST_CHECK(ParseCPUSet("a").empty());
+    BOOST_CHECK(ParseCPUSet("node-1").empty());
+
+    std::string strError;
+    BOOST_CHECK(!SetThreadPoolAffinity("nopool:0", strError));
+    BOOST_CHECK(!SetThreadPoolAffinity("miner", strError));
+    BOOST_CHECK(!SetThreadPoolAffinity("miner:x", strError));
+}
+
+BOOST_AUTO_TEST_CASE(threadpool_accounts_threads)
+{
+    std::vector<CThreadPoolStats> vBefore = GetThreadPoolStats();
+    const CThreadPoolStats* pBefore = FindPool(vBefore, "rpc");
+    const int nThreadsBefore = pBefore ? pBefore->nThreads : 0;
+    const double dThreadSecondsBefore = pBefore ? pBefore->dThreadSeconds : 0;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    bool fJoined = false, fDone = false;
+    boost::thread thread([&] {
+        JoinThreadPool("rpc");
+        boost::unique_lock<boost::mutex> lock(cs);
+        fJoined = true;
+        cond.notify_all();
+        while (!fDone)
+            cond.wait(lock);
+    });
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fJoined)
+            cond.wait(lock);
+    }
+
+    std::vector<CThreadPoolStats> vDuring = GetThreadPoolStats();
+    BOOST_REQUIRE(FindPool(vDuring, "rpc"));
+    BOOST_CHECK_EQUAL(FindPool(vDuring, "rpc")->nThreads, nThreadsBefore + 1);
+
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fDone = true;
+        cond.notify_all();
+    }
+    thread.join();
+
+    // The thread has left the pool, its time stays counted
+    std::vector<CThreadPoolStats> vAfter = GetThreadPoolStats();
+    BOOST_REQUIRE(FindPool(vAfter, "rpc"));
+    BOOST_CHECK_EQUAL(FindPool(vAfter, "rpc")->nThreads, nThreadsBefore);
+    BOOST_CHECK(FindPool(vAfter, "rpc")->dThreadSeconds > dThreadSecondsBefore);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -143,6 +143,7 @@ BOOST_AUTO_TEST_CASE(tx_valid)
             CDataStream stream(ParseHex(transaction), SER_NETWORK, PROTOCOL_VERSION);
             CTransaction tx;
             stream >> tx;
+            BOOST_CHECK_EQUAL(tx.GetTotalSize(), ParseHex(transaction).size());
 
             CValidationState state;
             BOOST_CHECK_MESSAGE(CheckTransaction(tx, state, verifier), strTest + comment);
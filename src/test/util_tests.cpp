@@ -86,6 +86,40 @@ BOOST_AUTO_TEST_CASE(util_HexStr)
         "04 67 8a fd b0");
 }
 
+BOOST_AUTO_TEST_CASE(util_HexCodecLengths)
+{
+    // Cover every length around the vector block sizes, with all byte values
+    std::vector<unsigned char> data(300);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (i * 97 + 13) & 0xff;
+
+    for (size_t len = 0; len <= data.size(); len++) {
+        std::string expected;
+        for (size_t i = 0; i < len; i++)
+            expected += strprintf("%02x", data[i]);
+        std::string hex = HexStr(data.begin(), data.begin() + len);
+        BOOST_CHECK_EQUAL(hex, expected);
+        BOOST_CHECK(ParseHex(hex) == std::vector<unsigned char>(data.begin(), data.begin() + len));
+        BOOST_CHECK_EQUAL(IsHex(hex), len > 0);
+
+        std::string upper = hex;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        BOOST_CHECK(ParseHex(upper) == std::vector<unsigned char>(data.begin(), data.begin() + len));
+    }
+
+    // A bad character anywhere stops decoding at the pair it is in
+    std::string hex = HexStr(data);
+    const char bad[] = { 'g', 'G', '/', ':', '@', '`', '\0', (char)0xb0 };
+    for (size_t pos = 0; pos < hex.size(); pos += 7) {
+        for (size_t i = 0; i < sizeof(bad); i++) {
+            std::string s = hex;
+            s[pos] = bad[i];
+            BOOST_CHECK(ParseHex(s) == std::vector<unsigned char>(data.begin(), data.begin() + pos / 2));
+            BOOST_CHECK(!IsHex(s));
+        }
+    }
+}
+
 
 BOOST_AUTO_TEST_CASE(util_DateTimeStrFormat)
 {
@@ -96,6 +130,55 @@ BOOST_AUTO_TEST_CASE(util_DateTimeStrFormat)
     BOOST_CHECK_EQUAL(DateTimeStrFormat("%a, %d %b %Y %H:%M:%S +0000", 1317425777), "Fri, 30 Sep 2011 23:36:17 +0000");
 }
 
+BOOST_AUTO_TEST_CASE(util_LogCategories)
+{
+    static_assert(LOG_CATEGORY(NULL) == 0, "LogPrintf has no category");
+    static_assert(LOG_CATEGORY("addrman") == 1, "categories are looked up when compiled");
+    BOOST_CHECK_EQUAL(GetLogCategory("forks"), LOG_CATEGORY("forks"));
+    BOOST_CHECK_EQUAL(GetLogCategory("zrpcunsafe"), LOG_CATEGORY("zrpcunsafe"));
+    BOOST_CHECK_EQUAL(GetLogCategory("nosuchcategory"), (uint64_t)0);
+    BOOST_CHECK(LOG_CATEGORY_COUNT < 64);
+
+    BOOST_CHECK(LogAcceptCategory(LOG_CATEGORY(NULL)));
+    bool fDebugSaved = fDebug;
+    std::vector<std::string> vDebugSaved = mapMultiArgs["-debug"];
+    fDebug = true;
+    mapMultiArgs["-debug"] = {"net", "nosuchcategory"};
+    ReadLogCategories();
+    BOOST_CHECK(LogAcceptCategory(LOG_CATEGORY("net")));
+    BOOST_CHECK(!LogAcceptCategory(LOG_CATEGORY("forks")));
+    mapMultiArgs["-debug"] = {"1"};
+    ReadLogCategories();
+    BOOST_CHECK(LogAcceptCategory(LOG_CATEGORY("forks")));
+
+    // The arguments of a line not logged are not evaluated
+    mapMultiArgs["-debug"] = {"net"};
+    ReadLogCategories();
+    int nEvaluated = 0;
+    LogPrint("forks", "%d\n", ++nEvaluated);
+    BOOST_CHECK_EQUAL(nEvaluated, 0);
+
+    fDebug = fDebugSaved;
+    mapMultiArgs["-debug"] = vDebugSaved;
+    nLogCategories = LOG_CATEGORIES_UNREAD;
+}
+
+BOOST_AUTO_TEST_CASE(util_LogRateAllowed)
+{
+    BOOST_CHECK(LogRateAllowed("ratetest"));
+    BOOST_CHECK(LogRateAllowed(NULL));
+
+    // The lines may be counted in two seconds, never more
+    nLogRateLimit = 2;
+    int nAllowed = 0;
+    for (int i = 0; i < 10; i++)
+        nAllowed += LogRateAllowed("ratetest");
+    BOOST_CHECK(nAllowed >= 2 && nAllowed <= 4);
+    BOOST_CHECK(LogRateAllowed(NULL));
+    nLogRateLimit = DEFAULT_LOG_RATE_LIMIT;
+    BOOST_CHECK(LogRateAllowed("ratetest"));
+}
+
 BOOST_AUTO_TEST_CASE(util_ParseParameters)
 {
     const char *argv_test[] = {"-ignored", "-a", "-b", "-ccc=argument", "-ccc=multiple", "f", "-d=e"};
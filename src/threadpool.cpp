@@ -0,0 +1,203 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "threadpool.h"
+
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+static const char* const THREAD_POOL_NAMES[] = {"validation", "http", "rpc", "scheduler", "miner"};
+
+namespace {
+
+/** A thread's membership of its pool, ended by the thread exiting */
+class CPoolThread
+{
+public:
+    explicit CPoolThread(const std::string& strPoolIn);
+    ~CPoolThread();
+
+    /** CPU time used by the thread, which must still be running, 0 where it cannot be told */
+    double GetCPUSeconds() const;
+    double GetThreadSeconds(int64_t nNowMicros) const { return (nNowMicros - nStartMicros) / 1000000.0; }
+
+private:
+    std::string strPool;
+    int64_t nStartMicros;
+#ifdef __linux__
+    clockid_t clock;
+    bool fClock;
+#endif
+};
+
+struct CThreadPool {
+    std::vector<int> vCPUs;
+    std::set<const CPoolThread*> setThreads;
+    //! Usage of the threads that have exited
+    double dRetiredCPUSeconds;
+    double dRetiredThreadSeconds;
+
+    CThreadPool() : dRetiredCPUSeconds(0), dRetiredThreadSeconds(0) {}
+};
+
+boost::mutex csThreadPools;
+std::map<std::string, CThreadPool> mapThreadPools;
+boost::thread_specific_ptr<CPoolThread> poolThread;
+
+CPoolThread::CPoolThread(const std::string& strPoolIn) : strPool(strPoolIn), nStartMicros(GetTimeMicros())
+{
+#ifdef __linux__
+    fClock = pthread_getcpuclockid(pthread_self(), &clock) == 0;
+#endif
+}
+
+CPoolThread::~CPoolThread()
+{
+    boost::unique_lock<boost::mutex> lock(csThreadPools);
+    CThreadPool& pool = mapThreadPools[strPool];
+    pool.dRetiredCPUSeconds += GetCPUSeconds();
+    pool.dRetiredThreadSeconds += GetThreadSeconds(GetTimeMicros());
+    pool.setThreads.erase(this);
+}
+
+double CPoolThread::GetCPUSeconds() const
+{
+#ifdef __linux__
+    struct timespec ts;
+    if (fClock && clock_gettime(clock, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+    return 0;
+}
+
+} // anon namespace
+
+std::vector<int> ParseCPUSet(const std::string& strCPUs)
+{
+    std::string strList = strCPUs;
+    if (boost::algorithm::starts_with(strCPUs, "node")) {
+        int nNode;
+        if (!ParseInt32(strCPUs.substr(4), &nNode) || nNode < 0)
+            return std::vector<int>();
+        // The kernel lists the CPUs of a node in the same form
+        boost::filesystem::ifstream file(strprintf("/sys/devices/system/node/node%d/cpulist", nNode));
+        strList.clear();
+        std::getline(file, strList);
+    }
+
+    std::vector<int> vCPUs;
+    std::vector<std::string> vRanges;
+    boost::split(vRanges, strList, boost::is_any_of(","));
+    for (const std::string& strRange : vRanges) {
+        size_t nDash = strRange.find('-');
+        int nFirst, nLast;
+        if (!ParseInt32(strRange.substr(0, nDash), &nFirst) ||
+            !ParseInt32(nDash == std::string::npos ? strRange : strRange.substr(nDash + 1), &nLast) ||
+            nFirst < 0 || nLast < nFirst)
+            return std::vector<int>();
+        for (int n = nFirst; n <= nLast; n++)
+            vCPUs.push_back(n);
+    }
+    std::sort(vCPUs.begin(), vCPUs.end());
+    vCPUs.erase(std::unique(vCPUs.begin(), vCPUs.end()), vCPUs.end());
+    return vCPUs;
+}
+
+bool SetThreadPoolAffinity(const std::string& strSpec, std::string& strError)
+{
+    size_t nColon = strSpec.find(':');
+    std::string strPool = strSpec.substr(0, nColon);
+    if (std::find(std::begin(THREAD_POOL_NAMES), std::end(THREAD_POOL_NAMES), strPool) == std::end(THREAD_POOL_NAMES)) {
+        strError = strprintf("Unknown thread pool in -threadaffinity=%s", strSpec);
+        return false;
+    }
+    std::vector<int> vCPUs;
+    if (nColon != std::string::npos)
+        vCPUs = ParseCPUSet(strSpec.substr(nColon + 1));
+    if (vCPUs.empty()) {
+        strError = strprintf("Invalid CPUs in -threadaffinity=%s", strSpec);
+        return false;
+    }
+#ifdef __linux__
+    boost::unique_lock<boost::mutex> lock(csThreadPools);
+    mapThreadPools[strPool].vCPUs = vCPUs;
+#else
+    LogPrintf("%s: threads cannot be pinned on this platform, ignoring -threadaffinity=%s\n", __func__, strSpec);
+#endif
+    return true;
+}
+
+int GetThreadPoolCPUCount(const std::string& strPool)
+{
+    boost::unique_lock<boost::mutex> lock(csThreadPools);
+    std::map<std::string, CThreadPool>::const_iterator it = mapThreadPools.find(strPool);
+    return it == mapThreadPools.end() ? 0 : it->second.vCPUs.size();
+}
+
+void JoinThreadPool(const std::string& strPool)
+{
+    CPoolThread* thread = new CPoolThread(strPool);
+    std::vector<int> vCPUs;
+    {
+        boost::unique_lock<boost::mutex> lock(csThreadPools);
+        CThreadPool& pool = mapThreadPools[strPool];
+        pool.setThreads.insert(thread);
+        vCPUs = pool.vCPUs;
+    }
+    // Leaving an earlier pool, if any, is done by replacing the membership
+    poolThread.reset(thread);
+
+#ifdef __linux__
+    if (!vCPUs.empty()) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        for (int nCPU : vCPUs)
+            if (nCPU < CPU_SETSIZE)
+                CPU_SET(nCPU, &cpuset);
+        int nErr = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        if (nErr != 0)
+            LogPrintf("%s: cannot pin a thread of the %s pool: %s\n", __func__, strPool, strerror(nErr));
+    }
+#endif
+}
+
+std::vector<CThreadPoolStats> GetThreadPoolStats()
+{
+    boost::unique_lock<boost::mutex> lock(csThreadPools);
+    const int64_t nNowMicros = GetTimeMicros();
+    std::vector<CThreadPoolStats> vStats;
+    for (const std::pair<const std::string, CThreadPool>& entry : mapThreadPools) {
+        const CThreadPool& pool = entry.second;
+        CThreadPoolStats stats;
+        stats.strName = entry.first;
+        stats.nThreads = pool.setThreads.size();
+        stats.vCPUs = pool.vCPUs;
+        stats.dCPUSeconds = pool.dRetiredCPUSeconds;
+        stats.dThreadSeconds = pool.dRetiredThreadSeconds;
+        for (const CPoolThread* thread : pool.setThreads) {
+            stats.dCPUSeconds += thread->GetCPUSeconds();
+            stats.dThreadSeconds += thread->GetThreadSeconds(nNowMicros);
+        }
+        vStats.push_back(stats);
+    }
+    return vStats;
+}
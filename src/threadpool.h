@@ -0,0 +1,50 @@
+// Copyright (c) 2018 The Zen Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_THREADPOOL_H
+#define BITCOIN_THREADPOOL_H
+
+#include <string>
+#include <vector>
+
+/**
+ * The worker threads of the node are grouped into named pools: validation,
+ * http, rpc, scheduler and miner. Each subsystem still sizes and runs its own
+ * threads; a thread joins its pool when it starts. Joining places the thread
+ * on the CPUs its pool is pinned to, if any, and counts its CPU time towards
+ * the pool, so that pools can be kept off each other's cores and their use
+ * of them watched.
+ */
+
+/** The usage of a pool, as getthreadpoolinfo reports it */
+struct CThreadPoolStats {
+    std::string strName;
+    //! Threads of the pool running now
+    int nThreads;
+    //! The CPUs the pool is pinned to, empty if it may run anywhere
+    std::vector<int> vCPUs;
+    //! CPU time used by the threads of the pool so far, and the time they were alive
+    double dCPUSeconds;
+    double dThreadSeconds;
+};
+
+/**
+ * The CPUs of a list such as "0-3,8", or of NUMA node n given as "node<n>".
+ * Empty if the list cannot be read.
+ */
+std::vector<int> ParseCPUSet(const std::string& strCPUs);
+
+/** Pin a pool to the CPUs of a "<pool>:<cpus>" spec, see -threadaffinity. Only threads joining later are placed there. */
+bool SetThreadPoolAffinity(const std::string& strSpec, std::string& strError);
+
+/** The number of CPUs strPool is pinned to, 0 if it may run anywhere */
+int GetThreadPoolCPUCount(const std::string& strPool);
+
+/** Make the calling thread a member of strPool until it exits */
+void JoinThreadPool(const std::string& strPool);
+
+/** The pools that have been pinned or joined, by name */
+std::vector<CThreadPoolStats> GetThreadPoolStats();
+
+#endif // BITCOIN_THREADPOOL_H
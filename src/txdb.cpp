@@ -9,19 +9,31 @@
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
 
+#include <set>
 #include <stdint.h>
+#include <thread>
 
 #include <boost/thread.hpp>
 
 using namespace std;
 
 static const char DB_ANCHOR = 'A';
+static const char DB_ANCHOR_DELTA = 'D';
 static const char DB_NULLIFIER = 's';
+//! Coins of a transaction as one record: of older versions and of snapshot files
 static const char DB_COINS = 'c';
+static const char DB_COINS_HEADER = 'H';
+static const char DB_COINS_OUTPUT = 'C';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_COMPACT_TXINDEX = 'i';
+static const char DB_BLOCK_FILTER = 'g';
+static const char DB_ADDRESSINDEX = 'd';
+static const char DB_SPENTINDEX = 'p';
+static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -30,6 +42,17 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_FAST_REINDEX_FLAG = 'S';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_TXOUTSET_STATS = 'u';
+
+//! Most unspent outputs of a transaction read one by one rather than with a cursor
+static const size_t COINS_MAX_POINT_READS = 8;
+//! Transactions converted per batch by CCoinsViewDB::Upgrade
+static const size_t COINS_UPGRADE_BATCH_SIZE = 10000;
+
+//! Number of block index records read and hashed at a time at startup
+static const size_t BLOCK_INDEX_LOAD_BATCH_SIZE = 20000;
+//! Fewest records of a batch worth an extra hashing thread
+static const size_t BLOCK_INDEX_LOAD_MIN_PER_THREAD = 1000;
 
 
 void static BatchWriteAnchor(CLevelDBBatch &batch,
@@ -44,6 +67,41 @@ void static BatchWriteAnchor(CLevelDBBatch &batch,
     }
 }
 
+/**
+ * An anchor stored as a delta: its serialized tree is prefix followed by the
+ * last nSuffix bytes of the serialized tree of parent. Appending commitments
+ * mostly changes the bottom of the frontier, which is serialized first, so
+ * the suffix usually covers most of the tree. A null parent means prefix is
+ * the whole tree; nChain counts the deltas down to such a record.
+ */
+class CAnchorDelta
+{
+public:
+    uint256 parent;
+    uint32_t nChain;
+    uint32_t nSuffix;
+    std::vector<unsigned char> prefix;
+
+    CAnchorDelta() : nChain(0), nSuffix(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(parent);
+        READWRITE(VARINT(nChain));
+        READWRITE(VARINT(nSuffix));
+        READWRITE(prefix);
+    }
+};
+
+static std::vector<unsigned char> SerializeAnchorTree(const ZCIncrementalMerkleTree &tree)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << tree;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
 void static BatchWriteNullifier(CLevelDBBatch &batch, const uint256 &nf, const bool &entered) {
     if (!entered)
         batch.Erase(make_pair(DB_NULLIFIER, nf));
@@ -51,11 +109,260 @@ void static BatchWriteNullifier(CLevelDBBatch &batch, const uint256 &nf, const b
         batch.Write(make_pair(DB_NULLIFIER, nf), true);
 }
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
+/**
+ * The record of a transaction with unspent outputs in the coin database: its
+ * metadata and which of its outputs are unspent. Each of those has a record
+ * of its own, keyed by CCoinsOutputKey and holding the compressed CTxOut, so
+ * spending an output of a large transaction rewrites this record and erases
+ * that of the output rather than rewriting all the others.
+ *
+ * Serialized as VARINT(nVersion), VARINT(nHeight * 2 + fCoinBase) and the
+ * unspentness bitvector, least significant bit first, whose last byte is not
+ * zero.
+ */
+class CCoinsHeader
+{
+public:
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+    std::vector<bool> vUnspent;
+
+    CCoinsHeader() : nVersion(0), nHeight(0), fCoinBase(false) {}
+
+    explicit CCoinsHeader(const CCoins &coins) : nVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase) {
+        vUnspent.resize(coins.vout.size());
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+            vUnspent[i] = !coins.vout[i].IsNull();
+    }
+
+    bool IsUnspent(unsigned int n) const {
+        return n < vUnspent.size() && vUnspent[n];
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        READWRITE(VARINT(nVersion));
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        std::vector<unsigned char> vMask((vUnspent.size() + 7) / 8);
+        for (unsigned int i = 0; i < vUnspent.size(); i++)
+            if (vUnspent[i])
+                vMask[i / 8] |= 1 << (i % 8);
+        READWRITE(vMask);
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 2;
+            fCoinBase = nCode & 1;
+            vUnspent.assign(vMask.size() * 8, false);
+            for (unsigned int i = 0; i < vUnspent.size(); i++)
+                vUnspent[i] = (vMask[i / 8] >> (i % 8)) & 1;
+            while (!vUnspent.empty() && !vUnspent.back())
+                vUnspent.pop_back();
+        }
+    }
+};
+
+/**
+ * Key of an unspent output in the coin database. The index is big endian so
+ * that the outputs of a transaction are contiguous and in order.
+ */
+struct CCoinsOutputKey
+{
+    uint256 txid;
+    uint32_t n;
+
+    CCoinsOutputKey() : n(0) {}
+    CCoinsOutputKey(const uint256 &txidIn, uint32_t nIn) : txid(txidIn), n(nIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 36;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        txid.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, n);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        txid.Unserialize(s, nType, nVersion);
+        n = ser_readdata32be(s);
+    }
+};
+
+/**
+ * Accumulates the changes of a write to the statistics of the unspent outputs.
+ * The counts are updated as outputs are added and removed, while the elements
+ * of the MuHash are only serialized, and hashed by Finish on as many threads
+ * as they keep busy.
+ */
+class CTxOutSetStatsUpdater
+{
+private:
+    CDataStream ssElements;
+    //! End of each element in ssElements, and whether it is removed
+    std::vector<std::pair<size_t, bool> > vElements;
+
+    void QueueElement(const uint256 &txid, uint32_t n, const CCoinsHeader &header, const CTxOut &out, bool fRemove) {
+        ssElements << txid << n << header.nVersion << header.nHeight << header.fCoinBase << out;
+        vElements.push_back(std::make_pair(ssElements.size(), fRemove));
+    }
+
+public:
+    CTxOutSetStats stats;
+    //! Whether the statistics are known; cleared if an output to remove cannot be read
+    bool fStats;
+
+    CTxOutSetStatsUpdater(const CTxOutSetStats &statsIn, bool fStatsIn) :
+        ssElements(SER_GETHASH, PROTOCOL_VERSION), stats(statsIn), fStats(fStatsIn) {}
+
+    //! The header of a transaction, either newly added or as stored before an update
+    void AddHeader(const CCoinsHeader &header) {
+        stats.nTransactions++;
+        stats.nSerializedSize += 32 + ::GetSerializeSize(header, SER_DISK, CLIENT_VERSION);
+    }
+    void RemoveHeader(const CCoinsHeader &header) {
+        stats.nTransactions--;
+        stats.nSerializedSize -= 32 + ::GetSerializeSize(header, SER_DISK, CLIENT_VERSION);
+    }
+
+    void AddOutput(const uint256 &txid, uint32_t n, const CCoinsHeader &header, const CTxOut &out) {
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += out.nValue;
+        stats.nSerializedSize += ::GetSerializeSize(CTxOutCompressor(REF(out)), SER_DISK, CLIENT_VERSION);
+        QueueElement(txid, n, header, out, false);
+    }
+    void RemoveOutput(const uint256 &txid, uint32_t n, const CCoinsHeader &header, const CTxOut &out) {
+        stats.nTransactionOutputs--;
+        stats.nTotalAmount -= out.nValue;
+        stats.nSerializedSize -= ::GetSerializeSize(CTxOutCompressor(REF(out)), SER_DISK, CLIENT_VERSION);
+        QueueElement(txid, n, header, out, true);
+    }
+
+    size_t GetQueued() const { return vElements.size(); }
+
+    //! Hash the queued elements into the MuHash of the statistics
+    void Finish() {
+        if (vElements.empty())
+            return;
+        size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vElements.size() / MIN_MUHASH_ELEMENTS_PER_THREAD);
+        nThreads = std::max(nThreads, (size_t)1);
+        // Each thread hashes a slice into a MuHash of its own; they are
+        // multiplied together in any order
+        std::vector<MuHash3072> vHashes(nThreads);
+        const unsigned char* pData = (const unsigned char*)&ssElements[0];
+        auto worker = [&](size_t t) {
+            for (size_t i = vElements.size() * t / nThreads; i < vElements.size() * (t + 1) / nThreads; i++) {
+                size_t nBegin = i == 0 ? 0 : vElements[i - 1].first;
+                if (vElements[i].second)
+                    vHashes[t].Remove(pData + nBegin, vElements[i].first - nBegin);
+                else
+                    vHashes[t].Insert(pData + nBegin, vElements[i].first - nBegin);
+            }
+        };
+        std::vector<std::thread> vThreads;
+        for (size_t t = 1; t < nThreads; t++)
+            vThreads.emplace_back(worker, t);
+        worker(0);
+        for (std::thread& thread : vThreads)
+            thread.join();
+        for (const MuHash3072& hash : vHashes)
+            stats.muhash *= hash;
+        ssElements.clear();
+        vElements.clear();
+    }
+};
+
+/**
+ * Add the changes of an entry of the coins cache to a batch: the records of
+ * the outputs spent or added since onDisk, the header of the entry as stored,
+ * and the header.
+ */
+void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins, const CCoinsHeader &onDisk) {
+    CCoinsHeader header(coins);
+    for (unsigned int i = 0; i < std::max(header.vUnspent.size(), onDisk.vUnspent.size()); i++) {
+        if (header.IsUnspent(i) && !onDisk.IsUnspent(i))
+            batch.Write(make_pair(DB_COINS_OUTPUT, CCoinsOutputKey(hash, i)), REF(CTxOutCompressor(REF(coins.vout[i]))));
+        else if (!header.IsUnspent(i) && onDisk.IsUnspent(i))
+            batch.Erase(make_pair(DB_COINS_OUTPUT, CCoinsOutputKey(hash, i)));
+    }
     if (coins.IsPruned())
-        batch.Erase(make_pair(DB_COINS, hash));
+        batch.Erase(make_pair(DB_COINS_HEADER, hash));
+    else
+        batch.Write(make_pair(DB_COINS_HEADER, hash), header);
+}
+
+/**
+ * Account the outputs and header added by BatchWriteCoins to the statistics.
+ * Those it removes are accounted by the caller, which must read their values.
+ */
+void static UpdateTxOutSetStats(CTxOutSetStatsUpdater &stats, const uint256 &hash, const CCoins &coins, const CCoinsHeader &onDisk, bool fOnDisk) {
+    CCoinsHeader header(coins);
+    for (unsigned int i = 0; i < header.vUnspent.size(); i++) {
+        if (header.IsUnspent(i) && !onDisk.IsUnspent(i))
+            stats.AddOutput(hash, i, header, coins.vout[i]);
+    }
+    if (fOnDisk)
+        stats.RemoveHeader(onDisk);
+    if (!coins.IsPruned())
+        stats.AddHeader(header);
+}
+
+void static BatchWriteTxOutSetStatsRecord(CLevelDBBatch &batch, const CTxOutSetStatsUpdater &stats) {
+    if (stats.fStats)
+        batch.Write(DB_TXOUTSET_STATS, stats.stats);
     else
-        batch.Write(make_pair(DB_COINS, hash), coins);
+        batch.Erase(DB_TXOUTSET_STATS);
+}
+
+//! Seek a cursor to the first output record of a transaction from index n on
+void static SeekCoinsOutput(leveldb::Iterator *pcursor, const uint256 &hash, uint32_t n) {
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair(DB_COINS_OUTPUT, CCoinsOutputKey(hash, n));
+    pcursor->Seek(ssKey.str());
+}
+
+/**
+ * Read the unspent outputs of a transaction into coins, from the output
+ * records at a cursor and on, leaving the cursor past them. Returns false if
+ * one of them is missing. nSize is increased by the size of their values.
+ */
+bool static ReadCoinsOutputs(leveldb::Iterator *pcursor, const uint256 &hash, const CCoinsHeader &header, CCoins &coins, uint64_t &nSize) {
+    size_t nUnspent = std::count(header.vUnspent.begin(), header.vUnspent.end(), true);
+    size_t nRead = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        CCoinsOutputKey key;
+        ssKey >> chType;
+        if (chType != DB_COINS_OUTPUT)
+            break;
+        ssKey >> key;
+        if (key.txid != hash)
+            break;
+        if (!header.IsUnspent(key.n))
+            return error("%s: output %s:%u is spent but has a record", __func__, hash.ToString(), key.n);
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> REF(CTxOutCompressor(coins.vout[key.n]));
+        nSize += slValue.size();
+        nRead++;
+    }
+    if (nRead != nUnspent)
+        return error("%s: %u of the %u unspent outputs of %s have a record", __func__, nRead, nUnspent, hash.ToString());
+    return true;
+}
+
+//! Start a CCoins from the header of its transaction, with null outputs
+void static InitCoinsFromHeader(const CCoinsHeader &header, CCoins &coins) {
+    coins.nVersion = header.nVersion;
+    coins.nHeight = header.nHeight;
+    coins.fCoinBase = header.fCoinBase;
+    coins.vout.assign(header.vUnspent.size(), CTxOut());
+    for (CTxOut &out : coins.vout)
+        out.SetNull();
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
@@ -66,26 +373,263 @@ void static BatchWriteHashBestAnchor(CLevelDBBatch &batch, const uint256 &hash)
     batch.Write(DB_BEST_ANCHOR, hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+/**
+ * LevelDB tuning of our databases. The chainstate is read through the coins
+ * cache and written in large flushes, so it favours its write buffer; its
+ * records are mostly hashes, which do not compress. The block index holds
+ * the compressible transaction, address and filter indexes.
+ */
+static CLevelDBTuning GetDBTuning(bool fChainstate)
+{
+    CLevelDBTuning tuning;
+    tuning.fCompression = !fChainstate && GetBoolArg("-dbcompression", DEFAULT_DB_COMPRESSION);
+    tuning.fWriteHeavy = fChainstate;
+    tuning.nMaxOpenFiles = GetArg("-dbmaxopenfiles", DEFAULT_LEVELDB_MAX_OPEN_FILES);
+    return tuning;
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe, GetDBTuning(true)), nNullifierFilterStale(0), fTxOutSetStats(false) {
+    RebuildNullifierFilter();
+    LoadTxOutSetStats();
 }
 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, GetDBTuning(true)), nNullifierFilterStale(0), fTxOutSetStats(false) {
+    RebuildNullifierFilter();
+    LoadTxOutSetStats();
+}
 
-bool CCoinsViewDB::GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const {
+void CCoinsViewDB::LoadTxOutSetStats() {
+    LOCK(cs_txOutSetStats);
+    hashTxOutSetStatsBlock = GetBestBlock();
+    fTxOutSetStats = db.Read(DB_TXOUTSET_STATS, txOutSetStats);
+    // A database that was never written to has no outputs; one written by
+    // an older version has no statistics until InitTxOutSetStats
+    if (!fTxOutSetStats && hashTxOutSetStatsBlock.IsNull()) {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        pcursor->SeekToFirst();
+        fTxOutSetStats = !pcursor->Valid();
+    }
+}
+
+CTxOutSetStatsUpdater CCoinsViewDB::GetTxOutSetStatsUpdater() const {
+    LOCK(cs_txOutSetStats);
+    return CTxOutSetStatsUpdater(txOutSetStats, fTxOutSetStats);
+}
+
+void CCoinsViewDB::SetTxOutSetStats(const CTxOutSetStats &stats, bool fStats, const uint256 &hashBlock) {
+    LOCK(cs_txOutSetStats);
+    txOutSetStats = stats;
+    fTxOutSetStats = fStats;
+    if (!hashBlock.IsNull())
+        hashTxOutSetStatsBlock = hashBlock;
+}
+
+bool CCoinsViewDB::GetTxOutSetStats(CCoinsStats &stats) const {
+    LOCK(cs_txOutSetStats);
+    if (!fTxOutSetStats)
+        return false;
+    stats.hashBlock = hashTxOutSetStatsBlock;
+    stats.nTransactions = txOutSetStats.nTransactions;
+    stats.nTransactionOutputs = txOutSetStats.nTransactionOutputs;
+    stats.nSerializedSize = txOutSetStats.nSerializedSize;
+    stats.nTotalAmount = txOutSetStats.nTotalAmount;
+    txOutSetStats.muhash.Finalize(stats.hashMuHash.begin());
+    return true;
+}
+
+void CCoinsViewDB::RebuildNullifierFilter() {
+    // Writes are not concurrent with this, so the filter in use stays a
+    // superset of the database while the new one is filled
+    std::vector<uint256> vNullifiers;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_NULLIFIER;
+    for (pcursor->Seek(ssKeySet.str()); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        uint256 nf;
+        ssKey >> chType;
+        if (chType != DB_NULLIFIER)
+            break;
+        ssKey >> nf;
+        vNullifiers.push_back(nf);
+    }
+
+    CBlockedBloomFilter filter(std::max(2 * vNullifiers.size(), NULLIFIER_FILTER_MIN_ELEMENTS));
+    for (const uint256& nf : vNullifiers)
+        filter.insert(nf);
+    LogPrint("coindb", "Nullifier filter of %u nullifiers, %u bytes\n", vNullifiers.size(), filter.DynamicMemoryUsage());
+
+    LOCK(cs_nullifierFilter);
+    std::swap(nullifierFilter, filter);
+    nNullifierFilterStale = 0;
+}
+
+bool CCoinsViewDB::UpdateNullifierFilter(const CNullifiersMap &mapNullifiers) {
+    LOCK(cs_nullifierFilter);
+    for (CNullifiersMap::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); it++) {
+        if (!(it->second.flags & CNullifiersCacheEntry::DIRTY))
+            continue;
+        if (it->second.entered)
+            nullifierFilter.insert(it->first);
+        else
+            nNullifierFilterStale++;
+    }
+    return nullifierFilter.size() + nNullifierFilterStale > nullifierFilter.capacity();
+}
+
+size_t CCoinsViewDB::BackendMemoryUsage() const {
+    size_t nUsage = 0;
+    {
+        LOCK(cs_nullifierFilter);
+        nUsage += nullifierFilter.DynamicMemoryUsage();
+    }
+    LOCK(cs_anchorTrees);
+    nUsage += memusage::DynamicUsage(lruAnchorTrees) + memusage::DynamicUsage(mapAnchorTrees);
+    for (auto it = mapAnchorTrees.begin(); it != mapAnchorTrees.end(); it++)
+        nUsage += memusage::DynamicUsage(it->second.first.tree);
+    return nUsage;
+}
+
+
+bool CCoinsViewDB::GetCachedAnchorTree(const uint256 &rt, CAnchorTreeData &data) const {
+    LOCK(cs_anchorTrees);
+    auto it = mapAnchorTrees.find(rt);
+    if (it == mapAnchorTrees.end())
+        return false;
+    lruAnchorTrees.splice(lruAnchorTrees.begin(), lruAnchorTrees, it->second.second);
+    data = it->second.first;
+    return true;
+}
+
+void CCoinsViewDB::CacheAnchorTree(const uint256 &rt, const CAnchorTreeData &data) const {
+    LOCK(cs_anchorTrees);
+    auto it = mapAnchorTrees.find(rt);
+    if (it != mapAnchorTrees.end()) {
+        lruAnchorTrees.splice(lruAnchorTrees.begin(), lruAnchorTrees, it->second.second);
+        it->second.first = data;
+        return;
+    }
+    lruAnchorTrees.push_front(rt);
+    mapAnchorTrees.insert(std::make_pair(rt, std::make_pair(data, lruAnchorTrees.begin())));
+    if (mapAnchorTrees.size() > ANCHOR_TREE_CACHE_SIZE) {
+        mapAnchorTrees.erase(lruAnchorTrees.back());
+        lruAnchorTrees.pop_back();
+    }
+}
+
+template <typename Reader>
+bool CCoinsViewDB::ReadAnchorTree(const Reader &reader, const uint256 &rt, CAnchorTreeData &data) const {
     if (rt == ZCIncrementalMerkleTree::empty_root()) {
-        ZCIncrementalMerkleTree new_tree;
-        tree = new_tree;
+        data.tree = SerializeAnchorTree(ZCIncrementalMerkleTree());
+        data.nChain = 0;
         return true;
     }
 
-    bool read = db.Read(make_pair(DB_ANCHOR, rt), tree);
+    // The record of the anchor itself is always read, it tells whether the
+    // anchor exists; the trees of its parents may come from the cache
+    CAnchorDelta delta;
+    if (reader.Read(make_pair(DB_ANCHOR_DELTA, rt), delta)) {
+        data.tree = delta.prefix;
+        data.nChain = delta.nChain;
+        if (!delta.parent.IsNull()) {
+            CAnchorTreeData parent;
+            if (!GetCachedAnchorTree(delta.parent, parent) && !ReadAnchorTree(reader, delta.parent, parent))
+                return error("%s: parent %s of anchor %s not found", __func__, delta.parent.ToString(), rt.ToString());
+            if (delta.nSuffix > parent.tree.size())
+                return error("%s: anchor %s does not fit its parent", __func__, rt.ToString());
+            data.tree.insert(data.tree.end(), parent.tree.end() - delta.nSuffix, parent.tree.end());
+        }
+    } else {
+        // Whole trees, as written before anchors were stored as deltas
+        ZCIncrementalMerkleTree tree;
+        if (!reader.Read(make_pair(DB_ANCHOR, rt), tree))
+            return false;
+        data.tree = SerializeAnchorTree(tree);
+        data.nChain = 0;
+    }
+    CacheAnchorTree(rt, data);
+    return true;
+}
+
+bool CCoinsViewDB::GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const {
+    CAnchorTreeData data;
+    if (!ReadAnchorTree(db, rt, data))
+        return false;
+    CDataStream ss(data.tree, SER_DISK, CLIENT_VERSION);
+    ss >> tree;
+    return true;
+}
+
+void CCoinsViewDB::BatchWriteAnchors(CLevelDBBatch &batch, const CAnchorsMap &mapAnchors) const {
+    // Trees written by this batch, the parents of the next ones
+    std::map<uint256, CAnchorTreeData> mapWritten;
+    for (CAnchorsMap::const_iterator it = mapAnchors.begin(); it != mapAnchors.end(); it++) {
+        if (!(it->second.flags & CAnchorsCacheEntry::DIRTY))
+            continue;
+        if (!it->second.entered) {
+            batch.Erase(make_pair(DB_ANCHOR, it->first));
+            batch.Erase(make_pair(DB_ANCHOR_DELTA, it->first));
+            continue;
+        }
 
-    return read;
+        // Write the ancestors of this batch first, from the oldest
+        std::vector<CAnchorsMap::const_iterator> vPending;
+        for (CAnchorsMap::const_iterator cur = it; cur != mapAnchors.end(); cur = mapAnchors.find(cur->second.parent)) {
+            if (!(cur->second.flags & CAnchorsCacheEntry::DIRTY) || !cur->second.entered || mapWritten.count(cur->first))
+                break;
+            vPending.push_back(cur);
+        }
+        for (auto pending = vPending.rbegin(); pending != vPending.rend(); pending++) {
+            const uint256 &rt = (*pending)->first;
+            const uint256 &parent = (*pending)->second.parent;
+            CAnchorTreeData data;
+            data.tree = SerializeAnchorTree((*pending)->second.tree);
+
+            // The parent must be on disk, or written by this batch
+            CAnchorTreeData parentData;
+            bool fParent = false;
+            if (!parent.IsNull() && parent != ZCIncrementalMerkleTree::empty_root()) {
+                auto written = mapWritten.find(parent);
+                CAnchorsMap::const_iterator inBatch = mapAnchors.find(parent);
+                if (written != mapWritten.end()) {
+                    parentData = written->second;
+                    fParent = true;
+                } else if (inBatch == mapAnchors.end() || !(inBatch->second.flags & CAnchorsCacheEntry::DIRTY)) {
+                    fParent = ReadAnchorTree(db, parent, parentData);
+                }
+            }
+
+            CAnchorDelta delta;
+            delta.prefix = data.tree;
+            size_t nSuffix = 0;
+            if (fParent && parentData.nChain < ANCHOR_DELTA_MAX_CHAIN) {
+                while (nSuffix < data.tree.size() && nSuffix < parentData.tree.size() &&
+                       data.tree[data.tree.size() - 1 - nSuffix] == parentData.tree[parentData.tree.size() - 1 - nSuffix])
+                    nSuffix++;
+            }
+            if (nSuffix > 0) {
+                delta.parent = parent;
+                delta.nChain = data.nChain = parentData.nChain + 1;
+                delta.nSuffix = nSuffix;
+                delta.prefix.resize(data.tree.size() - nSuffix);
+            }
+            // Replaces the whole tree a previous version may have written
+            batch.Erase(make_pair(DB_ANCHOR, rt));
+            batch.Write(make_pair(DB_ANCHOR_DELTA, rt), delta);
+            CacheAnchorTree(rt, data);
+            mapWritten[rt] = data;
+        }
+    }
 }
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf) const {
+    {
+        LOCK(cs_nullifierFilter);
+        if (!nullifierFilter.contains(nf))
+            return false;
+    }
     bool spent = false;
     bool read = db.Read(make_pair(DB_NULLIFIER, nf), spent);
 
@@ -93,11 +637,61 @@ bool CCoinsViewDB::GetNullifier(const uint256 &nf) const {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    CCoinsHeader header;
+    if (!db.Read(make_pair(DB_COINS_HEADER, txid), header))
+        return false;
+    InitCoinsFromHeader(header, coins);
+
+    // A few outputs are cheaper to look up one by one than to seek a cursor to
+    size_t nUnspent = std::count(header.vUnspent.begin(), header.vUnspent.end(), true);
+    if (nUnspent <= COINS_MAX_POINT_READS) {
+        for (unsigned int i = 0; i < header.vUnspent.size(); i++) {
+            if (!header.vUnspent[i])
+                continue;
+            if (!db.Read(make_pair(DB_COINS_OUTPUT, CCoinsOutputKey(txid, i)), REF(CTxOutCompressor(coins.vout[i]))))
+                return error("%s: missing output %s:%u", __func__, txid.ToString(), i);
+        }
+        return true;
+    }
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewLookupIterator());
+    SeekCoinsOutput(pcursor.get(), txid, 0);
+    uint64_t nSize = 0;
+    try {
+        return ReadCoinsOutputs(pcursor.get(), txid, header, coins, nSize);
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    return db.Exists(make_pair(DB_COINS_HEADER, txid));
+}
+
+void CCoinsViewDB::BatchWriteCoinsEntry(CLevelDBBatch &batch, const uint256 &txid, const CCoinsCacheEntry &entry, CTxOutSetStatsUpdater *pstats) const {
+    // A fresh entry has no records yet, otherwise only the outputs that
+    // changed since its header was written are
+    CCoinsHeader onDisk;
+    bool fOnDisk = false;
+    if (!(entry.flags & CCoinsCacheEntry::FRESH))
+        fOnDisk = db.Read(make_pair(DB_COINS_HEADER, txid), onDisk);
+    BatchWriteCoins(batch, txid, entry.coins, onDisk);
+    if (!pstats || !pstats->fStats)
+        return;
+
+    // The outputs spent since are only in their records, which are about to
+    // be erased
+    for (unsigned int i = 0; i < onDisk.vUnspent.size(); i++) {
+        if (!onDisk.IsUnspent(i) || (i < entry.coins.vout.size() && !entry.coins.vout[i].IsNull()))
+            continue;
+        CTxOut out;
+        if (!db.Read(make_pair(DB_COINS_OUTPUT, CCoinsOutputKey(txid, i)), REF(CTxOutCompressor(out)))) {
+            LogPrintf("%s: cannot read output %s:%u, the UTXO set statistics are no longer kept\n", __func__, txid.ToString(), i);
+            pstats->fStats = false;
+            return;
+        }
+        pstats->RemoveOutput(txid, i, onDisk, out);
+    }
+    UpdateTxOutSetStats(*pstats, txid, entry.coins, onDisk, fOnDisk);
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -114,17 +708,32 @@ uint256 CCoinsViewDB::GetBestAnchor() const {
     return hashBestAnchor;
 }
 
+uint256 CCoinsViewDB::GetBestBlock(const CLevelDBSnapshot &snapshot) const {
+    uint256 hashBestChain;
+    if (!snapshot.Read(DB_BEST_BLOCK, hashBestChain))
+        return uint256();
+    return hashBestChain;
+}
+
+uint256 CCoinsViewDB::GetBestAnchor(const CLevelDBSnapshot &snapshot) const {
+    uint256 hashBestAnchor;
+    if (!snapshot.Read(DB_BEST_ANCHOR, hashBestAnchor))
+        return ZCIncrementalMerkleTree::empty_root();
+    return hashBestAnchor;
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               const uint256 &hashBlock,
                               const uint256 &hashAnchor,
                               CAnchorsMap &mapAnchors,
                               CNullifiersMap &mapNullifiers) {
     CLevelDBBatch batch;
+    CTxOutSetStatsUpdater stats = GetTxOutSetStatsUpdater();
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            BatchWriteCoinsEntry(batch, it->first, it->second, &stats);
             changed++;
         }
         count++;
@@ -132,15 +741,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
         mapCoins.erase(itOld);
     }
 
-    for (CAnchorsMap::iterator it = mapAnchors.begin(); it != mapAnchors.end();) {
-        if (it->second.flags & CAnchorsCacheEntry::DIRTY) {
-            BatchWriteAnchor(batch, it->first, it->second.tree, it->second.entered);
-            // TODO: changed++?
-        }
-        CAnchorsMap::iterator itOld = it++;
-        mapAnchors.erase(itOld);
-    }
+    BatchWriteAnchors(batch, mapAnchors);
+    mapAnchors.clear();
 
+    bool fRebuildFilter = UpdateNullifierFilter(mapNullifiers);
     for (CNullifiersMap::iterator it = mapNullifiers.begin(); it != mapNullifiers.end();) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             BatchWriteNullifier(batch, it->first, it->second.entered);
@@ -154,12 +758,236 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
         BatchWriteHashBestChain(batch, hashBlock);
     if (!hashAnchor.IsNull())
         BatchWriteHashBestAnchor(batch, hashAnchor);
+    stats.Finish();
+    BatchWriteTxOutSetStatsRecord(batch, stats);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    if (!db.WriteBatch(batch))
+        return false;
+    SetTxOutSetStats(stats.stats, stats.fStats, hashBlock);
+    if (fRebuildFilter)
+        RebuildNullifierFilter();
+    return true;
+}
+
+bool CCoinsViewDB::WriteEntries(const CCoinsMap &mapCoins,
+                                const uint256 &hashBlock,
+                                const uint256 &hashAnchor,
+                                const CAnchorsMap &mapAnchors,
+                                const CNullifiersMap &mapNullifiers) {
+    CLevelDBBatch batch;
+    CTxOutSetStatsUpdater stats = GetTxOutSetStatsUpdater();
+    size_t changed = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            BatchWriteCoinsEntry(batch, it->first, it->second, &stats);
+            changed++;
+        }
+    }
+
+    BatchWriteAnchors(batch, mapAnchors);
+
+    bool fRebuildFilter = UpdateNullifierFilter(mapNullifiers);
+    for (CNullifiersMap::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); it++) {
+        if (it->second.flags & CNullifiersCacheEntry::DIRTY)
+            BatchWriteNullifier(batch, it->first, it->second.entered);
+    }
+
+    if (!hashBlock.IsNull())
+        BatchWriteHashBestChain(batch, hashBlock);
+    if (!hashAnchor.IsNull())
+        BatchWriteHashBestAnchor(batch, hashAnchor);
+    stats.Finish();
+    BatchWriteTxOutSetStatsRecord(batch, stats);
+
+    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)mapCoins.size());
+    if (!db.WriteBatch(batch))
+        return false;
+    SetTxOutSetStats(stats.stats, stats.fStats, hashBlock);
+    if (fRebuildFilter)
+        RebuildNullifierFilter();
+    return true;
+}
+
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB *dbIn) :
+    CCoinsViewBacked(dbIn), db(dbIn), fPending(false), fWriteFailed(false), fStop(false)
+{
+    writerThread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "coinsflush",
+                                             boost::function<void()>(boost::bind(&CCoinsViewBackgroundFlush::ThreadWriter, this))));
+}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fStop = true;
+    }
+    condPending.notify_all();
+    writerThread.join();
+}
+
+void CCoinsViewBackgroundFlush::ThreadWriter()
+{
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fPending && !fStop)
+                condPending.wait(lock);
+            // A pending snapshot is always written, also when stopping
+            if (!fPending)
+                return;
+        }
+
+        // The snapshot is not modified until fPending is reset, so it can be
+        // written without holding the lock while readers keep using it.
+        int64_t nStart = GetTimeMicros();
+        bool fOk;
+        try {
+            fOk = db->WriteEntries(snapshotCoins, snapshotBlock, snapshotAnchor, snapshotAnchors, snapshotNullifiers);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+            fOk = false;
+        }
+        LogPrint("coindb", "Background flush of %u coins took %.2fms\n", snapshotCoins.size(), (GetTimeMicros() - nStart) * 0.001);
+
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (!fOk) {
+                LogPrintf("Error: failed to write to coin database in the background\n");
+                fWriteFailed = true;
+            }
+            snapshotCoins.clear();
+            snapshotAnchors.clear();
+            snapshotNullifiers.clear();
+            snapshotBlock.SetNull();
+            snapshotAnchor.SetNull();
+            fPending = false;
+        }
+        condPending.notify_all();
+    }
+}
+
+bool CCoinsViewBackgroundFlush::GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const {
+    if (rt != ZCIncrementalMerkleTree::empty_root()) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CAnchorsMap::const_iterator it = snapshotAnchors.find(rt);
+        if (it != snapshotAnchors.end()) {
+            if (!it->second.entered)
+                return false;
+            tree = it->second.tree;
+            return true;
+        }
+    }
+    return base->GetAnchorAt(rt, tree);
+}
+
+bool CCoinsViewBackgroundFlush::GetNullifier(const uint256 &nf) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CNullifiersMap::const_iterator it = snapshotNullifiers.find(nf);
+        if (it != snapshotNullifiers.end())
+            return it->second.entered;
+    }
+    return base->GetNullifier(nf);
+}
+
+bool CCoinsViewBackgroundFlush::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = snapshotCoins.find(txid);
+        if (it != snapshotCoins.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = snapshotCoins.find(txid);
+        if (it != snapshotCoins.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!snapshotBlock.IsNull())
+            return snapshotBlock;
+    }
+    return base->GetBestBlock();
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestAnchor() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!snapshotAnchor.IsNull())
+            return snapshotAnchor;
+    }
+    return base->GetBestAnchor();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins,
+                                           const uint256 &hashBlock,
+                                           const uint256 &hashAnchor,
+                                           CAnchorsMap &mapAnchors,
+                                           CNullifiersMap &mapNullifiers) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fPending)
+        condPending.wait(lock);
+    if (fWriteFailed)
+        return false;
+
+    // The snapshot maps are empty here; the caller clears what it gets back.
+    snapshotCoins.swap(mapCoins);
+    snapshotAnchors.swap(mapAnchors);
+    snapshotNullifiers.swap(mapNullifiers);
+    snapshotBlock = hashBlock;
+    snapshotAnchor = hashAnchor;
+    fPending = true;
+    condPending.notify_all();
+    return true;
+}
+
+bool CCoinsViewBackgroundFlush::GetStats(CCoinsStats &stats) const {
+    // Statistics are computed from the database, so wait for it to be complete
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fPending)
+            condPending.wait(lock);
+    }
+    return base->GetStats(stats);
+}
+
+size_t CCoinsViewBackgroundFlush::BackendMemoryUsage() const {
+    size_t nUsage = 0;
+    {
+        // The snapshot is only read while it is written, so it can be walked here too
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending) {
+            nUsage += memusage::DynamicUsage(snapshotCoins) + memusage::DynamicUsage(snapshotAnchors) +
+                      memusage::DynamicUsage(snapshotNullifiers);
+            for (CCoinsMap::const_iterator it = snapshotCoins.begin(); it != snapshotCoins.end(); it++)
+                nUsage += it->second.coins.DynamicMemoryUsage();
+            for (CAnchorsMap::const_iterator it = snapshotAnchors.begin(); it != snapshotAnchors.end(); it++)
+                nUsage += it->second.tree.DynamicMemoryUsage();
+        }
+    }
+    return nUsage + base->BackendMemoryUsage();
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+bool CCoinsViewBackgroundFlush::Sync() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fPending)
+        condPending.wait(lock);
+    return !fWriteFailed;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, GetDBTuning(false)) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -193,59 +1021,350 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+/** Add a coin database entry to the hash_serialized of gettxoutsetinfo. */
+static void HashCoins(CHashWriter &ss, const uint256 &txhash, const CCoins &coins)
+{
+    ss << txhash;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            ss << VARINT(i+1);
+            ss << out;
+        }
+    }
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    CLevelDBSnapshot snapshot(db);
+    return GetStats(snapshot, stats);
+}
+
+/**
+ * Call f on the coins of every transaction of a snapshot, in txid order, with
+ * the size of their records. The headers and outputs of the transactions are
+ * both in txid order, so one cursor walks each.
+ */
+template <typename Func>
+bool static ForEachCoins(const CLevelDBSnapshot &snapshot, Func f) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(snapshot.NewIterator());
+    boost::scoped_ptr<leveldb::Iterator> pcursorOutputs(snapshot.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_COINS_HEADER;
+    pcursor->Seek(ssKeySet.str());
+    CDataStream ssOutputsSet(SER_DISK, CLIENT_VERSION);
+    ssOutputsSet << DB_COINS_OUTPUT;
+    pcursorOutputs->Seek(ssOutputsSet.str());
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != DB_COINS_HEADER)
+                break;
+            uint256 txhash;
+            ssKey >> txhash;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoinsHeader header;
+            ssValue >> header;
+            CCoins coins;
+            InitCoinsFromHeader(header, coins);
+            uint64_t nSize = slValue.size();
+            if (!ReadCoinsOutputs(pcursorOutputs.get(), txhash, header, coins, nSize))
+                return false;
+            f(txhash, coins, nSize);
+        }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+//! Most elements of the UTXO set MuHash queued while reading all the records
+static const size_t TXOUTSET_SCAN_MUHASH_QUEUE = 1 << 16;
+
+/**
+ * Compute the statistics of all the records of a snapshot, both the hash of
+ * their serialization and the running statistics kept as they are written.
+ */
+bool static ScanTxOutSetStats(const CLevelDBSnapshot &snapshot, CHashWriter &ss, CTxOutSetStatsUpdater &stats) {
+    bool fRead = ForEachCoins(snapshot, [&](const uint256 &txhash, const CCoins &coins, uint64_t nSize) {
+        HashCoins(ss, txhash, coins);
+        CCoinsHeader header(coins);
+        stats.AddHeader(header);
+        for (unsigned int i=0; i<coins.vout.size(); i++) {
+            if (!coins.vout[i].IsNull())
+                stats.AddOutput(txhash, i, header, coins.vout[i]);
+        }
+        if (stats.GetQueued() >= TXOUTSET_SCAN_MUHASH_QUEUE)
+            stats.Finish();
+    });
+    stats.Finish();
+    return fRead;
+}
 
+bool CCoinsViewDB::GetStats(const CLevelDBSnapshot &snapshot, CCoinsStats &stats) const {
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
+    // The best block of the snapshot is the one its records were flushed at
+    stats.hashBlock = GetBestBlock(snapshot);
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    CTxOutSetStatsUpdater scanned(CTxOutSetStats(), true);
+    if (!ScanTxOutSetStats(snapshot, ss, scanned))
+        return false;
+    {
+        // Unknown while a snapshot of the UTXO set is being loaded
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        if (mi != mapBlockIndex.end())
+            stats.nHeight = mi->second->nHeight;
+    }
+    stats.hashSerialized = ss.GetHash();
+    stats.nTransactions = scanned.stats.nTransactions;
+    stats.nTransactionOutputs = scanned.stats.nTransactionOutputs;
+    stats.nSerializedSize = scanned.stats.nSerializedSize;
+    stats.nTotalAmount = scanned.stats.nTotalAmount;
+    scanned.stats.muhash.Finalize(stats.hashMuHash.begin());
+    return true;
+}
+
+bool CCoinsViewDB::InitTxOutSetStats() {
+    {
+        LOCK(cs_txOutSetStats);
+        if (fTxOutSetStats)
+            return true;
+    }
+
+    uiInterface.InitMessage(_("Computing the UTXO set statistics..."));
+    LogPrintf("Computing the UTXO set statistics of the coin database...\n");
+    CLevelDBSnapshot snapshot(db);
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    CTxOutSetStatsUpdater stats(CTxOutSetStats(), true);
+    if (!ScanTxOutSetStats(snapshot, ss, stats))
+        return false;
+    CLevelDBBatch batch;
+    BatchWriteTxOutSetStatsRecord(batch, stats);
+    if (!db.WriteBatch(batch, true))
+        return false;
+    SetTxOutSetStats(stats.stats, true, GetBestBlock(snapshot));
+    LogPrintf("Computed the UTXO set statistics: %u transactions, %u outputs\n", stats.stats.nTransactions, stats.stats.nTransactionOutputs);
+    return true;
+}
+
+bool CCoinsViewDB::DumpSnapshot(const CLevelDBSnapshot &snapshot, CAutoFile &file, CTxOutSetSnapshotHeader &header) const {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(snapshot.NewIterator());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << header.hashBlock;
+    CHashWriter ssShielded(SER_GETHASH, PROTOCOL_VERSION);
+    ssShielded << header.hashAnchor;
+    header.nTransactions = header.nAnchors = header.nNullifiers = 0;
+
+    // Anchors come first, as whole trees in the order of their roots,
+    // however they are stored
+    std::set<uint256> setAnchors;
+    for (char chAnchorType : {DB_ANCHOR, DB_ANCHOR_DELTA}) {
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << chAnchorType;
+        for (pcursor->Seek(ssKeySet.str()); pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 root;
+            ssKey >> chType;
+            if (chType != chAnchorType)
+                break;
+            ssKey >> root;
+            setAnchors.insert(root);
+        }
+    }
+    for (const uint256& root : setAnchors) {
+        CAnchorTreeData data;
+        if (!ReadAnchorTree(snapshot, root, data))
+            return error("%s: cannot read anchor %s", __func__, root.ToString());
+        ZCIncrementalMerkleTree tree;
+        CDataStream ssTree(data.tree, SER_DISK, CLIENT_VERSION);
+        ssTree >> tree;
+        ssShielded << DB_ANCHOR << root << tree;
+        file << DB_ANCHOR << root << tree;
+        header.nAnchors++;
+    }
+
+    // Then the coins, a record per transaction whichever way they are stored
+    bool fRead = ForEachCoins(snapshot, [&](const uint256 &txhash, const CCoins &coins, uint64_t nSize) {
+        HashCoins(ss, txhash, coins);
+        file << DB_COINS << txhash << coins;
+        header.nTransactions++;
+    });
+    if (!fRead)
+        return false;
+
+    CDataStream ssNullifierSet(SER_DISK, CLIENT_VERSION);
+    ssNullifierSet << DB_NULLIFIER;
+    for (pcursor->Seek(ssNullifierSet.str()); pcursor->Valid(); pcursor->Next()) {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == DB_COINS) {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
+            if (chType != DB_NULLIFIER)
+                break;
+            uint256 nf;
+            ssKey >> nf;
+            ssShielded << chType << nf;
+            file << chType << nf;
+            header.nNullifiers++;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    file << '\0';
+    header.hashSerialized = ss.GetHash();
+    header.hashShielded = ssShielded.GetHash();
+    return true;
+}
+
+bool CCoinsViewDB::ReadSnapshot(CAutoFile &file, const CTxOutSetSnapshotHeader &header, bool fWrite, CTxOutSetSnapshotHeader &result) {
+    // Keep the batches small enough to not need much memory
+    static const size_t RECORDS_PER_BATCH = 10000;
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << header.hashBlock;
+    CHashWriter ssShielded(SER_GETHASH, PROTOCOL_VERSION);
+    ssShielded << header.hashAnchor;
+    result.nTransactions = result.nAnchors = result.nNullifiers = 0;
+
+    CLevelDBBatch batch;
+    size_t nBatched = 0;
+    // The statistics are written with the best block, so they are not
+    // known until the last batch is
+    CTxOutSetStatsUpdater stats = GetTxOutSetStatsUpdater();
+    if (fWrite) {
+        batch.Erase(DB_TXOUTSET_STATS);
+        SetTxOutSetStats(stats.stats, false, uint256());
+    }
+    try {
+        while (true) {
+            boost::this_thread::interruption_point();
+            char chType;
+            file >> chType;
+            if (chType == '\0') {
+                break;
+            } else if (chType == DB_COINS) {
                 uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+                CCoins coins;
+                file >> txhash >> coins;
+                HashCoins(ss, txhash, coins);
+                if (fWrite) {
+                    BatchWriteCoins(batch, txhash, coins, CCoinsHeader());
+                    if (stats.fStats)
+                        UpdateTxOutSetStats(stats, txhash, coins, CCoinsHeader(), false);
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                result.nTransactions++;
+            } else if (chType == DB_ANCHOR) {
+                uint256 root;
+                ZCIncrementalMerkleTree tree;
+                file >> root >> tree;
+                ssShielded << chType << root << tree;
+                if (fWrite)
+                    BatchWriteAnchor(batch, root, tree, true);
+                result.nAnchors++;
+            } else if (chType == DB_NULLIFIER) {
+                uint256 nf;
+                file >> nf;
+                ssShielded << chType << nf;
+                if (fWrite) {
+                    BatchWriteNullifier(batch, nf, true);
+                    LOCK(cs_nullifierFilter);
+                    nullifierFilter.insert(nf);
+                }
+                result.nNullifiers++;
+            } else {
+                return error("%s: unknown record type %d", __func__, chType);
+            }
+            if (fWrite && ++nBatched == RECORDS_PER_BATCH) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch = CLevelDBBatch();
+                nBatched = 0;
+                stats.Finish();
             }
-            pcursor->Next();
-        } catch (const std::exception& e) {
-            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
         }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
     }
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+    result.hashSerialized = ss.GetHash();
+    result.hashShielded = ssShielded.GetHash();
+
+    if (fWrite) {
+        BatchWriteHashBestChain(batch, header.hashBlock);
+        BatchWriteHashBestAnchor(batch, header.hashAnchor);
+        stats.Finish();
+        BatchWriteTxOutSetStatsRecord(batch, stats);
+        if (!db.WriteBatch(batch, true))
+            return false;
+        SetTxOutSetStats(stats.stats, stats.fStats, header.hashBlock);
+        RebuildNullifierFilter();
     }
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    return true;
+}
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_COINS;
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid())
+        return true;
+
+    uiInterface.InitMessage(_("Upgrading the coin database..."));
+    LogPrintf("Upgrading the coin database to one record per unspent output...\n");
+    CLevelDBBatch batch;
+    size_t nBatched = 0;
+    uint64_t nConverted = 0;
+    try {
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != DB_COINS)
+                break;
+            uint256 txhash;
+            ssKey >> txhash;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+            // The records of a transaction and the removal of its old one
+            // are in the same batch, so an interrupted upgrade resumes
+            BatchWriteCoins(batch, txhash, coins, CCoinsHeader());
+            batch.Erase(make_pair(DB_COINS, txhash));
+            nConverted++;
+            if (++nBatched == COINS_UPGRADE_BATCH_SIZE) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch = CLevelDBBatch();
+                nBatched = 0;
+                if (nConverted % (COINS_UPGRADE_BATCH_SIZE * 100) == 0)
+                    LogPrintf("Upgrading the coin database: %u transactions converted\n", nConverted);
+            }
+        }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (!db.WriteBatch(batch, true))
+        return false;
+    LogPrintf("Upgraded the coin database: %u transactions converted\n", nConverted);
+    db.CompactFull();
     return true;
 }
 
@@ -261,6 +1380,34 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadBlockSolution(const uint256 &hash, std::vector<unsigned char> &solution) const {
+    {
+        LOCK(cs_solutions);
+        auto it = mapSolutions.find(hash);
+        if (it != mapSolutions.end()) {
+            lruSolutions.splice(lruSolutions.begin(), lruSolutions, it->second.second);
+            solution = it->second.first;
+            return true;
+        }
+    }
+
+    CDiskBlockIndex diskindex;
+    if (!Read(make_pair(DB_BLOCK_INDEX, hash), diskindex))
+        return false;
+    solution = diskindex.GetDiskSolution();
+
+    LOCK(cs_solutions);
+    if (mapSolutions.count(hash))
+        return true;
+    lruSolutions.push_front(hash);
+    mapSolutions.insert(std::make_pair(hash, std::make_pair(solution, lruSolutions.begin())));
+    if (mapSolutions.size() > BLOCK_SOLUTION_CACHE_SIZE) {
+        mapSolutions.erase(lruSolutions.back());
+        lruSolutions.pop_back();
+    }
+    return true;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
@@ -272,6 +1419,179 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+namespace {
+
+/**
+ * Key of a transaction in the -compacttxindex format: the first bytes of its
+ * txid, then the height of its block and its offset past the block header,
+ * as varints; the value is a placeholder. Transactions whose txids start
+ * alike get keys of their own, lookups tell them apart by reading them.
+ */
+struct CCompactTxIndexKey
+{
+    static const size_t PREFIX_SIZE = 8;
+
+    unsigned char prefix[PREFIX_SIZE];
+    int nHeight;
+    unsigned int nTxOffset;
+
+    CCompactTxIndexKey(const uint256& txid, int nHeightIn, unsigned int nTxOffsetIn) : nHeight(nHeightIn), nTxOffset(nTxOffsetIn)
+    {
+        memcpy(prefix, txid.begin(), PREFIX_SIZE);
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(FLATDATA(prefix));
+        READWRITE(VARINT(nHeight));
+        READWRITE(VARINT(nTxOffset));
+    }
+};
+
+}
+
+bool CBlockTreeDB::ReadCompactTxIndex(const uint256 &txid, std::vector<std::pair<int, unsigned int> > &vPos) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewLookupIterator());
+
+    // The smallest key of the txid prefix has height and offset 0
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_COMPACT_TXINDEX, CCompactTxIndexKey(txid, 0, 0));
+    pcursor->Seek(ssKeySet.str());
+
+    for (; pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CCompactTxIndexKey key(uint256(), 0, 0);
+            ssKey >> chType >> key;
+            if (chType != DB_COMPACT_TXINDEX || memcmp(key.prefix, txid.begin(), CCompactTxIndexKey::PREFIX_SIZE) != 0)
+                break;
+            vPos.push_back(std::make_pair(key.nHeight, key.nTxOffset));
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteCompactTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect, int nHeight) {
+    CLevelDBBatch batch;
+    for (const std::pair<uint256, CDiskTxPos>& item : vect)
+        batch.Write(make_pair(DB_COMPACT_TXINDEX, CCompactTxIndexKey(item.first, nHeight, item.second.nTxOffset)), '1');
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(uint8_t type, const uint160 &addressHash, int nStartHeight, int nEndHeight,
+                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    // The entries of an address are ordered by height, seek to the first one wanted
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_ADDRESSINDEX;
+    ser_writedata8(ssKeySet, type);
+    ssKeySet << addressHash;
+    ser_writedata32be(ssKeySet, std::max(nStartHeight, 0));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressIndexKey key;
+            ssKey >> chType >> key;
+            if (chType != DB_ADDRESSINDEX || key.type != type || key.hashBytes != addressHash)
+                break;
+            if (nEndHeight > 0 && key.blockHeight > nEndHeight)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nValue;
+            ssValue >> nValue;
+            addressIndex.push_back(std::make_pair(key, nValue));
+            pcursor->Next();
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect) {
+    CLevelDBBatch batch;
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadTimestampIndex(uint32_t nLow, uint32_t nHigh, std::vector<uint256> &hashes) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_TIMESTAMPINDEX, CTimestampIndexKey(nLow, uint256()));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CTimestampIndexKey key;
+            ssKey >> chType >> key;
+            if (chType != DB_TIMESTAMPINDEX || key.timestamp > nHigh)
+                break;
+            hashes.push_back(key.blockHash);
+            pcursor->Next();
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &key) {
+    return Write(make_pair(DB_TIMESTAMPINDEX, key), '1');
+}
+
+bool CBlockTreeDB::EraseTimestampIndex(const CTimestampIndexKey &key) {
+    return Erase(make_pair(DB_TIMESTAMPINDEX, key));
+}
+
+bool CBlockTreeDB::ReadBlockFilter(const uint256 &hash, CBlockFilter &filter) {
+    return Read(make_pair(DB_BLOCK_FILTER, hash), filter);
+}
+
+bool CBlockTreeDB::WriteBlockFilter(const CBlockFilter &filter) {
+    return Write(make_pair(DB_BLOCK_FILTER, filter.GetBlockHash()), filter);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -284,6 +1604,34 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+/** Hash the records of a batch and check their proof of work, spread over the cores */
+static void HashBlockIndexBatch(const std::vector<CDiskBlockIndex>& vDiskIndex, std::vector<uint256>& vHash, std::vector<char>& vValid)
+{
+    vHash.resize(vDiskIndex.size());
+    vValid.resize(vDiskIndex.size());
+    const Consensus::Params& consensus = Params().GetConsensus();
+    auto worker = [&](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            vHash[i] = vDiskIndex[i].GetBlockHash();
+            vValid[i] = CheckProofOfWork(vHash[i], vDiskIndex[i].nBits, consensus);
+        }
+    };
+
+    size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vDiskIndex.size() / BLOCK_INDEX_LOAD_MIN_PER_THREAD);
+    if (nThreads <= 1) {
+        worker(0, vDiskIndex.size());
+        return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    const size_t nChunk = (vDiskIndex.size() + nThreads - 1) / nThreads;
+    for (size_t nBegin = nChunk; nBegin < vDiskIndex.size(); nBegin += nChunk)
+        threads.emplace_back(worker, nBegin, std::min(nBegin + nChunk, vDiskIndex.size()));
+    worker(0, std::min(nChunk, vDiskIndex.size()));
+    for (std::thread& t : threads)
+        t.join();
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -292,48 +1640,64 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     ssKeySet << make_pair(DB_BLOCK_INDEX, uint256());
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == DB_BLOCK_INDEX) {
+    // Load mapBlockIndex. Hashing the headers, solutions included, is most of
+    // the work, so the records are read in batches that are hashed in parallel.
+    // The solutions are not kept, see CBlockIndex::GetSolution.
+    std::vector<CDiskBlockIndex> vDiskIndex;
+    std::vector<uint256> vHash;
+    std::vector<char> vValid;
+    bool fDone = false;
+    while (!fDone) {
+        vDiskIndex.clear();
+        while (vDiskIndex.size() < BLOCK_INDEX_LOAD_BATCH_SIZE) {
+            boost::this_thread::interruption_point();
+            if (!pcursor->Valid()) {
+                fDone = true;
+                break;
+            }
+            try {
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                ssKey >> chType;
+                if (chType != DB_BLOCK_INDEX) {
+                    fDone = true; // if shutdown requested or finished loading block index
+                    break;
+                }
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashAnchor     = diskindex.hashAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->hashReserved   = diskindex.hashReserved;
-
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
+                vDiskIndex.push_back(CDiskBlockIndex());
+                ssValue >> vDiskIndex.back();
                 pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
+            } catch (const std::exception& e) {
+                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
             }
-        } catch (const std::exception& e) {
-            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+
+        HashBlockIndexBatch(vDiskIndex, vHash, vValid);
+        for (size_t i = 0; i < vDiskIndex.size(); i++) {
+            CDiskBlockIndex& diskindex = vDiskIndex[i];
+
+            // Construct block index object
+            CBlockIndex* pindexNew = InsertBlockIndex(vHash[i]);
+            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->hashAnchor     = diskindex.hashAnchor;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+            pindexNew->nSproutValue   = diskindex.nSproutValue;
+            pindexNew->hashReserved   = diskindex.hashReserved;
+
+            if (!vValid[i])
+                return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
         }
     }
 
@@ -6,16 +6,28 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
+#include "blockfilter.h"
+#include "bloom.h"
 #include "coins.h"
+#include "crypto/muhash.h"
 #include "leveldbwrapper.h"
+#include "streams.h"
+#include "sync.h"
 
+#include <list>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CBlockFileInfo;
 class CBlockIndex;
+class CTxOutSetStatsUpdater;
 struct CDiskTxPos;
 class uint256;
 
@@ -25,6 +37,112 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -asyncflush default
+static const bool DEFAULT_ASYNC_FLUSH = false;
+//! -dbcompression default, Snappy compression of the block index database
+static const bool DEFAULT_DB_COMPRESSION = false;
+
+/**
+ * Header of a UTXO set snapshot file (see dumptxoutset).
+ *
+ * The header is followed by the records of the coin database in key order,
+ * each starting with its database key prefix: DB_ANCHOR followed by the root
+ * and the tree, DB_COINS followed by the txid and the CCoins, DB_NULLIFIER
+ * followed by the nullifier. A zero byte ends the records.
+ */
+struct CTxOutSetSnapshotHeader
+{
+    static const uint32_t CURRENT_VERSION = 1;
+
+    uint32_t nVersion;
+    unsigned char pchMessageStart[4];
+    uint256 hashBlock;
+    int nHeight;
+    uint256 hashAnchor;
+    uint64_t nTransactions;
+    uint64_t nAnchors;
+    uint64_t nNullifiers;
+    //! Same as hash_serialized of gettxoutsetinfo
+    uint256 hashSerialized;
+    //! Hash of the best anchor followed by all the anchor and nullifier records
+    uint256 hashShielded;
+    //! Number of transactions of each block of the chain up to nHeight
+    std::vector<uint32_t> vTxCount;
+
+    CTxOutSetSnapshotHeader() : nVersion(CURRENT_VERSION), nHeight(0), nTransactions(0), nAnchors(0), nNullifiers(0)
+    {
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(nVersion);
+        if (nVersion != CURRENT_VERSION)
+            throw std::ios_base::failure("Unsupported snapshot version");
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(hashAnchor);
+        READWRITE(nTransactions);
+        READWRITE(nAnchors);
+        READWRITE(nNullifiers);
+        READWRITE(hashSerialized);
+        READWRITE(hashShielded);
+        READWRITE(vTxCount);
+    }
+};
+
+/**
+ * Statistics of the unspent outputs of the coin database, kept up to date as
+ * its records are written and in the same batches, so that they need not be
+ * computed by reading the whole set. The MuHash of the outputs does not
+ * depend on their order, so outputs are added to and removed from it one at a
+ * time; see TxOutSetElement for what is hashed of each.
+ */
+struct CTxOutSetStats
+{
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CTxOutSetStats() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+//! Fewest outputs a thread adds to or removes from the MuHash of the unspent outputs
+static const size_t MIN_MUHASH_ELEMENTS_PER_THREAD = 256;
+
+//! Most deltas between an anchor record and a record holding its whole tree
+static const uint32_t ANCHOR_DELTA_MAX_CHAIN = 16;
+//! Trees of anchors the coin database keeps materialized to apply deltas to
+static const size_t ANCHOR_TREE_CACHE_SIZE = 128;
+//! Solutions of trimmed block index entries the block tree database keeps after reading them
+static const size_t BLOCK_SOLUTION_CACHE_SIZE = 512;
+//! Nullifiers the nullifier filter of the coin database is sized for at least, 128KiB
+static const size_t NULLIFIER_FILTER_MIN_ELEMENTS = 1 << 16;
+
+/** The serialized commitment tree of an anchor, and the deltas it is stored as on disk */
+struct CAnchorTreeData
+{
+    std::vector<unsigned char> tree;
+    uint32_t nChain;
+
+    CAnchorTreeData() : nChain(0) {}
+};
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -32,6 +150,67 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CLevelDBWrapper db;
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /**
+     * Anchors are stored as deltas from the tree of their parent anchor, see
+     * BatchWriteAnchors; the trees last read or written are kept in a small
+     * LRU cache so that following a delta seldom reads more than one record.
+     */
+    mutable CCriticalSection cs_anchorTrees;
+    mutable std::list<uint256> lruAnchorTrees;
+    mutable std::map<uint256, std::pair<CAnchorTreeData, std::list<uint256>::iterator> > mapAnchorTrees;
+
+    bool GetCachedAnchorTree(const uint256 &rt, CAnchorTreeData &data) const;
+    void CacheAnchorTree(const uint256 &rt, const CAnchorTreeData &data) const;
+    //! Rebuild the tree of an anchor from its record and those of its parents
+    template <typename Reader>
+    bool ReadAnchorTree(const Reader &reader, const uint256 &rt, CAnchorTreeData &data) const;
+    //! Add the dirty anchors of a map to a batch, as deltas where the parent tree is known
+    void BatchWriteAnchors(CLevelDBBatch &batch, const CAnchorsMap &mapAnchors) const;
+
+    /**
+     * Bloom filter over the spent nullifiers of the database, so that looking
+     * up one that is not spent, as every new joinsplit does, seldom reads the
+     * database. Filled from the database at construction and as nullifiers are
+     * written; erased ones stay in it until it outgrows its capacity and is
+     * rebuilt.
+     */
+    mutable CCriticalSection cs_nullifierFilter;
+    CBlockedBloomFilter nullifierFilter;
+    size_t nNullifierFilterStale;
+
+    //! Size the filter for twice the nullifiers of the database and fill it from them
+    void RebuildNullifierFilter();
+    /**
+     * Account for the dirty nullifiers of a map about to be written, adding
+     * the spent ones to the filter. Returns whether the filter is full and
+     * should be rebuilt once they are written.
+     */
+    bool UpdateNullifierFilter(const CNullifiersMap &mapNullifiers);
+
+    /**
+     * Add the changes of a dirty entry of the coins cache to a batch. The
+     * coins of a transaction are stored as a header record, with its metadata
+     * and which of its outputs are unspent, and a record per unspent output,
+     * so only the outputs spent or added since the header was written are.
+     */
+    void BatchWriteCoinsEntry(CLevelDBBatch &batch, const uint256 &txid, const CCoinsCacheEntry &entry, CTxOutSetStatsUpdater *pstats) const;
+
+    /**
+     * Running statistics of the records, as of the last write and its best
+     * block; unknown (fTxOutSetStats unset) on a database of an older
+     * version until InitTxOutSetStats, or after an output could not be read.
+     */
+    mutable CCriticalSection cs_txOutSetStats;
+    CTxOutSetStats txOutSetStats;
+    uint256 hashTxOutSetStatsBlock;
+    bool fTxOutSetStats;
+
+    void LoadTxOutSetStats();
+    //! Start the changes of a write from the running statistics
+    CTxOutSetStatsUpdater GetTxOutSetStatsUpdater() const;
+    //! Keep the statistics of a batch just written, with its best block if it has one
+    void SetTxOutSetStats(const CTxOutSetStats &stats, bool fStats, const uint256 &hashBlock);
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -46,7 +225,113 @@ public:
                     const uint256 &hashAnchor,
                     CAnchorsMap &mapAnchors,
                     CNullifiersMap &mapNullifiers);
+    //! Write the dirty entries of the maps without modifying them
+    bool WriteEntries(const CCoinsMap &mapCoins,
+                      const uint256 &hashBlock,
+                      const uint256 &hashAnchor,
+                      const CAnchorsMap &mapAnchors,
+                      const CNullifiersMap &mapNullifiers);
+    //! Statistics of the records as flushed so far, read from a snapshot of their own
     bool GetStats(CCoinsStats &stats) const;
+    //! The nullifier filter and the cached anchor trees
+    size_t BackendMemoryUsage() const;
+
+    /**
+     * Take a consistent view of the database, for reads that must not be
+     * disturbed by flushes without holding cs_main. Its best block and
+     * anchor tell which state the records of the snapshot were flushed at.
+     */
+    CLevelDBSnapshot* NewSnapshot() const { return new CLevelDBSnapshot(db); }
+    uint256 GetBestBlock(const CLevelDBSnapshot &snapshot) const;
+    uint256 GetBestAnchor(const CLevelDBSnapshot &snapshot) const;
+    bool GetStats(const CLevelDBSnapshot &snapshot, CCoinsStats &stats) const;
+
+    /**
+     * The running statistics, without hashSerialized and nHeight, as of the
+     * last write; stats.hashBlock is the best block they were written with.
+     * Returns false if they are not known.
+     */
+    bool GetTxOutSetStats(CCoinsStats &stats) const;
+    //! Compute the running statistics by reading all the records, if the database has none yet
+    bool InitTxOutSetStats();
+
+    //! Compact the database, see CLevelDBWrapper::CompactFull
+    void CompactFull() { db.CompactFull(); }
+    uint64_t EstimateSize() const { return db.EstimateSize(); }
+
+    /**
+     * Write all records of a view of the database to a snapshot file, and
+     * fill in the counts and hashes of the header. The header itself is not
+     * written.
+     */
+    bool DumpSnapshot(const CLevelDBSnapshot &snapshot, CAutoFile &file, CTxOutSetSnapshotHeader &header) const;
+    /**
+     * Read the records of a snapshot file and compute its counts and hashes
+     * into result. If fWrite is set the records are also written to the
+     * database, followed by the best block and anchor of the header.
+     */
+    bool ReadSnapshot(CAutoFile &file, const CTxOutSetSnapshotHeader &header, bool fWrite, CTxOutSetSnapshotHeader &result);
+
+    /**
+     * Convert the records of older versions, one per transaction with all its
+     * outputs, to a header and a record per unspent output. Does nothing on a
+     * database without them; older versions cannot read an upgraded one.
+     */
+    bool Upgrade();
+};
+
+/**
+ * CCoinsView layer between the coins cache and the coin database that writes
+ * flushed entries on a background thread.
+ *
+ * BatchWrite takes over the passed maps as a snapshot and returns right away;
+ * the snapshot is written to the database by a dedicated thread, and reads
+ * are served from it until the write is done. Only one snapshot is pending at
+ * a time: a BatchWrite while the previous one is still being written waits for
+ * it. A failed write is reported by the next BatchWrite or Sync.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB *db;
+
+    mutable boost::mutex cs;
+    mutable boost::condition_variable condPending;
+    bool fPending;
+    bool fWriteFailed;
+    bool fStop;
+
+    CCoinsMap snapshotCoins;
+    CAnchorsMap snapshotAnchors;
+    CNullifiersMap snapshotNullifiers;
+    uint256 snapshotBlock;
+    uint256 snapshotAnchor;
+
+    boost::thread writerThread;
+
+    void ThreadWriter();
+
+public:
+    CCoinsViewBackgroundFlush(CCoinsViewDB *dbIn);
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetAnchorAt(const uint256 &rt, ZCIncrementalMerkleTree &tree) const;
+    bool GetNullifier(const uint256 &nf) const;
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor() const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashAnchor,
+                    CAnchorsMap &mapAnchors,
+                    CNullifiersMap &mapNullifiers);
+    bool GetStats(CCoinsStats &stats) const;
+    //! The snapshot being written, if any, and what the database holds
+    size_t BackendMemoryUsage() const;
+
+    //! Wait until the pending snapshot, if any, is written. Returns false if a write failed.
+    bool Sync();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -57,6 +342,14 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    /**
+     * Solutions last read by ReadBlockSolution, so that the headers around
+     * the tip, which peers ask for over and over, are seldom read from disk.
+     */
+    mutable CCriticalSection cs_solutions;
+    mutable std::list<uint256> lruSolutions;
+    mutable std::map<uint256, std::pair<std::vector<unsigned char>, std::list<uint256>::iterator> > mapSolutions;
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
@@ -67,8 +360,27 @@ public:
     bool ReadFastReindexing(bool &fReindexFast);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    //! The (height, offset past the block header) of the -compacttxindex entries whose txid starts as txid does
+    bool ReadCompactTxIndex(const uint256 &txid, std::vector<std::pair<int, unsigned int> > &vPos);
+    //! The -compacttxindex entries of the transactions of the block at nHeight
+    bool WriteCompactTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, int nHeight);
+    bool ReadAddressIndex(uint8_t type, const uint160 &addressHash, int nStartHeight, int nEndHeight,
+                          std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex);
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    //! Write the entries of vect, erasing those with a null value
+    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    //! Hashes of the blocks with a timestamp in [nLow, nHigh], in timestamp order
+    bool ReadTimestampIndex(uint32_t nLow, uint32_t nHigh, std::vector<uint256> &hashes);
+    bool WriteTimestampIndex(const CTimestampIndexKey &key);
+    bool EraseTimestampIndex(const CTimestampIndexKey &key);
+    bool ReadBlockFilter(const uint256 &hash, CBlockFilter &filter);
+    bool WriteBlockFilter(const CBlockFilter &filter);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    //! Equihash solution of the block index entry of a block
+    bool ReadBlockSolution(const uint256 &hash, std::vector<unsigned char> &solution) const;
     bool LoadBlockIndexGuts();
 };
 
@@ -10,6 +10,7 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "random.h"
 #include "streams.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -19,20 +20,26 @@
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false)
+    tx(std::make_shared<const CTransaction>()), nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false), spendsCoinbase(false), nFeeDelta(0),
+    nCountWithAncestors(0), nSizeWithAncestors(0), nModFeesWithAncestors(0),
+    nCountWithDescendants(0), nSizeWithDescendants(0), nModFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
-                                 unsigned int _nHeight, bool poolHasNoInputsOf):
-    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
-    hadNoDependencies(poolHasNoInputsOf)
+                                 unsigned int _nHeight, bool poolHasNoInputsOf, bool _spendsCoinbase):
+    tx(std::make_shared<const CTransaction>(_tx)), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
+    hadNoDependencies(poolHasNoInputsOf), spendsCoinbase(_spendsCoinbase), nFeeDelta(0)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-    nModSize = tx.CalculateModifiedSize(nTxSize);
-    nUsageSize = RecursiveDynamicUsage(tx);
+    nTxSize = tx->GetTotalSize();
+    nModSize = tx->CalculateModifiedSize(nTxSize);
+    nUsageSize = memusage::DynamicUsage(tx) + RecursiveDynamicUsage(*tx);
+
+    nCountWithAncestors = nCountWithDescendants = 1;
+    nSizeWithAncestors = nSizeWithDescendants = nTxSize;
+    nModFeesWithAncestors = nModFeesWithDescendants = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -43,19 +50,89 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
-    CAmount nValueIn = tx.GetValueOut()+nFee;
+    CAmount nValueIn = tx->GetValueOut()+nFee;
     double deltaPriority = ((double)(currentHeight-nHeight)*nValueIn)/nModSize;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
 
+bool CompareTxMemPoolIterByModFeeRate::operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const
+{
+    const CTxMemPoolEntry& x = a->second;
+    const CTxMemPoolEntry& y = b->second;
+    // Cross-multiplied as doubles, the products can overflow 64 bits
+    double f1 = (double)x.GetModifiedFee() * y.GetTxSize();
+    double f2 = (double)y.GetModifiedFee() * x.GetTxSize();
+    if (f1 == f2)
+        return a->first < b->first;
+    return f1 > f2;
+}
+
+bool CompareTxMemPoolIterByEntryTime::operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const
+{
+    if (a->second.GetTime() == b->second.GetTime())
+        return a->first < b->first;
+    return a->second.GetTime() < b->second.GetTime();
+}
+
+static void GetAncestorScoreFeeAndSize(const CTxMemPoolEntry& entry, double& fee, double& size)
+{
+    // Pick the lower of the two fee rates
+    if ((double)entry.GetModifiedFee() * entry.GetSizeWithAncestors() >
+        (double)entry.GetModFeesWithAncestors() * entry.GetTxSize()) {
+        fee = entry.GetModFeesWithAncestors();
+        size = entry.GetSizeWithAncestors();
+    } else {
+        fee = entry.GetModifiedFee();
+        size = entry.GetTxSize();
+    }
+}
+
+bool CompareTxMemPoolIterByAncestorScore::operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const
+{
+    double aFee, aSize, bFee, bSize;
+    GetAncestorScoreFeeAndSize(a->second, aFee, aSize);
+    GetAncestorScoreFeeAndSize(b->second, bFee, bSize);
+    double f1 = aFee * bSize;
+    double f2 = bFee * aSize;
+    if (f1 == f2)
+        return a->first < b->first;
+    return f1 > f2;
+}
+
+static void GetDescendantScoreFeeAndSize(const CTxMemPoolEntry& entry, double& fee, double& size)
+{
+    // Pick the higher of the two fee rates
+    if ((double)entry.GetModifiedFee() * entry.GetSizeWithDescendants() <
+        (double)entry.GetModFeesWithDescendants() * entry.GetTxSize()) {
+        fee = entry.GetModFeesWithDescendants();
+        size = entry.GetSizeWithDescendants();
+    } else {
+        fee = entry.GetModifiedFee();
+        size = entry.GetTxSize();
+    }
+}
+
+bool CompareTxMemPoolIterByDescendantScore::operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const
+{
+    double aFee, aSize, bFee, bSize;
+    GetDescendantScoreFeeAndSize(a->second, aFee, aSize);
+    GetDescendantScoreFeeAndSize(b->second, bFee, bSize);
+    double f1 = aFee * bSize;
+    double f2 = bFee * aSize;
+    if (f1 == f2)
+        return a->first < b->first;
+    return f1 < f2;
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), minRelayFee(_minRelayFee)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
     // of transactions in the pool
     fSanityCheck = false;
+    nCheckSample = DEFAULT_CHECK_MEMPOOL_SAMPLE;
 
     minerPolicyEstimator = new CBlockPolicyEstimator(_minRelayFee);
 }
@@ -90,6 +167,75 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+void CTxMemPool::CalculateAncestors(CTxMemPoolIter it, setEntries& ancestors)
+{
+    std::vector<CTxMemPoolIter> vToVisit(1, it);
+    while (!vToVisit.empty()) {
+        const CTransaction& tx = vToVisit.back()->second.GetTx();
+        vToVisit.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            CTxMemPoolIter parent = mapTx.find(txin.prevout.hash);
+            if (parent != mapTx.end() && ancestors.insert(parent).second)
+                vToVisit.push_back(parent);
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(CTxMemPoolIter it, setEntries& descendants)
+{
+    std::vector<CTxMemPoolIter> vToVisit(1, it);
+    while (!vToVisit.empty()) {
+        const uint256 hash = vToVisit.back()->first;
+        vToVisit.pop_back();
+        std::map<COutPoint, CInPoint>::iterator itNext = mapNextTx.lower_bound(COutPoint(hash, 0));
+        for (; itNext != mapNextTx.end() && itNext->first.hash == hash; ++itNext) {
+            CTxMemPoolIter child = mapTx.find(itNext->second.ptx->GetHash());
+            if (child != mapTx.end() && descendants.insert(child).second)
+                vToVisit.push_back(child);
+        }
+    }
+}
+
+void CTxMemPool::IndexEntry(CTxMemPoolIter it)
+{
+    setByModFeeRate.insert(it);
+    setByEntryTime.insert(it);
+    setByAncestorScore.insert(it);
+    setByDescendantScore.insert(it);
+}
+
+void CTxMemPool::UnindexEntry(CTxMemPoolIter it)
+{
+    setByModFeeRate.erase(it);
+    setByEntryTime.erase(it);
+    setByAncestorScore.erase(it);
+    setByDescendantScore.erase(it);
+}
+
+void CTxMemPool::UpdateAncestorState(CTxMemPoolIter it, int64_t nCount, int64_t nSize, CAmount nModFees)
+{
+    setByAncestorScore.erase(it);
+    CTxMemPoolEntry& entry = it->second;
+    entry.nCountWithAncestors += nCount;
+    entry.nSizeWithAncestors += nSize;
+    entry.nModFeesWithAncestors += nModFees;
+    setByAncestorScore.insert(it);
+    if (fSanityCheck && nCheckSample < 100)
+        setUncheckedTx.insert(it->first);
+}
+
+void CTxMemPool::UpdateDescendantState(CTxMemPoolIter it, int64_t nCount, int64_t nSize, CAmount nModFees)
+{
+    setByDescendantScore.erase(it);
+    CTxMemPoolEntry& entry = it->second;
+    entry.nCountWithDescendants += nCount;
+    entry.nSizeWithDescendants += nSize;
+    entry.nModFeesWithDescendants += nModFees;
+    setByDescendantScore.insert(it);
+    if (fSanityCheck && nCheckSample < 100)
+        setUncheckedTx.insert(it->first);
+}
+
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
@@ -97,8 +243,16 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    mapTx[hash] = entry;
-    const CTransaction& tx = mapTx[hash].GetTx();
+    CTxMemPoolIter it = mapTx.insert(std::make_pair(hash, entry)).first;
+    std::map<uint256, std::pair<double, CAmount> >::const_iterator itDelta = mapDeltas.find(hash);
+    if (itDelta != mapDeltas.end() && itDelta->second.second != 0) {
+        it->second.nFeeDelta = itDelta->second.second;
+        it->second.nModFeesWithAncestors += it->second.nFeeDelta;
+        it->second.nModFeesWithDescendants += it->second.nFeeDelta;
+    }
+    const CTransaction& tx = it->second.GetTx();
+    if (fSanityCheck && nCheckSample < 100)
+        setUncheckedTx.insert(hash);
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
@@ -107,17 +261,36 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
             mapNullifiers[nf] = &tx;
         }
+        mapAnchorSpenders[joinsplit.anchor].insert(hash);
+    }
+    if (entry.GetSpendsCoinbase())
+        setCoinbaseSpenders.insert(hash);
+
+    // Children never enter before their parents, so only the ancestors have to be updated
+    setEntries ancestors;
+    CalculateAncestors(it, ancestors);
+    CTxMemPoolEntry& newEntry = it->second;
+    BOOST_FOREACH(CTxMemPoolIter itAncestor, ancestors) {
+        CTxMemPoolEntry& ancestor = itAncestor->second;
+        newEntry.nCountWithAncestors++;
+        newEntry.nSizeWithAncestors += ancestor.GetTxSize();
+        newEntry.nModFeesWithAncestors += ancestor.GetModifiedFee();
+        UpdateDescendantState(itAncestor, 1, newEntry.GetTxSize(), newEntry.GetModifiedFee());
     }
+    IndexEntry(it);
+
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     cachedInnerUsage += entry.DynamicMemoryUsage();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
+    NotifyEntryAdded(tx, ++nMempoolSequence);
 
     return true;
 }
 
 
-void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive)
+void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& removed, bool fRecursive,
+                        MemPoolRemovalReason reason)
 {
     // Remove transaction from memory pool
     {
@@ -140,9 +313,10 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
         {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            CTxMemPoolIter itRemove = mapTx.find(hash);
+            if (itRemove == mapTx.end())
                 continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
+            const CTransaction& tx = itRemove->second.GetTx();
             if (fRecursive) {
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
                     std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
@@ -158,12 +332,32 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 BOOST_FOREACH(const uint256& nf, joinsplit.nullifiers) {
                     mapNullifiers.erase(nf);
                 }
+                boost::unordered_map<uint256, std::set<uint256>, SaltedUint256Hasher>::iterator itAnchor = mapAnchorSpenders.find(joinsplit.anchor);
+                if (itAnchor != mapAnchorSpenders.end()) {
+                    itAnchor->second.erase(hash);
+                    if (itAnchor->second.empty())
+                        mapAnchorSpenders.erase(itAnchor);
+                }
             }
+            setCoinbaseSpenders.erase(hash);
+
 
+            // Take the entry out of the aggregates of the relatives that stay, for now
+            const CTxMemPoolEntry& entry = itRemove->second;
+            setEntries ancestors, descendants;
+            CalculateAncestors(itRemove, ancestors);
+            CalculateDescendants(itRemove, descendants);
+            BOOST_FOREACH(CTxMemPoolIter itAncestor, ancestors)
+                UpdateDescendantState(itAncestor, -1, -(int64_t)entry.GetTxSize(), -entry.GetModifiedFee());
+            BOOST_FOREACH(CTxMemPoolIter itDescendant, descendants)
+                UpdateAncestorState(itDescendant, -1, -(int64_t)entry.GetTxSize(), -entry.GetModifiedFee());
+            UnindexEntry(itRemove);
+
+            NotifyEntryRemoved(tx, reason, ++nMempoolSequence);
             removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            cachedInnerUsage -= mapTx[hash].DynamicMemoryUsage();
-            mapTx.erase(hash);
+            totalTxSize -= entry.GetTxSize();
+            cachedInnerUsage -= entry.DynamicMemoryUsage();
+            mapTx.erase(itRemove);
             nTransactionsUpdated++;
             minerPolicyEstimator->removeTx(hash);
         }
@@ -175,8 +369,8 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache *pcoins, unsigned in
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
+    BOOST_FOREACH(const uint256& hash, setCoinbaseSpenders) {
+        const CTransaction& tx = mapTx[hash].GetTx();
         BOOST_FOREACH(const CTxIn& txin, tx.vin) {
             std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
             if (it2 != mapTx.end())
@@ -191,7 +385,7 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache *pcoins, unsigned in
     }
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MPR_REORG);
     }
 }
 
@@ -205,19 +399,15 @@ void CTxMemPool::removeWithAnchor(const uint256 &invalidRoot)
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
 
-    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
-        const CTransaction& tx = it->second.GetTx();
-        BOOST_FOREACH(const JSDescription& joinsplit, tx.vjoinsplit) {
-            if (joinsplit.anchor == invalidRoot) {
-                transactionsToRemove.push_back(tx);
-                break;
-            }
-        }
+    boost::unordered_map<uint256, std::set<uint256>, SaltedUint256Hasher>::const_iterator itAnchor = mapAnchorSpenders.find(invalidRoot);
+    if (itAnchor != mapAnchorSpenders.end()) {
+        BOOST_FOREACH(const uint256& hash, itAnchor->second)
+            transactionsToRemove.push_back(mapTx[hash].GetTx());
     }
 
     BOOST_FOREACH(const CTransaction& tx, transactionsToRemove) {
         list<CTransaction> removed;
-        remove(tx, removed, true);
+        remove(tx, removed, true, MPR_REORG);
     }
 }
 
@@ -232,19 +422,19 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
             {
-                remove(txConflict, removed, true);
+                remove(txConflict, removed, true, MPR_CONFLICT);
             }
         }
     }
 
     BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
         BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapNullifiers.find(nf);
+            boost::unordered_map<uint256, const CTransaction*, SaltedUint256Hasher>::iterator it = mapNullifiers.find(nf);
             if (it != mapNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx)
                 {
-                    remove(txConflict, removed, true);
+                    remove(txConflict, removed, true, MPR_CONFLICT);
                 }
             }
         }
@@ -268,19 +458,28 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
         std::list<CTransaction> dummy;
-        remove(tx, dummy, false);
+        remove(tx, dummy, false, MPR_BLOCK);
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
     }
     // After the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    nLastRollingFeeUpdate = GetTime();
+    fBlockSinceLastRollingFeeBump = true;
 }
 
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    setByModFeeRate.clear();
+    setByEntryTime.clear();
+    setByAncestorScore.clear();
+    setByDescendantScore.clear();
+    mapAnchorSpenders.clear();
+    setCoinbaseSpenders.clear();
     mapTx.clear();
     mapNextTx.clear();
+    setUncheckedTx.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -299,23 +498,42 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
 
     LOCK(cs);
+    // In sampled mode, the entries whose inputs and aggregates get checked;
+    // their inputs are checked against the mempool and pcoins directly, since
+    // the others are not there to be replayed in order
+    bool fSampled = nCheckSample < 100;
+    std::set<uint256> setSampled;
+    if (fSampled) {
+        for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+            if (setUncheckedTx.count(it->first) || insecure_rand() % 100 < nCheckSample)
+                setSampled.insert(it->first);
+        }
+        setUncheckedTx.clear();
+        LogPrint("mempool", "Checking the inputs of %u of them\n", (unsigned int)setSampled.size());
+    }
+    CCoinsViewMemPool viewMemPool(const_cast<CCoinsViewCache*>(pcoins), const_cast<CTxMemPool&>(*this));
+    CCoinsViewCache viewSampled(&viewMemPool);
+
     list<const CTxMemPoolEntry*> waitingOnDependants;
     for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
         checkTotal += it->second.GetTxSize();
         innerUsage += it->second.DynamicMemoryUsage();
         const CTransaction& tx = it->second.GetTx();
+        bool fCheckInputs = !fSampled || setSampled.count(it->first);
         bool fDependsWait = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
             // Check that every mempool transaction's inputs refer to available coins, or other mempool tx's.
-            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
-            if (it2 != mapTx.end()) {
-                const CTransaction& tx2 = it2->second.GetTx();
-                assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
-                fDependsWait = true;
-            } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+            if (fCheckInputs) {
+                std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(txin.prevout.hash);
+                if (it2 != mapTx.end()) {
+                    const CTransaction& tx2 = it2->second.GetTx();
+                    assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
+                    fDependsWait = true;
+                } else {
+                    const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
+                    assert(coins && coins->IsAvailable(txin.prevout.n));
+                }
             }
             // Check whether its inputs are marked in mapNextTx.
             std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
@@ -324,8 +542,10 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second.n == i);
             i++;
         }
+        if (!fCheckInputs)
+            continue;
 
-        boost::unordered_map<uint256, ZCIncrementalMerkleTree, CCoinsKeyHasher> intermediates;
+        boost::unordered_map<uint256, ZCIncrementalMerkleTree, SaltedUint256Hasher> intermediates;
 
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
             BOOST_FOREACH(const uint256 &nf, joinsplit.nullifiers) {
@@ -340,14 +560,14 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 assert(pcoins->GetAnchorAt(joinsplit.anchor, tree));
             }
 
-            BOOST_FOREACH(const uint256& commitment, joinsplit.commitments)
-            {
-                tree.append(commitment);
-            }
+            tree.append_range(joinsplit.commitments.begin(), joinsplit.commitments.end());
 
             intermediates.insert(std::make_pair(tree.root(), tree));
         }
-        if (fDependsWait)
+        if (fSampled) {
+            CValidationState state;
+            assert(ContextualCheckInputs(tx, state, viewSampled, false, chainActive, 0, false, Params().GetConsensus(), NULL));
+        } else if (fDependsWait)
             waitingOnDependants.push_back(&it->second);
         else {
             CValidationState state;
@@ -380,7 +600,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
-    for (std::map<uint256, const CTransaction*>::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); it++) {
+    for (boost::unordered_map<uint256, const CTransaction*, SaltedUint256Hasher>::const_iterator it = mapNullifiers.begin(); it != mapNullifiers.end(); it++) {
         uint256 hash = it->second->GetHash();
         map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->second.GetTx();
@@ -390,6 +610,61 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
     assert(totalTxSize == checkTotal);
     assert(innerUsage == cachedInnerUsage);
+
+    assert(setByModFeeRate.size() == mapTx.size());
+    assert(setByEntryTime.size() == mapTx.size());
+    assert(setByAncestorScore.size() == mapTx.size());
+    assert(setByDescendantScore.size() == mapTx.size());
+    size_t nAnchorSpends = 0;
+    for (boost::unordered_map<uint256, std::set<uint256>, SaltedUint256Hasher>::const_iterator it = mapAnchorSpenders.begin(); it != mapAnchorSpenders.end(); it++) {
+        BOOST_FOREACH(const uint256& hash, it->second) {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator it2 = mapTx.find(hash);
+            assert(it2 != mapTx.end());
+            bool fFound = false;
+            BOOST_FOREACH(const JSDescription& joinsplit, it2->second.GetTx().vjoinsplit)
+                fFound |= joinsplit.anchor == it->first;
+            assert(fFound);
+        }
+        nAnchorSpends += it->second.size();
+    }
+    size_t nCoinbaseSpenders = 0;
+    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        std::set<uint256> setAnchors;
+        BOOST_FOREACH(const JSDescription& joinsplit, it->second.GetTx().vjoinsplit)
+            setAnchors.insert(joinsplit.anchor);
+        nAnchorSpends -= setAnchors.size();
+        if (it->second.GetSpendsCoinbase()) {
+            assert(setCoinbaseSpenders.count(it->first));
+            nCoinbaseSpenders++;
+        }
+    }
+    assert(nAnchorSpends == 0);
+    assert(nCoinbaseSpenders == setCoinbaseSpenders.size());
+    for (CTxMemPoolIter it = const_cast<CTxMemPool*>(this)->mapTx.begin(); it != mapTx.end(); it++) {
+        if (fSampled && !setSampled.count(it->first))
+            continue;
+        setEntries ancestors, descendants;
+        const_cast<CTxMemPool*>(this)->CalculateAncestors(it, ancestors);
+        const_cast<CTxMemPool*>(this)->CalculateDescendants(it, descendants);
+        uint64_t nSize = it->second.GetTxSize();
+        CAmount nModFees = it->second.GetModifiedFee();
+        BOOST_FOREACH(CTxMemPoolIter itAncestor, ancestors) {
+            nSize += itAncestor->second.GetTxSize();
+            nModFees += itAncestor->second.GetModifiedFee();
+        }
+        assert(it->second.GetCountWithAncestors() == ancestors.size() + 1);
+        assert(it->second.GetSizeWithAncestors() == nSize);
+        assert(it->second.GetModFeesWithAncestors() == nModFees);
+        nSize = it->second.GetTxSize();
+        nModFees = it->second.GetModifiedFee();
+        BOOST_FOREACH(CTxMemPoolIter itDescendant, descendants) {
+            nSize += itDescendant->second.GetTxSize();
+            nModFees += itDescendant->second.GetModifiedFee();
+        }
+        assert(it->second.GetCountWithDescendants() == descendants.size() + 1);
+        assert(it->second.GetSizeWithDescendants() == nSize);
+        assert(it->second.GetModFeesWithDescendants() == nModFees);
+    }
 }
 
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
@@ -411,10 +686,37 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
-CFeeRate CTxMemPool::estimateFee(int nBlocks) const
+std::shared_ptr<const CTransaction> CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
-    return minerPolicyEstimator->estimateFee(nBlocks);
+    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return nullptr;
+    return i->second.GetSharedTx();
+}
+
+bool CTxMemPool::CompareDepthAndScore(const uint256& hasha, const uint256& hashb) const
+{
+    LOCK(cs);
+    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hasha);
+    if (i == mapTx.end()) return false;
+    map<uint256, CTxMemPoolEntry>::const_iterator j = mapTx.find(hashb);
+    if (j == mapTx.end()) return true;
+    uint64_t counta = i->second.GetCountWithAncestors();
+    uint64_t countb = j->second.GetCountWithAncestors();
+    if (counta == countb) {
+        double aFee, aSize, bFee, bSize;
+        GetAncestorScoreFeeAndSize(i->second, aFee, aSize);
+        GetAncestorScoreFeeAndSize(j->second, bFee, bSize);
+        return aFee * bSize > bFee * aSize;
+    }
+    return counta < countb;
+}
+
+CFeeRate CTxMemPool::estimateFee(int nBlocks, FeeEstimateHorizon horizon) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->estimateFee(nBlocks, horizon);
 }
 double CTxMemPool::estimatePriority(int nBlocks) const
 {
@@ -464,6 +766,23 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+
+        CTxMemPoolIter it = mapTx.find(hash);
+        if (it != mapTx.end() && nFeeDelta != 0) {
+            setEntries ancestors, descendants;
+            CalculateAncestors(it, ancestors);
+            CalculateDescendants(it, descendants);
+            UnindexEntry(it);
+            CTxMemPoolEntry& entry = it->second;
+            entry.nFeeDelta += nFeeDelta;
+            entry.nModFeesWithAncestors += nFeeDelta;
+            entry.nModFeesWithDescendants += nFeeDelta;
+            IndexEntry(it);
+            BOOST_FOREACH(CTxMemPoolIter itAncestor, ancestors)
+                UpdateDescendantState(itAncestor, 0, 0, nFeeDelta);
+            BOOST_FOREACH(CTxMemPoolIter itDescendant, descendants)
+                UpdateAncestorState(itDescendant, 0, 0, nFeeDelta);
+        }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -493,6 +812,80 @@ bool CTxMemPool::HasNoInputsOf(const CTransaction &tx) const
     return true;
 }
 
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!setByDescendantScore.empty() && DynamicMemoryUsage() > sizelimit) {
+        CTxMemPoolIter it = *setByDescendantScore.begin();
+        const CTxMemPoolEntry& entry = it->second;
+
+        // Remember the fee rate of the package, bumped, for the rolling minimum fee
+        CFeeRate removed(entry.GetModFeesWithDescendants(), entry.GetSizeWithDescendants());
+        removed = CFeeRate(removed.GetFeePerK() + minRelayFee.GetFeePerK());
+        if (maxFeeRateRemoved < removed)
+            maxFeeRateRemoved = removed;
+
+        const CTransaction tx = entry.GetTx();
+        std::list<CTransaction> removedTxs;
+        remove(tx, removedTxs, true, MPR_SIZELIMIT);
+        nTxnRemoved += removedTxs.size();
+    }
+
+    if (maxFeeRateRemoved > CFeeRate(0)) {
+        if (maxFeeRateRemoved.GetFeePerK() > rollingMinimumFeeRate) {
+            rollingMinimumFeeRate = maxFeeRateRemoved.GetFeePerK();
+            fBlockSinceLastRollingFeeBump = false;
+        }
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
+    }
+}
+
+int CTxMemPool::Expire(int64_t time)
+{
+    LOCK(cs);
+    std::vector<CTransaction> vExpired;
+    std::set<CTxMemPoolIter, CompareTxMemPoolIterByEntryTime>::const_iterator it = setByEntryTime.begin();
+    for (; it != setByEntryTime.end() && (*it)->second.GetTime() < time; ++it)
+        vExpired.push_back((*it)->second.GetTx());
+
+    int nRemoved = 0;
+    BOOST_FOREACH(const CTransaction& tx, vExpired) {
+        // Already gone if it descends from an earlier expired one
+        std::list<CTransaction> removed;
+        remove(tx, removed, true, MPR_EXPIRY);
+        nRemoved += removed.size();
+    }
+    return nRemoved;
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!fBlockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(rollingMinimumFeeRate);
+
+    int64_t time = GetTime();
+    if (time > nLastRollingFeeUpdate + 10) {
+        double halflife = ROLLING_FEE_HALFLIFE;
+        if (DynamicMemoryUsage() < sizelimit / 4)
+            halflife /= 4;
+        else if (DynamicMemoryUsage() < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - nLastRollingFeeUpdate) / halflife);
+        nLastRollingFeeUpdate = time;
+
+        // Once below half the relay fee the mempool is not full anymore
+        if (rollingMinimumFeeRate < (double)minRelayFee.GetFeePerK() / 2) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(rollingMinimumFeeRate), minRelayFee);
+}
+
 void CTxMemPool::NotifyRecentlyAdded()
 {
     uint64_t recentlyAddedSequence;
@@ -506,20 +899,19 @@ void CTxMemPool::NotifyRecentlyAdded()
         mapRecentlyAddedTx.clear();
     }
 
-    // A race condition can occur here between these SyncWithWallets calls, and
+    // A race condition can occur here between this SyncWithWallets call, and
     // the ones triggered by block logic (in ConnectTip and DisconnectTip). It
     // is harmless because calling SyncWithWallets(_, NULL) does not alter the
     // wallet transaction's block information.
-    for (auto tx : txs) {
-        try {
-            SyncWithWallets(tx, NULL);
-        } catch (const boost::thread_interrupted&) {
-            throw;
-        } catch (const std::exception& e) {
-            PrintExceptionContinue(&e, "CTxMemPool::NotifyRecentlyAdded()");
-        } catch (...) {
-            PrintExceptionContinue(NULL, "CTxMemPool::NotifyRecentlyAdded()");
-        }
+    // All of them go in one batch, so that each wallet takes its lock once.
+    try {
+        SyncWithWallets(txs, NULL);
+    } catch (const boost::thread_interrupted&) {
+        throw;
+    } catch (const std::exception& e) {
+        PrintExceptionContinue(&e, "CTxMemPool::NotifyRecentlyAdded()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "CTxMemPool::NotifyRecentlyAdded()");
     }
 
     // Update the notified sequence number. We only need this in regtest mode,
@@ -563,5 +955,9 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) +
+           memusage::DynamicUsage(setByModFeeRate) + memusage::DynamicUsage(setByEntryTime) +
+           memusage::DynamicUsage(setByAncestorScore) + memusage::DynamicUsage(setByDescendantScore) +
+           memusage::DynamicUsage(mapAnchorSpenders) + memusage::DynamicUsage(mapNullifiers) +
+           memusage::DynamicUsage(setCoinbaseSpenders) + cachedInnerUsage;
 }
@@ -7,12 +7,17 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <memory>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
+#include "policy/fees.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 
+#include <boost/signals2/signal.hpp>
+
 class CAutoFile;
 
 inline double AllowFreeThreshold()
@@ -33,10 +38,15 @@ static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 /**
  * CTxMemPool stores these:
  */
+/**
+ * The transaction of an entry is shared, with copies of the entry and with
+ * the relay memory (see RelayTransaction), so that a large shielded
+ * transaction is held once however many places keep it.
+ */
 class CTxMemPoolEntry
 {
 private:
-    CTransaction tx;
+    std::shared_ptr<const CTransaction> tx;
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize; //! ... and avoid recomputing tx size
     size_t nModSize; //! ... and modified size for priority
@@ -45,21 +55,88 @@ private:
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
+    bool spendsCoinbase; //! Spends a coinbase output, so a reorg can make it immature
+    CAmount nFeeDelta; //! Fee delta set by prioritisetransaction
+
+    // Aggregates over this entry and its in-mempool ancestors, maintained by CTxMemPool
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    // ... and over this entry and its in-mempool descendants
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    friend class CTxMemPool;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
-                    int64_t _nTime, double _dPriority, unsigned int _nHeight, bool poolHasNoInputsOf = false);
+                    int64_t _nTime, double _dPriority, unsigned int _nHeight, bool poolHasNoInputsOf = false,
+                    bool _spendsCoinbase = false);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return this->tx; }
+    const CTransaction& GetTx() const { return *this->tx; }
+    std::shared_ptr<const CTransaction> GetSharedTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
+    bool GetSpendsCoinbase() const { return spendsCoinbase; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+};
+
+typedef std::map<uint256, CTxMemPoolEntry>::iterator CTxMemPoolIter;
+
+/** Order mempool entries by txid. */
+struct CompareTxMemPoolIterByHash
+{
+    bool operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const
+    {
+        return a->first < b->first;
+    }
+};
+
+/** Order mempool entries by modified fee rate, highest first. */
+struct CompareTxMemPoolIterByModFeeRate
+{
+    bool operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const;
+};
+
+/** Order mempool entries by the time they entered the mempool, oldest first. */
+struct CompareTxMemPoolIterByEntryTime
+{
+    bool operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const;
+};
+
+/**
+ * Order mempool entries by ancestor score, highest first: the lower of the
+ * entry's own modified fee rate and that of the entry with its ancestors,
+ * which is what including it in a block actually pays.
+ */
+struct CompareTxMemPoolIterByAncestorScore
+{
+    bool operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const;
+};
+
+/**
+ * Order mempool entries by descendant score, lowest first: the higher of the
+ * entry's own modified fee rate and that of the entry with its descendants,
+ * so that the first entry and its descendants are the cheapest to evict.
+ */
+struct CompareTxMemPoolIterByDescendantScore
+{
+    bool operator()(const CTxMemPoolIter& a, const CTxMemPoolIter& b) const;
 };
 
 class CBlockPolicyEstimator;
@@ -88,25 +165,77 @@ public:
  * an input of a transaction in the pool, it is dropped,
  * as are non-standard transactions.
  */
+/** Why a transaction left the mempool, as told to NotifyEntryRemoved */
+enum MemPoolRemovalReason {
+    MPR_UNKNOWN = 0, //! Removed for another reason
+    MPR_BLOCK,       //! Included in a connected block
+    MPR_CONFLICT,    //! Conflicts with a transaction of a connected block
+    MPR_EXPIRY,      //! Older than -mempoolexpiry
+    MPR_SIZELIMIT,   //! Evicted to keep the mempool below -maxmempool
+    MPR_REORG,       //! No longer valid after a block was disconnected
+};
+
+//! -checkmempoolsample default: check every entry
+static const unsigned int DEFAULT_CHECK_MEMPOOL_SAMPLE = 100;
+
 class CTxMemPool
 {
 private:
     bool fSanityCheck; //! Normally false, true if -checkmempool or -regtest
+    //! Percentage of the unchanged entries whose inputs and aggregates check verifies, see -checkmempoolsample
+    unsigned int nCheckSample;
+    //! Entries added, or whose ancestor or descendant aggregates changed, since the last sampled check
+    mutable std::set<uint256> setUncheckedTx;
     unsigned int nTransactionsUpdated;
     CBlockPolicyEstimator* minerPolicyEstimator;
+    CFeeRate minRelayFee; //! Added to the fee rate of evicted packages for the rolling minimum fee
+
+    //! Minimum fee rate (satoshis per kB) raised by TrimToSize, decaying once blocks are found
+    mutable double rollingMinimumFeeRate = 0;
+    mutable int64_t nLastRollingFeeUpdate = 0;
+    mutable bool fBlockSinceLastRollingFeeBump = false;
 
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
-    std::map<uint256, const CTransaction*> mapRecentlyAddedTx;
+    boost::unordered_map<uint256, const CTransaction*, SaltedUint256Hasher> mapRecentlyAddedTx;
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
+    //! Counts the additions and removals, see GetSequence
+    uint64_t nMempoolSequence = 0;
+
+    typedef std::set<CTxMemPoolIter, CompareTxMemPoolIterByHash> setEntries;
+
+    //! Transactions by the JoinSplit anchors they use, for removeWithAnchor
+    boost::unordered_map<uint256, std::set<uint256>, SaltedUint256Hasher> mapAnchorSpenders;
+    //! Transactions spending a coinbase output, for removeCoinbaseSpends
+    std::set<uint256> setCoinbaseSpenders;
+
+    /** In-mempool ancestors of it, not including it. */
+    void CalculateAncestors(CTxMemPoolIter it, setEntries& ancestors);
+    /** In-mempool descendants of it, not including it. */
+    void CalculateDescendants(CTxMemPoolIter it, setEntries& descendants);
+    /** Add it to the indexes, once its ancestor aggregates are set. */
+    void IndexEntry(CTxMemPoolIter it);
+    void UnindexEntry(CTxMemPoolIter it);
+    /** Change the ancestor aggregates of it, keeping setByAncestorScore ordered. */
+    void UpdateAncestorState(CTxMemPoolIter it, int64_t nCount, int64_t nSize, CAmount nModFees);
+    /** Change the descendant aggregates of it, keeping setByDescendantScore ordered. */
+    void UpdateDescendantState(CTxMemPoolIter it, int64_t nCount, int64_t nSize, CAmount nModFees);
 
 public:
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
+    //! Secondary indexes over mapTx, kept up to date by all mempool updates
+    std::set<CTxMemPoolIter, CompareTxMemPoolIterByModFeeRate> setByModFeeRate;
+    std::set<CTxMemPoolIter, CompareTxMemPoolIterByEntryTime> setByEntryTime;
+    std::set<CTxMemPoolIter, CompareTxMemPoolIterByAncestorScore> setByAncestorScore;
+    std::set<CTxMemPoolIter, CompareTxMemPoolIterByDescendantScore> setByDescendantScore;
+
+    /** Half-life of the rolling minimum fee once a block has been found, in seconds */
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
     std::map<COutPoint, CInPoint> mapNextTx;
-    std::map<uint256, const CTransaction*> mapNullifiers;
+    boost::unordered_map<uint256, const CTransaction*, SaltedUint256Hasher> mapNullifiers;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
@@ -117,12 +246,21 @@ public:
      * consistent (does not contain two transactions that spend the same inputs,
      * all inputs are in the mapNextTx array). If sanity-checking is turned off,
      * check does nothing.
+     *
+     * With a sample below 100 the indexes are still checked in full, but the
+     * inputs and ancestor and descendant aggregates only of the entries that
+     * changed since the last check and of that percentage of the others.
      */
     void check(const CCoinsViewCache *pcoins) const;
-    void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
+    void setSanityCheck(bool _fSanityCheck, unsigned int _nCheckSample = DEFAULT_CHECK_MEMPOOL_SAMPLE)
+    {
+        fSanityCheck = _fSanityCheck;
+        nCheckSample = _nCheckSample;
+    }
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate = true);
-    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false);
+    void remove(const CTransaction &tx, std::list<CTransaction>& removed, bool fRecursive = false,
+                MemPoolRemovalReason reason = MPR_UNKNOWN);
     void removeWithAnchor(const uint256 &invalidRoot);
     void removeCoinbaseSpends(const CCoinsViewCache *pcoins, unsigned int nMemPoolHeight);
     void removeConflicts(const CTransaction &tx, std::list<CTransaction>& removed);
@@ -147,6 +285,38 @@ public:
     void NotifyRecentlyAdded();
     bool IsFullyNotified();
 
+    /**
+     * Fired under cs for each transaction added and removed, with the
+     * sequence number of the change. Consecutive changes have consecutive
+     * numbers, so listeners can tell whether they missed any.
+     */
+    boost::signals2::signal<void (const CTransaction&, uint64_t)> NotifyEntryAdded;
+    boost::signals2::signal<void (const CTransaction&, MemPoolRemovalReason, uint64_t)> NotifyEntryRemoved;
+
+    //! Sequence number of the latest addition or removal, zero if none yet
+    uint64_t GetSequence() const
+    {
+        LOCK(cs);
+        return nMempoolSequence;
+    }
+
+    /**
+     * Evict the transactions with the lowest descendant score, along with their
+     * descendants, until DynamicMemoryUsage() is at most sizelimit. Raises the
+     * rolling minimum fee above the fee rate of what was evicted.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove the transactions that entered before time, and their descendants. Returns the number removed. */
+    int Expire(int64_t time);
+
+    /**
+     * The minimum fee rate to get into a mempool limited to sizelimit bytes,
+     * zero unless TrimToSize had to evict. It halves every ROLLING_FEE_HALFLIFE
+     * after the next block, faster while the mempool is well below the limit.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
     unsigned long size()
     {
         LOCK(cs);
@@ -166,9 +336,18 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    //! The transaction of an entry itself rather than a copy, null if it is not in the mempool
+    std::shared_ptr<const CTransaction> get(const uint256& hash) const;
+
+    /**
+     * Whether the transaction hasha is to be announced before hashb: the one with fewer
+     * in-mempool ancestors first, so that parents go before their children, then the one
+     * with the higher ancestor score. Transactions no longer in the mempool go last.
+     */
+    bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb) const;
 
-    /** Estimate fee rate needed to get into the next nBlocks */
-    CFeeRate estimateFee(int nBlocks) const;
+    /** Estimate fee rate needed to get into the next nBlocks, judging by the given horizon */
+    CFeeRate estimateFee(int nBlocks, FeeEstimateHorizon horizon = MEDIUM_HORIZON) const;
 
     /** Estimate priority needed to get into the next nBlocks */
     double estimatePriority(int nBlocks) const;
@@ -45,6 +45,16 @@ public:
                 push_back_u(codepoint);
         }
     }
+    // Write a run of 7-bit ASCII chars
+    void append_ascii(const char *begin, const char *end)
+    {
+        if (begin == end)
+            return;
+        if (state) // Not a continuation, invalid
+            is_valid = false;
+        else
+            str.append(begin, end - begin);
+    }
     // Write codepoint directly, possibly collating surrogate pairs
     void push_back_u(unsigned int codepoint_)
     {
@@ -398,6 +398,51 @@ BOOST_AUTO_TEST_CASE(univalue_readwrite)
     BOOST_CHECK(!v.read("{} 42"));
 }
 
+BOOST_AUTO_TEST_CASE(univalue_readwrite_strings)
+{
+    // Special characters at every offset of a string longer than the
+    // eight bytes the reader scans at once
+    const std::string plain("abcdefghijklmnopqrstuvwxyz");
+    const char *specials[] = { "\"", "\\", "\n", "\x01", "\x7f", "\xc3\xa9" };
+    for (size_t s = 0; s < sizeof(specials) / sizeof(specials[0]); s++) {
+        for (size_t pos = 0; pos <= plain.size(); pos++) {
+            std::string str = plain.substr(0, pos) + specials[s] + plain.substr(pos);
+            UniValue arr(UniValue::VARR);
+            arr.push_back(str);
+
+            UniValue v;
+            BOOST_CHECK(v.read(arr.write()));
+            BOOST_CHECK_EQUAL(v[0].get_str(), str);
+        }
+    }
+
+    UniValue v;
+    BOOST_CHECK(!v.read("[\"abcdefgh\x01ijklmnop\"]"));
+    BOOST_CHECK(!v.read("[\"abcdefgh\xc3ijklmnop\"]"));
+    BOOST_CHECK(!v.read("[\"abcdefghijklmnop"));
+}
+
+BOOST_AUTO_TEST_CASE(univalue_move)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.pushKV("key", "value");
+
+    UniValue arr(UniValue::VARR);
+    BOOST_CHECK(arr.push_back(std::move(inner)));
+    BOOST_CHECK_EQUAL(arr.size(), 1);
+    BOOST_CHECK_EQUAL(arr[0]["key"].get_str(), "value");
+
+    UniValue obj(UniValue::VOBJ);
+    BOOST_CHECK(obj.pushKV("arr", std::move(arr)));
+    BOOST_CHECK(obj.pushKV("arr", UniValue(42)));
+    BOOST_CHECK_EQUAL(obj.size(), 1);
+    BOOST_CHECK_EQUAL(obj["arr"].get_int(), 42);
+
+    UniValue num;
+    BOOST_CHECK(!num.push_back(UniValue(1)));
+    BOOST_CHECK(!num.pushKV("key", UniValue(1)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 int main (int argc, char *argv[])
@@ -408,6 +453,8 @@ int main (int argc, char *argv[])
     univalue_array();
     univalue_object();
     univalue_readwrite();
+    univalue_readwrite_strings();
+    univalue_move();
     return 0;
 }
 
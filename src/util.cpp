@@ -16,7 +16,10 @@
 #include "utilstrencodings.h"
 #include "utiltime.h"
 
+#include <atomic>
+#include <limits>
 #include <stdarg.h>
+#include <thread>
 
 #if (defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__))
 #include <pthread.h>
@@ -24,7 +27,7 @@
 #endif
 
 #ifndef WIN32
-// for posix_fallocate
+// for posix_fallocate and posix_fadvise
 #ifdef __linux__
 
 #ifdef _POSIX_C_SOURCE
@@ -180,6 +183,36 @@ static FILE* debugLogFp = NULL;
 static boost::mutex* mutexDebugLog = NULL;
 static list<string> *vMsgsBeforeOpenLog;
 
+/**
+ * Once debug.log is open, a thread of its own writes to it. A logging thread
+ * only pushes its line, with the time it was logged at, onto a lock-free
+ * stack, waking the writer if the stack was empty; the writer takes all the
+ * lines at once and writes them oldest first, in one go.
+ */
+struct CLogLine {
+    std::string str;
+    int64_t nTime;
+    int64_t nTimeMicros;
+    std::thread::id threadId;
+    CLogLine* pnext;
+};
+
+//! Lines logged and not written yet, the latest first
+static std::atomic<CLogLine*> pLogQueue(NULL);
+static std::atomic<size_t> nLogQueueBytes(0);
+static std::atomic<uint64_t> nLogLinesDropped(0);
+static std::atomic<bool> fLogWriterRunning(false);
+static boost::condition_variable* condLogQueued = NULL;
+static boost::thread* threadLogWriter = NULL;
+//! Guarded by mutexDebugLog, as is debugLogFp
+static bool fStopLogWriter = false;
+static int64_t nDebugLogSize = 0;
+static bool fLogStartedNewLine = true;
+//! Bytes of text the log writer gathers before writing them out
+static const size_t LOG_WRITE_BATCH_BYTES = 1 << 20;
+
+int nLogRateLimit = DEFAULT_LOG_RATE_LIMIT;
+
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
     return fwrite(str.data(), 1, str.size(), fp);
@@ -189,6 +222,7 @@ static void DebugPrintInit()
 {
     assert(mutexDebugLog == NULL);
     mutexDebugLog = new boost::mutex();
+    condLogQueued = new boost::condition_variable();
     vMsgsBeforeOpenLog = new list<string>;
 }
 
@@ -197,54 +231,17 @@ boost::filesystem::path GetDebugLogPath()
     return GetDataDir() / "debug.log";
 }
 
-void OpenDebugLog()
-{
-    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
-    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-    boost::filesystem::path pathDebug = GetDebugLogPath();
-    assert(debugLogFp == NULL);
-    assert(vMsgsBeforeOpenLog);
-    debugLogFp = fopen(pathDebug.string().c_str(), "a");
-    if (debugLogFp)
-        setbuf(debugLogFp, NULL); // unbuffered
-
-    // dump buffered messages from before we opened the log
-    while (!vMsgsBeforeOpenLog->empty()) {
-        FileWriteStr(vMsgsBeforeOpenLog->front(), debugLogFp);
-        vMsgsBeforeOpenLog->pop_front();
-    }
-
-    delete vMsgsBeforeOpenLog;
-    vMsgsBeforeOpenLog = NULL;
-}
-
-bool LogAcceptCategory(const char* category)
+/** Open debug.log to append to, noting its size; mutexDebugLog held */
+static FILE* OpenDebugLogFile(FILE* fileReopen = NULL)
 {
-    if (category != NULL)
-    {
-        if (!fDebug)
-            return false;
-
-        // Give each thread quick access to -debug settings.
-        // This helps prevent issues debugging global destructors,
-        // where mapMultiArgs might be deleted before another
-        // global destructor calls LogPrint()
-        static boost::thread_specific_ptr<set<string> > ptrCategory;
-        if (ptrCategory.get() == NULL)
-        {
-            const vector<string>& categories = mapMultiArgs["-debug"];
-            ptrCategory.reset(new set<string>(categories.begin(), categories.end()));
-            // thread_specific_ptr automatically deletes the set when the thread ends.
-        }
-        const set<string>& setCategories = *ptrCategory.get();
-
-        // if not debugging everything and not debugging specific category, LogPrint does nothing.
-        if (setCategories.count(string("")) == 0 &&
-            setCategories.count(string("1")) == 0 &&
-            setCategories.count(string(category)) == 0)
-            return false;
+    std::string strPath = GetDebugLogPath().string();
+    FILE* file = fileReopen ? freopen(strPath.c_str(), "a", fileReopen) : fopen(strPath.c_str(), "a");
+    if (file) {
+        setbuf(file, NULL); // unbuffered, the writer hands over whole batches
+        fseek(file, 0, SEEK_END);
+        nDebugLogSize = ftell(file);
     }
-    return true;
+    return file;
 }
 
 /**
@@ -252,7 +249,8 @@ bool LogAcceptCategory(const char* category)
  * suppress printing of the timestamp when multiple calls are made that don't
  * end in a newline. Initialize it to true, and hold it, in the calling context.
  */
-static std::string LogTimestampStr(const std::string &str, bool *fStartedNewLine)
+static std::string LogTimestampStr(const std::string &str, bool *fStartedNewLine,
+                                   int64_t nTime, int64_t nTimeMicros, std::thread::id threadId)
 {
     string strStamped;
 
@@ -263,11 +261,11 @@ static std::string LogTimestampStr(const std::string &str, bool *fStartedNewLine
     {
         if (!fLogTimeMicros)
         {
-            strStamped =  DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()) + ' ' + str;
+            strStamped =  DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTime) + ' ' + str;
         }
         else
         {
-            strStamped =  DateTimeStrFormatMicro("%Y-%m-%d %H:%M:%S%F") + ' ' + str;
+            strStamped =  DateTimeStrFormatMicro("%Y-%m-%d %H:%M:%S%F", nTimeMicros) + strprintf(" [%s] ", threadId) + ' ' + str;
         }
     }
     else
@@ -281,10 +279,196 @@ static std::string LogTimestampStr(const std::string &str, bool *fStartedNewLine
     return strStamped;
 }
 
+/** Write text of whole lines to debug.log, moving a full file aside first; mutexDebugLog held */
+static void WriteLogBatch(const std::string& strBatch)
+{
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        if (debugLogFp)
+            debugLogFp = OpenDebugLogFile(debugLogFp);
+    }
+    // prevent log from endless growth: keep the full file as debug.log.1 and start a new one
+    if (fLimitDebugLogSize && debugLogFp && nDebugLogSize > MAX_DEBUG_LOG_SIZE) {
+        fclose(debugLogFp);
+        boost::system::error_code ec;
+        boost::filesystem::path pathDebug = GetDebugLogPath();
+        boost::filesystem::rename(pathDebug, pathDebug.string() + ".1", ec);
+        debugLogFp = OpenDebugLogFile();
+    }
+    if (debugLogFp)
+        nDebugLogSize += FileWriteStr(strBatch, debugLogFp);
+}
+
+/** Write lines taken off the queue, newest first as they were taken; mutexDebugLog held */
+static void WriteLogLines(CLogLine* plines)
+{
+    CLogLine* pordered = NULL;
+    while (plines) {
+        CLogLine* pnext = plines->pnext;
+        plines->pnext = pordered;
+        pordered = plines;
+        plines = pnext;
+    }
+
+    std::string strBatch;
+    while (pordered) {
+        strBatch += LogTimestampStr(pordered->str, &fLogStartedNewLine, pordered->nTime, pordered->nTimeMicros, pordered->threadId);
+        nLogQueueBytes -= pordered->str.size();
+        CLogLine* pnext = pordered->pnext;
+        delete pordered;
+        pordered = pnext;
+        // A writer that fell behind takes a lot at once, it still writes a bit at a time
+        if (strBatch.size() >= LOG_WRITE_BATCH_BYTES && fLogStartedNewLine) {
+            WriteLogBatch(strBatch);
+            strBatch.clear();
+        }
+    }
+    uint64_t nDropped = nLogLinesDropped.exchange(0);
+    if (nDropped > 0)
+        strBatch += LogTimestampStr(strprintf("%u lines were not logged, the log writer fell behind\n", nDropped),
+                                    &fLogStartedNewLine, GetTime(), GetTimeMicros(), std::this_thread::get_id());
+    if (!strBatch.empty())
+        WriteLogBatch(strBatch);
+}
+
+static void ThreadDebugLogWriter()
+{
+    RenameThread("horizen-log");
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    while (true) {
+        CLogLine* plines = pLogQueue.exchange(NULL);
+        if (plines) {
+            WriteLogLines(plines);
+            continue;
+        }
+        if (fStopLogWriter)
+            break;
+        // Lines are pushed without the lock, so a wakeup may be missed: never sleep long
+        condLogQueued->timed_wait(scoped_lock, boost::posix_time::milliseconds(100));
+    }
+}
+
+void OpenDebugLog()
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    assert(debugLogFp == NULL);
+    assert(vMsgsBeforeOpenLog);
+    debugLogFp = OpenDebugLogFile();
+
+    // dump buffered messages from before we opened the log
+    while (!vMsgsBeforeOpenLog->empty()) {
+        if (debugLogFp)
+            nDebugLogSize += FileWriteStr(vMsgsBeforeOpenLog->front(), debugLogFp);
+        vMsgsBeforeOpenLog->pop_front();
+    }
+
+    delete vMsgsBeforeOpenLog;
+    vMsgsBeforeOpenLog = NULL;
+
+    if (debugLogFp && !threadLogWriter) {
+        fStopLogWriter = false;
+        threadLogWriter = new boost::thread(&ThreadDebugLogWriter);
+        fLogWriterRunning = true;
+    }
+}
+
+void StopDebugLogWriter()
+{
+    if (!threadLogWriter)
+        return;
+    // Lines logged from here on are written by whoever logs them
+    fLogWriterRunning = false;
+    {
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        fStopLogWriter = true;
+    }
+    condLogQueued->notify_one();
+    threadLogWriter->join();
+    delete threadLogWriter;
+    threadLogWriter = NULL;
+
+    // Lines pushed as the writer was stopping
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    CLogLine* plines = pLogQueue.exchange(NULL);
+    if (plines)
+        WriteLogLines(plines);
+}
+
+std::atomic<uint64_t> nLogCategories(LOG_CATEGORIES_UNREAD);
+
+uint64_t GetLogCategory(const std::string& strCategory)
+{
+    for (unsigned int n = 0; n < LOG_CATEGORY_COUNT; n++)
+        if (strCategory == LOG_CATEGORIES[n])
+            return (uint64_t)1 << n;
+    return 0;
+}
+
+uint64_t ReadLogCategories()
+{
+    // Read once, so that global destructors calling LogPrint() do not need
+    // mapMultiArgs, which might be deleted by then
+    uint64_t nEnabled = 0;
+    for (const std::string& strCategory : mapMultiArgs["-debug"]) {
+        // if not debugging everything, only the categories given
+        if (strCategory == "" || strCategory == "1")
+            nEnabled = ~LOG_CATEGORIES_UNREAD;
+        else
+            nEnabled |= GetLogCategory(strCategory);
+    }
+    nLogCategories = nEnabled;
+    return nEnabled;
+}
+
+/** The lines a category logged in the current second, without a lock; categories are string literals */
+struct CLogRate {
+    std::atomic<const char*> category;
+    std::atomic<int64_t> nSecond;
+    std::atomic<uint32_t> nLines;
+    std::atomic<uint32_t> nSuppressed;
+};
+
+static const size_t LOG_RATE_SLOTS = 64;
+static CLogRate logRates[LOG_RATE_SLOTS];
+
+bool LogRateAllowed(const char* category)
+{
+    if (category == NULL || nLogRateLimit <= 0)
+        return true;
+
+    size_t nHash = 0;
+    for (const char* pch = category; *pch; pch++)
+        nHash = nHash * 31 + *pch;
+    CLogRate* prate = NULL;
+    for (size_t i = 0; i < LOG_RATE_SLOTS && !prate; i++) {
+        CLogRate& rate = logRates[(nHash + i) % LOG_RATE_SLOTS];
+        const char* pszSlot = rate.category.load();
+        if ((pszSlot == NULL && rate.category.compare_exchange_strong(pszSlot, category)) || strcmp(pszSlot, category) == 0)
+            prate = &rate;
+    }
+    if (!prate)
+        return true;
+
+    int64_t nNow = GetTimeMicros() / 1000000;
+    int64_t nSecond = prate->nSecond.load();
+    if (nSecond != nNow && prate->nSecond.compare_exchange_strong(nSecond, nNow)) {
+        prate->nLines = 0;
+        uint32_t nSuppressed = prate->nSuppressed.exchange(0);
+        if (nSuppressed > 0)
+            LogPrintStr(strprintf("%u lines of category %s were not logged, see -lograte\n", nSuppressed, category));
+    }
+    if (++prate->nLines > (uint32_t)nLogRateLimit) {
+        prate->nSuppressed++;
+        return false;
+    }
+    return true;
+}
+
 int LogPrintStr(const std::string &str)
 {
     int ret = 0; // Returns total number of characters written
-    static bool fStartedNewLine = true;
     if (fPrintToConsole)
     {
         // print to console
@@ -293,31 +477,43 @@ int LogPrintStr(const std::string &str)
     }
     else if (fPrintToDebugLog)
     {
+        if (fLogWriterRunning) {
+            // Dropping lines beats growing without bound when the disk cannot keep up
+            if (nLogQueueBytes.load() + str.size() > MAX_LOG_QUEUE_BYTES) {
+                nLogLinesDropped++;
+                return 0;
+            }
+            nLogQueueBytes += str.size();
+            CLogLine* pline = new CLogLine();
+            pline->str = str;
+            pline->nTime = GetTime();
+            pline->nTimeMicros = GetTimeMicros();
+            pline->threadId = std::this_thread::get_id();
+            // The line belongs to the writer once pushed, only the head it replaced may be looked at
+            CLogLine* phead = pLogQueue.load(std::memory_order_relaxed);
+            do {
+                pline->pnext = phead;
+            } while (!pLogQueue.compare_exchange_weak(phead, pline));
+            if (phead == NULL)
+                condLogQueued->notify_one();
+            return str.size();
+        }
+
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
         boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
 
-        string strTimestamped = LogTimestampStr(str, &fStartedNewLine);
+        string strTimestamped = LogTimestampStr(str, &fLogStartedNewLine, GetTime(), GetTimeMicros(), std::this_thread::get_id());
 
         // buffer if we haven't opened the log yet
         if (debugLogFp == NULL) {
-            assert(vMsgsBeforeOpenLog);
             ret = strTimestamped.length();
-            vMsgsBeforeOpenLog->push_back(strTimestamped);
+            if (vMsgsBeforeOpenLog)
+                vMsgsBeforeOpenLog->push_back(strTimestamped);
         }
         else
         {
-            // prevent log from endless growth
-            if (fLimitDebugLogSize)
-                ShrinkDebugFile();
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDebugLogPath();
-                if (freopen(pathDebug.string().c_str(),"a", debugLogFp) != NULL)
-                    setbuf(debugLogFp, NULL); // unbuffered
-            }
-
             ret = FileWriteStr(strTimestamped, debugLogFp);
+            nDebugLogSize += ret;
         }
     }
     return ret;
@@ -776,11 +972,20 @@ void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length) {
 #endif
 }
 
+void FileAdviseSequential(FILE *file) {
+#if defined(MAC_OSX)
+    fcntl(fileno(file), F_RDAHEAD, 1);
+#elif defined(__linux__)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    // Advisory, nothing to do elsewhere
+}
+
 void ShrinkDebugFile()
 {
     // Scroll debug.log if it's getting too big
     boost::filesystem::path pathDebug = GetDebugLogPath();
-    if (boost::filesystem::exists(pathDebug) && boost::filesystem::file_size(pathDebug) > 10 * 1000000)
+    if (boost::filesystem::exists(pathDebug) && boost::filesystem::file_size(pathDebug) > MAX_DEBUG_LOG_SIZE)
     {
         // Restart the file with some of the end
         FILE* file = fopen(pathDebug.string().c_str(), "r");
@@ -933,3 +1138,81 @@ int GetNumCores()
     return boost::thread::physical_concurrency();
 }
 
+#ifdef __linux__
+/** The first line of a file, empty if it cannot be read */
+static std::string ReadFirstLine(const char* pszPath)
+{
+    boost::filesystem::ifstream file(pszPath);
+    std::string strLine;
+    std::getline(file, strLine);
+    return strLine;
+}
+
+/** The value of key in a file of "key value" lines, such as /proc/meminfo and memory.stat; -1 if absent */
+static int64_t ReadKeyedValue(const char* pszPath, const std::string& strKey)
+{
+    boost::filesystem::ifstream file(pszPath);
+    std::string strName;
+    int64_t nValue;
+    while (file >> strName >> nValue) {
+        if (strName == strKey)
+            return nValue;
+        file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return -1;
+}
+
+/** Bytes the cgroup of the process may still charge, -1 if it is not limited */
+static int64_t GetCgroupMemoryHeadroom()
+{
+    int64_t nLimit, nUsage, nInactiveFile;
+    // cgroup v2, then v1; in a container the cgroup of the process is mounted there
+    std::string strLimit = ReadFirstLine("/sys/fs/cgroup/memory.max");
+    if (!strLimit.empty()) {
+        if (strLimit == "max" || !ParseInt64(strLimit, &nLimit) || !ParseInt64(ReadFirstLine("/sys/fs/cgroup/memory.current"), &nUsage))
+            return -1;
+        nInactiveFile = ReadKeyedValue("/sys/fs/cgroup/memory.stat", "inactive_file");
+    } else {
+        // v1 has no word for no limit, but a huge number
+        if (!ParseInt64(ReadFirstLine("/sys/fs/cgroup/memory/memory.limit_in_bytes"), &nLimit) || nLimit >= (1LL << 60) ||
+            !ParseInt64(ReadFirstLine("/sys/fs/cgroup/memory/memory.usage_in_bytes"), &nUsage))
+            return -1;
+        nInactiveFile = ReadKeyedValue("/sys/fs/cgroup/memory/memory.stat", "total_inactive_file");
+    }
+    // Page cache not recently used is reclaimed before the cgroup runs short
+    return nLimit - nUsage + std::max(nInactiveFile, (int64_t)0);
+}
+#endif
+
+int64_t GetMemoryHeadroom()
+{
+#ifdef __linux__
+    int64_t nHeadroom = -1;
+    int64_t nAvailable = ReadKeyedValue("/proc/meminfo", "MemAvailable:");
+    if (nAvailable >= 0)
+        nHeadroom = nAvailable * 1024;
+    int64_t nCgroupHeadroom = GetCgroupMemoryHeadroom();
+    if (nCgroupHeadroom >= 0 && (nHeadroom < 0 || nCgroupHeadroom < nHeadroom))
+        nHeadroom = nCgroupHeadroom;
+    return nHeadroom;
+#else
+    return -1;
+#endif
+}
+
+double GetMemoryPressure()
+{
+#ifdef __linux__
+    // The pressure stall information of the cgroup, else of the system: "some avg10=1.23 avg60=..."
+    std::string strLine = ReadFirstLine("/sys/fs/cgroup/memory.pressure");
+    if (strLine.empty())
+        strLine = ReadFirstLine("/proc/pressure/memory");
+    size_t nPos = strLine.find("avg10=");
+    if (strLine.compare(0, 5, "some ") != 0 || nPos == std::string::npos)
+        return -1;
+    return atof(strLine.c_str() + nPos + 6);
+#else
+    return -1;
+#endif
+}
+
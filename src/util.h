@@ -21,8 +21,10 @@
 #include <atomic>
 #include <exception>
 #include <map>
+#include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
@@ -32,6 +34,12 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+//! Lines per second logged of each -debug category, 0 for no limit
+static const int DEFAULT_LOG_RATE_LIMIT = 0;
+//! Bytes of lines waiting for the log writer past which more are dropped
+static const size_t MAX_LOG_QUEUE_BYTES = 64 << 20;
+//! Size past which debug.log is moved to debug.log.1, with -limitdebuglogsize
+static const int64_t MAX_DEBUG_LOG_SIZE = 10 * 1000000;
 
 /** Signals for translation. */
 class CTranslationInterface
@@ -53,6 +61,7 @@ extern bool fLogTimestamps;
 extern bool fLogTimeMicros;
 extern bool fLogIPs;
 extern std::atomic<bool> fReopenDebugLog;
+extern int nLogRateLimit;
 extern CTranslationInterface translationInterface;
 
 /**
@@ -68,11 +77,72 @@ inline std::string _(const char* psz)
 void SetupEnvironment();
 bool SetupNetworking();
 
-/** Return true if log accepts specified category */
-bool LogAcceptCategory(const char* category);
+/**
+ * The -debug categories. LogPrint looks its category up here as the call is
+ * compiled, so that telling whether the category is enabled costs a test of
+ * one bit of nLogCategories, and the line is not formatted at all when it is
+ * not. A LogPrint of a category not listed does not compile.
+ */
+constexpr const char* LOG_CATEGORIES[] = {
+    "addrman", "alert", "amqp", "bench", "cbh", "cmpctblock", "coindb", "db", "estimatefee", "forks",
+    "http", "libevent", "lock", "mempool", "mmap", "net", "partitioncheck", "paymentdisclosure", "pow",
+    "proxy", "prune", "py", "rand", "reindex", "rpc", "selectcoins", "stratum", "tls", "tor", "zmq", "zrpc",
+    "zrpcunsafe",
+};
+static const unsigned int LOG_CATEGORY_COUNT = sizeof(LOG_CATEGORIES) / sizeof(LOG_CATEGORIES[0]);
+//! Set in nLogCategories until -debug has been read into it
+static const uint64_t LOG_CATEGORIES_UNREAD = (uint64_t)1 << 63;
+
+constexpr bool LogCategoryEqual(const char* a, const char* b)
+{
+    return *a == *b && (*a == '\0' || LogCategoryEqual(a + 1, b + 1));
+}
+
+/** The bit of a category of LOG_CATEGORIES, 0 for NULL, the category of LogPrintf */
+constexpr uint64_t LogCategoryFlag(const char* category, unsigned int n = 0)
+{
+    return category == NULL ? 0 :
+           n == LOG_CATEGORY_COUNT ? throw std::invalid_argument("unknown LogPrint category") :
+           LogCategoryEqual(category, LOG_CATEGORIES[n]) ? (uint64_t)1 << n : LogCategoryFlag(category, n + 1);
+}
+
+//! The bit of a category, worked out by the compiler
+#define LOG_CATEGORY(category) (std::integral_constant<uint64_t, LogCategoryFlag(category)>::value)
+
+//! The categories enabled by -debug, once debugging is first asked about
+extern std::atomic<uint64_t> nLogCategories;
+
+/** The bit of a category named at run time, 0 if there is no such category */
+uint64_t GetLogCategory(const std::string& strCategory);
+/** Read the categories of -debug into nLogCategories */
+uint64_t ReadLogCategories();
+
+/** Return true if log accepts the category of a LOG_CATEGORY bit, or 0 */
+static inline bool LogAcceptCategory(uint64_t nCategory)
+{
+    if (nCategory == 0)
+        return true;
+    if (!fDebug)
+        return false;
+    uint64_t nEnabled = nLogCategories.load(std::memory_order_relaxed);
+    if (nEnabled & LOG_CATEGORIES_UNREAD)
+        nEnabled = ReadLogCategories();
+    return (nEnabled & nCategory) != 0;
+}
+/** Return false if the category has logged -lograte lines this second already */
+bool LogRateAllowed(const char* category);
 /** Send a string to the log output */
 int LogPrintStr(const std::string &str);
 
+/**
+ * Print to debug.log if -debug=category switch is given OR category is NULL.
+ * The arguments are not evaluated when the line is not printed.
+ */
+#define LogPrint(category, ...) do {                                          \
+        if (LogAcceptCategory(LOG_CATEGORY(category)) && LogRateAllowed(category)) \
+            LogPrintStr(LogFormat(__VA_ARGS__));                                \
+    } while (0)
+
 #define LogPrintf(...) LogPrint(NULL, __VA_ARGS__)
 
 /**
@@ -80,12 +150,11 @@ int LogPrintStr(const std::string &str);
  * of this macro-based construction (see tinyformat.h).
  */
 #define MAKE_ERROR_AND_LOG_FUNC(n)                                        \
-    /**   Print to debug.log if -debug=category switch is given OR category is NULL. */ \
+    /**   The text of a LogPrint */                                         \
     template<TINYFORMAT_ARGTYPES(n)>                                          \
-    static inline int LogPrint(const char* category, const char* format, TINYFORMAT_VARARGS(n))  \
+    static inline std::string LogFormat(const char* format, TINYFORMAT_VARARGS(n))  \
     {                                                                         \
-        if(!LogAcceptCategory(category)) return 0;                            \
-        return LogPrintStr(tfm::format(format, TINYFORMAT_PASSARGS(n))); \
+        return tfm::format(format, TINYFORMAT_PASSARGS(n));                 \
     }                                                                         \
     /**   Log error and return false */                                        \
     template<TINYFORMAT_ARGTYPES(n)>                                          \
@@ -101,10 +170,9 @@ TINYFORMAT_FOREACH_ARGNUM(MAKE_ERROR_AND_LOG_FUNC)
  * Zero-arg versions of logging and error, these are not covered by
  * TINYFORMAT_FOREACH_ARGNUM
  */
-static inline int LogPrint(const char* category, const char* format)
+static inline std::string LogFormat(const char* format)
 {
-    if(!LogAcceptCategory(category)) return 0;
-    return LogPrintStr(format);
+    return format;
 }
 static inline bool error(const char* format)
 {
@@ -120,6 +188,8 @@ void FileCommit(FILE *fileout);
 bool TruncateFile(FILE *file, unsigned int length);
 int RaiseFileDescriptorLimit(int nMinFD);
 void AllocateFileRange(FILE *file, unsigned int offset, unsigned int length);
+/** Hint that a file is about to be read through from its start, so the OS reads further ahead */
+void FileAdviseSequential(FILE *file);
 bool RenameOver(boost::filesystem::path src, boost::filesystem::path dest);
 bool TryCreateDirectory(const boost::filesystem::path& p);
 boost::filesystem::path GetDefaultDataDir();
@@ -139,7 +209,10 @@ void ReadConfigFile(std::map<std::string, std::string>& mapSettingsRet, std::map
 boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 boost::filesystem::path GetTempPath();
+/** Open debug.log, and start the thread writing the lines logged to it */
 void OpenDebugLog();
+/** Write the lines still queued and stop the writer; later lines are written as they are logged */
+void StopDebugLogWriter();
 void ShrinkDebugFile();
 void runCommand(const std::string& strCommand);
 const boost::filesystem::path GetExportDir();
@@ -228,6 +301,19 @@ std::string HelpMessageOpt(const std::string& option, const std::string& message
  */
 int GetNumCores();
 
+/**
+ * Bytes of memory the process may still take before the system, or the cgroup
+ * it is limited to, runs short; -1 if unknown. Page cache that can be
+ * reclaimed counts as free.
+ */
+int64_t GetMemoryHeadroom();
+
+/**
+ * Percentage of the last 10 seconds in which some tasks of the cgroup of the
+ * process, or of the system, stalled waiting for memory; -1 if unknown.
+ */
+double GetMemoryPressure();
+
 void SetThreadPriority(int nPriority);
 void RenameThread(const char* name);
 
@@ -12,6 +12,16 @@
 #include <errno.h>
 #include <limits>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ENABLE_HEX_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__)
+#define ENABLE_HEX_NEON 1
+#include <arm_neon.h>
+#endif
+
 using namespace std;
 
 string SanitizeString(const string& str)
@@ -69,20 +79,236 @@ signed char HexDigit(char c)
     return p_util_hexdigit[(unsigned char)c];
 }
 
+namespace {
+
+const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                          '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+
+/** Scalar codecs, for CPUs without vector units and for the tails of the vector ones */
+void HexEncodeScalar(const unsigned char* data, size_t len, char* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        out[2 * i] = hexmap[data[i] >> 4];
+        out[2 * i + 1] = hexmap[data[i] & 15];
+    }
+}
+
+size_t HexDecodeScalar(const char* psz, size_t len, unsigned char* out)
+{
+    size_t i = 0;
+    for (; i < len / 2; i++) {
+        signed char hi = HexDigit(psz[2 * i]);
+        signed char lo = HexDigit(psz[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            break;
+        out[i] = (hi << 4) | lo;
+    }
+    return i;
+}
+
+#ifdef ENABLE_HEX_X86
+
+#define HEX_SSSE3 __attribute__((target("ssse3")))
+#define HEX_AVX2 __attribute__((target("avx2")))
+
+/** Nibble values of 16 characters, and whether all of them are hex digits */
+HEX_SSSE3 inline __m128i Nibbles128(__m128i c, bool& fValid)
+{
+    // '0'..'9' minus '0', and 'a'..'f' or 'A'..'F' minus 'a' once lowercased,
+    // land in 0..9 respectively 0..5; everything else wraps above
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i fDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i fLetter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+    fValid = _mm_movemask_epi8(_mm_or_si128(fDigit, fLetter)) == 0xFFFF;
+    return _mm_or_si128(_mm_and_si128(fDigit, d), _mm_and_si128(fLetter, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+HEX_SSSE3 void HexEncodeSSSE3(const unsigned char* data, size_t len, char* out)
+{
+    const __m128i lut = _mm_loadu_si128((const __m128i*)hexmap);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(in, mask));
+        _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    HexEncodeScalar(data + i, len - i, out + 2 * i);
+}
+
+HEX_SSSE3 size_t HexDecodeSSSE3(const char* psz, size_t len, unsigned char* out)
+{
+    // Each pair of nibbles becomes 16 * hi + lo in one multiply-add
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; 2 * i + 32 <= len; i += 16) {
+        bool fValid0, fValid1;
+        __m128i n0 = Nibbles128(_mm_loadu_si128((const __m128i*)(psz + 2 * i)), fValid0);
+        __m128i n1 = Nibbles128(_mm_loadu_si128((const __m128i*)(psz + 2 * i + 16)), fValid1);
+        if (!fValid0 || !fValid1)
+            break;
+        __m128i b0 = _mm_maddubs_epi16(n0, weights);
+        __m128i b1 = _mm_maddubs_epi16(n1, weights);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(b0, b1));
+    }
+    return i + HexDecodeScalar(psz + 2 * i, len - 2 * i, out + i);
+}
+
+HEX_AVX2 inline __m256i Nibbles256(__m256i c, bool& fValid)
+{
+    __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i fDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i fLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+    fValid = _mm256_movemask_epi8(_mm256_or_si256(fDigit, fLetter)) == -1;
+    return _mm256_or_si256(_mm256_and_si256(fDigit, d), _mm256_and_si256(fLetter, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+}
+
+HEX_AVX2 void HexEncodeAVX2(const unsigned char* data, size_t len, char* out)
+{
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hexmap));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(in, mask));
+        // Unpacking works within 128-bit lanes: bytes 0-7 and 16-23, then 8-15 and 24-31
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*)(out + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    HexEncodeSSSE3(data + i, len - i, out + 2 * i);
+}
+
+HEX_AVX2 size_t HexDecodeAVX2(const char* psz, size_t len, unsigned char* out)
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; 2 * i + 64 <= len; i += 32) {
+        bool fValid0, fValid1;
+        __m256i n0 = Nibbles256(_mm256_loadu_si256((const __m256i*)(psz + 2 * i)), fValid0);
+        __m256i n1 = Nibbles256(_mm256_loadu_si256((const __m256i*)(psz + 2 * i + 32)), fValid1);
+        if (!fValid0 || !fValid1)
+            break;
+        // Packing works within 128-bit lanes too, so put the quarters back in order
+        __m256i b = _mm256_packus_epi16(_mm256_maddubs_epi16(n0, weights), _mm256_maddubs_epi16(n1, weights));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_permute4x64_epi64(b, 0xD8));
+    }
+    return i + HexDecodeSSSE3(psz + 2 * i, len - 2 * i, out + i);
+}
+
+enum HexImplementation { HEX_SCALAR, HEX_SSSE3_IMPL, HEX_AVX2_IMPL };
+
+HexImplementation DetectHex()
+{
+    if (__builtin_cpu_supports("avx2"))
+        return HEX_AVX2_IMPL;
+    if (__builtin_cpu_supports("ssse3"))
+        return HEX_SSSE3_IMPL;
+    return HEX_SCALAR;
+}
+
+//! Zero, the scalar codec, for anything encoded before static initialization gets here
+const HexImplementation hexImpl = DetectHex();
+
+#endif // ENABLE_HEX_X86
+
+#ifdef ENABLE_HEX_NEON
+
+void HexEncodeNEON(const unsigned char* data, size_t len, char* out)
+{
+    const uint8x16_t lut = vld1q_u8((const uint8_t*)hexmap);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t in = vld1q_u8(data + i);
+        uint8x16x2_t chars;
+        chars.val[0] = vqtbl1q_u8(lut, vshrq_n_u8(in, 4));
+        chars.val[1] = vqtbl1q_u8(lut, vandq_u8(in, vdupq_n_u8(0x0f)));
+        vst2q_u8((uint8_t*)(out + 2 * i), chars);
+    }
+    HexEncodeScalar(data + i, len - i, out + 2 * i);
+}
+
+size_t HexDecodeNEON(const char* psz, size_t len, unsigned char* out)
+{
+    size_t i = 0;
+    for (; 2 * i + 32 <= len; i += 16) {
+        // Split the high and low characters of each pair
+        uint8x16x2_t c = vld2q_u8((const uint8_t*)(psz + 2 * i));
+        uint8x16_t n[2];
+        uint8x16_t fValid = vdupq_n_u8(0xff);
+        for (int j = 0; j < 2; j++) {
+            uint8x16_t d = vsubq_u8(c.val[j], vdupq_n_u8('0'));
+            uint8x16_t l = vsubq_u8(vorrq_u8(c.val[j], vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+            uint8x16_t fDigit = vcleq_u8(d, vdupq_n_u8(9));
+            uint8x16_t fLetter = vcleq_u8(l, vdupq_n_u8(5));
+            fValid = vandq_u8(fValid, vorrq_u8(fDigit, fLetter));
+            n[j] = vorrq_u8(vandq_u8(fDigit, d), vandq_u8(fLetter, vaddq_u8(l, vdupq_n_u8(10))));
+        }
+        if (vminvq_u8(fValid) != 0xff)
+            break;
+        vst1q_u8(out + i, vorrq_u8(vshlq_n_u8(n[0], 4), n[1]));
+    }
+    return i + HexDecodeScalar(psz + 2 * i, len - 2 * i, out + i);
+}
+
+#endif // ENABLE_HEX_NEON
+
+} // anon namespace
+
+void HexEncode(const unsigned char* data, size_t len, char* out)
+{
+#if defined(ENABLE_HEX_X86)
+    if (hexImpl == HEX_AVX2_IMPL)
+        return HexEncodeAVX2(data, len, out);
+    if (hexImpl == HEX_SSSE3_IMPL)
+        return HexEncodeSSSE3(data, len, out);
+#elif defined(ENABLE_HEX_NEON)
+    return HexEncodeNEON(data, len, out);
+#endif
+    HexEncodeScalar(data, len, out);
+}
+
+size_t HexDecode(const char* psz, size_t len, unsigned char* out)
+{
+#if defined(ENABLE_HEX_X86)
+    if (hexImpl == HEX_AVX2_IMPL)
+        return HexDecodeAVX2(psz, len, out);
+    if (hexImpl == HEX_SSSE3_IMPL)
+        return HexDecodeSSSE3(psz, len, out);
+#elif defined(ENABLE_HEX_NEON)
+    return HexDecodeNEON(psz, len, out);
+#endif
+    return HexDecodeScalar(psz, len, out);
+}
+
 bool IsHex(const string& str)
 {
-    for(std::string::const_iterator it(str.begin()); it != str.end(); ++it)
-    {
-        if (HexDigit(*it) < 0)
+    if (str.empty() || str.size() % 2 != 0)
+        return false;
+    unsigned char buf[256];
+    for (size_t pos = 0; pos < str.size(); pos += 2 * sizeof(buf)) {
+        size_t len = std::min(str.size() - pos, 2 * sizeof(buf));
+        if (HexDecode(str.data() + pos, len, buf) != len / 2)
             return false;
     }
-    return (str.size() > 0) && (str.size()%2 == 0);
+    return true;
 }
 
-vector<unsigned char> ParseHex(const char* psz)
+/** Decode psz, of length len, straight into the result; only a stretch that is not plain hex goes through the byte loop */
+static vector<unsigned char> ParseHex(const char* psz, size_t len)
 {
-    // convert hex dump to vector
-    vector<unsigned char> vch;
+    vector<unsigned char> vch(len / 2);
+    size_t n = vch.empty() ? 0 : HexDecode(psz, len, &vch[0]);
+    vch.resize(n);
+    psz += 2 * n;
+
+    // convert the rest of the hex dump, where bytes may be separated by spaces
     while (true)
     {
         while (isspace(*psz))
@@ -100,9 +326,14 @@ vector<unsigned char> ParseHex(const char* psz)
     return vch;
 }
 
+vector<unsigned char> ParseHex(const char* psz)
+{
+    return ParseHex(psz, strlen(psz));
+}
+
 vector<unsigned char> ParseHex(const string& str)
 {
-    return ParseHex(str.c_str());
+    return ParseHex(str.c_str(), str.size());
 }
 
 string EncodeBase64(const unsigned char* pch, size_t len)
@@ -9,6 +9,7 @@
 #ifndef BITCOIN_UTILSTRENCODINGS_H
 #define BITCOIN_UTILSTRENCODINGS_H
 
+#include <algorithm>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -28,6 +29,14 @@ std::vector<unsigned char> ParseHex(const char* psz);
 std::vector<unsigned char> ParseHex(const std::string& str);
 signed char HexDigit(char c);
 bool IsHex(const std::string& str);
+/** Write the 2 * len lowercase hex digits of data to out, with SSSE3, AVX2 or NEON where the CPU has them */
+void HexEncode(const unsigned char* data, size_t len, char* out);
+/**
+ * Decode the pairs of hex digits at the start of the len characters at psz
+ * into out, which must have room for len / 2 bytes, up to the first pair that
+ * is not hex. Returns the number of bytes written.
+ */
+size_t HexDecode(const char* psz, size_t len, unsigned char* out);
 std::vector<unsigned char> DecodeBase64(const char* p, bool* pfInvalid = NULL);
 std::string DecodeBase64(const std::string& str);
 std::string EncodeBase64(const unsigned char* pch, size_t len);
@@ -68,6 +77,22 @@ template<typename T>
 std::string HexStr(const T itbegin, const T itend, bool fSpaces=false)
 {
     std::string rv;
+    if (!fSpaces) {
+        // Encode straight into the result, a block at a time
+        rv.resize((itend-itbegin)*2);
+        unsigned char buf[256];
+        size_t pos = 0;
+        for(T it = itbegin; it < itend; )
+        {
+            size_t len = std::min((size_t)(itend-it), sizeof(buf));
+            std::copy(it, it + len, buf);
+            HexEncode(buf, len, &rv[pos]);
+            it += len;
+            pos += 2*len;
+        }
+        return rv;
+    }
+
     static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
     rv.reserve((itend-itbegin)*3);
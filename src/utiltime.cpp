@@ -10,11 +10,10 @@
 #include "utiltime.h"
 
 #include <chrono>
+#include <boost/date_time/c_local_time_adjustor.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 
-#include <thread>
-
 using namespace std;
 
 static int64_t nMockTime = 0;  //! For unit testing
@@ -58,7 +57,7 @@ std::string DateTimeStrFormat(const char* pszFormat, int64_t nTime)
     return ss.str();
 }
 
-std::string DateTimeStrFormatMicro(const char* pszFormat)
+std::string DateTimeStrFormatMicro(const char* pszFormat, int64_t nTimeMicros)
 {
     std::stringstream   ss;
 
@@ -68,8 +67,8 @@ std::string DateTimeStrFormatMicro(const char* pszFormat)
             std::locale::classic(),
             new boost::posix_time::time_facet(pszFormat) ));
 
-    ss << boost::posix_time::microsec_clock::local_time();
-
-    ss << " [" << std::this_thread::get_id() << "] ";
+    boost::posix_time::ptime time = boost::posix_time::from_time_t(nTimeMicros / 1000000) +
+                                    boost::posix_time::microseconds(nTimeMicros % 1000000);
+    ss << boost::date_time::c_local_adjustor<boost::posix_time::ptime>::utc_to_local(time);
     return ss.str();
 }
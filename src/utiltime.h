@@ -16,6 +16,7 @@ void SetMockTime(int64_t nMockTimeIn);
 void MilliSleep(int64_t n);
 
 std::string DateTimeStrFormat(const char* pszFormat, int64_t nTime);
-std::string DateTimeStrFormatMicro(const char* pszFormat);
+/** Format a time in microseconds since the epoch as local time */
+std::string DateTimeStrFormatMicro(const char* pszFormat, int64_t nTimeMicros);
 
 #endif // BITCOIN_UTILTIME_H
@@ -8,6 +8,8 @@
 
 #include <boost/signals2/signal.hpp>
 
+#include <vector>
+
 #include "zcash/IncrementalMerkleTree.hpp"
 
 class CBlock;
@@ -28,13 +30,26 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
+/** Push several updated transactions to all registered wallets at once */
+void SyncWithWallets(const std::vector<CTransaction>& vtx, const CBlock* pblock = NULL);
 
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
+    /** Several transactions at once, override to handle them under one lock; one SyncTransaction each by default. */
+    virtual void SyncTransactions(const std::vector<CTransaction> &vtx, const CBlock *pblock);
     virtual void EraseFromWallet(const uint256 &hash) {}
     virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, ZCIncrementalMerkleTree tree, bool added) {}
+    /**
+     * A block became the tip, knocking the mempool transactions vtxConflicted out;
+     * tree is the commitment tree before it. Override to handle the whole block at
+     * once; by default the conflicted and the block transactions go to
+     * SyncTransactions, then the block to ChainTip.
+     */
+    virtual void BlockConnected(const CBlock &block, const CBlockIndex *pindex, const std::vector<CTransaction> &vtxConflicted, const ZCIncrementalMerkleTree &tree);
+    /** The tip block was disconnected, tree is the commitment tree without it; the reverse of BlockConnected. */
+    virtual void BlockDisconnected(const CBlock &block, const CBlockIndex *pindex, const ZCIncrementalMerkleTree &tree);
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
@@ -50,12 +65,18 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
+    /** Notifies listeners of several updated transactions at once, all with the same block. */
+    boost::signals2::signal<void (const std::vector<CTransaction> &, const CBlock *)> SyncTransactions;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a change to the tip of the active block chain. */
     boost::signals2::signal<void (const CBlockIndex *, const CBlock *, ZCIncrementalMerkleTree, bool)> ChainTip;
+    /** Notifies listeners of a block connected to the tip, with the mempool transactions it conflicted. */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *, const std::vector<CTransaction> &, const ZCIncrementalMerkleTree &)> BlockConnected;
+    /** Notifies listeners of the tip block being disconnected. */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *, const ZCIncrementalMerkleTree &)> BlockDisconnected;
     /** Notifies listeners of a new active block chain. */
     boost::signals2::signal<void (const CBlockLocator &)> SetBestChain;
     /** Notifies listeners about an inventory item being seen on the network. */
@@ -57,7 +57,7 @@ AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
         CAmount fee,
         UniValue contextInfo,
         bool sendChangeToSource) :
-        tx_(contextualTx), fromaddress_(fromAddress), t_outputs_(tOutputs), z_outputs_(zOutputs), mindepth_(minDepth), fee_(fee), contextinfo_(contextInfo), sendChangeToSource_(sendChangeToSource)
+        pwallet_(GetWalletForJSONRPCRequest()), requesturi_(GetRPCRequestURI()), tx_(contextualTx), fromaddress_(fromAddress), t_outputs_(tOutputs), z_outputs_(zOutputs), mindepth_(minDepth), fee_(fee), contextinfo_(contextInfo), sendChangeToSource_(sendChangeToSource)
 {
     assert(fee_ >= 0);
 
@@ -84,7 +84,7 @@ AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
 
             // We don't need to lock on the wallet as spending key related methods are thread-safe
             SpendingKey key;
-            if (!pwalletMain->GetSpendingKey(addr, key)) {
+            if (!pwallet_->GetSpendingKey(addr, key)) {
                 throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid from address, no spending key found for zaddr");
             }
 
@@ -101,7 +101,7 @@ AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
     }
 
     // Log the context info i.e. the call parameters to z_sendmany
-    if (LogAcceptCategory("zrpcunsafe")) {
+    if (LogAcceptCategory(LOG_CATEGORY("zrpcunsafe"))) {
         LogPrint("zrpcunsafe", "%s: z_sendmany initialized (params=%s)\n", getId(), contextInfo.write());
     } else {
         LogPrint("zrpc", "%s: z_sendmany initialized\n", getId());
@@ -116,6 +116,9 @@ AsyncRPCOperation_sendmany::~AsyncRPCOperation_sendmany() {
 }
 
 void AsyncRPCOperation_sendmany::main() {
+    // signrawtransaction has to find the keys in the same wallet
+    SetRPCRequestURI(requesturi_);
+
     if (isCancelled())
         return;
 
@@ -177,17 +180,21 @@ void AsyncRPCOperation_sendmany::main() {
     }
     LogPrintf("%s",s);
 
+    unlock_utxos(); // clean up
+    unlock_notes(); // clean up
+
     // !!! Payment disclosure START
     if (success && paymentDisclosureMode && paymentDisclosureData_.size()>0) {
         uint256 txidhash = tx_.GetHash();
         std::shared_ptr<PaymentDisclosureDB> db = PaymentDisclosureDB::sharedInstance();
-        for (PaymentDisclosureKeyInfo p : paymentDisclosureData_) {
+        for (PaymentDisclosureKeyInfo& p : paymentDisclosureData_)
             p.first.hash = txidhash;
-            if (!db->Put(p.first, p.second)) {
-                LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing entry to database for key %s\n", getId(), p.first.ToString());
-            } else {
+        // Written in the background, in one batch with the entries of other operations
+        if (!db->PutAsync(paymentDisclosureData_)) {
+            LogPrint("paymentdisclosure", "%s: Payment Disclosure: Error writing %u entries to database\n", getId(), paymentDisclosureData_.size());
+        } else {
+            for (const PaymentDisclosureKeyInfo& p : paymentDisclosureData_)
                 LogPrint("paymentdisclosure", "%s: Payment Disclosure: Successfully added entry to database for key %s\n", getId(), p.first.ToString());
-            }
         }
     }
     // !!! Payment disclosure END
@@ -196,7 +203,7 @@ void AsyncRPCOperation_sendmany::main() {
 // Notes:
 // 1. #1159 Currently there is no limit set on the number of joinsplits, so size of tx could be invalid.
 // 2. #1360 Note selection is not optimal
-// 3. #1277 Spendable notes are not locked, so an operation running in parallel could also try to use them
+// 3. #1277 Inputs are locked while they are found, so operations running in parallel select different ones
 bool AsyncRPCOperation_sendmany::main_impl() {
 
     assert(isfromtaddr_ != isfromzaddr_);
@@ -304,8 +311,11 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 FormatMoney(t_inputs_total), FormatMoney(dustThreshold - dustChange), FormatMoney(dustChange), FormatMoney(dustThreshold)));
         }
 
+        // Release the utxos which were not selected
+        unlock_utxos();
         t_inputs_ = selectedTInputs;
         t_inputs_total = selectedUTXOAmount;
+        lock_utxos();
 
         // Check mempooltxinputlimit to avoid creating a transaction which the local mempool rejects
         size_t limit = (size_t)GetArg("-mempooltxinputlimit", 0);
@@ -328,8 +338,12 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         tx_ = CTransaction(rawTx);
     }
 
-    LogPrint((isfromtaddr_) ? "zrpc" : "zrpcunsafe", "%s: spending %s to send %s with fee %s\n",
-            getId(), FormatMoney(targetAmount), FormatMoney(sendAmount), FormatMoney(minersFee));
+    if (isfromtaddr_)
+        LogPrint("zrpc", "%s: spending %s to send %s with fee %s\n",
+                getId(), FormatMoney(targetAmount), FormatMoney(sendAmount), FormatMoney(minersFee));
+    else
+        LogPrint("zrpcunsafe", "%s: spending %s to send %s with fee %s\n",
+                getId(), FormatMoney(targetAmount), FormatMoney(sendAmount), FormatMoney(minersFee));
     LogPrint("zrpc", "%s: transparent input: %s (to choose from)\n", getId(), FormatMoney(t_inputs_total));
     LogPrint("zrpcunsafe", "%s: private input: %s (to choose from)\n", getId(), FormatMoney(z_inputs_total));
     LogPrint("zrpc", "%s: transparent output: %s\n", getId(), FormatMoney(t_outputs_total));
@@ -385,6 +399,14 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             break;
         }
     }
+    // Release the notes which were not selected
+    if (zInputsDeque.size() < z_inputs_.size()) {
+        LOCK(pwallet_->cs_wallet);
+        for (size_t i = zInputsDeque.size(); i < z_inputs_.size(); i++) {
+            pwallet_->UnlockNote(std::get<0>(z_inputs_[i]));
+        }
+        z_inputs_.resize(zInputsDeque.size());
+    }
     std::deque<SendManyRecipient> zOutputsDeque;
     for (auto o : z_outputs_) {
         zOutputsDeque.push_back(o);
@@ -394,13 +416,13 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     // change upon arrival of new blocks which contain joinsplit transactions.  This is likely
     // to happen as creating a chained joinsplit transaction can take longer than the block interval.
     if (z_inputs_.size() > 0) {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
+        LOCK2(cs_main, pwallet_->cs_wallet);
         for (auto t : z_inputs_) {
             JSOutPoint jso = std::get<0>(t);
             std::vector<JSOutPoint> vOutPoints = { jso };
             uint256 inputAnchor;
             std::vector<boost::optional<ZCIncrementalWitness>> vInputWitnesses;
-            pwalletMain->GetNoteWitnesses(vOutPoints, vInputWitnesses, inputAnchor);
+            pwallet_->GetNoteWitnesses(vOutPoints, vInputWitnesses, inputAnchor);
             jsopWitnessAnchorMap[ jso.ToString() ] = WitnessAnchorData{ vInputWitnesses[0], inputAnchor };
         }
     }
@@ -441,7 +463,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         }
 
         // Create joinsplits, where each output represents a zaddr recipient.
-        UniValue obj(UniValue::VOBJ);
+        // They have no input notes, so they do not depend on each other.
+        std::vector<AsyncJoinSplitInfo> vInfos;
         while (zOutputsDeque.size() > 0) {
             AsyncJoinSplitInfo info;
             info.vpub_old = 0;
@@ -464,8 +487,9 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 // Funds are removed from the value pool and enter the private pool
                 info.vpub_old += value;
             }
-            obj = perform_joinsplit(info);
+            vInfos.push_back(info);
         }
+        UniValue obj = perform_joinsplits(vInfos);
         sign_send_raw_transaction(obj);
         return true;
     }
@@ -496,7 +520,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
     }
 
     // Keep track of treestate within this transaction
-    boost::unordered_map<uint256, ZCIncrementalMerkleTree, CCoinsKeyHasher> intermediates;
+    boost::unordered_map<uint256, ZCIncrementalMerkleTree, SaltedUint256Hasher> intermediates;
     std::vector<uint256> previousCommitments;
 
     while (!vpubNewProcessed) {
@@ -525,7 +549,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
         // Consume change as the first input of the JoinSplit.
         //
         if (jsChange > 0) {
-            LOCK2(cs_main, pwalletMain->cs_wallet);
+            LOCK2(cs_main, pwallet_->cs_wallet);
 
             // Update tree state with previous joinsplit
             ZCIncrementalMerkleTree tree;
@@ -612,8 +636,8 @@ bool AsyncRPCOperation_sendmany::main_impl() {
             int wtxHeight = -1;
             int wtxDepth = -1;
             {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
-                const CWalletTx& wtx = pwalletMain->mapWallet[jso.hash];
+                LOCK2(cs_main, pwallet_->cs_wallet);
+                const CWalletTx& wtx = pwallet_->mapWallet[jso.hash];
                 // Zero confirmaton notes belong to transactions which have not yet been mined
                 if (mapBlockIndex.find(wtx.hashBlock) == mapBlockIndex.end()) {
                     throw JSONRPCError(RPC_WALLET_ERROR, strprintf("mapBlockIndex does not contain block hash %s", wtx.hashBlock.ToString()));
@@ -645,9 +669,7 @@ bool AsyncRPCOperation_sendmany::main_impl() {
                 }
                 ZCIncrementalWitness w = *optionalWitness; // could use .get();
                 if (jsChange > 0) {
-                    for (const uint256& commitment : previousCommitments) {
-                        w.append(commitment);
-                    }
+                    w.append_range(previousCommitments.begin(), previousCommitments.end());
                     if (jsAnchor != w.root()) {
                         throw JSONRPCError(RPC_WALLET_ERROR, "Witness for spendable note does not have same anchor as change input");
                     }
@@ -819,9 +841,9 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
     set<CBitcoinAddress> setAddress = {fromtaddr_};
     vector<COutput> vecOutputs;
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
 
-    pwalletMain->AvailableCoins(vecOutputs, false, NULL, true, fAcceptCoinbase, fAcceptCoinbase);
+    pwallet_->AvailableCoins(vecOutputs, false, NULL, true, fAcceptCoinbase, fAcceptCoinbase);
 
     BOOST_FOREACH(const COutput& out, vecOutputs) {
         if (!out.fSpendable) {
@@ -854,6 +876,9 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
         t_inputs_.push_back(utxo);
     }
 
+    // Reserve the utxos so that operations running in parallel do not select them
+    lock_utxos();
+
     // sort in ascending order, so smaller utxos appear first
     std::sort(t_inputs_.begin(), t_inputs_.end(), [](SendManyInputUTXO i, SendManyInputUTXO j) -> bool {
         return ( std::get<2>(i) < std::get<2>(j));
@@ -866,8 +891,13 @@ bool AsyncRPCOperation_sendmany::find_utxos(bool fAcceptCoinbase=false) {
 bool AsyncRPCOperation_sendmany::find_unspent_notes() {
     std::vector<CNotePlaintextEntry> entries;
     {
-        LOCK2(cs_main, pwalletMain->cs_wallet);
-        pwalletMain->GetFilteredNotes(entries, fromaddress_, mindepth_);
+        LOCK2(cs_main, pwallet_->cs_wallet);
+        pwallet_->GetFilteredNotes(entries, fromaddress_, mindepth_, true, true, true);
+
+        // Reserve the notes so that operations running in parallel do not select them
+        for (CNotePlaintextEntry & entry : entries) {
+            pwallet_->LockNote(entry.jsop);
+        }
     }
 
     for (CNotePlaintextEntry & entry : entries) {
@@ -911,7 +941,7 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(AsyncJoinSplitInfo & info
     uint256 anchor;
     {
         LOCK(cs_main);
-        pwalletMain->GetNoteWitnesses(outPoints, witnesses, anchor);
+        pwallet_->GetNoteWitnesses(outPoints, witnesses, anchor);
     }
     return perform_joinsplit(info, witnesses, anchor);
 }
@@ -920,6 +950,71 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
         AsyncJoinSplitInfo & info,
         std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
         uint256 anchor)
+{
+    prepare_joinsplit(info, witnesses, anchor);
+    AsyncJoinSplitProof proof = prove_joinsplit(info, anchor, tx_.vjoinsplit.size());
+    return add_joinsplit_to_tx(proof);
+}
+
+/**
+ * Perform JoinSplits without input notes, which only depend on the anchor and not on
+ * each other, so their proofs are generated in parallel. They are added to the
+ * transaction in order, and the result is that of the last one.
+ */
+UniValue AsyncRPCOperation_sendmany::perform_joinsplits(std::vector<AsyncJoinSplitInfo> & infos) {
+    std::vector<boost::optional < ZCIncrementalWitness>> witnesses;
+    uint256 anchor;
+    {
+        LOCK(cs_main);
+        anchor = pcoinsTip->GetBestAnchor();    // As there are no inputs, ask the wallet for the best anchor
+    }
+    for (AsyncJoinSplitInfo & info : infos) {
+        prepare_joinsplit(info, witnesses, anchor);
+    }
+
+    size_t nFirstIndex = tx_.vjoinsplit.size();
+    std::vector<AsyncJoinSplitProof> proofs(infos.size());
+    std::vector<std::exception_ptr> errors(infos.size());
+    std::atomic<size_t> nNext(0);
+    auto prover = [&]() {
+        for (size_t i = nNext++; i < infos.size(); i = nNext++) {
+            try {
+                proofs[i] = prove_joinsplit(infos[i], anchor, nFirstIndex + i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+
+    // Each proof can itself use several threads and a lot of memory, so their number is limited
+    size_t nThreads = std::max(1, (int)GetArg("-joinsplitproverthreads", DEFAULT_JOINSPLIT_PROVER_THREADS));
+    nThreads = std::min(nThreads, infos.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nThreads; i++) {
+        threads.emplace_back(prover);
+    }
+    prover();
+    for (std::thread & t : threads) {
+        t.join();
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    for (size_t i = 0; i < infos.size(); i++) {
+        if (errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+        obj = add_joinsplit_to_tx(proofs[i]);
+    }
+    return obj;
+}
+
+/**
+ * Check the witnesses and fill in the inputs and outputs of a JoinSplit.
+ */
+void AsyncRPCOperation_sendmany::prepare_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < ZCIncrementalWitness>> & witnesses,
+        uint256 anchor)
 {
     if (anchor.IsNull()) {
         throw std::runtime_error("anchor is null");
@@ -948,12 +1043,16 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     if (info.vjsout.size() != ZC_NUM_JS_INPUTS || info.vjsin.size() != ZC_NUM_JS_OUTPUTS) {
         throw runtime_error("unsupported joinsplit input/output counts");
     }
+}
 
-    CMutableTransaction mtx(tx_);
-
+/**
+ * Generate the proof of a JoinSplit which will be at index js_index of the transaction.
+ * This does not change the transaction, so independent JoinSplits can be proven concurrently.
+ */
+AsyncJoinSplitProof AsyncRPCOperation_sendmany::prove_joinsplit(AsyncJoinSplitInfo & info, uint256 anchor, size_t js_index) {
     LogPrint("zrpcunsafe", "%s: creating joinsplit at index %d (vpub_old=%s, vpub_new=%s, in[0]=%s, in[1]=%s, out[0]=%s, out[1]=%s)\n",
             getId(),
-            tx_.vjoinsplit.size(),
+            js_index,
             FormatMoney(info.vpub_old), FormatMoney(info.vpub_new),
             FormatMoney(info.vjsin[0].note.value()), FormatMoney(info.vjsin[1].note.value()),
             FormatMoney(info.vjsout[0].value), FormatMoney(info.vjsout[1].value)
@@ -962,38 +1061,51 @@ UniValue AsyncRPCOperation_sendmany::perform_joinsplit(
     // Generate the proof, this can take over a minute.
     std::array<libzcash::JSInput, ZC_NUM_JS_INPUTS> inputs
             {info.vjsin[0], info.vjsin[1]};
-    std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> outputs
-            {info.vjsout[0], info.vjsout[1]};
-        #ifdef __APPLE__
-        std::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
-        std::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
-        #else
-        std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
-        std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
-        #endif
-
-    uint256 esk; // payment disclosure - secret
-
-    JSDescription jsdesc = JSDescription::Randomized(
-			mtx.nVersion == GROTH_TX_VERSION,
+    AsyncJoinSplitProof proof;
+    proof.outputs = {info.vjsout[0], info.vjsout[1]};
+
+    auto joinsplitStart = std::chrono::system_clock::now();
+    proof.jsdesc = JSDescription::Randomized(
+			tx_.nVersion == GROTH_TX_VERSION,
             *pzcashParams,
             joinSplitPubKey_,
             anchor,
             inputs,
-            outputs,
-            inputMap,
-            outputMap,
+            proof.outputs,
+            proof.inputMap,
+            proof.outputMap,
             info.vpub_old,
             info.vpub_new,
             !this->testmode,
-            &esk); // parameter expects pointer to esk, so pass in address
+            &proof.esk); // parameter expects pointer to esk, so pass in address
     {
         auto verifier = libzcash::ProofVerifier::Strict();
-        if (!(jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
+        if (!(proof.jsdesc.Verify(*pzcashParams, verifier, joinSplitPubKey_))) {
             throw std::runtime_error("error verifying joinsplit");
         }
     }
 
+    add_joinsplit_time(joinsplitStart);
+
+    return proof;
+}
+
+/**
+ * Add a proven JoinSplit to the transaction and sign it.
+ */
+UniValue AsyncRPCOperation_sendmany::add_joinsplit_to_tx(AsyncJoinSplitProof & proof) {
+    const JSDescription & jsdesc = proof.jsdesc;
+    const std::array<libzcash::JSOutput, ZC_NUM_JS_OUTPUTS> & outputs = proof.outputs;
+    uint256 esk = proof.esk;
+    #ifdef __APPLE__
+    const std::array<uint64_t, ZC_NUM_JS_INPUTS> & inputMap = proof.inputMap;
+    const std::array<uint64_t, ZC_NUM_JS_OUTPUTS> & outputMap = proof.outputMap;
+    #else
+    const std::array<size_t, ZC_NUM_JS_INPUTS> & inputMap = proof.inputMap;
+    const std::array<size_t, ZC_NUM_JS_OUTPUTS> & outputMap = proof.outputMap;
+    #endif
+
+    CMutableTransaction mtx(tx_);
     mtx.vjoinsplit.push_back(jsdesc);
 
     // Empty output script.
@@ -1110,7 +1222,7 @@ void AsyncRPCOperation_sendmany::add_taddr_outputs_to_tx() {
 
 void AsyncRPCOperation_sendmany::add_taddr_change_output_to_tx(CAmount amount, bool sendChangeToSource) {
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
 
     EnsureWalletIsUnlocked();
     CTxOut out;
@@ -1119,7 +1231,7 @@ void AsyncRPCOperation_sendmany::add_taddr_change_output_to_tx(CAmount amount, b
         out = CTxOut(amount, scriptPubKey);
     }
     else {
-        CReserveKey keyChange(pwalletMain);
+        CReserveKey keyChange(pwallet_);
         CPubKey vchPubKey;
         bool ret = keyChange.GetReservedKey(vchPubKey);
         if (!ret) {
@@ -1173,3 +1285,35 @@ UniValue AsyncRPCOperation_sendmany::getStatus() const {
     return obj;
 }
 
+
+/**
+ * Lock input utxos
+ */
+void AsyncRPCOperation_sendmany::lock_utxos() {
+    LOCK2(cs_main, pwallet_->cs_wallet);
+    for (auto utxo : t_inputs_) {
+        COutPoint outpt(std::get<0>(utxo), std::get<1>(utxo));
+        pwallet_->LockCoin(outpt);
+    }
+}
+
+/**
+ * Unlock input utxos
+ */
+void AsyncRPCOperation_sendmany::unlock_utxos() {
+    LOCK2(cs_main, pwallet_->cs_wallet);
+    for (auto utxo : t_inputs_) {
+        COutPoint outpt(std::get<0>(utxo), std::get<1>(utxo));
+        pwallet_->UnlockCoin(outpt);
+    }
+}
+
+/**
+ * Unlock input notes
+ */
+void AsyncRPCOperation_sendmany::unlock_notes() {
+    LOCK2(cs_main, pwallet_->cs_wallet);
+    for (auto note : z_inputs_) {
+        pwallet_->UnlockNote(std::get<0>(note));
+    }
+}
@@ -14,6 +14,7 @@
 #include "wallet.h"
 #include "paymentdisclosure.h"
 
+#include <array>
 #include <unordered_map>
 #include <tuple>
 
@@ -43,6 +44,21 @@ struct AsyncJoinSplitInfo
     CAmount vpub_new = 0;
 };
 
+// A JoinSplit which has been proven, but not yet added to the transaction.
+struct AsyncJoinSplitProof
+{
+    JSDescription jsdesc;
+    std::array<JSOutput, ZC_NUM_JS_OUTPUTS> outputs;
+    #ifdef __APPLE__
+    std::array<uint64_t, ZC_NUM_JS_INPUTS> inputMap;
+    std::array<uint64_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    #else
+    std::array<size_t, ZC_NUM_JS_INPUTS> inputMap;
+    std::array<size_t, ZC_NUM_JS_OUTPUTS> outputMap;
+    #endif
+    uint256 esk; // payment disclosure - secret
+};
+
 // A struct to help us track the witness and anchor for a given JSOutPoint
 struct WitnessAnchorData {
 	boost::optional<ZCIncrementalWitness> witness;
@@ -71,6 +87,8 @@ public:
 private:
     friend class TEST_FRIEND_AsyncRPCOperation_sendmany;    // class for unit testing
 
+    CWallet* pwallet_;         // wallet of the RPC request that created the operation
+    std::string requesturi_;   // endpoint of that request, for the RPC calls made while running
     UniValue contextinfo_;     // optional data to include in return value from getStatus()
     bool sendChangeToSource_;
 
@@ -115,8 +133,24 @@ private:
         std::vector<boost::optional < ZCIncrementalWitness>> witnesses,
         uint256 anchor);
 
+    // JoinSplits without input notes, which are proven in parallel
+    UniValue perform_joinsplits(std::vector<AsyncJoinSplitInfo> &);
+
+    void prepare_joinsplit(
+        AsyncJoinSplitInfo & info,
+        std::vector<boost::optional < ZCIncrementalWitness>> & witnesses,
+        uint256 anchor);
+    AsyncJoinSplitProof prove_joinsplit(AsyncJoinSplitInfo & info, uint256 anchor, size_t js_index);
+    UniValue add_joinsplit_to_tx(AsyncJoinSplitProof & proof);
+
     void sign_send_raw_transaction(UniValue obj);     // throws exception if there was an error
 
+    void lock_utxos();
+
+    void unlock_utxos();
+
+    void unlock_notes();
+
     // payment disclosure!
     std::vector<PaymentDisclosureKeyInfo> paymentDisclosureData_;
 };
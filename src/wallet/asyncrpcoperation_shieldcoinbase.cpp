@@ -53,7 +53,7 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
         std::string toAddress,
         CAmount fee,
         UniValue contextInfo) :
-        tx_(contextualTx), inputs_(inputs), fee_(fee), contextinfo_(contextInfo)
+        pwallet_(GetWalletForJSONRPCRequest()), requesturi_(GetRPCRequestURI()), tx_(contextualTx), inputs_(inputs), fee_(fee), contextinfo_(contextInfo)
 {
     assert(contextualTx.nVersion >= PHGR_TX_VERSION || contextualTx.nVersion == GROTH_TX_VERSION);  // transaction format version must support vjoinsplit
 
@@ -74,12 +74,15 @@ AsyncRPCOperation_shieldcoinbase::AsyncRPCOperation_shieldcoinbase(
     }
 
     // Log the context info
-    if (LogAcceptCategory("zrpcunsafe")) {
+    if (LogAcceptCategory(LOG_CATEGORY("zrpcunsafe"))) {
         LogPrint("zrpcunsafe", "%s: z_shieldcoinbase initialized (context=%s)\n", getId(), contextInfo.write());
     } else {
         LogPrint("zrpc", "%s: z_shieldcoinbase initialized\n", getId());
     }
 
+    // Shielding coinbase is bulk work, which should not delay other operations
+    set_priority(OperationPriority::LOW);
+
     // Lock UTXOs
     lock_utxos();
 }
@@ -88,6 +91,9 @@ AsyncRPCOperation_shieldcoinbase::~AsyncRPCOperation_shieldcoinbase() {
 }
 
 void AsyncRPCOperation_shieldcoinbase::main() {
+    // signrawtransaction has to find the keys in the same wallet
+    SetRPCRequestURI(requesturi_);
+
     if (isCancelled()) {
         unlock_utxos(); // clean up
         return;
@@ -323,6 +329,7 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
 
     uint256 esk;
 
+    auto joinsplitStart = std::chrono::system_clock::now();
     JSDescription jsdesc = JSDescription::Randomized(
 			mtx.nVersion == GROTH_TX_VERSION,
             *pzcashParams,
@@ -343,6 +350,8 @@ UniValue AsyncRPCOperation_shieldcoinbase::perform_joinsplit(ShieldCoinbaseJSInf
         }
     }
 
+    add_joinsplit_time(joinsplitStart);
+
     mtx.vjoinsplit.push_back(jsdesc);
 
     // Empty output script.
@@ -432,10 +441,10 @@ UniValue AsyncRPCOperation_shieldcoinbase::getStatus() const {
  * Lock input utxos
  */
  void AsyncRPCOperation_shieldcoinbase::lock_utxos() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto utxo : inputs_) {
         COutPoint outpt(utxo.txid, utxo.vout);
-        pwalletMain->LockCoin(outpt);
+        pwallet_->LockCoin(outpt);
     }
 }
 
@@ -443,9 +452,9 @@ UniValue AsyncRPCOperation_shieldcoinbase::getStatus() const {
  * Unlock input utxos
  */
 void AsyncRPCOperation_shieldcoinbase::unlock_utxos() {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet_->cs_wallet);
     for (auto utxo : inputs_) {
         COutPoint outpt(utxo.txid, utxo.vout);
-        pwalletMain->UnlockCoin(outpt);
+        pwallet_->UnlockCoin(outpt);
     }
 }
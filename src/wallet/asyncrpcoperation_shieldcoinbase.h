@@ -58,6 +58,8 @@ public:
 private:
     friend class TEST_FRIEND_AsyncRPCOperation_shieldcoinbase;    // class for unit testing
 
+    CWallet* pwallet_;         // wallet of the RPC request that created the operation
+    std::string requesturi_;   // endpoint of that request, for the RPC calls made while running
     UniValue contextinfo_;     // optional data to include in return value from getStatus()
 
     CAmount fee_;
@@ -4,11 +4,15 @@
 
 #include "crypter.h"
 
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "util.h"
 
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <thread>
 #include <vector>
 #include <boost/foreach.hpp>
 #include <openssl/aes.h>
@@ -100,30 +104,107 @@ bool CCrypter::Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingM
 }
 
 
-static bool EncryptSecret(const CKeyingMaterial& vMasterKey, const CKeyingMaterial &vchPlaintext, const uint256& nIV, std::vector<unsigned char> &vchCiphertext)
+//! Fewest keys a thread checks when a wallet is first unlocked
+static const size_t MIN_UNLOCK_CHECKS_PER_THREAD = 256;
+
+namespace {
+
+/**
+ * Encrypts or decrypts the secrets of a wallet under its master key, each
+ * with its own IV, in one cipher context: the AES key schedule is worked out
+ * once, when the direction changes, and only the IV is set for each secret.
+ * OpenSSL uses AES-NI where the CPU has it.
+ */
+class CSecretCrypter
 {
-    CCrypter cKeyCrypter;
-    std::vector<unsigned char> chIV(WALLET_CRYPTO_KEY_SIZE);
-    memcpy(&chIV[0], &nIV, WALLET_CRYPTO_KEY_SIZE);
-    if(!cKeyCrypter.SetKey(vMasterKey, chIV))
-        return false;
-    return cKeyCrypter.Encrypt(*((const CKeyingMaterial*)&vchPlaintext), vchCiphertext);
+private:
+    EVP_CIPHER_CTX* ctx;
+    CKeyingMaterial vMasterKey;
+    //! 1 while set up to encrypt, 0 to decrypt, -1 before either
+    int nEncrypting;
+
+    bool Init(int nEncrypt, const uint256& nIV)
+    {
+        unsigned char chIV[WALLET_CRYPTO_KEY_SIZE];
+        memcpy(chIV, nIV.begin(), sizeof(chIV));
+        bool fOk;
+        if (nEncrypting == nEncrypt)
+            fOk = EVP_CipherInit_ex(ctx, NULL, NULL, NULL, chIV, nEncrypt) != 0;
+        else
+            fOk = EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, &vMasterKey[0], chIV, nEncrypt) != 0;
+        nEncrypting = fOk ? nEncrypt : -1;
+        return fOk;
+    }
+
+public:
+    explicit CSecretCrypter(const CKeyingMaterial& vMasterKeyIn) : vMasterKey(vMasterKeyIn), nEncrypting(-1)
+    {
+        ctx = EVP_CIPHER_CTX_new();
+        assert(ctx);
+    }
+
+    ~CSecretCrypter()
+    {
+        EVP_CIPHER_CTX_free(ctx);
+    }
+
+    bool Encrypt(const CKeyingMaterial& vchPlaintext, const uint256& nIV, std::vector<unsigned char>& vchCiphertext)
+    {
+        if (vMasterKey.size() != WALLET_CRYPTO_KEY_SIZE)
+            return false;
+
+        // max ciphertext len for a n bytes of plaintext is
+        // n + AES_BLOCK_SIZE - 1 bytes
+        int nLen = vchPlaintext.size();
+        int nCLen = nLen + AES_BLOCK_SIZE, nFLen = 0;
+        vchCiphertext = std::vector<unsigned char>(nCLen);
+
+        bool fOk = Init(1, nIV);
+        if (fOk) fOk = EVP_EncryptUpdate(ctx, &vchCiphertext[0], &nCLen, &vchPlaintext[0], nLen) != 0;
+        if (fOk) fOk = EVP_EncryptFinal_ex(ctx, (&vchCiphertext[0]) + nCLen, &nFLen) != 0;
+        if (!fOk) return false;
+
+        vchCiphertext.resize(nCLen + nFLen);
+        return true;
+    }
+
+    bool Decrypt(const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext)
+    {
+        if (vMasterKey.size() != WALLET_CRYPTO_KEY_SIZE)
+            return false;
+
+        // plaintext will always be equal to or lesser than length of ciphertext
+        int nLen = vchCiphertext.size();
+        int nPLen = nLen, nFLen = 0;
+        vchPlaintext = CKeyingMaterial(nPLen);
+
+        bool fOk = Init(0, nIV);
+        if (fOk) fOk = EVP_DecryptUpdate(ctx, &vchPlaintext[0], &nPLen, &vchCiphertext[0], nLen) != 0;
+        if (fOk) fOk = EVP_DecryptFinal_ex(ctx, (&vchPlaintext[0]) + nPLen, &nFLen) != 0;
+        if (!fOk) return false;
+
+        vchPlaintext.resize(nPLen + nFLen);
+        return true;
+    }
+};
+
+} // anon namespace
+
+static bool EncryptSecret(CSecretCrypter& crypter, const CKeyingMaterial &vchPlaintext, const uint256& nIV, std::vector<unsigned char> &vchCiphertext)
+{
+    return crypter.Encrypt(vchPlaintext, nIV, vchCiphertext);
 }
 
-static bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext)
+static bool EncryptSecret(const CKeyingMaterial& vMasterKey, const CKeyingMaterial &vchPlaintext, const uint256& nIV, std::vector<unsigned char> &vchCiphertext)
 {
-    CCrypter cKeyCrypter;
-    std::vector<unsigned char> chIV(WALLET_CRYPTO_KEY_SIZE);
-    memcpy(&chIV[0], &nIV, WALLET_CRYPTO_KEY_SIZE);
-    if(!cKeyCrypter.SetKey(vMasterKey, chIV))
-        return false;
-    return cKeyCrypter.Decrypt(vchCiphertext, *((CKeyingMaterial*)&vchPlaintext));
+    CSecretCrypter crypter(vMasterKey);
+    return EncryptSecret(crypter, vchPlaintext, nIV, vchCiphertext);
 }
 
-static bool DecryptKey(const CKeyingMaterial& vMasterKey, const std::vector<unsigned char>& vchCryptedSecret, const CPubKey& vchPubKey, CKey& key)
+static bool DecryptKey(CSecretCrypter& crypter, const std::vector<unsigned char>& vchCryptedSecret, const CPubKey& vchPubKey, CKey& key)
 {
     CKeyingMaterial vchSecret;
-    if(!DecryptSecret(vMasterKey, vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
+    if(!crypter.Decrypt(vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
         return false;
 
     if (vchSecret.size() != 32)
@@ -133,13 +214,19 @@ static bool DecryptKey(const CKeyingMaterial& vMasterKey, const std::vector<unsi
     return key.VerifyPubKey(vchPubKey);
 }
 
-static bool DecryptSpendingKey(const CKeyingMaterial& vMasterKey,
+static bool DecryptKey(const CKeyingMaterial& vMasterKey, const std::vector<unsigned char>& vchCryptedSecret, const CPubKey& vchPubKey, CKey& key)
+{
+    CSecretCrypter crypter(vMasterKey);
+    return DecryptKey(crypter, vchCryptedSecret, vchPubKey, key);
+}
+
+static bool DecryptSpendingKey(CSecretCrypter& crypter,
                                const std::vector<unsigned char>& vchCryptedSecret,
                                const libzcash::PaymentAddress& address,
                                libzcash::SpendingKey& sk)
 {
     CKeyingMaterial vchSecret;
-    if(!DecryptSecret(vMasterKey, vchCryptedSecret, address.GetHash(), vchSecret))
+    if(!crypter.Decrypt(vchCryptedSecret, address.GetHash(), vchSecret))
         return false;
 
     if (vchSecret.size() != libzcash::SerializedSpendingKeySize)
@@ -150,6 +237,15 @@ static bool DecryptSpendingKey(const CKeyingMaterial& vMasterKey,
     return sk.address() == address;
 }
 
+static bool DecryptSpendingKey(const CKeyingMaterial& vMasterKey,
+                               const std::vector<unsigned char>& vchCryptedSecret,
+                               const libzcash::PaymentAddress& address,
+                               libzcash::SpendingKey& sk)
+{
+    CSecretCrypter crypter(vMasterKey);
+    return DecryptSpendingKey(crypter, vchCryptedSecret, address, sk);
+}
+
 bool CCryptoKeyStore::SetCrypted()
 {
     LOCK2(cs_KeyStore, cs_SpendingKeyStore);
@@ -182,38 +278,53 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
-        bool keyPass = false;
-        bool keyFail = false;
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
-        {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
+        // Once the passphrase has been checked against every key, checking
+        // one of each kind is enough
+        std::vector<const CryptedKeyMap::value_type*> vKeys;
+        for (const CryptedKeyMap::value_type& item : mapCryptedKeys) {
+            vKeys.push_back(&item);
             if (fDecryptionThoroughlyChecked)
                 break;
         }
-        CryptedSpendingKeyMap::const_iterator skmi = mapCryptedSpendingKeys.begin();
-        for (; skmi != mapCryptedSpendingKeys.end(); ++skmi)
-        {
-            const libzcash::PaymentAddress &address = (*skmi).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*skmi).second;
-            libzcash::SpendingKey sk;
-            if (!DecryptSpendingKey(vMasterKeyIn, vchCryptedSecret, address, sk))
-            {
-                keyFail = true;
-                break;
-            }
-            keyPass = true;
+        std::vector<const CryptedSpendingKeyMap::value_type*> vSpendingKeys;
+        for (const CryptedSpendingKeyMap::value_type& item : mapCryptedSpendingKeys) {
+            vSpendingKeys.push_back(&item);
             if (fDecryptionThoroughlyChecked)
                 break;
         }
+
+        // Checking a key means deriving its public key or address, which is
+        // what makes the first unlock of a large wallet slow, so the keys are
+        // shared out between threads; all stop at the first key that fails
+        std::atomic<bool> keyPass(false);
+        std::atomic<bool> keyFail(false);
+        const size_t nWork = vKeys.size() + vSpendingKeys.size();
+        auto worker = [&](size_t nFirst, size_t nStride) {
+            CSecretCrypter crypter(vMasterKeyIn);
+            for (size_t i = nFirst; i < nWork && !keyFail; i += nStride) {
+                bool fOk;
+                if (i < vKeys.size()) {
+                    CKey key;
+                    fOk = DecryptKey(crypter, vKeys[i]->second.second, vKeys[i]->second.first, key);
+                } else {
+                    const CryptedSpendingKeyMap::value_type& item = *vSpendingKeys[i - vKeys.size()];
+                    libzcash::SpendingKey sk;
+                    fOk = DecryptSpendingKey(crypter, item.second, item.first, sk);
+                }
+                if (fOk)
+                    keyPass = true;
+                else
+                    keyFail = true;
+            }
+        };
+        size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), nWork / MIN_UNLOCK_CHECKS_PER_THREAD);
+        std::vector<std::thread> threads;
+        for (size_t n = 1; n < nThreads; n++)
+            threads.emplace_back(worker, n, nThreads);
+        worker(0, std::max(nThreads, (size_t)1));
+        for (std::thread& t : threads)
+            t.join();
+
         if (keyPass && keyFail)
         {
             LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
@@ -361,13 +472,14 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
             return false;
 
         fUseCrypto = true;
+        CSecretCrypter crypter(vMasterKeyIn);
         BOOST_FOREACH(KeyMap::value_type& mKey, mapKeys)
         {
             const CKey &key = mKey.second;
             CPubKey vchPubKey = key.GetPubKey();
             CKeyingMaterial vchSecret(key.begin(), key.end());
             std::vector<unsigned char> vchCryptedSecret;
-            if (!EncryptSecret(vMasterKeyIn, vchSecret, vchPubKey.GetHash(), vchCryptedSecret))
+            if (!EncryptSecret(crypter, vchSecret, vchPubKey.GetHash(), vchCryptedSecret))
                 return false;
             if (!AddCryptedKey(vchPubKey, vchCryptedSecret))
                 return false;
@@ -381,7 +493,7 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
             CKeyingMaterial vchSecret(ss.begin(), ss.end());
             libzcash::PaymentAddress address = sk.address();
             std::vector<unsigned char> vchCryptedSecret;
-            if (!EncryptSecret(vMasterKeyIn, vchSecret, address.GetHash(), vchCryptedSecret))
+            if (!EncryptSecret(crypter, vchSecret, address.GetHash(), vchCryptedSecret))
                 return false;
             if (!AddCryptedSpendingKey(address, sk.receiving_key(), vchCryptedSecret))
                 return false;
@@ -390,3 +502,14 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
     }
     return true;
 }
+
+size_t CCryptoKeyStore::DynamicMemoryUsage() const
+{
+    size_t nUsage = CBasicKeyStore::DynamicMemoryUsage();
+    {
+        LOCK(cs_KeyStore);
+        nUsage += memusage::DynamicUsage(mapCryptedKeys);
+    }
+    LOCK(cs_SpendingKeyStore);
+    return nUsage + memusage::DynamicUsage(mapCryptedSpendingKeys);
+}
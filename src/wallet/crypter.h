@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "streams.h"
 #include "support/allocators/secure.h"
+#include "support/pagelocker.h"
 #include "zcash/Address.hpp"
 
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
@@ -229,6 +230,9 @@ public:
         }
     }
 
+    //! Memory used by the maps of keys and scripts, encrypted or not
+    size_t DynamicMemoryUsage() const;
+
     /**
      * Wallet status (encrypted, locked) changed.
      * Note: Called without locks held.
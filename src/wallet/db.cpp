@@ -39,6 +39,7 @@ void CDBEnv::EnvShutdown()
         return;
 
     fDbEnvInit = false;
+    setDetachedFiles.clear();
     int ret = dbenv->close(0);
     if (ret != 0)
         LogPrintf("CDBEnv::EnvShutdown: Error %d shutting down database environment: %s\n", ret, DbEnv::strerror(ret));
@@ -221,10 +222,12 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
     if (fMockDb)
         return;
     dbenv->lsn_reset(strFile.c_str(), 0);
+    LOCK(cs_db);
+    setDetachedFiles.insert(strFile);
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL), fModified(false)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -311,6 +314,8 @@ void CDB::Close()
     {
         LOCK(bitdb.cs_db);
         --bitdb.mapFileUseCount[strFile];
+        if (fModified)
+            bitdb.setDetachedFiles.erase(strFile);
     }
 }
 
@@ -333,6 +338,7 @@ bool CDBEnv::RemoveDb(const string& strFile)
     this->CloseDb(strFile);
 
     LOCK(cs_db);
+    setDetachedFiles.erase(strFile);
     int rc = dbenv->dbremove(NULL, strFile.c_str(), NULL, DB_AUTO_COMMIT);
     return (rc == 0);
 }
@@ -410,6 +416,8 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                     if (dbB.rename(strFileRes.c_str(), NULL, strFile.c_str(), 0))
                         fSuccess = false;
                 }
+                // The new file was written outside of the log, the next flush detaches it
+                bitdb.setDetachedFiles.erase(strFile);
                 if (!fSuccess)
                     LogPrintf("CDB::Rewrite: Failed to rewrite database file %s\n", strFileRes);
                 return fSuccess;
@@ -436,13 +444,16 @@ void CDBEnv::Flush(bool fShutdown)
             int nRefCount = (*mi).second;
             LogPrint("db", "CDBEnv::Flush: Flushing %s (refcount = %d)...\n", strFile, nRefCount);
             if (nRefCount == 0) {
-                // Move log data to the dat file
+                // Move log data to the dat file, unless it was already and the
+                // file was only read since, which spares most of the shutdown
+                // of a node that flushed its wallet in the background
                 CloseDb(strFile);
-                LogPrint("db", "CDBEnv::Flush: %s checkpoint\n", strFile);
-                dbenv->txn_checkpoint(0, 0, 0);
-                LogPrint("db", "CDBEnv::Flush: %s detach\n", strFile);
-                if (!fMockDb)
-                    dbenv->lsn_reset(strFile.c_str(), 0);
+                if (setDetachedFiles.count(strFile)) {
+                    LogPrint("db", "CDBEnv::Flush: %s already detached\n", strFile);
+                } else {
+                    LogPrint("db", "CDBEnv::Flush: %s checkpoint and detach\n", strFile);
+                    CheckpointLSN(strFile);
+                }
                 LogPrint("db", "CDBEnv::Flush: %s closed\n", strFile);
                 mapFileUseCount.erase(mi++);
             } else
@@ -11,6 +11,7 @@
 #include "sync.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -36,6 +37,8 @@ public:
     DbEnv *dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    //! Files detached from the log by CheckpointLSN and not modified since, which Flush needs not detach again
+    std::set<std::string> setDetachedFiles;
 
     CDBEnv();
     ~CDBEnv();
@@ -94,6 +97,8 @@ protected:
     DbTxn* activeTxn;
     bool fReadOnly;
     bool fFlushOnClose;
+    //! Whether anything was written or erased through this handle
+    bool fModified;
 
     explicit CDB(const std::string& strFilename, const char* pszMode = "r+", bool fFlushOnCloseIn=true);
     ~CDB() { Close(); }
@@ -148,6 +153,7 @@ protected:
             return false;
         if (fReadOnly)
             assert(!"Write called on database in read-only mode");
+        fModified = true;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
@@ -177,6 +183,7 @@ protected:
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
+        fModified = true;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
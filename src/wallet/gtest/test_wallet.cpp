@@ -15,6 +15,7 @@
 
 #include <boost/filesystem.hpp>
 
+using ::testing::Field;
 using ::testing::Return;
 
 extern ZCJoinSplit* params;
@@ -29,7 +30,9 @@ public:
     MOCK_METHOD0(TxnCommit, bool());
     MOCK_METHOD0(TxnAbort, bool());
 
-    MOCK_METHOD2(WriteTx, bool(uint256 hash, const CWalletTx& wtx));
+    MOCK_METHOD2(WriteNoteWitnessHeight, bool(const JSOutPoint& jsoutpt, int witnessHeight));
+    MOCK_METHOD3(WriteNoteWitness, bool(const JSOutPoint& jsoutpt, int nHeight, const ZCIncrementalWitness& witness));
+    MOCK_METHOD2(EraseNoteWitness, bool(const JSOutPoint& jsoutpt, int nHeight));
     MOCK_METHOD1(WriteWitnessCacheSize, bool(int64_t nWitnessCacheSize));
     MOCK_METHOD1(WriteBestBlock, bool(const CBlockLocator& loc));
 };
@@ -128,14 +131,18 @@ TEST(wallet_tests, note_data_serialisation) {
     nd.witnesses.push_front(tree.witness());
     noteData[jsoutpt] = nd;
 
+    noteData[jsoutpt].witnessHeight = 1;
+
     CDataStream ss(SER_DISK, CLIENT_VERSION);
     ss << noteData;
 
     mapNoteData_t noteData2;
     ss >> noteData2;
 
+    // The witness cache is stored in its own records
     EXPECT_EQ(noteData, noteData2);
-    EXPECT_EQ(noteData[jsoutpt].witnesses, noteData2[jsoutpt].witnesses);
+    EXPECT_EQ(0, noteData2[jsoutpt].witnesses.size());
+    EXPECT_EQ(-1, noteData2[jsoutpt].witnessHeight);
 }
 
 
@@ -235,6 +242,15 @@ TEST(wallet_tests, find_unspent_notes) {
     wallet.GetFilteredNotes(entries, "", 3, false);
     EXPECT_EQ(0, entries.size());
     entries.clear();
+    // It is found through its address, and only through it.
+    wallet.GetFilteredNotes(entries, CZCPaymentAddress(sk.address()).ToString(), 0, false);
+    EXPECT_EQ(1, entries.size());
+    EXPECT_EQ(jsoutpt, entries[0].jsop);
+    entries.clear();
+    auto sk2 = libzcash::SpendingKey::random();
+    wallet.GetFilteredNotes(entries, CZCPaymentAddress(sk2.address()).ToString(), 0, false);
+    EXPECT_EQ(0, entries.size());
+    entries.clear();
 
 
     // Let's receive a new note
@@ -908,20 +924,20 @@ TEST(wallet_tests, WriteWitnessCache) {
     EXPECT_CALL(walletdb, TxnBegin())
         .WillRepeatedly(Return(true));
 
-    // WriteTx fails
-    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+    // WriteNoteWitnessHeight fails
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, -1))
         .WillOnce(Return(false));
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
     wallet.SetBestChain(walletdb, loc);
 
-    // WriteTx throws
-    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+    // WriteNoteWitnessHeight throws
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, -1))
         .WillOnce(ThrowLogicError());
     EXPECT_CALL(walletdb, TxnAbort())
         .Times(1);
     wallet.SetBestChain(walletdb, loc);
-    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), wtx))
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, -1))
         .WillRepeatedly(Return(true));
 
     // WriteWitnessCacheSize fails
@@ -965,6 +981,104 @@ TEST(wallet_tests, WriteWitnessCache) {
 
     // Everything succeeds
     wallet.SetBestChain(walletdb, loc);
+
+    // Nothing changed since the last write
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(::testing::_, ::testing::_))
+        .Times(0);
+    wallet.SetBestChain(walletdb, loc);
+}
+
+TEST(wallet_tests, WriteWitnessCacheDeltas) {
+    TestWallet wallet;
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+    ZCIncrementalMerkleTree tree;
+
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(::testing::_))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillRepeatedly(Return(true));
+
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto jsoutpt = CreateValidBlock(wallet, sk, index1, block1, tree);
+
+    // The first write stores the witness of the note and its height
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, 1))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+
+    // A new block only adds the witness for its height
+    CBlock block2;
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    wallet.IncrementNoteWitnesses(&index2, &block2, tree);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 1, ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 2, ::testing::_))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, 2))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+
+    // Disconnecting it erases that witness
+    wallet.DecrementNoteWitnesses(&index2);
+    EXPECT_CALL(walletdb, EraseNoteWitness(jsoutpt, 2))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, 1))
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+
+    // A block replacing it before the next write overwrites the witness
+    EXPECT_CALL(walletdb, WriteNoteWitness(jsoutpt, 2, ::testing::_))
+        .Times(2).WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(jsoutpt, 2))
+        .WillOnce(Return(true));
+    wallet.IncrementNoteWitnesses(&index2, &block2, tree);
+    wallet.SetBestChain(walletdb, loc);
+    wallet.DecrementNoteWitnesses(&index2);
+    wallet.IncrementNoteWitnesses(&index2, &block2, tree);
+    wallet.SetBestChain(walletdb, loc);
+}
+
+TEST(wallet_tests, LoadNoteWitnesses) {
+    TestWallet wallet;
+    ZCIncrementalMerkleTree tree;
+
+    auto sk = libzcash::SpendingKey::random();
+    wallet.AddSpendingKey(sk);
+
+    CBlock block1;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    auto jsoutpt = CreateValidBlock(wallet, sk, index1, block1, tree);
+    auto witness = wallet.mapWallet[jsoutpt.hash].mapNoteData[jsoutpt].witnesses.front();
+
+    // Witnesses are restored from witnessHeight down while contiguous
+    std::map<int, ZCIncrementalWitness> witnesses;
+    witnesses[7] = witness;
+    witnesses[6] = witness;
+    witnesses[4] = witness;
+    {
+        LOCK(wallet.cs_wallet);
+        EXPECT_TRUE(wallet.LoadNoteWitnesses(jsoutpt, 7, witnesses));
+        EXPECT_FALSE(wallet.LoadNoteWitnesses(JSOutPoint(), 7, witnesses));
+    }
+    auto nd = wallet.mapWallet[jsoutpt.hash].mapNoteData[jsoutpt];
+    EXPECT_EQ(7, nd.witnessHeight);
+    EXPECT_EQ(2, nd.witnesses.size());
+    EXPECT_EQ(7, nd.witnessHeightOnDisk);
+    EXPECT_EQ(2, nd.witnessesOnDisk);
 }
 
 TEST(wallet_tests, UpdateNullifierNoteMap) {
@@ -1000,6 +1114,31 @@ TEST(wallet_tests, UpdateNullifierNoteMap) {
     EXPECT_EQ(wtx.GetHash(), wallet.mapNullifiersToNotes[nullifier].hash);
     EXPECT_EQ(0, wallet.mapNullifiersToNotes[nullifier].js);
     EXPECT_EQ(1, wallet.mapNullifiersToNotes[nullifier].n);
+    EXPECT_EQ(nullifier, *wallet.mapWallet[wtx.GetHash()].mapNoteData[jsoutpt].nullifier);
+    EXPECT_EQ(note.value(), *wallet.mapWallet[wtx.GetHash()].mapNoteData[jsoutpt].value);
+}
+
+TEST(wallet_tests, NoteValueSerialization) {
+    auto sk = libzcash::SpendingKey::random();
+    auto wtx = GetValidReceive(sk, 10, true);
+
+    mapNoteData_t noteData;
+    JSOutPoint jsoutpt {wtx.GetHash(), 0, 0};
+    JSOutPoint jsoutpt2 {wtx.GetHash(), 0, 1};
+    noteData[jsoutpt] = CNoteData {sk.address()};
+    noteData[jsoutpt].value = 10;
+    noteData[jsoutpt2] = CNoteData {sk.address()};
+    wtx.SetNoteData(noteData);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << wtx;
+    CWalletTx wtx2;
+    ss >> wtx2;
+
+    EXPECT_EQ(10, *wtx2.mapNoteData[jsoutpt].value);
+    EXPECT_FALSE(wtx2.mapNoteData[jsoutpt2].value);
+    EXPECT_EQ(0, wtx2.mapValue.count("notevalues"));
+    EXPECT_EQ(0, wtx.mapValue.count("notevalues"));
 }
 
 TEST(wallet_tests, UpdatedNoteData) {
@@ -1123,11 +1262,11 @@ TEST(wallet_tests, SetBestChainIgnoresTxsWithoutShieldedData) {
 
     EXPECT_CALL(walletdb, TxnBegin())
         .WillOnce(Return(true));
-    EXPECT_CALL(walletdb, WriteTx(wtxTransparent.GetHash(), wtxTransparent))
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(Field(&JSOutPoint::hash, wtxTransparent.GetHash()), ::testing::_))
         .Times(0);
-    EXPECT_CALL(walletdb, WriteTx(wtxSprout.GetHash(), wtxSprout))
-        .Times(1).WillOnce(Return(true));
-    EXPECT_CALL(walletdb, WriteTx(wtxSproutTransparent.GetHash(), wtxSproutTransparent))
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(Field(&JSOutPoint::hash, wtxSprout.GetHash()), -1))
+        .Times(wtxSprout.mapNoteData.size()).WillRepeatedly(Return(true));
+    EXPECT_CALL(walletdb, WriteNoteWitnessHeight(Field(&JSOutPoint::hash, wtxSproutTransparent.GetHash()), ::testing::_))
         .Times(0);
     EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
         .WillOnce(Return(true));
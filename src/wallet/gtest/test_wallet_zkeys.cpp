@@ -306,3 +306,70 @@ TEST(wallet_zkeys_tests, write_cryptedzkey_direct_to_db) {
 
 }
 
+
+/**
+ * This test covers methods on CWallet
+ * ImportKeys()
+ */
+TEST(wallet_zkeys_tests, ImportKeysInOneBatch) {
+    SelectParams(CBaseChainParams::TESTNET);
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    bool fFirstRun;
+    CWallet wallet("wallet.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+
+    // A key the wallet has already, and one it only has the viewing key of
+    auto skPresent = libzcash::SpendingKey::random();
+    auto skViewing = libzcash::SpendingKey::random();
+    {
+        LOCK(wallet.cs_wallet);
+        ASSERT_TRUE(wallet.AddZKey(skPresent));
+        ASSERT_TRUE(wallet.AddViewingKey(skViewing.viewing_key()));
+    }
+
+    std::vector<CImportedZKey> vZKeys;
+    for (const libzcash::SpendingKey& sk : {skPresent, skViewing, libzcash::SpendingKey::random()}) {
+        CImportedZKey zkey;
+        zkey.key = sk;
+        zkey.addr = sk.address();
+        zkey.nCreateTime = 2000 + vZKeys.size();
+        vZKeys.push_back(zkey);
+    }
+    std::vector<CImportedKey> vKeys(2);
+    for (CImportedKey& key : vKeys) {
+        key.key.MakeNewKey(true);
+        key.pubkey = key.key.GetPubKey();
+        key.nCreateTime = 1000;
+        key.fLabel = &key == &vKeys[0];
+        key.strLabel = "imported";
+    }
+
+    {
+        LOCK(wallet.cs_wallet);
+        int64_t nTimeFirst = std::numeric_limits<int64_t>::max();
+        ASSERT_TRUE(wallet.ImportKeys(vKeys, vZKeys, nTimeFirst));
+        EXPECT_EQ(1000, nTimeFirst);
+        EXPECT_FALSE(wallet.HaveViewingKey(skViewing.address()));
+    }
+
+    // Everything made it to disk, the creation times as well
+    CWallet wallet2("wallet.dat");
+    ASSERT_EQ(DB_LOAD_OK, wallet2.LoadWallet(fFirstRun));
+    LOCK(wallet2.cs_wallet);
+    for (const CImportedZKey& zkey : vZKeys)
+        EXPECT_TRUE(wallet2.HaveSpendingKey(zkey.addr));
+    EXPECT_FALSE(wallet2.HaveViewingKey(skViewing.address()));
+    EXPECT_EQ(2001, wallet2.mapZKeyMetadata[vZKeys[1].addr].nCreateTime);
+    EXPECT_EQ(2002, wallet2.mapZKeyMetadata[vZKeys[2].addr].nCreateTime);
+    for (const CImportedKey& key : vKeys) {
+        EXPECT_TRUE(wallet2.HaveKey(key.pubkey.GetID()));
+        EXPECT_EQ(1000, wallet2.mapKeyMetadata[key.pubkey.GetID()].nCreateTime);
+    }
+    ASSERT_EQ(1, wallet2.mapAddressBook.count(vKeys[0].pubkey.GetID()));
+    EXPECT_EQ("imported", wallet2.mapAddressBook[vKeys[0].pubkey.GetID()].name);
+    EXPECT_EQ(0, wallet2.mapAddressBook.count(vKeys[1].pubkey.GetID()));
+}
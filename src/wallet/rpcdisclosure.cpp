@@ -38,6 +38,8 @@ bool EnsureWalletIsAvailable(bool avoidException);
  */
 UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -69,7 +71,7 @@ UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error: payment disclosure is disabled.");
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -92,10 +94,10 @@ UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
     }
 
     // Check is mine
-    if (!pwalletMain->mapWallet.count(hash)) {
+    if (!pwallet->mapWallet.count(hash)) {
         throw JSONRPCError(RPC_MISC_ERROR, "Transaction does not belong to the wallet");
     }
-    const CWalletTx& wtx = pwalletMain->mapWallet[hash];
+    const CWalletTx& wtx = pwallet->mapWallet[hash];
 
     // Check if shielded tx
     if (wtx.vjoinsplit.empty()) {
@@ -144,6 +146,8 @@ UniValue z_getpaymentdisclosure(const UniValue& params, bool fHelp)
  */
 UniValue z_validatepaymentdisclosure(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -170,7 +174,7 @@ UniValue z_validatepaymentdisclosure(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error: payment disclosure is disabled.");
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
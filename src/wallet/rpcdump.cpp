@@ -6,6 +6,7 @@
 #include "rpc/server.h"
 #include "init.h"
 #include "main.h"
+#include "scheduler.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "sync.h"
@@ -14,9 +15,12 @@
 #include "wallet.h"
 
 #include <fstream>
+#include <limits>
 #include <stdint.h>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <univalue.h>
@@ -29,6 +33,9 @@ bool EnsureWalletIsAvailable(bool avoidException);
 UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys);
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys);
 
+//! Fewest lines of a wallet dump a thread parses on import
+static const size_t MIN_IMPORT_LINES_PER_THREAD = 64;
+
 
 std::string static EncodeDumpTime(int64_t nTime) {
     return DateTimeStrFormat("%Y-%m-%dT%H:%M:%SZ", nTime);
@@ -75,6 +82,8 @@ std::string DecodeDumpString(const std::string &str) {
 
 UniValue importprivkey(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -98,7 +107,7 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -124,24 +133,24 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
     assert(key.VerifyPubKey(pubkey));
     CKeyID vchAddress = pubkey.GetID();
     {
-        pwalletMain->MarkDirty();
-        pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
+        pwallet->MarkDirty();
+        pwallet->SetAddressBook(vchAddress, strLabel, "receive");
 
         // Don't throw error in case a key is already there
-        if (pwalletMain->HaveKey(vchAddress)) {
+        if (pwallet->HaveKey(vchAddress)) {
             return CBitcoinAddress(vchAddress).ToString();
         }
 
-        pwalletMain->mapKeyMetadata[vchAddress].nCreateTime = 1;
+        pwallet->mapKeyMetadata[vchAddress].nCreateTime = 1;
 
-        if (!pwalletMain->AddKeyPubKey(key, pubkey))
+        if (!pwallet->AddKeyPubKey(key, pubkey))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding key to wallet");
 
         // whenever a key is imported, we need to scan the whole chain
-        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+        pwallet->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
         if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+            pwallet->ScanForWalletTransactions(chainActive.Genesis(), true);
         }
     }
 
@@ -150,6 +159,8 @@ UniValue importprivkey(const UniValue& params, bool fHelp)
 
 UniValue importaddress(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -171,7 +182,7 @@ UniValue importaddress(const UniValue& params, bool fHelp)
             + HelpExampleRpc("importaddress", "\"myaddress\", \"testing\", false")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     CScript script;
 
@@ -195,26 +206,26 @@ UniValue importaddress(const UniValue& params, bool fHelp)
         fRescan = params[2].get_bool();
 
     {
-        if (::IsMine(*pwalletMain, script) == ISMINE_SPENDABLE)
+        if (::IsMine(*pwallet, script) == ISMINE_SPENDABLE)
             throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this address or script");
 
         // add to address book or update label
         if (address.IsValid())
-            pwalletMain->SetAddressBook(address.Get(), strLabel, "receive");
+            pwallet->SetAddressBook(address.Get(), strLabel, "receive");
 
         // Don't throw error in case an address is already there
-        if (pwalletMain->HaveWatchOnly(script))
+        if (pwallet->HaveWatchOnly(script))
             return NullUniValue;
 
-        pwalletMain->MarkDirty();
+        pwallet->MarkDirty();
 
-        if (!pwalletMain->AddWatchOnly(script))
+        if (!pwallet->AddWatchOnly(script))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
 
         if (fRescan)
         {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-            pwalletMain->ReacceptWalletTransactions();
+            pwallet->ScanForWalletTransactions(chainActive.Genesis(), true);
+            pwallet->ReacceptWalletTransactions();
         }
     }
 
@@ -226,17 +237,20 @@ UniValue z_importwallet(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() != 1)
+    if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
-            "z_importwallet \"filename\"\n"
+            "z_importwallet \"filename\" ( rescan )\n"
             "\nImports taddr and zaddr keys from a wallet export file (see z_exportwallet).\n"
             "\nArguments:\n"
             "1. \"filename\"    (string, required) The wallet file\n"
+            "2. rescan        (string, optional, default=\"yes\") Rescan the wallet for transactions of the keys added - can be \"yes\", \"no\" or \"background\", which returns once the keys are added\n"
             "\nExamples:\n"
             "\nDump the wallet\n"
             + HelpExampleCli("z_exportwallet", "\"test\"") +
             "\nImport the wallet\n"
             + HelpExampleCli("z_importwallet", "\"test\"") +
+            "\nImport the wallet, rescanning in the background\n"
+            + HelpExampleCli("z_importwallet", "\"test\" background") +
             "\nImport using the json rpc call\n"
             + HelpExampleRpc("z_importwallet", "\"test\"")
         );
@@ -249,17 +263,20 @@ UniValue importwallet(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() != 1)
+    if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
-            "importwallet \"filename\"\n"
+            "importwallet \"filename\" ( rescan )\n"
             "\nImports taddr keys from a wallet dump file (see dumpwallet).\n"
             "\nArguments:\n"
             "1. \"filename\"    (string, required) The wallet file\n"
+            "2. rescan        (string, optional, default=\"yes\") Rescan the wallet for transactions of the keys added - can be \"yes\", \"no\" or \"background\", which returns once the keys are added\n"
             "\nExamples:\n"
             "\nDump the wallet\n"
             + HelpExampleCli("dumpwallet", "\"test\"") +
             "\nImport the wallet\n"
             + HelpExampleCli("importwallet", "\"test\"") +
+            "\nImport the wallet, rescanning in the background\n"
+            + HelpExampleCli("importwallet", "\"test\" background") +
             "\nImport using the json rpc call\n"
             + HelpExampleRpc("importwallet", "\"test\"")
         );
@@ -267,113 +284,158 @@ UniValue importwallet(const UniValue& params, bool fHelp)
 	return importwallet_impl(params, fHelp, false);
 }
 
+/**
+ * Parse a line of a wallet dump, deriving the public key or payment address
+ * of the key it holds, if any. Lines are parsed on several threads at once.
+ */
+static void ParseDumpLine(const std::string& line, bool fImportZKeys,
+                          std::vector<CImportedKey>& vKeys, std::vector<CImportedZKey>& vZKeys)
+{
+    if (line.empty() || line[0] == '#')
+        return;
+
+    std::vector<std::string> vstr;
+    boost::split(vstr, line, boost::is_any_of(" "));
+    if (vstr.size() < 2)
+        return;
+
+    // Let's see if the address is a valid Zcash spending key
+    if (fImportZKeys) {
+        try {
+            CZCSpendingKey spendingkey(vstr[0]);
+            CImportedZKey zkey;
+            zkey.key = spendingkey.Get();
+            zkey.addr = zkey.key.address();
+            zkey.nCreateTime = DecodeDumpTime(vstr[1]);
+            vZKeys.push_back(zkey);
+            return;
+        }
+        catch (const std::runtime_error &e) {
+            LogPrint("zrpc","Importing detected an error: %s\n", e.what());
+            // Not a valid spending key, so carry on and see if it's a Zcash style address.
+        }
+    }
+
+    CBitcoinSecret vchSecret;
+    if (!vchSecret.SetString(vstr[0]))
+        return;
+    CImportedKey key;
+    key.key = vchSecret.GetKey();
+    key.pubkey = key.key.GetPubKey();
+    assert(key.key.VerifyPubKey(key.pubkey));
+    key.nCreateTime = DecodeDumpTime(vstr[1]);
+    key.fLabel = true;
+    for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
+        if (boost::algorithm::starts_with(vstr[nStr], "#"))
+            break;
+        if (vstr[nStr] == "change=1")
+            key.fLabel = false;
+        if (vstr[nStr] == "reserve=1")
+            key.fLabel = false;
+        if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
+            key.strLabel = DecodeDumpString(vstr[nStr].substr(6));
+            key.fLabel = true;
+        }
+    }
+    vKeys.push_back(key);
+}
+
+/** Rescan for the keys of a wallet dump, from the scheduler */
+static void ImportRescan(CWallet* pwallet, int nHeight)
+{
+    LOCK2(cs_main, pwallet->cs_wallet);
+    CBlockIndex *pindex = chainActive[std::min(nHeight, chainActive.Height())];
+    LogPrintf("Rescanning last %i blocks in the background\n", chainActive.Height() - pindex->nHeight + 1);
+    pwallet->ScanForWalletTransactions(pindex);
+    pwallet->MarkDirty();
+}
+
 UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys)
 {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
 
     EnsureWalletIsUnlocked();
 
+    bool fRescan = true;
+    bool fRescanBackground = false;
+    if (params.size() > 1) {
+        std::string strRescan = params[1].get_str();
+        if (strRescan == "no") {
+            fRescan = false;
+        } else if (strRescan == "background") {
+            fRescanBackground = true;
+        } else if (strRescan != "yes") {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "rescan must be \"yes\", \"no\" or \"background\"");
+        }
+    }
+
     ifstream file;
-    file.open(params[0].get_str().c_str(), std::ios::in | std::ios::ate);
+    file.open(params[0].get_str().c_str(), std::ios::in);
     if (!file.is_open())
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open wallet dump file");
 
-    int64_t nTimeBegin = chainActive.Tip()->GetBlockTime();
-
-    bool fGood = true;
-
-    int64_t nFilesize = std::max((int64_t)1, (int64_t)file.tellg());
-    file.seekg(0, file.beg);
-
-    pwalletMain->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
-    while (file.good()) {
-        pwalletMain->ShowProgress("", std::max(1, std::min(99, (int)(((double)file.tellg() / (double)nFilesize) * 100))));
-        std::string line;
-        std::getline(file, line);
-        if (line.empty() || line[0] == '#')
-            continue;
-
-        std::vector<std::string> vstr;
-        boost::split(vstr, line, boost::is_any_of(" "));
-        if (vstr.size() < 2)
-            continue;
-
-        // Let's see if the address is a valid Zcash spending key
-        if (fImportZKeys) {
-            try {
-                CZCSpendingKey spendingkey(vstr[0]);
-                libzcash::SpendingKey key = spendingkey.Get();
-                libzcash::PaymentAddress addr = key.address();
-                if (pwalletMain->HaveSpendingKey(addr)) {
-                    LogPrint("zrpc", "Skipping import of zaddr %s (key already present)\n", CZCPaymentAddress(addr).ToString());
-                    continue;
-                }
-                int64_t nTime = DecodeDumpTime(vstr[1]);
-                LogPrint("zrpc", "Importing zaddr %s...\n", CZCPaymentAddress(addr).ToString());
-                if (!pwalletMain->AddZKey(key)) {
-                    // Something went wrong
-                    fGood = false;
-                    continue;
-                }
-                // Successfully imported zaddr.  Now import the metadata.
-                pwalletMain->mapZKeyMetadata[addr].nCreateTime = nTime;
-                continue;
-            }
-            catch (const std::runtime_error &e) {
-                LogPrint("zrpc","Importing detected an error: %s\n", e.what());
-                // Not a valid spending key, so carry on and see if it's a Zcash style address.
-            }
-        }
+    pwallet->ShowProgress(_("Importing..."), 0); // show progress dialog in GUI
+    std::vector<std::string> vLines;
+    std::string line;
+    while (std::getline(file, line))
+        vLines.push_back(line);
+    file.close();
 
-        CBitcoinSecret vchSecret;
-        if (!vchSecret.SetString(vstr[0]))
-            continue;
-        CKey key = vchSecret.GetKey();
-        CPubKey pubkey = key.GetPubKey();
-        assert(key.VerifyPubKey(pubkey));
-        CKeyID keyid = pubkey.GetID();
-        if (pwalletMain->HaveKey(keyid)) {
-            LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
-            continue;
-        }
-        int64_t nTime = DecodeDumpTime(vstr[1]);
-        std::string strLabel;
-        bool fLabel = true;
-        for (unsigned int nStr = 2; nStr < vstr.size(); nStr++) {
-            if (boost::algorithm::starts_with(vstr[nStr], "#"))
-                break;
-            if (vstr[nStr] == "change=1")
-                fLabel = false;
-            if (vstr[nStr] == "reserve=1")
-                fLabel = false;
-            if (boost::algorithm::starts_with(vstr[nStr], "label=")) {
-                strLabel = DecodeDumpString(vstr[nStr].substr(6));
-                fLabel = true;
-            }
-        }
-        LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
-        if (!pwalletMain->AddKeyPubKey(key, pubkey)) {
-            fGood = false;
-            continue;
-        }
-        pwalletMain->mapKeyMetadata[keyid].nCreateTime = nTime;
-        if (fLabel)
-            pwalletMain->SetAddressBook(keyid, strLabel, "receive");
-        nTimeBegin = std::min(nTimeBegin, nTime);
+    // Decoding the keys and deriving their public keys and payment addresses
+    // takes most of the time, and needs no lock. Each thread parses a run of
+    // lines, so that the keys come out in the order of the file.
+    size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vLines.size() / MIN_IMPORT_LINES_PER_THREAD);
+    nThreads = std::max(nThreads, (size_t)1);
+    std::vector<std::vector<CImportedKey> > vThreadKeys(nThreads);
+    std::vector<std::vector<CImportedZKey> > vThreadZKeys(nThreads);
+    auto worker = [&](size_t nThread) {
+        for (size_t i = vLines.size() * nThread / nThreads; i < vLines.size() * (nThread + 1) / nThreads; i++)
+            ParseDumpLine(vLines[i], fImportZKeys, vThreadKeys[nThread], vThreadZKeys[nThread]);
+    };
+    std::vector<std::thread> threads;
+    for (size_t n = 1; n < nThreads; n++)
+        threads.emplace_back(worker, n);
+    worker(0);
+    for (std::thread& t : threads)
+        t.join();
+    pwallet->ShowProgress("", 50);
+
+    std::vector<CImportedKey> vKeys;
+    std::vector<CImportedZKey> vZKeys;
+    for (size_t n = 0; n < nThreads; n++) {
+        vKeys.insert(vKeys.end(), vThreadKeys[n].begin(), vThreadKeys[n].end());
+        vZKeys.insert(vZKeys.end(), vThreadZKeys[n].begin(), vThreadZKeys[n].end());
     }
-    file.close();
-    pwalletMain->ShowProgress("", 100); // hide progress dialog in GUI
+    vThreadKeys.clear();
+    vThreadZKeys.clear();
 
-    CBlockIndex *pindex = chainActive.Tip();
-    while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - TIMESTAMP_WINDOW)
-        pindex = pindex->pprev;
+    LOCK2(cs_main, pwallet->cs_wallet);
 
-    if (!pwalletMain->nTimeFirstKey || nTimeBegin < pwalletMain->nTimeFirstKey)
-        pwalletMain->nTimeFirstKey = nTimeBegin;
+    // The wallet may have been locked while the dump was parsed
+    EnsureWalletIsUnlocked();
 
-    LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
-    pwalletMain->ScanForWalletTransactions(pindex);
-    pwalletMain->MarkDirty();
+    int64_t nTimeFirst = std::numeric_limits<int64_t>::max();
+    bool fGood = pwallet->ImportKeys(vKeys, vZKeys, nTimeFirst);
+    pwallet->ShowProgress("", 100); // hide progress dialog in GUI
+
+    // Nothing to rescan for if the wallet had all the keys already
+    if (nTimeFirst != std::numeric_limits<int64_t>::max()) {
+        int64_t nTimeBegin = std::min(chainActive.Tip()->GetBlockTime(), nTimeFirst);
+        CBlockIndex *pindex = chainActive.Tip();
+        while (pindex && pindex->pprev && pindex->GetBlockTime() > nTimeBegin - TIMESTAMP_WINDOW)
+            pindex = pindex->pprev;
+
+        if (!pwallet->nTimeFirstKey || nTimeBegin < pwallet->nTimeFirstKey)
+            pwallet->nTimeFirstKey = nTimeBegin;
+
+        if (fRescan && fRescanBackground && pschedulerMain) {
+            pschedulerMain->scheduleFromNow(boost::bind(&ImportRescan, pwallet, pindex->nHeight), 0, "importrescan", true);
+        } else if (fRescan) {
+            LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
+            pwallet->ScanForWalletTransactions(pindex);
+            pwallet->MarkDirty();
+        }
+    }
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
@@ -383,6 +445,8 @@ UniValue importwallet_impl(const UniValue& params, bool fHelp, bool fImportZKeys
 
 UniValue dumpprivkey(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -401,7 +465,7 @@ UniValue dumpprivkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("dumpprivkey", "\"myaddress\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -413,7 +477,7 @@ UniValue dumpprivkey(const UniValue& params, bool fHelp)
     if (!address.GetKeyID(keyID))
         throw JSONRPCError(RPC_TYPE_ERROR, "Address does not refer to a key");
     CKey vchSecret;
-    if (!pwalletMain->GetKey(keyID, vchSecret))
+    if (!pwallet->GetKey(keyID, vchSecret))
         throw JSONRPCError(RPC_WALLET_ERROR, "Private key for address " + strAddress + " is not known");
     return CBitcoinSecret(vchSecret).ToString();
 }
@@ -464,7 +528,9 @@ UniValue dumpwallet(const UniValue& params, bool fHelp)
 
 UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 {
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -495,8 +561,8 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 
     std::map<CKeyID, int64_t> mapKeyBirth;
     std::set<CKeyID> setKeyPool;
-    pwalletMain->GetKeyBirthTimes(mapKeyBirth);
-    pwalletMain->GetAllReserveKeys(setKeyPool);
+    pwallet->GetKeyBirthTimes(mapKeyBirth);
+    pwallet->GetAllReserveKeys(setKeyPool);
 
     // sort time/key pairs
     std::vector<std::pair<int64_t, CKeyID> > vKeyBirth;
@@ -517,9 +583,9 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
         std::string strTime = EncodeDumpTime(it->first);
         std::string strAddr = CBitcoinAddress(keyid).ToString();
         CKey key;
-        if (pwalletMain->GetKey(keyid, key)) {
-            if (pwalletMain->mapAddressBook.count(keyid)) {
-                file << strprintf("%s %s label=%s # addr=%s\n", CBitcoinSecret(key).ToString(), strTime, EncodeDumpString(pwalletMain->mapAddressBook[keyid].name), strAddr);
+        if (pwallet->GetKey(keyid, key)) {
+            if (pwallet->mapAddressBook.count(keyid)) {
+                file << strprintf("%s %s label=%s # addr=%s\n", CBitcoinSecret(key).ToString(), strTime, EncodeDumpString(pwallet->mapAddressBook[keyid].name), strAddr);
             } else if (setKeyPool.count(keyid)) {
                 file << strprintf("%s %s reserve=1 # addr=%s\n", CBitcoinSecret(key).ToString(), strTime, strAddr);
             } else {
@@ -531,14 +597,14 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 
     if (fDumpZKeys) {
         std::set<libzcash::PaymentAddress> addresses;
-        pwalletMain->GetPaymentAddresses(addresses);
+        pwallet->GetPaymentAddresses(addresses);
         file << "\n";
         file << "# Zkeys\n";
         file << "\n";
         for (auto addr : addresses ) {
             libzcash::SpendingKey key;
-            if (pwalletMain->GetSpendingKey(addr, key)) {
-                std::string strTime = EncodeDumpTime(pwalletMain->mapZKeyMetadata[addr].nCreateTime);
+            if (pwallet->GetSpendingKey(addr, key)) {
+                std::string strTime = EncodeDumpTime(pwallet->mapZKeyMetadata[addr].nCreateTime);
                 file << strprintf("%s %s # zaddr=%s\n", CZCSpendingKey(key).ToString(), strTime, CZCPaymentAddress(addr).ToString());
             }
         }
@@ -554,6 +620,8 @@ UniValue dumpwallet_impl(const UniValue& params, bool fHelp, bool fDumpZKeys)
 
 UniValue z_importkey(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -579,7 +647,7 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importkey", "\"mykey\", \"no\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -623,25 +691,25 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
 
     {
         // Don't throw error in case a key is already there
-        if (pwalletMain->HaveSpendingKey(addr)) {
+        if (pwallet->HaveSpendingKey(addr)) {
             if (fIgnoreExistingKey) {
                 return NullUniValue;
             }
         } else {
-            pwalletMain->MarkDirty();
+            pwallet->MarkDirty();
 
-            if (!pwalletMain-> AddZKey(key))
+            if (!pwallet-> AddZKey(key))
                 throw JSONRPCError(RPC_WALLET_ERROR, "Error adding spending key to wallet");
 
-            pwalletMain->mapZKeyMetadata[addr].nCreateTime = 1;
+            pwallet->mapZKeyMetadata[addr].nCreateTime = 1;
         }
 
         // whenever a key is imported, we need to scan the whole chain
-        pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
+        pwallet->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
         // We want to scan for transactions and notes
         if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+            pwallet->ScanForWalletTransactions(chainActive[nRescanHeight], true);
         }
     }
 
@@ -650,6 +718,8 @@ UniValue z_importkey(const UniValue& params, bool fHelp)
 
 UniValue z_importviewingkey(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -675,7 +745,7 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_importviewingkey", "\"vkey\", \"no\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -711,26 +781,26 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
     auto addr = vkey.address();
 
     {
-        if (pwalletMain->HaveSpendingKey(addr)) {
+        if (pwallet->HaveSpendingKey(addr)) {
             throw JSONRPCError(RPC_WALLET_ERROR, "The wallet already contains the private key for this viewing key");
         }
 
         // Don't throw error in case a viewing key is already there
-        if (pwalletMain->HaveViewingKey(addr)) {
+        if (pwallet->HaveViewingKey(addr)) {
             if (fIgnoreExistingKey) {
                 return NullUniValue;
             }
         } else {
-            pwalletMain->MarkDirty();
+            pwallet->MarkDirty();
 
-            if (!pwalletMain->AddViewingKey(vkey)) {
+            if (!pwallet->AddViewingKey(vkey)) {
                 throw JSONRPCError(RPC_WALLET_ERROR, "Error adding viewing key to wallet");
             }
         }
 
         // We want to scan for transactions and notes
         if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[nRescanHeight], true);
+            pwallet->ScanForWalletTransactions(chainActive[nRescanHeight], true);
         }
     }
 
@@ -739,6 +809,8 @@ UniValue z_importviewingkey(const UniValue& params, bool fHelp)
 
 UniValue z_exportkey(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -757,7 +829,7 @@ UniValue z_exportkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_exportkey", "\"myaddress\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -767,7 +839,7 @@ UniValue z_exportkey(const UniValue& params, bool fHelp)
     auto addr = address.Get();
 
     libzcash::SpendingKey k;
-    if (!pwalletMain->GetSpendingKey(addr, k))
+    if (!pwallet->GetSpendingKey(addr, k))
         throw JSONRPCError(RPC_WALLET_ERROR, "Wallet does not hold private zkey for this zaddr");
 
     CZCSpendingKey spendingkey(k);
@@ -776,6 +848,8 @@ UniValue z_exportkey(const UniValue& params, bool fHelp)
 
 UniValue z_exportviewingkey(const UniValue& params, bool fHelp)
 {
+    CWallet* const pwallet = GetWalletForJSONRPCRequest();
+
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
@@ -793,7 +867,7 @@ UniValue z_exportviewingkey(const UniValue& params, bool fHelp)
             + HelpExampleRpc("z_exportviewingkey", "\"myaddress\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    LOCK2(cs_main, pwallet->cs_wallet);
 
     EnsureWalletIsUnlocked();
 
@@ -803,9 +877,9 @@ UniValue z_exportviewingkey(const UniValue& params, bool fHelp)
     auto addr = address.Get();
 
     libzcash::ViewingKey vk;
-    if (!pwalletMain->GetViewingKey(addr, vk)) {
+    if (!pwallet->GetViewingKey(addr, vk)) {
         libzcash::SpendingKey k;
-        if (!pwalletMain->GetSpendingKey(addr, k)) {
+        if (!pwallet->GetSpendingKey(addr, k)) {
             throw JSONRPCError(RPC_WALLET_ERROR, "Wallet does not hold private key or viewing key for this zaddr");
         }
         vk = k.viewing_key();
@@ -223,6 +223,13 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
         BOOST_CHECK_EQUAL(nValueRet, 500000 * COIN); // we should get the exact amount
         BOOST_CHECK_EQUAL(setCoinsRet.size(), 10U); // in ten coins
 
+        // among many coins of different values, an exact subset is found
+        empty_wallet();
+        for (int j = 1; j <= 200; j++)
+            add_coin(j * CENT);
+        BOOST_CHECK( wallet.SelectCoinsMinConf(1234 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, 1234 * CENT);
+
         // if there's not enough in the smaller coins to make at least 1 cent change (0.5+0.6+0.7 < 1.0+1.0),
         // we need to try finding an exact subset anyway
 
@@ -15,6 +15,7 @@
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "utilmoneystr.h"
 #include "zcash/Note.hpp"
 #include "crypter.h"
@@ -28,6 +29,9 @@ using namespace zen;
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
+#include <atomic>
+#include <thread>
+
 using namespace std;
 using namespace libzcash;
 
@@ -118,6 +122,10 @@ bool CWallet::AddZKey(const libzcash::SpendingKey &key)
         return true;
 
     if (!IsCrypted()) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->WriteZKey(addr,
+                                             key,
+                                             mapZKeyMetadata[addr]);
         return CWalletDB(strWalletFile).WriteZKey(addr,
                                                   key,
                                                   mapZKeyMetadata[addr]);
@@ -156,6 +164,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    MarkBalancesDirty();
 
     // check if we need to remove from watch-only
     CScript script;
@@ -166,6 +175,10 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->WriteKey(pubkey,
+                                              secret.GetPrivKey(),
+                                              mapKeyMetadata[pubkey.GetID()]);
         return CWalletDB(strWalletFile).WriteKey(pubkey,
                                                  secret.GetPrivKey(),
                                                  mapKeyMetadata[pubkey.GetID()]);
@@ -178,6 +191,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    MarkBalancesDirty();
     if (!fFileBacked)
         return true;
     {
@@ -186,6 +200,10 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
             return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
                                                         vchCryptedSecret,
                                                         mapKeyMetadata[vchPubKey.GetID()]);
+        else if (pwalletdbBatch)
+            return pwalletdbBatch->WriteCryptedKey(vchPubKey,
+                                                     vchCryptedSecret,
+                                                     mapKeyMetadata[vchPubKey.GetID()]);
         else
             return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
                                                             vchCryptedSecret,
@@ -210,6 +228,11 @@ bool CWallet::AddCryptedSpendingKey(const libzcash::PaymentAddress &address,
                                                          rk,
                                                          vchCryptedSecret,
                                                          mapZKeyMetadata[address]);
+        } else if (pwalletdbBatch) {
+            return pwalletdbBatch->WriteCryptedZKey(address,
+                                                    rk,
+                                                    vchCryptedSecret,
+                                                    mapZKeyMetadata[address]);
         } else {
             return CWalletDB(strWalletFile).WriteCryptedZKey(address,
                                                              rk,
@@ -220,6 +243,70 @@ bool CWallet::AddCryptedSpendingKey(const libzcash::PaymentAddress &address,
     return false;
 }
 
+bool CWallet::ImportKeys(const std::vector<CImportedKey>& vKeys,
+                         const std::vector<CImportedZKey>& vZKeys,
+                         int64_t& nTimeFirst)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata, mapZKeyMetadata
+    assert(!pwalletdbEncryption && !pwalletdbBatch);
+
+    // Without a transaction the keys are written one by one, as they would
+    // be imported singly
+    CWalletDB walletdb(strWalletFile);
+    if (fFileBacked && walletdb.TxnBegin())
+        pwalletdbBatch = &walletdb;
+
+    bool fGood = true;
+    try {
+        for (const CImportedZKey& zkey : vZKeys) {
+            if (HaveSpendingKey(zkey.addr)) {
+                LogPrint("zrpc", "Skipping import of zaddr %s (key already present)\n", CZCPaymentAddress(zkey.addr).ToString());
+                continue;
+            }
+            LogPrint("zrpc", "Importing zaddr %s...\n", CZCPaymentAddress(zkey.addr).ToString());
+            // The metadata goes to disk with the key
+            mapZKeyMetadata[zkey.addr].nCreateTime = zkey.nCreateTime;
+            if (!AddZKey(zkey.key)) {
+                fGood = false;
+                continue;
+            }
+            nTimeFirst = std::min(nTimeFirst, zkey.nCreateTime);
+        }
+
+        for (const CImportedKey& key : vKeys) {
+            CKeyID keyid = key.pubkey.GetID();
+            if (HaveKey(keyid)) {
+                LogPrintf("Skipping import of %s (key already present)\n", CBitcoinAddress(keyid).ToString());
+                continue;
+            }
+            LogPrintf("Importing %s...\n", CBitcoinAddress(keyid).ToString());
+            mapKeyMetadata[keyid].nCreateTime = key.nCreateTime;
+            if (!AddKeyPubKey(key.key, key.pubkey)) {
+                fGood = false;
+                continue;
+            }
+            if (key.fLabel)
+                SetAddressBook(keyid, key.strLabel, "receive");
+            nTimeFirst = std::min(nTimeFirst, key.nCreateTime);
+        }
+    } catch (...) {
+        if (pwalletdbBatch) {
+            pwalletdbBatch = NULL;
+            walletdb.TxnAbort();
+        }
+        throw;
+    }
+
+    if (pwalletdbBatch) {
+        pwalletdbBatch = NULL;
+        if (!walletdb.TxnCommit()) {
+            LogPrintf("ImportKeys(): Couldn't commit the imported keys\n");
+            return false;
+        }
+    }
+    return fGood;
+}
+
 bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
@@ -271,6 +358,8 @@ bool CWallet::RemoveViewingKey(const libzcash::ViewingKey &vk)
         return false;
     }
     if (fFileBacked) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->EraseViewingKey(vk);
         if (!CWalletDB(strWalletFile).EraseViewingKey(vk)) {
             return false;
         }
@@ -288,6 +377,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    MarkBalancesDirty();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -313,6 +403,7 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    MarkBalancesDirty();
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -325,11 +416,15 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    MarkBalancesDirty();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
-    if (fFileBacked)
+    if (fFileBacked) {
+        if (pwalletdbBatch)
+            return pwalletdbBatch->EraseWatchOnly(dest);
         if (!CWalletDB(strWalletFile).EraseWatchOnly(dest))
             return false;
+    }
 
     return true;
 }
@@ -413,6 +508,15 @@ void CWallet::ChainTip(const CBlockIndex *pindex, const CBlock *pblock,
     } else {
         DecrementNoteWitnesses(pindex);
     }
+
+    LOCK(cs_wallet);
+    if (fBlockTxsIndexed) {
+        if (added) {
+            setBlockTxsNotInChain.erase(pindex->GetBlockHash());
+        } else if (mapBlockTxs.count(pindex->GetBlockHash())) {
+            setBlockTxsNotInChain.insert(pindex->GetBlockHash());
+        }
+    }
 }
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
@@ -666,6 +770,7 @@ void CWallet::ClearNoteWitnessCache()
         for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
             item.second.witnesses.clear();
             item.second.witnessHeight = -1;
+            item.second.witnessSyncedHeight = -1;
         }
     }
     nWitnessCacheSize = 0;
@@ -677,11 +782,17 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
 {
     {
         LOCK(cs_wallet);
+        // The notes behind the current height are collected once, so that
+        // each commitment of the block only walks the witnesses being
+        // incremented rather than the whole wallet.
+        std::vector<CNoteData*> vBehind;
+        std::vector<CNoteData*> vWitnessed;
         for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
             for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
                 CNoteData* nd = &(item.second);
                 // Only increment witnesses that are behind the current height
                 if (nd->witnessHeight < pindex->nHeight) {
+                    vBehind.push_back(nd);
                     // Check the validity of the cache
                     // The only time a note witnessed above the current height
                     // would be invalid here is during a reindex when blocks
@@ -699,6 +810,9 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                     if (nd->witnesses.size() > WITNESS_CACHE_SIZE) {
                         nd->witnesses.pop_back();
                     }
+                    if (nd->witnesses.size() > 0) {
+                        vWitnessed.push_back(nd);
+                    }
                 }
             }
         }
@@ -713,34 +827,41 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             pblock = &block;
         }
 
+        // The commitments of the block go into the tree and the witnesses
+        // all at once
+        std::vector<uint256> vCommitments;
+        for (const CTransaction& tx : pblock->vtx) {
+            for (const JSDescription& jsdesc : tx.vjoinsplit) {
+                vCommitments.insert(vCommitments.end(), jsdesc.commitments.begin(), jsdesc.commitments.end());
+            }
+        }
+
+        // Increment existing witnesses
+        for (CNoteData* nd : vWitnessed) {
+            // Check the validity of the cache
+            // See earlier comment about validity.
+            assert(nWitnessCacheSize >= nd->witnesses.size());
+            nd->witnesses.front().append_range(vCommitments.begin(), vCommitments.end());
+        }
+
+        // The tree is appended up to each of our notes to witness it, and the
+        // witness then gets the rest of the block
+        size_t nAppended = 0;
+        size_t nCommitment = 0;
         for (const CTransaction& tx : pblock->vtx) {
             auto hash = tx.GetHash();
             bool txIsOurs = mapWallet.count(hash);
             for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
                 const JSDescription& jsdesc = tx.vjoinsplit[i];
-                for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
-                    const uint256& note_commitment = jsdesc.commitments[j];
-                    tree.append(note_commitment);
-
-                    // Increment existing witnesses
-                    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                        for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                            CNoteData* nd = &(item.second);
-                            if (nd->witnessHeight < pindex->nHeight &&
-                                    nd->witnesses.size() > 0) {
-                                // Check the validity of the cache
-                                // See earlier comment about validity.
-                                assert(nWitnessCacheSize >= nd->witnesses.size());
-                                nd->witnesses.front().append(note_commitment);
-                            }
-                        }
-                    }
-
+                for (uint8_t j = 0; j < jsdesc.commitments.size(); j++, nCommitment++) {
                     // If this is our note, witness it
                     if (txIsOurs) {
                         JSOutPoint jsoutpt {hash, i, j};
                         if (mapWallet[hash].mapNoteData.count(jsoutpt) &&
                                 mapWallet[hash].mapNoteData[jsoutpt].witnessHeight < pindex->nHeight) {
+                            tree.append_range(vCommitments.begin() + nAppended, vCommitments.begin() + nCommitment + 1);
+                            nAppended = nCommitment + 1;
+
                             CNoteData* nd = &(mapWallet[hash].mapNoteData[jsoutpt]);
                             if (nd->witnesses.size() > 0) {
                                 // We think this can happen because we write out the
@@ -758,8 +879,11 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                           pindex->nHeight,
                                           tree.witness().root().GetHex());
                                 nd->witnesses.clear();
+                                nd->witnessSyncedHeight = -1;
                             }
-                            nd->witnesses.push_front(tree.witness());
+                            ZCIncrementalWitness witness = tree.witness();
+                            witness.append_range(vCommitments.begin() + nAppended, vCommitments.end());
+                            nd->witnesses.push_front(witness);
                             // Set height to one less than pindex so it gets incremented
                             nd->witnessHeight = pindex->nHeight - 1;
                             // Check the validity of the cache
@@ -769,18 +893,14 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                 }
             }
         }
+        tree.append_range(vCommitments.begin() + nAppended, vCommitments.end());
 
         // Update witness heights
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                CNoteData* nd = &(item.second);
-                if (nd->witnessHeight < pindex->nHeight) {
-                    nd->witnessHeight = pindex->nHeight;
-                    // Check the validity of the cache
-                    // See earlier comment about validity.
-                    assert(nWitnessCacheSize >= nd->witnesses.size());
-                }
-            }
+        for (CNoteData* nd : vBehind) {
+            nd->witnessHeight = pindex->nHeight;
+            // Check the validity of the cache
+            // See earlier comment about validity.
+            assert(nWitnessCacheSize >= nd->witnesses.size());
         }
 
         // For performance reasons, we write out the witness cache in
@@ -809,6 +929,9 @@ void CWallet::DecrementNoteWitnesses(const CBlockIndex* pindex)
                     if (nd->witnesses.size() > 0) {
                         nd->witnesses.pop_front();
                     }
+                    // The stored witness for pindex no longer matches the
+                    // cache once another block is connected at its height.
+                    nd->witnessSyncedHeight = std::min(nd->witnessSyncedHeight, pindex->nHeight - 1);
                     // pindex is the block being removed, so the new witness cache
                     // height is one below it.
                     nd->witnessHeight = pindex->nHeight - 1;
@@ -955,9 +1078,17 @@ void CWallet::MarkDirty()
     }
 }
 
+//! Below this many notes per thread, UpdateNullifierNoteMap stays on the calling thread
+static const size_t MIN_NOTE_DECRYPTIONS_PER_THREAD = 8;
+
 /**
  * Ensure that every note in the wallet (for which we possess a spending key)
- * has a cached nullifier.
+ * has a cached nullifier, and every note a cached value.
+ *
+ * Decrypting the notes is what makes this slow for large wallets, so the
+ * notes that miss something are collected first, with their keys looked up
+ * once per address, and decrypted in parallel. What was learned is written
+ * back, so it is not computed again on the next unlock or restart.
  */
 bool CWallet::UpdateNullifierNoteMap()
 {
@@ -967,25 +1098,101 @@ bool CWallet::UpdateNullifierNoteMap()
         if (IsLocked())
             return false;
 
-        ZCNoteDecryption dec;
-        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
-                if (!item.second.nullifier) {
-                    if (GetNoteDecryptor(item.second.address, dec)) {
-                        auto i = item.first.js;
-                        auto hSig = wtxItem.second.vjoinsplit[i].h_sig(
-                            *pzcashParams, wtxItem.second.joinSplitPubKey);
-                        item.second.nullifier = GetNoteNullifier(
-                            wtxItem.second.vjoinsplit[i],
-                            item.second.address,
-                            dec,
-                            hSig,
-                            item.first.n);
-                    }
+        struct CPendingNote {
+            uint256 hash;
+            const CWalletTx* wtx;
+            JSOutPoint jsop;
+            const ZCNoteDecryption* dec;
+            const libzcash::SpendingKey* key;
+            boost::optional<uint256> nullifier;
+            CAmount value;
+            bool fDecrypted;
+        };
+        std::map<libzcash::PaymentAddress, ZCNoteDecryption> mapDecryptors;
+        std::map<libzcash::PaymentAddress, boost::optional<libzcash::SpendingKey> > mapKeys;
+        std::vector<CPendingNote> vPending;
+        for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            for (const mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
+                const libzcash::PaymentAddress& address = item.second.address;
+                if (!mapKeys.count(address)) {
+                    libzcash::SpendingKey key;
+                    if (GetSpendingKey(address, key))
+                        mapKeys[address] = key;
+                    else
+                        mapKeys[address] = boost::none;
+                    ZCNoteDecryption dec;
+                    if (GetNoteDecryptor(address, dec))
+                        mapDecryptors.insert(std::make_pair(address, dec));
                 }
+                const boost::optional<libzcash::SpendingKey>& key = mapKeys[address];
+                bool fNeedNullifier = !item.second.nullifier && key;
+                if ((!fNeedNullifier && item.second.value) || !mapDecryptors.count(address))
+                    continue;
+                vPending.push_back(CPendingNote{wtxItem.first, &wtxItem.second, item.first,
+                    &mapDecryptors.at(address), key ? &*key : NULL, boost::none, 0, false});
             }
-            UpdateNullifierNoteMapWithTx(wtxItem.second);
         }
+
+        // Only reads the transactions and the keys gathered above
+        auto worker = [&](size_t nStart, size_t nStride) {
+            for (size_t i = nStart; i < vPending.size(); i += nStride) {
+                CPendingNote& pending = vPending[i];
+                const JSDescription& jsdesc = pending.wtx->vjoinsplit[pending.jsop.js];
+                try {
+                    auto hSig = jsdesc.h_sig(*pzcashParams, pending.wtx->joinSplitPubKey);
+                    auto note = libzcash::NotePlaintext::decrypt(
+                        *pending.dec,
+                        jsdesc.ciphertexts[pending.jsop.n],
+                        jsdesc.ephemeralKey,
+                        hSig,
+                        (unsigned char) pending.jsop.n).note(
+                            pending.wtx->mapNoteData.at(pending.jsop).address);
+                    if (note.cm() != jsdesc.commitments[pending.jsop.n])
+                        continue;
+                    pending.value = note.value();
+                    if (pending.key)
+                        pending.nullifier = note.nullifier(*pending.key);
+                    pending.fDecrypted = true;
+                } catch (const std::exception&) {
+                    // Reported below, as the note is not marked decrypted
+                }
+            }
+        };
+        size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vPending.size() / MIN_NOTE_DECRYPTIONS_PER_THREAD);
+        if (nThreads <= 1) {
+            worker(0, 1);
+        } else {
+            std::vector<std::thread> threads;
+            threads.reserve(nThreads - 1);
+            for (size_t t = 1; t < nThreads; t++)
+                threads.emplace_back(worker, t, nThreads);
+            worker(0, nThreads);
+            for (std::thread& t : threads)
+                t.join();
+        }
+
+        std::set<uint256> setUpdated;
+        for (const CPendingNote& pending : vPending) {
+            if (!pending.fDecrypted) {
+                LogPrintf("UpdateNullifierNoteMap(): Could not decrypt note %s:%u:%u\n",
+                    pending.hash.ToString(), pending.jsop.js, pending.jsop.n);
+                continue;
+            }
+            CNoteData& nd = mapWallet[pending.hash].mapNoteData[pending.jsop];
+            if (!nd.nullifier && pending.nullifier)
+                nd.nullifier = pending.nullifier;
+            nd.value = pending.value;
+            setUpdated.insert(pending.hash);
+        }
+        // SetBestChain() no longer rewrites the transactions with notes,
+        // so save the nullifiers and values we just learned here.
+        if (!setUpdated.empty() && fFileBacked) {
+            CWalletDB walletdb(strWalletFile);
+            for (const uint256& hash : setUpdated)
+                walletdb.WriteTx(hash, mapWallet[hash]);
+        }
+        for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet)
+            UpdateNullifierNoteMapWithTx(wtxItem.second);
     }
     return true;
 }
@@ -1005,6 +1212,92 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
     }
 }
 
+/** The mapBlockTxs entry of a transaction: its block, if it has a merkle branch to it. */
+static uint256 GetTxBlock(const CWalletTx& wtx)
+{
+    return wtx.nIndex == -1 ? uint256() : wtx.hashBlock;
+}
+
+void CWallet::IndexTxBlock(const uint256& hash, const uint256& hashBlock, bool fAdd)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fBlockTxsIndexed)
+        return;
+    if (fAdd) {
+        mapBlockTxs[hashBlock].insert(hash);
+        return;
+    }
+    std::map<uint256, std::set<uint256> >::iterator it = mapBlockTxs.find(hashBlock);
+    if (it != mapBlockTxs.end()) {
+        it->second.erase(hash);
+        if (it->second.empty()) {
+            setBlockTxsNotInChain.erase(it->first);
+            mapBlockTxs.erase(it);
+        }
+    }
+}
+
+void CWallet::IndexBlockTxs()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fBlockTxsIndexed)
+        return;
+    mapBlockTxs.clear();
+    setBlockTxsNotInChain.clear();
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        mapBlockTxs[GetTxBlock(wtxItem.second)].insert(wtxItem.first);
+    }
+    for (const std::pair<const uint256, std::set<uint256> >& item : mapBlockTxs) {
+        if (item.first.IsNull())
+            continue;
+        BlockMap::const_iterator mi = mapBlockIndex.find(item.first);
+        if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+            setBlockTxsNotInChain.insert(item.first);
+        }
+    }
+    fBlockTxsIndexed = true;
+}
+
+void CWallet::GetTxsSinceBlock(const CBlockIndex* pindex, std::set<uint256>& setTxids)
+{
+    IndexBlockTxs();
+
+    std::map<uint256, std::set<uint256> >::const_iterator it;
+    for (int nHeight = pindex->nHeight + 1; nHeight <= chainActive.Height(); nHeight++) {
+        it = mapBlockTxs.find(chainActive[nHeight]->GetBlockHash());
+        if (it != mapBlockTxs.end())
+            setTxids.insert(it->second.begin(), it->second.end());
+    }
+    GetTxsNotInChain(setTxids);
+}
+
+void CWallet::GetTxsNotInChain(std::set<uint256>& setTxids)
+{
+    IndexBlockTxs();
+
+    std::map<uint256, std::set<uint256> >::const_iterator it;
+    it = mapBlockTxs.find(uint256());
+    if (it != mapBlockTxs.end())
+        setTxids.insert(it->second.begin(), it->second.end());
+    for (const uint256& hashBlock : setBlockTxsNotInChain) {
+        it = mapBlockTxs.find(hashBlock);
+        if (it != mapBlockTxs.end())
+            setTxids.insert(it->second.begin(), it->second.end());
+    }
+}
+
+/**
+ * Update mapAddressNotes with the notes of this tx.
+ */
+void CWallet::UpdateAddressNoteMapWithTx(const CWalletTx& wtx)
+{
+    LOCK(cs_wallet);
+    for (const mapNoteData_t::value_type& item : wtx.mapNoteData)
+        mapAddressNotes[item.second.address].insert(item.first);
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -1016,6 +1309,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+        UpdateAddressNoteMapWithTx(wtx);
+        IndexTxBlock(hash, GetTxBlock(wtx), true);
         AddToSpends(hash);
     }
     else
@@ -1081,6 +1376,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         }
 
         bool fUpdated = false;
+        const uint256 hashBlockBefore = GetTxBlock(wtx);
         if (!fInsertedNew)
         {
             // Merge
@@ -1105,6 +1401,14 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        UpdateAddressNoteMapWithTx(wtx);
+        if (fInsertedNew) {
+            IndexTxBlock(hash, GetTxBlock(wtx), true);
+        } else if (GetTxBlock(wtx) != hashBlockBefore) {
+            IndexTxBlock(hash, hashBlockBefore, false);
+            IndexTxBlock(hash, GetTxBlock(wtx), true);
+        }
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
@@ -1145,6 +1449,17 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
                 nd.second.witnesses.cbegin(), nd.second.witnesses.cend());
         }
         tmp.at(nd.first).witnessHeight = nd.second.witnessHeight;
+        tmp.at(nd.first).witnessHeightOnDisk = nd.second.witnessHeightOnDisk;
+        tmp.at(nd.first).witnessesOnDisk = nd.second.witnessesOnDisk;
+        tmp.at(nd.first).witnessSyncedHeight = nd.second.witnessSyncedHeight;
+        // Notes found while the wallet was locked have no nullifier, and
+        // the ones from older wallets no value; don't lose what we know
+        if (tmp.count(nd.first) && tmp.at(nd.first).address == nd.second.address) {
+            if (!tmp.at(nd.first).nullifier)
+                tmp.at(nd.first).nullifier = nd.second.nullifier;
+            if (!tmp.at(nd.first).value)
+                tmp.at(nd.first).value = nd.second.value;
+        }
     }
     // Now copy over the updated note data
     wtx.mapNoteData = tmp;
@@ -1163,13 +1478,21 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * updated; instead, the transaction being in the mempool or conflicted is determined on
  * the fly in CMerkleTx::GetDepthInMainChain().
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, CWalletDB* pwalletdb)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fUpdate && mapWallet.count(tx.GetHash()))
+        return false;
+    return AddToWalletIfInvolvingMe(tx, FindMyNotes(tx), pblock, fUpdate, pwalletdb);
+}
+
+/** As above, with the notes of the transaction already found by FindMyNotes */
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const mapNoteData_t& noteData, const CBlock* pblock, bool fUpdate, CWalletDB* pwalletdb)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto noteData = FindMyNotes(tx);
         if (fExisted || IsMine(tx) || IsFromMe(tx) || noteData.size() > 0)
         {
             CWalletTx wtx(this,tx);
@@ -1182,6 +1505,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
 
+            if (pwalletdb)
+                return AddToWallet(wtx, false, pwalletdb);
+
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
             CWalletDB walletdb(strWalletFile, "r+", false);
@@ -1201,6 +1527,68 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     MarkAffectedTransactionsDirty(tx);
 }
 
+void CWallet::SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock)
+{
+    LOCK(cs_wallet);
+    // Write the whole batch in one database transaction, rather than committing
+    // each wallet transaction on its own. Not flushing is safe for the same reason
+    // as in AddToWalletIfInvolvingMe.
+    CWalletDB walletdb(strWalletFile, "r+", false);
+    bool fBatch = walletdb.TxnBegin();
+    SyncTransactions(vtx, pblock, walletdb);
+    if (fBatch && !walletdb.TxnCommit())
+        LogPrintf("SyncTransactions(): Couldn't commit wallet writes\n");
+}
+
+/** SyncTransactions under cs_wallet, writing to walletdb; the notes of all of vtx are searched at once */
+void CWallet::SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock, CWalletDB& walletdb)
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<const CTransaction*> vptx;
+    vptx.reserve(vtx.size());
+    for (const CTransaction& tx : vtx)
+        vptx.push_back(&tx);
+    std::vector<mapNoteData_t> vNoteData = FindMyNotes(vptx);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (AddToWalletIfInvolvingMe(vtx[i], vNoteData[i], pblock, true, &walletdb))
+            MarkAffectedTransactionsDirty(vtx[i]);
+    }
+}
+
+/**
+ * A block was connected: sync its conflicts and transactions under one lock
+ * and one database transaction, then advance the note witnesses.
+ */
+void CWallet::BlockConnected(const CBlock& block, const CBlockIndex* pindex,
+                             const std::vector<CTransaction>& vtxConflicted,
+                             const ZCIncrementalMerkleTree& tree)
+{
+    LOCK(cs_wallet);
+    {
+        CWalletDB walletdb(strWalletFile, "r+", false);
+        bool fBatch = walletdb.TxnBegin();
+        SyncTransactions(vtxConflicted, NULL, walletdb);
+        SyncTransactions(block.vtx, &block, walletdb);
+        if (fBatch && !walletdb.TxnCommit())
+            LogPrintf("BlockConnected(): Couldn't commit wallet writes\n");
+    }
+    ChainTip(pindex, &block, tree, true);
+}
+
+/** A block was disconnected: its transactions go back to the mempool, and the witnesses back one block */
+void CWallet::BlockDisconnected(const CBlock& block, const CBlockIndex* pindex, const ZCIncrementalMerkleTree& tree)
+{
+    LOCK(cs_wallet);
+    {
+        CWalletDB walletdb(strWalletFile, "r+", false);
+        bool fBatch = walletdb.TxnBegin();
+        SyncTransactions(block.vtx, NULL, walletdb);
+        if (fBatch && !walletdb.TxnCommit())
+            LogPrintf("BlockDisconnected(): Couldn't commit wallet writes\n");
+    }
+    ChainTip(pindex, &block, tree, false);
+}
+
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
 {
     // If a transaction changes 'conflicted' state, that changes the balance
@@ -1227,8 +1615,16 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        map<uint256, CWalletTx>::iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            return;
+        for (const mapNoteData_t::value_type& item : it->second.mapNoteData) {
+            mapAddressNotes[item.second.address].erase(item.first);
+            mapNotePlaintexts.erase(item.first);
+        }
+        IndexTxBlock(hash, GetTxBlock(it->second), false);
+        mapWallet.erase(it);
+        CWalletDB(strWalletFile).EraseTx(hash);
     }
     return;
 }
@@ -1242,7 +1638,8 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
                                                    const libzcash::PaymentAddress& address,
                                                    const ZCNoteDecryption& dec,
                                                    const uint256& hSig,
-                                                   uint8_t n) const
+                                                   uint8_t n,
+                                                   CAmount* pvalue) const
 {
     boost::optional<uint256> ret;
     auto note_pt = libzcash::NotePlaintext::decrypt(
@@ -1257,6 +1654,8 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
     if (note.cm() != jsdesc.commitments[n]) {
         throw libzcash::note_decryption_failed();
     }
+    if (pvalue)
+        *pvalue = note.value();
 
     // SpendingKeys are only available if:
     // - We have them (this isn't a viewing key)
@@ -1268,6 +1667,65 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
     return ret;
 }
 
+namespace {
+
+//! Below this many trial decryptions per thread, FindMyNotes stays on the calling thread
+const size_t MIN_TRIAL_DECRYPTIONS_PER_THREAD = 32;
+
+struct CTrialCiphertext {
+    const JSDescription* jsdesc;
+    uint256 hSig;
+    uint8_t n;
+};
+
+/**
+ * Try every decryptor against every ciphertext, spreading the pairs over
+ * worker threads, so that a block of ciphertexts is spread as well as many
+ * keys are. Returns a flag per (ciphertext, decryptor) pair that
+ * is set when the authenticated decryption succeeded, or failed unexpectedly
+ * so that the caller reports it. Only reads the decryptors, so the caller
+ * keeps holding the lock that protects them.
+ */
+std::vector<char> TrialDecryptNotes(const std::vector<CTrialCiphertext>& vCiphertexts,
+                                    const std::vector<const ZCNoteDecryption*>& vDecryptors)
+{
+    const size_t nDecryptors = vDecryptors.size();
+    const size_t nWork = vCiphertexts.size() * nDecryptors;
+    std::vector<char> vMatch(nWork, 0);
+
+    // Pair w is ciphertext w / nDecryptors with decryptor w % nDecryptors
+    auto worker = [&](size_t nBegin, size_t nEnd) {
+        for (size_t w = nBegin; w < nEnd; w++) {
+            const CTrialCiphertext& ct = vCiphertexts[w / nDecryptors];
+            try {
+                vDecryptors[w % nDecryptors]->decrypt(ct.jsdesc->ciphertexts[ct.n], ct.jsdesc->ephemeralKey, ct.hSig, (unsigned char) ct.n);
+                vMatch[w] = 1;
+            } catch (const libzcash::note_decryption_failed&) {
+            } catch (...) {
+                vMatch[w] = 1;
+            }
+        }
+    };
+
+    size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), nWork / MIN_TRIAL_DECRYPTIONS_PER_THREAD);
+    if (nThreads <= 1) {
+        worker(0, nWork);
+        return vMatch;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    const size_t nChunk = (nWork + nThreads - 1) / nThreads;
+    for (size_t nBegin = nChunk; nBegin < nWork; nBegin += nChunk)
+        threads.emplace_back(worker, nBegin, std::min(nBegin + nChunk, nWork));
+    worker(0, std::min(nChunk, nWork));
+    for (std::thread& t : threads)
+        t.join();
+    return vMatch;
+}
+
+}
+
 /**
  * Finds all output notes in the given transaction that have been sent to
  * PaymentAddresses in this wallet.
@@ -1278,41 +1736,79 @@ boost::optional<uint256> CWallet::GetNoteNullifier(const JSDescription& jsdesc,
  */
 mapNoteData_t CWallet::FindMyNotes(const CTransaction& tx) const
 {
-    LOCK(cs_SpendingKeyStore);
-    uint256 hash = tx.GetHash();
+    return FindMyNotes(std::vector<const CTransaction*>(1, &tx))[0];
+}
 
-    mapNoteData_t noteData;
-    for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
-        auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
-        for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
-                try {
-                    auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
-                    auto nullifier = GetNoteNullifier(
-                        tx.vjoinsplit[i],
-                        address,
-                        item.second,
-                        hSig, j);
-                    if (nullifier) {
-                        CNoteData nd {address, *nullifier};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    } else {
-                        CNoteData nd {address};
-                        noteData.insert(std::make_pair(jsoutpt, nd));
-                    }
-                    break;
-                } catch (const note_decryption_failed &err) {
-                    // Couldn't decrypt with this decryptor
-                } catch (const std::exception &exc) {
-                    // Unexpected failure
-                    LogPrintf("FindMyNotes(): Unexpected error while testing decrypt:\n");
-                    LogPrintf("%s\n", exc.what());
-                }
+/**
+ * FindMyNotes for each of the given transactions, with the trial decryptions
+ * of all of them spread over the worker threads together, so that a block
+ * keeps them busy even when the wallet has few keys.
+ */
+std::vector<mapNoteData_t> CWallet::FindMyNotes(const std::vector<const CTransaction*>& vptx) const
+{
+    LOCK(cs_SpendingKeyStore);
+    std::vector<mapNoteData_t> vNoteData(vptx.size());
+    if (mapNoteDecryptors.empty())
+        return vNoteData;
+
+    // The trial decryptions are what makes this slow with many keys, so they
+    // are done up front in parallel; only the pairs that decrypted go through
+    // the full check below, in the same order as before.
+    std::vector<CTrialCiphertext> vCiphertexts;
+    std::vector<size_t> vCiphertextTx;
+    for (size_t t = 0; t < vptx.size(); t++) {
+        const CTransaction& tx = *vptx[t];
+        for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+            auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
+            for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
+                vCiphertexts.push_back(CTrialCiphertext{&tx.vjoinsplit[i], hSig, j});
+                vCiphertextTx.push_back(t);
+            }
+        }
+    }
+    if (vCiphertexts.empty())
+        return vNoteData;
+    std::vector<const NoteDecryptorMap::value_type*> vItems;
+    std::vector<const ZCNoteDecryption*> vDecryptors;
+    for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
+        vItems.push_back(&item);
+        vDecryptors.push_back(&item.second);
+    }
+    std::vector<char> vMatch = TrialDecryptNotes(vCiphertexts, vDecryptors);
+
+    for (size_t c = 0; c < vCiphertexts.size(); c++) {
+        const CTransaction& tx = *vptx[vCiphertextTx[c]];
+        const size_t i = vCiphertexts[c].jsdesc - &tx.vjoinsplit[0];
+        const uint8_t j = vCiphertexts[c].n;
+        const uint256& hSig = vCiphertexts[c].hSig;
+        for (size_t k = 0; k < vItems.size(); k++) {
+            if (!vMatch[c * vItems.size() + k])
+                continue;
+            const NoteDecryptorMap::value_type& item = *vItems[k];
+            try {
+                auto address = item.first;
+                JSOutPoint jsoutpt {tx.GetHash(), i, j};
+                CAmount value;
+                auto nullifier = GetNoteNullifier(
+                    tx.vjoinsplit[i],
+                    address,
+                    item.second,
+                    hSig, j, &value);
+                CNoteData nd {address};
+                nd.nullifier = nullifier;
+                nd.value = value;
+                vNoteData[vCiphertextTx[c]].insert(std::make_pair(jsoutpt, nd));
+                break;
+            } catch (const note_decryption_failed &err) {
+                // Couldn't decrypt with this decryptor
+            } catch (const std::exception &exc) {
+                // Unexpected failure
+                LogPrintf("FindMyNotes(): Unexpected error while testing decrypt:\n");
+                LogPrintf("%s\n", exc.what());
             }
         }
     }
-    return noteData;
+    return vNoteData;
 }
 
 bool CWallet::IsFromMe(const uint256& nullifier) const
@@ -1487,7 +1983,21 @@ CAmount CWallet::GetChange(const CTransaction& tx) const
     return nChange;
 }
 
-void CWalletTx::SetNoteData(mapNoteData_t &noteData)
+void CWalletTx::MarkDirty()
+{
+    fCreditCached = false;
+    fAvailableCreditCached = false;
+    fWatchDebitCached = false;
+    fWatchCreditCached = false;
+    fAvailableWatchCreditCached = false;
+    fImmatureWatchCreditCached = false;
+    fDebitCached = false;
+    fChangeCached = false;
+    if (pwallet)
+        pwallet->MarkBalancesDirty();
+}
+
+void CWalletTx::SetNoteData(const mapNoteData_t &noteData)
 {
     mapNoteData.clear();
     for (const std::pair<JSOutPoint, CNoteData> nd : noteData) {
@@ -1722,30 +2232,37 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
         CBlock block;
         ReadBlockFromDisk(block, pindex);
 
+        std::vector<uint256> vBlockCommitments;
         BOOST_FOREACH(const CTransaction& tx, block.vtx)
         {
             BOOST_FOREACH(const JSDescription& jsdesc, tx.vjoinsplit)
             {
-                BOOST_FOREACH(const uint256 &note_commitment, jsdesc.commitments)
-                {
-                    tree.append(note_commitment);
+                vBlockCommitments.insert(vBlockCommitments.end(), jsdesc.commitments.begin(), jsdesc.commitments.end());
+            }
+        }
 
-                    BOOST_FOREACH(boost::optional<ZCIncrementalWitness>& wit, witnesses) {
-                        if (wit) {
-                            wit->append(note_commitment);
-                        }
-                    }
+        BOOST_FOREACH(boost::optional<ZCIncrementalWitness>& wit, witnesses) {
+            if (wit) {
+                wit->append_range(vBlockCommitments.begin(), vBlockCommitments.end());
+            }
+        }
 
-                    size_t i = 0;
-                    BOOST_FOREACH(uint256& commitment, commitments) {
-                        if (note_commitment == commitment) {
-                            witnesses.at(i) = tree.witness();
-                        }
-                        i++;
-                    }
+        // The tree is appended up to each commitment looked for, whose
+        // witness then gets the rest of the block
+        size_t nAppended = 0;
+        for (size_t n = 0; n < vBlockCommitments.size(); n++) {
+            size_t i = 0;
+            BOOST_FOREACH(uint256& commitment, commitments) {
+                if (vBlockCommitments[n] == commitment) {
+                    tree.append_range(vBlockCommitments.begin() + nAppended, vBlockCommitments.begin() + n + 1);
+                    nAppended = n + 1;
+                    witnesses.at(i) = tree.witness();
+                    witnesses.at(i)->append_range(vBlockCommitments.begin() + n + 1, vBlockCommitments.end());
                 }
+                i++;
             }
         }
+        tree.append_range(vBlockCommitments.begin() + nAppended, vBlockCommitments.end());
 
         uint256 current_anchor = tree.root();
 
@@ -1767,6 +2284,94 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+namespace {
+
+//! Number of blocks the rescan reader may have read ahead of the wallet
+const size_t RESCAN_PREFETCH_BLOCKS = 16;
+
+/**
+ * Reads the blocks of a rescan from disk on a separate thread, so that
+ * reading and deserializing the next blocks overlaps with the wallet
+ * processing the current one. The block indexes are fixed when it is
+ * created and must stay valid, which the rescan ensures by holding cs_main.
+ * A NULL index stands for a block that is skipped and comes out empty.
+ */
+class CRescanBlockReader
+{
+private:
+    const std::vector<CBlockIndex*> vIndexes;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<CBlock> queue;
+    bool fStop;
+    boost::thread thread;
+
+    void Run()
+    {
+        for (CBlockIndex* pindex : vIndexes) {
+            CBlock block;
+            if (pindex)
+                ReadBlockFromDisk(block, pindex);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.size() >= RESCAN_PREFETCH_BLOCKS && !fStop)
+                cond.wait(lock);
+            if (fStop)
+                return;
+            queue.push_back(CBlock());
+            std::swap(queue.back(), block);
+            cond.notify_all();
+        }
+    }
+
+public:
+    CRescanBlockReader(const std::vector<CBlockIndex*>& vIndexesIn) : vIndexes(vIndexesIn), fStop(false)
+    {
+        thread = boost::thread(&CRescanBlockReader::Run, this);
+    }
+
+    ~CRescanBlockReader()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        thread.join();
+    }
+
+    /** Wait for the next block in chain order. */
+    void Next(CBlock& block)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty())
+            cond.wait(lock);
+        std::swap(block, queue.front());
+        queue.pop_front();
+        cond.notify_all();
+    }
+};
+
+}
+
+void CWallet::GetBlockFilterElements(GCSFilter::ElementSet& elements) const
+{
+    LOCK(cs_wallet);
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    for (const CKeyID& keyID : setKeys) {
+        elements.insert(GetFilterElement(GetScriptForDestination(keyID, false)));
+        CPubKey pubkey;
+        if (GetPubKey(keyID, pubkey))
+            elements.insert(GetFilterElement(CScript() << ToByteVector(pubkey) << OP_CHECKSIG));
+    }
+    for (const ScriptMap::value_type& item : mapScripts) {
+        elements.insert(GetFilterElement(GetScriptForDestination(item.first, false)));
+        elements.insert(GetFilterElement(item.second));
+    }
+    for (const CScript& script : setWatchOnly)
+        elements.insert(GetFilterElement(script));
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1790,18 +2395,49 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
+        // With the block filter index, blocks that have no JoinSplit and
+        // none of our scriptPubKeys among their outputs or spent outputs
+        // cannot concern us and are not read at all.
+        GCSFilter::ElementSet filterElements;
+        if (fBlockFilterIndex)
+            GetBlockFilterElements(filterElements);
+        int nSkipped = 0;
+
+        // The wallet updates and witness increments have to follow the chain
+        // in order under both locks, but the blocks can be read ahead.
+        std::vector<CBlockIndex*> vIndexes;
+        for (CBlockIndex* pindexRead = pindex; pindexRead; pindexRead = chainActive.Next(pindexRead)) {
+            CBlockFilter filter;
+            if (fBlockFilterIndex && pblocktree->ReadBlockFilter(pindexRead->GetBlockHash(), filter) &&
+                    !filter.HasJoinSplits() && !filter.GetFilter().MatchAny(filterElements)) {
+                vIndexes.push_back(NULL);
+                nSkipped++;
+            } else {
+                vIndexes.push_back(pindexRead);
+            }
+        }
+        if (nSkipped > 0)
+            LogPrintf("Rescan skips %d of %u blocks thanks to the block filter index\n", nSkipped, vIndexes.size());
+        CRescanBlockReader reader(vIndexes);
+        CWalletDB walletdb(strWalletFile, "r+", false);
+
         while (pindex)
         {
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
             CBlock block;
-            ReadBlockFromDisk(block, pindex);
+            reader.Next(block);
+            // Commit the wallet writes of each block together
+            bool fBatch = !block.vtx.empty() && walletdb.TxnBegin();
             BOOST_FOREACH(CTransaction& tx, block.vtx)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate, &walletdb))
                     ret++;
             }
+            if (fBatch && !walletdb.TxnCommit())
+                LogPrintf("ScanForWalletTransactions(): Couldn't commit wallet writes\n");
 
             ZCIncrementalMerkleTree tree;
             // This should never fail: we should always be able to get the tree
@@ -1810,11 +2446,11 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             // Increment note witness caches
             IncrementNoteWitnesses(pindex, &block, tree);
 
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
+            pindex = chainActive.Next(pindex);
         }
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
@@ -1860,7 +2496,7 @@ bool CWalletTx::RelayWalletTransaction()
     {
         if (GetDepthInMainChain() == 0) {
             LogPrintf("Relaying wtx %s\n", GetHash().ToString());
-            RelayTransaction((CTransaction)*this);
+            RelayMempoolTransaction(*this);
             return true;
         }
     }
@@ -2070,12 +2706,16 @@ std::vector<uint256> CWallet::ResendWalletTransactionsBefore(int64_t nTime)
 {
     std::vector<uint256> result;
 
-    LOCK(cs_wallet);
+    LOCK2(cs_main, cs_wallet);
+    // Only the transactions not in an active block may be unconfirmed
+    std::set<uint256> setTxids;
+    GetTxsNotInChain(setTxids);
+
     // Sort them in chronological order
     multimap<unsigned int, CWalletTx*> mapSorted;
-    BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+    BOOST_FOREACH(const uint256& hash, setTxids)
     {
-        CWalletTx& wtx = item.second;
+        CWalletTx& wtx = mapWallet[hash];
         // Don't rebroadcast if newer than nTime:
         if (wtx.nTimeReceived > nTime)
             continue;
@@ -2124,94 +2764,91 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime)
  */
 
 
-CAmount CWallet::GetBalance() const
+const CWallet::CBalanceCache& CWallet::GetBalanceCache() const
 {
-    CAmount nTotal = 0;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    CBalanceCache& cache = balanceCache;
+    if (cache.fValid && cache.nGeneration == nBalanceGeneration &&
+            cache.nTransactions == mapWallet.size() && cache.pindexTip == chainActive.Tip()) {
+        bool fUnchanged = true;
+        for (const std::pair<uint256, std::pair<bool, bool> >& item : cache.vUnconfirmed) {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(item.first);
+            if (it == mapWallet.end() || mempool.exists(item.first) != item.second.first ||
+                    CheckFinalTx(it->second) != item.second.second) {
+                fUnchanged = false;
+                break;
+            }
+        }
+        if (fUnchanged)
+            return cache;
+    }
+
+    cache = CBalanceCache();
+    cache.nGeneration = nBalanceGeneration;
+    cache.nTransactions = mapWallet.size();
+    cache.pindexTip = chainActive.Tip();
+    cache.nBalance = cache.nUnconfirmedBalance = cache.nImmatureBalance = 0;
+    cache.nWatchOnlyBalance = cache.nUnconfirmedWatchOnlyBalance = cache.nImmatureWatchOnlyBalance = 0;
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+        const CWalletTx* pcoin = &(*it).second;
+        const bool fFinal = CheckFinalTx(*pcoin);
+        const int nDepth = pcoin->GetDepthInMainChain();
+        if (nDepth <= 0 || !fFinal)
+            cache.vUnconfirmed.push_back(std::make_pair(it->first, std::make_pair(mempool.exists(it->first), fFinal)));
+
+        const bool fTrusted = pcoin->IsTrusted();
+        if (fTrusted) {
+            cache.nBalance += pcoin->GetAvailableCredit();
+            cache.nWatchOnlyBalance += pcoin->GetAvailableWatchOnlyCredit();
         }
+        if (!fFinal || (!fTrusted && nDepth == 0)) {
+            cache.nUnconfirmedBalance += pcoin->GetAvailableCredit();
+            cache.nUnconfirmedWatchOnlyBalance += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        cache.nImmatureBalance += pcoin->GetImmatureCredit();
+        cache.nImmatureWatchOnlyBalance += pcoin->GetImmatureWatchOnlyCredit();
     }
+    cache.fValid = true;
+    return cache;
+}
 
-    return nTotal;
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceCache().nBalance;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceCache().nUnconfirmedBalance;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceCache().nImmatureBalance;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceCache().nWatchOnlyBalance;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceCache().nUnconfirmedWatchOnlyBalance;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalanceCache().nImmatureWatchOnlyBalance;
 }
 
 /**
@@ -2274,7 +2911,57 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+/**
+ * Depth-first branch and bound search for a subset of vValue, sorted by
+ * descending value, that adds up to exactly nTargetValue, so that no change
+ * is needed. A branch is dropped as soon as it overshoots the target or
+ * cannot reach it with the coins left, and a coin is not tried after an
+ * excluded coin of the same value. Gives up after MAX_BNB_TRIES steps.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower,
+                           const CAmount& nTargetValue, vector<char>& vfBest)
+{
+    vector<char> vfIncluded(vValue.size(), false);
+    CAmount nSelected = 0;
+    // Value of the coins from i on, not decided yet
+    CAmount nRemaining = nTotalLower;
+    size_t i = 0;
+
+    for (unsigned int nTries = 0; nTries < MAX_BNB_TRIES; nTries++)
+    {
+        if (nSelected == nTargetValue)
+        {
+            vfBest = vfIncluded;
+            return true;
+        }
+        if (nSelected > nTargetValue || nSelected + nRemaining < nTargetValue)
+        {
+            // Backtrack to the last included coin, and exclude it
+            while (i > 0 && !vfIncluded[i - 1])
+            {
+                i--;
+                nRemaining += vValue[i].first;
+            }
+            if (i == 0)
+                return false;
+            vfIncluded[i - 1] = false;
+            nSelected -= vValue[i - 1].first;
+        }
+        else
+        {
+            if (i == 0 || vfIncluded[i - 1] || vValue[i].first != vValue[i - 1].first)
+            {
+                vfIncluded[i] = true;
+                nSelected += vValue[i].first;
+            }
+            nRemaining -= vValue[i].first;
+            i++;
+        }
+    }
+    return false;
+}
+
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
     vector<char> vfIncluded;
@@ -2386,14 +3073,23 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+    // Look for an exact match first, then solve subset sum by stochastic
+    // approximation, with fewer iterations for many coins to bound the work
+    if (SelectCoinsBnB(vValue, nTotalLower, nTargetValue, vfBest))
+    {
+        nBest = nTargetValue;
+    }
+    else
+    {
+        int nIterations = std::max((size_t)1, std::min((size_t)1000, MAX_SUBSET_SEARCH_STEPS / vValue.size()));
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, nIterations);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, nIterations);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -2432,9 +3128,19 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
         fProtectCFCoinbase = fProtectCoinbase;
 
     // Output parameter fOnlyCoinbaseCoinsRet is set to true when the only available coins are coinbase utxos.
+    // The wallet is scanned once, and the coins without protected coinbase
+    // filtered out of the result.
     vector<COutput> vCoinsNoProtectedCoinbase, vCoinsWithProtectedCoinbase;
-    AvailableCoins(vCoinsNoProtectedCoinbase, true, coinControl, false, false, !fProtectCFCoinbase);
     AvailableCoins(vCoinsWithProtectedCoinbase, true, coinControl, false, true, true);
+    {
+        LOCK(cs_main);
+        for (const COutput& out : vCoinsWithProtectedCoinbase) {
+            if (out.tx->IsCoinBase() &&
+                (fProtectCFCoinbase || !IsCommunityFund(pcoinsTip->AccessCoins(out.tx->GetHash()), out.i)))
+                continue;
+            vCoinsNoProtectedCoinbase.push_back(out);
+        }
+    }
     fOnlyCoinbaseCoinsRet = vCoinsNoProtectedCoinbase.size() == 0 && vCoinsWithProtectedCoinbase.size() > 0;
 
     vector<COutput> vCoins = (fProtectCoinbase) ? vCoinsNoProtectedCoinbase : vCoinsWithProtectedCoinbase;
@@ -2781,25 +3487,44 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                     }
                 }
 
-                // Sign
-                int nIn = 0;
+                // Sign, runs of inputs on threads of their own: the signature hash of
+                // an input blanks the scripts of all others, so they all hash the one
+                // copy of the transaction and its precomputed parts
                 CTransaction txNewConst(txNew);
+                const PrecomputedTransactionData txdata(txNewConst);
+                std::vector<const CScript*> vScriptPubKeys;
+                vScriptPubKeys.reserve(setCoins.size());
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                {
-                    bool signSuccess;
-                    const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
-                    CScript& scriptSigRes = txNew.vin[nIn].scriptSig;
-                    if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, SIGHASH_ALL), scriptPubKey, scriptSigRes);
-                    else
-                        signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, scriptSigRes);
-
-                    if (!signSuccess)
+                    vScriptPubKeys.push_back(&coin.first->vout[coin.second].scriptPubKey);
+                std::atomic<bool> fSignFailed(false);
+                auto signInputs = [&](size_t nBegin, size_t nEnd) {
+                    for (size_t nIn = nBegin; nIn < nEnd && !fSignFailed; nIn++)
                     {
-                        strFailReason = _("Signing transaction failed");
-                        return false;
+                        bool signSuccess;
+                        const CScript& scriptPubKey = *vScriptPubKeys[nIn];
+                        CScript& scriptSigRes = txNew.vin[nIn].scriptSig;
+                        if (sign)
+                            signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, SIGHASH_ALL, &txdata), scriptPubKey, scriptSigRes);
+                        else
+                            signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, scriptSigRes);
+
+                        if (!signSuccess)
+                            fSignFailed = true;
                     }
-                    nIn++;
+                };
+                size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vScriptPubKeys.size() / MIN_SIGNATURE_INPUTS_PER_THREAD);
+                nThreads = sign ? std::max(nThreads, (size_t)1) : 1;
+                std::vector<std::thread> threads;
+                for (size_t n = 1; n < nThreads; n++)
+                    threads.emplace_back(signInputs, vScriptPubKeys.size() * n / nThreads, vScriptPubKeys.size() * (n + 1) / nThreads);
+                signInputs(0, vScriptPubKeys.size() / nThreads);
+                for (std::thread& t : threads)
+                    t.join();
+
+                if (fSignFailed)
+                {
+                    strFailReason = _("Signing transaction failed");
+                    return false;
                 }
 
                 unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
@@ -3004,8 +3729,11 @@ DBErrors CWallet::ZapWalletTx(std::vector<CWalletTx>& vWtx)
 bool CWallet::SetAddressBook(const CTxDestination& address, const string& strName, const string& strPurpose)
 {
     bool fUpdated = false;
+    CWalletDB *pwalletdb = NULL;
     {
         LOCK(cs_wallet); // mapAddressBook
+        // Only the thread writing a batch, which holds cs_wallet, can see it set
+        pwalletdb = pwalletdbBatch;
         std::map<CTxDestination, CAddressBookData>::iterator mi = mapAddressBook.find(address);
         fUpdated = mi != mapAddressBook.end();
         mapAddressBook[address].name = strName;
@@ -3016,6 +3744,11 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW) );
     if (!fFileBacked)
         return false;
+    if (pwalletdb) {
+        if (!strPurpose.empty() && !pwalletdb->WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
+            return false;
+        return pwalletdb->WriteName(CBitcoinAddress(address).ToString(), strName);
+    }
     if (!strPurpose.empty() && !CWalletDB(strWalletFile).WritePurpose(CBitcoinAddress(address).ToString(), strPurpose))
         return false;
     return CWalletDB(strWalletFile).WriteName(CBitcoinAddress(address).ToString(), strName);
@@ -3073,18 +3806,56 @@ bool CWallet::NewKeyPool()
         if (IsLocked())
             return false;
 
-        int64_t nKeys = max(GetArg("-keypool", 100), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
-        {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
+        unsigned int nKeys = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t)0);
+        while (setKeyPool.size() < nKeys)
+            AddKeysToKeyPool(min(nKeys - (unsigned int)setKeyPool.size(), KEYPOOL_BATCH_SIZE));
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
     return true;
 }
 
+/**
+ * Generate nKeys new keys and append them to the key pool. The keys and their
+ * pool entries are written in one database transaction.
+ */
+void CWallet::AddKeysToKeyPool(unsigned int nKeys)
+{
+    AssertLockHeld(cs_wallet);
+    assert(!pwalletdbEncryption && !pwalletdbBatch);
+
+    // Bump the version before the transaction is opened, GenerateNewKey()
+    // would otherwise write it through a second handle
+    if (CanSupportFeature(FEATURE_COMPRPUBKEY))
+        SetMinVersion(FEATURE_COMPRPUBKEY);
+
+    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.TxnBegin())
+        throw runtime_error("AddKeysToKeyPool(): TxnBegin failed");
+
+    int64_t nBegin = 1;
+    if (!setKeyPool.empty())
+        nBegin = *(--setKeyPool.end()) + 1;
+
+    pwalletdbBatch = &walletdb;
+    try {
+        for (unsigned int i = 0; i < nKeys; i++) {
+            if (!walletdb.WritePool(nBegin + i, CKeyPool(GenerateNewKey())))
+                throw runtime_error("AddKeysToKeyPool(): writing generated key failed");
+        }
+    } catch (...) {
+        pwalletdbBatch = NULL;
+        walletdb.TxnAbort();
+        throw;
+    }
+    pwalletdbBatch = NULL;
+
+    if (!walletdb.TxnCommit())
+        throw runtime_error("AddKeysToKeyPool(): TxnCommit failed");
+    for (unsigned int i = 0; i < nKeys; i++)
+        setKeyPool.insert(nBegin + i);
+    LogPrintf("keypool added keys %d to %d, size=%u\n", nBegin, nBegin + nKeys - 1, setKeyPool.size());
+}
+
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
     {
@@ -3093,27 +3864,60 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
-
         // Top up key pool
         unsigned int nTargetSize;
         if (kpSize > 0)
             nTargetSize = kpSize;
         else
-            nTargetSize = max(GetArg("-keypool", 100), (int64_t) 0);
+            nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
 
         while (setKeyPool.size() < (nTargetSize + 1))
+            AddKeysToKeyPool(min(nTargetSize + 1 - (unsigned int)setKeyPool.size(), KEYPOOL_BATCH_SIZE));
+    }
+    return true;
+}
+
+/**
+ * Add at most one batch of keys towards the -keypool target, so that cs_wallet
+ * is only held briefly. Returns whether the key pool still needs more keys.
+ */
+bool CWallet::RefillKeyPool()
+{
+    LOCK(cs_wallet);
+
+    if (IsLocked())
+        return false;
+
+    unsigned int nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0) + 1;
+    if (setKeyPool.size() >= nTargetSize)
+        return false;
+
+    AddKeysToKeyPool(min(nTargetSize - (unsigned int)setKeyPool.size(), KEYPOOL_BATCH_SIZE));
+    return setKeyPool.size() < nTargetSize;
+}
+
+void ThreadRefillKeyPool(CWallet* pwallet)
+{
+    // Make this thread recognisable as the key pool refilling thread
+    RenameThread("horizen-keypool");
+
+    unsigned int nMinSize = max(GetArg("-keypoolmin", DEFAULT_KEYPOOL_MIN), (int64_t) 0);
+    if (nMinSize == 0)
+        return;
+
+    while (true)
+    {
+        MilliSleep(250);
+
         {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool(): writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            LOCK(pwallet->cs_wallet);
+            if (pwallet->GetKeyPoolSize() >= nMinSize)
+                continue;
         }
+
+        while (pwallet->RefillKeyPool())
+            boost::this_thread::interruption_point();
     }
-    return true;
 }
 
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
@@ -3123,7 +3927,9 @@ void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
     {
         LOCK(cs_wallet);
 
-        if (!IsLocked())
+        // When -keypoolmin is set the pool is refilled in the background, and
+        // only topped up here once it has run dry
+        if (!IsLocked() && (setKeyPool.empty() || GetArg("-keypoolmin", DEFAULT_KEYPOOL_MIN) <= 0))
             TopUpKeyPool();
 
         // Get the oldest key
@@ -3441,6 +4247,36 @@ void CWallet::ListLockedCoins(std::vector<COutPoint>& vOutpts)
     }
 }
 
+bool CWallet::IsLockedNote(const JSOutPoint& outpt) const
+{
+    AssertLockHeld(cs_wallet); // setLockedNotes
+    return (setLockedNotes.count(outpt) > 0);
+}
+
+void CWallet::LockNote(const JSOutPoint& output)
+{
+    AssertLockHeld(cs_wallet); // setLockedNotes
+    setLockedNotes.insert(output);
+}
+
+void CWallet::UnlockNote(const JSOutPoint& output)
+{
+    AssertLockHeld(cs_wallet); // setLockedNotes
+    setLockedNotes.erase(output);
+}
+
+void CWallet::UnlockAllNotes()
+{
+    AssertLockHeld(cs_wallet); // setLockedNotes
+    setLockedNotes.clear();
+}
+
+void CWallet::ListLockedNotes(std::vector<JSOutPoint>& vOutpts)
+{
+    AssertLockHeld(cs_wallet); // setLockedNotes
+    vOutpts.insert(vOutpts.end(), setLockedNotes.begin(), setLockedNotes.end());
+}
+
 /** @} */ // end of Actions
 
 class CAffectedKeysVisitor : public boost::static_visitor<void> {
@@ -3553,6 +4389,30 @@ bool CWallet::LoadDestData(const CTxDestination &dest, const std::string &key, c
     return true;
 }
 
+bool CWallet::LoadNoteWitnesses(const JSOutPoint& jsoutpt, int witnessHeight,
+                                const std::map<int, ZCIncrementalWitness>& witnesses)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, CWalletTx>::iterator it = mapWallet.find(jsoutpt.hash);
+    if (it == mapWallet.end() || !it->second.mapNoteData.count(jsoutpt)) {
+        return false;
+    }
+    CNoteData& nd = it->second.mapNoteData[jsoutpt];
+    // The stored records replace whatever an older CWalletTx record carried.
+    // Rebuild the cache from witnessHeight down, as far as it is contiguous.
+    nd.witnesses.clear();
+    nd.witnessHeight = witnessHeight;
+    for (int nHeight = witnessHeight; nd.witnesses.size() < WITNESS_CACHE_SIZE; nHeight--) {
+        std::map<int, ZCIncrementalWitness>::const_iterator wit = witnesses.find(nHeight);
+        if (wit == witnesses.end()) {
+            break;
+        }
+        nd.witnesses.push_back(wit->second);
+    }
+    nd.MarkWitnessesWritten();
+    return true;
+}
+
 bool CWallet::GetDestData(const CTxDestination &dest, const std::string &key, std::string *value) const
 {
     std::map<CTxDestination, CAddressBookData>::const_iterator i = mapAddressBook.find(dest);
@@ -3659,11 +4519,16 @@ bool CMerkleTx::AcceptToMemoryPool(bool fLimitFree, bool fRejectAbsurdFee)
 }
 
 /**
- * Find notes in the wallet filtered by payment address, min depth and ability to spend.
- * These notes are decrypted and added to the output parameter vector, outEntries.
+ * Call f for the notes in the wallet with the given payment address (or any,
+ * if empty), min depth and ability to spend. The caller holds cs_main and
+ * cs_wallet.
  */
-void CWallet::GetFilteredNotes(std::vector<CNotePlaintextEntry> & outEntries, std::string address, int minDepth, bool ignoreSpent, bool ignoreUnspendable)
+void CWallet::ForEachFilteredNote(std::string address, int minDepth, bool ignoreSpent, bool ignoreUnspendable, bool ignoreLocked,
+                                  const std::function<void(const CWalletTx&, const JSOutPoint&, const CNoteData&)>& f)
 {
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
     bool fFilterAddress = false;
     libzcash::PaymentAddress filterPaymentAddress;
     if (address.length() > 0) {
@@ -3671,69 +4536,159 @@ void CWallet::GetFilteredNotes(std::vector<CNotePlaintextEntry> & outEntries, st
         fFilterAddress = true;
     }
 
-    LOCK2(cs_main, cs_wallet);
+    // Filter the transactions before checking for notes
+    auto acceptTx = [&](const CWalletTx& wtx) {
+        return CheckFinalTx(wtx) && wtx.GetBlocksToMaturity() <= 0 && wtx.GetDepthInMainChain() >= minDepth;
+    };
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    auto addNote = [&](const CWalletTx& wtx, const JSOutPoint& jsop, const CNoteData& nd) {
+        PaymentAddress pa = nd.address;
 
-        // Filter the transactions before checking for notes
-        if (!CheckFinalTx(wtx) || wtx.GetBlocksToMaturity() > 0 || wtx.GetDepthInMainChain() < minDepth) {
-            continue;
+        // skip note which has been spent
+        if (ignoreSpent && nd.nullifier && IsSpent(*nd.nullifier)) {
+            return;
         }
 
-        if (wtx.mapNoteData.size() == 0) {
-            continue;
+        // skip notes which cannot be spent
+        if (ignoreUnspendable && !HaveSpendingKey(pa)) {
+            return;
         }
 
-        for (auto & pair : wtx.mapNoteData) {
-            JSOutPoint jsop = pair.first;
-            CNoteData nd = pair.second;
-            PaymentAddress pa = nd.address;
+        // skip notes reserved by an operation in progress
+        if (ignoreLocked && IsLockedNote(jsop)) {
+            return;
+        }
 
-            // skip notes which belong to a different payment address in the wallet
-            if (fFilterAddress && !(pa == filterPaymentAddress)) {
-                continue;
-            }
+        f(wtx, jsop, nd);
+    };
 
-            // skip note which has been spent
-            if (ignoreSpent && nd.nullifier && IsSpent(*nd.nullifier)) {
+    if (fFilterAddress) {
+        std::map<PaymentAddress, std::set<JSOutPoint> >::const_iterator mi = mapAddressNotes.find(filterPaymentAddress);
+        if (mi == mapAddressNotes.end()) {
+            return;
+        }
+        for (const JSOutPoint& jsop : mi->second) {
+            std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(jsop.hash);
+            if (it == mapWallet.end() || !acceptTx(it->second)) {
                 continue;
             }
-
-            // skip notes which cannot be spent
-            if (ignoreUnspendable && !HaveSpendingKey(pa)) {
+            mapNoteData_t::const_iterator nd = it->second.mapNoteData.find(jsop);
+            if (nd == it->second.mapNoteData.end() || !(nd->second.address == filterPaymentAddress)) {
                 continue;
             }
+            addNote(it->second, jsop, nd->second);
+        }
+        return;
+    }
 
-            int i = jsop.js; // Index into CTransaction.vjoinsplit
-            int j = jsop.n; // Index into JSDescription.ciphertexts
+    for (const std::pair<const uint256, CWalletTx>& p : mapWallet) {
+        const CWalletTx& wtx = p.second;
 
-            // Get cached decryptor
-            ZCNoteDecryption decryptor;
-            if (!GetNoteDecryptor(pa, decryptor)) {
-                // Note decryptors are created when the wallet is loaded, so it should always exist
-                throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", CZCPaymentAddress(pa).ToString()));
-            }
+        if (wtx.mapNoteData.size() == 0 || !acceptTx(wtx)) {
+            continue;
+        }
 
-            // determine amount of funds in the note
-            auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
-            try {
-                NotePlaintext plaintext = NotePlaintext::decrypt(
-                        decryptor,
-                        wtx.vjoinsplit[i].ciphertexts[j],
-                        wtx.vjoinsplit[i].ephemeralKey,
-                        hSig,
-                        (unsigned char) j);
+        for (const mapNoteData_t::value_type& pair : wtx.mapNoteData) {
+            addNote(wtx, pair.first, pair.second);
+        }
+    }
+}
 
-                outEntries.push_back(CNotePlaintextEntry{jsop, plaintext});
+/**
+ * Decrypt a note of the wallet. The plaintext of a note never changes, so it
+ * is only decrypted once. Throws std::runtime_error if that fails.
+ */
+const NotePlaintext& CWallet::GetNotePlaintext(const CWalletTx& wtx, const JSOutPoint& jsop, const PaymentAddress& pa)
+{
+    std::map<JSOutPoint, NotePlaintext>::const_iterator cached = mapNotePlaintexts.find(jsop);
+    if (cached != mapNotePlaintexts.end()) {
+        return cached->second;
+    }
 
-            } catch (const note_decryption_failed &err) {
-                // Couldn't decrypt with this spending key
-                throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", CZCPaymentAddress(pa).ToString()));
-            } catch (const std::exception &exc) {
-                // Unexpected failure
-                throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", CZCPaymentAddress(pa).ToString(), exc.what()));
-            }
+    int i = jsop.js; // Index into CTransaction.vjoinsplit
+    int j = jsop.n; // Index into JSDescription.ciphertexts
+
+    // Get cached decryptor
+    ZCNoteDecryption decryptor;
+    if (!GetNoteDecryptor(pa, decryptor)) {
+        // Note decryptors are created when the wallet is loaded, so it should always exist
+        throw std::runtime_error(strprintf("Could not find note decryptor for payment address %s", CZCPaymentAddress(pa).ToString()));
+    }
+
+    // determine amount of funds in the note
+    auto hSig = wtx.vjoinsplit[i].h_sig(*pzcashParams, wtx.joinSplitPubKey);
+    try {
+        NotePlaintext plaintext = NotePlaintext::decrypt(
+                decryptor,
+                wtx.vjoinsplit[i].ciphertexts[j],
+                wtx.vjoinsplit[i].ephemeralKey,
+                hSig,
+                (unsigned char) j);
+
+        return mapNotePlaintexts.insert(std::make_pair(jsop, plaintext)).first->second;
+
+    } catch (const note_decryption_failed &err) {
+        // Couldn't decrypt with this spending key
+        throw std::runtime_error(strprintf("Could not decrypt note for payment address %s", CZCPaymentAddress(pa).ToString()));
+    } catch (const std::exception &exc) {
+        // Unexpected failure
+        throw std::runtime_error(strprintf("Error while decrypting note for payment address %s: %s", CZCPaymentAddress(pa).ToString(), exc.what()));
+    }
+}
+
+/**
+ * Find notes in the wallet filtered by payment address, min depth and ability to spend.
+ * These notes are decrypted and added to the output parameter vector, outEntries.
+ */
+void CWallet::GetFilteredNotes(std::vector<CNotePlaintextEntry> & outEntries, std::string address, int minDepth, bool ignoreSpent, bool ignoreUnspendable, bool ignoreLocked)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    ForEachFilteredNote(address, minDepth, ignoreSpent, ignoreUnspendable, ignoreLocked,
+        [&](const CWalletTx& wtx, const JSOutPoint& jsop, const CNoteData& nd) {
+            outEntries.push_back(CNotePlaintextEntry{jsop, GetNotePlaintext(wtx, jsop, nd.address)});
+        });
+}
+
+/**
+ * Add up the values of the notes GetFilteredNotes would find. Only the notes
+ * without a cached value (see UpdateNullifierNoteMap) are decrypted.
+ */
+CAmount CWallet::GetFilteredNotesBalance(std::string address, int minDepth, bool ignoreSpent, bool ignoreUnspendable)
+{
+    CAmount balance = 0;
+    LOCK2(cs_main, cs_wallet);
+
+    ForEachFilteredNote(address, minDepth, ignoreSpent, ignoreUnspendable, false,
+        [&](const CWalletTx& wtx, const JSOutPoint& jsop, const CNoteData& nd) {
+            if (nd.value)
+                balance += *nd.value;
+            else
+                balance += CAmount(GetNotePlaintext(wtx, jsop, nd.address).value());
+        });
+    return balance;
+}
+
+size_t CWallet::DynamicMemoryUsage() const
+{
+    size_t nUsage = CCryptoKeyStore::DynamicMemoryUsage();
+    LOCK(cs_wallet);
+    nUsage += memusage::DynamicUsage(mapWallet) + memusage::DynamicUsage(wtxOrdered) +
+              memusage::DynamicUsage(mapTxSpends) + memusage::DynamicUsage(mapTxNullifiers) +
+              memusage::DynamicUsage(mapNullifiersToNotes) + memusage::DynamicUsage(mapRequestCount) +
+              memusage::DynamicUsage(mapAddressBook) + memusage::DynamicUsage(setKeyPool) +
+              memusage::DynamicUsage(mapKeyMetadata) + memusage::DynamicUsage(mapZKeyMetadata);
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        const CWalletTx& wtx = item.second;
+        nUsage += RecursiveDynamicUsage(static_cast<const CTransaction&>(wtx)) +
+                  memusage::DynamicUsage(wtx.vMerkleBranch) + memusage::DynamicUsage(wtx.mapValue) +
+                  memusage::DynamicUsage(wtx.vOrderForm) + memusage::DynamicUsage(wtx.mapNoteData);
+        // The witness caches of the notes are most of the memory of a shielded wallet
+        for (const std::pair<const JSOutPoint, CNoteData>& note : wtx.mapNoteData) {
+            nUsage += memusage::DynamicUsage(note.second.witnesses);
+            for (const ZCIncrementalWitness& witness : note.second.witnesses)
+                nUsage += witness.DynamicMemoryUsage();
         }
     }
+    return nUsage;
 }
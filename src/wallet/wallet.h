@@ -7,6 +7,7 @@
 #define BITCOIN_WALLET_WALLET_H
 
 #include "amount.h"
+#include "blockfilter.h"
 #include "coins.h"
 #include "consensus/consensus.h"
 #include "key.h"
@@ -25,8 +26,10 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <functional>
 #include <map>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
@@ -51,10 +54,22 @@ static const CAmount nHighTransactionFeeWarning = 0.01 * COIN;
 static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.1 * COIN;
 //! -txconfirmtarget default
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
+//! -joinsplitproverthreads default
+static const int DEFAULT_JOINSPLIT_PROVER_THREADS = 2;
+//! -keypool default
+static const unsigned int DEFAULT_KEYPOOL_SIZE = 100;
+//! -keypoolmin default, 0 leaves the key pool to be topped up on demand
+static const unsigned int DEFAULT_KEYPOOL_MIN = 0;
+//! Keys generated and written per database transaction when topping up the key pool
+static const unsigned int KEYPOOL_BATCH_SIZE = 20;
 //! -maxtxfee will warn if called with a higher fee than this amount (in satoshis)
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! Largest number of steps of the exact match search in coin selection
+static const unsigned int MAX_BNB_TRIES = 100000;
+//! Coins visited by the stochastic subset search in coin selection, over all its iterations
+static const size_t MAX_SUBSET_SEARCH_STEPS = 10000000;
 //! Size of witness cache
 //  Should be large enough that we can expect not to reorg beyond our cache
 //  unless there is some exceptional network disruption.
@@ -214,6 +229,16 @@ public:
      */
     boost::optional<uint256> nullifier;
 
+    /**
+     * Cached note value, learned together with the nullifier when the note
+     * is decrypted, so that balances don't need the note plaintext.
+     *
+     * The CNoteData record layout is shared with older versions, so the value
+     * is not part of it: CWalletTx stores the values of its notes in its
+     * mapValue instead (see ReadNoteValues and WriteNoteValues).
+     */
+    boost::optional<CAmount> value;
+
     /**
      * Cached incremental witnesses for spendable Notes.
      * Beginning of the list is the most recent witness.
@@ -231,11 +256,31 @@ public:
      */
     int witnessHeight;
 
-    CNoteData() : address(), nullifier(), witnessHeight {-1} { }
+    /**
+     * Witness cache state last written to wallet.dat (not serialized).
+     *
+     * The witness cache is not stored in the CWalletTx record: each witness
+     * has its own "notewitness" record keyed by block height, so
+     * CWallet::SetBestChain() only writes the witnesses added since the
+     * previous flush and erases those that fell out of the cache.
+     *
+     * witnessHeightOnDisk is the stored witnessHeight, or -2 if none has been
+     * stored yet. witnessesOnDisk is the number of stored witnesses ending at
+     * that height. The stored witnesses up to witnessSyncedHeight are known
+     * to match the cache; a reorg or a cache reset lowers it.
+     */
+    int witnessHeightOnDisk;
+    size_t witnessesOnDisk;
+    int witnessSyncedHeight;
+
+    CNoteData() : address(), nullifier(), value(), witnessHeight {-1},
+            witnessHeightOnDisk {-2}, witnessesOnDisk {0}, witnessSyncedHeight {-1} { }
     CNoteData(libzcash::PaymentAddress a) :
-            address {a}, nullifier(), witnessHeight {-1} { }
+            address {a}, nullifier(), value(), witnessHeight {-1},
+            witnessHeightOnDisk {-2}, witnessesOnDisk {0}, witnessSyncedHeight {-1} { }
     CNoteData(libzcash::PaymentAddress a, uint256 n) :
-            address {a}, nullifier {n}, witnessHeight {-1} { }
+            address {a}, nullifier {n}, value(), witnessHeight {-1},
+            witnessHeightOnDisk {-2}, witnessesOnDisk {0}, witnessSyncedHeight {-1} { }
 
     ADD_SERIALIZE_METHODS;
 
@@ -243,8 +288,29 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(address);
         READWRITE(nullifier);
-        READWRITE(witnesses);
-        READWRITE(witnessHeight);
+        if (ser_action.ForRead()) {
+            // Wallets written by older versions carry the witness cache here;
+            // it is used until the note has its own witness records.
+            READWRITE(witnesses);
+            READWRITE(witnessHeight);
+        } else {
+            std::list<ZCIncrementalWitness> noWitnesses;
+            int noWitnessHeight = -1;
+            READWRITE(noWitnesses);
+            READWRITE(noWitnessHeight);
+        }
+    }
+
+    /** Height of the oldest cached witness, one above witnessHeight if there are none. */
+    int OldestWitnessHeight() const {
+        return witnessHeight - (int)witnesses.size() + 1;
+    }
+
+    /** Records that the witness cache has been written to wallet.dat. */
+    void MarkWitnessesWritten() {
+        witnessHeightOnDisk = witnessHeight;
+        witnessesOnDisk = witnesses.size();
+        witnessSyncedHeight = witnessHeight;
     }
 
     friend bool operator<(const CNoteData& a, const CNoteData& b) {
@@ -263,6 +329,43 @@ public:
 
 typedef std::map<JSOutPoint, CNoteData> mapNoteData_t;
 
+/** Restore the cached note values that WriteNoteValues kept in mapValue */
+static void ReadNoteValues(mapNoteData_t& mapNoteData, mapValue_t& mapValue)
+{
+    if (!mapValue.count("notevalues"))
+        return;
+    std::istringstream entries(mapValue["notevalues"]);
+    std::string entry;
+    while (entries >> entry) {
+        std::istringstream fields(entry);
+        uint64_t js;
+        unsigned int n;
+        CAmount value;
+        char sep1, sep2;
+        if (!(fields >> js >> sep1 >> n >> sep2 >> value) || sep1 != ':' || sep2 != ':')
+            continue;
+        for (mapNoteData_t::value_type& item : mapNoteData) {
+            if (item.first.js == js && item.first.n == n)
+                item.second.value = value;
+        }
+    }
+}
+
+/** Keep the cached note values as "js:n:value" entries in mapValue */
+static void WriteNoteValues(const mapNoteData_t& mapNoteData, mapValue_t& mapValue)
+{
+    std::string entries;
+    for (const mapNoteData_t::value_type& item : mapNoteData) {
+        if (!item.second.value)
+            continue;
+        if (!entries.empty())
+            entries += " ";
+        entries += strprintf("%u:%u:%d", item.first.js, item.first.n, *item.second.value);
+    }
+    if (!entries.empty())
+        mapValue["notevalues"] = entries;
+}
+
 /** Decrypted note and its location in a transaction. */
 struct CNotePlaintextEntry
 {
@@ -271,6 +374,25 @@ struct CNotePlaintextEntry
 };
 
 
+/** A key read from a wallet dump, for CWallet::ImportKeys */
+struct CImportedKey
+{
+    CKey key;
+    CPubKey pubkey;
+    int64_t nCreateTime;
+    //! Change and reserve keys keep out of the address book
+    bool fLabel;
+    std::string strLabel;
+};
+
+/** A spending key read from a wallet dump, for CWallet::ImportKeys */
+struct CImportedZKey
+{
+    libzcash::SpendingKey key;
+    libzcash::PaymentAddress addr;
+    int64_t nCreateTime;
+};
+
 
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
@@ -439,6 +561,8 @@ public:
 
             if (nTimeSmart)
                 mapValue["timesmart"] = strprintf("%u", nTimeSmart);
+
+            WriteNoteValues(mapNoteData, mapValue);
         }
 
         READWRITE(*(CMerkleTx*)this);
@@ -459,6 +583,8 @@ public:
             ReadOrderPos(nOrderPos, mapValue);
 
             nTimeSmart = mapValue.count("timesmart") ? (unsigned int)atoi64(mapValue["timesmart"]) : 0;
+
+            ReadNoteValues(mapNoteData, mapValue);
         }
 
         mapValue.erase("fromaccount");
@@ -466,20 +592,12 @@ public:
         mapValue.erase("spent");
         mapValue.erase("n");
         mapValue.erase("timesmart");
+        mapValue.erase("notevalues");
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    //! Also invalidates the cached balances of the wallet
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -487,7 +605,7 @@ public:
         MarkDirty();
     }
 
-    void SetNoteData(mapNoteData_t &noteData);
+    void SetNoteData(const mapNoteData_t &noteData);
 
     //! filter decides which addresses will count towards the debit
     CAmount GetDebit(const isminefilter& filter) const;
@@ -661,6 +779,10 @@ private:
     bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool& fOnlyCoinbaseCoinsRet, bool& fNeedCoinbaseCoinsRet, const CCoinControl *coinControl = NULL) const;
 
     CWalletDB *pwalletdbEncryption;
+    //! Set while a batch of keys is being written in one database transaction
+    CWalletDB *pwalletdbBatch;
+
+    void AddKeysToKeyPool(unsigned int nKeys);
 
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
@@ -692,6 +814,35 @@ private:
     void AddToSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * The totals of the balance getters, all computed in one pass over
+     * mapWallet. They stay valid while nothing in the wallet is marked
+     * dirty, the chain tip is the same and the transactions that are not in
+     * a block of it are still in the same mempool and finality state.
+     */
+    struct CBalanceCache
+    {
+        bool fValid;
+        uint64_t nGeneration;
+        size_t nTransactions;
+        const CBlockIndex* pindexTip;
+        //! Unconfirmed or non-final transactions, whether they were in the mempool and final
+        std::vector<std::pair<uint256, std::pair<bool, bool> > > vUnconfirmed;
+        CAmount nBalance;
+        CAmount nUnconfirmedBalance;
+        CAmount nImmatureBalance;
+        CAmount nWatchOnlyBalance;
+        CAmount nUnconfirmedWatchOnlyBalance;
+        CAmount nImmatureWatchOnlyBalance;
+
+        CBalanceCache() : fValid(false), nGeneration(0), nTransactions(0), pindexTip(NULL) {}
+    };
+    mutable uint64_t nBalanceGeneration;
+    mutable CBalanceCache balanceCache;
+
+    //! Returns the balance totals, recomputing them if anything changed. cs_main and cs_wallet must be held.
+    const CBalanceCache& GetBalanceCache() const;
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -722,18 +873,13 @@ protected:
             return;
         }
         try {
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
-                // We skip transactions for which mapSproutNoteData is empty.
-                //This covers transactions that have no Sprout
-                // (i.e. are purely transparent), as well as shielding and unshielding
-                // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapNoteData.empty())) {
-                    if (!walletdb.WriteTx(wtxItem.first, wtx)) {
-                        LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
+            for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+                for (const mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
+                    if (!WriteNoteWitnessesINTERNAL(walletdb, item.first, item.second)) {
+                        LogPrintf("SetBestChain(): Failed to write note witnesses, aborting atomic write\n");
                         walletdb.TxnAbort();
                         return;
-                   }
+                    }
                 }
             }
             if (!walletdb.WriteWitnessCacheSize(nWitnessCacheSize)) {
@@ -758,6 +904,42 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            for (mapNoteData_t::value_type& item : wtxItem.second.mapNoteData) {
+                item.second.MarkWitnessesWritten();
+            }
+        }
+    }
+
+    /**
+     * Writes the changes to the witness cache of a note since it was last
+     * written: new witnesses, witnesses that left the cache and witnessHeight.
+     */
+    template <typename WalletDB>
+    bool WriteNoteWitnessesINTERNAL(WalletDB& walletdb, const JSOutPoint& jsoutpt, const CNoteData& nd) {
+        int nOldestOnDisk = nd.witnessHeightOnDisk - (int)nd.witnessesOnDisk + 1;
+        int nOldest = nd.OldestWitnessHeight();
+        for (int nHeight = nOldestOnDisk; nHeight <= nd.witnessHeightOnDisk; nHeight++) {
+            if (nHeight < nOldest || nHeight > nd.witnessHeight) {
+                if (!walletdb.EraseNoteWitness(jsoutpt, nHeight)) {
+                    return false;
+                }
+            }
+        }
+        int nHeight = nd.witnessHeight;
+        for (const ZCIncrementalWitness& witness : nd.witnesses) {
+            if (nHeight > nd.witnessSyncedHeight ||
+                nHeight < nOldestOnDisk || nHeight > nd.witnessHeightOnDisk) {
+                if (!walletdb.WriteNoteWitness(jsoutpt, nHeight, witness)) {
+                    return false;
+                }
+            }
+            nHeight--;
+        }
+        if (nd.witnessHeight != nd.witnessHeightOnDisk) {
+            return walletdb.WriteNoteWitnessHeight(jsoutpt, nd.witnessHeight);
+        }
+        return true;
     }
 
 private:
@@ -766,7 +948,17 @@ private:
 
 protected:
     bool UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx);
+    //! Adds a transaction to, or removes it from, the mapBlockTxs entry of hashBlock
+    void IndexTxBlock(const uint256& hash, const uint256& hashBlock, bool fAdd);
+    //! Builds mapBlockTxs and setBlockTxsNotInChain on first use
+    void IndexBlockTxs();
     void MarkAffectedTransactionsDirty(const CTransaction& tx);
+    //! Calls f for the notes GetFilteredNotes selects
+    void ForEachFilteredNote(std::string address, int minDepth, bool ignoreSpent, bool ignoreUnspendable, bool ignoreLocked,
+                             const std::function<void(const CWalletTx&, const JSOutPoint&, const CNoteData&)>& f);
+    //! The plaintext of a wallet note, decrypted on first use
+    const libzcash::NotePlaintext& GetNotePlaintext(const CWalletTx& wtx, const JSOutPoint& jsop,
+                                                    const libzcash::PaymentAddress& pa);
 
 public:
     /*
@@ -815,14 +1007,20 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        pwalletdbBatch = NULL;
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        nBalanceGeneration = 0;
+        fBlockTxsIndexed = false;
     }
 
+    //! Invalidate the cached balances, for changes that affect them without marking a transaction dirty
+    void MarkBalancesDirty() const { nBalanceGeneration++; }
+
     /**
      * The reverse mapping of nullifiers to notes.
      *
@@ -873,6 +1071,26 @@ public:
      */
     std::map<uint256, JSOutPoint> mapNullifiersToNotes;
 
+    /**
+     * The notes of each payment address, filled in as note data is added to
+     * the wallet so that GetFilteredNotes for one address does not walk
+     * mapWallet. Entries are checked against mapWallet when used.
+     */
+    std::map<libzcash::PaymentAddress, std::set<JSOutPoint> > mapAddressNotes;
+    /** Plaintexts of the wallet notes decrypted so far, which never change for a given note. */
+    std::map<JSOutPoint, libzcash::NotePlaintext> mapNotePlaintexts;
+
+    /**
+     * The transactions of mapWallet by the block they are in (null for none),
+     * and those of these blocks that are not in the active chain, so that
+     * listsinceblock only looks at the recent blocks. Built by the first
+     * GetTxsSinceBlock call, then kept up to date by AddToWallet, ChainTip and
+     * EraseFromWallet.
+     */
+    std::map<uint256, std::set<uint256> > mapBlockTxs;
+    std::set<uint256> setBlockTxsNotInChain;
+    bool fBlockTxsIndexed;
+
     std::map<uint256, CWalletTx> mapWallet;
     std::list<CAccountingEntry> laccentries;
 
@@ -888,6 +1106,7 @@ public:
     CPubKey vchDefaultKey;
 
     std::set<COutPoint> setLockedCoins;
+    std::set<JSOutPoint> setLockedNotes;
 
     int64_t nTimeFirstKey;
 
@@ -908,6 +1127,12 @@ public:
     void UnlockAllCoins();
     void ListLockedCoins(std::vector<COutPoint>& vOutpts);
 
+    bool IsLockedNote(const JSOutPoint& outpt) const;
+    void LockNote(const JSOutPoint& output);
+    void UnlockNote(const JSOutPoint& output);
+    void UnlockAllNotes();
+    void ListLockedNotes(std::vector<JSOutPoint>& vOutpts);
+
     /**
      * keystore implementation
      * Generate a new key
@@ -935,6 +1160,9 @@ public:
     bool EraseDestData(const CTxDestination &dest, const std::string &key);
     //! Adds a destination data tuple to the store, without saving it to disk
     bool LoadDestData(const CTxDestination &dest, const std::string &key, const std::string &value);
+    //! Restores the witness cache of a note from its own records (used by LoadWallet)
+    bool LoadNoteWitnesses(const JSOutPoint& jsoutpt, int witnessHeight,
+                           const std::map<int, ZCIncrementalWitness>& witnesses);
     //! Look up a destination data tuple in the store, return true if found false otherwise
     bool GetDestData(const CTxDestination &dest, const std::string &key, std::string *value) const;
 
@@ -944,6 +1172,16 @@ public:
     //! Adds a watch-only address to the store, without saving it to disk (used by LoadWallet)
     bool LoadWatchOnly(const CScript &dest);
 
+    /**
+     * Adds keys read from a wallet dump, with their creation times and
+     * labels, writing them all in one database transaction. Keys already in
+     * the wallet are skipped. nTimeFirst is lowered to the earliest creation
+     * time of the keys added. Returns false if any key could not be added.
+     */
+    bool ImportKeys(const std::vector<CImportedKey>& vKeys,
+                    const std::vector<CImportedZKey>& vZKeys,
+                    int64_t& nTimeFirst);
+
     bool Unlock(const SecureString& strWalletPassphrase);
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
     bool EncryptWallet(const SecureString& strWalletPassphrase);
@@ -981,14 +1219,35 @@ public:
     void MarkDirty();
     bool UpdateNullifierNoteMap();
     void UpdateNullifierNoteMapWithTx(const CWalletTx& wtx);
+    void UpdateAddressNoteMapWithTx(const CWalletTx& wtx);
+    /**
+     * Finds the transactions whose depth in the main chain is lower than the
+     * depth of pindex: those in the blocks above it, and those not in an
+     * active block. cs_main and cs_wallet must be held.
+     */
+    void GetTxsSinceBlock(const CBlockIndex* pindex, std::set<uint256>& setTxids);
+    /**
+     * Finds the transactions not in an active block, the only ones that may
+     * be unconfirmed. cs_main and cs_wallet must be held.
+     */
+    void GetTxsNotInChain(std::set<uint256>& setTxids);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    void SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock);
+    void SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock, CWalletDB& walletdb);
+    void BlockConnected(const CBlock& block, const CBlockIndex* pindex,
+                        const std::vector<CTransaction>& vtxConflicted,
+                        const ZCIncrementalMerkleTree& tree);
+    void BlockDisconnected(const CBlock& block, const CBlockIndex* pindex, const ZCIncrementalMerkleTree& tree);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, CWalletDB* pwalletdb = NULL);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const mapNoteData_t& noteData, const CBlock* pblock, bool fUpdate, CWalletDB* pwalletdb = NULL);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
          std::vector<boost::optional<ZCIncrementalWitness>>& witnesses,
          uint256 &final_anchor);
+    /** The block filter elements of every scriptPubKey this wallet can own or watch */
+    void GetBlockFilterElements(GCSFilter::ElementSet& elements) const;
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
@@ -1011,6 +1270,7 @@ public:
 
     bool NewKeyPool();
     bool TopUpKeyPool(unsigned int kpSize = 0);
+    bool RefillKeyPool();
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
     void ReturnKey(int64_t nIndex);
@@ -1028,8 +1288,10 @@ public:
         const libzcash::PaymentAddress& address,
         const ZCNoteDecryption& dec,
         const uint256& hSig,
-        uint8_t n) const;
+        uint8_t n,
+        CAmount* pvalue = NULL) const;
     mapNoteData_t FindMyNotes(const CTransaction& tx) const;
+    std::vector<mapNoteData_t> FindMyNotes(const std::vector<const CTransaction*>& vptx) const;
     bool IsFromMe(const uint256& nullifier) const;
     void GetNoteWitnesses(
          std::vector<JSOutPoint> notes,
@@ -1129,7 +1391,17 @@ public:
                           std::string address,
                           int minDepth=1,
                           bool ignoreSpent=true,
-                          bool ignoreUnspendable=true);
+                          bool ignoreUnspendable=true,
+                          bool ignoreLocked=false);
+
+    /* Total value of the notes GetFilteredNotes would find, from the cached note values */
+    CAmount GetFilteredNotesBalance(std::string address,
+                                    int minDepth=1,
+                                    bool ignoreSpent=true,
+                                    bool ignoreUnspendable=true);
+
+    /** Memory used by the transactions, notes and keys of the wallet */
+    size_t DynamicMemoryUsage() const;
     
 };
 
@@ -1158,6 +1430,12 @@ public:
 };
 
 
+/**
+ * Keep the key pool of a wallet between -keypoolmin and -keypool keys in the
+ * background, so that handing out a new address never has to generate keys.
+ */
+void ThreadRefillKeyPool(CWallet* pwallet);
+
 /** 
  * Account information.
  * Stored in wallet with key "acc"+string account name.
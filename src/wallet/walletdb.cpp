@@ -21,6 +21,9 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include <atomic>
+#include <thread>
+
 using namespace std;
 
 static uint64_t nAccountingEntryNumber = 0;
@@ -201,6 +204,24 @@ bool CWalletDB::WriteWitnessCacheSize(int64_t nWitnessCacheSize)
     return Write(std::string("witnesscachesize"), nWitnessCacheSize);
 }
 
+bool CWalletDB::WriteNoteWitnessHeight(const JSOutPoint& jsoutpt, int witnessHeight)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("notewitnessheight"), jsoutpt), witnessHeight);
+}
+
+bool CWalletDB::WriteNoteWitness(const JSOutPoint& jsoutpt, int nHeight, const ZCIncrementalWitness& witness)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("notewitness"), std::make_pair(jsoutpt, nHeight)), witness);
+}
+
+bool CWalletDB::EraseNoteWitness(const JSOutPoint& jsoutpt, int nHeight)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("notewitness"), std::make_pair(jsoutpt, nHeight)));
+}
+
 bool CWalletDB::ReadPool(int64_t nPool, CKeyPool& keypool)
 {
     return Read(std::make_pair(std::string("pool"), nPool), keypool);
@@ -387,6 +408,8 @@ public:
     bool fAnyUnordered;
     int nFileVersion;
     vector<uint256> vWalletUpgrade;
+    map<JSOutPoint, int> mapNoteWitnessHeights;
+    map<JSOutPoint, map<int, ZCIncrementalWitness> > mapNoteWitnesses;
 
     CWalletScanState() {
         nKeys = nCKeys = nKeyMeta = nZKeys = nCZKeys = nZKeyMeta = 0;
@@ -396,6 +419,100 @@ public:
     }
 };
 
+/**
+ * Decodes a "tx" record and checks the transaction, which includes verifying
+ * its JoinSplit proofs. Only touches its arguments, so that LoadWallet can
+ * run it for several records at once.
+ */
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    auto verifier = libzcash::ProofVerifier::Strict();
+    if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
+    {
+        // Don't consider REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND error code as a failure. It can appear because a tx
+        // is a pre-chainsplit tx, so it is perfectly fine in this case.
+        if (state.GetRejectCode() != REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND)
+            return false;
+    }
+    return true;
+}
+
+/** Adds a transaction decoded by ReadWalletTx to the wallet. */
+static void LoadWalletTx(CWallet* pwallet, CDataStream& ssValue, const uint256& hash, CWalletTx& wtx,
+                         CWalletScanState &wss, string& strErr)
+{
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        wss.vWalletUpgrade.push_back(hash);
+    }
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+}
+
+/** A "tx" record read by LoadWallet, decoded and checked later on a worker thread. */
+struct CWalletTxRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    uint256 hash;
+    CWalletTx wtx;
+    bool fValid;
+
+    CWalletTxRecord(const CDataStream& ssKeyIn, const CDataStream& ssValueIn) :
+        ssKey(ssKeyIn), ssValue(ssValueIn), fValid(false) {}
+};
+
+/**
+ * Runs ReadWalletTx for every record, spreading them over the available
+ * cores: checking the proofs of the transactions is most of the cost of
+ * loading a wallet with shielded transactions.
+ */
+static void ReadWalletTxs(vector<CWalletTxRecord>& vRecords)
+{
+    std::atomic<size_t> nNext(0);
+    auto reader = [&]() {
+        for (size_t i = nNext++; i < vRecords.size(); i = nNext++) {
+            CWalletTxRecord& record = vRecords[i];
+            try {
+                record.fValid = ReadWalletTx(record.ssKey, record.ssValue, record.hash, record.wtx);
+            } catch (...) {
+                record.fValid = false;
+            }
+        }
+    };
+
+    size_t nThreads = std::min((size_t) std::max(GetNumCores(), 1), vRecords.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nThreads; i++) {
+        threads.emplace_back(reader);
+    }
+    reader();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -420,43 +537,10 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            auto verifier = libzcash::ProofVerifier::Strict();
-            if (!(CheckTransaction(wtx, state, verifier) && (wtx.GetHash() == hash) && state.IsValid()))
-            {
-                // Don't consider REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND error code as a failure. It can appear because a tx
-                // is a pre-chainsplit tx, so it is perfectly fine in this case.
-                if (state.GetRejectCode() != REJECT_CHECKBLOCKATHEIGHT_NOT_FOUND)
-                    return false;
-            }
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            if (!ReadWalletTx(ssKey, ssValue, hash, wtx))
+                return false;
+            LoadWalletTx(pwallet, ssValue, hash, wtx, wss, strErr);
         }
         else if (strType == "acentry")
         {
@@ -713,6 +797,20 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         {
             ssValue >> pwallet->nWitnessCacheSize;
         }
+        else if (strType == "notewitnessheight")
+        {
+            JSOutPoint jsoutpt;
+            ssKey >> jsoutpt;
+            ssValue >> wss.mapNoteWitnessHeights[jsoutpt];
+        }
+        else if (strType == "notewitness")
+        {
+            JSOutPoint jsoutpt;
+            int nHeight;
+            ssKey >> jsoutpt;
+            ssKey >> nHeight;
+            ssValue >> wss.mapNoteWitnesses[jsoutpt][nHeight];
+        }
     } catch (...)
     {
         return false;
@@ -732,6 +830,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
     CWalletScanState wss;
+    vector<CWalletTxRecord> vTxRecords;
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
@@ -767,8 +866,16 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
+            // Transactions are decoded once all records are read, see below
+            string strType;
+            CDataStream(ssKey) >> strType;
+            if (strType == "tx") {
+                vTxRecords.push_back(CWalletTxRecord(ssKey, ssValue));
+                continue;
+            }
+
             // Try to be tolerant of single corrupt records:
-            string strType, strErr;
+            string strErr;
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
             {
                 // losing keys is considered a catastrophic error, anything else
@@ -779,15 +886,38 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 {
                     // Leave other errors alone, if we try to fix them we might make things worse.
                     fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
                 }
             }
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+
+        // Decode and check the transactions in parallel, then add them to
+        // the wallet in the order they were read
+        int64_t nStart = GetTimeMillis();
+        ReadWalletTxs(vTxRecords);
+        for (CWalletTxRecord& record : vTxRecords)
+        {
+            string strErr;
+            if (record.fValid)
+            {
+                try {
+                    LoadWalletTx(pwallet, record.ssValue, record.hash, record.wtx, wss, strErr);
+                } catch (...) {
+                    record.fValid = false;
+                }
+            }
+            if (!record.fValid)
+            {
+                fNoncriticalErrors = true;
+                // Rescan if there is a bad transaction record:
+                SoftSetBoolArg("-rescan", true);
+            }
+            if (!strErr.empty())
+                LogPrintf("%s\n", strErr);
+        }
+        LogPrint("db", "LoadWallet(): loaded %u transactions in %dms\n", vTxRecords.size(), GetTimeMillis() - nStart);
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -796,6 +926,15 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         result = DB_CORRUPT;
     }
 
+    // Witness caches are rebuilt once every transaction has been loaded
+    {
+        LOCK(pwallet->cs_wallet);
+        for (const std::pair<const JSOutPoint, int>& item : wss.mapNoteWitnessHeights) {
+            if (!pwallet->LoadNoteWitnesses(item.first, item.second, wss.mapNoteWitnesses[item.first]))
+                LogPrint("db", "LoadWallet(): ignoring witnesses of unknown note %s\n", item.first.ToString());
+        }
+    }
+
     if (fNoncriticalErrors && result == DB_LOAD_OK)
         result = DB_NONCRITICAL_ERROR;
 
@@ -921,7 +1060,7 @@ DBErrors CWalletDB::ZapWalletTx(CWallet* pwallet, vector<CWalletTx>& vWtx)
     return DB_LOAD_OK;
 }
 
-void ThreadFlushWalletDB(const string& strFile)
+void ThreadFlushWalletDB(const vector<string>& vFiles)
 {
     // Make this thread recognisable as the wallet flushing thread
     RenameThread("horizen-wallet");
@@ -963,19 +1102,21 @@ void ThreadFlushWalletDB(const string& strFile)
                 if (nRefCount == 0)
                 {
                     boost::this_thread::interruption_point();
-                    map<string, int>::iterator mi = bitdb.mapFileUseCount.find(strFile);
-                    if (mi != bitdb.mapFileUseCount.end())
+                    nLastFlushed = nWalletDBUpdated;
+                    for (const string& strFile : vFiles)
                     {
-                        LogPrint("db", "Flushing wallet.dat\n");
-                        nLastFlushed = nWalletDBUpdated;
+                        map<string, int>::iterator mi = bitdb.mapFileUseCount.find(strFile);
+                        if (mi == bitdb.mapFileUseCount.end())
+                            continue;
+                        LogPrint("db", "Flushing %s\n", strFile);
                         int64_t nStart = GetTimeMillis();
 
-                        // Flush wallet.dat so it's self contained
+                        // Flush the wallet file so it's self contained
                         bitdb.CloseDb(strFile);
                         bitdb.CheckpointLSN(strFile);
 
-                        bitdb.mapFileUseCount.erase(mi++);
-                        LogPrint("db", "Flushed wallet.dat %dms\n", GetTimeMillis() - nStart);
+                        bitdb.mapFileUseCount.erase(mi);
+                        LogPrint("db", "Flushed %s %dms\n", strFile, GetTimeMillis() - nStart);
                     }
                 }
             }
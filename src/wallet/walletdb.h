@@ -11,6 +11,7 @@
 #include "key.h"
 #include "keystore.h"
 #include "zcash/Address.hpp"
+#include "zcash/IncrementalMerkleTree.hpp"
 
 #include <list>
 #include <stdint.h>
@@ -26,6 +27,7 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class JSOutPoint;
 class uint160;
 class uint256;
 
@@ -108,6 +110,11 @@ public:
 
     bool WriteWitnessCacheSize(int64_t nWitnessCacheSize);
 
+    /// Witness caches of notes are stored apart from their CWalletTx, one record per block height.
+    bool WriteNoteWitnessHeight(const JSOutPoint& jsoutpt, int witnessHeight);
+    bool WriteNoteWitness(const JSOutPoint& jsoutpt, int nHeight, const ZCIncrementalWitness& witness);
+    bool EraseNoteWitness(const JSOutPoint& jsoutpt, int nHeight);
+
     bool ReadPool(int64_t nPool, CKeyPool& keypool);
     bool WritePool(int64_t nPool, const CKeyPool& keypool);
     bool ErasePool(int64_t nPool);
@@ -153,6 +160,6 @@ private:
 };
 
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
-void ThreadFlushWalletDB(const std::string& strFile);
+void ThreadFlushWalletDB(const std::vector<std::string>& vFiles);
 
 #endif // BITCOIN_WALLET_WALLETDB_H
@@ -27,6 +27,18 @@ PedersenHash PedersenHash::combine(
     return res;
 }
 
+void PedersenHash::combine_pairs(
+    const PedersenHash* in,
+    PedersenHash* out,
+    size_t pairs,
+    size_t depth
+)
+{
+    for (size_t i = 0; i < pairs; i++) {
+        out[i] = combine(in[2*i], in[2*i+1], depth);
+    }
+}
+
 PedersenHash PedersenHash::uncommitted() {
     PedersenHash res = PedersenHash();
 
@@ -51,6 +63,18 @@ SHA256Compress SHA256Compress::combine(
     return res;
 }
 
+void SHA256Compress::combine_pairs(
+    const SHA256Compress* in,
+    SHA256Compress* out,
+    size_t pairs,
+    size_t depth
+)
+{
+    // Each pair is the 64-byte block of one compression
+    BOOST_STATIC_ASSERT(sizeof(SHA256Compress) == 32);
+    SHA256Compress64(out->begin(), in->begin(), pairs);
+}
+
 template <size_t Depth, typename Hash>
 class PathFiller {
 private:
@@ -165,6 +189,62 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append_range(const std::vector<Hash>& objs) {
+    if (objs.empty()) {
+        return;
+    }
+    if (objs.size() > (((size_t)1) << Depth) - size()) {
+        throw std::runtime_error("tree is full");
+    }
+
+    // The leaves not combined yet, followed by the new ones
+    std::vector<Hash> level;
+    level.reserve(objs.size() + 2);
+    if (left) {
+        level.push_back(*left);
+    }
+    if (right) {
+        level.push_back(*right);
+    }
+    level.insert(level.end(), objs.begin(), objs.end());
+
+    // As append() does, the last leaf stays uncombined, or the last two
+    // when they make a pair
+    if (level.size() % 2 == 0) {
+        left = level[level.size() - 2];
+        right = level.back();
+        level.resize(level.size() - 2);
+    } else {
+        left = level.back();
+        right = boost::none;
+        level.pop_back();
+    }
+
+    // Combine the complete subtrees one depth at a time; at each depth the
+    // parent waiting for its sibling comes first, and an odd one out is left
+    // as the new parent
+    std::vector<Hash> combined;
+    for (size_t i = 0; !level.empty(); i++) {
+        combined.resize(level.size() / 2);
+        Hash::combine_pairs(level.data(), combined.data(), combined.size(), i);
+        level.swap(combined);
+
+        if (i == parents.size()) {
+            parents.push_back(boost::none);
+        }
+        if (parents[i]) {
+            level.insert(level.begin(), *parents[i]);
+        }
+        if (level.size() % 2) {
+            parents[i] = level.back();
+            level.pop_back();
+        } else {
+            parents[i] = boost::none;
+        }
+    }
+}
+
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
@@ -348,6 +428,37 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::append_range(const std::vector<Hash>& objs) {
+    size_t i = 0;
+    while (i < objs.size()) {
+        if (!cursor) {
+            cursor_depth = tree.next_depth(filled.size());
+
+            if (cursor_depth >= Depth) {
+                throw std::runtime_error("tree is full");
+            }
+
+            if (cursor_depth == 0) {
+                filled.push_back(objs[i++]);
+                continue;
+            }
+            cursor = IncrementalMerkleTree<Depth, Hash>();
+        }
+
+        // Fill the subtree under the cursor with as many as it lacks
+        size_t missing = (((size_t)1) << cursor_depth) - cursor->size();
+        size_t n = std::min(missing, objs.size() - i);
+        cursor->append_range(objs.begin() + i, objs.begin() + i + n);
+        i += n;
+
+        if (cursor->is_complete(cursor_depth)) {
+            filled.push_back(cursor->root(cursor_depth));
+            cursor = boost::none;
+        }
+    }
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
@@ -101,6 +101,13 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+    // Same as appending each of objs in turn, but hashes the complete
+    // subtrees they form one level at a time, several pairs per call
+    void append_range(const std::vector<Hash>& objs);
+    template<typename Iterator>
+    void append_range(Iterator first, Iterator last) {
+        append_range(std::vector<Hash>(first, last));
+    }
     Hash root() const {
         return root(Depth, std::deque<Hash>());
     }
@@ -174,11 +181,24 @@ public:
         return tree.size() - 1;
     }
 
+    size_t DynamicMemoryUsage() const {
+        return tree.DynamicMemoryUsage() +
+               filled.capacity() * 32 + // filled
+               (cursor ? cursor->DynamicMemoryUsage() : 0); // cursor
+    }
+
     Hash root() const {
         return tree.root(Depth, partial_path());
     }
 
     void append(Hash obj);
+    // Same as appending each of objs in turn, filling the subtree under the
+    // cursor with as many of them as it takes at once
+    void append_range(const std::vector<Hash>& objs);
+    template<typename Iterator>
+    void append_range(Iterator first, Iterator last) {
+        append_range(std::vector<Hash>(first, last));
+    }
 
     ADD_SERIALIZE_METHODS;
 
@@ -224,6 +244,14 @@ public:
         size_t depth
     );
 
+    // combine() of in[2i] and in[2i+1] into out[i], for each i < pairs
+    static void combine_pairs(
+        const SHA256Compress* in,
+        SHA256Compress* out,
+        size_t pairs,
+        size_t depth
+    );
+
     static SHA256Compress uncommitted() {
         return SHA256Compress();
     }
@@ -240,6 +268,13 @@ public:
         size_t depth
     );
 
+    static void combine_pairs(
+        const PedersenHash* in,
+        PedersenHash* out,
+        size_t pairs,
+        size_t depth
+    );
+
     static PedersenHash uncommitted();
 };
 
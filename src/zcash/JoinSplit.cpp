@@ -4,6 +4,7 @@
 
 #include "zcash/util.h"
 
+#include <atomic>
 #include <memory>
 
 #include <boost/foreach.hpp>
@@ -19,9 +20,14 @@
 #include "amount.h"
 
 #include "librustzcash.h"
+#include "mappedfile.h"
 #include "streams.h"
 #include "version.h"
 
+#ifdef MULTICORE
+#include <omp.h>
+#endif
+
 using namespace libsnark;
 
 namespace libzcash {
@@ -30,6 +36,25 @@ namespace libzcash {
 
 static CCriticalSection cs_ParamsIO;
 
+static std::atomic<int> nProverThreads(0);
+
+void SetProverThreads(int nThreads)
+{
+    nProverThreads = std::max(nThreads, 0);
+}
+
+bool SetProverMultiExp(const std::string& name)
+{
+    if (name == "bdlo12") {
+        set_multi_exp_method(multi_exp_method_BDLO12);
+    } else if (name == "boscoster") {
+        set_multi_exp_method(multi_exp_method_bos_coster);
+    } else {
+        return false;
+    }
+    return true;
+}
+
 template<typename T>
 void saveToFile(const std::string path, T& obj) {
     LOCK(cs_ParamsIO);
@@ -66,6 +91,19 @@ void loadFromFile(const std::string path, T& objIn) {
     objIn = std::move(obj);
 }
 
+/** Reads a mapped file through std::istream, without copying it */
+class CMappedFileStreamBuf : public std::streambuf
+{
+public:
+    CMappedFileStreamBuf(const boost::shared_ptr<const CMappedFile>& mapped)
+    {
+        if (mapped) {
+            char* pbegin = const_cast<char*>(mapped->data());
+            setg(pbegin, pbegin, pbegin + mapped->size());
+        }
+    }
+};
+
 template<size_t NumInputs, size_t NumOutputs>
 class JoinSplitCircuit : public JoinSplit<NumInputs, NumOutputs> {
 public:
@@ -76,12 +114,32 @@ public:
     r1cs_ppzksnark_processed_verification_key<ppzksnark_ppT> vk_precomp;
     std::string pkPath;
 
-    JoinSplitCircuit(const std::string vkPath, const std::string pkPath) : pkPath(pkPath) {
+    /**
+     * The proving key is only read by the PHGR13 prover, so it is mapped by
+     * the first proof rather than loaded with the verifying key, and then
+     * parsed from the page cache by each proof.
+     */
+    CCriticalSection cs_pkMapped;
+    boost::shared_ptr<const CMappedFile> pkMapped;
+    bool fPkMapTried;
+
+    JoinSplitCircuit(const std::string vkPath, const std::string pkPath) : pkPath(pkPath), fPkMapTried(false) {
         loadFromFile(vkPath, vk);
         vk_precomp = r1cs_ppzksnark_verifier_process_vk(vk);
     }
     ~JoinSplitCircuit() {}
 
+    /** The proving key mapping, or NULL to read the file instead */
+    boost::shared_ptr<const CMappedFile> MapProvingKey()
+    {
+        LOCK(cs_pkMapped);
+        if (!fPkMapTried) {
+            pkMapped = CMappedFile::Open(pkPath);
+            fPkMapTried = true;
+        }
+        return pkMapped;
+    }
+
     static void generate(const std::string r1csPath,
                          const std::string vkPath,
                          const std::string pkPath)
@@ -353,14 +411,27 @@ public:
         // estimate that it doesn't matter if we check every time.
         pb.constraint_system.swap_AB_if_beneficial();
 
-        std::ifstream fh(pkPath, std::ios::binary);
-
-        if(!fh.is_open()) {
-            throw std::runtime_error(strprintf("could not load param file at %s", pkPath));
+#ifdef MULTICORE
+        // The OpenMP thread count is a setting of each thread, and proofs are
+        // made on whichever thread asks for them
+        if (nProverThreads > 0) {
+            omp_set_num_threads(nProverThreads);
+        }
+#endif
+
+        boost::shared_ptr<const CMappedFile> mapped = MapProvingKey();
+        CMappedFileStreamBuf mappedBuf(mapped);
+        std::ifstream fh;
+        if (!mapped) {
+            fh.open(pkPath, std::ios::binary);
+            if(!fh.is_open()) {
+                throw std::runtime_error(strprintf("could not load param file at %s", pkPath));
+            }
         }
+        std::istream pk(mapped ? static_cast<std::streambuf*>(&mappedBuf) : fh.rdbuf());
 
         return PHGRProof(r1cs_ppzksnark_prover_streaming<ppzksnark_ppT>(
-            fh,
+            pk,
             primary_input,
             aux_input,
             pb.constraint_system
@@ -20,6 +20,10 @@ static constexpr size_t GROTH_PROOF_SIZE = (
     96 + // π_B
     48); // π_C
 
+static constexpr size_t PHGR_PROOF_SIZE = (
+    7 * 33 + // π_A, π'_A, π'_B, π_C, π'_C, π_K, π_H
+    65);     // π_B
+
 typedef std::array<unsigned char, GROTH_PROOF_SIZE> GrothProof;
 typedef boost::variant<PHGRProof, GrothProof> SproutProof;
 
@@ -51,6 +55,20 @@ public:
     Note note(const uint252& phi, const uint256& r, size_t i, const uint256& h_sig) const;
 };
 
+/**
+ * Threads the PHGR13 proofs of joinsplits are computed on by the parallel
+ * loops of libsnark. 0, the default, leaves the OpenMP default, one per core
+ * or OMP_NUM_THREADS. Applies to the proofs started afterwards; Groth proofs
+ * are computed by librustzcash on its own threads.
+ */
+void SetProverThreads(int nThreads);
+/**
+ * Select the multi-exponentiation algorithm of the PHGR13 prover by name,
+ * "bdlo12" (the default, a bucket method) or "boscoster". Returns false if
+ * the name is unknown.
+ */
+bool SetProverMultiExp(const std::string& name);
+
 template<size_t NumInputs, size_t NumOutputs>
 class JoinSplit {
 public:
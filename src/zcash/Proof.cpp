@@ -6,6 +6,7 @@
 #include <libsnark/common/default_types/r1cs_ppzksnark_pp.hpp>
 #include <libsnark/zk_proof_systems/ppzksnark/r1cs_ppzksnark/r1cs_ppzksnark.hpp>
 #include <mutex>
+#include <sodium.h>
 
 using namespace libsnark;
 
@@ -223,6 +224,107 @@ void initialize_curve_params()
     std::call_once (init_public_params_once_flag, curve_pp::init_public_params);
 }
 
+struct PHGRBatchEntry {
+    const r1cs_ppzksnark_processed_verification_key<curve_pp>* pvk;
+    r1cs_primary_input<curve_Fr> primary_input;
+    r1cs_ppzksnark_proof<curve_pp> proof;
+};
+
+class PHGRProofBatch {
+public:
+    std::vector<PHGRBatchEntry> entries;
+};
+
+// Random 128-bit scalar used to weight one pairing equation of one proof
+static bigint<2> random_batch_scalar()
+{
+    bigint<2> r;
+    do {
+        randombytes_buf(r.data, sizeof(r.data));
+    } while (r.is_zero());
+    return r;
+}
+
+/**
+ * Verifies all entries (which must share the same processed verification
+ * key) as one randomized product of pairings.
+ *
+ * Each of the five pairing equations checked by
+ * r1cs_ppzksnark_online_verifier_weak_IC is raised to an independent random
+ * 128-bit power per proof and all of them are multiplied together. Terms
+ * that pair against a fixed verification key element are aggregated in the
+ * group first, so a batch of n proofs needs n + 9 Miller loops and a single
+ * final exponentiation instead of 10n Miller loops and 5n final
+ * exponentiations.
+ */
+static bool verify_phgr_batch(const std::vector<PHGRBatchEntry>& entries)
+{
+    assert(!entries.empty());
+    const r1cs_ppzksnark_processed_verification_key<curve_pp>& pvk = *entries[0].pvk;
+
+    curve_G1 sum_A = curve_G1::zero();          // paired with alphaA_g2
+    curve_G2 sum_B = curve_G2::zero();          // paired with alphaB_g1
+    curve_G1 sum_C = curve_G1::zero();          // paired with alphaC_g2
+    curve_G1 sum_one = curve_G1::zero();        // paired with G2 one
+    curve_G1 sum_H = curve_G1::zero();          // paired with rC_Z_g2
+    curve_G1 sum_K = curve_G1::zero();          // paired with gamma_g2
+    curve_G1 sum_gamma_beta = curve_G1::zero(); // paired with gamma_beta_g2
+    curve_G2 sum_B_gamma = curve_G2::zero();    // paired with gamma_beta_g1
+
+    alt_bn128_Fq12 qap = alt_bn128_Fq12::one();
+
+    for (const PHGRBatchEntry& entry : entries) {
+        const r1cs_ppzksnark_proof<curve_pp>& proof = entry.proof;
+        const curve_G1 acc = pvk.encoded_IC_query.template accumulate_chunk<curve_Fr>(
+            entry.primary_input.begin(), entry.primary_input.end(), 0).first;
+        const curve_G1 A_acc = proof.g_A.g + acc;
+
+        const bigint<2> a = random_batch_scalar();
+        const bigint<2> b = random_batch_scalar();
+        const bigint<2> c = random_batch_scalar();
+        const bigint<2> d = random_batch_scalar();
+        const bigint<2> e = random_batch_scalar();
+
+        // e(A, alphaA_g2) = e(A', g2)
+        sum_A = sum_A + a * proof.g_A.g;
+        sum_one = sum_one + a * proof.g_A.h;
+        // e(alphaB_g1, B) = e(B', g2)
+        sum_B = sum_B + b * proof.g_B.g;
+        sum_one = sum_one + b * proof.g_B.h;
+        // e(C, alphaC_g2) = e(C', g2)
+        sum_C = sum_C + c * proof.g_C.g;
+        sum_one = sum_one + c * proof.g_C.h;
+        // e(A + acc, B) = e(H, rC_Z_g2) * e(C, g2)
+        qap = qap * curve_pp::miller_loop(curve_pp::precompute_G1(d * A_acc),
+                                          curve_pp::precompute_G2(proof.g_B.g));
+        sum_H = sum_H + d * proof.g_H;
+        sum_one = sum_one + d * proof.g_C.g;
+        // e(K, gamma_g2) = e(A + acc + C, gamma_beta_g2) * e(gamma_beta_g1, B)
+        sum_K = sum_K + e * proof.g_K;
+        sum_gamma_beta = sum_gamma_beta + e * (A_acc + proof.g_C.g);
+        sum_B_gamma = sum_B_gamma + e * proof.g_B.g;
+    }
+
+    alt_bn128_Fq12 lhs = qap *
+        curve_pp::double_miller_loop(curve_pp::precompute_G1(sum_A), pvk.vk_alphaA_g2_precomp,
+                                     curve_pp::precompute_G1(sum_C), pvk.vk_alphaC_g2_precomp) *
+        curve_pp::double_miller_loop(pvk.vk_alphaB_g1_precomp, curve_pp::precompute_G2(sum_B),
+                                     curve_pp::precompute_G1(sum_K), pvk.vk_gamma_g2_precomp);
+    alt_bn128_Fq12 rhs =
+        curve_pp::double_miller_loop(curve_pp::precompute_G1(sum_one), pvk.pp_G2_one_precomp,
+                                     curve_pp::precompute_G1(sum_H), pvk.vk_rC_Z_g2_precomp) *
+        curve_pp::double_miller_loop(curve_pp::precompute_G1(sum_gamma_beta), pvk.vk_gamma_beta_g2_precomp,
+                                     pvk.vk_gamma_beta_g1_precomp, curve_pp::precompute_G2(sum_B_gamma));
+
+    return curve_pp::final_exponentiation(lhs * rhs.unitary_inverse()) == curve_GT::one();
+}
+
+ProofVerifier::ProofVerifier(bool perform_verification, bool batch_verification) :
+    perform_verification(perform_verification),
+    batch(batch_verification ? new PHGRProofBatch() : nullptr) { }
+
+ProofVerifier::~ProofVerifier() { }
+
 ProofVerifier ProofVerifier::Strict() {
     initialize_curve_params();
     return ProofVerifier(true);
@@ -233,6 +335,11 @@ ProofVerifier ProofVerifier::Disabled() {
     return ProofVerifier(false);
 }
 
+ProofVerifier ProofVerifier::Batch() {
+    initialize_curve_params();
+    return ProofVerifier(true, true);
+}
+
 template<>
 bool ProofVerifier::check(
     const r1cs_ppzksnark_verification_key<curve_pp>& vk,
@@ -241,11 +348,60 @@ bool ProofVerifier::check(
     const r1cs_ppzksnark_proof<curve_pp>& proof
 )
 {
-    if (perform_verification) {
-        return r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(pvk, primary_input, proof);
-    } else {
+    if (!perform_verification) {
         return true;
     }
+    if (batch) {
+        // The same checks r1cs_ppzksnark_online_verifier_strong_IC does
+        // before touching any pairings.
+        if (pvk.encoded_IC_query.domain_size() != primary_input.size() || !proof.is_well_formed()) {
+            return false;
+        }
+        batch->entries.push_back(PHGRBatchEntry{&pvk, primary_input, proof});
+        return true;
+    }
+    return r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(pvk, primary_input, proof);
+}
+
+bool ProofVerifier::verifyBatch()
+{
+    if (!batch || batch->entries.empty()) {
+        return true;
+    }
+
+    std::vector<PHGRBatchEntry> entries;
+    entries.swap(batch->entries);
+
+    // Proofs against a different key than the first one (not expected in
+    // practice) are verified one at a time.
+    std::vector<PHGRBatchEntry> vBatched;
+    bool fOtherKeysOk = true;
+    for (PHGRBatchEntry& entry : entries) {
+        if (entry.pvk == entries[0].pvk) {
+            vBatched.push_back(entry);
+        } else if (fOtherKeysOk) {
+            fOtherKeysOk = r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(*entry.pvk, entry.primary_input, entry.proof);
+        }
+    }
+    if (!fOtherKeysOk) {
+        return false;
+    }
+    if (verify_phgr_batch(vBatched)) {
+        return true;
+    }
+
+    // At least one proof is bad; fall back to checking them one by one
+    for (const PHGRBatchEntry& entry : vBatched) {
+        if (!r1cs_ppzksnark_online_verifier_strong_IC<curve_pp>(*entry.pvk, entry.primary_input, entry.proof)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t ProofVerifier::batchSize() const
+{
+    return batch ? batch->entries.size() : 0;
 }
 
 bool ProofVerifier::isVerificationEnabled() const
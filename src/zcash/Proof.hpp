@@ -4,6 +4,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+
 namespace libzcash {
 
 const unsigned char G1_PREFIX_MASK = 0x02;
@@ -237,11 +239,17 @@ public:
 
 void initialize_curve_params();
 
+class PHGRProofBatch;
+
 class ProofVerifier {
 private:
     bool perform_verification;
 
-    ProofVerifier(bool perform_verification) : perform_verification(perform_verification) { }
+    // Proofs whose verification has been deferred to verifyBatch(),
+    // only allocated for verifiers created with Batch().
+    std::unique_ptr<PHGRProofBatch> batch;
+
+    ProofVerifier(bool perform_verification, bool batch_verification = false);
 
 public:
     // ProofVerifier should never be copied
@@ -249,6 +257,7 @@ public:
     ProofVerifier& operator=(const ProofVerifier&) = delete;
     ProofVerifier(ProofVerifier&&);
     ProofVerifier& operator=(ProofVerifier&&);
+    ~ProofVerifier();
 
     // Creates a verification context that strictly verifies
     // all proofs using libsnark's API.
@@ -259,6 +268,12 @@ public:
     // such as during reindexing.
     static ProofVerifier Disabled();
 
+    // Creates a verification context that accumulates PHGR
+    // proofs and verifies all of them at once in verifyBatch()
+    // with a single randomized multi-pairing check. check()
+    // only performs the cheap per-proof sanity checks.
+    static ProofVerifier Batch();
+
     template <typename VerificationKey,
               typename ProcessedVerificationKey,
               typename PrimaryInput,
@@ -271,6 +286,15 @@ public:
         const Proof& p
     );
 
+    // Verifies the proofs accumulated since the last call and
+    // clears the batch. If the combined check fails every proof
+    // is checked on its own, so the result is exact. Always
+    // true for non-batching verifiers.
+    bool verifyBatch();
+
+    // Number of proofs waiting for verifyBatch().
+    size_t batchSize() const;
+
     bool isVerificationEnabled() const;
 };
 
@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <functional>
 #include <future>
 #include <map>
 #include <thread>
@@ -106,7 +107,7 @@ double benchmark_parameter_loading()
     return ret;
 }
 
-double benchmark_create_joinsplit()
+double benchmark_create_joinsplit(bool isGroth)
 {
     uint256 pubKeyHash;
 
@@ -115,8 +116,8 @@ double benchmark_create_joinsplit()
 
     struct timeval tv_start;
     timer_start(tv_start);
-    JSDescription jsdesc(true,
-						 *pzcashParams,
+    JSDescription jsdesc(isGroth,
+                         *pzcashParams,
                          pubKeyHash,
                          anchor,
                          {JSInput(), JSInput()},
@@ -130,13 +131,13 @@ double benchmark_create_joinsplit()
     return ret;
 }
 
-std::vector<double> benchmark_create_joinsplit_threaded(int nThreads)
+std::vector<double> benchmark_create_joinsplit_threaded(int nThreads, bool isGroth)
 {
     std::vector<double> ret;
     std::vector<std::future<double>> tasks;
     std::vector<std::thread> threads;
     for (int i = 0; i < nThreads; i++) {
-        std::packaged_task<double(void)> task(&benchmark_create_joinsplit);
+        std::packaged_task<double(void)> task(std::bind(&benchmark_create_joinsplit, isGroth));
         tasks.emplace_back(task.get_future());
         threads.emplace_back(std::move(task));
     }
@@ -475,3 +476,148 @@ double benchmark_listunspent()
     auto unspent = listunspent(params, false);
     return timer_stop(tv_start);
 }
+
+//! Value of each output the mempool load benchmark spends
+static const CAmount MEMPOOL_LOAD_OUTPUT_VALUE = 100000;
+//! Fee of each transaction the mempool load benchmark sends
+static const CAmount MEMPOOL_LOAD_TX_FEE = 10000;
+//! Outputs of each funding transaction, keeping it well under the size limit
+static const size_t MEMPOOL_LOAD_OUTPUTS_PER_PARENT = 500;
+
+/** cs_main wait and hold times sampled by the lock profiler so far */
+static void GetMainLockTimes(uint64_t& nWaitMicros, uint64_t& nHoldMicros)
+{
+    nWaitMicros = 0;
+    nHoldMicros = 0;
+    for (const CLockSiteStats& site : GetLockProfile(false)) {
+        if (site.strName != "cs_main")
+            continue;
+        nWaitMicros += site.wait.nTotalMicros;
+        nHoldMicros += site.hold.nTotalMicros;
+    }
+}
+
+static int64_t Percentile(const std::vector<int64_t>& vSorted, double dFraction)
+{
+    if (vSorted.empty())
+        return 0;
+    return vSorted[std::min(vSorted.size() - 1, (size_t)(dFraction * vSorted.size()))];
+}
+
+UniValue benchmark_mempool_load(size_t nTxs, int nPeers, double dRate)
+{
+    // The wallet funds parents whose outputs go to a key of our own, each
+    // transaction of the load then spends one of them
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CScript scriptPubKey;
+    {
+        LOCK(cs_main);
+        scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    }
+
+    std::vector<CTransaction> vParents;
+    for (size_t nFunded = 0; nFunded < nTxs; ) {
+        size_t nOutputs = std::min(nTxs - nFunded, MEMPOOL_LOAD_OUTPUTS_PER_PARENT);
+        std::vector<CRecipient> vecSend(nOutputs, CRecipient{scriptPubKey, MEMPOOL_LOAD_OUTPUT_VALUE, false});
+
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        CWalletTx wtx;
+        CReserveKey reservekey(pwalletMain);
+        CAmount nFeeRequired;
+        int nChangePos;
+        std::string strFailReason;
+        if (!pwalletMain->CreateTransaction(vecSend, wtx, reservekey, nFeeRequired, nChangePos, strFailReason))
+            throw JSONRPCError(RPC_WALLET_ERROR, "Could not fund the load: " + strFailReason);
+        if (!pwalletMain->CommitTransaction(wtx, reservekey))
+            throw JSONRPCError(RPC_WALLET_ERROR, "Could not commit the funding transaction");
+        vParents.push_back(wtx);
+        nFunded += nOutputs;
+    }
+
+    // Sign the load up front so only the relay path is timed
+    std::vector<CTransaction> vLoad;
+    vLoad.reserve(nTxs);
+    for (const CTransaction& parent : vParents) {
+        for (unsigned int n = 0; n < parent.vout.size(); n++) {
+            if (parent.vout[n].scriptPubKey != scriptPubKey)
+                continue;
+            CMutableTransaction mtx;
+            mtx.vin.push_back(CTxIn(parent.GetHash(), n));
+            mtx.vout.push_back(CTxOut(MEMPOOL_LOAD_OUTPUT_VALUE - MEMPOOL_LOAD_TX_FEE, scriptPubKey));
+            if (!SignSignature(keystore, parent, mtx, 0))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not sign the load");
+            vLoad.push_back(CTransaction(mtx));
+        }
+    }
+
+    // Peers the load arrives from, as inbound connections
+    std::vector<CNode*> vPeers;
+    for (int i = 0; i < nPeers; i++) {
+        CNode* pnode = new CNode(INVALID_SOCKET, CAddress(CService(strprintf("127.0.0.%d", i % 254 + 1), 10000 + i)), "", true);
+        pnode->nVersion = PROTOCOL_VERSION;
+        vPeers.push_back(pnode);
+    }
+
+    unsigned int nPrevInterval = nLockProfileInterval.exchange(1);
+    uint64_t nStartWait, nStartHold;
+    GetMainLockTimes(nStartWait, nStartHold);
+
+    std::vector<int64_t> vLatencies;
+    vLatencies.reserve(vLoad.size());
+    int64_t nStart = GetTimeMicros();
+    for (size_t i = 0; i < vLoad.size(); i++) {
+        if (dRate > 0) {
+            int64_t nDue = nStart + (int64_t)(i * 1000000 / dRate);
+            int64_t nNow = GetTimeMicros();
+            if (nDue > nNow)
+                MilliSleep((nDue - nNow) / 1000);
+        }
+        CPublicDataStream vRecv(SER_NETWORK, PROTOCOL_VERSION);
+        vRecv << vLoad[i];
+        int64_t nTimeReceived = GetTimeMicros();
+        ProcessMessage(vPeers[i % vPeers.size()], "tx", vRecv, nTimeReceived);
+        vLatencies.push_back(GetTimeMicros() - nTimeReceived);
+    }
+    double dSeconds = (GetTimeMicros() - nStart) * 0.000001;
+
+    uint64_t nEndWait, nEndHold;
+    GetMainLockTimes(nEndWait, nEndHold);
+    nLockProfileInterval = nPrevInterval;
+
+    for (CNode* pnode : vPeers)
+        delete pnode;
+
+    size_t nAccepted = 0;
+    for (const CTransaction& tx : vLoad) {
+        if (mempool.exists(tx.GetHash()))
+            nAccepted++;
+    }
+
+    int64_t nTemplateStart = GetTimeMicros();
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey));
+    int64_t nTemplateMicros = GetTimeMicros() - nTemplateStart;
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Could not build a block template");
+
+    std::sort(vLatencies.begin(), vLatencies.end());
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("runningtime", dSeconds);
+    result.pushKV("txs", (uint64_t)vLoad.size());
+    result.pushKV("accepted", (uint64_t)nAccepted);
+    result.pushKV("txpersecond", vLoad.size() / std::max(dSeconds, 0.000001));
+    result.pushKV("latencyp50", Percentile(vLatencies, 0.5));
+    result.pushKV("latencyp90", Percentile(vLatencies, 0.9));
+    result.pushKV("latencyp99", Percentile(vLatencies, 0.99));
+    result.pushKV("latencymax", vLatencies.empty() ? 0 : vLatencies.back());
+    result.pushKV("mempooltxs", (uint64_t)mempool.size());
+    result.pushKV("mempoolbytes", mempool.GetTotalTxSize());
+    result.pushKV("mempoolusage", (uint64_t)mempool.DynamicMemoryUsage());
+    result.pushKV("templatetxs", (uint64_t)pblocktemplate->block.vtx.size());
+    result.pushKV("templatetime", nTemplateMicros);
+    result.pushKV("csmainwait", nEndWait - nStartWait);
+    result.pushKV("csmainhold", nEndHold - nStartHold);
+    return result;
+}
@@ -6,8 +6,8 @@
 
 extern double benchmark_sleep();
 extern double benchmark_parameter_loading();
-extern double benchmark_create_joinsplit();
-extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads);
+extern double benchmark_create_joinsplit(bool isGroth);
+extern std::vector<double> benchmark_create_joinsplit_threaded(int nThreads, bool isGroth);
 extern double benchmark_solve_equihash();
 extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads);
 extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
@@ -19,5 +19,6 @@ extern double benchmark_connectblock_slow();
 extern double benchmark_sendtoaddress(CAmount amount);
 extern double benchmark_loadwallet();
 extern double benchmark_listunspent();
+extern UniValue benchmark_mempool_load(size_t nTxs, int nPeers, double dRate);
 
 #endif
@@ -8,7 +8,7 @@ int64_t GetBlockDelay(const CBlockIndex& newBlock, const CBlockIndex& prevBlock,
     }
 
     if(newBlock.nHeight < activeChainHeight ) {
-      	LogPrintf("Received a delayed block (activeChainHeight: %d, newBlockHeight: %d)!\n", activeChainHeight, newBlock.nHeight);
+      	LogPrint("forks", "Received a delayed block (activeChainHeight: %d, newBlockHeight: %d)!\n", activeChainHeight, newBlock.nHeight);
     }
 
     // if the current chain is penalised.
@@ -18,7 +18,7 @@ int64_t GetBlockDelay(const CBlockIndex& newBlock, const CBlockIndex& prevBlock,
         if (activeChainHeight >= newBlock.nHeight ) {
         	return (activeChainHeight - newBlock.nHeight);
         } else {
-        	LogPrintf("Decreasing penalty to chain (activeChainHeight: %d, newBlockHeight: %d, prevBlockChainDelay: %d)!\n", activeChainHeight, newBlock.nHeight, prevBlock.nChainDelay);
+        	LogPrint("forks", "Decreasing penalty to chain (activeChainHeight: %d, newBlockHeight: %d, prevBlockChainDelay: %d)!\n", activeChainHeight, newBlock.nHeight, prevBlock.nChainDelay);
         	// -1 to decrease the penalty afterwards.
             return -1;
         } 
@@ -11,4 +11,9 @@
 
 static const int PENALTY_THRESHOLD = 5;
 
+/**
+ * The delay added by newBlock to the penalty of the chain of prevBlock. It is
+ * summed once into CBlockIndex::nChainDelay when the block index is created,
+ * and candidates for the best chain are ordered by that stored value.
+ */
 int64_t GetBlockDelay (const CBlockIndex& newBlock,const CBlockIndex& prevBlock, const int activeChainHeight, bool isStartupSyncing);
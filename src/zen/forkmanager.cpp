@@ -13,6 +13,10 @@
 #include "forks/fork6_timeblockfork.h"
 #include "forks/fork7_replayprotectionfixfork.h"
 
+#include <algorithm>
+#include <assert.h>
+#include <limits>
+
 namespace zen {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -74,7 +78,7 @@ CAmount ForkManager::getCommunityFundReward(int height, CAmount reward, Fork::Co
  * @return the replay protection level
  */
 ReplayProtectionLevel ForkManager::getReplayProtectionLevel(int height) const {
-    return getForkAtHeight(height)->getReplayProtectionLevel();
+    return getEntryAtHeight(height).replayProtectionLevel;
 }
 
 /**
@@ -83,7 +87,7 @@ ReplayProtectionLevel ForkManager::getReplayProtectionLevel(int height) const {
  * @return returns true if Community funds can be sent to a transparent address at this height
  */
 bool ForkManager::canSendCommunityFundsToTransparentAddress(int height) const {
-    return getForkAtHeight(height)->canSendCommunityFundsToTransparentAddress();
+    return (getEntryAtHeight(height).flags & FLAG_CF_TO_TRANSPARENT) != 0;
 }
 
 /**
@@ -92,7 +96,7 @@ bool ForkManager::canSendCommunityFundsToTransparentAddress(int height) const {
  * @return true if this height is after the original chain split, false otherwise
  */
 bool ForkManager::isAfterChainsplit(int height) const {
-    return getForkAtHeight(height)->isAfterChainsplit();
+    return (getEntryAtHeight(height).flags & FLAG_AFTER_CHAINSPLIT) != 0;
 }
 
 /**
@@ -102,7 +106,10 @@ bool ForkManager::isAfterChainsplit(int height) const {
  * @return true if allowed, false otherwise
  */
 bool ForkManager::isTransactionTypeAllowedAtHeight(int height, txnouttype transactionType) const {
-    return getForkAtHeight(height)->isTransactionTypeAllowed(transactionType);
+    const ForkEntry& entry = getEntryAtHeight(height);
+    if (transactionType < 0 || transactionType > TX_NULL_DATA_REPLAY)
+        return entry.fork->isTransactionTypeAllowed(transactionType);
+    return (entry.allowedTransactionTypes >> transactionType) & 1;
 }
 
 /**
@@ -111,7 +118,7 @@ bool ForkManager::isTransactionTypeAllowedAtHeight(int height, txnouttype transa
  * @return returns phpgr,groth,... tx version based on block height
  */
 int ForkManager::getShieldedTxVersion(int height) const {
-    return getForkAtHeight(height)->getShieldedTxVersion();
+    return getEntryAtHeight(height).shieldedTxVersion;
 }
 
 
@@ -119,7 +126,7 @@ int ForkManager::getShieldedTxVersion(int height) const {
  * @brief
  */
 bool ForkManager::isFutureMiningTimeStampActive(int height) const {
-	return getForkAtHeight(height)->isFutureMiningTimeStampActive();
+	return (getEntryAtHeight(height).flags & FLAG_FUTURE_MINING_TIMESTAMP) != 0;
 }
 
 /**
@@ -179,16 +186,56 @@ const Fork* ForkManager::getForkAtHeight(int height) const {
         return nullptr;
     }
 
-    // Iterate through all the forks until fork height is higher than block height or there are no more forks
-    std::list<Fork*>::const_iterator lastIterator = forks.begin();
-    for (std::list<Fork*>::const_iterator iterator = forks.begin();iterator != forks.end();iterator++) {
-        if ((*iterator)->getHeight(currentNetwork) > height) {
-            break;
+    return getEntryAtHeight(height).fork;
+}
+
+/**
+ * @brief getEntryAtHeight returns the table entry of the active fork at the specified height, there must be registered forks.
+ * Entry heights never decrease, so the entry before the first one higher than the block height is the last fork
+ * reached going through the forks in order, or the first fork if none is
+ * @param height height to test against
+ * @return the entry of the fork at that height
+ */
+const ForkManager::ForkEntry& ForkManager::getEntryAtHeight(int height) const {
+    const std::vector<ForkEntry>& table = forkTables[currentNetwork];
+    assert(!table.empty());
+    std::vector<ForkEntry>::const_iterator it = std::upper_bound(table.begin(), table.end(), height,
+        [](int h, const ForkEntry& entry) { return h < entry.height; });
+    return it == table.begin() ? *it : *(it - 1);
+}
+
+/**
+ * @brief buildForkTables fills the table of each network from the registered forks, in the order of the list
+ */
+void ForkManager::buildForkTables() {
+    static_assert(TX_NULL_DATA_REPLAY < 32, "allowedTransactionTypes has a bit per transaction type");
+    for (int network = 0; network < CBaseChainParams::MAX_NETWORK_TYPES; network++) {
+        std::vector<ForkEntry>& table = forkTables[network];
+        table.clear();
+        int height = std::numeric_limits<int>::min();
+        for (std::list<Fork*>::const_iterator iterator = forks.begin(); iterator != forks.end(); iterator++) {
+            const Fork* fork = *iterator;
+            ForkEntry entry;
+            height = std::max(height, fork->getHeight((CBaseChainParams::Network)network));
+            entry.height = height;
+            entry.fork = fork;
+            entry.allowedTransactionTypes = 0;
+            for (int type = TX_NONSTANDARD; type <= TX_NULL_DATA_REPLAY; type++) {
+                if (fork->isTransactionTypeAllowed((txnouttype)type))
+                    entry.allowedTransactionTypes |= 1u << type;
+            }
+            entry.shieldedTxVersion = fork->getShieldedTxVersion();
+            entry.replayProtectionLevel = fork->getReplayProtectionLevel();
+            entry.flags = 0;
+            if (fork->isAfterChainsplit())
+                entry.flags |= FLAG_AFTER_CHAINSPLIT;
+            if (fork->canSendCommunityFundsToTransparentAddress())
+                entry.flags |= FLAG_CF_TO_TRANSPARENT;
+            if (fork->isFutureMiningTimeStampActive())
+                entry.flags |= FLAG_FUTURE_MINING_TIMESTAMP;
+            table.push_back(entry);
         }
-        lastIterator = iterator;
     }
-    // return the last fork before that fork
-    return *lastIterator;
 }
 
 /**
@@ -200,6 +247,7 @@ void ForkManager::registerFork(Fork* fork) {
     forks.push_back(fork);
     // sort list by height in the MAIN network. We assume that forks will always keep the same relative height order regardless of the network used
     forks.sort([](Fork* fork1, Fork* fork2) { return fork1->getHeight(CBaseChainParams::Network::MAIN) < fork2->getHeight(CBaseChainParams::Network::MAIN); });
+    buildForkTables();
 }
 
 }
@@ -8,6 +8,7 @@
 #include "chainparamsbase.h"
 #include "amount.h"
 #include <list>
+#include <vector>
 #include "zen/replayprotectionlevel.h"
 #include "script/standard.h"
 #include "forks/fork.h"
@@ -98,10 +99,37 @@ private:
      */
     ~ForkManager();
     
+    /**
+     * @brief ForkEntry is a registered fork with its height on a network and the answers of its
+     * height-independent queries, packed so that a query takes one lookup in a small array
+     */
+    struct ForkEntry {
+        int height;                     //!< highest start height of this fork and the ones before it
+        const Fork* fork;
+        uint32_t allowedTransactionTypes; //!< bit n is set if txnouttype n is allowed
+        int shieldedTxVersion;
+        ReplayProtectionLevel replayProtectionLevel;
+        uint8_t flags;                  //!< FLAG_* capabilities
+    };
+
+    static const uint8_t FLAG_AFTER_CHAINSPLIT = 1 << 0;
+    static const uint8_t FLAG_CF_TO_TRANSPARENT = 1 << 1;
+    static const uint8_t FLAG_FUTURE_MINING_TIMESTAMP = 1 << 2;
+
     /**
      * @brief getForkAtHeight returns the active fork at the specified height. 
      */
     const Fork* getForkAtHeight(int height) const;
+
+    /**
+     * @brief getEntryAtHeight returns the table entry of the active fork at the specified height
+     */
+    const ForkEntry& getEntryAtHeight(int height) const;
+
+    /**
+     * @brief buildForkTables fills forkTables from the registered forks
+     */
+    void buildForkTables();
     
     /**
      * @brief registerFork used internally to register a new fork
@@ -112,6 +140,11 @@ private:
      * @brief forks stores the list of all forks sorted by ascending height
      */
     std::list<Fork*> forks;
+
+    /**
+     * @brief forkTables stores for each network the registered forks in the same order, see ForkEntry
+     */
+    std::vector<ForkEntry> forkTables[CBaseChainParams::MAX_NETWORK_TYPES];
     
     /**
      * @brief currentNetwork currently selected network
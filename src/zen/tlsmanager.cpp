@@ -89,13 +89,64 @@ DH *tmp_dh_callback(SSL *ssl, int is_export, int keylength)
     LogPrint("tls", "TLS: %s: %s():%d - Using Diffie-Hellman param for PFS: is_export=%d, keylength=%d\n",
         __FILE__, __func__, __LINE__, is_export, keylength);
 
-    return get_dh2048(); 
+    // OpenSSL does not take ownership of the returned parameters, so build them once
+    static DH* dh2048 = get_dh2048();
+    return dh2048;
+}
+
+//! Maximum number of outbound peers whose TLS session is remembered
+static const size_t MAX_CLIENT_SESSIONS = 1000;
+//! How long the server lets its sessions be resumed, in seconds
+static const long TLS_SESSION_TIMEOUT = 2 * 60 * 60;
+
+//! Sessions of outbound connections by peer address, offered again when reconnecting to that peer
+static std::map<std::string, SSL_SESSION*> mapClientSessions;
+static CCriticalSection cs_mapClientSessions;
+//! SSL ex_data index holding the mapClientSessions key of an outbound connection
+static int nSessionKeyIndex = -1;
+
+static void freeSessionKey(void* parent, void* ptr, CRYPTO_EX_DATA* ad, int idx, long argl, void* argp)
+{
+    delete static_cast<std::string*>(ptr);
+}
+
+/** Called by OpenSSL whenever the server hands out a session (or a TLS 1.3 ticket) to us as a client. */
+static int newClientSession(SSL* ssl, SSL_SESSION* session)
+{
+    const std::string* key = static_cast<const std::string*>(SSL_get_ex_data(ssl, nSessionKeyIndex));
+    if (key == NULL || !SSL_SESSION_is_resumable(session))
+        return 0;
+
+    LOCK(cs_mapClientSessions);
+    std::map<std::string, SSL_SESSION*>::iterator it = mapClientSessions.find(*key);
+    if (it != mapClientSessions.end()) {
+        SSL_SESSION_free(it->second);
+        it->second = session;
+    } else {
+        if (mapClientSessions.size() >= MAX_CLIENT_SESSIONS) {
+            SSL_SESSION_free(mapClientSessions.begin()->second);
+            mapClientSessions.erase(mapClientSessions.begin());
+        }
+        mapClientSessions.insert(std::make_pair(*key, session));
+    }
+    // We keep the reference OpenSSL passed in
+    return 1;
+}
+
+static void forgetClientSession(const std::string& key)
+{
+    LOCK(cs_mapClientSessions);
+    std::map<std::string, SSL_SESSION*>::iterator it = mapClientSessions.find(key);
+    if (it != mapClientSessions.end()) {
+        SSL_SESSION_free(it->second);
+        mapClientSessions.erase(it);
+    }
 }
 
 /** if 'tls' debug category is enabled, collect info about certificates relevant to the passed context and print them on logs */
 static void dumpCertificateDebugInfo(int preverify_ok, X509_STORE_CTX* chainContext)
 {
-    if (!LogAcceptCategory("tls") )
+    if (!LogAcceptCategory(LOG_CATEGORY("tls")) )
         return;
 
     char    buf[256] = {};
@@ -286,14 +337,8 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
             break;
         }
 
-        fd_set socketSet;
-        FD_ZERO(&socketSet);
-        FD_SET(hSocket, &socketSet);
-
-        struct timeval timeout = {timeoutSec, 0};
-
         if (sslErr == SSL_ERROR_WANT_READ) {
-            int result = select(hSocket + 1, &socketSet, NULL, NULL, &timeout);
+            int result = WaitForSocket(hSocket, false, timeoutSec * 1000);
             if (result == 0) {
                 LogPrint("tls", "TLS: ERROR: %s: %s():%d - WANT_READ timeout on %s\n", __FILE__, __func__, __LINE__,
                     (eRoutine == SSL_CONNECT ? "SSL_CONNECT" : 
@@ -308,7 +353,7 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
                 break;
             }
         } else {
-            int result = select(hSocket + 1, NULL, &socketSet, NULL, &timeout);
+            int result = WaitForSocket(hSocket, true, timeoutSec * 1000);
             if (result == 0) {
                 LogPrint("tls", "TLS: ERROR: %s: %s():%d - WANT_WRITE timeout on %s\n", __FILE__, __func__, __LINE__,
                     (eRoutine == SSL_CONNECT ? "SSL_CONNECT" : 
@@ -328,6 +373,18 @@ int TLSManager::waitFor(SSLConnectionRoutine eRoutine, SOCKET hSocket, SSL* ssl,
     return retOp;
 }
 
+/** The kTLS part of the log line of an established connection */
+static const char* KernelTLSDescription(bool fSend, bool fRecv)
+{
+    if (fSend && fRecv)
+        return ", kTLS";
+    if (fSend)
+        return ", kTLS send only";
+    if (fRecv)
+        return ", kTLS receive only";
+    return "";
+}
+
 /**
  * @brief establish TLS connection to an address
  * 
@@ -343,9 +400,18 @@ SSL* TLSManager::connect(SOCKET hSocket, const CAddress& addrConnect, unsigned l
     err_code = 0;
     SSL* ssl = NULL;
     bool bConnectedTLS = false;
+    const std::string strSessionKey = addrConnect.ToStringIPPort();
 
     if ((ssl = SSL_new(tls_ctx_client))) {
         if (SSL_set_fd(ssl, hSocket)) {
+            SSL_set_ex_data(ssl, nSessionKeyIndex, new std::string(strSessionKey));
+            {
+                // Offer the session of the last connection to this peer to skip the full handshake
+                LOCK(cs_mapClientSessions);
+                std::map<std::string, SSL_SESSION*>::iterator it = mapClientSessions.find(strSessionKey);
+                if (it != mapClientSessions.end())
+                    SSL_set_session(ssl, it->second);
+            }
             int ret = TLSManager::waitFor(SSL_CONNECT, hSocket, ssl, (DEFAULT_CONNECT_TIMEOUT / 1000), err_code);
             if (ret == 1)
             {
@@ -363,12 +429,18 @@ SSL* TLSManager::connect(SOCKET hSocket, const CAddress& addrConnect, unsigned l
 
 
     if (bConnectedTLS) {
-        LogPrintf("TLS: connection to %s has been established (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s\n",
-            addrConnect.ToString(), SSL_get_version(ssl), SSL_version(ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(), SSL_get_cipher(ssl));
+        bool fKernelSend, fKernelRecv;
+        GetKernelTLSStatus(ssl, fKernelSend, fKernelRecv);
+        LogPrintf("TLS: connection to %s has been established (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s%s%s\n",
+            addrConnect.ToString(), SSL_get_version(ssl), SSL_version(ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(), SSL_get_cipher(ssl),
+            SSL_session_reused(ssl) ? " (session resumed)" : "", KernelTLSDescription(fKernelSend, fKernelRecv));
     } else {
         LogPrintf("TLS: %s: %s():%d - TLS connection to %s failed (err_code 0x%X)\n",
             __FILE__, __func__, __LINE__, addrConnect.ToString(), err_code);
 
+        // Do not offer a session the peer may have choked on again
+        forgetClientSession(strSessionKey);
+
         if (ssl) {
             SSL_free(ssl);
             ssl = NULL;
@@ -402,7 +474,7 @@ SSL_CTX* TLSManager::initCtx(
     SSL_CTX* tlsCtx = NULL;
 
     if ((tlsCtx = SSL_CTX_new(ctxType == SERVER_CONTEXT ? TLS_server_method() : TLS_client_method()))) {
-        SSL_CTX_set_mode(tlsCtx, SSL_MODE_AUTO_RETRY);
+        SSL_CTX_set_mode(tlsCtx, SSL_MODE_AUTO_RETRY | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
         // Disable TLS 1.0. and 1.1
         int ret = SSL_CTX_set_min_proto_version(tlsCtx, TLS1_2_VERSION);
@@ -426,6 +498,11 @@ SSL_CTX* TLSManager::initCtx(
         // TLS 1.3 has ephemeral Diffie-Hellman as the only key exchange mechanism, so that perfect forward
         // secrecy is ensured.
 
+        // Elliptic curve key exchange is much cheaper than finite field DHE, which only serves older peers
+        if (SSL_CTX_set1_groups_list(tlsCtx, "X25519:P-256:P-384") == 0) {
+            LogPrintf("TLS: WARNING: %s: %s():%d - failed to set key exchange groups\n", __FILE__, __func__, __LINE__);
+        }
+
         if (ctxType == SERVER_CONTEXT)
         {
             // amongst the Cl/Srv mutually-acceptable set, pick the one that the server prefers most instead of the one that
@@ -434,11 +511,37 @@ SSL_CTX* TLSManager::initCtx(
 
             LogPrintf("TLS: %s: %s():%d - setting dh callback\n", __FILE__, __func__, __LINE__);
             SSL_CTX_set_tmp_dh_callback(tlsCtx, tmp_dh_callback);
+
+            // Let reconnecting peers resume their session, from the cache or a session ticket.
+            // A session id context is required for that since peer certificates are requested.
+            static const unsigned char sessionIdContext[] = "zend";
+            SSL_CTX_set_session_id_context(tlsCtx, sessionIdContext, sizeof(sessionIdContext) - 1);
+            SSL_CTX_set_session_cache_mode(tlsCtx, SSL_SESS_CACHE_SERVER);
+            SSL_CTX_set_timeout(tlsCtx, TLS_SESSION_TIMEOUT);
+        }
+        else
+        {
+            // Sessions are kept per peer address by newClientSession rather than in the context
+            if (nSessionKeyIndex < 0)
+                nSessionKeyIndex = SSL_get_ex_new_index(0, NULL, NULL, NULL, freeSessionKey);
+            SSL_CTX_set_session_cache_mode(tlsCtx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(tlsCtx, newClientSession);
         }
 
         // Fix for Secure Client-Initiated Renegotiation DoS threat
         SSL_CTX_set_options(tlsCtx, SSL_OP_NO_RENEGOTIATION);
 
+        // Once the handshake is done, let the kernel encrypt and decrypt the records where
+        // OpenSSL was built with kTLS and the kernel supports the negotiated cipher.
+        // SSL_write and SSL_read are used as before, they just skip the userspace crypto.
+        if (GetBoolArg("-tlsktls", false)) {
+#ifdef SSL_OP_ENABLE_KTLS
+            SSL_CTX_set_options(tlsCtx, SSL_OP_ENABLE_KTLS);
+#else
+            LogPrintf("TLS: -tlsktls is not supported by %s\n", OpenSSL_version(OPENSSL_VERSION));
+#endif
+        }
+
         int min_ver = SSL_CTX_get_min_proto_version(tlsCtx);
         int max_ver = SSL_CTX_get_max_proto_version(tlsCtx); // 0x0 means auto
         int opt_mask = SSL_CTX_get_options(tlsCtx);
@@ -520,58 +623,83 @@ bool TLSManager::prepareCredentials()
     return bPrepared;
 }
 /**
- * @brief accept a TLS connection
- * 
+ * @brief start the server side of a TLS connection
+ *
+ * The handshake itself is driven by the socket handler thread through
+ * continueHandshake(), so that a slow peer does not hold up the others.
+ *
  * @param hSocket the TLS socket.
  * @param addr incoming address.
- * @param tls_ctx_server TLS server context.
  * @return SSL* returns pointer to the ssl object if successful, otherwise returns NULL
  */
-SSL* TLSManager::accept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code)
+SSL* TLSManager::startAccept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code)
 {
     LogPrint("tls", "TLS: accepting connection from %s (tid = %X)\n", addr.ToString(), pthread_self());
 
-    err_code = 0; 
+    err_code = 0;
     SSL* ssl = NULL;
-    bool bAcceptedTLS = false;
 
     if ((ssl = SSL_new(tls_ctx_server))) {
         if (SSL_set_fd(ssl, hSocket)) {
-            int ret = TLSManager::waitFor(SSL_ACCEPT, hSocket, ssl, (DEFAULT_CONNECT_TIMEOUT / 1000), err_code);
-            if (ret == 1)
-            {
-                bAcceptedTLS = true;
-            }
+            SSL_set_accept_state(ssl);
+        } else {
+            err_code = ERR_get_error();
+            SSL_free(ssl);
+            ssl = NULL;
         }
     }
-    else
-    {
-        err_code = ERR_get_error();
+
+    if (!ssl) {
+        if (err_code == 0)
+            err_code = ERR_get_error();
         const char* error_str = ERR_error_string(err_code, NULL);
         LogPrint("tls", "TLS: %s: %s():%d - SSL_new failed err: %s\n",
             __FILE__, __func__, __LINE__, error_str);
     }
-
-    if (bAcceptedTLS) {
-        LogPrintf("TLS: connection from %s has been accepted (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s\n",
-            addr.ToString(), SSL_get_version(ssl), SSL_version(ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(), SSL_get_cipher(ssl));
-
-        STACK_OF(SSL_CIPHER) *sk = SSL_get_ciphers(ssl); 
+    return ssl;
+}
+/**
+ * @brief advance the TLS handshake of an inbound peer without blocking
+ *
+ * @param pnode the peer, with fTLSHandshake set.
+ * @param err_code set to the OpenSSL error when the handshake fails.
+ * @return int returns 1 when the handshake completed, 0 when it waits for the socket and -1 when it failed.
+ */
+int TLSManager::continueHandshake(CNode* pnode, unsigned long& err_code)
+{
+    err_code = 0;
+    int ret = SSL_do_handshake(pnode->ssl);
+    if (ret == 1) {
+        bool fKernelSend, fKernelRecv;
+        GetKernelTLSStatus(pnode->ssl, fKernelSend, fKernelRecv);
+        LogPrintf("TLS: connection from %s has been accepted (tlsv = %s 0x%04x / ssl = %s 0x%x ). Using cipher: %s%s%s\n",
+            pnode->addr.ToString(), SSL_get_version(pnode->ssl), SSL_version(pnode->ssl), OpenSSL_version(OPENSSL_VERSION), OpenSSL_version_num(),
+            SSL_get_cipher(pnode->ssl), SSL_session_reused(pnode->ssl) ? " (session resumed)" : "", KernelTLSDescription(fKernelSend, fKernelRecv));
+
+        STACK_OF(SSL_CIPHER) *sk = SSL_get_ciphers(pnode->ssl);
         for (int i = 0; i < sk_SSL_CIPHER_num(sk); i++) {
             const SSL_CIPHER *c = sk_SSL_CIPHER_value(sk, i);
             LogPrint("tls", "TLS: supporting cipher: %s\n", SSL_CIPHER_get_name(c));
         }
-    } else {
-        LogPrintf("TLS: %s: %s():%d - TLS connection from %s failed (err_code 0x%X)\n",
-            __FILE__, __func__, __LINE__, addr.ToString(), err_code);
+        return 1;
+    }
 
-        if (ssl) {
-            SSL_free(ssl);
-            ssl = NULL;
-        }
+    int sslErr = SSL_get_error(pnode->ssl, ret);
+    if (sslErr == SSL_ERROR_WANT_READ) {
+        pnode->fSocketReadable = false;
+        pnode->fTLSHandshakeWantWrite = false;
+        return 0;
+    }
+    if (sslErr == SSL_ERROR_WANT_WRITE) {
+        pnode->fSocketWritable = false;
+        pnode->fTLSHandshakeWantWrite = true;
+        return 0;
     }
 
-    return ssl;
+    err_code = ERR_get_error();
+    LogPrintf("TLS: %s: %s():%d - TLS connection from %s failed (sslErr 0x%x, err_code 0x%X: %s)\n",
+        __FILE__, __func__, __LINE__, pnode->addr.ToString(), sslErr, err_code, ERR_error_string(err_code, NULL));
+    return -1;
 }
 /**
  * @brief Determines whether a string exists in the non-TLS address pool.
@@ -620,30 +748,23 @@ void TLSManager::cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection
  * @brief Handles send and recieve functionality in TLS Sockets.
  * 
  * @param pnode reference to the CNode object.
- * @param fdsetRecv 
- * @param fdsetSend 
- * @param fdsetError 
+ * @param fRecv whether the socket is ready to receive (or has an error)
+ * @param fSend whether the socket is ready to send
  * @return int returns -1 when socket is invalid. returns 0 otherwise.
  */
-int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError)
+int TLSManager::threadSocketHandler(CNode* pnode, bool fRecv, bool fSend)
 {
     //
     // Receive
     //
-    bool recvSet = false, sendSet = false, errorSet = false;
-
     {
         LOCK(pnode->cs_hSocket);
 
         if (pnode->hSocket == INVALID_SOCKET)
             return -1;
-
-        recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-        sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-        errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
     }
 
-    if (recvSet || errorSet) {
+    if (fRecv) {
         TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
         if (lockRecv) {
             {
@@ -653,6 +774,13 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
                 bool bIsSSL = false;
                 int nBytes = 0, nRet = 0;
 
+                // Once the header of a message is in, its payload is read straight into the message
+                unsigned int nMaxBytes = sizeof(pchBuf);
+                char* pchData = pnode->GetRecvDataBuffer(nMaxBytes);
+                char* pchDest = pchData ? pchData : pchBuf;
+                if (!pchData)
+                    nMaxBytes = sizeof(pchBuf);
+
                 {
                     LOCK(pnode->cs_hSocket);
 
@@ -665,16 +793,18 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
 
                     if (bIsSSL) {
                         ERR_clear_error(); // clear the error queue, otherwise we may be reading an old error that occurred previously in the current thread
-                        nBytes = SSL_read(pnode->ssl, pchBuf, sizeof(pchBuf));
+                        nBytes = SSL_read(pnode->ssl, pchDest, nMaxBytes);
                         nRet = SSL_get_error(pnode->ssl, nBytes);
                     } else {
-                        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                        nBytes = recv(pnode->hSocket, pchDest, nMaxBytes, MSG_DONTWAIT);
                         nRet = WSAGetLastError();
                     }
                 }
 
                 if (nBytes > 0) {
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                    if (pchData)
+                        pnode->ReceivedMsgData(nBytes);
+                    else if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
                         pnode->CloseSocketDisconnect();
                     pnode->nLastRecv = GetTime();
                     pnode->nRecvBytes += nBytes;
@@ -710,12 +840,17 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
                                 __FILE__, __func__, __LINE__, nRet, error_str);
 
                         } else {
+                            // Everything buffered by OpenSSL and the socket was read
+                            if (nRet == SSL_ERROR_WANT_READ)
+                                pnode->fSocketReadable = false;
                             // preventive measure from exhausting CPU usage
                             //
                             MilliSleep(1); // 1 msec
                         }
                     } else {
-                        if (nRet != WSAEWOULDBLOCK && nRet != WSAEMSGSIZE && nRet != WSAEINTR && nRet != WSAEINPROGRESS) {
+                        if (nRet == WSAEWOULDBLOCK)
+                            pnode->fSocketReadable = false;
+                        else if (nRet != WSAEMSGSIZE && nRet != WSAEINTR && nRet != WSAEINPROGRESS) {
                             if (!pnode->fDisconnect)
                                 LogPrintf("TSL: ERROR: socket recv %s\n", NetworkErrorString(nRet));
                             pnode->CloseSocketDisconnect();
@@ -729,10 +864,14 @@ int TLSManager::threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fds
     //
     // Send
     //
-    if (sendSet) {
+    if (fSend) {
         TRY_LOCK(pnode->cs_vSend, lockSend);
-        if (lockSend)
+        if (lockSend) {
             SocketSendData(pnode);
+            // Data left means the send buffer is full
+            if (!pnode->vSendMsg.empty())
+                pnode->fSocketWritable = false;
+        }
     }
     return 0;
 }
@@ -53,10 +53,12 @@ public:
         const std::vector<boost::filesystem::path>& trustedDirs);
 
      bool prepareCredentials();
-     SSL* accept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code);
+     SSL* startAccept(SOCKET hSocket, const CAddress& addr, unsigned long& err_code);
+     int continueHandshake(CNode* pnode, unsigned long& err_code);
      bool isNonTLSAddr(const string& strAddr, const vector<NODE_ADDR>& vPool, CCriticalSection& cs);
      void cleanNonTLSPool(std::vector<NODE_ADDR>& vPool, CCriticalSection& cs);
-     int threadSocketHandler(CNode* pnode, fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError);
+     /** Receive from and send to a peer socket; the socket handler thread decides which is possible. */
+     int threadSocketHandler(CNode* pnode, bool fRecv, bool fSend);
      bool initialize();
 };
 }
@@ -389,6 +389,12 @@ bool GenerateCredentials(
 // Validates peer certificate using a chain of CA certificates.
 // If some of intermediate CA certificates are absent in the trusted certificates store, then validation status will be 'false')
 //
+void GetKernelTLSStatus(SSL *ssl, bool &fSend, bool &fRecv)
+{
+    fSend = ssl && BIO_get_ktls_send(SSL_get_wbio(ssl));
+    fRecv = ssl && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+}
+
 bool ValidatePeerCertificate(SSL *ssl)
 {
     if (!ssl)
@@ -42,6 +42,10 @@ bool ValidatePeerCertificate(SSL *ssl);
 //
 bool ValidateCertificate(SSL_CTX *ssl_ctx);
 
+// Checks if the kernel encrypts the records sent, respectively received, on an established connection (-tlsktls)
+//
+void GetKernelTLSStatus(SSL *ssl, bool &fSend, bool &fRecv);
+
 // Creates the list of available OpenSSL default directories for trusted certificates storage
 //
 std::vector<boost::filesystem::path> GetDefaultTrustedDirectories();
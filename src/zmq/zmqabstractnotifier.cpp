@@ -11,12 +11,17 @@ CZMQAbstractNotifier::~CZMQAbstractNotifier()
     assert(!psocket);
 }
 
-bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/)
+bool CZMQAbstractNotifier::NotifyBlock(const CNotification &/*block*/)
 {
     return true;
 }
 
-bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/)
+bool CZMQAbstractNotifier::NotifyTransaction(const CNotification &/*transaction*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyMempool(const CNotification &/*event*/)
 {
     return true;
 }
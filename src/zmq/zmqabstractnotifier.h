@@ -7,7 +7,7 @@
 
 #include "zmqconfig.h"
 
-class CBlockIndex;
+struct CNotification;
 class CZMQAbstractNotifier;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
@@ -32,8 +32,9 @@ public:
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyTransaction(const CTransaction &transaction);
+    virtual bool NotifyBlock(const CNotification &block);
+    virtual bool NotifyTransaction(const CNotification &transaction);
+    virtual bool NotifyMempool(const CNotification &event);
 
 protected:
     void *psocket;
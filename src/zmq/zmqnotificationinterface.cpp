@@ -5,9 +5,6 @@
 #include "zmqnotificationinterface.h"
 #include "zmqpublishnotifier.h"
 
-#include "version.h"
-#include "main.h"
-#include "streams.h"
 #include "util.h"
 
 void zmqError(const char *str)
@@ -39,6 +36,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubmempoolsequence"] = CZMQAbstractNotifier::Create<CZMQPublishMempoolSequenceNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -124,29 +122,57 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+bool CZMQNotificationInterface::WantsRawBlocks() const
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    for (std::list<CZMQAbstractNotifier*>::const_iterator i = notifiers.begin(); i!=notifiers.end(); ++i)
     {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
+        if ((*i)->GetType() == "pubrawblock")
+            return true;
+    }
+    return false;
+}
+
+bool CZMQNotificationInterface::WantsRawTransactions() const
+{
+    for (std::list<CZMQAbstractNotifier*>::const_iterator i = notifiers.begin(); i!=notifiers.end(); ++i)
+    {
+        if ((*i)->GetType() == "pubrawtx")
+            return true;
+    }
+    return false;
+}
+
+bool CZMQNotificationInterface::WantsMempoolEvents() const
+{
+    for (std::list<CZMQAbstractNotifier*>::const_iterator i = notifiers.begin(); i!=notifiers.end(); ++i)
+    {
+        if ((*i)->GetType() == "pubmempoolsequence")
+            return true;
+    }
+    return false;
+}
+
+static bool Notify(CZMQAbstractNotifier *notifier, const CNotification &notification)
+{
+    switch (notification.type) {
+    case NOTIFY_BLOCK:
+        return notifier->NotifyBlock(notification);
+    case NOTIFY_MEMPOOL:
+        return notifier->NotifyMempool(notification);
+    default:
+        return notifier->NotifyTransaction(notification);
     }
 }
 
-void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+void CZMQNotificationInterface::Publish(const std::vector<CNotification> &vNotifications)
 {
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
+        bool fOk = true;
+        for (std::vector<CNotification>::const_iterator it = vNotifications.begin(); fOk && it != vNotifications.end(); ++it)
+            fOk = Notify(notifier, *it);
+        if (fOk)
         {
             i++;
         }
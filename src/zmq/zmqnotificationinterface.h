@@ -5,14 +5,13 @@
 #ifndef BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
-#include "validationinterface.h"
+#include "notificationdispatcher.h"
 #include <string>
 #include <map>
 
-class CBlockIndex;
 class CZMQAbstractNotifier;
 
-class CZMQNotificationInterface : public CValidationInterface
+class CZMQNotificationInterface : public CNotificationPublisher
 {
 public:
     virtual ~CZMQNotificationInterface();
@@ -23,9 +22,11 @@ protected:
     bool Initialize();
     void Shutdown();
 
-    // CValidationInterface
-    void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
-    void UpdatedBlockTip(const CBlockIndex *pindex);
+    // CNotificationPublisher
+    bool WantsRawBlocks() const;
+    bool WantsRawTransactions() const;
+    bool WantsMempoolEvents() const;
+    void Publish(const std::vector<CNotification> &vNotifications);
 
 private:
     CZMQNotificationInterface();
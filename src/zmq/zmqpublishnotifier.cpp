@@ -3,7 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "zmqpublishnotifier.h"
-#include "main.h"
+#include "notificationdispatcher.h"
 #include "util.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
@@ -12,6 +12,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_MEMPOOLSEQUENCE = "mempoolsequence";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -139,51 +140,48 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CNotification &block)
 {
-    uint256 hash = pindex->GetBlockHash();
-    LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
+    LogPrint("zmq", "zmq: Publish hashblock %s\n", block.hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
+        data[31 - i] = block.hash.begin()[i];
     return SendMessage(MSG_HASHBLOCK, data, 32);
 }
 
-bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CNotification &transaction)
 {
-    uint256 hash = transaction.GetHash();
-    LogPrint("zmq", "zmq: Publish hashtx %s\n", hash.GetHex());
+    LogPrint("zmq", "zmq: Publish hashtx %s\n", transaction.hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
-        data[31 - i] = hash.begin()[i];
+        data[31 - i] = transaction.hash.begin()[i];
     return SendMessage(MSG_HASHTX, data, 32);
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CNotification &block)
 {
-    LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
-
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
+    LogPrint("zmq", "zmq: Publish rawblock %s\n", block.hash.GetHex());
+    if (!block.raw) {
+        zmqError("Block not available on disk");
+        return false;
     }
+    return SendMessage(MSG_RAWBLOCK, block.raw->data(), block.raw->size());
+}
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CNotification &transaction)
+{
+    LogPrint("zmq", "zmq: Publish rawtx %s\n", transaction.hash.GetHex());
+    return SendMessage(MSG_RAWTX, transaction.raw->data(), transaction.raw->size());
 }
 
-bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishMempoolSequenceNotifier::NotifyMempool(const CNotification &event)
 {
-    uint256 hash = transaction.GetHash();
-    LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    LogPrint("zmq", "zmq: Publish mempoolsequence %s %c %u\n", event.hash.GetHex(), event.chMempoolEvent, event.nMempoolSequence);
+    /* txid as in hashtx, the event label and a LE 8byte mempool sequence number */
+    unsigned char data[32 + 1 + sizeof(uint64_t)];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = event.hash.begin()[i];
+    data[32] = event.chMempoolEvent;
+    WriteLE64(&data[33], event.nMempoolSequence);
+    return SendMessage(MSG_MEMPOOLSEQUENCE, data, sizeof(data));
 }
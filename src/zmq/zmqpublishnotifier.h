@@ -7,8 +7,6 @@
 
 #include "zmqabstractnotifier.h"
 
-class CBlockIndex;
-
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
@@ -31,25 +29,31 @@ public:
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CNotification &block);
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CNotification &transaction);
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CNotification &block);
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CNotification &transaction);
+};
+
+class CZMQPublishMempoolSequenceNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyMempool(const CNotification &event);
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H